@@ -0,0 +1,184 @@
+//===- FuzzerAsyncWriter.cpp - Background artifact writer -----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// The writer thread used by -async_writes=1.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerAsyncWriter.h"
+#include "FuzzerIO.h"
+#include "FuzzerUtil.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+namespace fuzzer {
+
+// How long the writer waits before retrying a write that hit a full disk.
+static const std::chrono::seconds kDiskFullRetryInterval(1);
+
+static bool IsDiskFull(int Err) {
+#ifdef EDQUOT
+  if (Err == EDQUOT) return true;
+#endif
+  return Err == ENOSPC;
+}
+
+bool AsyncWriter::Start(size_t MaxBytes, const std::string &PackPath,
+                        size_t BatchUnits, std::chrono::milliseconds BatchWait,
+                        bool Sync) {
+  assert(!IsRunning());
+  if (!PackPath.empty()) {
+    Pack = fopen(PackPath.c_str(), "ab");
+    if (!Pack) {
+      Printf("ERROR: can't open the artifact pack %s: %s\n", PackPath.c_str(),
+             strerror(errno));
+      return false;
+    }
+    // Every record goes out in one fwrite(), so a failed one can be cut off.
+    setvbuf(Pack, nullptr, _IONBF, 0);
+  }
+  MaxQueuedBytes = MaxBytes;
+  this->BatchUnits = std::max<size_t>(BatchUnits, 1);
+  this->BatchWait = BatchWait;
+  this->Sync = Sync;
+  Exiting = false;
+  Writer = std::thread(&AsyncWriter::WriterLoop, this);
+  return true;
+}
+
+void AsyncWriter::Stop() {
+  if (!IsRunning()) return;
+  {
+    std::lock_guard<std::mutex> Lock(Mu);
+    Exiting = true;
+  }
+  CV.notify_one();
+  Writer.join();
+  if (Pack) fclose(Pack);
+  Pack = nullptr;
+}
+
+bool AsyncWriter::Write(const Unit &U, const std::string &Path, bool ToPack) {
+  {
+    std::lock_guard<std::mutex> Lock(Mu);
+    if (QueuedBytes + U.size() > MaxQueuedBytes && !Queue.empty()) {
+      Dropped++;
+      return false;
+    }
+    if (Queue.empty())
+      FirstQueued = std::chrono::steady_clock::now();
+    Queue.push_back({Path, U, ToPack});
+    QueuedBytes += U.size();
+    // A batch in the making needs no wakeup until it is complete.
+    if (Queue.size() != 1 && Queue.size() < BatchUnits)
+      return true;
+  }
+  CV.notify_one();
+  return true;
+}
+
+size_t AsyncWriter::NumDropped() {
+  std::lock_guard<std::mutex> Lock(Mu);
+  return Dropped;
+}
+
+size_t AsyncWriter::NumWritten() {
+  std::lock_guard<std::mutex> Lock(Mu);
+  return Written;
+}
+
+size_t AsyncWriter::NumBatches() {
+  std::lock_guard<std::mutex> Lock(Mu);
+  return Batches;
+}
+
+int AsyncWriter::WriteItem(const Item &It) {
+  if (Pack && It.ToPack) {
+    std::string Record = It.Path.substr(It.Path.find_last_of("/\\") + 1) +
+                         " " + std::to_string(It.U.size()) + "\n";
+    Record.append(It.U.begin(), It.U.end());
+    fseek(Pack, 0, SEEK_END);
+    long End = ftell(Pack);
+    if (fwrite(Record.data(), 1, Record.size(), Pack) == Record.size())
+      return 0;
+    int Err = errno;
+    // Drop the torn record, which will be written again in full.
+    clearerr(Pack);
+    if (End >= 0) TruncateFile(fileno(Pack), End);
+    return Err;
+  }
+  FILE *Out = fopen(It.Path.c_str(), "wb");
+  if (!Out) return errno;
+  bool Ok = fwrite(It.U.data(), 1, It.U.size(), Out) == It.U.size();
+  if (Ok && Sync)
+    Ok = !fflush(Out) && SyncFile(fileno(Out));
+  int Err = Ok ? 0 : errno;
+  if (fclose(Out) && !Err) Err = errno;
+  if (Err)
+    RemoveFile(It.Path);
+  else if (Sync)
+    DirtyDirs.insert(DirName(It.Path));
+  return Err;
+}
+
+void AsyncWriter::SyncBatch() {
+  if (!Sync) return;
+  if (Pack && !SyncFile(fileno(Pack)))
+    Printf("WARNING: can't sync the artifact pack: %s\n", strerror(errno));
+  for (auto &Dir : DirtyDirs)
+    SyncDir(Dir);
+  DirtyDirs.clear();
+}
+
+void AsyncWriter::WriterLoop() {
+  BlockAlarmSignalForCurrentThread();
+  std::unique_lock<std::mutex> Lock(Mu);
+  while (true) {
+    CV.wait(Lock, [&] { return Exiting || !Queue.empty(); });
+    if (Queue.empty()) return;
+    if (BatchUnits > 1)
+      CV.wait_until(Lock, FirstQueued + BatchWait, [&] {
+        return Exiting || Queue.size() >= BatchUnits;
+      });
+    // Units queued while the batch is written wait for the next one.
+    size_t N = Queue.size();
+    size_t WrittenInBatch = 0;
+    while (N) {
+      // The unit stays queued, and counted, until it is on disk.
+      const Item &It = Queue.front();
+      Lock.unlock();
+      int Err = WriteItem(It);
+      Lock.lock();
+      if (IsDiskFull(Err) && !Exiting) {
+        CV.wait_for(Lock, kDiskFullRetryInterval, [&] { return Exiting; });
+        continue;
+      }
+      if (Err) {
+        Printf("WARNING: can't write %s: %s\n", It.Path.c_str(),
+               strerror(Err));
+        Dropped++;
+      } else {
+        WrittenInBatch++;
+      }
+      QueuedBytes -= It.U.size();
+      Queue.pop_front();
+      N--;
+    }
+    // With Sync the units are only on disk once their directories are.
+    Lock.unlock();
+    SyncBatch();
+    Lock.lock();
+    Written += WrittenInBatch;
+    Batches++;
+    if (!Queue.empty())
+      FirstQueued = std::chrono::steady_clock::now();
+  }
+}
+
+}  // namespace fuzzer
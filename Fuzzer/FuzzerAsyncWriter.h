@@ -0,0 +1,95 @@
+//===- FuzzerAsyncWriter.h - Background artifact writer ---------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::AsyncWriter
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_ASYNC_WRITER_H
+#define LLVM_FUZZER_ASYNC_WRITER_H
+
+#include "FuzzerDefs.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+namespace fuzzer {
+
+// Writes units to files from a thread of its own, so that a burst of new
+// diffs does not stall the fuzzing thread behind the disk. With a pack path,
+// the units written with ToPack go to that one append-only file instead, each
+// preceded by a "<file name> <size>\n" header line.
+//
+// The queue holds at most MaxQueuedBytes of units. While the disk is full the
+// writer retries the oldest unit once a second; if the queue fills up in the
+// meantime, new units are dropped and counted instead of blocking.
+//
+// With BatchUnits > 1 the writer waits until that many units are queued, or
+// until the first of them has waited BatchWait, and writes them together.
+// With Sync, every file is fsync()ed before it is closed, and the pack and
+// the directories of the files once at the end of each batch, so that the
+// metadata of a burst of units is flushed once instead of once per unit. The
+// units of a batch are counted as written once all of this is done.
+class AsyncWriter {
+ public:
+  ~AsyncWriter() { Stop(); }
+
+  bool Start(size_t MaxQueuedBytes, const std::string &PackPath,
+             size_t BatchUnits = 1,
+             std::chrono::milliseconds BatchWait = {}, bool Sync = false);
+  // Writes out the queued units and joins the writer thread.
+  void Stop();
+  bool IsRunning() const { return Writer.joinable(); }
+
+  // Returns false if the unit was dropped because the queue is full.
+  bool Write(const Unit &U, const std::string &Path, bool ToPack);
+
+  size_t NumDropped();
+  size_t NumWritten();
+  size_t NumBatches();
+
+ private:
+  struct Item {
+    std::string Path;
+    Unit U;
+    bool ToPack;
+  };
+
+  void WriterLoop();
+  // Returns 0 or the errno of the failed write.
+  int WriteItem(const Item &It);
+  // Flushes the pack and the directories written to since the last call.
+  void SyncBatch();
+
+  std::mutex Mu;
+  std::condition_variable CV;
+  std::deque<Item> Queue;
+  size_t QueuedBytes = 0;
+  size_t MaxQueuedBytes = 0;
+  size_t Dropped = 0;
+  size_t Written = 0;
+  size_t Batches = 0;
+  size_t BatchUnits = 1;
+  std::chrono::milliseconds BatchWait{0};
+  bool Sync = false;
+  // When the oldest unit in the queue was queued.
+  std::chrono::steady_clock::time_point FirstQueued;
+  std::set<std::string> DirtyDirs;  // Used by the writer thread only.
+  bool Exiting = false;
+  FILE *Pack = nullptr;
+  std::thread Writer;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_ASYNC_WRITER_H
@@ -0,0 +1,170 @@
+//===- FuzzerBenchmark.cpp - Benchmarks of the diff hot path --------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Measuring the throughput of the differential execution hot path.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerExtFunctions.h"
+#include "FuzzerHash.h"
+#include "FuzzerInternal.h"
+#include "FuzzerMutate.h"
+#include "FuzzerSHA1.h"
+#include "FuzzerTracePC.h"
+
+#include <chrono>
+#include <string>
+
+namespace fuzzer {
+
+namespace {
+// Ops run between two reads of the clock.
+const size_t kOpsPerClockRead = 16;
+
+// Keeps the compiler from dropping the feature walk.
+volatile size_t FeatureSink;
+volatile uint64_t HashSink;
+
+// Runs Op(i) for i = 0, 1, ... for about Millis milliseconds, after one
+// warm-up call, and prints one line in a format that scripts can rely on:
+//   BENCHMARK: <name> <ops> ops <ns> ns/op <rate> execs/s
+template <class Callback>
+void Benchmark(const std::string &Name, int Millis, Callback Op) {
+  Op(0);
+  auto Budget = milliseconds(Millis);
+  auto Start = steady_clock::now();
+  steady_clock::duration Elapsed;
+  size_t Ops = 0;
+  do {
+    for (size_t i = 0; i < kOpsPerClockRead; i++)
+      Op(Ops + i);
+    Ops += kOpsPerClockRead;
+    Elapsed = steady_clock::now() - Start;
+  } while (Elapsed < Budget);
+  double NsPerOp = duration<double, std::nano>(Elapsed).count() / Ops;
+  Printf("BENCHMARK: %-36s %10zd ops %12.1f ns/op %14.1f execs/s\n",
+         Name.c_str(), Ops, NsPerOp, 1e9 / NsPerOp);
+}
+
+// SHA1 names the units written to disk, Hash128 tells in-memory ones apart.
+template <class DataOf>
+void BenchmarkHashes(const std::string &What, int Millis, DataOf Data) {
+  Benchmark("ComputeSHA1/" + What, Millis, [&](size_t i) {
+    const Unit &U = Data(i);
+    uint8_t Sha1[kSHA1NumBytes];
+    ComputeSHA1(U.data(), U.size(), Sha1);
+    HashSink = Sha1[0];
+  });
+  Benchmark("Hash128/" + What, Millis, [&](size_t i) {
+    const Unit &U = Data(i);
+    HashSink = Hash128(U.data(), U.size()).Lo;
+  });
+}
+}  // namespace
+
+// Times the pieces of a differential run on the units of Inputs, cycling
+// through them: RunOne with the first 2, 4 and 8 callbacks (when the target
+// has that many) and with all of them, the coverage bookkeeping, the diff
+// fingerprinting of DumpUnitIfDiff, the hashes and the mutators.
+void Fuzzer::RunBenchmarks(const UnitVector &Inputs, int Millis) {
+  assert(Options.DifferentialMode && !Inputs.empty());
+  size_t N = Inputs.size();
+  auto Input = [&](size_t i) -> const Unit & { return Inputs[i % N]; };
+  Printf("INFO: benchmarking on %zd inputs, %d ms each\n", N, Millis);
+
+  int NumCallbacks = TPC.UC->size;
+  bool Serial = !DiffWorkers.IsRunning() && !DiffForkServer.IsRunning() &&
+                !Options.DiffFused;
+  for (int K : {2, 4, 8, NumCallbacks}) {
+    if (K > NumCallbacks || (K < NumCallbacks && !Serial)) continue;
+    // Serial runs only look at the first UC->size callbacks.
+    TPC.UC->size = K;
+    TPC.OutputDiffVec.resize(K);
+    Benchmark("RunOne/" + std::to_string(K) + "-callbacks", Millis,
+              [&](size_t i) {
+                const Unit &U = Input(i);
+                RunOne(U.data(), U.size());
+              });
+    TPC.UC->size = NumCallbacks;
+    TPC.OutputDiffVec.resize(NumCallbacks);
+    if (K == NumCallbacks) break;
+  }
+
+  // The coverage of one run of every callback on the first input.
+  const Unit &First = Input(0);
+  TPC.ResetCoverage();
+  for (int i = 0; i < NumCallbacks; i++) {
+    CB = TPC.UC->callbacks[i];
+    TPC.SelectValueProfileMap(i);
+    TPC.OutputDiffVec[i] = ExecuteCallback(First.data(), First.size());
+  }
+  TPC.SelectValueProfileMap(0);
+  std::vector<uint8_t> Coverage(TPC.MaxExportedCoverageSize());
+  Coverage.resize(TPC.ExportCoverage(Coverage.data(), Coverage.size()));
+
+  size_t NumFeatures = 0;
+  TPC.CollectFeatures([&](size_t) {
+    NumFeatures++;
+    return true;
+  });
+  Printf("INFO: the first input has %zd features\n", NumFeatures);
+  Benchmark("TracePC::CollectFeatures", Millis, [&](size_t) {
+    TPC.CollectFeatures([&](size_t Feature) {
+      FeatureSink = Feature;
+      return true;
+    });
+  });
+  Benchmark("TracePC::ImportCoverage", Millis, [&](size_t) {
+    TPC.ImportCoverage(Coverage.data(), Coverage.size());
+  });
+  // Subtract the line above to get ResetCoverage() of one run's coverage.
+  Benchmark("TracePC::ImportCoverage+ResetCoverage", Millis, [&](size_t) {
+    TPC.ImportCoverage(Coverage.data(), Coverage.size());
+    TPC.ResetCoverage();
+  });
+
+  BenchmarkHashes("inputs", Millis, Input);
+  BenchmarkHashes("coverage", Millis,
+                  [&](size_t) -> const Unit & { return Coverage; });
+
+  // Let the first callback accept and the others reject, so that every call
+  // fingerprints the run and, after the first one, finds a duplicate.
+  if (NumCallbacks > 1) {
+    TPC.ImportCoverage(Coverage.data(), Coverage.size());
+    for (int i = 0; i < NumCallbacks; i++)
+      TPC.OutputDiffVec[i] = i > 0;
+    TPC.NewOutputDiff_change();
+    Benchmark("Fuzzer::DumpUnitIfDiff", Millis, [&](size_t) {
+      DumpUnitIfDiff(First.data(), First.size());
+    });
+    TPC.ResetCoverage();
+  }
+
+  std::vector<uint8_t> Buf(MaxMutationLen);
+  auto Mutate = [&](size_t i, size_t (MutationDispatcher::*M)(
+                                  uint8_t *, size_t, size_t)) {
+    const Unit &U = Input(i);
+    size_t Size = std::min(U.size(), Buf.size());
+    memcpy(Buf.data(), U.data(), Size);
+    MD.StartMutationSequence();
+    (MD.*M)(Buf.data(), Size, Buf.size());
+  };
+  Benchmark("MutationDispatcher::Mutate", Millis,
+            [&](size_t i) { Mutate(i, &MutationDispatcher::Mutate); });
+  Benchmark("MutationDispatcher::DefaultMutate", Millis,
+            [&](size_t i) { Mutate(i, &MutationDispatcher::DefaultMutate); });
+  if (EF->LLVMFuzzerCustomMutator)
+    Benchmark("LLVMFuzzerCustomMutator", Millis, [&](size_t i) {
+      const Unit &U = Input(i);
+      size_t Size = std::min(U.size(), Buf.size());
+      memcpy(Buf.data(), U.data(), Size);
+      EF->LLVMFuzzerCustomMutator(Buf.data(), Size, Buf.size(),
+                                  static_cast<unsigned>(i));
+    });
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,115 @@
+//===- FuzzerCheckpoint.cpp - Dedup state across restarts -----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// -diff_checkpoint: saving and restoring the tables that tell new diffs from
+// the ones a campaign has already seen.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerIO.h"
+#include "FuzzerInternal.h"
+#include "FuzzerTracePC.h"
+
+#include <cstring>
+
+namespace fuzzer {
+
+namespace {
+const uint64_t kCheckpointMagic = 0x31305450434b4346ULL;  // "FCKPCT01"
+
+// The header of a checkpoint: the magic, the number of callbacks and the
+// counters, followed by hashMap, CoverageHash and the two signature sets.
+struct CheckpointHeader {
+  uint64_t Magic;
+  uint64_t NumCallbacks;
+  uint64_t Duplicate;
+  uint64_t NumberOfDuplicate;
+  uint64_t NumberOfDiffUnitsAdded;
+  uint64_t NumberofValidCases;
+};
+}  // namespace
+
+// Called before the seed corpus runs, so that its diffs count as seen.
+void Fuzzer::LoadDiffCheckpoint() {
+  LastDiffCheckpoint = steady_clock::now();
+  if (Options.DiffCheckpoint.empty() || !Options.DifferentialMode) return;
+  size_t Size = 0;
+  const uint8_t *Data = MapFile(Options.DiffCheckpoint, &Size);
+  if (!Data) {
+    Printf("INFO: no checkpoint in %s yet\n", Options.DiffCheckpoint.c_str());
+    return;
+  }
+  CheckpointHeader H;
+  const uint8_t *P = Data + sizeof(H), *End = Data + Size;
+  bool Ok = Size >= sizeof(H);
+  if (Ok) {
+    memcpy(&H, Data, sizeof(H));
+    Ok = H.Magic == kCheckpointMagic &&
+         H.NumCallbacks == static_cast<uint64_t>(TPC.UC->size);
+  }
+  // A set saved with other -dedup_* flags is left out, not the whole file.
+  bool Complete = Ok;
+  for (DigestSet *S : {&hashMap, &CoverageHash})
+    Complete &= Ok && S->Load(&P, End);
+  for (SignatureSet *S :
+       {TPC.TraceDiffSignatures(), TPC.OutputDiffSignatures()})
+    Complete &= Ok && S->Load(&P, End);
+  UnmapFile(Data, Size);
+  if (!Ok) {
+    Printf("WARNING: %s is not a checkpoint of this target, ignoring it\n",
+           Options.DiffCheckpoint.c_str());
+    return;
+  }
+  Duplicate += H.Duplicate;
+  NumberOfDuplicate += H.NumberOfDuplicate;
+  NumberOfDiffUnitsAdded += H.NumberOfDiffUnitsAdded;
+  NumberofValidCases += H.NumberofValidCases;
+  Printf("INFO: loaded checkpoint %s: %zd diffs, %zd duplicates%s\n",
+         Options.DiffCheckpoint.c_str(), CoverageHash.size(), Duplicate,
+         Complete ? "" : " (partially)");
+}
+
+// Writes the checkpoint next to the old one and renames it over it, so a
+// crash while saving keeps the previous checkpoint.
+bool Fuzzer::SaveDiffCheckpoint() {
+  if (Options.DiffCheckpoint.empty() || !Options.DifferentialMode)
+    return false;
+  CheckpointHeader H = {kCheckpointMagic,
+                        static_cast<uint64_t>(TPC.UC->size),
+                        Duplicate,
+                        NumberOfDuplicate + Pipeline.NumDuplicates(),
+                        NumberOfDiffUnitsAdded,
+                        NumberofValidCases};
+  const uint8_t *B = reinterpret_cast<const uint8_t *>(&H);
+  Unit U(B, B + sizeof(H));
+  for (DigestSet *S : {&hashMap, &CoverageHash})
+    S->Save(&U);
+  for (SignatureSet *S :
+       {TPC.TraceDiffSignatures(), TPC.OutputDiffSignatures()})
+    S->Save(&U);
+  std::string Tmp = Options.DiffCheckpoint + ".tmp";
+  WriteToFile(U, Tmp);
+  if (!RenameFile(Tmp, Options.DiffCheckpoint)) {
+    Printf("WARNING: can't save checkpoint %s\n",
+           Options.DiffCheckpoint.c_str());
+    RemoveFile(Tmp);
+    return false;
+  }
+  LastDiffCheckpoint = steady_clock::now();
+  return true;
+}
+
+void Fuzzer::MaybeSaveDiffCheckpoint() {
+  if (Options.DiffCheckpoint.empty() || Options.DiffCheckpointIntervalSec <= 0)
+    return;
+  if (steady_clock::now() - LastDiffCheckpoint <
+      seconds(Options.DiffCheckpointIntervalSec))
+    return;
+  SaveDiffCheckpoint();
+}
+
+}  // namespace fuzzer
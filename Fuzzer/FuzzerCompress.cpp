@@ -0,0 +1,212 @@
+//===- FuzzerCompress.cpp - A small LZ77 compressor -----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Compress() and Decompress(), see FuzzerCompress.h.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerCompress.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace fuzzer {
+
+namespace {
+const size_t kMinMatch = 4;
+const size_t kMaxOffset = 65535;
+const size_t kHashBits = 14;
+// TrainDictionary() scores segments of kSegment bytes by their kDmer-byte
+// strings and looks at no more than kMaxTrainingBytes of the samples.
+const size_t kDmer = 8;
+const size_t kSegment = 64;
+const size_t kMaxTrainingBytes = 1 << 22;
+
+void WriteLength(std::vector<uint8_t> *Out, size_t N) {
+  for (; N >= 255; N -= 255)
+    Out->push_back(255);
+  Out->push_back(static_cast<uint8_t>(N));
+}
+
+bool ReadLength(const uint8_t **In, const uint8_t *End, size_t *N) {
+  uint8_t B;
+  do {
+    if (*In == End) return false;
+    B = *(*In)++;
+    *N += B;
+  } while (B == 255);
+  return true;
+}
+
+// Literals, then a match of MatchLen bytes at Offset unless MatchLen is 0.
+void WriteSequence(std::vector<uint8_t> *Out, const uint8_t *Literals,
+                   size_t NumLiterals, size_t Offset, size_t MatchLen) {
+  size_t M = MatchLen ? MatchLen - kMinMatch : 0;
+  Out->push_back(static_cast<uint8_t>((Min(NumLiterals, (size_t)15) << 4) |
+                                      Min(M, (size_t)15)));
+  if (NumLiterals >= 15)
+    WriteLength(Out, NumLiterals - 15);
+  Out->insert(Out->end(), Literals, Literals + NumLiterals);
+  if (!MatchLen) return;
+  Out->push_back(static_cast<uint8_t>(Offset));
+  Out->push_back(static_cast<uint8_t>(Offset >> 8));
+  if (M >= 15)
+    WriteLength(Out, M - 15);
+}
+}  // namespace
+
+// Compresses Buf[Start, Size), with Buf[0, Start) as the dictionary.
+static std::vector<uint8_t> CompressFrom(const uint8_t *Buf, size_t Size,
+                                         size_t Start) {
+  std::vector<uint8_t> Out;
+  Out.reserve((Size - Start) / 2 + 16);
+  // Position + 1 of the last occurrence of every hashed 4-byte string.
+  std::vector<uint32_t> Table(1 << kHashBits, 0);
+  auto Hash = [&](size_t i) {
+    uint32_t V;
+    memcpy(&V, Buf + i, sizeof(V));
+    return (V * 2654435761U) >> (32 - kHashBits);
+  };
+  for (size_t i = 0; i + kMinMatch <= Start; i++)
+    Table[Hash(i)] = static_cast<uint32_t>(i + 1);
+  size_t Anchor = Start, i = Start;
+  while (i + kMinMatch <= Size) {
+    uint32_t H = Hash(i);
+    size_t Candidate = Table[H];
+    Table[H] = static_cast<uint32_t>(i + 1);
+    if (!Candidate || i + 1 - Candidate > kMaxOffset ||
+        memcmp(Buf + Candidate - 1, Buf + i, kMinMatch)) {
+      i++;
+      continue;
+    }
+    size_t Match = Candidate - 1;
+    size_t Len = kMinMatch;
+    while (i + Len < Size && Buf[Match + Len] == Buf[i + Len])
+      Len++;
+    WriteSequence(&Out, Buf + Anchor, i - Anchor, i - Match, Len);
+    i += Len;
+    Anchor = i;
+  }
+  WriteSequence(&Out, Buf + Anchor, Size - Anchor, 0, 0);
+  return Out;
+}
+
+std::vector<uint8_t> Compress(const uint8_t *Data, size_t Size,
+                              const uint8_t *Dict, size_t DictSize) {
+  if (!DictSize)
+    return CompressFrom(Data, Size, 0);
+  std::vector<uint8_t> Buf(Dict, Dict + DictSize);
+  Buf.insert(Buf.end(), Data, Data + Size);
+  return CompressFrom(Buf.data(), Buf.size(), DictSize);
+}
+
+bool Decompress(const uint8_t *In, size_t Size, size_t RawSize,
+                std::vector<uint8_t> *Out, const uint8_t *Dict,
+                size_t DictSize) {
+  const uint8_t *End = In + Size;
+  Out->clear();
+  Out->reserve(RawSize);
+  while (In != End) {
+    uint8_t Token = *In++;
+    size_t NumLiterals = Token >> 4;
+    if (NumLiterals == 15 && !ReadLength(&In, End, &NumLiterals))
+      return false;
+    if (NumLiterals > static_cast<size_t>(End - In) ||
+        NumLiterals > RawSize - Out->size())
+      return false;
+    Out->insert(Out->end(), In, In + NumLiterals);
+    In += NumLiterals;
+    if (Out->size() == RawSize)
+      return In == End;  // The last sequence.
+    if (End - In < 2) return false;
+    size_t Offset = In[0] | (In[1] << 8);
+    In += 2;
+    size_t Len = Token & 15;
+    if (Len == 15 && !ReadLength(&In, End, &Len))
+      return false;
+    Len += kMinMatch;
+    if (!Offset || Offset > Out->size() + DictSize ||
+        Len > RawSize - Out->size())
+      return false;
+    // Matches may start in the dictionary, which precedes the output, and
+    // may overlap the bytes they produce.
+    size_t From = Out->size() + DictSize - Offset;
+    for (; Len && From < DictSize; Len--)
+      Out->push_back(Dict[From++]);
+    for (From -= DictSize; Len; Len--)
+      Out->push_back((*Out)[From++]);
+  }
+  return false;
+}
+
+std::vector<uint8_t>
+TrainDictionary(const std::vector<std::pair<const uint8_t *, size_t>> &Samples,
+                size_t MaxSize) {
+  std::vector<uint8_t> All;
+  for (auto &S : Samples) {
+    if (All.size() + S.second > kMaxTrainingBytes) break;
+    All.insert(All.end(), S.first, S.first + S.second);
+  }
+  std::vector<uint8_t> Dict;
+  if (All.size() < kSegment || MaxSize < kSegment) return Dict;
+  auto Dmer = [&](size_t i) {
+    uint64_t V;
+    memcpy(&V, All.data() + i, sizeof(V));
+    return V;
+  };
+  // How many samples every string is in.
+  std::unordered_map<uint64_t, uint32_t> Freq;
+  std::unordered_set<uint64_t> InSample;
+  size_t Begin = 0;
+  for (auto &S : Samples) {
+    if (Begin + S.second > All.size()) break;
+    InSample.clear();
+    for (size_t i = Begin; i + kDmer <= Begin + S.second; i++)
+      if (InSample.insert(Dmer(i)).second)
+        Freq[Dmer(i)]++;
+    Begin += S.second;
+  }
+  auto Score = [&](size_t i) -> uint64_t {
+    auto It = Freq.find(Dmer(i));
+    // Strings of a single sample would not help compress any other.
+    return It == Freq.end() || It->second < 2 ? 0 : It->second;
+  };
+  size_t NumEpochs = std::max<size_t>(1, MaxSize / kSegment);
+  size_t EpochSize = std::max(All.size() / NumEpochs, kSegment);
+  const size_t kDmersPerSegment = kSegment - kDmer + 1;
+  std::vector<std::pair<uint64_t, size_t>> Best;
+  for (size_t E = 0; E + kSegment <= All.size(); E += EpochSize) {
+    size_t EpochEnd = std::min(E + EpochSize, All.size());
+    // Slide a segment over the epoch, keeping the score of its strings.
+    uint64_t Sum = 0, BestSum = 0;
+    size_t BestPos = E;
+    for (size_t i = E; i + kDmer <= EpochEnd; i++) {
+      Sum += Score(i);
+      if (i >= E + kDmersPerSegment)
+        Sum -= Score(i - kDmersPerSegment);
+      if (i + 1 >= E + kDmersPerSegment && Sum > BestSum) {
+        BestSum = Sum;
+        BestPos = i + 1 - kDmersPerSegment;
+      }
+    }
+    if (!BestSum) continue;
+    Best.push_back({BestSum, BestPos});
+    for (size_t i = BestPos; i < BestPos + kDmersPerSegment; i++)
+      Freq.erase(Dmer(i));
+  }
+  // The best segments go last, where Compress() finds them at the
+  // smallest offsets.
+  std::sort(Best.begin(), Best.end());
+  size_t First = Best.size() - std::min(Best.size(), MaxSize / kSegment);
+  for (size_t i = First; i < Best.size(); i++)
+    Dict.insert(Dict.end(), All.begin() + Best[i].second,
+                All.begin() + Best[i].second + kSegment);
+  return Dict;
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,54 @@
+//===- FuzzerCompress.h - Internal header for compression -------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// A small LZ77 compressor, to keep libFuzzer free of external dependencies.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_COMPRESS_H
+#define LLVM_FUZZER_COMPRESS_H
+
+#include "FuzzerDefs.h"
+
+#include <utility>
+#include <vector>
+
+namespace fuzzer {
+
+// The format is that of an LZ4 block: sequences of a token (literal length
+// and match length in a nibble each, longer lengths continued in bytes of
+// 255), the literals, and a two-byte little-endian match offset; the last
+// sequence has literals only. It is fast on both ends and does well on the
+// repetitive structure of protocol messages; it is not meant to compete
+// with zlib on ratio.
+//
+// With a dictionary, the data is compressed as if it followed the
+// dictionary, so that matches can refer to it; Decompress() needs the same
+// dictionary. It should be no larger than 32 KB, for the matches to reach
+// all of it from the start of data no larger than that.
+std::vector<uint8_t> Compress(const uint8_t *Data, size_t Size,
+                              const uint8_t *Dict = nullptr,
+                              size_t DictSize = 0);
+
+// Decompresses the output of Compress() of RawSize bytes into *Out. Returns
+// false, and leaves *Out unspecified, if In is not such an output.
+bool Decompress(const uint8_t *In, size_t Size, size_t RawSize,
+                std::vector<uint8_t> *Out, const uint8_t *Dict = nullptr,
+                size_t DictSize = 0);
+
+// Builds a dictionary of at most MaxSize bytes for many small, similar
+// inputs, the way the COVER algorithm of zstd does: the samples are split
+// into epochs, each of which contributes its segment whose 8-byte strings
+// are in the most samples, and the strings of a chosen segment no longer
+// count for the next ones.
+std::vector<uint8_t>
+TrainDictionary(const std::vector<std::pair<const uint8_t *, size_t>> &Samples,
+                size_t MaxSize);
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_COMPRESS_H
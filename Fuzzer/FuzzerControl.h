@@ -0,0 +1,47 @@
+//===- FuzzerControl.h - Commands to a running fuzzer -----------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::ControlChannel
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_CONTROL_H
+#define LLVM_FUZZER_CONTROL_H
+
+#include "FuzzerDefs.h"
+
+#include <string>
+#include <vector>
+
+namespace fuzzer {
+
+// The FIFO of -diff_control=PATH, created if it does not exist, through
+// which commands reach the fuzzing thread one line at a time, e.g.
+//   echo "reload 1" > PATH
+// Poll() never blocks, so the fuzzing thread checks it between units.
+class ControlChannel {
+ public:
+  ~ControlChannel() { Stop(); }
+
+  bool Start(const std::string &Path);
+  void Stop();
+  bool IsActive() const { return Fd >= 0; }
+
+  // Appends the lines completed since the last call to Commands, without
+  // their newlines. Returns true if there are any.
+  bool Poll(std::vector<std::string> *Commands);
+
+ private:
+  int Fd = -1;
+  std::string Path;
+  bool Created = false;  // The FIFO is removed again on Stop().
+  std::string Partial;   // The last line, until its newline arrives.
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_CONTROL_H
@@ -0,0 +1,76 @@
+//===- FuzzerControlPosix.cpp - Commands to a running fuzzer ----*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// ControlChannel
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if LIBFUZZER_POSIX
+
+#include "FuzzerControl.h"
+#include "FuzzerIO.h"
+
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fuzzer {
+
+bool ControlChannel::Start(const std::string &NewPath) {
+  Stop();
+  Path = NewPath;
+  Created = !mkfifo(Path.c_str(), 0600);
+  if (!Created && errno != EEXIST) {
+    Printf("WARNING: -diff_control: can't create %s: %s\n", Path.c_str(),
+           strerror(errno));
+    return false;
+  }
+  struct stat St;
+  if (stat(Path.c_str(), &St) || !S_ISFIFO(St.st_mode)) {
+    Printf("WARNING: -diff_control: %s is not a FIFO\n", Path.c_str());
+    return false;
+  }
+  // Opening for writing as well keeps the FIFO from reporting end of file
+  // whenever a writer goes away.
+  Fd = open(Path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (Fd < 0) {
+    Printf("WARNING: -diff_control: can't open %s: %s\n", Path.c_str(),
+           strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+void ControlChannel::Stop() {
+  if (Fd >= 0) close(Fd);
+  Fd = -1;
+  if (Created) unlink(Path.c_str());
+  Created = false;
+  Partial.clear();
+}
+
+bool ControlChannel::Poll(std::vector<std::string> *Commands) {
+  if (Fd < 0) return false;
+  size_t NumCommandsBefore = Commands->size();
+  char Buf[4096];
+  ssize_t N;
+  while ((N = read(Fd, Buf, sizeof(Buf))) > 0) {
+    Partial.append(Buf, N);
+    size_t Pos;
+    while ((Pos = Partial.find('\n')) != std::string::npos) {
+      Commands->push_back(Partial.substr(0, Pos));
+      Partial.erase(0, Pos + 1);
+    }
+  }
+  return Commands->size() != NumCommandsBefore;
+}
+
+}  // namespace fuzzer
+
+#endif  // LIBFUZZER_POSIX
@@ -0,0 +1,32 @@
+//===- FuzzerControlWindows.cpp - Commands to a running fuzzer --*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// ControlChannel
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if LIBFUZZER_WINDOWS
+
+#include "FuzzerControl.h"
+#include "FuzzerIO.h"
+
+namespace fuzzer {
+
+bool ControlChannel::Start(const std::string &NewPath) {
+  Printf("WARNING: -diff_control is not supported on Windows\n");
+  return false;
+}
+
+void ControlChannel::Stop() {}
+
+bool ControlChannel::Poll(std::vector<std::string> *Commands) {
+  return false;
+}
+
+}  // namespace fuzzer
+
+#endif  // LIBFUZZER_WINDOWS
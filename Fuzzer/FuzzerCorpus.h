@@ -12,20 +12,55 @@
 #ifndef LLVM_FUZZER_CORPUS
 #define LLVM_FUZZER_CORPUS
 
+#include "FuzzerCompress.h"
 #include "FuzzerDefs.h"
+#include "FuzzerDigestSet.h"
 #include "FuzzerIO.h"
 #include "FuzzerRandom.h"
+#include "FuzzerSampler.h"
 #include "FuzzerSHA1.h"
 #include "FuzzerTracePC.h"
+#include "FuzzerUtil.h"
 #include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <random>
-#include <unordered_set>
+#include <unordered_map>
 
 namespace fuzzer {
 
+// Read-only view of a unit stored in the corpus. It is invalidated when the
+// next unit is added to the corpus or when a unit is replaced or deleted.
+// The view of a compressed unit shares ownership of its decompressed copy
+// and stays valid as long as it is held.
+class UnitRef {
+ public:
+  UnitRef(const uint8_t *Data, size_t Size) : Data(Data), Size(Size) {}
+  explicit UnitRef(std::shared_ptr<const Unit> Copy)
+      : Data(Copy->data()), Size(Copy->size()), Copy(std::move(Copy)) {}
+  const uint8_t *data() const { return Data; }
+  size_t size() const { return Size; }
+  bool empty() const { return !Size; }
+  const uint8_t *begin() const { return Data; }
+  const uint8_t *end() const { return Data + Size; }
+
+ private:
+  const uint8_t *Data;
+  size_t Size;
+  std::shared_ptr<const Unit> Copy;
+};
+
 struct InputInfo {
-  Unit U;  // The actual input data.
+  // The actual input data and the feature set live in the arenas of the
+  // corpus, see InputCorpus::UnitOf() and InputCorpus::FeatureSetOf().
+  size_t Offset = 0, Size = 0;
+  // With -compress_corpus: the size of the unit compressed in the arena, or
+  // 0 if it is stored as is.
+  size_t PackedSize = 0;
+  size_t FeatureOffset = 0, FeatureSetSize = 0;
   uint8_t Sha1[kSHA1NumBytes];  // Checksum.
   // Number of features that this input has and no smaller input has.
   size_t NumFeatures = 0;
@@ -33,62 +68,294 @@ struct InputInfo {
   // Stats.
   size_t NumExecutedMutations = 0;
   size_t NumSuccessfullMutations = 0;
+  size_t NumDiffMutations = 0;  // Successful mutations that were diffs.
   bool MayDeleteFile = false;
-  std::vector<uint32_t> FeatureSet;
+  // Set for units that were added because the differential callbacks
+  // disagreed on them.
+  bool HasDiff = false;
+  uint64_t DiffMask = 0;  // Bit i: callback i rejected the input.
+  size_t DiffClass = 0;   // Index of its verdict pattern in DiffClasses.
+  // With -directed_targets: the mean call distance of its coverage to the
+  // targets, or -1 if it covers nothing that reaches them.
+  double TargetDistance = -1;
+  // With -cost_aware: how long the run that added it took, in ns, and the
+  // factor, in 1/InputCorpus::kCostWeightOne, that its weight gets for it.
+  uint64_t ExecNanos = 0;
+  uint32_t CostWeight = 16;
+  // With -diff_input_to_state: its operand substitutions have been run.
+  bool InputToStateDone = false;
+  // With -rare_edges: per differential callback, the feature of that
+  // callback this input hit least often when it was added (~0 if none), and
+  // the weight factor they give it.
+  std::vector<uint32_t> RarestFeatures;
+  uint32_t RareEdgeBoost = 1;
 };
 
 class InputCorpus {
   static const size_t kFeatureSetSize = 1 << 21;
  public:
   InputCorpus(const std::string &OutputCorpus) : OutputCorpus(OutputCorpus) {
-    memset(InputSizesPerFeature, 0, sizeof(InputSizesPerFeature));
-    memset(SmallestElementPerFeature, 0, sizeof(SmallestElementPerFeature));
+    InputSizesPerFeature = static_cast<uint32_t *>(
+        MapZeroedPages(kFeatureSetSize * sizeof(uint32_t)));
+    SmallestElementPerFeature = static_cast<uint32_t *>(
+        MapZeroedPages(kFeatureSetSize * sizeof(uint32_t)));
+    if (!InputSizesPerFeature || !SmallestElementPerFeature) {
+      Printf("ERROR: failed to map the feature tables of the corpus\n");
+      exit(1);
+    }
   }
   ~InputCorpus() {
-    for (auto II : Inputs)
-      delete II;
+    UnmapFeatureTable(InputSizesPerFeature);
+    UnmapFeatureTable(SmallestElementPerFeature);
   }
-  size_t size() const { return Inputs.size(); }
-  size_t SizeInBytes() const {
-    size_t Res = 0;
-    for (auto II : Inputs)
-      Res += II->U.size();
-    return Res;
-  }
-  size_t NumActiveUnits() const {
-    size_t Res = 0;
-    for (auto II : Inputs)
-      Res += !II->U.empty();
-    return Res;
+  InputCorpus(const InputCorpus &) = delete;
+  InputCorpus &operator=(const InputCorpus &) = delete;
+
+  // Moves the per-feature tables to huge pages (MapHugePages()), see
+  // TracePC::UseHugePages().
+  bool UseHugePages(size_t *Size, size_t *HugeSize) {
+    const size_t Bytes = kFeatureSetSize * sizeof(uint32_t);
+    if (!FeatureTablesOnHugePages) {
+      auto *Sizes = static_cast<uint32_t *>(MapHugePages(Bytes));
+      auto *Smallest = static_cast<uint32_t *>(MapHugePages(Bytes));
+      if (!Sizes || !Smallest) {
+        if (Sizes) UnmapHugePages(Sizes, Bytes);
+        if (Smallest) UnmapHugePages(Smallest, Bytes);
+        return false;
+      }
+      memcpy(Sizes, InputSizesPerFeature, Bytes);
+      memcpy(Smallest, SmallestElementPerFeature, Bytes);
+      UnmapFeatureTable(InputSizesPerFeature);
+      UnmapFeatureTable(SmallestElementPerFeature);
+      InputSizesPerFeature = Sizes;
+      SmallestElementPerFeature = Smallest;
+      FeatureTablesOnHugePages = true;
+    }
+    *Size = 2 * Bytes;
+    *HugeSize = HugePageBytes(InputSizesPerFeature, Bytes) +
+                HugePageBytes(SmallestElementPerFeature, Bytes);
+    return true;
   }
+  size_t size() const { return Inputs.size(); }
+  size_t SizeInBytes() const { return NumBytes; }
+  size_t NumActiveUnits() const { return NumActive; }
   size_t MaxInputSize() const {
-    size_t Res = 0;
-    for (auto II : Inputs)
-        Res = std::max(Res, II->U.size());
-    return Res;
+    return UnitsPerSize.empty() ? 0 : UnitsPerSize.rbegin()->first;
   }
   bool empty() const { return Inputs.empty(); }
-  const Unit &operator[] (size_t Idx) const { return Inputs[Idx]->U; }
+  UnitRef operator[] (size_t Idx) const { return UnitOf(*Inputs[Idx]); }
+  InputInfo &Input(size_t Idx) { return *Inputs[Idx]; }
+  UnitRef UnitOf(const InputInfo &II) const {
+    if (II.PackedSize) return Unpacked(II);
+    return {Bytes.data() + II.Offset, II.Size};
+  }
+  const uint32_t *FeatureSetOf(const InputInfo &II) const {
+    return Features.data() + II.FeatureOffset;
+  }
+  // Sha1, if given, must be the checksum of U.
   void AddToCorpus(const Unit &U, size_t NumFeatures, bool MayDeleteFile,
-                   const std::vector<uint32_t> &FeatureSet) {
+                   const std::vector<uint32_t> &FeatureSet,
+                   const uint8_t *Sha1 = nullptr) {
     assert(!U.empty());
     if (FeatureDebug)
       Printf("ADD_TO_CORPUS %zd NF %zd\n", Inputs.size(), NumFeatures);
-    Inputs.push_back(new InputInfo());
+    InputInfos.emplace_back();
+    Inputs.push_back(&InputInfos.back());
     InputInfo &II = *Inputs.back();
-    II.U = U;
+    StoreBytes(&II, U.data(), U.size(), 0);
+    II.Size = U.size();
+    AddUnitSize(U.size());
     II.NumFeatures = NumFeatures;
     II.MayDeleteFile = MayDeleteFile;
-    II.FeatureSet = FeatureSet;
-    ComputeSHA1(U.data(), U.size(), II.Sha1);
-    Hashes.insert(Sha1ToString(II.Sha1));
-    UpdateCorpusDistribution();
+    II.FeatureOffset = Features.size();
+    II.FeatureSetSize = FeatureSet.size();
+    Features.insert(Features.end(), FeatureSet.begin(), FeatureSet.end());
+    if (Sha1)
+      memcpy(II.Sha1, Sha1, kSHA1NumBytes);
+    else
+      ComputeSHA1(U.data(), U.size(), II.Sha1);
+    Hashes.Insert(Sha1Digest(II.Sha1));
+    CorpusDistribution.PushBack(UnitWeight(Inputs.size() - 1));
+    if (Compression)
+      PackColdUnits();
     PrintCorpus();
     // ValidateFeatureSet();
   }
 
+  // Records the divergence of Inputs[Idx], identified by the hash of its
+  // verdict pattern (Pattern) and by the callbacks that rejected it (Mask).
+  void SetDiffInfo(size_t Idx, uint64_t Pattern, uint64_t Mask) {
+    InputInfo *II = Inputs[Idx];
+    auto It = DiffClassOfPattern.find(Pattern);
+    if (It == DiffClassOfPattern.end()) {
+      It = DiffClassOfPattern.insert({Pattern, DiffClasses.size()}).first;
+      DiffClasses.emplace_back();
+      DiffClassPatterns.push_back(Pattern);
+    }
+    II->HasDiff = true;
+    II->DiffMask = Mask;
+    II->DiffClass = It->second;
+    DiffClasses[It->second].push_back(Idx);
+  }
+  size_t NumDiffClasses() const { return DiffClasses.size(); }
+  uint64_t DiffClassPattern(size_t Class) const {
+    return DiffClassPatterns[Class];
+  }
+  // The first unit of the class that still has its data, or size().
+  size_t DiffClassRepresentative(size_t Class) const {
+    for (size_t Idx : DiffClasses[Class])
+      if (Inputs[Idx]->Size) return Idx;
+    return Inputs.size();
+  }
+  // -rare_edges: AddFeature() counts how often each feature is hit, up to
+  // 65535, in one array of 16-bit counters.
+  void EnableFeatureHits() { FeatureHits.assign(kFeatureSetSize, 0); }
+  bool HasFeatureHits() const { return !FeatureHits.empty(); }
+  size_t FeatureHitCount(size_t Feature) const {
+    return FeatureHits[Feature % kFeatureSetSize];
+  }
+  // A unit whose rarest feature in one callback was hit H times, while the
+  // rarest one in another callback was hit H * 2^k times, weighs 1 + k times
+  // as much, up to kMaxRareEdgeBoost: it exercises the libraries unevenly.
+  void SetRarestFeatures(size_t Idx, std::vector<uint32_t> &&Features) {
+    Inputs[Idx]->RarestFeatures = std::move(Features);
+    UpdateRareEdgeBoost(Idx);
+  }
+  // Recomputes the factors from the current counts, as edges that were rare
+  // get common.
+  void UpdateRareEdgeBoosts() {
+    for (size_t i = 0; i < Inputs.size(); i++)
+      if (Inputs[i]->Size && !Inputs[i]->RarestFeatures.empty())
+        UpdateRareEdgeBoost(i);
+  }
+  static const uint32_t kMaxRareEdgeBoost = 16;
+  // -cost_aware: a unit whose run took T ns weighs M / T times as much as it
+  // would otherwise, within [1/kMaxCostFactor, kMaxCostFactor], where M is
+  // the median over the corpus at the last UpdateCostWeights(). That makes
+  // the weights yields per unit of CPU time rather than per mutation.
+  void SetExecTime(size_t Idx, uint64_t Nanos) {
+    Inputs[Idx]->ExecNanos = std::max<uint64_t>(Nanos, 1);
+    UpdateCostWeight(Idx);
+  }
+  void UpdateCostWeights() {
+    std::vector<uint64_t> Times;
+    for (const InputInfo *II : Inputs)
+      if (II->Size && II->ExecNanos)
+        Times.push_back(II->ExecNanos);
+    if (Times.empty()) return;
+    std::nth_element(Times.begin(), Times.begin() + Times.size() / 2,
+                     Times.end());
+    MedianExecNanos = Times[Times.size() / 2];
+    for (size_t i = 0; i < Inputs.size(); i++)
+      if (Inputs[i]->Size && Inputs[i]->ExecNanos)
+        UpdateCostWeight(i);
+  }
+  uint64_t MedianExecTime() const { return MedianExecNanos; }
+  static const uint32_t kCostWeightOne = 16;
+  static const uint32_t kMaxCostFactor = 16;
+
+  // The share of Executed mutations that found something, diffs counting
+  // kDiffYieldWeight times. With no mutations yet, it is as if one in
+  // kPriorMutations had found something.
+  static double MutationYield(double Successes, double Diffs,
+                              double Executed) {
+    return (1.0 + Successes + kDiffYieldWeight * Diffs) /
+           (kPriorMutations + Executed);
+  }
+  static double MutationYield(const InputInfo &II) {
+    return MutationYield(II.NumSuccessfullMutations, II.NumDiffMutations,
+                         II.NumExecutedMutations);
+  }
+
+  void SetTargetDistance(size_t Idx, double D) {
+    Inputs[Idx]->TargetDistance = D;
+    CorpusDistribution.Set(Idx, UnitWeight(Idx));
+  }
+  // Number of diff units whose verdict pattern is that of II.
+  size_t DiffClassSize(const InputInfo &II) const {
+    return II.HasDiff ? DiffClasses[II.DiffClass].size() : 0;
+  }
+  // With a unit or byte budget, the corpus is kept within it by evicting
+  // the least productive units, see EvictionScore(). The bytes are those of
+  // the units and of their feature sets. Evicted units keep their file and
+  // their checksum, so they are not added again, and their features stay
+  // known.
+  void SetBudget(size_t MaxUnits, size_t MaxBytes) {
+    MaxActiveUnits = MaxUnits;
+    MaxLiveBytes = MaxBytes;
+  }
+  bool OverBudget() const {
+    return (MaxActiveUnits &&
+            NumActive > std::max(MaxActiveUnits, EvictAgainUnits)) ||
+           (MaxLiveBytes &&
+            LiveBytes() > std::max(MaxLiveBytes, EvictAgainBytes));
+  }
+  size_t NumEvicted() const { return NumEvictedUnits; }
+
+  // Evicts units until the corpus is a little below its budget, so that
+  // this does not run again for every new unit. The newest active unit and
+  // the best unit of every verdict pattern stay. If these alone are over the
+  // budget, the next eviction waits until the corpus has grown by as much as
+  // an eviction frees.
+  void EvictToBudget() {
+    size_t TargetUnits = MaxActiveUnits - MaxActiveUnits / kEvictionSlack;
+    size_t TargetBytes = MaxLiveBytes - MaxLiveBytes / kEvictionSlack;
+    std::vector<bool> Keep(Inputs.size());
+    for (size_t Idx = Inputs.size(); Idx-- > 0;)
+      if (Inputs[Idx]->Size) {
+        Keep[Idx] = true;
+        break;
+      }
+    for (auto &Class : DiffClasses) {
+      size_t Best = Inputs.size();
+      for (size_t Idx : Class)
+        if (Inputs[Idx]->Size &&
+            (Best == Inputs.size() ||
+             EvictionScore(*Inputs[Idx]) > EvictionScore(*Inputs[Best])))
+          Best = Idx;
+      if (Best != Inputs.size())
+        Keep[Best] = true;
+    }
+    std::vector<std::pair<double, size_t>> Candidates;
+    for (size_t Idx = 0; Idx < Inputs.size(); Idx++)
+      if (Inputs[Idx]->Size && !Keep[Idx])
+        Candidates.push_back({EvictionScore(*Inputs[Idx]), Idx});
+    std::sort(Candidates.begin(), Candidates.end());
+    for (auto &C : Candidates) {
+      if ((!MaxActiveUnits || NumActive <= TargetUnits) &&
+          (!MaxLiveBytes || LiveBytes() <= TargetBytes))
+        break;
+      EvictInput(C.second);
+    }
+    MaybeCompact();
+    EvictAgainUnits = NumActive + MaxActiveUnits / kEvictionSlack;
+    EvictAgainBytes = LiveBytes() + MaxLiveBytes / kEvictionSlack;
+  }
+
+  // -compress_corpus: once the corpus has kMinUnitsToTrain units, a
+  // dictionary is trained on them, and from then on every unit but the
+  // kHotUnits newest ones is kept compressed with it, if that makes it
+  // smaller. The newest units are the ones most likely to be mutated; the
+  // kUnpackedCacheSize older ones last looked at are kept decompressed as
+  // well.
+  void EnableCompression() { Compression = true; }
+  size_t NumPackedUnits() const { return NumPacked; }
+  // How much smaller the compressed units are, in bytes.
+  size_t NumPackedBytesSaved() const { return NumBytesSaved; }
+  size_t DictionarySize() const { return Dict.size(); }
+  static const size_t kMinUnitsToTrain = 256;
+  static const size_t kHotUnits = 256;
+  static const size_t kUnpackedCacheSize = 64;
+  static const size_t kMaxDictionarySize = 1 << 14;
+
+  // With a DiffEnergy of P, P% of the units to mutate are picked among the
+  // diff units: a verdict pattern is chosen uniformly, then a unit with that
+  // pattern. A unit of a rare pattern thus gets more mutations than one of
+  // a pattern seen many times.
+  void SetDiffEnergy(int P) { DiffEnergy = std::min(std::max(P, 0), 100); }
+
   // Debug-only
-  void PrintUnit(const Unit &U) {
+  void PrintUnit(UnitRef U) {
     if (!FeatureDebug) return;
     for (uint8_t C : U) {
       if (C != 'F' && C != 'U' && C != 'Z')
@@ -98,11 +365,11 @@ class InputCorpus {
   }
 
   // Debug-only
-  void PrintFeatureSet(const std::vector<uint32_t> &FeatureSet) {
+  void PrintFeatureSet(const InputInfo &II) {
     if (!FeatureDebug) return;
     Printf("{");
-    for (uint32_t Feature: FeatureSet)
-      Printf("%u,", Feature);
+    for (size_t i = 0; i < II.FeatureSetSize; i++)
+      Printf("%u,", FeatureSetOf(II)[i]);
     Printf("}");
   }
 
@@ -112,25 +379,28 @@ class InputCorpus {
     Printf("======= CORPUS:\n");
     int i = 0;
     for (auto II : Inputs) {
-      if (std::find(II->U.begin(), II->U.end(), 'F') != II->U.end()) {
+      UnitRef U = UnitOf(*II);
+      if (std::find(U.begin(), U.end(), 'F') != U.end()) {
         Printf("[%2d] ", i);
-        Printf("%s sz=%zd ", Sha1ToString(II->Sha1).c_str(), II->U.size());
-        PrintUnit(II->U);
+        Printf("%s sz=%zd ", Sha1ToString(II->Sha1).c_str(), U.size());
+        PrintUnit(U);
         Printf(" ");
-        PrintFeatureSet(II->FeatureSet);
+        PrintFeatureSet(*II);
         Printf("\n");
       }
       i++;
     }
   }
 
-  // If FeatureSet is that same as in II, replace II->U with {Data,Size}.
+  // If FeatureSet is that same as in II, replace the unit of II with
+  // {Data,Size}.
   bool TryToReplace(InputInfo *II, const uint8_t *Data, size_t Size,
                     const std::vector<uint32_t> &FeatureSet) {
-    if (II->U.size() > Size && II->FeatureSet.size() &&
-        II->FeatureSet == FeatureSet) {
+    if (II->Size > Size && II->FeatureSetSize &&
+        II->FeatureSetSize == FeatureSet.size() &&
+        std::equal(FeatureSet.begin(), FeatureSet.end(), FeatureSetOf(*II))) {
       if (FeatureDebug)
-        Printf("Replace: %zd => %zd\n", II->U.size(), Size);
+        Printf("Replace: %zd => %zd\n", II->Size, Size);
       Replace(II, {Data, Data + Size});
       PrintCorpus();
       return true;
@@ -138,20 +408,52 @@ class InputCorpus {
     return false;
   }
 
+  // U must not be larger than the unit it replaces: it is written over the
+  // old bytes and the rest of them become garbage in the arena.
   void Replace(InputInfo *II, const Unit &U) {
-    assert(II->U.size());
-    Hashes.erase(Sha1ToString(II->Sha1));
+    assert(II->Size);
+    assert(U.size() <= II->Size);
+    Hashes.Erase(Sha1Digest(II->Sha1));
     DeleteFile(*II);
     ComputeSHA1(U.data(), U.size(), II->Sha1);
-    Hashes.insert(Sha1ToString(II->Sha1));
-    II->U = U;
+    Hashes.Insert(Sha1Digest(II->Sha1));
+    RemoveUnitSize(II->Size);
+    AddUnitSize(U.size());
+    if (II->PackedSize) {
+      DropUnpacked(*II);
+      ForgetPacked(*II);
+      II->Size = U.size();
+      Pack(II, U.data());
+    } else {
+      StoreBytes(II, U.data(), U.size(), 0);
+      II->Size = U.size();
+    }
+    MaybeCompact();
   }
 
-  bool HasUnit(const Unit &U) { return Hashes.count(Hash(U)); }
-  bool HasUnit(const std::string &H) { return Hashes.count(H); }
+  bool HasUnit(const Unit &U) {
+    uint8_t Sha1[kSHA1NumBytes];
+    ComputeSHA1(U.data(), U.size(), Sha1);
+    return HasUnit(Sha1);
+  }
+  bool HasUnit(const uint8_t Sha1[kSHA1NumBytes]) const {
+    return Hashes.Contains(Sha1Digest(Sha1));
+  }
+  // H is the checksum in hex, as in the corpus file names.
+  bool HasUnit(const std::string &H) const {
+    uint8_t Sha1[kSHA1NumBytes];
+    if (H.size() != 2 * kSHA1NumBytes) return false;
+    for (size_t i = 0; i < kSHA1NumBytes; i++) {
+      char *End;
+      std::string Byte = H.substr(2 * i, 2);
+      Sha1[i] = static_cast<uint8_t>(strtoul(Byte.c_str(), &End, 16));
+      if (*End) return false;
+    }
+    return HasUnit(Sha1);
+  }
   InputInfo &ChooseUnitToMutate(Random &Rand) {
     InputInfo &II = *Inputs[ChooseUnitIdxToMutate(Rand)];
-    assert(!II.U.empty());
+    assert(II.Size);
     return II;
   };
 
@@ -159,7 +461,14 @@ class InputCorpus {
   // Hypothesis: units added to the corpus last are more likely to be
   // interesting. This function gives more weight to the more recent units.
   size_t ChooseUnitIdxToMutate(Random &Rand) {
-    size_t Idx = static_cast<size_t>(CorpusDistribution(Rand));
+    if (DiffEnergy && !DiffClasses.empty() &&
+        Rand(100) < static_cast<size_t>(DiffEnergy)) {
+      const auto &Class = DiffClasses[Rand(DiffClasses.size())];
+      size_t Idx = Class[Rand(Class.size())];
+      if (Inputs[Idx]->Size)
+        return Idx;
+    }
+    size_t Idx = CorpusDistribution.Sample(Rand);
     assert(Idx < Inputs.size());
     return Idx;
   }
@@ -168,7 +477,7 @@ class InputCorpus {
     for (size_t i = 0; i < Inputs.size(); i++) {
       const auto &II = *Inputs[i];
       Printf("  [%zd %s]\tsz: %zd\truns: %zd\tsucc: %zd\n", i,
-             Sha1ToString(II.Sha1).c_str(), II.U.size(),
+             Sha1ToString(II.Sha1).c_str(), II.Size,
              II.NumExecutedMutations, II.NumSuccessfullMutations);
     }
   }
@@ -193,14 +502,40 @@ class InputCorpus {
   void DeleteInput(size_t Idx) {
     InputInfo &II = *Inputs[Idx];
     DeleteFile(II);
-    Unit().swap(II.U);
+    if (II.Size)
+      RemoveUnitSize(II.Size);
+    ReleaseBytes(&II);
+    NumGarbageFeatures += II.FeatureSetSize;
+    II.FeatureSetSize = 0;
+    MaybeCompact();
     if (FeatureDebug)
       Printf("EVICTED %zd\n", Idx);
   }
 
-  void AddFeature(size_t Idx, uint32_t NewSize, bool Shrink) {
+  // Unlike DeleteInput(), keeps the file: the unit may still be productive
+  // in a later run.
+  void EvictInput(size_t Idx) {
+    InputInfo &II = *Inputs[Idx];
+    assert(II.Size);
+    RemoveUnitSize(II.Size);
+    ReleaseBytes(&II);
+    NumGarbageFeatures += II.FeatureSetSize;
+    II.FeatureSetSize = 0;
+    std::vector<uint32_t>().swap(II.RarestFeatures);
+    CorpusDistribution.Set(Idx, 0);
+    NumEvictedUnits++;
+    if (FeatureDebug)
+      Printf("EVICTED %zd (budget)\n", Idx);
+  }
+
+  // Returns kFeatureUpdated if Idx gets a new smallest input, and
+  // kFeatureAdded if it had none.
+  enum FeatureUpdate { kFeatureKept, kFeatureUpdated, kFeatureAdded };
+  FeatureUpdate AddFeature(size_t Idx, uint32_t NewSize, bool Shrink) {
     assert(NewSize);
     Idx = Idx % kFeatureSetSize;
+    if (!FeatureHits.empty() && FeatureHits[Idx] != UINT16_MAX)
+      FeatureHits[Idx]++;
     uint32_t OldSize = GetFeature(Idx);
     if (OldSize == 0 || (Shrink && OldSize > NewSize)) {
       if (OldSize > 0) {
@@ -208,6 +543,7 @@ class InputCorpus {
         InputInfo &II = *Inputs[OldIdx];
         assert(II.NumFeatures > 0);
         II.NumFeatures--;
+        CorpusDistribution.Set(OldIdx, UnitWeight(OldIdx));
         if (II.NumFeatures == 0)
           DeleteInput(OldIdx);
       } else {
@@ -218,24 +554,204 @@ class InputCorpus {
         Printf("ADD FEATURE %zd sz %d\n", Idx, NewSize);
       SmallestElementPerFeature[Idx] = Inputs.size();
       InputSizesPerFeature[Idx] = NewSize;
+      return OldSize ? kFeatureUpdated : kFeatureAdded;
+    }
+    return kFeatureKept;
+  }
+
+  // AddFeature() for the features of one run, as CollectFeatures() hands
+  // them out: mostly in increasing order, so the slots they touch in the two
+  // feature arrays are each loaded ahead of time, kFeaturePrefetchDistance
+  // features before their turn, and the misses overlap. Calls
+  // OnUpdate(Feature, IsNew) for every feature that gets a new smallest
+  // input; IsNew if it had none.
+  template <class Callback>
+  void AddFeatures(const uint32_t *Features, size_t N, uint32_t NewSize,
+                   bool Shrink, Callback OnUpdate) {
+    for (size_t i = 0; i < N; i++) {
+      if (i + kFeaturePrefetchDistance < N) {
+        size_t Ahead = Features[i + kFeaturePrefetchDistance] % kFeatureSetSize;
+        __builtin_prefetch(&InputSizesPerFeature[Ahead]);
+        if (!FeatureHits.empty())
+          __builtin_prefetch(&FeatureHits[Ahead], 1);
+      }
+      if (FeatureUpdate U = AddFeature(Features[i], NewSize, Shrink))
+        OnUpdate(Features[i], U == kFeatureAdded);
     }
   }
 
+  // Whether AddFeature(Idx, NewSize, Shrink) would change the feature set.
+  bool WouldAddFeature(size_t Idx, uint32_t NewSize, bool Shrink) const {
+    uint32_t OldSize = GetFeature(Idx % kFeatureSetSize);
+    return OldSize == 0 || (Shrink && OldSize > NewSize);
+  }
+
   size_t NumFeatures() const { return NumAddedFeatures; }
   size_t NumFeatureUpdates() const { return NumUpdatedFeatures; }
 
   void ResetFeatureSet() {
     assert(Inputs.empty());
-    memset(InputSizesPerFeature, 0, sizeof(InputSizesPerFeature));
-    memset(SmallestElementPerFeature, 0, sizeof(SmallestElementPerFeature));
+    memset(InputSizesPerFeature, 0, kFeatureSetSize * sizeof(uint32_t));
+    memset(SmallestElementPerFeature, 0, kFeatureSetSize * sizeof(uint32_t));
   }
 
 private:
 
   static const bool FeatureDebug = false;
+  // How far AddFeatures() looks ahead; about the misses one core keeps in
+  // flight.
+  static const size_t kFeaturePrefetchDistance = 8;
 
   size_t GetFeature(size_t Idx) const { return InputSizesPerFeature[Idx]; }
 
+  void UnmapFeatureTable(uint32_t *Table) {
+    if (FeatureTablesOnHugePages)
+      UnmapHugePages(Table, kFeatureSetSize * sizeof(uint32_t));
+    else
+      UnmapPages(Table, kFeatureSetSize * sizeof(uint32_t));
+  }
+
+  // Once more than half of an arena is garbage, the live units (or feature
+  // sets) are moved to its front, in corpus order. This keeps the arenas
+  // within twice the size of the corpus at an amortized O(1) cost per byte.
+  void MaybeCompact() {
+    if (NumGarbageBytes > kMinGarbageToCompact &&
+        NumGarbageBytes * 2 > Bytes.size()) {
+      size_t End = 0;
+      for (auto II : Inputs) {
+        std::copy(Bytes.begin() + II->Offset,
+                  Bytes.begin() + II->Offset + StoredSize(*II),
+                  Bytes.begin() + End);
+        II->Offset = End;
+        End += StoredSize(*II);
+      }
+      Bytes.resize(End);
+      Bytes.shrink_to_fit();
+      NumGarbageBytes = 0;
+    }
+    if (NumGarbageFeatures > kMinGarbageToCompact &&
+        NumGarbageFeatures * 2 > Features.size()) {
+      size_t End = 0;
+      for (auto II : Inputs) {
+        std::copy(Features.begin() + II->FeatureOffset,
+                  Features.begin() + II->FeatureOffset + II->FeatureSetSize,
+                  Features.begin() + End);
+        II->FeatureOffset = End;
+        End += II->FeatureSetSize;
+      }
+      Features.resize(End);
+      Features.shrink_to_fit();
+      NumGarbageFeatures = 0;
+    }
+  }
+
+  static size_t StoredSize(const InputInfo &II) {
+    return II.PackedSize ? II.PackedSize : II.Size;
+  }
+  // Stores the N bytes at Data, which must not be in the arena, in place of
+  // those of II if they fit there, or else at the end of the arena.
+  void StoreBytes(InputInfo *II, const uint8_t *Data, size_t N,
+                  size_t PackedSize) {
+    size_t Old = StoredSize(*II);
+    if (Old && N <= Old) {
+      std::copy(Data, Data + N, Bytes.begin() + II->Offset);
+      NumGarbageBytes += Old - N;
+    } else {
+      NumGarbageBytes += Old;
+      II->Offset = Bytes.size();
+      Bytes.insert(Bytes.end(), Data, Data + N);
+    }
+    II->PackedSize = PackedSize;
+  }
+  void ReleaseBytes(InputInfo *II) {
+    if (II->PackedSize) {
+      DropUnpacked(*II);
+      ForgetPacked(*II);
+    }
+    NumGarbageBytes += StoredSize(*II);
+    II->Size = 0;
+    II->PackedSize = 0;
+  }
+  void ForgetPacked(const InputInfo &II) {
+    NumPacked--;
+    NumBytesSaved -= II.Size - II.PackedSize;
+  }
+  // Stores the II->Size bytes at Data in II compressed, unless that does
+  // not make them smaller.
+  void Pack(InputInfo *II, const uint8_t *Data) {
+    std::vector<uint8_t> P = Compress(Data, II->Size, Dict.data(), Dict.size());
+    if (P.size() >= II->Size) {
+      StoreBytes(II, Data, II->Size, 0);
+      return;
+    }
+    StoreBytes(II, P.data(), P.size(), P.size());
+    NumPacked++;
+    NumBytesSaved += II->Size - II->PackedSize;
+  }
+  void PackColdUnits() {
+    if (!Trained) {
+      if (NumActive < kMinUnitsToTrain) return;
+      std::vector<std::pair<const uint8_t *, size_t>> Samples;
+      for (auto II : Inputs)
+        if (II->Size)
+          Samples.push_back({Bytes.data() + II->Offset, II->Size});
+      Dict = TrainDictionary(Samples, kMaxDictionarySize);
+      Trained = true;
+    }
+    for (; NextToPack + kHotUnits < Inputs.size(); NextToPack++) {
+      InputInfo *II = Inputs[NextToPack];
+      if (!II->Size || II->PackedSize) continue;
+      // Pack() may write over the bytes it compresses.
+      Unit U(Bytes.begin() + II->Offset, Bytes.begin() + II->Offset + II->Size);
+      Pack(II, U.data());
+    }
+    MaybeCompact();
+  }
+  // Safe to call from other threads than the one changing the corpus, as
+  // long as it does not change it meanwhile.
+  UnitRef Unpacked(const InputInfo &II) const {
+    std::lock_guard<std::mutex> Lock(UnpackedCacheMutex);
+    for (auto &E : UnpackedCache)
+      if (E.first == &II) return UnitRef(E.second);
+    std::shared_ptr<Unit> U = std::make_shared<Unit>();
+    if (!Decompress(Bytes.data() + II.Offset, II.PackedSize, II.Size, U.get(),
+                    Dict.data(), Dict.size())) {
+      Printf("ERROR: can't decompress corpus unit %s\n",
+             Sha1ToString(II.Sha1).c_str());
+      exit(1);
+    }
+    if (UnpackedCache.size() < kUnpackedCacheSize)
+      UnpackedCache.emplace_back();
+    auto &E = UnpackedCache[NextToEvictFromCache++ % UnpackedCache.size()];
+    E.first = &II;
+    E.second = U;
+    return UnitRef(std::move(U));
+  }
+  void DropUnpacked(const InputInfo &II) {
+    std::lock_guard<std::mutex> Lock(UnpackedCacheMutex);
+    for (auto &E : UnpackedCache)
+      if (E.first == &II) {
+        E.first = nullptr;
+        E.second.reset();
+      }
+  }
+
+  // Keep SizeInBytes(), NumActiveUnits() and MaxInputSize() up to date as
+  // non-empty units come and go.
+  void AddUnitSize(size_t Size) {
+    NumBytes += Size;
+    NumActive++;
+    UnitsPerSize[Size]++;
+  }
+  void RemoveUnitSize(size_t Size) {
+    NumBytes -= Size;
+    NumActive--;
+    auto It = UnitsPerSize.find(Size);
+    assert(It != UnitsPerSize.end());
+    if (--It->second == 0)
+      UnitsPerSize.erase(It);
+  }
+
   void ValidateFeatureSet() {
     if (FeatureDebug)
       PrintFeatureSet();
@@ -250,36 +766,120 @@ private:
     }
   }
 
-  // Updates the probability distribution for the units in the corpus.
-  // Must be called whenever the corpus or unit weights are changed.
-  void UpdateCorpusDistribution() {
-    size_t N = Inputs.size();
-    assert(N);
-    Intervals.resize(N + 1);
-    Weights.resize(N);
-    std::iota(Intervals.begin(), Intervals.end(), 0);
-    for (size_t i = 0; i < N; i++)
-    {
-	Weights[i] = Inputs[i]->NumFeatures * (i + 1) ;
-	//Weights[i] = Inputs[i]->NumFeatures;
-	//printf("%zu,%f ",Inputs[i]->NumFeatures,Weights[i]);
-    }    
-    //printf("\n");
-    CorpusDistribution = std::piecewise_constant_distribution<double>(
-        Intervals.begin(), Intervals.end(), Weights.begin());
-  }
-  std::piecewise_constant_distribution<double> CorpusDistribution;
-
-  std::vector<double> Intervals;
-  std::vector<double> Weights;
-
-  std::unordered_set<std::string> Hashes;
+  // Sampling weight of Inputs[Idx]. It must be updated in
+  // CorpusDistribution whenever the unit's NumFeatures changes. A unit at a
+  // mean distance D from the -directed_targets weighs kTargetBoost / (1 + D)
+  // times as much, but never less than it would without a distance. The
+  // -cost_aware factor applies before the distance one.
+  uint64_t UnitWeight(size_t Idx) const {
+    const InputInfo &II = *Inputs[Idx];
+    if (!II.Size) return 0;  // Evicted.
+    uint64_t W = static_cast<uint64_t>(II.NumFeatures) * (Idx + 1);
+    W *= II.RareEdgeBoost;
+    if (W && II.CostWeight != kCostWeightOne)
+      W = std::max<uint64_t>(1, W * II.CostWeight / kCostWeightOne);
+    if (II.TargetDistance < 0 || !W) return W;
+    return std::max<uint64_t>(W, W * kTargetBoost / (1 + II.TargetDistance));
+  }
+  void UpdateRareEdgeBoost(size_t Idx) {
+    InputInfo &II = *Inputs[Idx];
+    size_t Min = ~static_cast<size_t>(0), Max = 0;
+    for (uint32_t F : II.RarestFeatures) {
+      if (F == ~0U) continue;
+      size_t H = FeatureHitCount(F);
+      Min = std::min(Min, H);
+      Max = std::max(Max, H);
+    }
+    uint32_t Boost = 1;
+    while (Min <= Max && Boost < kMaxRareEdgeBoost &&
+           (Min + 1) << Boost <= Max + 1)
+      Boost++;
+    if (Boost == II.RareEdgeBoost) return;
+    II.RareEdgeBoost = Boost;
+    CorpusDistribution.Set(Idx, UnitWeight(Idx));
+  }
+  void UpdateCostWeight(size_t Idx) {
+    InputInfo &II = *Inputs[Idx];
+    if (!MedianExecNanos) return;
+    uint64_t Weight = kCostWeightOne * MedianExecNanos / II.ExecNanos;
+    Weight = std::min<uint64_t>(
+        std::max<uint64_t>(Weight, kCostWeightOne / kMaxCostFactor),
+        kCostWeightOne * kMaxCostFactor);
+    if (Weight == II.CostWeight) return;
+    II.CostWeight = static_cast<uint32_t>(Weight);
+    CorpusDistribution.Set(Idx, UnitWeight(Idx));
+  }
+  uint64_t MedianExecNanos = 0;
+  static const uint64_t kTargetBoost = 16;
+  WeightedSampler CorpusDistribution;
+
+  // How productive II has been: its MutationYield() by the number of
+  // features only it has.
+  static double EvictionScore(const InputInfo &II) {
+    return MutationYield(II) * (1 + II.NumFeatures);
+  }
+  size_t LiveBytes() const {
+    return NumBytes - NumBytesSaved + (Features.size() - NumGarbageFeatures) *
+                          sizeof(Features[0]);
+  }
+  static const size_t kDiffYieldWeight = 4;
+  static const size_t kPriorMutations = 64;
+  // EvictToBudget() frees 1/kEvictionSlack of the budget at a time.
+  static const size_t kEvictionSlack = 16;
+  size_t MaxActiveUnits = 0;
+  size_t MaxLiveBytes = 0;
+  // Where the corpus is over budget again after an eviction that could not
+  // get below it.
+  size_t EvictAgainUnits = 0;
+  size_t EvictAgainBytes = 0;
+  size_t NumEvictedUnits = 0;
+
+  // Indices of the diff units, grouped by verdict pattern.
+  std::vector<std::vector<size_t>> DiffClasses;
+  std::unordered_map<uint64_t, size_t> DiffClassOfPattern;
+  std::vector<uint64_t> DiffClassPatterns;
+  int DiffEnergy = 0;
+
+  // The corpus is keyed by the first 16 bytes of the SHA1 checksums.
+  static Digest128 Sha1Digest(const uint8_t Sha1[kSHA1NumBytes]) {
+    Digest128 D;
+    memcpy(&D.Lo, Sha1, sizeof(D.Lo));
+    memcpy(&D.Hi, Sha1 + sizeof(D.Lo), sizeof(D.Hi));
+    return D;
+  }
+  DigestSet Hashes;
   std::vector<InputInfo*> Inputs;
+  std::deque<InputInfo> InputInfos;  // Backs Inputs, never moves an element.
+
+  static const size_t kMinGarbageToCompact = 1 << 16;
+  std::vector<uint8_t> Bytes;       // Arena of the units.
+  std::vector<uint32_t> Features;   // Arena of the feature sets.
+  size_t NumGarbageBytes = 0;
+  size_t NumGarbageFeatures = 0;
+  size_t NumBytes = 0;
+  bool Compression = false;
+  bool Trained = false;
+  std::vector<uint8_t> Dict;
+  size_t NextToPack = 0;
+  size_t NumPacked = 0;
+  size_t NumBytesSaved = 0;
+  // Decompressed units, replaced in round-robin order. A UnitRef still
+  // holding an evicted one keeps it alive.
+  mutable std::mutex UnpackedCacheMutex;
+  mutable std::vector<std::pair<const InputInfo *, std::shared_ptr<const Unit>>>
+      UnpackedCache;
+  mutable size_t NextToEvictFromCache = 0;
+  size_t NumActive = 0;
+  std::map<size_t, size_t> UnitsPerSize;  // Non-empty units only.
 
   size_t NumAddedFeatures = 0;
   size_t NumUpdatedFeatures = 0;
-  uint32_t InputSizesPerFeature[kFeatureSetSize];
-  uint32_t SmallestElementPerFeature[kFeatureSetSize];
+  std::vector<uint16_t> FeatureHits;
+  // kFeatureSetSize entries each, mapped rather than inline so that they can
+  // move to huge pages.
+  uint32_t *InputSizesPerFeature;
+  uint32_t *SmallestElementPerFeature;
+  bool FeatureTablesOnHugePages = false;
 
   std::string OutputCorpus;
 };
@@ -85,8 +85,15 @@
 #define ATTRIBUTE_INTERFACE __attribute__((visibility("default")))
 #endif
 
+// Build with -DLIBFUZZER_TRACING=0 to compile the -trace_file hooks out.
+#ifndef LIBFUZZER_TRACING
+#define LIBFUZZER_TRACING 1
+#endif
+
 namespace fuzzer {
 
+constexpr bool kTraceHooks = LIBFUZZER_TRACING;
+
 template <class T> T Min(T a, T b) { return a < b ? a : b; }
 template <class T> T Max(T a, T b) { return a > b ? a : b; }
 
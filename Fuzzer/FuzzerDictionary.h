@@ -13,10 +13,13 @@
 #define LLVM_FUZZER_DICTIONARY_H
 
 #include "FuzzerDefs.h"
+#include "FuzzerHash.h"
 #include "FuzzerIO.h"
 #include "FuzzerUtil.h"
 #include <algorithm>
+#include <deque>
 #include <limits>
+#include <unordered_map>
 
 namespace fuzzer {
 // A simple POD sized array of bytes.
@@ -86,32 +89,47 @@ private:
   size_t SuccessCount = 0;
 };
 
+struct WordHash {
+  size_t operator()(const Word &W) const {
+    return static_cast<size_t>(Hash128(W.data(), W.size()).Lo);
+  }
+};
+
+// Entries are kept in a deque, so that references to them, as held in
+// MutationDispatcher::CurrentDictionaryEntrySequence, survive push_back.
+// Index maps every word to its first entry.
 class Dictionary {
  public:
-  static const size_t kMaxDictSize = 1 << 14;
-
-  bool ContainsWord(const Word &W) const {
-    return std::any_of(begin(), end(), [&](const DictionaryEntry &DE) {
-      return DE.GetW() == W;
-    });
+  static const size_t kMaxDictSize = 1 << 18;
+  typedef std::deque<DictionaryEntry>::const_iterator const_iterator;
+
+  bool ContainsWord(const Word &W) const { return Index.count(W) != 0; }
+  // Returns size() if W is not in the dictionary.
+  size_t IndexOf(const Word &W) const {
+    auto It = Index.find(W);
+    return It == Index.end() ? size() : It->second;
   }
-  const DictionaryEntry *begin() const { return &DE[0]; }
-  const DictionaryEntry *end() const { return begin() + Size; }
+  const_iterator begin() const { return DE.begin(); }
+  const_iterator end() const { return DE.end(); }
   DictionaryEntry & operator[] (size_t Idx) {
-    assert(Idx < Size);
+    assert(Idx < size());
     return DE[Idx];
   }
   void push_back(DictionaryEntry DE) {
-    if (Size < kMaxDictSize)
-      this->DE[Size++] = DE;
+    if (size() == kMaxDictSize) return;
+    Index.insert({DE.GetW(), size()});
+    this->DE.push_back(DE);
+  }
+  void clear() {
+    DE.clear();
+    Index.clear();
   }
-  void clear() { Size = 0; }
-  bool empty() const { return Size == 0; }
-  size_t size() const { return Size; }
+  bool empty() const { return DE.empty(); }
+  size_t size() const { return DE.size(); }
 
 private:
-  DictionaryEntry DE[kMaxDictSize];
-  size_t Size = 0;
+  std::deque<DictionaryEntry> DE;
+  std::unordered_map<Word, size_t, WordHash> Index;
 };
 
 // Parses one dictionary entry.
@@ -0,0 +1,114 @@
+//===- FuzzerDiffCluster.h - INTERNAL - Clusters of diffs -------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::MinHash, fuzzer::DiffClusters
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_DIFF_CLUSTER_H
+#define LLVM_FUZZER_DIFF_CLUSTER_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerHash.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+namespace fuzzer {
+
+// MinHash signature of a set of 64-bit tokens: the fraction of equal slots
+// of two signatures estimates the Jaccard similarity of their sets. The
+// kSize hash functions are derived from two hashes of the token
+// (Kirsch-Mitzenmacher), so adding a token costs two hashes.
+class MinHash {
+ public:
+  static const size_t kSize = 64;
+
+  MinHash() { std::fill(Slots, Slots + kSize, UINT32_MAX); }
+
+  void Add(uint64_t Token) {
+    Digest128 D = Hash128(reinterpret_cast<const uint8_t *>(&Token),
+                          sizeof(Token));
+    for (size_t i = 0; i < kSize; i++)
+      Slots[i] = std::min(Slots[i], static_cast<uint32_t>(D.Lo + i * D.Hi));
+  }
+  double Similarity(const MinHash &Other) const {
+    size_t Equal = 0;
+    for (size_t i = 0; i < kSize; i++)
+      Equal += Slots[i] == Other.Slots[i];
+    return static_cast<double>(Equal) / kSize;
+  }
+  uint32_t operator[](size_t i) const { return Slots[i]; }
+
+ private:
+  uint32_t Slots[kSize];
+};
+
+// Diffs grouped by verdict pattern and, within a pattern, by the MinHash of
+// their coverage. A locality-sensitive index (kBands bands of the signature,
+// each hashed to a bucket) finds the earlier diffs that are likely similar;
+// a diff joins the cluster of the most similar one among them if that one
+// is at least SetSimilarity() alike, and starts a new cluster otherwise.
+class DiffClusters {
+ public:
+  static const size_t kBands = 16;
+  static const size_t kRowsPerBand = MinHash::kSize / kBands;
+
+  void SetSimilarity(double S) { Similarity = S; }
+
+  // Returns the cluster of the diff, and whether it is a new one in *IsNew.
+  size_t Insert(uint64_t Class, const MinHash &Sig, bool *IsNew) {
+    uint64_t Keys[kBands];
+    size_t Best = Members.size();
+    double BestSimilarity = -1;
+    for (size_t b = 0; b < kBands; b++) {
+      Hasher128 H(Class);
+      H.Update(b);
+      for (size_t r = 0; r < kRowsPerBand; r++)
+        H.Update(Sig[b * kRowsPerBand + r]);
+      Keys[b] = H.Final().Lo;
+      auto It = Buckets.find(Keys[b]);
+      if (It == Buckets.end()) continue;
+      for (size_t M : It->second) {
+        if (Members[M].Class != Class) continue;
+        double S = Members[M].Sig.Similarity(Sig);
+        if (S > BestSimilarity) {
+          Best = M;
+          BestSimilarity = S;
+        }
+      }
+    }
+    *IsNew = BestSimilarity < Similarity;
+    size_t Cluster = *IsNew ? NumClusters++ : Members[Best].Cluster;
+    for (size_t b = 0; b < kBands; b++) {
+      auto &Bucket = Buckets[Keys[b]];
+      if (Bucket.empty() || Bucket.back() != Members.size())
+        Bucket.push_back(Members.size());
+    }
+    Members.push_back({Class, Sig, Cluster});
+    return Cluster;
+  }
+  size_t size() const { return NumClusters; }
+  size_t NumDiffs() const { return Members.size(); }
+
+ private:
+  struct Member {
+    uint64_t Class;
+    MinHash Sig;
+    size_t Cluster;
+  };
+
+  double Similarity = 1;
+  size_t NumClusters = 0;
+  std::vector<Member> Members;
+  std::unordered_map<uint64_t, std::vector<size_t>> Buckets;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_DIFF_CLUSTER_H
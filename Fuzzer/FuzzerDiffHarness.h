@@ -0,0 +1,120 @@
+//===- FuzzerDiffHarness.h - Differential target boilerplate ----*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::DiffHarness, for differential targets.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_DIFF_HARNESS_H
+#define LLVM_FUZZER_DIFF_HARNESS_H
+
+#include "FuzzerExtFunctions.h"
+
+#include <tuple>
+
+// A differential target lists its implementations, in callback order, once:
+//
+//   struct FuzzMe {
+//     static int Run(const uint8_t *Data, size_t Size);
+//   };
+//   struct FuzzMeToo {
+//     static int Run(const uint8_t *Data, size_t Size);
+//     // Optional: results that mean the same as another implementation's.
+//     static constexpr fuzzer::DiffResultMapping kResultMap[] = {{-1, 0}};
+//   };
+//   LLVM_FUZZER_DIFF_HARNESS(FuzzMe, FuzzMeToo)
+//
+// The macro defines LLVMFuzzerTestOneInput (the first implementation),
+// LLVMFuzzerCustomCallbacks and the fused LLVMFuzzerCustomRunAll. Every
+// callback calls its Run() directly, so a statically linked implementation
+// is inlined into it. Results found among the From values of an
+// implementation's kResultMap are replaced by their To value before the
+// fuzzer compares them; before C++17 kResultMap also needs a definition at
+// namespace scope.
+//
+// Unless -diff_fused=0 is given, the fuzzer calls LLVMFuzzerCustomRunAll
+// instead of the callbacks: one call runs all implementations, then the
+// coverage of all of them is collected at once and credited to the callback
+// whose module produced it, as with -diff_parallel.
+
+namespace fuzzer {
+
+struct DiffResultMapping {
+  int From;
+  int To;
+};
+
+template <size_t N>
+constexpr int MapDiffResult(const DiffResultMapping (&Map)[N], int Raw,
+                            size_t I = 0) {
+  return I == N ? Raw
+                : Map[I].From == Raw ? Map[I].To : MapDiffResult(Map, Raw, I + 1);
+}
+
+template <size_t... Is> struct DiffIndexSeq {};
+template <size_t N, size_t... Is>
+struct MakeDiffIndexSeq : MakeDiffIndexSeq<N - 1, N - 1, Is...> {};
+template <size_t... Is> struct MakeDiffIndexSeq<0, Is...> {
+  typedef DiffIndexSeq<Is...> Type;
+};
+
+template <class... Impls> class DiffHarness {
+ public:
+  static const size_t kNumImpls = sizeof...(Impls);
+  static_assert(kNumImpls > 0, "a differential harness needs implementations");
+
+  template <size_t I> static int Run(const uint8_t *Data, size_t Size) {
+    typedef typename std::tuple_element<I, std::tuple<Impls...>>::type Impl;
+    return Normalize<Impl>(Impl::Run(Data, Size), 0);
+  }
+
+  static UserCallbacks *Callbacks() {
+    return Callbacks(typename MakeDiffIndexSeq<kNumImpls>::Type());
+  }
+
+  // Stores the result of implementation i in Results[i].
+  static void RunAll(const uint8_t *Data, size_t Size, int *Results) {
+    RunAll(Data, Size, Results, typename MakeDiffIndexSeq<kNumImpls>::Type());
+  }
+
+ private:
+  template <class Impl>
+  static auto Normalize(int Raw, int) -> decltype(Impl::kResultMap, int()) {
+    return MapDiffResult(Impl::kResultMap, Raw);
+  }
+  template <class Impl> static int Normalize(int Raw, long) { return Raw; }
+
+  template <size_t... Is> static UserCallbacks *Callbacks(DiffIndexSeq<Is...>) {
+    static UserCallback Table[] = {&Run<Is>...};
+    static UserCallbacks Container = {Table, static_cast<int>(kNumImpls)};
+    return &Container;
+  }
+
+  template <size_t... Is>
+  static void RunAll(const uint8_t *Data, size_t Size, int *Results,
+                     DiffIndexSeq<Is...>) {
+    // Braced initializers run in order.
+    int Order[] = {(Results[Is] = Run<Is>(Data, Size), 0)...};
+    (void)Order;
+  }
+};
+
+}  // namespace fuzzer
+
+#define LLVM_FUZZER_DIFF_HARNESS(...)                                          \
+  extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {    \
+    return fuzzer::DiffHarness<__VA_ARGS__>::Run<0>(Data, Size);               \
+  }                                                                            \
+  extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() {                      \
+    return fuzzer::DiffHarness<__VA_ARGS__>::Callbacks();                      \
+  }                                                                            \
+  extern "C" void LLVMFuzzerCustomRunAll(const uint8_t *Data, size_t Size,     \
+                                         int *Results) {                       \
+    fuzzer::DiffHarness<__VA_ARGS__>::RunAll(Data, Size, Results);            \
+  }
+
+#endif  // LLVM_FUZZER_DIFF_HARNESS_H
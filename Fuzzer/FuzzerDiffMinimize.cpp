@@ -0,0 +1,175 @@
+//===- FuzzerDiffMinimize.cpp - Minimization of diff inputs ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Shrinking an input while keeping the result of every differential callback.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerExtFunctions.h"
+#include "FuzzerForkServer.h"
+#include "FuzzerInternal.h"
+#include "FuzzerTracePC.h"
+#include "FuzzerUtil.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace fuzzer {
+
+namespace {
+// LLVMFuzzerCustomShrink candidates tried per round, whatever the number of
+// workers, so that the seeds it gets are too.
+const size_t kShrinkCandidatesPerRound = 16;
+// Rounds of LLVMFuzzerCustomShrink candidates without a smaller input after
+// which the byte-level steps take over.
+const size_t kMaxFailedShrinkRounds = 8;
+// Inputs served by one forked child.
+const size_t kMinimizeInputsPerChild = 1000;
+}  // namespace
+
+// Runs every candidate through all callbacks in forked children, one per
+// worker, and returns the index of the smallest one whose results match
+// Target, or Candidates.size() if there is none; of two that match with the
+// same size, the first. Candidates that crash or hang do not match.
+size_t Fuzzer::SelectDiffCandidate(ForkServer *Servers, size_t NumWorkers,
+                                   const std::vector<Unit> &Candidates,
+                                   const std::vector<int> &Target) {
+  std::vector<char> Matches(Candidates.size());
+  std::atomic<size_t> Next(0);
+  auto RunWorker = [&](size_t W) {
+    while (true) {
+      size_t i = Next++;
+      if (i >= Candidates.size()) return;
+      const uint8_t *Reply;
+      size_t ReplySize;
+      if (!Servers[W].Run(Candidates[i].data(), Candidates[i].size(), &Reply,
+                          &ReplySize))
+        continue;
+      bool Match = true;
+      for (size_t j = 0; j < Target.size() && Match; j++) {
+        int Res;
+        memcpy(&Res, Reply + j * sizeof(int), sizeof(int));
+        Match = DiffVerdict(Res) == Target[j];
+      }
+      Matches[i] = Match;
+    }
+  };
+  std::vector<std::thread> Threads;
+  for (size_t W = 0; W < NumWorkers; W++)
+    Threads.push_back(std::thread(RunWorker, W));
+  for (auto &T : Threads)
+    T.join();
+  size_t Best = Candidates.size();
+  for (size_t i = 0; i < Candidates.size(); i++)
+    if (Matches[i] &&
+        (Best == Candidates.size() ||
+         Candidates[i].size() < Candidates[Best].size()))
+      Best = i;
+  return Best;
+}
+
+// Shrinks U as long as the verdicts of all differential callbacks stay the
+// same: first with the candidates of the target's LLVMFuzzerCustomShrink,
+// if it has one, then by cutting out ever smaller chunks of bytes. Every
+// round runs a batch of candidates on NumWorkers cores and keeps the
+// smallest one that still matches. The batches do not depend on the number
+// of workers, and neither does the result, unless LLVMFuzzerCustomShrink
+// depends on more than its seed. Stops early after -max_total_time seconds.
+Unit Fuzzer::MinimizeDiff(const Unit &U, size_t NumWorkers) {
+  NumWorkers = NumWorkers ? NumWorkers : NumberOfCpuCores();
+  NumWorkers = Max(NumWorkers, (size_t)1);
+  std::unique_ptr<ForkServer[]> Servers(new ForkServer[NumWorkers]);
+  for (size_t W = 0; W < NumWorkers; W++)
+    if (!Servers[W].Start(
+            kMinimizeInputsPerChild,
+            ForkedResultsSize() + TPC.MaxExportedCoverageSize(),
+            [this](const uint8_t *Data, size_t Size, uint8_t *Out,
+                   size_t MaxOutSize) {
+              return RunCallbacksInForkedChild(Data, Size, Out, MaxOutSize);
+            }))
+      exit(1);
+
+  size_t NumCallbacks = TPC.UC->size;
+  const uint8_t *Reply;
+  size_t ReplySize;
+  if (!Servers[0].Run(U.data(), U.size(), &Reply, &ReplySize)) {
+    Printf("DIFF_MIN: the input crashed or timed out (status %d)\n",
+           Servers[0].LastStatus());
+    exit(1);
+  }
+  std::vector<int> Target(NumCallbacks);
+  bool IsDiff = false;
+  for (size_t i = 0; i < NumCallbacks; i++) {
+    int Res;
+    memcpy(&Res, Reply + i * sizeof(int), sizeof(int));
+    Target[i] = DiffVerdict(Res);
+    IsDiff |= Target[i] != Target[0];
+  }
+  if (!IsDiff) {
+    Printf("DIFF_MIN: all callbacks agree on the input, nothing to keep\n");
+    exit(1);
+  }
+  Printf("DIFF_MIN: %zd bytes, %zd callbacks, %zd workers\n", U.size(),
+         NumCallbacks, NumWorkers);
+
+  auto TimedOut = [&]() {
+    return Options.MaxTotalTimeSec > 0 &&
+           secondsSinceProcessStartUp() >=
+               static_cast<size_t>(Options.MaxTotalTimeSec);
+  };
+  Unit Best = U;
+  std::vector<Unit> Candidates;
+
+  if (EF->LLVMFuzzerCustomShrink) {
+    Unit Out;
+    unsigned int Seed = 0;
+    for (size_t Failed = 0; Failed < kMaxFailedShrinkRounds && !TimedOut();) {
+      Candidates.clear();
+      Out.resize(Best.size());
+      for (size_t i = 0; i < kShrinkCandidatesPerRound; i++) {
+        size_t Size = EF->LLVMFuzzerCustomShrink(Best.data(), Best.size(),
+                                                 Out.data(), Out.size(),
+                                                 Seed++);
+        if (Size && Size < Best.size())
+          Candidates.push_back(Unit(Out.data(), Out.data() + Size));
+      }
+      size_t Idx = SelectDiffCandidate(Servers.get(), NumWorkers, Candidates,
+                                       Target);
+      if (Idx == Candidates.size()) {
+        Failed++;
+        continue;
+      }
+      Failed = 0;
+      Best.swap(Candidates[Idx]);
+      Printf("DIFF_MIN: %zd bytes (structure)\n", Best.size());
+    }
+  }
+
+  for (size_t Chunk = Best.size() / 2; Chunk && !TimedOut();) {
+    Candidates.clear();
+    for (size_t Beg = 0; Beg < Best.size(); Beg += Chunk) {
+      Candidates.push_back(Unit(Best.begin(), Best.begin() + Beg));
+      Candidates.back().insert(Candidates.back().end(),
+                               Best.begin() + Min(Beg + Chunk, Best.size()),
+                               Best.end());
+    }
+    size_t Idx = SelectDiffCandidate(Servers.get(), NumWorkers, Candidates,
+                                     Target);
+    if (Idx == Candidates.size()) {
+      Chunk /= 2;
+      continue;
+    }
+    Best.swap(Candidates[Idx]);
+    Chunk = Min(Chunk, Best.size() / 2);
+    Printf("DIFF_MIN: %zd bytes (bytes)\n", Best.size());
+  }
+  Printf("DIFF_MIN: %zd -> %zd bytes\n", U.size(), Best.size());
+  return Best;
+}
+
+}  // namespace fuzzer
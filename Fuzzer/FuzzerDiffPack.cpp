@@ -0,0 +1,83 @@
+//===- FuzzerDiffPack.cpp - Packed diff artifacts ---------------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::DiffPack
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerDiffPack.h"
+
+#include <cstring>
+
+namespace fuzzer {
+
+bool DiffPack::Append(const DiffRecord &R) {
+  Header H;
+  H.ClassHash = R.ClassHash;
+  H.FingerprintLo = R.Fingerprint.Lo;
+  H.FingerprintHi = R.Fingerprint.Hi;
+  H.NumResults = static_cast<uint32_t>(R.Results.size());
+  H.InputSize = static_cast<uint32_t>(R.Input.size());
+  H.ParentSize = static_cast<uint32_t>(R.Parent.size());
+  H.SequenceSize = static_cast<uint32_t>(R.MutationSequence.size());
+  size_t ResultsSize = R.Results.size() * sizeof(int);
+  std::vector<uint8_t> Buf(sizeof(H) + ResultsSize + R.Input.size() +
+                           R.Parent.size() + R.MutationSequence.size());
+  uint8_t *P = Buf.data();
+  memcpy(P, &H, sizeof(H));
+  P += sizeof(H);
+  if (ResultsSize) memcpy(P, R.Results.data(), ResultsSize);
+  P += ResultsSize;
+  if (!R.Input.empty()) memcpy(P, R.Input.data(), R.Input.size());
+  P += R.Input.size();
+  if (!R.Parent.empty()) memcpy(P, R.Parent.data(), R.Parent.size());
+  P += R.Parent.size();
+  memcpy(P, R.MutationSequence.data(), R.MutationSequence.size());
+  return Records.Append(Buf.data(), Buf.size());
+}
+
+bool DiffPack::Read(size_t Idx, DiffRecord *R) const {
+  size_t Size = Records.UnitSize(Idx);
+  const uint8_t *P = Records.UnitData(Idx);
+  Header H;
+  if (Size < sizeof(H)) return false;
+  memcpy(&H, P, sizeof(H));
+  size_t ResultsSize = static_cast<size_t>(H.NumResults) * sizeof(int);
+  if (Size != sizeof(H) + ResultsSize + H.InputSize + H.ParentSize +
+                  H.SequenceSize)
+    return false;
+  P += sizeof(H);
+  R->ClassHash = H.ClassHash;
+  R->Fingerprint = {H.FingerprintLo, H.FingerprintHi};
+  R->Results.resize(H.NumResults);
+  if (ResultsSize) memcpy(R->Results.data(), P, ResultsSize);
+  P += ResultsSize;
+  R->Input.assign(P, P + H.InputSize);
+  P += H.InputSize;
+  R->Parent.assign(P, P + H.ParentSize);
+  P += H.ParentSize;
+  R->MutationSequence.assign(reinterpret_cast<const char *>(P),
+                             H.SequenceSize);
+  return true;
+}
+
+uint64_t DiffPack::ClassOf(size_t Idx) const {
+  Header H;
+  if (Records.UnitSize(Idx) < sizeof(H)) return 0;
+  memcpy(&H, Records.UnitData(Idx), sizeof(H));
+  return H.ClassHash;
+}
+
+std::vector<size_t> DiffPack::FindClass(uint64_t ClassHash) const {
+  std::vector<size_t> Res;
+  for (size_t i = 0; i < size(); i++)
+    if (ClassOf(i) == ClassHash)
+      Res.push_back(i);
+  return Res;
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,68 @@
+//===- FuzzerDiffPack.h - INTERNAL - Packed diff artifacts ------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::DiffPack
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_DIFF_PACK_H
+#define LLVM_FUZZER_DIFF_PACK_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerHash.h"
+#include "FuzzerPackedCorpus.h"
+
+#include <string>
+#include <vector>
+
+namespace fuzzer {
+
+// One diff artifact: the input, the unit it was mutated from (empty for a
+// unit of the initial corpus), the result of every differential callback,
+// the coverage fingerprint DumpUnitIfDiff tells diffs apart by, and the
+// mutation sequence that turned the parent into the input.
+struct DiffRecord {
+  uint64_t ClassHash = 0;  // The verdict pattern, as used by -diff_energy.
+  Digest128 Fingerprint = {0, 0};
+  std::vector<int> Results;
+  Unit Input, Parent;
+  std::string MutationSequence;
+};
+
+// Diff artifacts kept in a PackedCorpus at Path.idx and Path.blob, one
+// record per unit, instead of a diff_ and a _BeforeMutationWas_ file each.
+// Every record starts with a fixed header holding its class and sizes, so
+// records are found by class without reading their inputs.
+class DiffPack {
+ public:
+  bool Open(const std::string &Path, bool ReadOnly = false) {
+    return Records.Open(Path, ReadOnly);
+  }
+  bool IsOpen() const { return Records.IsOpen(); }
+  size_t Refresh() { return Records.Refresh(); }
+  size_t size() const { return Records.size(); }
+
+  bool Append(const DiffRecord &R);
+  // Returns false if the record is malformed.
+  bool Read(size_t Idx, DiffRecord *R) const;
+  uint64_t ClassOf(size_t Idx) const;
+  // The indices of the records of class ClassHash, in append order.
+  std::vector<size_t> FindClass(uint64_t ClassHash) const;
+
+ private:
+  struct Header {
+    uint64_t ClassHash;
+    uint64_t FingerprintLo, FingerprintHi;
+    uint32_t NumResults, InputSize, ParentSize, SequenceSize;
+  };
+
+  PackedCorpus Records;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_DIFF_PACK_H
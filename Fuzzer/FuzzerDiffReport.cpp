@@ -0,0 +1,158 @@
+//===- FuzzerDiffReport.cpp - Per-implementation coverage report ----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// The report written by -diff_coverage_report=FILE.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerDiffReport.h"
+#include "FuzzerExtFunctions.h"
+#include "FuzzerTracePC.h"
+#include <algorithm>
+#include <string>
+
+namespace fuzzer {
+
+void DiffCoverageReport::Grow(size_t NumWords) {
+  Covered.resize(NumWords);
+  Agreeing.resize(NumWords);
+  Divergent.resize(NumWords);
+  GuardPCs.resize(NumWords * 64);
+  for (auto &C : Classes)
+    C.Bits.resize(NumWords);
+}
+
+void DiffCoverageReport::Record(const TracePC &TPC) {
+  assert(IsActive());
+  size_t NumWords = (TPC.GetNumPCs() + 63) / 64;
+  if (Covered.size() < NumWords)
+    Grow(NumWords);
+  NumRuns++;
+  bool Diverged = TPC.NumOutputClasses() > 1;
+  NumDivergentRuns += Diverged;
+  auto &Side = Diverged ? Divergent : Agreeing;
+
+  Pattern.resize(NumCallbacks);
+  for (size_t i = 0; i < NumCallbacks; i++)
+    Pattern[i] = TPC.OutputClass(i);
+  OutputClassBits *Class = nullptr;
+  auto It = ClassOfPattern.find(Pattern);
+  if (It != ClassOfPattern.end()) {
+    Class = &Classes[It->second];
+  } else if (Classes.size() < kMaxClasses) {
+    ClassOfPattern[Pattern] = Classes.size();
+    Classes.emplace_back();
+    Class = &Classes.back();
+    Class->Pattern = Pattern;
+    Class->Bits.resize(Covered.size());
+  }
+  if (Class)
+    Class->NumRuns++;
+  else
+    NumUnclassifiedRuns++;
+
+  // Only the touched words of the covered bitmap can be non-zero.
+  const uint64_t *Bits = TPC.CoveredBits();
+  const uintptr_t *PCs = TPC.PCs();
+  size_t NumTouched;
+  const uint32_t *Touched = TPC.TouchedCoverageWords(&NumTouched);
+  for (size_t k = 0; k < NumTouched; k++) {
+    size_t W = Touched[k];
+    uint64_t B = Bits[W];
+    for (uint64_t New = B & ~Covered[W]; New; New &= New - 1)
+      GuardPCs[W * 64 + __builtin_ctzll(New)] =
+          PCs[W * 64 + __builtin_ctzll(New)];
+    Covered[W] |= B;
+    Side[W] |= B;
+    if (Class)
+      Class->Bits[W] |= B;
+  }
+}
+
+// The number of guards in R set in Bits.
+static size_t CountGuards(const std::vector<uint64_t> &Bits,
+                          TracePC::GuardRange R) {
+  size_t N = 0;
+  size_t End = std::min(R.End, Bits.size() * 64);
+  for (size_t W = R.Begin / 64; W * 64 < End; W++) {
+    uint64_t Word = Bits[W];
+    if (W == R.Begin / 64)
+      Word &= ~0ULL << (R.Begin % 64);
+    if ((W + 1) * 64 > End)
+      Word &= ~0ULL >> (64 - End % 64);
+    N += __builtin_popcountll(Word);
+  }
+  return N;
+}
+
+static std::string DescribeModulePC(uintptr_t PC, std::string *Module) {
+  char ModulePathRaw[4096] = "";
+  void *OffsetRaw = nullptr;
+  if (!PC || !EF->__sanitizer_get_module_and_offset_for_pc ||
+      !EF->__sanitizer_get_module_and_offset_for_pc(
+          reinterpret_cast<void *>(PC), ModulePathRaw, sizeof(ModulePathRaw),
+          &OffsetRaw)) {
+    char Buf[32];
+    snprintf(Buf, sizeof(Buf), "0x%zx", static_cast<size_t>(PC));
+    return Buf;
+  }
+  *Module = ModulePathRaw;
+  char Buf[32];
+  snprintf(Buf, sizeof(Buf), "+0x%zx",
+           static_cast<size_t>(reinterpret_cast<uintptr_t>(OffsetRaw)));
+  return *Module + Buf;
+}
+
+void DiffCoverageReport::PrintRange(const std::string &Prefix,
+                                    TracePC::GuardRange R, FILE *Out) const {
+  std::vector<std::string> DivergentOnly;
+  std::string Module = "?";
+  size_t End = std::min(R.End, GuardPCs.size());
+  for (size_t G = R.Begin; G < End; G++) {
+    if (!(Covered[G / 64] >> (G % 64) & 1)) continue;
+    if (Module == "?")
+      DescribeModulePC(GuardPCs[G], &Module);
+    if ((Divergent[G / 64] & ~Agreeing[G / 64]) >> (G % 64) & 1)
+      DivergentOnly.push_back(DescribeModulePC(GuardPCs[G], &Module));
+  }
+  const char *P = Prefix.c_str();
+  fprintf(Out, "%s: %s guards: %zd covered: %zd divergent: %zd "
+               "divergent_only: %zd\n",
+          P, Module.c_str(), R.End - R.Begin, CountGuards(Covered, R),
+          CountGuards(Divergent, R), DivergentOnly.size());
+  for (size_t c = 0; c < Classes.size(); c++)
+    fprintf(Out, "%s CLASS %zd: covered: %zd\n", P, c,
+            CountGuards(Classes[c].Bits, R));
+  for (auto &PC : DivergentOnly)
+    fprintf(Out, "%s DIVERGENT_ONLY: %s\n", P, PC.c_str());
+}
+
+void DiffCoverageReport::Print(const TracePC &TPC, FILE *Out) const {
+  fprintf(Out, "RUNS: %zd DIVERGENT: %zd UNCLASSIFIED: %zd\n", NumRuns,
+          NumDivergentRuns, NumUnclassifiedRuns);
+  for (size_t c = 0; c < Classes.size(); c++) {
+    std::string P;
+    for (uint32_t X : Classes[c].Pattern)
+      P += (P.empty() ? "" : ",") + std::to_string(X);
+    fprintf(Out, "CLASS %zd: %s runs: %zd\n", c, P.c_str(),
+            Classes[c].NumRuns);
+  }
+  bool AllInModules = true;
+  for (size_t i = 0; i < NumCallbacks; i++) {
+    TracePC::GuardRange R = TPC.CallbackGuards(i);
+    if (R.Begin == R.End) {
+      AllInModules = false;
+      continue;
+    }
+    PrintRange("CALLBACK " + std::to_string(i), R, Out);
+  }
+  // Callbacks linked into one module can only be reported together.
+  if (!AllInModules)
+    PrintRange("ALL", {1, TPC.GetNumPCs()}, Out);
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,71 @@
+//===- FuzzerDiffReport.h - Per-implementation coverage report --*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::DiffCoverageReport
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_DIFF_REPORT_H
+#define LLVM_FUZZER_DIFF_REPORT_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerTracePC.h"
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace fuzzer {
+
+// -diff_coverage_report=FILE: the guards covered by the runs of the whole
+// campaign, kept as bitmaps in memory, so that the report at exit does not
+// run the corpus again. Besides the guards covered by any run, it keeps
+// those covered by the runs on which the callbacks diverged, by those on
+// which they agreed, and by the runs of each output class pattern (the
+// OutputClass() of every callback, as numbered by NewOutputDiff_change()).
+// The report splits all of them by the module of each callback; callbacks
+// without a module of their own are reported together.
+class DiffCoverageReport {
+ public:
+  void Start(size_t NumCallbacks) { this->NumCallbacks = NumCallbacks; }
+  bool IsActive() const { return NumCallbacks != 0; }
+
+  // Adds the run whose coverage is in TPC and whose results TPC has
+  // classified.
+  void Record(const TracePC &TPC);
+  void Print(const TracePC &TPC, FILE *Out) const;
+
+  // Runs beyond this many output class patterns are only counted.
+  static const size_t kMaxClasses = 64;
+
+ private:
+  struct OutputClassBits {
+    std::vector<uint32_t> Pattern;
+    size_t NumRuns = 0;
+    std::vector<uint64_t> Bits;
+  };
+
+  void Grow(size_t NumWords);
+  void PrintRange(const std::string &Prefix, TracePC::GuardRange R,
+                  FILE *Out) const;
+
+  size_t NumCallbacks = 0;
+  size_t NumRuns = 0;
+  size_t NumDivergentRuns = 0;
+  size_t NumUnclassifiedRuns = 0;
+  std::vector<uint64_t> Covered, Agreeing, Divergent;
+  // The PC of every guard, taken from its first run.
+  std::vector<uintptr_t> GuardPCs;
+  std::vector<OutputClassBits> Classes;
+  std::map<std::vector<uint32_t>, size_t> ClassOfPattern;
+  std::vector<uint32_t> Pattern;  // Scratch space of Record().
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_DIFF_REPORT_H
@@ -0,0 +1,87 @@
+//===- FuzzerDiffShared.cpp - State shared by diff-mode jobs --------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Shared diff dedup table and corpus ring used with -diff_shared=1.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerDiffShared.h"
+#include "FuzzerIO.h"
+#include "FuzzerUtil.h"
+#include <cstring>
+
+namespace fuzzer {
+
+bool DiffSharedState::Create(const char *Name) {
+  if (!Region.Create(Name, sizeof(Layout))) return false;
+  // A fresh file is zero-filled, which is a valid empty state.
+  L = reinterpret_cast<Layout *>(Region.GetData());
+  L->Magic = kMagic;
+  MyId = GetPid();
+  return true;
+}
+
+bool DiffSharedState::Open(const char *Name) {
+  if (!Region.Open(Name) || Region.GetSize() != sizeof(Layout)) return false;
+  L = reinterpret_cast<Layout *>(Region.GetData());
+  if (L->Magic != kMagic) {
+    L = nullptr;
+    return false;
+  }
+  MyId = GetPid();
+  return true;
+}
+
+bool DiffSharedState::InsertDiffDigest(uint64_t Digest) {
+  assert(IsActive());
+  if (!Digest) Digest = 1;  // Zero marks an empty slot.
+  const size_t kMaxProbes = 64;
+  for (size_t i = 0; i < kMaxProbes; i++) {
+    auto &Slot = L->DiffDigests[(Digest + i) % kNumDiffDigests];
+    uint64_t Old = Slot.load(std::memory_order_relaxed);
+    if (Old == Digest) return false;
+    if (Old) continue;
+    if (Slot.compare_exchange_strong(Old, Digest)) return true;
+    if (Old == Digest) return false;  // Somebody beat us to it.
+  }
+  return true;
+}
+
+void DiffSharedState::PublishUnit(const uint8_t *Data, size_t Size) {
+  assert(IsActive());
+  if (Size > kMaxUnitSize) return;
+  uint64_t Ticket = L->NextTicket.fetch_add(1);
+  UnitSlot &S = L->Units[Ticket % kNumUnitSlots];
+  S.Seq.store(2 * Ticket + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  S.Publisher = MyId;
+  S.Size = Size;
+  memcpy(S.Data, Data, Size);
+  S.Seq.store(2 * Ticket + 2, std::memory_order_release);
+}
+
+void DiffSharedState::FetchNewUnits(std::vector<Unit> *Units) {
+  assert(IsActive());
+  uint64_t End = L->NextTicket.load(std::memory_order_acquire);
+  if (End - ReadCursor > kNumUnitSlots)
+    ReadCursor = End - kNumUnitSlots;  // The older ones are gone.
+  for (; ReadCursor < End; ReadCursor++) {
+    UnitSlot &S = L->Units[ReadCursor % kNumUnitSlots];
+    uint64_t Seq = S.Seq.load(std::memory_order_acquire);
+    if (Seq < 2 * ReadCursor + 2) break;  // Still being written.
+    if (Seq > 2 * ReadCursor + 2) continue;  // Already overwritten.
+    if (S.Publisher == MyId) continue;
+    size_t Size = Min<uint64_t>(S.Size, kMaxUnitSize);
+    Unit U(S.Data, S.Data + Size);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (S.Seq.load(std::memory_order_relaxed) != Seq)
+      continue;  // Overwritten while we were copying it.
+    Units->push_back(std::move(U));
+  }
+}
+
+}  // namespace fuzzer
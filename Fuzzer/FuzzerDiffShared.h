@@ -0,0 +1,78 @@
+//===- FuzzerDiffShared.h - State shared by diff-mode jobs ------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::DiffSharedState
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_DIFF_SHARED_H
+#define LLVM_FUZZER_DIFF_SHARED_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerShmem.h"
+
+#include <atomic>
+#include <vector>
+
+namespace fuzzer {
+
+// State shared by all the jobs of one -jobs=N -diff_shared=1 run, kept in a
+// SharedMemoryRegion created by the supervisor:
+//   * a table of diff coverage fingerprints, so that a diff seen by one job
+//     is not saved again by the others;
+//   * a ring of corpus units, to which every job appends the units it adds
+//     and from which every job pulls the units added by the others.
+// Both are lock-free so that a job killed at any point cannot wedge the rest.
+class DiffSharedState {
+ public:
+  static const size_t kNumDiffDigests = 1 << 20;
+  static const size_t kNumUnitSlots = 1 << 10;
+  static const size_t kMaxUnitSize = (1 << 14) - 64;
+
+  bool Create(const char *Name);
+  bool Open(const char *Name);
+  bool Destroy(const char *Name) { return Region.Destroy(Name); }
+  bool IsActive() const { return L != nullptr; }
+
+  // Returns true if no job has inserted Digest before. If the table is
+  // full, every digest is reported as new.
+  bool InsertDiffDigest(uint64_t Digest);
+
+  // Makes the unit visible to the other jobs. Units larger than
+  // kMaxUnitSize are not shared.
+  void PublishUnit(const uint8_t *Data, size_t Size);
+
+  // Appends the units published by other jobs since the previous call.
+  // Units that were overwritten before we got to them are skipped.
+  void FetchNewUnits(std::vector<Unit> *Units);
+
+ private:
+  struct UnitSlot {
+    // 2 * Ticket + 1 while the slot is being written, 2 * Ticket + 2 once
+    // unit number Ticket is complete.
+    std::atomic<uint64_t> Seq;
+    uint64_t Publisher;
+    uint64_t Size;
+    uint8_t Data[kMaxUnitSize];
+  };
+  struct Layout {
+    uint64_t Magic;
+    std::atomic<uint64_t> NextTicket;
+    std::atomic<uint64_t> DiffDigests[kNumDiffDigests];
+    UnitSlot Units[kNumUnitSlots];
+  };
+  static const uint64_t kMagic = 0x4446465348415245ULL;  // "DFFSHARE"
+
+  SharedMemoryRegion Region;
+  Layout *L = nullptr;
+  uint64_t ReadCursor = 0;
+  uint64_t MyId = 0;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_DIFF_SHARED_H
@@ -0,0 +1,203 @@
+//===- FuzzerDiffThreads.cpp - Parallel differential callbacks ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Worker threads used by -diff_parallel=1 and executors of -diff_threads=N.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerDiffThreads.h"
+#include "FuzzerIO.h"
+#include "FuzzerTracePC.h"
+#include "FuzzerUtil.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+namespace fuzzer {
+
+void DiffThreadPool::Start(const UserCallback *CBs, size_t NumCallbacks) {
+  assert(!IsRunning());
+  Callbacks.assign(CBs, CBs + NumCallbacks);
+  Exiting = false;
+  std::vector<unsigned> Cpus;
+  std::vector<unsigned> Pinned = GetThreadAffinity();
+  if (!Pinned.empty()) {
+    // A job bound by -pin_cpus stays within its own CPUs, which no other
+    // worker's jobs use: the fuzzing thread takes the first of them and the
+    // workers share the rest.
+    SetThreadAffinity(Pinned[0]);
+    Cpus.assign(Pinned.begin() + 1, Pinned.end());
+    if (Cpus.empty())
+      Cpus.push_back(Pinned[0]);
+  } else {
+    unsigned NumCpus = std::max(1U, std::thread::hardware_concurrency());
+    // CPU 0 is left for the fuzzing thread whenever there is room for it.
+    unsigned FirstCpu = NumCpus > NumCallbacks ? 1 : 0;
+    for (unsigned i = 0; i < NumCpus; i++)
+      Cpus.push_back((FirstCpu + i) % NumCpus);
+  }
+  for (size_t i = 0; i < NumCallbacks; i++)
+    Workers.emplace_back(&DiffThreadPool::WorkerLoop, this, i,
+                         Cpus[i % Cpus.size()]);
+}
+
+void DiffThreadPool::Stop() {
+  if (!IsRunning()) return;
+  {
+    std::lock_guard<std::mutex> Lock(Mu);
+    Exiting = true;
+  }
+  WorkCV.notify_all();
+  for (auto &T : Workers)
+    T.join();
+  Workers.clear();
+}
+
+bool DiffThreadPool::Run(const uint8_t *Data, size_t Size, int *Results,
+                         uint64_t *Nanos) {
+  assert(IsRunning());
+  std::unique_lock<std::mutex> Lock(Mu);
+  CurData = Data;
+  CurSize = Size;
+  CurResults = Results;
+  CurNanos = Nanos;
+  CurInputModified = false;
+  NumPending = Workers.size();
+  Generation++;
+  WorkCV.notify_all();
+  DoneCV.wait(Lock, [&] { return NumPending == 0; });
+  return !CurInputModified;
+}
+
+void DiffThreadPool::WorkerLoop(size_t Idx, unsigned Cpu) {
+  SetThreadAffinity(Cpu);
+  BlockAlarmSignalForCurrentThread();
+  TPC.SelectValueProfileMap(Idx);
+  TPC.UseThreadCmpTables();
+  size_t SeenGeneration = 0;
+  while (true) {
+    const uint8_t *Data;
+    size_t Size;
+    {
+      std::unique_lock<std::mutex> Lock(Mu);
+      WorkCV.wait(Lock, [&] { return Exiting || Generation != SeenGeneration; });
+      if (Exiting) return;
+      SeenGeneration = Generation;
+      Data = CurData;
+      Size = CurSize;
+    }
+    // Like Fuzzer::ExecuteCallback, give every callback a private heap copy
+    // so that buffer overflows in it are reliably found.
+    uint8_t *DataCopy = new uint8_t[Size];
+    memcpy(DataCopy, Data, Size);
+    auto Start = std::chrono::steady_clock::now();
+    int Res = Callbacks[Idx](DataCopy, Size);
+    auto Nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - Start);
+    bool Modified = memcmp(DataCopy, Data, Size) != 0;
+    delete[] DataCopy;
+    {
+      std::lock_guard<std::mutex> Lock(Mu);
+      CurResults[Idx] = Res;
+      CurNanos[Idx] = Nanos.count();
+      CurInputModified |= Modified;
+      if (--NumPending == 0)
+        DoneCV.notify_one();
+    }
+  }
+}
+
+thread_local const Unit *DiffExecutorPool::CurInput;
+
+void DiffExecutorPool::Start(const UserCallback *CBs, size_t NumCallbacks,
+                             size_t NumThreads) {
+  assert(!IsRunning());
+  Callbacks.assign(CBs, CBs + NumCallbacks);
+  Exiting = false;
+  for (size_t i = 0; i < NumThreads; i++)
+    Executors.emplace_back(&DiffExecutorPool::ExecutorLoop, this);
+}
+
+void DiffExecutorPool::Stop() {
+  if (!IsRunning()) return;
+  {
+    std::lock_guard<std::mutex> Lock(Mu);
+    Exiting = true;
+  }
+  WorkCV.notify_all();
+  for (auto &T : Executors)
+    T.join();
+  Executors.clear();
+}
+
+size_t DiffExecutorPool::Run(const Unit *Inputs, size_t N, int *Results,
+                             Unit *Coverage, uint64_t *Nanos) {
+  assert(IsRunning());
+  std::unique_lock<std::mutex> Lock(Mu);
+  CurInputs = Inputs;
+  CurN = N;
+  CurResults = Results;
+  CurCoverage = Coverage;
+  CurNanos = Nanos;
+  NextInput = 0;
+  ModifiedInput = N;
+  NumPending = Executors.size();
+  Generation++;
+  WorkCV.notify_all();
+  DoneCV.wait(Lock, [&] { return NumPending == 0; });
+  return ModifiedInput;
+}
+
+void DiffExecutorPool::RunInput(size_t J, Unit &Copy, Unit &ExportBuffer) {
+  const Unit &U = CurInputs[J];
+  CurInput = &U;
+  for (size_t i = 0; i < Callbacks.size(); i++) {
+    TPC.ResetCoverage();
+    // A private heap copy, as in Fuzzer::ExecuteCallback.
+    Copy = U;
+    auto Start = std::chrono::steady_clock::now();
+    int Res = Callbacks[i](Copy.data(), Copy.size());
+    auto Nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - Start);
+    if (Copy != U)
+      ModifiedInput = J;
+    size_t Idx = i * CurN + J;
+    CurResults[Idx] = Res;
+    CurNanos[Idx] = Nanos.count();
+    size_t Size = TPC.ExportCoverage(ExportBuffer.data(), ExportBuffer.size());
+    CurCoverage[Idx].assign(ExportBuffer.data(), ExportBuffer.data() + Size);
+  }
+  CurInput = nullptr;
+}
+
+void DiffExecutorPool::ExecutorLoop() {
+  BlockAlarmSignalForCurrentThread();
+  if (!TPC.UseThreadCoverage()) {
+    Printf("ERROR: can't allocate the coverage tables of an executor\n");
+    exit(1);
+  }
+  TPC.UseThreadCmpTables();
+  Unit Copy, ExportBuffer(TPC.MaxExportedCoverageSize());
+  size_t SeenGeneration = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> Lock(Mu);
+      WorkCV.wait(Lock, [&] { return Exiting || Generation != SeenGeneration; });
+      if (Exiting) break;
+      SeenGeneration = Generation;
+    }
+    for (size_t J; (J = NextInput++) < CurN;)
+      RunInput(J, Copy, ExportBuffer);
+    std::lock_guard<std::mutex> Lock(Mu);
+    if (--NumPending == 0)
+      DoneCV.notify_one();
+  }
+  TPC.FreeThreadCoverage();
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,115 @@
+//===- FuzzerDiffThreads.h - Parallel differential callbacks ----*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::DiffThreadPool, fuzzer::DiffExecutorPool
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_DIFF_THREADS_H
+#define LLVM_FUZZER_DIFF_THREADS_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerExtFunctions.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fuzzer {
+
+// Runs every differential callback on its own worker thread, each pinned to
+// a separate CPU. Every implementation lives in its own instrumented module,
+// so the workers write to disjoint slices of the coverage counters and the
+// results can be collected once all of them are done.
+class DiffThreadPool {
+ public:
+  ~DiffThreadPool() { Stop(); }
+
+  void Start(const UserCallback *Callbacks, size_t NumCallbacks);
+  void Stop();
+  bool IsRunning() const { return !Workers.empty(); }
+
+  // Executes all callbacks on Data and stores their return values in Results
+  // and the nanoseconds each of them took in Nanos.
+  // Returns false if some callback has overwritten its copy of the input.
+  bool Run(const uint8_t *Data, size_t Size, int *Results, uint64_t *Nanos);
+
+ private:
+  void WorkerLoop(size_t Idx, unsigned Cpu);
+
+  std::vector<UserCallback> Callbacks;
+  std::vector<std::thread> Workers;
+
+  std::mutex Mu;
+  std::condition_variable WorkCV, DoneCV;
+  size_t Generation = 0;  // Bumped for every Run().
+  size_t NumPending = 0;
+  bool Exiting = false;
+
+  const uint8_t *CurData = nullptr;
+  size_t CurSize = 0;
+  int *CurResults = nullptr;
+  uint64_t *CurNanos = nullptr;
+  bool CurInputModified = false;
+};
+
+// Runs the mutants of a batch on executor threads: each executor takes the
+// next input and runs all callbacks on it, so that N executors run N inputs
+// at once. The guards hit on an executor go to coverage tables of its own
+// (TracePC::UseThreadCoverage()), and the coverage of every run is exported
+// for the fuzzing thread to replay, as with -diff_batch.
+class DiffExecutorPool {
+ public:
+  ~DiffExecutorPool() { Stop(); }
+
+  void Start(const UserCallback *Callbacks, size_t NumCallbacks,
+             size_t NumThreads);
+  void Stop();
+  bool IsRunning() const { return !Executors.empty(); }
+  size_t NumThreads() const { return Executors.size(); }
+
+  // Runs every callback on each of the N Inputs. The return value of
+  // callback i on input j goes to Results[i * N + j], its exported coverage
+  // to Coverage[i * N + j] and its running time to Nanos[i * N + j].
+  // Returns the index of an input some callback has overwritten its copy
+  // of, or N.
+  size_t Run(const Unit *Inputs, size_t N, int *Results, Unit *Coverage,
+             uint64_t *Nanos);
+
+  // The input the calling executor runs, nullptr on other threads. Crash
+  // reports use it instead of the fuzzer's current unit.
+  static const Unit *ThreadInput() { return CurInput; }
+
+ private:
+  void ExecutorLoop();
+  void RunInput(size_t J, Unit &Copy, Unit &ExportBuffer);
+
+  std::vector<UserCallback> Callbacks;
+  std::vector<std::thread> Executors;
+
+  std::mutex Mu;
+  std::condition_variable WorkCV, DoneCV;
+  size_t Generation = 0;  // Bumped for every Run().
+  size_t NumPending = 0;
+  bool Exiting = false;
+
+  const Unit *CurInputs = nullptr;
+  size_t CurN = 0;
+  int *CurResults = nullptr;
+  Unit *CurCoverage = nullptr;
+  uint64_t *CurNanos = nullptr;
+  std::atomic<size_t> NextInput{0};
+  std::atomic<size_t> ModifiedInput{0};
+
+  static thread_local const Unit *CurInput;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_DIFF_THREADS_H
@@ -0,0 +1,235 @@
+//===- FuzzerDigestSet.h - INTERNAL - Set of hash digests -------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// DigestSet.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_DIGEST_SET_H
+#define LLVM_FUZZER_DIGEST_SET_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerHash.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace fuzzer {
+
+// A set of fixed-width digests used to remember which inputs or coverage
+// fingerprints have already been seen during long campaigns.
+//
+// By default an open-addressing table with linear probing stores every
+// digest exactly. With SetMaxSize(N) the table forgets everything once it
+// holds N digests, which bounds its memory. With SetApproximate(LogBits)
+// the set turns into a Bloom filter of 2^LogBits bits: constant memory,
+// no false negatives, and a false-positive rate that grows as it fills up.
+class DigestSet {
+ public:
+  void SetMaxSize(size_t N) { MaxSize = N; }
+  void SetApproximate(size_t LogBits) {
+    assert(LogBits >= 6 && LogBits < 64);
+    Bloom.assign((size_t)1 << (LogBits - 6), 0);
+    BloomMask = ((uint64_t)1 << LogBits) - 1;
+    Slots.clear();
+    NumDigests = 0;
+  }
+  bool IsApproximate() const { return !Bloom.empty(); }
+
+  // Returns true if D was not in the set.
+  bool Insert(Digest128 D) {
+    if (IsApproximate()) return InsertBloom(D);
+    if (MaxSize && NumDigests >= MaxSize) clear();
+    if (IsFree(D)) {
+      if (HasFreeDigest) return false;
+      NumDigests++;
+      return HasFreeDigest = true;
+    }
+    if ((NumDigests + 1) * 2 > Slots.size()) Grow();
+    if (InsertIntoSlots(D, &Slots)) {
+      NumDigests++;
+      return true;
+    }
+    return false;
+  }
+  bool Insert(uint64_t D) { return Insert(Digest128{D, 0}); }
+
+  bool Contains(Digest128 D) const {
+    if (IsApproximate()) {
+      for (size_t i = 0; i < kNumBloomHashes; i++)
+        if (!(Bloom[BloomBit(D, i) / 64] & (1ULL << (BloomBit(D, i) % 64))))
+          return false;
+      return true;
+    }
+    if (IsFree(D)) return HasFreeDigest;
+    if (Slots.empty()) return false;
+    size_t Mask = Slots.size() - 1;
+    for (size_t Idx = D.Lo & Mask; !IsFree(Slots[Idx]);
+         Idx = (Idx + 1) & Mask)
+      if (Slots[Idx] == D) return true;
+    return false;
+  }
+  bool Contains(uint64_t D) const { return Contains(Digest128{D, 0}); }
+
+  // Returns true if D was in the set. Only supported in exact mode.
+  bool Erase(Digest128 D) {
+    assert(!IsApproximate());
+    if (IsFree(D)) {
+      if (!HasFreeDigest) return false;
+      HasFreeDigest = false;
+      NumDigests--;
+      return true;
+    }
+    if (Slots.empty()) return false;
+    size_t Mask = Slots.size() - 1;
+    size_t Hole = D.Lo & Mask;
+    for (; Slots[Hole] != D; Hole = (Hole + 1) & Mask)
+      if (IsFree(Slots[Hole])) return false;
+    // Backward-shift the digests that probed past the hole, so that every
+    // lookup still finds its digest before the first free slot.
+    for (size_t Idx = (Hole + 1) & Mask; !IsFree(Slots[Idx]);
+         Idx = (Idx + 1) & Mask) {
+      size_t Home = Slots[Idx].Lo & Mask;
+      if (((Idx - Home) & Mask) >= ((Idx - Hole) & Mask)) {
+        Slots[Hole] = Slots[Idx];
+        Hole = Idx;
+      }
+    }
+    Slots[Hole] = Digest128{0, 0};
+    NumDigests--;
+    return true;
+  }
+
+  // Number of digests inserted since the last clear(). In approximate mode
+  // this only counts the inserts that were reported as new.
+  size_t size() const { return NumDigests; }
+
+  void clear() {
+    Slots.clear();
+    std::fill(Bloom.begin(), Bloom.end(), 0);
+    HasFreeDigest = false;
+    NumDigests = 0;
+  }
+
+  // Appends the digests, or the bits of the Bloom filter, to Out.
+  void Save(std::vector<uint8_t> *Out) const {
+    uint64_t Header[2] = {IsApproximate() ? Bloom.size() : 0, NumDigests};
+    Append(Out, Header, sizeof(Header));
+    if (IsApproximate()) {
+      Append(Out, Bloom.data(), Bloom.size() * sizeof(uint64_t));
+      return;
+    }
+    if (HasFreeDigest) {
+      Digest128 Zero = {0, 0};
+      Append(Out, &Zero, sizeof(Zero));
+    }
+    for (auto &D : Slots)
+      if (!IsFree(D)) Append(Out, &D, sizeof(D));
+  }
+
+  // Adds what Save() wrote at *P to the set and moves *P past it. Returns
+  // false if that is not there or was saved in another mode; a set saved in
+  // another mode is skipped.
+  bool Load(const uint8_t **P, const uint8_t *End) {
+    uint64_t Header[2];
+    if (!Take(P, End, Header, sizeof(Header))) return false;
+    if (Header[0] != (IsApproximate() ? Bloom.size() : 0)) {
+      // Skip the payload, so that what follows it can still be loaded.
+      size_t Avail = static_cast<size_t>(End - *P);
+      size_t Width = Header[0] ? sizeof(uint64_t) : sizeof(Digest128);
+      uint64_t N = Header[0] ? Header[0] : Header[1];
+      *P = Avail / Width < N ? End : *P + N * Width;
+      return false;
+    }
+    if (IsApproximate()) {
+      size_t Bytes = Bloom.size() * sizeof(uint64_t);
+      if (static_cast<size_t>(End - *P) < Bytes) return false;
+      for (size_t i = 0; i < Bloom.size(); i++) {
+        uint64_t W;
+        memcpy(&W, *P + i * sizeof(W), sizeof(W));
+        Bloom[i] |= W;
+      }
+      *P += Bytes;
+      NumDigests += Header[1];
+      return true;
+    }
+    if ((End - *P) / sizeof(Digest128) < Header[1]) return false;
+    for (uint64_t i = 0; i < Header[1]; i++) {
+      Digest128 D{0, 0};
+      if (!Take(P, End, &D, sizeof(D))) return false;
+      Insert(D);
+    }
+    return true;
+  }
+
+ private:
+  static void Append(std::vector<uint8_t> *Out, const void *Data,
+                     size_t Size) {
+    const uint8_t *B = static_cast<const uint8_t *>(Data);
+    Out->insert(Out->end(), B, B + Size);
+  }
+  static bool Take(const uint8_t **P, const uint8_t *End, void *Data,
+                   size_t Size) {
+    if (static_cast<size_t>(End - *P) < Size) return false;
+    memcpy(Data, *P, Size);
+    *P += Size;
+    return true;
+  }
+
+  static const size_t kNumBloomHashes = 4;
+  // The all-zero digest marks a free slot; it is tracked by HasFreeDigest.
+  static bool IsFree(const Digest128 &D) { return !D.Lo && !D.Hi; }
+
+  static bool InsertIntoSlots(Digest128 D, std::vector<Digest128> *Table) {
+    size_t Mask = Table->size() - 1;
+    size_t Idx = D.Lo & Mask;
+    for (; !IsFree((*Table)[Idx]); Idx = (Idx + 1) & Mask)
+      if ((*Table)[Idx] == D) return false;
+    (*Table)[Idx] = D;
+    return true;
+  }
+
+  void Grow() {
+    std::vector<Digest128> NewSlots(Slots.empty() ? 1024 : Slots.size() * 2,
+                                    Digest128{0, 0});
+    for (auto &D : Slots)
+      if (!IsFree(D))
+        InsertIntoSlots(D, &NewSlots);
+    Slots.swap(NewSlots);
+  }
+
+  // Double hashing: bit i is Lo + i * Hi'. Hi' is odd so that the probes
+  // do not collapse when a 64-bit digest is stored with Hi == 0.
+  size_t BloomBit(Digest128 D, size_t i) const {
+    uint64_t Step = (D.Hi ^ (D.Lo >> 32) ^ (D.Lo << 29)) | 1;
+    return (D.Lo + i * Step) & BloomMask;
+  }
+
+  bool InsertBloom(Digest128 D) {
+    bool New = false;
+    for (size_t i = 0; i < kNumBloomHashes; i++) {
+      size_t Bit = BloomBit(D, i);
+      uint64_t &W = Bloom[Bit / 64];
+      uint64_t Mask = 1ULL << (Bit % 64);
+      New |= !(W & Mask);
+      W |= Mask;
+    }
+    if (New) NumDigests++;
+    return New;
+  }
+
+  std::vector<Digest128> Slots;  // Size is zero or a power of two.
+  std::vector<uint64_t> Bloom;
+  uint64_t BloomMask = 0;
+  size_t NumDigests = 0;
+  size_t MaxSize = 0;
+  bool HasFreeDigest = false;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_DIGEST_SET_H
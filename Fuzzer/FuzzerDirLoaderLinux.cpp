@@ -0,0 +1,217 @@
+//===- FuzzerDirLoaderLinux.cpp - Load a corpus dir with getdents64 -------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// ReadDirInParallel() on top of getdents64 and openat.
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if LIBFUZZER_LINUX
+
+#include "FuzzerIO.h"
+#include "FuzzerUtil.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+namespace fuzzer {
+
+// The files to read are queued by name, relative to their directory, which
+// stays open while any of them is queued. The queue is bounded so that the
+// names don't pile up while the readers are behind. A reader is started for
+// every kFilesPerReader files listed, so that rereading a directory with few
+// new files, as -reload does, starts few threads or none.
+static const size_t kMaxQueuedFiles = 1024;
+static const unsigned kMaxReaderThreads = 8;
+static const size_t kFilesPerReader = 64;
+
+namespace {
+
+struct OpenDir {
+  explicit OpenDir(int Fd) : Fd(Fd) {}
+  ~OpenDir() { close(Fd); }
+  const int Fd;
+};
+
+struct FileToRead {
+  std::shared_ptr<OpenDir> Dir;
+  std::string Name;
+  size_t Index;  // In the order the files were listed in.
+};
+
+// The record getdents64 fills in; glibc has no declaration of its own.
+struct LinuxDirent64 {
+  uint64_t Ino;
+  int64_t Off;
+  unsigned short RecLen;
+  unsigned char Type;
+  char Name[1];
+};
+
+class DirLoader {
+ public:
+  DirLoader(const std::string &Path, long *Epoch, size_t MaxSize)
+      : Path(Path), Epoch(Epoch), MaxSize(MaxSize),
+        MinEpoch(Epoch ? *Epoch : 0),
+        MaxReaders(std::max(1U, std::min(kMaxReaderThreads,
+                                         NumberOfCpuCores()))) {}
+
+  void Run(std::vector<Unit> *V, bool ExitOnError);
+
+ private:
+  void ListDir(int Fd, const std::string &Name, bool TopDir);
+  void Push(const std::shared_ptr<OpenDir> &Dir, const char *Name);
+  void ReaderLoop();
+
+  const std::string Path;
+  long *Epoch;
+  const size_t MaxSize;
+  const long MinEpoch;
+  const unsigned MaxReaders;
+  // Only touched by the thread listing the directories.
+  std::vector<std::thread> Readers;
+
+  std::mutex Mu;
+  std::condition_variable NotEmpty, NotFull;
+  std::deque<FileToRead> Queue;
+  bool Listed = false;
+  size_t NumListed = 0;
+  size_t NumLoaded = 0;
+  // Indexed like FileToRead::Index; references stay valid as it grows.
+  std::deque<Unit> Units;
+  std::string Missing;      // The first directory or file that can't be read.
+  bool MissingDir = false;
+};
+
+void DirLoader::Push(const std::shared_ptr<OpenDir> &Dir, const char *Name) {
+  std::unique_lock<std::mutex> Lock(Mu);
+  NotFull.wait(Lock, [&] { return Queue.size() < kMaxQueuedFiles; });
+  Queue.push_back({Dir, Name, NumListed++});
+  Units.emplace_back();
+  bool NeedReader = Readers.size() < MaxReaders &&
+                    NumListed > Readers.size() * kFilesPerReader;
+  Lock.unlock();
+  NotEmpty.notify_one();
+  if (NeedReader)
+    Readers.emplace_back(&DirLoader::ReaderLoop, this);
+}
+
+// Mirrors ListFilesInDirRecursive(): directories not modified since *Epoch
+// are skipped, and so are subdirectories starting with '.'.
+void DirLoader::ListDir(int Fd, const std::string &Name, bool TopDir) {
+  if (Fd < 0) {
+    std::lock_guard<std::mutex> Lock(Mu);
+    if (Missing.empty()) {
+      Missing = Name;
+      MissingDir = true;
+    }
+    return;
+  }
+  auto Dir = std::make_shared<OpenDir>(Fd);
+  struct stat St;
+  long E = fstat(Fd, &St) ? 0 : St.st_mtime;
+  if (Epoch && E && *Epoch >= E) return;
+
+  alignas(LinuxDirent64) char Buf[1 << 15];
+  while (true) {
+    long Len = syscall(SYS_getdents64, Fd, Buf, sizeof(Buf));
+    if (Len < 0 && errno == EINTR) continue;
+    if (Len <= 0) break;
+    for (long Pos = 0; Pos < Len;) {
+      auto *D = reinterpret_cast<LinuxDirent64 *>(Buf + Pos);
+      Pos += D->RecLen;
+      unsigned char Type = D->Type;
+      if (Type == DT_UNKNOWN) {
+        struct stat Entry;
+        if (fstatat(Fd, D->Name, &Entry, AT_SYMLINK_NOFOLLOW)) continue;
+        Type = S_ISDIR(Entry.st_mode) ? DT_DIR
+               : S_ISLNK(Entry.st_mode) ? DT_LNK
+               : S_ISREG(Entry.st_mode) ? DT_REG : DT_UNKNOWN;
+      }
+      if (Type == DT_REG || Type == DT_LNK)
+        Push(Dir, D->Name);
+      else if (Type == DT_DIR && *D->Name != '.')
+        ListDir(openat(Fd, D->Name, O_RDONLY | O_DIRECTORY | O_CLOEXEC),
+                DirPlusFile(Name, D->Name), false);
+    }
+  }
+  if (Epoch && TopDir)
+    *Epoch = E;
+}
+
+void DirLoader::ReaderLoop() {
+  std::unique_lock<std::mutex> Lock(Mu);
+  while (true) {
+    NotEmpty.wait(Lock, [&] { return Listed || !Queue.empty(); });
+    if (Queue.empty()) return;
+    FileToRead F = std::move(Queue.front());
+    Queue.pop_front();
+    Unit &Slot = Units[F.Index];
+    Lock.unlock();
+    NotFull.notify_one();
+
+    Unit U;
+    long MTime = 0;
+    int Fd = openat(F.Dir->Fd, F.Name.c_str(), O_RDONLY | O_CLOEXEC);
+    bool Read = Fd >= 0 && ReadFdToUnit(Fd, MaxSize, &U, &MTime);
+    if (Fd >= 0)
+      close(Fd);
+    bool Skip = Read && Epoch && MTime < MinEpoch;
+    F.Dir.reset();
+
+    Lock.lock();
+    if (!Read && Missing.empty())
+      Missing = F.Name;
+    if (Read && !Skip) {
+      Slot = std::move(U);
+      NumLoaded++;
+      if ((NumLoaded & (NumLoaded - 1)) == 0 && NumLoaded >= 1024)
+        Printf("Loaded %zd files from %s\n", NumLoaded, Path.c_str());
+    }
+  }
+}
+
+void DirLoader::Run(std::vector<Unit> *V, bool ExitOnError) {
+  ListDir(open(Path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC), Path,
+          /*TopDir*/ true);
+  {
+    std::lock_guard<std::mutex> Lock(Mu);
+    Listed = true;
+  }
+  NotEmpty.notify_all();
+  for (auto &T : Readers)
+    T.join();
+  // Like ListFilesInDirRecursive(), a missing directory is always fatal.
+  if (MissingDir || (ExitOnError && !Missing.empty())) {
+    Printf("No such directory: %s; exiting\n", Missing.c_str());
+    exit(1);
+  }
+  for (auto &U : Units)
+    if (!U.empty())
+      V->push_back(std::move(U));
+}
+
+}  // namespace
+
+bool ReadDirInParallel(const std::string &Dir, std::vector<Unit> *V,
+                       long *Epoch, size_t MaxSize, bool ExitOnError) {
+  DirLoader(Dir, Epoch, MaxSize).Run(V, ExitOnError);
+  return true;
+}
+
+}  // namespace fuzzer
+
+#endif  // LIBFUZZER_LINUX
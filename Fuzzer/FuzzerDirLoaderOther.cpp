@@ -0,0 +1,26 @@
+//===- FuzzerDirLoaderOther.cpp - ReadDirInParallel stub ------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// ReadDirInParallel stub for platforms without getdents64; callers list the
+// files first.
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if !LIBFUZZER_LINUX
+
+#include "FuzzerIO.h"
+
+namespace fuzzer {
+
+bool ReadDirInParallel(const std::string &Dir, std::vector<Unit> *V,
+                       long *Epoch, size_t MaxSize, bool ExitOnError) {
+  return false;
+}
+
+}  // namespace fuzzer
+
+#endif  // !LIBFUZZER_LINUX
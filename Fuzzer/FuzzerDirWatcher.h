@@ -0,0 +1,44 @@
+//===- FuzzerDirWatcher.h - Watch a directory for new files -----*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::DirWatcher
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_DIR_WATCHER_H
+#define LLVM_FUZZER_DIR_WATCHER_H
+
+#include "FuzzerDefs.h"
+
+#include <string>
+#include <vector>
+
+namespace fuzzer {
+
+// Reports the files written into a directory, so that reloading the output
+// corpus of other jobs does not need to scan the whole directory. Only the
+// directory itself is watched, not its subdirectories.
+class DirWatcher {
+ public:
+  ~DirWatcher() { Stop(); }
+
+  // Returns false if watching is not supported here.
+  bool Start(const std::string &Dir);
+  void Stop();
+  bool IsActive() const { return Fd >= 0; }
+
+  // Appends the names of the files finished since the last call. Returns
+  // false if some were lost, in which case the directory has to be rescanned.
+  bool Poll(std::vector<std::string> *Names);
+
+ private:
+  int Fd = -1;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_DIR_WATCHER_H
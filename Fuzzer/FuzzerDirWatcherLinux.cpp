@@ -0,0 +1,62 @@
+//===- FuzzerDirWatcherLinux.cpp - Watch a directory with inotify ---------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// DirWatcher on top of inotify.
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if LIBFUZZER_LINUX
+
+#include "FuzzerDirWatcher.h"
+
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace fuzzer {
+
+bool DirWatcher::Start(const std::string &Dir) {
+  assert(!IsActive());
+  Fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (Fd < 0) return false;
+  // Units are written in place (closed) or renamed into the directory.
+  if (inotify_add_watch(Fd, Dir.c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) < 0) {
+    Stop();
+    return false;
+  }
+  return true;
+}
+
+void DirWatcher::Stop() {
+  if (Fd >= 0) close(Fd);
+  Fd = -1;
+}
+
+bool DirWatcher::Poll(std::vector<std::string> *Names) {
+  assert(IsActive());
+  alignas(struct inotify_event) char Buf[1 << 16];
+  bool Complete = true;
+  while (true) {
+    ssize_t Len = read(Fd, Buf, sizeof(Buf));
+    if (Len < 0 && errno == EINTR) continue;
+    if (Len <= 0) break;  // EAGAIN: no more events.
+    for (char *P = Buf; P < Buf + Len;) {
+      auto *E = reinterpret_cast<struct inotify_event *>(P);
+      P += sizeof(*E) + E->len;
+      if (E->mask & IN_Q_OVERFLOW)
+        Complete = false;
+      else if (E->len && !(E->mask & IN_ISDIR))
+        Names->push_back(E->name);
+    }
+  }
+  return Complete;
+}
+
+}  // namespace fuzzer
+
+#endif  // LIBFUZZER_LINUX
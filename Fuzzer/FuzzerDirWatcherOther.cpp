@@ -0,0 +1,26 @@
+//===- FuzzerDirWatcherOther.cpp - DirWatcher stub ------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// DirWatcher stub for platforms without inotify; callers keep scanning.
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if !LIBFUZZER_LINUX
+
+#include "FuzzerDirWatcher.h"
+
+namespace fuzzer {
+
+bool DirWatcher::Start(const std::string &Dir) { return false; }
+
+void DirWatcher::Stop() {}
+
+bool DirWatcher::Poll(std::vector<std::string> *Names) { return false; }
+
+}  // namespace fuzzer
+
+#endif  // !LIBFUZZER_LINUX
@@ -0,0 +1,257 @@
+//===- FuzzerDirected.cpp - Distances to target functions -----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// The call graph distances used by -directed_targets=FILE.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerDirected.h"
+#include "FuzzerExtFunctions.h"
+#include "FuzzerIO.h"
+#include "FuzzerTracePC.h"
+#include "FuzzerUtil.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <deque>
+#include <sstream>
+
+namespace fuzzer {
+
+const uint16_t TargetDistances::kUnreachable;
+
+namespace {
+// A line number: decimal digits only, no sign or blanks.
+bool ParseLineNumber(const std::string &S, size_t *Line) {
+  if (S.empty() || S.size() > 9 ||
+      S.find_first_not_of("0123456789") != std::string::npos)
+    return false;
+  *Line = strtoul(S.c_str(), nullptr, 10);
+  return true;
+}
+}  // namespace
+
+bool TargetDistances::Load(const std::string &Path) {
+  if (!EF->__sanitizer_get_module_and_offset_for_pc) {
+    Printf("ERROR: -directed_targets needs "
+           "__sanitizer_get_module_and_offset_for_pc\n");
+    return false;
+  }
+  std::istringstream ISS(FileToString(Path));
+  std::string L;
+  while (std::getline(ISS, L)) {
+    std::istringstream Words(L);
+    std::vector<std::string> W;
+    std::string S;
+    while (Words >> S)
+      W.push_back(S);
+    if (W.empty() || W[0][0] == '#') continue;
+    if (W.size() > 2) {
+      Printf("ERROR: -directed_targets: can't parse \"%s\"\n", L.c_str());
+      return false;
+    }
+    Target T;
+    if (W.size() == 2)
+      T.Library = W[0];
+    const std::string &Spec = W.back();
+    // file:first-last, file:line or a file name; anything else is a function.
+    size_t Colon = Spec.rfind(':');
+    size_t Dot = Spec.find('.');
+    if (Colon != std::string::npos && Colon + 1 < Spec.size() &&
+        isdigit(Spec[Colon + 1]) && Spec.find("::") == std::string::npos) {
+      T.File = Spec.substr(0, Colon);
+      std::string Lines = Spec.substr(Colon + 1);
+      size_t Dash = Lines.find('-');
+      T.LastLine = 0;
+      if (!ParseLineNumber(Lines.substr(0, Dash), &T.FirstLine) ||
+          (Dash != std::string::npos &&
+           !ParseLineNumber(Lines.substr(Dash + 1), &T.LastLine)) ||
+          (Dash != std::string::npos && T.LastLine < T.FirstLine)) {
+        Printf("ERROR: -directed_targets: bad lines in \"%s\"\n", L.c_str());
+        return false;
+      }
+      if (Dash == std::string::npos)
+        T.LastLine = T.FirstLine;
+    } else if (Dot != std::string::npos &&
+               Spec.find('(') == std::string::npos &&
+               Spec.find("::") == std::string::npos) {
+      T.File = Spec;
+    } else {
+      T.Function = Spec;
+    }
+    Targets.push_back(T);
+  }
+  if (Targets.empty()) {
+    Printf("ERROR: -directed_targets: no targets in %s\n", Path.c_str());
+    return false;
+  }
+  Printf("INFO: -directed_targets: %zd targets\n", Targets.size());
+  return true;
+}
+
+const TargetDistances::Module &
+TargetDistances::ModuleAt(const std::string &Path) {
+  auto It = Modules.find(Path);
+  if (It != Modules.end()) return It->second;
+  Module &M = Modules[Path];
+  std::vector<const Target *> Mine;
+  for (auto &T : Targets)
+    if (T.Library.empty() || Path.find(T.Library) != std::string::npos)
+      Mine.push_back(&T);
+  if (Mine.empty()) return M;
+
+  std::string Cmd = DisassembleWithLinesCmd(Path);
+  std::string Out;
+  if (!ExecuteCommandAndReadOutput(Cmd, &Out)) {
+    Printf("INFO: Command failed: %s\n", Cmd.c_str());
+    return M;
+  }
+  struct Function {
+    uintptr_t Start;
+    bool IsTarget;
+    std::vector<uintptr_t> Callees;
+  };
+  std::vector<Function> Funcs;
+  auto IsTarget = [&](const std::string &Name, const std::string &File,
+                      size_t Line) {
+    for (auto *T : Mine) {
+      if (!T->Function.empty()) {
+        if (T->Function == Name ||
+            T->Function == Name.substr(0, Name.find('(')))
+          return true;
+        continue;
+      }
+      if (File.empty() || Line < T->FirstLine || Line > T->LastLine)
+        continue;
+      size_t Len = T->File.size();
+      if (File.size() >= Len &&
+          !File.compare(File.size() - Len, Len, T->File) &&
+          (File.size() == Len || File[File.size() - Len - 1] == '/'))
+        return true;
+    }
+    return false;
+  };
+  std::istringstream ISS(Out);
+  std::string L;
+  while (std::getline(ISS, L)) {
+    if (L.empty()) continue;
+    size_t Lt = L.find(" <");
+    if (isxdigit(L[0]) && Lt != std::string::npos && L.back() == ':') {
+      // "0000000000001139 <foo(int)>:"
+      std::string Name = L.substr(Lt + 2, L.size() - Lt - 4);
+      Funcs.push_back({std::stoull(L.substr(0, Lt), 0, 16),
+                       IsTarget(Name, "", 0), {}});
+      continue;
+    }
+    if (Funcs.empty()) continue;
+    if (isspace(L[0])) {
+      // "  113d:\tcall   1150 <bar(int)>"; indirect calls are not followed.
+      if (Lt == std::string::npos || L.find('*') < Lt ||
+          (L.find("call") > Lt && L.find("jmp") > Lt))
+        continue;
+      size_t B = L.find_last_of(" \t", Lt - 1);
+      if (B == std::string::npos || B + 1 >= Lt) continue;
+      std::string Addr = L.substr(B + 1, Lt - B - 1);
+      if (Addr.find_first_not_of("0123456789abcdef") != std::string::npos)
+        continue;
+      Funcs.back().Callees.push_back(std::stoull(Addr, 0, 16));
+      continue;
+    }
+    // "/src/ssl/t1_lib.c:123 (discriminator 1)"; other lines name functions.
+    std::string Loc = L.substr(0, L.find(" ("));
+    size_t Colon = Loc.rfind(':'), Line;
+    if (Colon == std::string::npos ||
+        !ParseLineNumber(Loc.substr(Colon + 1), &Line))
+      continue;
+    if (!Funcs.back().IsTarget && IsTarget("", Loc.substr(0, Colon), Line))
+      Funcs.back().IsTarget = true;
+  }
+
+  std::sort(Funcs.begin(), Funcs.end(),
+            [](const Function &A, const Function &B) {
+              return A.Start < B.Start;
+            });
+  size_t N = Funcs.size();
+  M.Starts.resize(N);
+  for (size_t i = 0; i < N; i++)
+    M.Starts[i] = Funcs[i].Start;
+  auto FunctionAt = [&](uintptr_t Offset) -> size_t {
+    auto It = std::upper_bound(M.Starts.begin(), M.Starts.end(), Offset);
+    return It == M.Starts.begin() ? N : It - M.Starts.begin() - 1;
+  };
+  std::vector<std::vector<uint32_t>> Callers(N);
+  for (size_t i = 0; i < N; i++)
+    for (uintptr_t Callee : Funcs[i].Callees) {
+      size_t j = FunctionAt(Callee);
+      if (j < N && j != i)
+        Callers[j].push_back(static_cast<uint32_t>(i));
+    }
+  M.Distances.assign(N, kUnreachable);
+  std::deque<uint32_t> Queue;
+  size_t NumTargets = 0, NumReaching = 0;
+  for (size_t i = 0; i < N; i++)
+    if (Funcs[i].IsTarget) {
+      M.Distances[i] = 0;
+      Queue.push_back(static_cast<uint32_t>(i));
+      NumTargets++;
+    }
+  while (!Queue.empty()) {
+    uint32_t F = Queue.front();
+    Queue.pop_front();
+    NumReaching++;
+    for (uint32_t C : Callers[F])
+      if (M.Distances[C] == kUnreachable &&
+          M.Distances[F] + 1 < kUnreachable) {
+        M.Distances[C] = M.Distances[F] + 1;
+        Queue.push_back(C);
+      }
+  }
+  Printf("INFO: -directed_targets: %zd target and %zd other functions of %zd "
+         "reach a target in %s\n",
+         NumTargets, NumReaching - NumTargets, N, Path.c_str());
+  return M;
+}
+
+uint16_t TargetDistances::GuardDistance(size_t Idx, uintptr_t PC) {
+  if (Guards[Idx]) return Guards[Idx] - 1;
+  uint16_t D = kUnreachable;
+  char ModulePathRaw[4096] = "";
+  void *OffsetRaw = nullptr;
+  // PC is the return address of the call to the guard hook.
+  if (PC && EF->__sanitizer_get_module_and_offset_for_pc(
+                reinterpret_cast<void *>(PC - 1), ModulePathRaw,
+                sizeof(ModulePathRaw), &OffsetRaw)) {
+    const Module &M = ModuleAt(ModulePathRaw);
+    uintptr_t Offset = reinterpret_cast<uintptr_t>(OffsetRaw);
+    auto It = std::upper_bound(M.Starts.begin(), M.Starts.end(), Offset);
+    if (It != M.Starts.begin())
+      D = M.Distances[It - M.Starts.begin() - 1];
+  }
+  Guards[Idx] = D + 1;
+  return D;
+}
+
+double TargetDistances::RunDistance(const TracePC &TPC) {
+  if (Guards.size() < TPC.GetNumPCs())
+    Guards.resize(TPC.GetNumPCs());
+  const uint64_t *Bits = TPC.CoveredBits();
+  const uintptr_t *PCs = TPC.PCs();
+  size_t NumTouched;
+  const uint32_t *Touched = TPC.TouchedCoverageWords(&NumTouched);
+  size_t Sum = 0, Num = 0;
+  for (size_t k = 0; k < NumTouched; k++)
+    for (uint64_t W = Bits[Touched[k]]; W; W &= W - 1) {
+      size_t Idx = Touched[k] * 64 + __builtin_ctzll(W);
+      uint16_t D = GuardDistance(Idx, PCs[Idx]);
+      if (D == kUnreachable) continue;
+      Sum += D;
+      Num++;
+    }
+  return Num ? static_cast<double>(Sum) / Num : -1;
+}
+
+}  // namespace fuzzer
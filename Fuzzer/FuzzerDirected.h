@@ -0,0 +1,80 @@
+//===- FuzzerDirected.h - Distances to target functions ---------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::TargetDistances
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_DIRECTED_H
+#define LLVM_FUZZER_DIRECTED_H
+
+#include "FuzzerDefs.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace fuzzer {
+
+class TracePC;
+
+// -directed_targets=FILE: how far the code an input covers is from the
+// functions the campaign should spend its time on.
+//
+// Every line of FILE names targets, optionally after the name (or part of
+// the path) of the library they are in:
+//
+//   libssl.so tls_parse_ctos_server_name
+//   tls_parse_stoc_alpn
+//   libcrypto.so crypto/asn1/tasn_dec.c:100-400
+//   t1_lib.c
+//
+// A target is a function, every function with code in the given lines of a
+// source file, or every function of a source file; the lines need debug
+// info. When a module first shows up in the coverage, its call graph is read
+// from "objdump -d -l -C" and every function gets its distance in calls to
+// the nearest target of that module, by breadth-first search over the
+// callers. A guard inherits the distance of its function and is looked up
+// once, on its first hit, in a table indexed by guard like the PC table of
+// TracePC.
+class TargetDistances {
+ public:
+  static const uint16_t kUnreachable = 0xFFFE;
+
+  bool Load(const std::string &Path);
+  bool IsActive() const { return !Targets.empty(); }
+
+  // The mean distance of the guards covered by the last run that can reach
+  // a target, or -1 if none of them can.
+  double RunDistance(const TracePC &TPC);
+
+  size_t NumModules() const { return Modules.size(); }
+
+ private:
+  struct Target {
+    std::string Library;  // Empty: any library.
+    std::string Function;
+    std::string File;     // With Function empty: a source region.
+    size_t FirstLine = 0, LastLine = ~static_cast<size_t>(0);
+  };
+  struct Module {
+    std::vector<uintptr_t> Starts;      // Sorted start offsets of functions.
+    std::vector<uint16_t> Distances;    // Distance of each function.
+  };
+
+  uint16_t GuardDistance(size_t Idx, uintptr_t PC);
+  const Module &ModuleAt(const std::string &Path);
+
+  std::vector<Target> Targets;
+  std::map<std::string, Module> Modules;
+  // Per guard: the distance plus 1, or 0 if not looked up yet.
+  std::vector<uint16_t> Guards;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_DIRECTED_H
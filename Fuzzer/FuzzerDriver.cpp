@@ -10,18 +10,23 @@
 //===----------------------------------------------------------------------===//
 
 #include "FuzzerCorpus.h"
+#include "FuzzerDiffPack.h"
+#include "FuzzerEdgeStore.h"
 #include "FuzzerIO.h"
 #include "FuzzerInterface.h"
 #include "FuzzerInternal.h"
 #include "FuzzerMutate.h"
+#include "FuzzerPcap.h"
 #include "FuzzerRandom.h"
-#include "FuzzerShmem.h"
 #include "FuzzerTracePC.h"
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <map>
 #include <mutex>
+#include <sstream>
 #include <string>
 #include <thread>
 
@@ -197,32 +202,141 @@ static void ParseFlags(const std::vector<std::string> &Args) {
 
 static std::mutex Mu;
 
-static void PulseThread() {
-  while (true) {
-    SleepSeconds(600);
+static const int kMaxJobSliceSec = 3600;
+static const int kJobPulseSec = 60;
+
+// Hands out the -jobs=N jobs to -workers=M threads, each of which runs one
+// job at a time in a process of its own and takes the next job as soon as
+// its previous one exits. With -job_slice=S every job is a slice of
+// -max_total_time: S seconds at first, doubled whenever a job runs its whole
+// slice without an error, and back to S after a job fails. Jobs that keep
+// going pay the cost of loading the corpus less often, while a target that
+// keeps crashing is restarted with the corpus of the others sooner. The
+// -max_total_time of the whole run then bounds the slices, rather than
+// being given to every job.
+class JobScheduler {
+ public:
+  // Worker W runs its jobs on the CPUs in Cpus[W], if Cpus isn't empty.
+  JobScheduler(const std::string &Cmd, unsigned NumJobs, int SliceSec,
+               int MaxTotalTimeSec,
+               const std::vector<std::vector<CpuInfo>> &Cpus)
+      : Cmd(Cmd), NumJobs(NumJobs), InitialSliceSec(SliceSec),
+        MaxTotalTimeSec(MaxTotalTimeSec), Cpus(Cpus),
+        Start(std::chrono::steady_clock::now()), SliceSec(SliceSec) {}
+
+  // Returns false if a job failed.
+  bool Run(unsigned NumWorkers) {
+    std::thread Pulse([this] { PulseThread(); });
+    std::vector<std::thread> V;
+    for (unsigned i = 0; i < NumWorkers; i++)
+      V.push_back(std::thread([this, i] { WorkerThread(i); }));
+    for (auto &T : V)
+      T.join();
+    {
+      std::lock_guard<std::mutex> Lock(Mu);
+      Done = true;
+    }
+    DoneCV.notify_all();
+    Pulse.join();
+    return !HasErrors;
+  }
+
+ private:
+  int ElapsedSec() const {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::steady_clock::now() - Start)
+        .count();
+  }
+
+  // Takes the next job and its slice (0 without -job_slice).
+  bool NextJob(unsigned *Job, int *Slice) {
     std::lock_guard<std::mutex> Lock(Mu);
-    Printf("pulse...\n");
+    if (NextJobIdx >= NumJobs) return false;
+    *Slice = SliceSec;
+    if (SliceSec && MaxTotalTimeSec) {
+      int Left = MaxTotalTimeSec - ElapsedSec();
+      if (Left <= 0) return false;
+      *Slice = std::min(*Slice, Left);
+    }
+    *Job = NextJobIdx++;
+    NumRunning++;
+    return true;
   }
-}
 
-static void WorkerThread(const std::string &Cmd, std::atomic<unsigned> *Counter,
-                         unsigned NumJobs, std::atomic<bool> *HasErrors) {
-  while (true) {
-    unsigned C = (*Counter)++;
-    if (C >= NumJobs) break;
-    std::string Log = "fuzz-" + std::to_string(C) + ".log";
-    std::string ToRun = Cmd + " > " + Log + " 2>&1\n";
-    if (Flags.verbosity)
-      Printf("%s", ToRun.c_str());
-    int ExitCode = ExecuteCommand(ToRun);
-    if (ExitCode != 0)
-      *HasErrors = true;
+  void JobDone(int Slice, double Seconds, int ExitCode) {
     std::lock_guard<std::mutex> Lock(Mu);
-    Printf("================== Job %u exited with exit code %d ============\n",
-           C, ExitCode);
-    fuzzer::CopyFileToErr(Log);
+    NumRunning--;
+    NumDone++;
+    if (ExitCode) {
+      HasErrors = true;
+      SliceSec = InitialSliceSec;
+    } else if (Slice && Seconds >= Slice) {
+      SliceSec = std::min(SliceSec * 2, kMaxJobSliceSec);
+    }
   }
-}
+
+  void WorkerThread(unsigned W) {
+    // The jobs inherit the binding: they are on their cores from their first
+    // instruction, and the kernel puts the pages they touch on their node.
+    if (!Cpus.empty()) {
+      std::vector<unsigned> Set;
+      for (auto &C : Cpus[W % Cpus.size()])
+        Set.push_back(C.Cpu);
+      SetThreadAffinity(Set);
+    }
+    unsigned Job;
+    int Slice;
+    while (NextJob(&Job, &Slice)) {
+      std::string Log = "fuzz-" + std::to_string(Job) + ".log";
+      std::string ToRun = Cmd;
+      if (Slice)
+        ToRun += "-max_total_time=" + std::to_string(Slice) + " ";
+      ToRun += "> " + Log + " 2>&1\n";
+      if (Flags.verbosity) {
+        std::lock_guard<std::mutex> Lock(Mu);
+        Printf("%s", ToRun.c_str());
+      }
+      auto JobStart = std::chrono::steady_clock::now();
+      int ExitCode = ExecuteCommand(ToRun);
+      JobDone(Slice,
+              std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            JobStart)
+                  .count(),
+              ExitCode);
+      std::lock_guard<std::mutex> Lock(Mu);
+      Printf("================== Job %u exited with exit code %d ============\n",
+             Job, ExitCode);
+      fuzzer::CopyFileToErr(Log);
+    }
+  }
+
+  void PulseThread() {
+    std::unique_lock<std::mutex> Lock(Mu);
+    while (!DoneCV.wait_for(Lock, std::chrono::seconds(kJobPulseSec),
+                            [this] { return Done; })) {
+      Printf("pulse: %u of %u jobs done, %u running", NumDone, NumJobs,
+             NumRunning);
+      if (SliceSec)
+        Printf(", slice %ds", SliceSec);
+      Printf(", %ds\n", ElapsedSec());
+    }
+  }
+
+  const std::string Cmd;
+  const unsigned NumJobs;
+  const int InitialSliceSec;
+  const int MaxTotalTimeSec;
+  const std::vector<std::vector<CpuInfo>> Cpus;
+  const std::chrono::steady_clock::time_point Start;
+  // Guarded by Mu.
+  int SliceSec;
+  unsigned NextJobIdx = 0;
+  unsigned NumRunning = 0;
+  unsigned NumDone = 0;
+  bool HasErrors = false;
+  bool Done = false;
+  std::condition_variable DoneCV;
+};
 
 std::string CloneArgsWithoutX(const std::vector<std::string> &Args,
                               const char *X1, const char *X2) {
@@ -237,17 +351,47 @@ std::string CloneArgsWithoutX(const std::vector<std::string> &Args,
 
 static int RunInMultipleProcesses(const std::vector<std::string> &Args,
                                   unsigned NumWorkers, unsigned NumJobs) {
-  std::atomic<unsigned> Counter(0);
-  std::atomic<bool> HasErrors(false);
-  std::string Cmd = CloneArgsWithoutX(Args, "jobs", "workers");
-  std::vector<std::thread> V;
-  std::thread Pulse(PulseThread);
-  Pulse.detach();
-  for (unsigned i = 0; i < NumWorkers; i++)
-    V.push_back(std::thread(WorkerThread, Cmd, &Counter, NumJobs, &HasErrors));
-  for (auto &T : V)
-    T.join();
-  return HasErrors ? 1 : 0;
+  int SliceSec = Max(Flags.job_slice, 0);
+  std::string Cmd;
+  for (auto &S : Args)
+    if (!FlagValue(S.c_str(), "jobs") && !FlagValue(S.c_str(), "workers") &&
+        !FlagValue(S.c_str(), "job_slice") &&
+        !(SliceSec && FlagValue(S.c_str(), "max_total_time")))
+      Cmd += S + " ";
+  // The supervisor owns the region, so the table of diffs outlives the jobs
+  // and a restarted job does not save the diffs of its predecessors again.
+  DiffSharedState Shared;
+  std::string SharedName;
+  if (Flags.diff_mode && Flags.diff_shared) {
+    SharedName = "libFuzzerDiffShared." + std::to_string(GetPid());
+    if (!Shared.Create(SharedName.c_str())) {
+      Printf("ERROR: can't create shared memory region\n");
+      return 1;
+    }
+    Cmd += "-diff_shared_name=" + SharedName + " ";
+  }
+  std::vector<std::vector<CpuInfo>> Cpus;
+  if (Flags.pin_cpus) {
+    std::vector<CpuInfo> Ordered = OrderCpusForPlacement(GetCpuTopology());
+    Cpus = SplitCpusAmongWorkers(Ordered, NumWorkers);
+    Printf("INFO: binding %u workers to CPUs (NUMA node):", NumWorkers);
+    for (auto &Set : Cpus) {
+      Printf(" ");
+      for (size_t i = 0; i < Set.size(); i++)
+        Printf("%s%u", i ? "," : "", Set[i].Cpu);
+      Printf(" (%u)", Set[0].Node);
+    }
+    Printf("\n");
+    if (Ordered.size() < NumWorkers)
+      Printf("WARNING: %u workers share %zd CPUs\n", NumWorkers,
+             Ordered.size());
+  }
+  JobScheduler Scheduler(Cmd, NumJobs, SliceSec, Max(Flags.max_total_time, 0),
+                         Cpus);
+  bool Ok = Scheduler.Run(NumWorkers);
+  if (Shared.IsActive())
+    Shared.Destroy(SharedName.c_str());
+  return Ok ? 0 : 1;
 }
 
 static void RssThread(Fuzzer *F, size_t RssLimitMb) {
@@ -274,6 +418,28 @@ int RunOneTest(Fuzzer *F, const char *InputFilePath, size_t MaxLen) {
   return 0;
 }
 
+// Moves the tables touched on every run to huge pages (-huge_pages) and
+// reports how much of them the kernel did back with huge pages.
+static void UseHugePages(InputCorpus *Corpus) {
+  auto Report = [](const char *What, bool Mapped, size_t Size,
+                   size_t HugeSize) {
+    if (!Mapped)
+      Printf("WARNING: -huge_pages: failed to map the %s\n", What);
+    else if (!HugeSize)
+      Printf("WARNING: -huge_pages: the %s (%zd Mb) got no huge pages; see "
+             "/sys/kernel/mm/transparent_hugepage/enabled and "
+             "/proc/sys/vm/nr_hugepages\n", What, Size >> 20);
+    else
+      Printf("INFO: -huge_pages: %zd of %zd Mb of the %s on huge pages\n",
+             HugeSize >> 20, Size >> 20, What);
+  };
+  size_t Size = 0, HugeSize = 0;
+  bool Mapped = TPC.UseHugePages(&Size, &HugeSize);
+  Report("coverage tables", Mapped, Size, HugeSize);
+  Mapped = Corpus->UseHugePages(&Size, &HugeSize);
+  Report("corpus feature tables", Mapped, Size, HugeSize);
+}
+
 static bool AllInputsAreFiles() {
   if (Inputs->empty()) return false;
   for (auto &Path : *Inputs)
@@ -455,6 +621,138 @@ int MinimizeCrashInputInternalStep(Fuzzer *F, InputCorpus *Corpus) {
   return 0;
 }
 
+// The Q-quantile of V, interpolating between its two nearest elements.
+static double Quantile(std::vector<double> V, double Q) {
+  std::sort(V.begin(), V.end());
+  double Pos = Q * (V.size() - 1);
+  size_t Lo = static_cast<size_t>(Pos);
+  if (Lo + 1 >= V.size()) return V.back();
+  return V[Lo] + (Pos - Lo) * (V[Lo + 1] - V[Lo]);
+}
+
+// -diff_discovery_benchmark=M: runs the fuzzer with -diff_stop_after_classes=M
+// for every seed, one seed at a time so that the runs don't compete for the
+// CPU, and reads the DIFF_CLASS: lines off their logs.
+static int RunDiscoveryBenchmark(const std::vector<std::string> &Args) {
+  int M = Flags.diff_discovery_benchmark;
+  int NumSeeds = Max(Flags.diff_discovery_seeds, 1);
+  unsigned FirstSeed = Flags.seed ? Flags.seed : 1;
+  std::string Cmd;
+  for (auto &S : Args)
+    if (!FlagValue(S.c_str(), "diff_discovery_benchmark") &&
+        !FlagValue(S.c_str(), "diff_discovery_seeds") &&
+        !FlagValue(S.c_str(), "seed"))
+      Cmd += S + " ";
+  Cmd += "-diff_stop_after_classes=" + std::to_string(M) + " ";
+  auto LogFilePath = DirPlusFile(
+      TmpDir(), "libFuzzerTemp." + std::to_string(GetPid()) + ".txt");
+  // Per number of classes, the execs and milliseconds of the seeds that
+  // found that many.
+  std::vector<std::vector<double>> Execs(M), Millis(M);
+  for (int i = 0; i < NumSeeds; i++) {
+    unsigned Seed = FirstSeed + i;
+    std::string Run = Cmd + "-seed=" + std::to_string(Seed) + " > " +
+                      LogFilePath + " 2>&1";
+    int ExitCode = ExecuteCommand(Run);
+    std::istringstream Log(FileToString(LogFilePath));
+    std::string L;
+    size_t NumFound = 0, LastExecs = 0, LastMillis = 0;
+    while (std::getline(Log, L)) {
+      size_t K, E, T;
+      if (sscanf(L.c_str(), "DIFF_CLASS: %zd execs: %zd ms: %zd", &K, &E,
+                 &T) != 3 ||
+          K < 1 || K > static_cast<size_t>(M))
+        continue;
+      Execs[K - 1].push_back(E);
+      Millis[K - 1].push_back(T);
+      NumFound = std::max(NumFound, K);
+      LastExecs = E;
+      LastMillis = T;
+    }
+    Printf("DISCOVERY: seed %u: %zd classes, the last after %zd execs, "
+           "%zd ms%s\n",
+           Seed, NumFound, LastExecs, LastMillis,
+           ExitCode ? " (the run failed)" : "");
+  }
+  RemoveFile(LogFilePath);
+  for (int K = 0; K < M; K++) {
+    Printf("DISCOVERY: class %d: %zd/%d seeds", K + 1, Execs[K].size(),
+           NumSeeds);
+    if (!Execs[K].empty())
+      Printf(", execs median %.0f IQR %.0f-%.0f,"
+             " ms median %.0f IQR %.0f-%.0f",
+             Quantile(Execs[K], 0.5), Quantile(Execs[K], 0.25),
+             Quantile(Execs[K], 0.75), Quantile(Millis[K], 0.5),
+             Quantile(Millis[K], 0.25), Quantile(Millis[K], 0.75));
+    Printf("\n");
+  }
+  return 0;
+}
+
+// Lists the records of a -diff_pack by divergence class. Only the record
+// headers are read to group them.
+int PrintDiffPack(const std::string &Path) {
+  DiffPack Pack;
+  if (!Pack.Open(Path, /*ReadOnly=*/true))
+    return 1;
+  std::map<uint64_t, std::vector<size_t>> Classes;
+  for (size_t i = 0; i < Pack.size(); i++)
+    Classes[Pack.ClassOf(i)].push_back(i);
+  Printf("INFO: %zd diff(s) in %zd class(es) in %s\n", Pack.size(),
+         Classes.size(), Path.c_str());
+  DiffRecord R;
+  for (auto &C : Classes) {
+    Printf("CLASS %016llx: %zd diff(s)\n", (unsigned long long)C.first,
+           C.second.size());
+    for (size_t Idx : C.second) {
+      if (!Pack.Read(Idx, &R)) {
+        Printf("  #%zd: malformed record\n", Idx);
+        continue;
+      }
+      Printf("  #%zd: results: ", Idx);
+      for (int Res : R.Results)
+        Printf("%d_", Res);
+      Printf(" L: %zd parent L: %zd fingerprint: %016llx%016llx %s\n",
+             R.Input.size(), R.Parent.size(),
+             (unsigned long long)R.Fingerprint.Hi,
+             (unsigned long long)R.Fingerprint.Lo,
+             R.MutationSequence.c_str());
+    }
+  }
+  return 0;
+}
+
+// Prints what -print_edge_store asks for, from the bitmaps alone. The guards
+// are numbered from the start of the library of their callback.
+int PrintEdgeStore(const std::string &Path) {
+  static const size_t kMaxPrintedEdges = 64;
+  EdgeStore Store;
+  if (!Store.Open(Path))
+    return 1;
+  size_t NumCallbacks = 0;
+  for (size_t i = 0; i < Store.size(); i++)
+    NumCallbacks = std::max(NumCallbacks, Store.NumCallbacks(i));
+  Printf("INFO: %zd diff(s) of %zd callback(s) in %s\n", Store.size(),
+         NumCallbacks, Path.c_str());
+  auto PrintEdges = [](const char *Name, const RoaringBitmap &B) {
+    Printf("  %s %zd:", Name, B.Cardinality());
+    size_t N = 0;
+    B.ForEach([&](uint32_t Edge) {
+      if (N++ < kMaxPrintedEdges)
+        Printf(" %u", Edge);
+    });
+    Printf("%s\n", N > kMaxPrintedEdges ? " ..." : "");
+  };
+  for (size_t Callback = 0; Callback < NumCallbacks; Callback++)
+    for (auto &C : Store.QueryClasses(Callback)) {
+      Printf("CALLBACK %zd CLASS %016llx: %zd diff(s)\n", Callback,
+             (unsigned long long)C.ClassHash, C.NumRecords);
+      PrintEdges("common", C.Common);
+      PrintEdges("unique", C.Unique);
+    }
+  return 0;
+}
+
 int AnalyzeDictionary(Fuzzer *F, const std::vector<Unit>& Dict,
                       UnitVector& Corpus) {
   Printf("Started dictionary minimization (up to %d tests)\n",
@@ -557,12 +855,29 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   if (Flags.workers > 0 && Flags.jobs > 0)
     return RunInMultipleProcesses(Args, Flags.workers, Flags.jobs);
 
+  if (Flags.diff_discovery_benchmark > 0) {
+    if (!Flags.diff_mode) {
+      Printf("ERROR: -diff_discovery_benchmark requires -diff_mode=1\n");
+      return 1;
+    }
+    return RunDiscoveryBenchmark(Args);
+  }
+
+  std::vector<unsigned> PinnedCpus = GetThreadAffinity();
+  if (!PinnedCpus.empty() && Flags.verbosity) {
+    Printf("INFO: bound to CPU");
+    for (size_t i = 0; i < PinnedCpus.size(); i++)
+      Printf("%s%u", i ? "," : " ", PinnedCpus[i]);
+    Printf(" (NUMA node %u)\n", NumaNodeOfCpu(PinnedCpus[0]));
+  }
+
   const size_t kMaxSaneLen = 1 << 20;
   const size_t kMinDefaultLen = 4096;
   FuzzingOptions Options;
   Options.Verbosity = Flags.verbosity;
   Options.MaxLen = Flags.max_len;
   Options.ExperimentalLenControl = Flags.experimental_len_control;
+  Options.LenControl = Flags.len_control;
   if (Flags.experimental_len_control && Flags.max_len == kMinDefaultLen)
     Options.MaxLen = 1 << 20;
   Options.UnitTimeoutSec = Flags.timeout;
@@ -571,11 +886,20 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   Options.MaxTotalTimeSec = Flags.max_total_time;
   Options.DoCrossOver = Flags.cross_over;
   Options.MutateDepth = Flags.mutate_depth;
+  Options.AdaptiveDepth = Flags.adaptive_depth;
+  Options.MutateHybrid = Flags.mutate_hybrid;
+  Options.MutateAdaptive = Flags.mutate_adaptive;
+  Options.MutatorStats = Flags.mutator_stats;
+  Options.MutatePipeline = Flags.mutate_pipeline;
   Options.UseCounters = Flags.use_counters;
   Options.UseIndirCalls = Flags.use_indir_calls;
   Options.UseMemmem = Flags.use_memmem;
   Options.UseCmp = Flags.use_cmp;
   Options.UseValueProfile = Flags.use_value_profile;
+  Options.ValueProfileMapBits =
+      Min(Max(Flags.value_profile_map_bits,
+              (int)ValueBitMap::kMinMapSizeLog),
+          (int)ValueBitMap::kMaxMapSizeLog);
   Options.Shrink = Flags.shrink;
   Options.ReduceInputs = Flags.reduce_inputs;
   Options.ShuffleAtStartUp = Flags.shuffle;
@@ -584,12 +908,95 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   Options.OnlyASCII = Flags.only_ascii;
   Options.DetectLeaks = Flags.detect_leaks;
   Options.TraceMalloc = Flags.trace_malloc;
+  Options.MallocSample = Flags.malloc_sample;
   Options.RssLimitMb = Flags.rss_limit_mb;
   Options.DifferentialMode = Flags.diff_mode;
+  Options.DiffParallel = Flags.diff_parallel;
+  Options.DiffThreads = Flags.diff_threads;
+  Options.DiffForkInputs = Flags.diff_fork;
+  Options.SeedWorkers = Flags.seed_workers;
+  if (Flags.seed_cache)
+    Options.SeedCache = Flags.seed_cache;
+  Options.DiffCrashAsDiff = Flags.diff_crash_as_diff;
+  Options.DiffZeroCopy = Flags.diff_zero_copy;
+  Options.ProtectInput = Flags.protect_input;
+  Options.DiffCmpDict = Flags.diff_cmp_dict;
+  Options.DiffInputToState = Flags.diff_input_to_state;
+  Options.DiffConfirm = Flags.diff_confirm;
+  Options.DiffBatchSize = Flags.diff_batch;
+  Options.DiffCoverageWindow = Flags.diff_coverage_window;
+  Options.DiffFused = Flags.diff_fused;
+  Options.DiffVerdictBits = Min(Max(Flags.diff_verdict_bits, 0), 31);
+  if (Flags.diff_oracle)
+    Options.DiffOracle = Flags.diff_oracle;
+  Options.DiffPruneInterval = Flags.diff_prune;
+  Options.DiffEarlyExit = Flags.diff_early_exit;
+  Options.DiffFastPath = Flags.diff_fast_path;
+  Options.DiffReference = Flags.diff_reference;
+  Options.DiffReferenceSample = Flags.diff_reference_sample;
+  Options.DiffCallbackTimeoutSec = Flags.diff_callback_timeout;
+  Options.DiffEnergy = Flags.diff_energy;
+  Options.DiffCluster = Flags.diff_cluster;
+  Options.DiffClusterSimilarity =
+      Min(Max(Flags.diff_cluster_similarity, 0), 100);
+  Options.DiffEdgeBuckets = Flags.diff_edge_buckets;
+  Options.DiffEdgeBucketsLimit = Max(Flags.diff_edge_buckets_limit, 1);
+  Options.DiffSignatureLimit = Max(Flags.diff_signature_limit, 0);
+  Options.DiffRejectCache = Flags.diff_reject_cache;
+  if (Flags.diff_shared_name)
+    Options.DiffSharedName = Flags.diff_shared_name;
+  if (Flags.diff_hw_trace)
+    Options.DiffHwTrace = Flags.diff_hw_trace;
+  if (Flags.diff_remote)
+    Options.DiffRemote = Flags.diff_remote;
+  Options.DiffRemoteWorkers = Flags.diff_remote_workers;
+  Options.DedupMutants = Flags.dedup_mutants;
+  Options.DedupMaxSize = Flags.dedup_max_size;
+  Options.DedupBloomBits = Flags.dedup_bloom_bits;
+  if (Flags.diff_checkpoint)
+    Options.DiffCheckpoint = Flags.diff_checkpoint;
+  Options.DiffCheckpointIntervalSec = Flags.diff_checkpoint_interval;
   if (Flags.runs >= 0)
     Options.MaxNumberOfRuns = Flags.runs;
   if (!Inputs->empty() && !Flags.minimize_crash_internal_step)
     Options.OutputCorpus = (*Inputs)[0];
+  if (Flags.packed_corpus)
+    Options.PackedCorpus = Flags.packed_corpus;
+  if (Flags.stats_log)
+    Options.StatsLogPath = Flags.stats_log;
+  Options.StatsLogInterval = Flags.stats_log_interval;
+  if (Flags.diff_control)
+    Options.DiffControl = Flags.diff_control;
+  Options.DiffMemoryLimitMb = Flags.diff_memory_limit_mb;
+  Options.MetricsPort = Flags.metrics_port;
+  if (Flags.sync_with)
+    Options.SyncWith = Flags.sync_with;
+  Options.SyncIntervalSec = Flags.sync_interval;
+  Options.AsyncWrites = Flags.async_writes;
+  Options.AsyncWriteQueueMb = Flags.async_write_queue_mb;
+  Options.MergeTextControl = Flags.merge_text_control;
+  Options.WriteBatch = Flags.write_batch;
+  Options.WriteBatchMs = Flags.write_batch_ms;
+  Options.FsyncWrites = Flags.fsync_writes;
+  if (Flags.diff_pack)
+    Options.DiffPack = Flags.diff_pack;
+  if (Flags.diff_edge_store)
+    Options.DiffEdgeStore = Flags.diff_edge_store;
+  Options.RareEdges = Flags.rare_edges;
+  Options.CostAware = Flags.cost_aware;
+  Options.CorpusMaxUnits = Flags.corpus_max_units;
+  Options.CorpusMaxMb = Flags.corpus_max_mb;
+  Options.CompressCorpus = Flags.compress_corpus;
+  Options.DiffStopAfterClasses = Flags.diff_stop_after_classes;
+  if (Flags.directed_targets)
+    Options.DirectedTargets = Flags.directed_targets;
+  if (Flags.diff_coverage_report)
+    Options.DiffCoverageReport = Flags.diff_coverage_report;
+  if (Flags.trace_file)
+    Options.TraceFile = Flags.trace_file;
+  Options.PerfCounters = Flags.perf_counters;
+  if (Flags.artifact_pack)
+    Options.ArtifactPack = Flags.artifact_pack;
   Options.ReportSlowUnits = Flags.report_slow_units;
   if (Flags.artifact_prefix)
     Options.ArtifactPrefix = Flags.artifact_prefix;
@@ -603,7 +1010,8 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
     Printf("Dictionary: %zd entries\n", Dictionary.size());
   bool DoPlainRun = AllInputsAreFiles();
   Options.SaveArtifacts =
-      !DoPlainRun || Flags.minimize_crash_internal_step;
+      (!DoPlainRun && !Flags.diff_replay && Flags.diff_benchmark <= 0) ||
+      Flags.minimize_crash_internal_step;
   Options.PrintNewCovPcs = Flags.print_pcs;
   Options.PrintFinalStats = Flags.print_final_stats;
   Options.PrintCorpusStats = Flags.print_corpus_stats;
@@ -625,11 +1033,24 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   Random Rand(Seed);
   auto *MD = new MutationDispatcher(Rand, Options);
   auto *Corpus = new InputCorpus(Options.OutputCorpus);
+  if (Options.DifferentialMode)
+    Corpus->SetDiffEnergy(Options.DiffEnergy);
+  if (Flags.huge_pages)
+    UseHugePages(Corpus);
   auto *F = new Fuzzer(Callback, *Corpus, *MD, Options);
 
   for (auto &U: Dictionary)
     if (U.size() <= Word::GetMaxSize())
       MD->AddWordToManualDictionary(Word(U.data(), U.size()));
+  if (EF->LLVMFuzzerCustomDictionary)
+    if (auto *UD = EF->LLVMFuzzerCustomDictionary()) {
+      for (size_t i = 0; i < UD->size; i++)
+        if (UD->words[i].size && UD->words[i].size <= Word::GetMaxSize())
+          MD->AddWordToManualDictionary(
+              Word(UD->words[i].data, UD->words[i].size));
+      if (Flags.verbosity > 0)
+        Printf("INFO: %zd dictionary entries from the target\n", UD->size);
+    }
 
   StartRssThread(F, Flags.rss_limit_mb);
 
@@ -652,30 +1073,75 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   if (Flags.cleanse_crash)
     return CleanseCrashInput(Args, Options);
 
-  if (auto Name = Flags.run_equivalence_server) {
-    SMR.Destroy(Name);
-    if (!SMR.Create(Name)) {
-       Printf("ERROR: can't create shared memory region\n");
+  if (Flags.print_diff_pack)
+    return PrintDiffPack(Flags.print_diff_pack);
+
+  if (Flags.print_edge_store)
+    return PrintEdgeStore(Flags.print_edge_store);
+
+  if (Flags.sync_server > 0)
+    return SyncServer().Run(Flags.sync_server,
+                            Flags.sync_bind ? Flags.sync_bind : "127.0.0.1");
+
+  if (auto Name = Flags.run_equivalence_server)
+    return F->RunEquivalenceServer(
+        Name, Flags.equivalence_slots > 0 ? Flags.equivalence_slots
+                                          : EquivalenceRing::kDefaultNumSlots);
+
+  if (auto Name = Flags.diff_remote_worker) {
+    if (!Options.DifferentialMode) {
+      Printf("ERROR: -diff_remote_worker requires -diff_mode=1\n");
       return 1;
     }
-    Printf("INFO: EQUIVALENCE SERVER UP\n");
-    while (true) {
-      SMR.WaitClient();
-      size_t Size = SMR.ReadByteArraySize();
-      SMR.WriteByteArray(nullptr, 0);
-      const Unit tmp(SMR.GetByteArray(), SMR.GetByteArray() + Size);
-      F->ExecuteCallback(tmp.data(), tmp.size());
-      SMR.PostServer();
+    return F->RunRemoteWorker(Name, Max(Flags.diff_remote_idx, 0),
+                              Max(Flags.diff_remote_callback, 0));
+  }
+
+  if (Flags.use_equivalence_server) {
+    std::string Names = Flags.use_equivalence_server;
+    size_t NumServers = 0;
+    while (!Names.empty()) {
+      auto Split = SplitBefore(",", Names);
+      if (!F->ConnectToEquivalenceServer(Split.first.c_str())) {
+        Printf("ERROR: can't open shared memory region %s\n",
+               Split.first.c_str());
+        return 1;
+      }
+      NumServers++;
+      Names = Split.second.empty() ? "" : Split.second.substr(1);
     }
-    return 0;
+    Printf("INFO: EQUIVALENCE CLIENT UP (%zd servers)\n", NumServers);
   }
 
-  if (auto Name = Flags.use_equivalence_server) {
-    if (!SMR.Open(Name)) {
-      Printf("ERROR: can't open shared memory region\n");
+  if (Flags.diff_replay) {
+    if (!Options.DifferentialMode) {
+      Printf("ERROR: -diff_replay requires -diff_mode=1\n");
       return 1;
     }
-    Printf("INFO: EQUIVALENCE CLIENT UP\n");
+    if (Options.MaxLen == 0)
+      F->SetMaxInputLen(kMaxSaneLen);
+    F->ReplayDiffs(*Inputs, Flags.workers, Flags.diff_replay_table,
+                   Flags.diff_cluster_dir);
+    exit(0);
+  }
+
+  if (Flags.minimize_diff) {
+    if (!Options.DifferentialMode || Inputs->size() != 1) {
+      Printf("ERROR: -minimize_diff requires -diff_mode=1 and one input "
+             "file\n");
+      return 1;
+    }
+    if (Options.MaxLen == 0)
+      F->SetMaxInputLen(kMaxSaneLen);
+    Unit U = FileToVector(Inputs->at(0));
+    Unit Min = F->MinimizeDiff(U, Flags.workers);
+    std::string Path = Flags.exact_artifact_path
+                           ? Flags.exact_artifact_path
+                           : Options.ArtifactPrefix + "minimized-diff-" +
+                                 Hash(U);
+    WriteToFile(Min, Path);
+    Printf("DIFF_MIN: wrote %zd bytes to %s\n", Min.size(), Path.c_str());
+    exit(0);
   }
 
   if (DoPlainRun) {
@@ -708,7 +1174,7 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
     else
       F->CrashResistantMerge(Args, *Inputs,
                              Flags.load_coverage_summary,
-                             Flags.save_coverage_summary);
+                             Flags.save_coverage_summary, Flags.workers);
     exit(0);
   }
 
@@ -720,6 +1186,9 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
     ReadDirToVectorOfUnits(Inp.c_str(), &InitialCorpus, nullptr,
                            TemporaryMaxLen, /*ExitOnError=*/false);
   }
+  if (Flags.seed_pcap)
+    ReadPcapSeeds(Flags.seed_pcap, Flags.seed_pcap_flights, TemporaryMaxLen,
+                  &InitialCorpus);
 
   if (Flags.analyze_dict) {
     if (Dictionary.empty() || Inputs->empty()) {
@@ -738,10 +1207,22 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
     size_t MaxLen = 0;
     for (auto &U : InitialCorpus)
       MaxLen = std::max(U.size(), MaxLen);
+    MaxLen = std::max(F->MaxPackedUnitSize(), MaxLen);
     F->SetMaxInputLen(std::min(std::max(kMinDefaultLen, MaxLen), kMaxSaneLen));
   }
 
-  if (InitialCorpus.empty()) {
+  if (Flags.diff_benchmark > 0) {
+    if (!Options.DifferentialMode) {
+      Printf("ERROR: -diff_benchmark requires -diff_mode=1\n");
+      return 1;
+    }
+    if (InitialCorpus.empty())
+      InitialCorpus.push_back(Unit({'\n'}));
+    F->RunBenchmarks(InitialCorpus, Flags.diff_benchmark);
+    exit(0);
+  }
+
+  if (InitialCorpus.empty() && !F->NumPackedUnits()) {
     InitialCorpus.push_back(Unit({'\n'}));  // Valid ASCII input.
     if (Options.Verbosity)
       Printf("INFO: A corpus is not provided, starting from an empty corpus\n");
@@ -0,0 +1,145 @@
+//===- FuzzerEdgeStore.cpp - Edge sets of diffs -----------------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::EdgeStore
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerEdgeStore.h"
+
+#include <cstring>
+#include <map>
+
+namespace fuzzer {
+
+bool EdgeStore::Append(const EdgeSetRecord &R) {
+  Header H;
+  H.ClassHash = R.ClassHash;
+  H.FingerprintLo = R.Fingerprint.Lo;
+  H.FingerprintHi = R.Fingerprint.Hi;
+  memcpy(H.Sha1, R.Sha1, sizeof(H.Sha1));
+  H.NumCallbacks = static_cast<uint32_t>(R.Results.size());
+  if (R.Edges.size() != R.Results.size()) return false;
+  size_t ResultsSize = R.Results.size() * sizeof(int);
+  std::vector<uint32_t> Offsets(R.Edges.size() + 1);
+  size_t Size = sizeof(H) + ResultsSize + Offsets.size() * sizeof(uint32_t);
+  for (size_t i = 0; i < R.Edges.size(); i++) {
+    Offsets[i] = static_cast<uint32_t>(Size);
+    Size += R.Edges[i].SerializedSize();
+  }
+  Offsets.back() = static_cast<uint32_t>(Size);
+  std::vector<uint8_t> Buf(Size);
+  uint8_t *P = Buf.data();
+  memcpy(P, &H, sizeof(H));
+  P += sizeof(H);
+  if (ResultsSize) memcpy(P, R.Results.data(), ResultsSize);
+  P += ResultsSize;
+  memcpy(P, Offsets.data(), Offsets.size() * sizeof(uint32_t));
+  for (size_t i = 0; i < R.Edges.size(); i++)
+    R.Edges[i].Serialize(Buf.data() + Offsets[i]);
+  return Records.Append(Buf.data(), Buf.size());
+}
+
+bool EdgeStore::ReadHeader(size_t Idx, Header *H) const {
+  size_t Size = Records.UnitSize(Idx);
+  if (Size < sizeof(*H)) return false;
+  memcpy(H, Records.UnitData(Idx), sizeof(*H));
+  size_t Tables = static_cast<size_t>(H->NumCallbacks) * sizeof(int) +
+                  (static_cast<size_t>(H->NumCallbacks) + 1) * sizeof(uint32_t);
+  return Size - sizeof(*H) >= Tables;
+}
+
+const uint8_t *EdgeStore::Bitmap(size_t Idx, const Header &H,
+                                 size_t Callback, size_t *Size) const {
+  const uint8_t *Data = Records.UnitData(Idx);
+  uint32_t Range[2];
+  memcpy(Range,
+         Data + sizeof(H) + H.NumCallbacks * sizeof(int) +
+             Callback * sizeof(uint32_t),
+         sizeof(Range));
+  if (Range[0] > Range[1] || Range[1] > Records.UnitSize(Idx))
+    return nullptr;
+  *Size = Range[1] - Range[0];
+  return Data + Range[0];
+}
+
+bool EdgeStore::Read(size_t Idx, EdgeSetRecord *R) const {
+  Header H;
+  if (!ReadHeader(Idx, &H)) return false;
+  R->ClassHash = H.ClassHash;
+  R->Fingerprint = {H.FingerprintLo, H.FingerprintHi};
+  memcpy(R->Sha1, H.Sha1, sizeof(H.Sha1));
+  R->Results.resize(H.NumCallbacks);
+  if (H.NumCallbacks)
+    memcpy(R->Results.data(), Records.UnitData(Idx) + sizeof(H),
+           H.NumCallbacks * sizeof(int));
+  R->Edges.resize(H.NumCallbacks);
+  for (size_t i = 0; i < H.NumCallbacks; i++) {
+    size_t Size;
+    const uint8_t *Data = Bitmap(Idx, H, i, &Size);
+    if (!Data || !R->Edges[i].Deserialize(Data, Size)) return false;
+  }
+  return true;
+}
+
+uint64_t EdgeStore::ClassOf(size_t Idx) const {
+  Header H;
+  return ReadHeader(Idx, &H) ? H.ClassHash : 0;
+}
+
+size_t EdgeStore::NumCallbacks(size_t Idx) const {
+  Header H;
+  return ReadHeader(Idx, &H) ? H.NumCallbacks : 0;
+}
+
+bool EdgeStore::ReadEdges(size_t Idx, size_t Callback,
+                          RoaringBitmap *B) const {
+  B->clear();
+  Header H;
+  if (!ReadHeader(Idx, &H) || Callback >= H.NumCallbacks) return false;
+  size_t Size;
+  const uint8_t *Data = Bitmap(Idx, H, Callback, &Size);
+  return Data && B->Deserialize(Data, Size);
+}
+
+// An edge is unique to a class unless it is in the union of two classes,
+// which one pass over the unions finds.
+std::vector<EdgeStore::ClassEdges>
+EdgeStore::QueryClasses(size_t Callback) const {
+  std::map<uint64_t, size_t> ClassIdx;
+  std::vector<ClassEdges> Res;
+  std::vector<RoaringBitmap> Unions;
+  RoaringBitmap Edges;
+  for (size_t i = 0; i < size(); i++) {
+    if (!ReadEdges(i, Callback, &Edges)) continue;
+    uint64_t Class = ClassOf(i);
+    auto It = ClassIdx.find(Class);
+    if (It == ClassIdx.end()) {
+      It = ClassIdx.insert({Class, Res.size()}).first;
+      Res.push_back({Class, 0, Edges, {}});
+      Unions.push_back(Edges);
+    } else {
+      Res[It->second].Common.IntersectWith(Edges);
+      Unions[It->second].UnionWith(Edges);
+    }
+    Res[It->second].NumRecords++;
+  }
+  RoaringBitmap Seen, InSeveral;
+  for (auto &U : Unions) {
+    RoaringBitmap Both = U;
+    Both.IntersectWith(Seen);
+    InSeveral.UnionWith(Both);
+    Seen.UnionWith(U);
+  }
+  for (size_t C = 0; C < Res.size(); C++) {
+    Res[C].Unique = std::move(Unions[C]);
+    Res[C].Unique.Subtract(InSeveral);
+  }
+  return Res;
+}
+
+}  // namespace fuzzer
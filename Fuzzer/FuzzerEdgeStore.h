@@ -0,0 +1,87 @@
+//===- FuzzerEdgeStore.h - INTERNAL - Edge sets of diffs --------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::EdgeStore
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_EDGE_STORE_H
+#define LLVM_FUZZER_EDGE_STORE_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerHash.h"
+#include "FuzzerPackedCorpus.h"
+#include "FuzzerRoaring.h"
+#include "FuzzerSHA1.h"
+
+#include <string>
+#include <vector>
+
+namespace fuzzer {
+
+// The coverage of one diff: for every differential callback the guards it
+// covered, numbered from the start of the callback's library as in
+// DiffFingerprint(), together with what identifies the diff elsewhere: its
+// class, its fingerprint and the SHA1 its artifact is named after.
+struct EdgeSetRecord {
+  uint64_t ClassHash = 0;
+  Digest128 Fingerprint = {0, 0};
+  uint8_t Sha1[kSHA1NumBytes] = {};
+  std::vector<int> Results;
+  std::vector<RoaringBitmap> Edges;  // One per callback.
+};
+
+// -diff_edge_store: the edge sets of every new diff, kept in a PackedCorpus
+// at Path.idx and Path.blob like the records of a DiffPack. A record starts
+// with a fixed header and the offset of the bitmap of every callback, so the
+// edges of one callback of one record are read without the others.
+class EdgeStore {
+ public:
+  bool Open(const std::string &Path) { return Records.Open(Path); }
+  bool IsOpen() const { return Records.IsOpen(); }
+  size_t Refresh() { return Records.Refresh(); }
+  size_t size() const { return Records.size(); }
+
+  bool Append(const EdgeSetRecord &R);
+  // Returns false if the record is malformed.
+  bool Read(size_t Idx, EdgeSetRecord *R) const;
+  uint64_t ClassOf(size_t Idx) const;
+  size_t NumCallbacks(size_t Idx) const;
+  // The edges of callback Callback in record Idx; false if there are none.
+  bool ReadEdges(size_t Idx, size_t Callback, RoaringBitmap *B) const;
+
+  // For every class, the edges of callback Callback that all its records
+  // cover and those that only its records cover, i.e. that no record of
+  // another class covers.
+  struct ClassEdges {
+    uint64_t ClassHash;
+    size_t NumRecords;
+    RoaringBitmap Common, Unique;
+  };
+  std::vector<ClassEdges> QueryClasses(size_t Callback) const;
+
+ private:
+  struct Header {
+    uint64_t ClassHash;
+    uint64_t FingerprintLo, FingerprintHi;
+    uint8_t Sha1[kSHA1NumBytes];
+    uint32_t NumCallbacks;
+  };
+  // After the header: NumCallbacks results, then NumCallbacks + 1 offsets of
+  // the bitmaps from the start of the record, the last one its end. Returns
+  // false if the record is too short for them.
+  bool ReadHeader(size_t Idx, Header *H) const;
+  // The bytes of the bitmap of callback Callback in record Idx.
+  const uint8_t *Bitmap(size_t Idx, const Header &H, size_t Callback,
+                        size_t *Size) const;
+
+  PackedCorpus Records;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_EDGE_STORE_H
@@ -0,0 +1,167 @@
+//===- FuzzerEquivalence.cpp - Equivalence servers ------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// The input ring between a fuzzer and an equivalence server.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerEquivalence.h"
+#include "FuzzerIO.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace fuzzer {
+
+bool EquivalenceRing::Create(const char *Name, size_t NumSlots) {
+  static_assert(sizeof(Layout) <= kSlotsOffset, "Layout too large");
+  NumSlots = Max(NumSlots, (size_t)1);
+  Region.Destroy(Name);
+  if (!Region.Create(Name, kSlotsOffset + NumSlots * kSlotSize)) return false;
+  // A fresh file is zero-filled, which is a valid empty ring.
+  L = reinterpret_cast<Layout *>(Region.GetData());
+  L->NumSlots = NumSlots;
+  L->Magic = kMagic;
+  return true;
+}
+
+bool EquivalenceRing::Open(const char *Name) {
+  if (!Region.Open(Name) || Region.GetSize() < kSlotsOffset) return false;
+  L = reinterpret_cast<Layout *>(Region.GetData());
+  if (L->Magic != kMagic ||
+      Region.GetSize() < kSlotsOffset + L->NumSlots * kSlotSize) {
+    L = nullptr;
+    return false;
+  }
+  Batch = Max(L->NumSlots / 4, (uint64_t)1);
+  // A previous client may have left inputs behind; they are not ours.
+  Checked = L->Head.load(std::memory_order_relaxed);
+  return true;
+}
+
+void EquivalenceRing::Serve(
+    const std::function<void(const uint8_t *, size_t)> &Run) {
+  assert(IsServer());
+  uint64_t Tail = L->Tail.load(std::memory_order_relaxed);
+  while (true) {
+    if (L->Head.load(std::memory_order_acquire) == Tail) {
+      // Announce that we sleep, then look once more: the client checks the
+      // flag after it publishes an input.
+      L->ServerWaiting.store(1);
+      if (L->Head.load() == Tail)
+        Region.WaitClient();
+      else
+        L->ServerWaiting.store(0);
+      continue;
+    }
+    Slot *S = GetSlot(Tail);
+    Outputs.clear();
+    Run(S->Bytes, S->InputSize);
+    const uint8_t *Expected = S->Bytes + S->InputSize;
+    size_t ExpectedSize = S->OutputSize;
+    size_t i = 0;
+    for (; i < Min(ExpectedSize, Outputs.size()); i++)
+      if (Expected[i] != Outputs[i])
+        break;
+    S->Mismatch = ExpectedSize != Outputs.size() || i < ExpectedSize;
+    S->OtherSize = Outputs.size();
+    S->Offset = i;
+    L->Tail.store(++Tail, std::memory_order_release);
+    if (L->ClientWaiting.exchange(0))
+      Region.PostServer();
+  }
+}
+
+void EquivalenceRing::Announce(const uint8_t *Data, size_t Size) {
+  if (IsServer()) {
+    Outputs.insert(Outputs.end(), Data, Data + Size);
+    return;
+  }
+  assert(IsClient());
+  Slot *S = GetSlot(L->Head.load(std::memory_order_relaxed));
+  if (S->InputSize + S->OutputSize + Size > kMaxSlotBytes) {
+    Printf("ERROR: the outputs of an input take more than the %zd bytes of "
+           "an equivalence slot\n", kMaxSlotBytes);
+    exit(1);
+  }
+  memcpy(S->Bytes + S->InputSize + S->OutputSize, Data, Size);
+  S->OutputSize += Size;
+}
+
+void EquivalenceRing::BeginInput(const uint8_t *Data, size_t Size) {
+  assert(IsClient());
+  uint64_t Head = L->Head.load(std::memory_order_relaxed);
+  if (Head - L->Tail.load(std::memory_order_acquire) >= L->NumSlots)
+    WaitForServer(Head - L->NumSlots + 1);
+  // The slot of Head is overwritten below.
+  CheckDoneSlots();
+  if (Size > kMaxSlotBytes) {
+    Printf("ERROR: an input of %zd bytes does not fit in an equivalence "
+           "slot\n", Size);
+    exit(1);
+  }
+  Slot *S = GetSlot(Head);
+  S->InputSize = Size;
+  S->OutputSize = 0;
+  memcpy(S->Bytes, Data, Size);
+}
+
+void EquivalenceRing::EndInput() {
+  assert(IsClient());
+  uint64_t Head = L->Head.load(std::memory_order_relaxed) + 1;
+  L->Head.store(Head, std::memory_order_release);
+  if (Head % Batch == 0)
+    WakeServer();
+}
+
+void EquivalenceRing::Drain() {
+  assert(IsClient());
+  WaitForServer(L->Head.load(std::memory_order_relaxed));
+  CheckDoneSlots();
+}
+
+bool EquivalenceRing::TakeMismatch(Mismatch *M) {
+  if (!HasMismatch) return false;
+  std::swap(*M, FirstMismatch);
+  HasMismatch = false;
+  return true;
+}
+
+void EquivalenceRing::WakeServer() {
+  if (L->ServerWaiting.exchange(0))
+    Region.PostClient();
+}
+
+// The server only sleeps once it has done every input, so after one wake-up
+// it gets to MinTail <= Head without further posts.
+void EquivalenceRing::WaitForServer(uint64_t MinTail) {
+  WakeServer();
+  while (L->Tail.load(std::memory_order_acquire) < MinTail) {
+    L->ClientWaiting.store(1);
+    if (L->Tail.load() >= MinTail) {
+      // The server may still post; the next wait then returns at once and
+      // the loop looks again.
+      L->ClientWaiting.store(0);
+      break;
+    }
+    Region.WaitServer();
+  }
+}
+
+void EquivalenceRing::CheckDoneSlots() {
+  uint64_t Tail = L->Tail.load(std::memory_order_acquire);
+  for (; Checked < Tail; Checked++) {
+    Slot *S = GetSlot(Checked);
+    if (!S->Mismatch || HasMismatch) continue;
+    FirstMismatch.Input.assign(S->Bytes, S->Bytes + S->InputSize);
+    FirstMismatch.Size = S->OutputSize;
+    FirstMismatch.OtherSize = S->OtherSize;
+    FirstMismatch.Offset = S->Offset;
+    HasMismatch = true;
+  }
+}
+
+}  // namespace fuzzer
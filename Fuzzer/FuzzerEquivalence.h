@@ -0,0 +1,114 @@
+//===- FuzzerEquivalence.h - INTERNAL - Equivalence servers -----*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::EquivalenceRing
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_EQUIVALENCE_H
+#define LLVM_FUZZER_EQUIVALENCE_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerShmem.h"
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+namespace fuzzer {
+
+// The link between a fuzzer (-use_equivalence_server) and one equivalence
+// server (-run_equivalence_server), which runs another build of the target
+// in a process of its own. The server creates a SharedMemoryRegion holding a
+// ring of input slots; the client writes every input it runs and the outputs
+// the target announces for it (LLVMFuzzerAnnounceOutput) into the next slot,
+// the server runs the input through its own build and records in the slot
+// whether its outputs were the same.
+//
+// Neither side waits for the other per input. The client wakes a sleeping
+// server once every Batch inputs, the server wakes the client only when the
+// client waits for a free slot, so a mismatch is reported up to NumSlots
+// inputs after the one that caused it, together with that input. A client
+// can talk to any number of servers, through one ring each.
+class EquivalenceRing {
+ public:
+  static const size_t kDefaultNumSlots = 16;
+  // Room for an input and its outputs; slots are only touched as far as
+  // they are used.
+  static const size_t kSlotSize = SharedMemoryRegion::kShmemSize;
+
+  struct Mismatch {
+    Unit Input;
+    size_t Size, OtherSize, Offset;
+  };
+
+  bool Create(const char *Name, size_t NumSlots);
+  bool Open(const char *Name);
+  bool Destroy(const char *Name) { return Region.Destroy(Name); }
+  bool IsServer() const { return L && Region.IsServer(); }
+  bool IsClient() const { return L && Region.IsClient(); }
+
+  // Server: runs every input the client writes, forever.
+  void Serve(const std::function<void(const uint8_t *, size_t)> &Run);
+
+  // Both sides: appends an output to those of the current input.
+  void Announce(const uint8_t *Data, size_t Size);
+
+  // Client: the current input starts and ends. BeginInput waits for a free
+  // slot if the server is NumSlots inputs behind.
+  void BeginInput(const uint8_t *Data, size_t Size);
+  void EndInput();
+  // Client: waits until the server has caught up with every input.
+  void Drain();
+  // Client: returns true and the first mismatch reported by the server
+  // since the previous call, if there is one.
+  bool TakeMismatch(Mismatch *M);
+
+ private:
+  struct Slot {
+    uint64_t InputSize;
+    uint64_t OutputSize;
+    // Filled by the server.
+    uint64_t Mismatch;
+    uint64_t OtherSize;
+    uint64_t Offset;
+    uint8_t Bytes[1];  // The input, then the client's outputs.
+  };
+  struct Layout {
+    uint64_t Magic;
+    uint64_t NumSlots;
+    std::atomic<uint64_t> Head;  // Inputs written by the client.
+    std::atomic<uint64_t> Tail;  // Inputs done by the server.
+    std::atomic<uint32_t> ServerWaiting;
+    std::atomic<uint32_t> ClientWaiting;
+  };
+  static const uint64_t kMagic = 0x4551554956524E47ULL;  // "EQUIVRNG"
+  static const size_t kSlotsOffset = 64;
+  static const size_t kMaxSlotBytes = kSlotSize - offsetof(Slot, Bytes);
+
+  Slot *GetSlot(uint64_t Idx) {
+    return reinterpret_cast<Slot *>(Region.GetData() + kSlotsOffset +
+                                    (Idx % L->NumSlots) * kSlotSize);
+  }
+  void WakeServer();
+  void WaitForServer(uint64_t MinTail);
+  void CheckDoneSlots();
+
+  SharedMemoryRegion Region;
+  Layout *L = nullptr;
+  size_t Batch = 1;
+  // Client: slots up to here have been checked for mismatches.
+  uint64_t Checked = 0;
+  bool HasMismatch = false;
+  Mismatch FirstMismatch;
+  // Server: the outputs of the current input.
+  std::vector<uint8_t> Outputs;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_EQUIVALENCE_H
@@ -21,6 +21,33 @@ struct UserCallbacks {
   int size;
 };
 
+// Batched variant of UserCallback, returned by the optional
+// LLVMFuzzerCustomBatchCallbacks() in the same order as the callbacks of
+// LLVMFuzzerCustomCallbacks(). It runs one implementation on N inputs and
+// stores the return value for Data[i] in Results[i]. InputDone(i) must be
+// called as soon as Data[i] is finished so that the coverage of every input
+// can be told apart.
+typedef void (*BatchInputDone)(size_t Idx);
+typedef void (*UserBatchCallback)(const uint8_t *const *Data,
+                                  const size_t *Sizes, size_t N, int *Results,
+                                  BatchInputDone InputDone);
+struct UserBatchCallbacks {
+  UserBatchCallback *callbacks;
+  int size;
+};
+
+// Words returned by the optional LLVMFuzzerCustomDictionary(), added to the
+// manual dictionary next to the ones of -dict. Words longer than 64 bytes
+// are ignored.
+struct UserDictionaryWord {
+  const uint8_t *data;
+  size_t size;
+};
+struct UserDictionary {
+  const UserDictionaryWord *words;
+  size_t size;
+};
+
 namespace fuzzer {
 
 struct ExternalFunctions {
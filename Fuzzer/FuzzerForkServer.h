@@ -0,0 +1,73 @@
+//===- FuzzerForkServer.h - Fork server for diff mode -----------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::ForkServer
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_FORK_SERVER_H
+#define LLVM_FUZZER_FORK_SERVER_H
+
+#include "FuzzerDefs.h"
+
+#include <functional>
+
+namespace fuzzer {
+
+// Runs inputs in forked children of the (fully initialized) fuzzer process,
+// so that a crash or a hang only takes down the child. Every child serves up
+// to InputsPerChild inputs and then exits; the next input forks a new one.
+// Inputs and replies travel through a shared anonymous mapping, the control
+// messages through a pair of pipes. Several servers may run from different
+// threads.
+class ForkServer {
+ public:
+  ~ForkServer() { Stop(); }
+
+  // Runs in the child. Writes the reply for (Data, Size) into Out, which has
+  // room for MaxOutSize bytes, and returns the reply size.
+  typedef std::function<size_t(const uint8_t *Data, size_t Size, uint8_t *Out,
+                               size_t MaxOutSize)>
+      ChildCallback;
+
+  static const size_t kMaxInputSize = 1 << 24;
+
+  bool Start(size_t InputsPerChild, size_t MaxOutSize, ChildCallback CB);
+  bool IsRunning() const { return Region != nullptr; }
+  // Kills the idle child, if any. The children of other servers may hold
+  // the pipe to it, so it would not see its end.
+  void Stop();
+
+  // Sends Data to a child and waits for its reply. Returns false if the
+  // child died before replying; its wait status is then in LastStatus(),
+  // and *Out holds whatever the child wrote to the reply before it died.
+  // The child's callback gets Arg from InputArg().
+  bool Run(const uint8_t *Data, size_t Size, const uint8_t **Out,
+           size_t *OutSize, size_t Arg = 0);
+  int LastStatus() const { return Status; }
+  // In the child, the Arg of the input that is being served.
+  size_t InputArg() const;
+
+ private:
+  bool SpawnChild();
+  void ReapChild();
+  void ChildLoop();
+
+  ChildCallback CB;
+  size_t InputsPerChild = 0;
+  size_t MaxOutSize = 0;
+  size_t RegionSize = 0;
+  uint8_t *Region = nullptr;  // Header, then input, then reply.
+  long ChildPid = -1;
+  int ToChild = -1, FromChild = -1;
+  size_t NumInputsInChild = 0;
+  int Status = 0;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_FORK_SERVER_H
@@ -0,0 +1,172 @@
+//===- FuzzerForkServerPosix.cpp - Fork server for diff mode ----*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// ForkServer
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if LIBFUZZER_POSIX
+
+#include "FuzzerForkServer.h"
+#include "FuzzerIO.h"
+
+#include <cstring>
+#include <errno.h>
+#include <mutex>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fuzzer {
+
+namespace {
+struct Header {
+  size_t InputSize;
+  size_t OutSize;
+  size_t Arg;
+};
+
+// Both ends restart on EINTR, e.g. when the parent gets its SIGALRM pulse.
+bool ReadByte(int Fd) {
+  char C;
+  ssize_t Res;
+  while ((Res = read(Fd, &C, 1)) < 0 && errno == EINTR) {}
+  return Res == 1;
+}
+
+bool WriteByte(int Fd) {
+  char C = 0;
+  ssize_t Res;
+  while ((Res = write(Fd, &C, 1)) < 0 && errno == EINTR) {}
+  return Res == 1;
+}
+
+// Held from creating the pipes of a child until the parent closed the
+// child's ends, so that no other server forks a child holding them.
+std::mutex SpawnMutex;
+}  // namespace
+
+bool ForkServer::Start(size_t InputsPerChild, size_t MaxOutSize,
+                       ChildCallback CB) {
+  assert(!IsRunning() && InputsPerChild);
+  this->InputsPerChild = InputsPerChild;
+  this->MaxOutSize = MaxOutSize;
+  this->CB = CB;
+  RegionSize = sizeof(Header) + kMaxInputSize + MaxOutSize;
+  // The mapping is only backed by memory once pages are touched.
+  void *Addr = mmap(nullptr, RegionSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (Addr == MAP_FAILED) {
+    Printf("ERROR: fork server: mmap of %zd bytes failed with %d\n",
+           RegionSize, errno);
+    return false;
+  }
+  Region = static_cast<uint8_t *>(Addr);
+  // A child that dies while we talk to it must not kill us with SIGPIPE.
+  signal(SIGPIPE, SIG_IGN);
+  return true;
+}
+
+bool ForkServer::SpawnChild() {
+  std::lock_guard<std::mutex> Lock(SpawnMutex);
+  int ToChildPipe[2], FromChildPipe[2];
+  if (pipe(ToChildPipe)) return false;
+  if (pipe(FromChildPipe)) {
+    close(ToChildPipe[0]);
+    close(ToChildPipe[1]);
+    return false;
+  }
+  pid_t Pid = fork();
+  if (Pid < 0) {
+    Printf("ERROR: fork server: fork failed with %d\n", errno);
+    for (int Fd : {ToChildPipe[0], ToChildPipe[1], FromChildPipe[0],
+                   FromChildPipe[1]})
+      close(Fd);
+    return false;
+  }
+  if (Pid == 0) {
+    close(ToChildPipe[1]);
+    close(FromChildPipe[0]);
+    ToChild = ToChildPipe[0];
+    FromChild = FromChildPipe[1];
+    ChildLoop();  // Does not return.
+  }
+  close(ToChildPipe[0]);
+  close(FromChildPipe[1]);
+  ToChild = ToChildPipe[1];
+  FromChild = FromChildPipe[0];
+  ChildPid = Pid;
+  NumInputsInChild = 0;
+  return true;
+}
+
+void ForkServer::ChildLoop() {
+  Header *H = reinterpret_cast<Header *>(Region);
+  uint8_t *In = Region + sizeof(Header);
+  for (size_t i = 0; i < InputsPerChild; i++) {
+    if (!ReadByte(ToChild)) break;
+    H->OutSize = CB(In, H->InputSize, In + kMaxInputSize, MaxOutSize);
+    if (!WriteByte(FromChild)) break;
+  }
+  _Exit(0);  // Skip the at-exit actions of the parent's copy.
+}
+
+void ForkServer::ReapChild() {
+  close(ToChild);
+  close(FromChild);
+  ToChild = FromChild = -1;
+  while (waitpid(ChildPid, &Status, 0) < 0 && errno == EINTR) {}
+  ChildPid = -1;
+}
+
+void ForkServer::Stop() {
+  if (!IsRunning()) return;
+  if (ChildPid >= 0) {
+    kill(ChildPid, SIGKILL);
+    ReapChild();
+  }
+  munmap(Region, RegionSize);
+  Region = nullptr;
+}
+
+size_t ForkServer::InputArg() const {
+  return reinterpret_cast<const Header *>(Region)->Arg;
+}
+
+bool ForkServer::Run(const uint8_t *Data, size_t Size, const uint8_t **Out,
+                     size_t *OutSize, size_t Arg) {
+  assert(IsRunning());
+  if (Size > kMaxInputSize) {
+    Printf("ERROR: fork server: input of %zd bytes is too large\n", Size);
+    exit(1);
+  }
+  *Out = Region + sizeof(Header) + kMaxInputSize;
+  *OutSize = 0;
+  if (ChildPid < 0 && !SpawnChild()) {
+    Status = 0;
+    return false;
+  }
+  Header *H = reinterpret_cast<Header *>(Region);
+  H->InputSize = Size;
+  H->Arg = Arg;
+  memcpy(Region + sizeof(Header), Data, Size);
+  if (!WriteByte(ToChild) || !ReadByte(FromChild)) {
+    ReapChild();
+    return false;
+  }
+  *OutSize = H->OutSize;
+  if (++NumInputsInChild == InputsPerChild)
+    ReapChild();  // The child exits after its last reply.
+  return true;
+}
+
+}  // namespace fuzzer
+
+#endif  // LIBFUZZER_POSIX
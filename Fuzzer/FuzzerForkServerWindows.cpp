@@ -0,0 +1,37 @@
+//===- FuzzerForkServerWindows.cpp - Fork server for diff mode --*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// ForkServer
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if LIBFUZZER_WINDOWS
+
+#include "FuzzerForkServer.h"
+#include "FuzzerIO.h"
+
+namespace fuzzer {
+
+bool ForkServer::Start(size_t InputsPerChild, size_t MaxOutSize,
+                       ChildCallback CB) {
+  Printf("ERROR: fork server is not supported on Windows\n");
+  return false;
+}
+
+void ForkServer::Stop() {}
+
+bool ForkServer::Run(const uint8_t *Data, size_t Size, const uint8_t **Out,
+                     size_t *OutSize, size_t Arg) {
+  assert(0 && "UNIMPLEMENTED");
+  return false;
+}
+
+size_t ForkServer::InputArg() const { return 0; }
+
+}  // namespace fuzzer
+
+#endif  // LIBFUZZER_WINDOWS
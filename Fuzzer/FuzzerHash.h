@@ -0,0 +1,100 @@
+//===- FuzzerHash.h - Internal header for fast hashing ----------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Fast non-cryptographic hashing, for in-memory deduplication only.
+// Anything that is written to disk keeps using SHA1.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_HASH_H
+#define LLVM_FUZZER_HASH_H
+
+#include "FuzzerDefs.h"
+#include <cstring>
+#include <stdint.h>
+
+namespace fuzzer {
+
+struct Digest128 {
+  uint64_t Lo, Hi;
+  bool operator==(const Digest128 &Other) const {
+    return Lo == Other.Lo && Hi == Other.Hi;
+  }
+  bool operator!=(const Digest128 &Other) const { return !(*this == Other); }
+  bool operator<(const Digest128 &Other) const {
+    return Hi != Other.Hi ? Hi < Other.Hi : Lo < Other.Lo;
+  }
+};
+
+// Streaming 128-bit hash built from the MurmurHash3 x64 mixing steps.
+// Values are fed one at a time, so callers never need to materialize the
+// data being hashed in a contiguous buffer.
+class Hasher128 {
+ public:
+  explicit Hasher128(uint64_t Seed = 0) : H1(Seed), H2(Seed) {}
+
+  void Update(uint64_t V) {
+    H1 ^= Rotl(V * kC1, 31) * kC2;
+    H1 = Rotl(H1, 27) + H2;
+    H1 = H1 * 5 + 0x52dce729;
+    H2 ^= Rotl(V * kC2, 33) * kC1;
+    H2 = Rotl(H2, 31) + H1;
+    H2 = H2 * 5 + 0x38495ab5;
+    Len++;
+  }
+
+  void Update(const uint8_t *Data, size_t Size) {
+    for (; Size >= 8; Data += 8, Size -= 8) {
+      uint64_t V;
+      memcpy(&V, Data, 8);
+      Update(V);
+    }
+    if (Size) {
+      uint64_t V = 0;
+      memcpy(&V, Data, Size);
+      Update(V ^ (static_cast<uint64_t>(Size) << 56));
+    }
+  }
+
+  Digest128 Final() const {
+    uint64_t A = H1 ^ Len, B = H2 ^ Len;
+    A += B;
+    B += A;
+    A = Mix(A);
+    B = Mix(B);
+    A += B;
+    B += A;
+    return {A, B};
+  }
+
+ private:
+  static const uint64_t kC1 = 0x87c37b91114253d5ULL;
+  static const uint64_t kC2 = 0x4cf5ad432745937fULL;
+
+  static uint64_t Rotl(uint64_t X, int R) { return (X << R) | (X >> (64 - R)); }
+  static uint64_t Mix(uint64_t K) {
+    K ^= K >> 33;
+    K *= 0xff51afd7ed558ccdULL;
+    K ^= K >> 33;
+    K *= 0xc4ceb9fe1a85ec53ULL;
+    K ^= K >> 33;
+    return K;
+  }
+
+  uint64_t H1, H2;
+  uint64_t Len = 0;
+};
+
+inline Digest128 Hash128(const uint8_t *Data, size_t Size) {
+  Hasher128 H;
+  H.Update(Data, Size);
+  return H.Final();
+}
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_HASH_H
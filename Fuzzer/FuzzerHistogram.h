@@ -0,0 +1,77 @@
+//===- FuzzerHistogram.h - INTERNAL - Latency histogram ---------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// LatencyHistogram.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_HISTOGRAM_H
+#define LLVM_FUZZER_HISTOGRAM_H
+
+#include "FuzzerDefs.h"
+#include <algorithm>
+
+namespace fuzzer {
+
+// Counts nanosecond latencies in log-linear buckets, like an HDR histogram
+// with one significant hex digit: every power of two is split into
+// kSubBuckets equal buckets, so a quantile is off by at most 1/kSubBuckets
+// of its value. Recording is a count-leading-zeros and an increment.
+class LatencyHistogram {
+ public:
+  static const size_t kSubBucketBits = 4;
+  static const size_t kSubBuckets = 1 << kSubBucketBits;
+  static const size_t kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  void Record(uint64_t Nanos) {
+    Buckets[BucketOf(Nanos)]++;
+    Count++;
+    Sum += Nanos;
+    Max = std::max(Max, Nanos);
+  }
+
+  uint64_t NumValues() const { return Count; }
+  uint64_t SumNanos() const { return Sum; }
+  uint64_t MaxNanos() const { return Max; }
+
+  // The largest value of the bucket holding the Q-quantile, capped by Max.
+  uint64_t Quantile(double Q) const {
+    if (!Count) return 0;
+    uint64_t Rank = static_cast<uint64_t>(Q * (Count - 1));
+    uint64_t Seen = 0;
+    for (size_t i = 0; i < kNumBuckets; i++) {
+      Seen += Buckets[i];
+      if (Seen > Rank)
+        return std::min(Max, i + 1 < kNumBuckets ? LowestOf(i + 1) - 1 : Max);
+    }
+    return Max;
+  }
+
+  static size_t BucketOf(uint64_t V) {
+    if (V < kSubBuckets) return V;
+    size_t Log = 63 - __builtin_clzll(V);
+    size_t Sub = (V >> (Log - kSubBucketBits)) & (kSubBuckets - 1);
+    return (Log - kSubBucketBits + 1) * kSubBuckets + Sub;
+  }
+
+  static uint64_t LowestOf(size_t Bucket) {
+    if (Bucket < kSubBuckets) return Bucket;
+    size_t Log = Bucket / kSubBuckets + kSubBucketBits - 1;
+    uint64_t Sub = Bucket % kSubBuckets;
+    return (kSubBuckets + Sub) << (Log - kSubBucketBits);
+  }
+
+ private:
+  uint64_t Buckets[kNumBuckets] = {};
+  uint64_t Count = 0;
+  uint64_t Sum = 0;
+  uint64_t Max = 0;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_HISTOGRAM_H
@@ -0,0 +1,179 @@
+//===- FuzzerHwTrace.cpp - Intel PT packet decoder ------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// DecodeIntelPT(), after the packet formats of the Intel SDM, vol. 3, ch. 32.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerHwTrace.h"
+#include <algorithm>
+#include <cstring>
+
+namespace fuzzer {
+
+// The TNT bits after a TIP that get counters of their own; the later ones
+// share those of the last position, so that a long loop doesn't spread over
+// all of them.
+static const size_t kMaxTntPosition = 64;
+
+static const uint8_t kPSB[16] = {0x02, 0x82, 0x02, 0x82, 0x02, 0x82,
+                                 0x02, 0x82, 0x02, 0x82, 0x02, 0x82,
+                                 0x02, 0x82, 0x02, 0x82};
+
+static uint64_t MixKey(uint64_t K) {
+  K ^= K >> 33;
+  K *= 0xff51afd7ed558ccdULL;
+  K ^= K >> 33;
+  K *= 0xc4ceb9fe1a85ec53ULL;
+  K ^= K >> 33;
+  return K;
+}
+
+static const uint8_t *FindPSB(const uint8_t *P, const uint8_t *End) {
+  for (; P + sizeof(kPSB) <= End; P++)
+    if (P[0] == 0x02 && !memcmp(P, kPSB, sizeof(kPSB)))
+      return P;
+  return End;
+}
+
+static uint64_t ReadLE(const uint8_t *P, size_t N) {
+  uint64_t V = 0;
+  for (size_t i = 0; i < N; i++)
+    V |= static_cast<uint64_t>(P[i]) << (8 * i);
+  return V;
+}
+
+// The size of the extended packet (0x02 followed by Op), or 0 if unknown.
+static size_t ExtendedPacketSize(uint8_t Op) {
+  if ((Op & 0x1F) == 0x12)  // PTWRITE, with a 4 or 8 byte payload.
+    return (Op >> 5 & 3) ? 10 : 6;
+  switch (Op) {
+  case 0x82: return 16;  // PSB
+  case 0x23: return 2;   // PSBEND
+  case 0xF3: return 2;   // OVF
+  case 0x83: return 2;   // TraceStop
+  case 0x62: case 0xE2: return 2;  // EXSTOP
+  case 0xA3: return 8;   // long TNT
+  case 0x43: return 8;   // PIP
+  case 0x03: return 4;   // CBR
+  case 0x73: return 7;   // TMA
+  case 0xC8: return 7;   // VMCS
+  case 0xC3: return 11;  // MNT
+  case 0xC2: return 10;  // MWAIT
+  case 0x22: return 4;   // PWRE
+  case 0xA2: return 7;   // PWRX
+  default: return 0;
+  }
+}
+
+size_t DecodeIntelPT(const uint8_t *Data, size_t Size, uintptr_t Base,
+                     uint8_t *Counts, size_t NumCounts) {
+  const uint8_t *P = Data, *End = Data + Size;
+  uint64_t LastIP = 0;  // For the compressed IPs of TIP and FUP packets.
+  uint64_t Anchor = 0;  // The last TIP target, relative to Base.
+  size_t Position = 0;  // TNT bits since then.
+  size_t Hits = 0;
+  auto Hit = [&](uint64_t Key) {
+    uint8_t &C = Counts[MixKey(Key) % NumCounts];
+    if (C != 0xFF) C++;
+    Hits++;
+  };
+  // TNT bits come oldest first, from the most significant one down.
+  auto TakeTnt = [&](uint64_t Bits, int NumBits) {
+    for (int i = NumBits - 1; i >= 0; i--) {
+      uint64_t Pos = std::min(Position++, kMaxTntPosition);
+      Hit(MixKey(Anchor) ^ (Pos << 1 | (Bits >> i & 1)));
+    }
+  };
+  while (P < End) {
+    uint8_t B = *P;
+    if (B == 0x00) {  // PAD
+      P++;
+      continue;
+    }
+    if (B == 0x02) {
+      size_t Len = P + 1 < End ? ExtendedPacketSize(P[1]) : 0;
+      if (!Len) {
+        P = FindPSB(P + 1, End);
+        continue;
+      }
+      if (P + Len > End) break;
+      if (P[1] == 0xA3) {
+        uint64_t Payload = ReadLE(P + 2, 6);
+        if (Payload)
+          TakeTnt(Payload, 63 - __builtin_clzll(Payload));
+      } else if (P[1] == 0x82) {
+        LastIP = 0;
+      } else if (P[1] == 0xF3) {
+        Anchor = 0;
+        Position = 0;
+      }
+      P += Len;
+      continue;
+    }
+    if (!(B & 1)) {  // Short TNT: up to 6 bits above a stop bit.
+      TakeTnt(B >> 1, 30 - __builtin_clz(B));
+      P++;
+      continue;
+    }
+    if ((B & 3) == 3) {  // CYC, with more bytes while their bit 0 is set.
+      P++;
+      if (B & 4)
+        while (P < End && (*P++ & 1)) {}
+      continue;
+    }
+    uint8_t Type = B & 0x1F;
+    if (Type == 0x0D || Type == 0x11 || Type == 0x01 || Type == 0x1D) {
+      static const size_t kIPBytes[8] = {0, 2, 4, 6, 6, 0, 8, 0};
+      unsigned Compression = B >> 5;
+      size_t Len = kIPBytes[Compression];
+      if (!Len && Compression) {
+        P = FindPSB(P + 1, End);
+        continue;
+      }
+      if (P + 1 + Len > End) break;
+      uint64_t Payload = ReadLE(P + 1, Len);
+      P += 1 + Len;
+      if (!Compression) {  // The IP is out of context.
+        if (Type == 0x0D) {
+          Anchor = 0;
+          Position = 0;
+        }
+        continue;
+      }
+      if (Compression == 3)  // Sign-extended from 48 bits.
+        LastIP = static_cast<uint64_t>(
+            static_cast<int64_t>(Payload << 16) >> 16);
+      else if (Len == 8)
+        LastIP = Payload;
+      else
+        LastIP = (LastIP & ~((1ULL << (8 * Len)) - 1)) | Payload;
+      uint64_t Target = LastIP - Base;
+      if (Type == 0x0D) {  // TIP
+        Hit(MixKey(Anchor) ^ MixKey(Target) ^ 1);
+        Anchor = Target;
+        Position = 0;
+      } else if (Type == 0x11) {  // TIP.PGE: tracing resumes at Target.
+        Anchor = Target;
+        Position = 0;
+      }
+      continue;
+    }
+    if (B == 0x99 || B == 0x59) {  // MODE, MTC
+      P += 2;
+      continue;
+    }
+    if (B == 0x19) {  // TSC
+      P += 8;
+      continue;
+    }
+    P = FindPSB(P + 1, End);
+  }
+  return Hits;
+}
+
+}  // namespace fuzzer
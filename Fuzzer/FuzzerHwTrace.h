@@ -0,0 +1,111 @@
+//===- FuzzerHwTrace.h - Coverage from hardware branch traces ---*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::HardwareTrace, fuzzer::DecodeIntelPT()
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_HW_TRACE_H
+#define LLVM_FUZZER_HW_TRACE_H
+
+#include "FuzzerDefs.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fuzzer {
+
+// Turns the Intel PT packets in [Data, Data + Size) into hits of NumCounts
+// 8-bit counters, without a disassembler: every taken or not taken
+// conditional branch (a TNT bit) is keyed by the target of the last indirect
+// branch, call or return before it (the last TIP packet) and its position
+// after that target, and every TIP by the pair of targets. The targets are
+// taken relative to Base, the load address of the traced library, so that
+// the counters are the same in every process. The trace is expected with
+// return compression off, so that every return comes with its TIP. A
+// packet that can't be parsed skips the trace to the next PSB. Returns the
+// number of hits.
+size_t DecodeIntelPT(const uint8_t *Data, size_t Size, uintptr_t Base,
+                     uint8_t *Counts, size_t NumCounts);
+
+// -diff_hw_trace=IDX:LIBRARY[,IDX:LIBRARY...]: coverage for the callbacks
+// whose library can't be built with sanitizer coverage. The executable
+// segments of the library, the loaded object whose path contains LIBRARY,
+// are traced with Intel PT through perf_event_open(), filtered by address
+// and only while Begin() and End() bracket a run of callback IDX. End()
+// moves the trace to a background thread, which decodes it while the other
+// callbacks run; Wait() then hands out the counters of that run. The
+// fuzzer imports them into guards reserved for the callback (see
+// TracePC::AddTracedCallbackGuards()), so that the features, diff
+// fingerprints and the rest of diff mode treat them like the guards of an
+// instrumented library. Linux only; ARM CoreSight traces are not decoded.
+class HardwareTrace {
+ public:
+  ~HardwareTrace();
+
+  // Returns false, having printed why, if the library is not loaded or the
+  // kernel or the CPU can't trace it.
+  bool Add(int Callback, const std::string &Library, size_t NumCounts);
+  bool IsRunning() const { return NumTraced > 0; }
+  bool IsTraced(int Callback) const {
+    return Callback >= 0 && static_cast<size_t>(Callback) < Traces.size() &&
+           Traces[Callback];
+  }
+  // Which callbacks Add() set up, indexed by callback.
+  std::vector<bool> TracedCallbacks(size_t NumCallbacks) const;
+
+  void Begin(int Callback);
+  void End(int Callback);
+  // True between End() and Wait().
+  bool IsPending(int Callback) const { return Traces[Callback]->Pending; }
+  // Waits for the trace of the last run of Callback to be decoded and
+  // returns its counters; the caller zeroes the ones it reads.
+  uint8_t *Wait(int Callback);
+
+  size_t NumTraceBytes() const { return TraceBytes; }
+  // Runs whose trace did not fit into the buffer, or that lost packets.
+  size_t NumLostTraces() const { return LostTraces; }
+
+ private:
+  struct Trace {
+    int Fd = -1;
+    uint8_t *Base = nullptr;  // The perf_event_mmap_page and the data ring.
+    size_t BaseSize = 0;
+    uint8_t *Aux = nullptr;   // The ring of PT packets.
+    size_t AuxSize = 0;
+    uintptr_t LoadAddress = 0;
+    std::vector<uint8_t> Counts;
+    bool Pending = false;     // Written by the fuzzing thread only.
+    size_t NumQueued = 0;     // Guarded by Mu.
+  };
+  struct Job {
+    int Callback;
+    std::vector<uint8_t> Packets;
+  };
+
+  void DecoderLoop();
+
+  std::vector<std::unique_ptr<Trace>> Traces;
+  size_t NumTraced = 0;
+  size_t TraceBytes = 0;
+  size_t LostTraces = 0;
+
+  std::mutex Mu;
+  std::condition_variable HasJobs, Decoded;
+  std::deque<Job> Jobs;
+  bool Stopping = false;
+  std::thread Decoder;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_HW_TRACE_H
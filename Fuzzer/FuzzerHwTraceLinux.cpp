@@ -0,0 +1,252 @@
+//===- FuzzerHwTraceLinux.cpp - Intel PT through perf_event_open ----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// HardwareTrace on top of the intel_pt PMU of Linux perf.
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if LIBFUZZER_LINUX
+
+#include "FuzzerHwTrace.h"
+#include "FuzzerIO.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <linux/perf_event.h>
+#include <sstream>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace fuzzer {
+
+// The ring of PT packets of one callback: a run whose trace is longer loses
+// its end.
+static const size_t kAuxBytes = 4 << 20;
+
+static const char *kPtPmuDir = "/sys/bus/event_source/devices/intel_pt/";
+
+// The perf type of the intel_pt PMU, or -1.
+static int PtPmuType() {
+  std::ifstream In(std::string(kPtPmuDir) + "type");
+  int Type = -1;
+  if (!(In >> Type)) return -1;
+  return Type;
+}
+
+// The config bit of the PMU format Name ("config:11"), or Default.
+static int PtConfigBit(const char *Name, int Default) {
+  std::ifstream In(std::string(kPtPmuDir) + "format/" + Name);
+  std::string S;
+  if (!(In >> S) || S.compare(0, 7, "config:")) return Default;
+  return atoi(S.c_str() + 7);
+}
+
+// The executable mapping of the loaded object whose path contains Library:
+// its path, the file offsets and addresses it spans, and the load address.
+struct LibraryMapping {
+  std::string Path;
+  uintptr_t Begin = 0, End = 0;
+  uintptr_t FileOffset = 0;
+  uintptr_t LoadAddress = ~static_cast<uintptr_t>(0);
+};
+
+static bool FindLibrary(const std::string &Library, LibraryMapping *M) {
+  std::ifstream In("/proc/self/maps");
+  std::string L;
+  while (std::getline(In, L)) {
+    std::istringstream ISS(L);
+    std::string Range, Perms, Offset, Dev, Inode, Path;
+    if (!(ISS >> Range >> Perms >> Offset >> Dev >> Inode >> Path)) continue;
+    if (Path.find(Library) == std::string::npos) continue;
+    if (!M->Path.empty() && Path != M->Path) continue;
+    uintptr_t Begin = std::stoull(Range, nullptr, 16);
+    uintptr_t End = std::stoull(Range.substr(Range.find('-') + 1), nullptr, 16);
+    uintptr_t Off = std::stoull(Offset, nullptr, 16);
+    M->Path = Path;
+    M->LoadAddress = std::min(M->LoadAddress, Begin - Off);
+    if (Perms.find('x') == std::string::npos) continue;
+    if (!M->End) {
+      M->Begin = Begin;
+      M->FileOffset = Off;
+    }
+    M->End = End;
+  }
+  return M->End != 0;
+}
+
+HardwareTrace::~HardwareTrace() {
+  if (Decoder.joinable()) {
+    {
+      std::lock_guard<std::mutex> Lock(Mu);
+      Stopping = true;
+    }
+    HasJobs.notify_all();
+    Decoder.join();
+  }
+  for (auto &T : Traces) {
+    if (!T) continue;
+    if (T->Aux) munmap(T->Aux, T->AuxSize);
+    if (T->Base) munmap(T->Base, T->BaseSize);
+    if (T->Fd >= 0) close(T->Fd);
+  }
+}
+
+bool HardwareTrace::Add(int Callback, const std::string &Library,
+                        size_t NumCounts) {
+  int Type = PtPmuType();
+  if (Type < 0) {
+    Printf("ERROR: -diff_hw_trace: no Intel PT here (%stype)\n", kPtPmuDir);
+    return false;
+  }
+  LibraryMapping M;
+  if (!FindLibrary(Library, &M)) {
+    Printf("ERROR: -diff_hw_trace: no loaded library matches %s\n",
+           Library.c_str());
+    return false;
+  }
+  std::unique_ptr<Trace> T(new Trace);
+  T->LoadAddress = M.LoadAddress;
+  T->Counts.assign(NumCounts, 0);
+
+  struct perf_event_attr A;
+  memset(&A, 0, sizeof(A));
+  A.size = sizeof(A);
+  A.type = Type;
+  // Branch tracing is on by default; return compression would need a call
+  // stack to decode.
+  A.config = 1ULL << PtConfigBit("noretcomp", 11);
+  A.disabled = 1;
+  A.exclude_kernel = 1;
+  A.exclude_hv = 1;
+  // This thread only: the callbacks run in the fuzzing thread.
+  T->Fd = static_cast<int>(syscall(SYS_perf_event_open, &A, 0, -1, -1,
+                                   PERF_FLAG_FD_CLOEXEC));
+  if (T->Fd < 0) {
+    Printf("ERROR: -diff_hw_trace: perf_event_open: %s\n", strerror(errno));
+    return false;
+  }
+  size_t Page = sysconf(_SC_PAGESIZE);
+  T->BaseSize = 2 * Page;
+  void *Base = mmap(nullptr, T->BaseSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    T->Fd, 0);
+  if (Base == MAP_FAILED) {
+    Printf("ERROR: -diff_hw_trace: mmap: %s\n", strerror(errno));
+    close(T->Fd);
+    return false;
+  }
+  T->Base = static_cast<uint8_t *>(Base);
+  auto *H = reinterpret_cast<perf_event_mmap_page *>(T->Base);
+  H->aux_offset = T->BaseSize;
+  H->aux_size = T->AuxSize = kAuxBytes;
+  void *Aux = mmap(nullptr, T->AuxSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   T->Fd, H->aux_offset);
+  if (Aux == MAP_FAILED) {
+    Printf("ERROR: -diff_hw_trace: mmap of the AUX area: %s\n",
+           strerror(errno));
+    munmap(T->Base, T->BaseSize);
+    close(T->Fd);
+    return false;
+  }
+  T->Aux = static_cast<uint8_t *>(Aux);
+  char Filter[4096];
+  snprintf(Filter, sizeof(Filter), "filter 0x%zx/0x%zx@%s",
+           static_cast<size_t>(M.FileOffset),
+           static_cast<size_t>(M.End - M.Begin), M.Path.c_str());
+  if (ioctl(T->Fd, PERF_EVENT_IOC_SET_FILTER, Filter) < 0) {
+    Printf("ERROR: -diff_hw_trace: can't set the address filter \"%s\": %s\n",
+           Filter, strerror(errno));
+    munmap(T->Aux, T->AuxSize);
+    munmap(T->Base, T->BaseSize);
+    close(T->Fd);
+    return false;
+  }
+  Printf("INFO: -diff_hw_trace: callback %d traces %s at 0x%zx-0x%zx\n",
+         Callback, M.Path.c_str(), static_cast<size_t>(M.Begin),
+         static_cast<size_t>(M.End));
+  if (Traces.size() <= static_cast<size_t>(Callback))
+    Traces.resize(Callback + 1);
+  Traces[Callback] = std::move(T);
+  NumTraced++;
+  if (!Decoder.joinable())
+    Decoder = std::thread(&HardwareTrace::DecoderLoop, this);
+  return true;
+}
+
+std::vector<bool> HardwareTrace::TracedCallbacks(size_t NumCallbacks) const {
+  std::vector<bool> Res(NumCallbacks);
+  for (size_t i = 0; i < NumCallbacks; i++)
+    Res[i] = IsTraced(static_cast<int>(i));
+  return Res;
+}
+
+void HardwareTrace::Begin(int Callback) {
+  ioctl(Traces[Callback]->Fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+void HardwareTrace::End(int Callback) {
+  Trace &T = *Traces[Callback];
+  ioctl(T.Fd, PERF_EVENT_IOC_DISABLE, 0);
+  auto *H = reinterpret_cast<perf_event_mmap_page *>(T.Base);
+  uint64_t Head = __atomic_load_n(&H->aux_head, __ATOMIC_ACQUIRE);
+  uint64_t Tail = H->aux_tail;
+  Job J = {Callback, {}};
+  size_t Size = static_cast<size_t>(Head - Tail);
+  if (Size >= T.AuxSize) {
+    // The kernel stopped writing; the trace lacks its end.
+    LostTraces++;
+    Size = T.AuxSize;
+  }
+  J.Packets.resize(Size);
+  size_t Off = Tail % T.AuxSize;
+  size_t First = std::min(Size, T.AuxSize - Off);
+  memcpy(J.Packets.data(), T.Aux + Off, First);
+  memcpy(J.Packets.data() + First, T.Aux, Size - First);
+  __atomic_store_n(&H->aux_tail, Head, __ATOMIC_RELEASE);
+  TraceBytes += Size;
+  T.Pending = true;
+  {
+    std::lock_guard<std::mutex> Lock(Mu);
+    T.NumQueued++;
+    Jobs.push_back(std::move(J));
+  }
+  HasJobs.notify_one();
+}
+
+uint8_t *HardwareTrace::Wait(int Callback) {
+  Trace &T = *Traces[Callback];
+  std::unique_lock<std::mutex> Lock(Mu);
+  Decoded.wait(Lock, [&] { return T.NumQueued == 0; });
+  T.Pending = false;
+  return T.Counts.data();
+}
+
+void HardwareTrace::DecoderLoop() {
+  std::unique_lock<std::mutex> Lock(Mu);
+  while (true) {
+    HasJobs.wait(Lock, [&] { return Stopping || !Jobs.empty(); });
+    if (Jobs.empty()) return;
+    Job J = std::move(Jobs.front());
+    Jobs.pop_front();
+    Trace &T = *Traces[J.Callback];
+    Lock.unlock();
+    // Only this thread touches T.Counts while the job is queued.
+    DecodeIntelPT(J.Packets.data(), J.Packets.size(), T.LoadAddress,
+                  T.Counts.data(), T.Counts.size());
+    Lock.lock();
+    T.NumQueued--;
+    Decoded.notify_all();
+  }
+}
+
+}  // namespace fuzzer
+
+#endif  // LIBFUZZER_LINUX
@@ -0,0 +1,41 @@
+//===- FuzzerHwTraceOther.cpp - HardwareTrace stub ------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// HardwareTrace stub for platforms without Linux perf.
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if !LIBFUZZER_LINUX
+
+#include "FuzzerHwTrace.h"
+#include "FuzzerIO.h"
+
+namespace fuzzer {
+
+HardwareTrace::~HardwareTrace() {}
+
+bool HardwareTrace::Add(int Callback, const std::string &Library,
+                        size_t NumCounts) {
+  Printf("ERROR: -diff_hw_trace is only supported on Linux\n");
+  return false;
+}
+
+std::vector<bool> HardwareTrace::TracedCallbacks(size_t NumCallbacks) const {
+  return std::vector<bool>(NumCallbacks);
+}
+
+void HardwareTrace::Begin(int Callback) {}
+
+void HardwareTrace::End(int Callback) {}
+
+uint8_t *HardwareTrace::Wait(int Callback) { return nullptr; }
+
+void HardwareTrace::DecoderLoop() {}
+
+}  // namespace fuzzer
+
+#endif  // !LIBFUZZER_LINUX
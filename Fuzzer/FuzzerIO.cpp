@@ -31,20 +31,11 @@ long GetEpoch(const std::string &Path) {
 }
 
 Unit FileToVector(const std::string &Path, size_t MaxSize, bool ExitOnError) {
-  std::ifstream T(Path);
-  if (ExitOnError && !T) {
+  Unit Res;
+  if (!ReadFileToUnit(Path, MaxSize, &Res) && ExitOnError) {
     Printf("No such directory: %s; exiting\n", Path.c_str());
     exit(1);
   }
-
-  T.seekg(0, T.end);
-  size_t FileLen = T.tellg();
-  if (MaxSize)
-    FileLen = std::min(FileLen, MaxSize);
-
-  T.seekg(0, T.beg);
-  Unit Res(FileLen);
-  T.read(reinterpret_cast<char *>(Res.data()), FileLen);
   return Res;
 }
 
@@ -58,16 +49,22 @@ void CopyFileToErr(const std::string &Path) {
   Printf("%s", FileToString(Path).c_str());
 }
 
-void WriteToFile(const Unit &U, const std::string &Path) {
+void WriteToFile(const Unit &U, const std::string &Path, bool Sync) {
   // Use raw C interface because this function may be called from a sig handler.
   FILE *Out = fopen(Path.c_str(), "w");
   if (!Out) return;
   fwrite(U.data(), sizeof(U[0]), U.size(), Out);
+  if (Sync && !fflush(Out))
+    SyncFile(fileno(Out));
   fclose(Out);
+  if (Sync)
+    SyncDir(DirName(Path));
 }
 
 void ReadDirToVectorOfUnits(const char *Path, std::vector<Unit> *V,
                             long *Epoch, size_t MaxSize, bool ExitOnError) {
+  if (ReadDirInParallel(Path, V, Epoch, MaxSize, ExitOnError))
+    return;
   long E = Epoch ? *Epoch : 0;
   std::vector<std::string> Files;
   ListFilesInDirRecursive(Path, Epoch, &Files, /*TopDir*/true);
@@ -80,7 +77,7 @@ void ReadDirToVectorOfUnits(const char *Path, std::vector<Unit> *V,
       Printf("Loaded %zd/%zd files from %s\n", NumLoaded, Files.size(), Path);
     auto S = FileToVector(X, MaxSize, ExitOnError);
     if (!S.empty())
-      V->push_back(S);
+      V->push_back(std::move(S));
   }
 }
 
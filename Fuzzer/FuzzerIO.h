@@ -25,7 +25,8 @@ std::string FileToString(const std::string &Path);
 
 void CopyFileToErr(const std::string &Path);
 
-void WriteToFile(const Unit &U, const std::string &Path);
+// With Sync, also waits for the data to reach the disk.
+void WriteToFile(const Unit &U, const std::string &Path, bool Sync = false);
 
 void ReadDirToVectorOfUnits(const char *Path, std::vector<Unit> *V,
                             long *Epoch, size_t MaxSize, bool ExitOnError);
@@ -57,6 +58,19 @@ bool IsFile(const std::string &Path);
 void ListFilesInDirRecursive(const std::string &Dir, long *Epoch,
                              std::vector<std::string> *V, bool TopDir);
 
+// Reads the first MaxSize bytes (all of them if MaxSize is 0) of the file at
+// Path into *U. Returns false if it can't be read.
+bool ReadFileToUnit(const std::string &Path, size_t MaxSize, Unit *U);
+
+// Posix only: the same for the open file Fd; sets *MTime if not null.
+bool ReadFdToUnit(int Fd, size_t MaxSize, Unit *U, long *MTime);
+
+// What ReadDirToVectorOfUnits() does, with the files read by a pool of
+// threads while the directories are still being listed, so that no list of
+// all the paths is built. Returns false if this is not supported here.
+bool ReadDirInParallel(const std::string &Dir, std::vector<Unit> *V,
+                       long *Epoch, size_t MaxSize, bool ExitOnError);
+
 char GetSeparator();
 
 FILE* OpenFile(int Fd, const char *Mode);
@@ -67,6 +81,23 @@ int DuplicateFile(int Fd);
 
 void RemoveFile(const std::string &Path);
 
+// Replaces To by From, atomically where the OS allows it.
+bool RenameFile(const std::string &From, const std::string &To);
+
+// Maps the file at Path read-only and sets *Size to its size. Returns
+// nullptr if it can't be read or is empty. Release it with UnmapFile().
+const uint8_t *MapFile(const std::string &Path, size_t *Size);
+void UnmapFile(const uint8_t *Data, size_t Size);
+
+// Flushes the file open as Fd, or the entry of the files in Dir, to the
+// disk. SyncDir() does nothing where directories can't be synced.
+bool SyncFile(int Fd);
+void SyncDir(const std::string &Dir);
+
+// Cuts the file open as Fd, or the one at Path, down to its first Size bytes.
+bool TruncateFile(int Fd, size_t Size);
+bool TruncateFile(const std::string &Path, size_t Size);
+
 void DiscardOutput(int Fd);
 
 intptr_t GetHandleFromFd(int fd);
@@ -13,12 +13,16 @@
 
 #include "FuzzerExtFunctions.h"
 #include "FuzzerIO.h"
+#include <algorithm>
 #include <cstdarg>
 #include <cstdio>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <fstream>
 #include <iterator>
 #include <libgen.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -55,6 +59,46 @@ void ListFilesInDirRecursive(const std::string &Dir, long *Epoch,
     *Epoch = E;
 }
 
+// Larger files are mapped rather than read through a buffer.
+static const size_t kMinMappedFileSize = 1 << 20;
+
+bool ReadFdToUnit(int Fd, size_t MaxSize, Unit *U, long *MTime) {
+  struct stat St;
+  if (fstat(Fd, &St) || !S_ISREG(St.st_mode)) return false;
+  if (MTime)
+    *MTime = St.st_mtime;
+  size_t Len = St.st_size;
+  if (MaxSize)
+    Len = std::min(Len, MaxSize);
+  U->resize(Len);
+  if (Len >= kMinMappedFileSize) {
+    void *Map = mmap(nullptr, Len, PROT_READ, MAP_PRIVATE, Fd, 0);
+    if (Map != MAP_FAILED) {
+      madvise(Map, Len, MADV_SEQUENTIAL);
+      memcpy(U->data(), Map, Len);
+      munmap(Map, Len);
+      return true;
+    }
+  }
+  size_t Pos = 0;
+  while (Pos < Len) {
+    ssize_t N = pread(Fd, U->data() + Pos, Len - Pos, Pos);
+    if (N < 0 && errno == EINTR) continue;
+    if (N <= 0) break;  // Truncated while being read.
+    Pos += N;
+  }
+  U->resize(Pos);
+  return true;
+}
+
+bool ReadFileToUnit(const std::string &Path, size_t MaxSize, Unit *U) {
+  int Fd = open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (Fd < 0) return false;
+  bool Res = ReadFdToUnit(Fd, MaxSize, U, nullptr);
+  close(Fd);
+  return Res;
+}
+
 char GetSeparator() {
   return '/';
 }
@@ -75,6 +119,47 @@ void RemoveFile(const std::string &Path) {
   unlink(Path.c_str());
 }
 
+bool RenameFile(const std::string &From, const std::string &To) {
+  return !rename(From.c_str(), To.c_str());
+}
+
+const uint8_t *MapFile(const std::string &Path, size_t *Size) {
+  int Fd = open(Path.c_str(), O_RDONLY);
+  if (Fd < 0) return nullptr;
+  struct stat St;
+  void *Res = MAP_FAILED;
+  if (!fstat(Fd, &St) && St.st_size > 0)
+    Res = mmap(nullptr, St.st_size, PROT_READ, MAP_PRIVATE, Fd, 0);
+  close(Fd);
+  if (Res == MAP_FAILED) return nullptr;
+  *Size = St.st_size;
+  return static_cast<const uint8_t *>(Res);
+}
+
+void UnmapFile(const uint8_t *Data, size_t Size) {
+  if (Data)
+    munmap(const_cast<uint8_t *>(Data), Size);
+}
+
+bool SyncFile(int Fd) {
+  return !fsync(Fd);
+}
+
+void SyncDir(const std::string &Dir) {
+  int Fd = open(Dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (Fd < 0) return;
+  fsync(Fd);
+  close(Fd);
+}
+
+bool TruncateFile(int Fd, size_t Size) {
+  return !ftruncate(Fd, Size);
+}
+
+bool TruncateFile(const std::string &Path, size_t Size) {
+  return !truncate(Path.c_str(), Size);
+}
+
 void DiscardOutput(int Fd) {
   FILE* Temp = fopen("/dev/null", "w");
   if (!Temp)
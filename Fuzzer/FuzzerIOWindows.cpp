@@ -13,8 +13,11 @@
 
 #include "FuzzerExtFunctions.h"
 #include "FuzzerIO.h"
+#include <algorithm>
 #include <cstdarg>
 #include <cstdio>
+#include <cstring>
+#include <fcntl.h>
 #include <fstream>
 #include <io.h>
 #include <iterator>
@@ -137,10 +140,61 @@ int DuplicateFile(int Fd) {
   return _dup(Fd);
 }
 
+bool ReadFileToUnit(const std::string &Path, size_t MaxSize, Unit *U) {
+  std::ifstream T(Path, std::ios::binary);
+  if (!T) return false;
+  T.seekg(0, T.end);
+  auto FileLen = T.tellg();
+  if (FileLen < 0) return false;
+  size_t Len = static_cast<size_t>(FileLen);
+  if (MaxSize)
+    Len = std::min(Len, MaxSize);
+  T.seekg(0, T.beg);
+  U->resize(Len);
+  T.read(reinterpret_cast<char *>(U->data()), Len);
+  U->resize(T.gcount());
+  return true;
+}
+
 void RemoveFile(const std::string &Path) {
   _unlink(Path.c_str());
 }
 
+bool RenameFile(const std::string &From, const std::string &To) {
+  return MoveFileExA(From.c_str(), To.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+// Reads the file into memory instead of mapping it.
+const uint8_t *MapFile(const std::string &Path, size_t *Size) {
+  Unit U = FileToVector(Path, 0, /*ExitOnError=*/false);
+  if (U.empty()) return nullptr;
+  uint8_t *Res = new uint8_t[U.size()];
+  memcpy(Res, U.data(), U.size());
+  *Size = U.size();
+  return Res;
+}
+
+void UnmapFile(const uint8_t *Data, size_t Size) { delete[] Data; }
+
+bool SyncFile(int Fd) {
+  return !_commit(Fd);
+}
+
+// NTFS keeps directory entries consistent on its own.
+void SyncDir(const std::string &Dir) {}
+
+bool TruncateFile(int Fd, size_t Size) {
+  return !_chsize_s(Fd, Size);
+}
+
+bool TruncateFile(const std::string &Path, size_t Size) {
+  int Fd = _open(Path.c_str(), _O_WRONLY | _O_BINARY);
+  if (Fd < 0) return false;
+  bool Ok = TruncateFile(Fd, Size);
+  _close(Fd);
+  return Ok;
+}
+
 void DiscardOutput(int Fd) {
   FILE* Temp = fopen("nul", "w");
   if (!Temp)
@@ -54,6 +54,18 @@ size_t LLVMFuzzerCustomCrossOver(const uint8_t *Data1, size_t Size1,
                                  uint8_t *Out, size_t MaxOutSize,
                                  unsigned int Seed);
 
+// Optional user-provided shrinking function, used by -minimize_diff=1.
+// Writes a smaller variant of [Data, Data+Size) to Out and returns its size,
+// or returns 0 if it has none.
+// Should produce the same variant given the same Seed.
+size_t LLVMFuzzerCustomShrink(const uint8_t *Data, size_t Size, uint8_t *Out,
+                              size_t MaxOutSize, unsigned int Seed);
+
+// Optional user-provided function, used by -len_control=N.
+// Returns the next mutation length limit above MaxLen that is worth trying,
+// e.g. MaxLen plus the size of one more record or extension.
+size_t LLVMFuzzerCustomLengthStep(size_t MaxLen);
+
 // Experimental, may go away in future.
 // libFuzzer-provided function to be used inside LLVMFuzzerCustomMutator.
 // Mutates raw data in [Data, Data+Size) inplace.
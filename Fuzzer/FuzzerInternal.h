@@ -12,11 +12,35 @@
 #ifndef LLVM_FUZZER_INTERNAL_H
 #define LLVM_FUZZER_INTERNAL_H
 
+#include "FuzzerAsyncWriter.h"
+#include "FuzzerControl.h"
 #include "FuzzerDefs.h"
+#include "FuzzerDiffCluster.h"
+#include "FuzzerDiffPack.h"
+#include "FuzzerDiffReport.h"
+#include "FuzzerDiffShared.h"
+#include "FuzzerDiffThreads.h"
+#include "FuzzerDigestSet.h"
+#include "FuzzerDirected.h"
+#include "FuzzerDirWatcher.h"
+#include "FuzzerEdgeStore.h"
+#include "FuzzerEquivalence.h"
 #include "FuzzerExtFunctions.h"
+#include "FuzzerForkServer.h"
+#include "FuzzerHash.h"
+#include "FuzzerHistogram.h"
+#include "FuzzerHwTrace.h"
 #include "FuzzerInterface.h"
+#include "FuzzerMetrics.h"
+#include "FuzzerMutate.h"
+#include "FuzzerMutatePipeline.h"
 #include "FuzzerOptions.h"
+#include "FuzzerPackedCorpus.h"
+#include "FuzzerRemote.h"
 #include "FuzzerSHA1.h"
+#include "FuzzerStatsLog.h"
+#include "FuzzerSync.h"
+#include "FuzzerTrace.h"
 #include "FuzzerValueBitMap.h"
 #include <algorithm>
 #include <atomic>
@@ -25,6 +49,9 @@
 #include <cstdlib>
 #include <string.h>
 #include <map>
+#include <memory>
+#include <set>
+#include <unordered_map>
 namespace fuzzer {
 
 using namespace std::chrono;
@@ -33,12 +60,15 @@ class Fuzzer {
 public:
 
   Fuzzer(UserCallback CB, InputCorpus &Corpus, MutationDispatcher &MD,
-         FuzzingOptions Options);
+         FuzzingOptions Opts);
   ~Fuzzer();
   void Loop();
   void MinimizeCrashLoop(const Unit &U);
   void ShuffleAndMinimize(UnitVector *V);
   void RereadOutputCorpus(size_t MaxSize);
+  void RunSharedUnits();
+  size_t NumPackedUnits() const { return Packed.size(); }
+  size_t MaxPackedUnitSize() const;
 
   size_t secondsSinceProcessStartUp() {
     return duration_cast<seconds>(system_clock::now() - ProcessStartTime)
@@ -62,22 +92,59 @@ public:
   static void StaticCrashSignalCallback();
   static void StaticInterruptCallback();
   static void StaticFileSizeExceedCallback();
+  static void StaticBatchInputDoneCallback(size_t Idx);
+  static void StaticCrashOnOverwrittenData();
 
   int ExecuteCallback(const uint8_t *Data, size_t Size);
   bool RunOne(const uint8_t *Data, size_t Size, bool MayDeleteFile = false,
               InputInfo *II = nullptr);
+  bool RunOneUntimed(const uint8_t *Data, size_t Size, bool MayDeleteFile,
+                     InputInfo *II);
   bool RunOneCallback(const uint8_t *Data, size_t Size, size_t idx,
                       bool MayDeleteFile = false, InputInfo *II = nullptr);
+  bool AddTraceFeatures(const uint8_t *Data, size_t Size, size_t idx,
+                        bool MayDeleteFile, InputInfo *II);
+  bool ExecuteAllCallbacks(const uint8_t *Data, size_t Size);
+  size_t RunAllCallbacks(const uint8_t *Data, size_t Size, bool MayDeleteFile,
+                         InputInfo *II, std::vector<int> *FeaturesPerCallback);
+  size_t CollectAllCallbackFeatures(const uint8_t *Data, size_t Size,
+                                    bool MayDeleteFile, InputInfo *II,
+                                    std::vector<int> *FeaturesPerCallback);
+  bool FinishDiffRun(const uint8_t *Data, size_t Size, bool MayDeleteFile,
+                     size_t features, std::vector<int> &feature_vec);
+  size_t RunCallbacksInForkedChild(const uint8_t *Data, size_t Size,
+                                   uint8_t *Out, size_t MaxOutSize,
+                                   size_t FirstCallback = 0);
+  int CrashedForkedCallback(const uint8_t *Reply, size_t FirstCallback) const;
+  // A forked child replies with the result and the latency of every
+  // callback, followed by the exported coverage.
+  size_t ForkedResultsSize() const;
 
   // Merge Corpora[1:] into Corpora[0].
   void Merge(const std::vector<std::string> &Corpora);
   void CrashResistantMerge(const std::vector<std::string> &Args,
                            const std::vector<std::string> &Corpora,
                            const char *CoverageSummaryInputPathOrNull,
-                           const char *CoverageSummaryOutputPathOrNull);
+                           const char *CoverageSummaryOutputPathOrNull,
+                           size_t NumShards = 1);
   void CrashResistantMergeInternalStep(const std::string &ControlFilePath);
+  // Runs the inputs and the -diff_pack records through all callbacks.
+  void ReplayDiffs(const std::vector<std::string> &Inputs, size_t NumWorkers,
+                   const char *TablePathOrNull,
+                   const char *ClusterDirOrNull = nullptr);
+  // Shrinks U while the verdicts of all callbacks stay the same.
+  Unit MinimizeDiff(const Unit &U, size_t NumWorkers);
+  // -seed_workers=N and -seed_cache: the initial pass over the seeds on N
+  // cores. Calls OnNewUnit for every seed that joined the corpus.
+  void TriageSeeds(const UnitVector &Seeds, size_t NumWorkers,
+                   const std::function<void(const Unit &)> &OnNewUnit);
+  bool RunOneFromForkedReply(const uint8_t *Data, size_t Size,
+                             const uint8_t *Reply, size_t ReplySize);
+  // Times the diff hot path on Inputs, for about Millis ms per benchmark.
+  void RunBenchmarks(const UnitVector &Inputs, int Millis);
   MutationDispatcher &GetMD() { return MD; }
   void PrintFinalStats();
+  void DumpModuleCoverage();
   void SetMaxInputLen(size_t MaxInputLen);
   void SetMaxMutationLen(size_t MaxMutationLen);
   void RssLimitCallback();
@@ -86,9 +153,27 @@ public:
   size_t GetCurrentUnitInFuzzingThead(const uint8_t **Data) const;
   void TryDetectingAMemoryLeak(const uint8_t *Data, size_t Size,
                                bool DuringInitialCorpusExecution);
+  void TryDetectingACallbackLeak(const uint8_t *Data, size_t Size,
+                                 bool DuringInitialCorpusExecution);
+  void CheckLeakSuspects(bool DuringInitialCorpusExecution);
 
   void HandleMalloc(size_t Size);
+  // The serial differential callback being run, or -1; the malloc hooks
+  // charge its allocations to it.
+  int RunningCallback() const { return RunningCallbackIdx; }
   void AnnounceOutput(const uint8_t *Data, size_t Size);
+  // -run_equivalence_server: serves the inputs of a client, never returns.
+  int RunEquivalenceServer(const char *Name, size_t NumSlots);
+  // -use_equivalence_server: adds one server to compare the outputs with.
+  bool ConnectToEquivalenceServer(const char *Name);
+  // Waits until every server has checked every input.
+  void DrainEquivalenceServers();
+  // -diff_remote_worker: runs callback Callback for the fuzzer, never
+  // returns unless attaching fails.
+  int RunRemoteWorker(const char *Name, size_t Idx, size_t Callback);
+  // The proxy of remote callback Idx: runs Data on all workers, returns the
+  // result of Idx and leaves its coverage in TPC.
+  int RunRemoteCallback(size_t Idx, const uint8_t *Data, size_t Size);
 
 private:
   void AlarmCallback();
@@ -96,10 +181,40 @@ private:
   void CrashOnOverwrittenData();
   void InterruptCallback();
   void MutateAndTestOne();
+  int AdaptiveMutateDepth(const InputInfo &II) const;
+  static const int kMaxMutateDepthFactor = 4;
+  void RunPipelinedMutants();
+  size_t LenControlMaxMutationLen();
+  bool IsDuplicateMutant(const uint8_t *Data, size_t Size);
+  bool SkipRejectedPrefix(const uint8_t *Data, size_t Size, Digest128 *Prefix);
+  void LearnRejectedPrefix(Digest128 Prefix, bool NewUnit);
+  MutationDispatcher::MutantOutcome MutantOutcomeOf(bool NewUnit,
+                                                   size_t NumFeaturesBefore,
+                                                   size_t NumDiffClassesBefore,
+                                                   double Seconds);
+  void ReportNewMutant(InputInfo *II, const Unit &U);
+  // One round of MinimizeDiff(): the index of the smallest of Candidates
+  // whose verdicts are Target, or Candidates.size().
+  size_t SelectDiffCandidate(ForkServer *Servers, size_t NumWorkers,
+                             const std::vector<Unit> &Candidates,
+                             const std::vector<int> &Target);
+  void RunBatch(InputInfo *II);
+  void RunCoverageWindow(InputInfo *II);
+  void RunPendingMutants(InputInfo *II);
+  void StartBatchInput(size_t Idx);
+  void BatchInputDoneCallback(size_t Idx);
   void ReportNewCoverage(InputInfo *II, const Unit &U);
   void PrintPulseAndReportSlowInput(const uint8_t *Data, size_t Size);
   void WriteToOutputCorpus(const Unit &U);
-  void WriteUnitToFileWithPrefix(const Unit &U, const char *Prefix);
+  // Sha1, if given, must be the checksum of U.
+  void WriteUnitToFileWithPrefix(const Unit &U, const char *Prefix,
+                                 const uint8_t *Sha1 = nullptr);
+  // Like WriteUnitToFileWithPrefix, but with -async_writes=1 the unit is only
+  // queued. Used for the artifacts that are not written on the way out.
+  void QueueUnitToFileWithPrefix(const Unit &U, const char *Prefix,
+                                 const uint8_t *Sha1 = nullptr);
+  std::string ArtifactPath(const Unit &U, const char *Prefix,
+                           const uint8_t *Sha1) const;
   void PrintStats(const char *Where, const char *End = "\n", size_t Units = 0);
   void PrintStatusForNewUnit(const Unit &U);
   void ShuffleCorpus(UnitVector *V);
@@ -108,22 +223,145 @@ private:
   static void StaticDeathCallback();
   void DumpCurrentUnit(const char *Prefix);
   void DumpUnitIfDiff(const uint8_t *Data, size_t Size);
+  bool IsOutputDiff() const;
+  Digest128 DiffFingerprint() const;
+  MinHash DiffSignature() const;
+  bool IsNewDiffCluster();
+  uint64_t DiffClassHash() const;
+  void AppendDiffRecord(const uint8_t *Data, size_t Size, Digest128 D);
+  void AppendEdgeSets(Digest128 D);
+  // The unit the input being run was mutated from, and with -diff_pack its
+  // mutation sequence if it is not MD's current one.
+  const uint8_t *DiffParentData = nullptr;
+  size_t DiffParentSize = 0;
+  const std::string *DiffParentSequence = nullptr;
+  void CollectDiffMergeFeatures(const uint8_t *Data, size_t Size,
+                                std::set<size_t> *Features);
+  void MineDiffCmpArgs(const uint8_t *Data, size_t Size);
+  static const size_t kMaxMinedCmpWordsPerDiff = 16;
+  size_t NumberOfMinedCmpWords = 0;
+  void RunInputToState(InputInfo *II, const uint8_t *Data, size_t Size);
+  static const size_t kMaxInputToStateCandidates = 256;
+  size_t NumberOfInputToStateUnits = 0;
+  size_t NumberOfInputToStateRuns = 0;
+  size_t NumberOfInputToStateNewUnits = 0;
+  bool ConfirmDiff(const uint8_t *Data, size_t Size);
+  OutputOracle Oracle;  // Used with -diff_oracle.
+  // -diff_confirm=K: the fingerprints of the diffs that did not reproduce.
+  DigestSet FlakyDiffs;
+  static const size_t kMaxFlakyDiffs = 1 << 16;
+  size_t NumberOfFlakyDiffs = 0;
+  size_t NumberOfConfirmRuns = 0;
+  int DiffVerdict(int Ret) const {
+    return Options.DiffVerdictBits ? Ret & ((1 << Options.DiffVerdictBits) - 1)
+                                   : Ret;
+  }
   void DeathCallback();
+  void RunPackedUnits(size_t Begin, bool Shuffle);
+  // -diff_energy: files a new diff unit under its verdict pattern.
+  void RecordDiffClass(size_t Idx);
+  // -diff_prune=N: per-callback execution time and the number of diffs that
+  // would have been missed without the callback.
+  void CreditDiffToCallbacks();
+  void MaybePruneCallbacks();
+  void PrintCallbackStats();
+  // Latencies of every differential callback, in all execution modes, and
+  // the slowest one so far for -report_slow_units.
+  void RecordCallbackLatency(size_t Idx, uint64_t Nanos, const uint8_t *Data,
+                             size_t Size);
+  std::vector<LatencyHistogram> CallbackLatency;
+  std::vector<double> CallbackLongestSeconds;
+  // Filled by the -diff_parallel workers and the -diff_fork child.
+  std::vector<uint64_t> CallbackNanos;
+  std::vector<double> CallbackSeconds;
+  std::vector<size_t> CallbackUniqueDiffs;
+  std::vector<bool> CallbackDisabled;
+  // Features first found in the module of each callback.
+  std::vector<size_t> CallbackNewFeatures;
+  size_t RunsSincePrune = 0;
+  // -diff_early_exit=N: the serial callbacks by mean latency, and for each
+  // result of the callback that runs first the number of inputs in a row
+  // on which all callbacks then agreed.
+  void MaybeReorderCallbacks();
+  bool PredictsAgreement(int First);
+  void LearnAgreement(int First);
+  std::vector<int> CallbackOrder;
+  std::unordered_map<uint64_t, size_t> AgreeingRuns;
+  size_t RunsSinceReorder = 0;
+  size_t NumberOfEarlyExits = 0;
+  size_t NumberOfSavedCallbacks = 0;
+  // -diff_fast_path=N: the uninstrumented builds of the callbacks, their
+  // copy of the input and their results, and the results seen so far.
+  bool RunFastCallbacks(const uint8_t *Data, size_t Size);
+  UserCallbacks *FastUC = nullptr;
+  std::vector<uint8_t> FastInputCopy;
+  std::vector<int> FastResults;
+  DigestSet FastPathPatterns;
+  size_t NumberOfFastOnlyRuns = 0;
+  size_t NumberOfFastPathMismatches = 0;
+  // -diff_reference=R: coverage comes from callback R alone; the others run
+  // on its new coverage and on one in ReferenceSampleOneIn other inputs,
+  // which LearnReferenceSample() adapts to the diffs those turn up.
+  bool RunReferenceCallback(const uint8_t *Data, size_t Size,
+                            bool MayDeleteFile, InputInfo *II,
+                            size_t *Features);
+  void LearnReferenceSample();
+  static const size_t kReferenceWindow = 64;
+  size_t ReferenceSampleOneIn = 1;
+  bool ReferenceSampled = false;
+  size_t ReferenceWindowRuns = 0;
+  size_t ReferenceWindowDiffs = 0;
+  size_t NumberOfReferenceOnlyRuns = 0;
+  size_t NumberOfReferenceSampledRuns = 0;
+  size_t NumberOfReferenceSampledDiffs = 0;
 
   void AllocateCurrentUnitData();
   uint8_t *CurrentUnitData = nullptr;
+  // The corpus unit MutateAndTestOne() mutates, kept next to CurrentUnitData
+  // for the -diff_pack record and the _BeforeMutationWas_ file of a diff.
+  uint8_t *BaseUnitData = nullptr;
+  // -diff_zero_copy=1: every callback of one input runs on SharedInputCopy,
+  // which ends right before the guard page of GuardedInput.
+  uint8_t *CopyToGuardedInput(const uint8_t *Data, size_t Size);
+  void ProtectGuardedInput(bool ReadOnly);
+  uint8_t *GuardedInput = nullptr;
+  size_t GuardedInputCapacity = 0;
+  uint8_t *SharedInputCopy = nullptr;
   std::atomic<size_t> CurrentUnitSize;
   uint8_t BaseSha1[kSHA1NumBytes];  // Checksum of the base unit.
+  // Checksum of the last unit with a new diff, computed once for its
+  // artifact, its corpus entry and its _BeforeMutationWas_ file.
+  uint8_t DiffUnitSha1[kSHA1NumBytes];
   bool RunningCB = false;
+  // The serial differential callback being run, or -1.
+  int RunningCallbackIdx = -1;
 
   size_t TotalNumberOfRuns = 0;
   size_t NumberOfNewUnitsAdded = 0;
+  // All mutations so far, for -adaptive_depth.
+  size_t NumberOfMutations = 0;
+  size_t NumberOfSuccessfulMutations = 0;
+  size_t NumberOfDiffMutations = 0;
+  size_t NumberOfMutatedUnits = 0;
   size_t NumberOfDiffUnitsAdded = 0;
   size_t NumberofValidCases = 0;
   bool HasMoreMallocsThanFrees = false;
   size_t NumberOfLeakDetectionAttempts = 0;
-  std::map<std::string, bool> hashMap;
+  // Differential leak detection, per callback.
+  std::vector<bool> CallbackLeakSuspects;  // Set by the last RunOne.
+  std::vector<size_t> CallbackLeakAttempts;
+  std::vector<bool> CallbackLeakChecksOff;
+  UnitVector LeakSuspects;  // Inputs waiting for CheckLeakSuspects().
+  std::vector<std::string> LeakSuspectCallbacks;
+  DigestSet hashMap;  // Mutants produced so far.
   size_t NumberOfDuplicate = 0;
+  // -diff_reject_cache: prefixes that all callbacks rejected alike.
+  DigestSet RejectedPrefixes;
+  size_t NumberOfRejectCacheHits = 0;
+  size_t NumberOfRejectCacheSkips = 0;
+  // -mutate_pipeline: the producer has been sent Corpus[0, PipelineSynced).
+  MutationPipeline Pipeline;
+  size_t PipelineSynced = 0;
   size_t Duplicate = 0;
   UserCallback CB;
   InputCorpus &Corpus;
@@ -132,18 +370,113 @@ private:
 
   system_clock::time_point ProcessStartTime = system_clock::now();
   system_clock::time_point UnitStartTime, UnitStopTime;
+  // The time spent in callbacks so far, read by RunOne() with -cost_aware.
+  uint64_t CallbackNanosSum = 0;
   long TimeOfLongestUnitInSeconds = 0;
   long EpochOfLastReadOfOutputCorpus = 0;
+  DirWatcher OutputCorpusWatcher;  // Used by RereadOutputCorpus if possible.
 
   size_t MaxInputLen = 0;
   size_t MaxMutationLen = 0;
+  // -len_control: the current limit, and the run and the number of new
+  // units when it was last raised or the corpus last grew.
+  size_t LenControlLen = 0;
+  size_t LenControlRun = 0;
+  size_t LenControlUnits = 0;
 
   std::vector<uint32_t> FeatureSetTmp;
 
   // Need to know our own thread.
   static thread_local bool IsMyThread;
   static thread_local bool UnitHadOutputDiff;
-  std::map<std::string, bool> CoverageHash;
+  DigestSet CoverageHash;  // Fingerprints of diff coverage.
+  DiffThreadPool DiffWorkers;  // Used with -diff_parallel=1.
+  DiffExecutorPool DiffExecutors;  // Used with -diff_threads=N.
+  ForkServer DiffForkServer;   // Used with -diff_fork=N.
+  DiffSharedState DiffShared;  // Used with -jobs=N -diff_shared=1.
+  // The server's one ring, or one ring per server of a client.
+  std::vector<std::unique_ptr<EquivalenceRing>> EquivalenceRings;
+  void BeginEquivalenceInput(const uint8_t *Data, size_t Size);
+  void EndEquivalenceInput();
+  void CheckEquivalence();
+  RemoteWorkers Remote;        // Used with -diff_remote.
+  HardwareTrace HwTrace;       // Used with -diff_hw_trace.
+  void StartHardwareTrace();
+  // The guards, and counters, of every traced callback.
+  static const size_t kHwTraceGuards = 1 << 16;
+  UserCallbacks RemoteUC;      // The proxies of the remote callbacks.
+  void StartRemoteWorkers();
+  // Takes the replies to the oldest input on the workers: their results go
+  // to TPC.OutputDiffVec and CallbackNanos, their coverage to TPC.
+  void TakeRemoteReplies();
+  static void StaticStopRemoteWorkers();
+  PackedCorpus Packed;         // Used with -packed_corpus.
+  DiffClusters Clusters;       // Used with -diff_cluster=1.
+  size_t NumberOfClusteredDiffs = 0;
+  size_t NumberOfEdgeBucketUnits = 0;
+  DiffPack DiffArtifacts;      // Used with -diff_pack.
+  EdgeStore EdgeSets;          // Used with -diff_edge_store.
+  DiffCoverageReport CoverageReport;  // Used with -diff_coverage_report.
+  TargetDistances Directed;    // Used with -directed_targets.
+  // Gives the unit last added to the corpus what -directed_targets and
+  // -rare_edges make of the coverage of the last run.
+  void AnnotateNewUnit();
+  void MaybeUpdateRareEdgeBoosts();
+  size_t LastRareEdgeUpdate = 0;
+  void MaybeUpdateCostWeights();
+  size_t NextCostUpdate = 0;
+  void WriteDiffCoverageReport();
+  StatsLog DiffStatsLog;       // Used with -diff_mode=1 -stats_log.
+  Tracer Trace;                // Used with -trace_file.
+  MetricsServer Metrics;       // Used with -metrics_port=N.
+  SyncClient Sync;             // Used with -sync_with.
+  void RunSyncedUnits(size_t MaxSize);
+  size_t NumberOfSyncedUnits = 0;
+  size_t NumberOfSyncedDiffs = 0;
+  AsyncWriter FileWriter;      // Used with -async_writes=1.
+  void MaybePublishMetrics();
+  std::string FormatMetrics();
+  steady_clock::time_point LastMetricsPublish;
+  ControlChannel Control;      // Used with -diff_control.
+  void MaybeRunControlCommands();
+  void ReloadCallback(int Idx);
+  steady_clock::time_point LastControlPoll;
+  size_t NumberOfReloads = 0;
+  // -diff_memory_limit_mb=N: reloads, or else disables, a callback whose
+  // heap went over N Mb.
+  void MaybeEnforceCallbackMemoryLimits();
+  std::vector<size_t> CallbackMemoryResets;
+  // -diff_checkpoint: the dedup tables and counters of a campaign.
+  void LoadDiffCheckpoint();
+  bool SaveDiffCheckpoint();
+  void MaybeSaveDiffCheckpoint();
+  steady_clock::time_point LastDiffCheckpoint;
+  // Time spent in MD.Mutate() and in executing the mutants, -metrics_port.
+  double MutateSeconds = 0;
+  double ExecuteSeconds = 0;
+  size_t NumPackedUnitsRun = 0;
+  bool InForkedChild = false;
+  // -diff_batch=N and -diff_coverage_window=W: the pending mutants, all
+  // mutated from BaseUnitData. With -diff_batch, the results and exported
+  // coverage of every (callback, input) pair.
+  std::vector<Unit> Batch;
+  std::vector<std::string> BatchMutationSequences;  // With -diff_pack.
+  // With MD.TracksMutants().
+  std::vector<MutationDispatcher::MutantOrigin> BatchMutantOrigins;
+  std::vector<MutationDispatcher::MutantOutcome> BatchMutantOutcomes;
+  std::vector<int> BatchResults;
+  std::vector<std::vector<uint8_t>> BatchCoverage;
+  std::vector<uint64_t> BatchNanos;  // With -diff_threads.
+  std::vector<uint8_t> BatchExportBuffer;
+  size_t BatchCallbackIdx = 0;
+  // -diff_coverage_window: set while ExecuteCallback() is to leave the
+  // coverage maps of the previous runs alone.
+  bool AccumulatingCoverage = false;
+  size_t NumberOfCoverageWindows = 0;
+  size_t NumberOfWindowReruns = 0;
+  size_t NumberOfForkedChildFailures = 0;
+  size_t NumberOfCallbackTimeouts = 0;
+  size_t NumberOfCallbackCrashes = 0;
 };
 
 } // namespace fuzzer
@@ -14,10 +14,12 @@
 #include "FuzzerInternal.h"
 #include "FuzzerMutate.h"
 #include "FuzzerRandom.h"
-#include "FuzzerShmem.h"
 #include "FuzzerTracePC.h"
 #include <algorithm>
+#include <cinttypes>
+#include <climits>
 #include <cstring>
+#include <functional>
 #include <memory>
 #include <set>
 #include <sstream>
@@ -57,38 +59,28 @@
 #include "errno.h"
 #include <time.h>
 
-void log_save(const char *file, char *message)
-{
-  FILE* fp = NULL;
-  fp = fopen(file, "a");
-  fprintf(fp, "%s\n", message);
-  fclose(fp);
-}
-
-void uint_to_uint8(uintptr_t* source, uint8_t* dest,size_t size)
-{
-	
-	for (int i = 0; i < size; i++) {
-	    dest[i * 8] = (uint8_t)source[i];
-	    dest[i * 8 + 1] = (uint8_t)(source[i] >> 8);
-	    dest[i * 8 + 2] = (uint8_t)(source[i] >> 16);
-	    dest[i * 8 + 3] = (uint8_t)(source[i] >> 24);
-	    dest[i * 8 + 4] = (uint8_t)(source[i] >> 32);
-	    dest[i * 8 + 5] = (uint8_t)(source[i] >> 40);
-	    dest[i * 8 + 6] = (uint8_t)(source[i] >> 48);
-	    dest[i * 8 + 7] = (uint8_t)(source[i] >> 56);
-	}
-}
-
 
 namespace fuzzer {
 static const size_t kMaxUnitSizeToPrint = 256;
+// How many times MutateAndTestOne re-mutates a unit it has already seen
+// (with -dedup_mutants=2) before executing it anyway.
+static const size_t kMaxDuplicateMutantRetries = 16;
+// -diff_reject_cache starts over when it holds this many prefixes.
+static const size_t kMaxRejectedPrefixes = 1 << 16;
+// -diff_early_exit reorders the callbacks by latency this often.
+static const size_t kEarlyExitReorderRuns = 4096;
+// -diff_fast_path starts over when it has seen this many result vectors.
+static const size_t kMaxFastPathPatterns = 1 << 20;
+// In diff mode one lsan pass checks this many leak suspects.
+static const size_t kLeakSuspectsPerCheck = 8;
+// -rare_edges recomputes the weights of the corpus units this often.
+static const size_t kRareEdgeUpdateRuns = 1 << 16;
+// -cost_aware: the runs between two updates of the median run time.
+static const size_t kCostUpdateRuns = 1 << 14;
 
 thread_local bool Fuzzer::IsMyThread;
 thread_local bool Fuzzer::UnitHadOutputDiff;
 
-SharedMemoryRegion SMR;
-
 // Only one Fuzzer per process.
 static Fuzzer *F;
 
@@ -99,31 +91,92 @@ struct MallocFreeTracer {
     this->TraceLevel = TraceLevel;
     if (TraceLevel)
       Printf("MallocFreeTracer: START\n");
-    Mallocs = 0;
-    Frees = 0;
+    if (!Aggregating) {
+      Mallocs = Frees = 0;
+      ThreadMallocs = ThreadFrees = 0;
+    }
+    StartMallocs = Mallocs + ThreadMallocs;
+    StartFrees = Frees + ThreadFrees;
+    Active.store(true, std::memory_order_relaxed);
   }
-  // Returns true if there were more mallocs than frees.
+  // Returns true if there were more mallocs than frees since Start().
   bool Stop() {
+    Active.store(false, std::memory_order_relaxed);
+    size_t M = Mallocs + ThreadMallocs - StartMallocs;
+    size_t Fr = Frees + ThreadFrees - StartFrees;
     if (TraceLevel)
-      Printf("MallocFreeTracer: STOP %zd %zd (%s)\n", Mallocs.load(),
-             Frees.load(), Mallocs == Frees ? "same" : "DIFFERENT");
-    bool Result = Mallocs > Frees;
-    Mallocs = 0;
-    Frees = 0;
+      Printf("MallocFreeTracer: STOP %zd %zd (%s)\n", M, Fr,
+             M == Fr ? "same" : "DIFFERENT");
     TraceLevel = 0;
-    return Result;
+    return M > Fr;
+  }
+  // Adds up the Start()/Stop() windows until EndInput(), which tells
+  // whether the input as a whole, where a block one callback allocates may
+  // be freed by a later one, is a leak suspect.
+  void BeginInput() {
+    Mallocs = Frees = 0;
+    ThreadMallocs = ThreadFrees = 0;
+    Aggregating = true;
+  }
+  bool EndInput() {
+    Aggregating = false;
+    return Mallocs + ThreadMallocs > Frees + ThreadFrees;
+  }
+  // With -malloc_sample=N only the blocks whose address hashes into one of
+  // N buckets are counted. A block is counted at both malloc and free, so
+  // a leaked block is still seen with probability 1/N.
+  bool Counts(const volatile void *Ptr) const {
+    if (!Active.load(std::memory_order_relaxed)) return false;
+    uint64_t H = reinterpret_cast<uintptr_t>(Ptr) * 0x9e3779b97f4a7c15ULL;
+    return !((H >> 32) & SampleMask);
   }
-  std::atomic<size_t> Mallocs;
-  std::atomic<size_t> Frees;
+  // The fuzzing thread counts without atomics; -diff_parallel workers and
+  // other threads use the atomic counters.
+  size_t Mallocs = 0;
+  size_t Frees = 0;
+  std::atomic<size_t> ThreadMallocs{0};
+  std::atomic<size_t> ThreadFrees{0};
+  size_t StartMallocs = 0;
+  size_t StartFrees = 0;
+  std::atomic<bool> Active{false};
+  bool Aggregating = false;
+  uint64_t SampleMask = 0;
   int TraceLevel = 0;
 };
 
 static MallocFreeTracer AllocTracer;
 
+// -diff_memory_limit_mb: the heap each serial callback holds, i.e. what the
+// fuzzing thread allocated minus what it freed while the callback ran, and
+// the most it ever held. A block is charged to the callback that frees it,
+// which for the caches and sessions of a library is the one that made it.
+struct CallbackHeapTracer {
+  void Malloc(size_t Size) {
+    if (Live.empty() || !F->InFuzzingThread()) return;
+    int Idx = F->RunningCallback();
+    if (Idx < 0) return;
+    Live[Idx] += Size;
+    Peak[Idx] = std::max(Peak[Idx], Live[Idx]);
+  }
+  void Free(const volatile void *Ptr) {
+    if (Live.empty() || !F->InFuzzingThread()) return;
+    int Idx = F->RunningCallback();
+    if (Idx >= 0)
+      Live[Idx] -= EF->__sanitizer_get_allocated_size(Ptr);
+  }
+  std::vector<int64_t> Live;
+  std::vector<int64_t> Peak;
+};
+
+static CallbackHeapTracer CallbackHeap;
+
 ATTRIBUTE_NO_SANITIZE_MEMORY
 void MallocHook(const volatile void *ptr, size_t size) {
-  size_t N = AllocTracer.Mallocs++;
   F->HandleMalloc(size);
+  CallbackHeap.Malloc(size);
+  if (!AllocTracer.Counts(ptr)) return;
+  size_t N = F->InFuzzingThread() ? AllocTracer.Mallocs++
+                                  : AllocTracer.ThreadMallocs++;
   if (int TraceLevel = AllocTracer.TraceLevel) {
     Printf("MALLOC[%zd] %p %zd\n", N, ptr, size);
     if (TraceLevel >= 2 && EF)
@@ -133,7 +186,10 @@ void MallocHook(const volatile void *ptr, size_t size) {
 
 ATTRIBUTE_NO_SANITIZE_MEMORY
 void FreeHook(const volatile void *ptr) {
-  size_t N = AllocTracer.Frees++;
+  CallbackHeap.Free(ptr);
+  if (!AllocTracer.Counts(ptr)) return;
+  size_t N = F->InFuzzingThread() ? AllocTracer.Frees++
+                                  : AllocTracer.ThreadFrees++;
   if (int TraceLevel = AllocTracer.TraceLevel) {
     Printf("FREE[%zd]   %p\n", N, ptr);
     if (TraceLevel >= 2 && EF)
@@ -157,36 +213,402 @@ void Fuzzer::HandleMalloc(size_t Size) {
 }
 
 Fuzzer::Fuzzer(UserCallback CB, InputCorpus &Corpus, MutationDispatcher &MD,
-               FuzzingOptions Options)
-    : CB(CB), Corpus(Corpus), MD(MD), Options(Options) {
+               FuzzingOptions Opts)
+    : CB(CB), Corpus(Corpus), MD(MD), Options(Opts) {
   if (EF->__sanitizer_set_death_callback)
     EF->__sanitizer_set_death_callback(StaticDeathCallback);
   assert(!F);
   F = this;
   TPC.ResetMaps();
-  if (Options.DifferentialMode) TPC.InitializeDiffCallbacks(EF);
+  if (Options.DifferentialMode && !Options.DiffRemote.empty())
+    StartRemoteWorkers();
+  if (Options.DifferentialMode)
+    TPC.InitializeDiffCallbacks(EF, Remote.IsRunning() ? &RemoteUC : nullptr);
+  if (Options.DifferentialMode && !Options.DiffOracle.empty()) {
+    if (!Oracle.Load(Options.DiffOracle, TPC.UC->size,
+                     Options.DiffVerdictBits))
+      exit(1);
+    Printf("INFO: -diff_oracle: %zd code(s) in %zd class(es)\n",
+           Oracle.NumCodes(), Oracle.NumClasses());
+    TPC.SetOutputOracle(&Oracle);
+  }
+  if (!TPC.SetValueProfileMaps(Options.ValueProfileMapBits,
+                               Options.DifferentialMode ? TPC.UC->size : 1)) {
+    Printf("ERROR: can't allocate the value profile map\n");
+    exit(1);
+  }
+  if (Remote.IsRunning() && (Options.DiffForkInputs || Options.DiffParallel)) {
+    Printf("WARNING: -diff_fork and -diff_parallel are ignored with "
+           "-diff_remote\n");
+    Options.DiffForkInputs = 0;
+    Options.DiffParallel = false;
+  }
+  if (Options.DiffCrashAsDiff && Options.DiffForkInputs <= 0) {
+    Printf("WARNING: -diff_crash_as_diff is ignored without -diff_fork\n");
+    Options.DiffCrashAsDiff = false;
+  }
+  if (Options.DifferentialMode && Options.DiffForkInputs > 0) {
+    if (Options.DiffParallel)
+      Printf("WARNING: -diff_fork overrides -diff_parallel\n");
+    if (!DiffForkServer.Start(
+            Options.DiffForkInputs,
+            ForkedResultsSize() + TPC.MaxExportedCoverageSize(),
+            [this](const uint8_t *Data, size_t Size, uint8_t *Out,
+                   size_t MaxOutSize) {
+              return RunCallbacksInForkedChild(Data, Size, Out, MaxOutSize,
+                                               DiffForkServer.InputArg());
+            }))
+      exit(1);
+  } else if (Options.DifferentialMode && Options.DiffParallel) {
+    DiffWorkers.Start(TPC.UC->callbacks, TPC.UC->size);
+  }
+  if (Options.DifferentialMode && Options.DiffThreads > 0) {
+    if (DiffWorkers.IsRunning() || DiffForkServer.IsRunning() ||
+        Remote.IsRunning()) {
+      Printf("WARNING: -diff_threads is ignored with -diff_parallel, "
+             "-diff_fork and -diff_remote\n");
+    } else {
+      // The value profile maps are shared by all threads.
+      if (Options.UseValueProfile) {
+        Printf("WARNING: -use_value_profile is ignored with -diff_threads\n");
+        Options.UseValueProfile = false;
+      }
+      if (Options.DiffBatchSize <= 0)
+        Options.DiffBatchSize = 4 * Options.DiffThreads;
+      DiffExecutors.Start(TPC.UC->callbacks, TPC.UC->size,
+                          Options.DiffThreads);
+      Printf("INFO: running the callbacks on %d executor threads, %d inputs "
+             "at a time\n", Options.DiffThreads, Options.DiffBatchSize);
+    }
+  }
+  if (Options.DifferentialMode && Options.StatsLogInterval > 0 &&
+      !Options.StatsLogPath.empty() &&
+      !DiffStatsLog.Start(Options.StatsLogPath))
+    exit(1);
+  if (!Options.PackedCorpus.empty() &&
+      !Packed.Open(Options.PackedCorpus))
+    exit(1);
+  if (Options.DifferentialMode && !Options.DiffPack.empty() &&
+      !DiffArtifacts.Open(Options.DiffPack))
+    exit(1);
+  if (Options.DifferentialMode && !Options.DiffEdgeStore.empty() &&
+      !EdgeSets.Open(Options.DiffEdgeStore))
+    exit(1);
+  if (Options.DifferentialMode && !Options.DiffCoverageReport.empty())
+    CoverageReport.Start(TPC.UC->size);
+  if (!Options.DirectedTargets.empty() &&
+      !Directed.Load(Options.DirectedTargets))
+    exit(1);
+  if (Options.RareEdges) {
+    if (Options.DifferentialMode)
+      Corpus.EnableFeatureHits();
+    else
+      Printf("WARNING: -rare_edges is ignored without -diff_mode=1\n");
+  }
+  Corpus.SetBudget(static_cast<size_t>(Max(Options.CorpusMaxUnits, 0)),
+                   static_cast<size_t>(Max(Options.CorpusMaxMb, 0)) << 20);
+  if (Options.CompressCorpus)
+    Corpus.EnableCompression();
+  Clusters.SetSimilarity(Options.DiffClusterSimilarity / 100.0);
+  TPC.SetEdgeBucketLimit(Options.DiffEdgeBucketsLimit);
+  TPC.SetDiffSignatureLimit(Options.DiffSignatureLimit);
+  if (!Options.TraceFile.empty() && !Trace.Start(Options.TraceFile))
+    exit(1);
+  if (Options.PerfCounters) {
+    if (!Trace.StartCounters())
+      exit(1);
+    if (DiffWorkers.IsRunning() || DiffExecutors.IsRunning() ||
+        DiffForkServer.IsRunning() || Remote.IsRunning())
+      Printf("WARNING: -perf_counters only counts the fuzzing thread, not "
+             "the callbacks that -diff_parallel, -diff_threads, -diff_fork "
+             "or -diff_remote run elsewhere\n");
+  }
+  if (!Options.DiffSharedName.empty() &&
+      !DiffShared.Open(Options.DiffSharedName.c_str())) {
+    Printf("ERROR: can't open shared memory region %s\n",
+           Options.DiffSharedName.c_str());
+    exit(1);
+  }
+  // Remote workers always take batches: the inputs of one are pipelined.
+  if (Remote.IsRunning() && Options.DiffBatchSize <= 0)
+    Options.DiffBatchSize = RemoteWorkers::kNumSlots;
+  if (Options.DifferentialMode && Options.DiffBatchSize > 0 &&
+      !Remote.IsRunning() && !DiffExecutors.IsRunning()) {
+    if (!TPC.UBC || !TPC.UBC->callbacks || TPC.UBC->size != TPC.UC->size) {
+      Printf("ERROR: -diff_batch requires LLVMFuzzerCustomBatchCallbacks() "
+             "with one batch callback per differential callback\n");
+      exit(1);
+    }
+    if (DiffWorkers.IsRunning() || DiffForkServer.IsRunning()) {
+      Printf("WARNING: -diff_batch is ignored with -diff_parallel and "
+             "-diff_fork\n");
+      Options.DiffBatchSize = 0;
+    }
+  }
+  if (Options.DifferentialMode && Options.DiffCoverageWindow > 1 &&
+      (DiffWorkers.IsRunning() || DiffForkServer.IsRunning() ||
+       Options.DiffBatchSize > 0 || Options.DiffFused > 0 ||
+       Options.DiffEdgeBuckets)) {
+    Printf("WARNING: -diff_coverage_window is ignored with -diff_parallel, "
+           "-diff_fork, -diff_batch, -diff_fused=1 and -diff_edge_buckets\n");
+    Options.DiffCoverageWindow = 0;
+  }
+  if (Options.DifferentialMode && !Options.DiffHwTrace.empty()) {
+    if (DiffWorkers.IsRunning() || DiffForkServer.IsRunning() ||
+        Remote.IsRunning() || Options.DiffBatchSize > 0 ||
+        Options.DiffFused > 0 || Options.DiffCoverageWindow > 1)
+      Printf("WARNING: -diff_hw_trace is ignored with -diff_parallel, "
+             "-diff_fork, -diff_remote, -diff_batch, -diff_fused=1 and "
+             "-diff_coverage_window\n");
+    else
+      StartHardwareTrace();
+  }
+  // By default (-diff_fused=-1) a target that defines LLVMFuzzerCustomRunAll
+  // runs fused unless an option needs its callbacks run one by one.
+  if (Options.DifferentialMode && Options.DiffFused) {
+    bool Requested = Options.DiffFused > 0;
+    Options.DiffFused = 0;
+    if (!EF->LLVMFuzzerCustomRunAll) {
+      if (Requested)
+        Printf("WARNING: -diff_fused requires LLVMFuzzerCustomRunAll(), "
+               "ignoring it\n");
+    } else if (DiffWorkers.IsRunning() || DiffForkServer.IsRunning() ||
+               Remote.IsRunning() || Options.DiffBatchSize > 0 ||
+               HwTrace.IsRunning()) {
+      if (Requested)
+        Printf("WARNING: -diff_fused is ignored with -diff_parallel, "
+               "-diff_fork, -diff_remote, -diff_batch and -diff_hw_trace\n");
+    } else if (Requested || (Options.DiffPruneInterval <= 0 &&
+                             Options.DiffCallbackTimeoutSec <= 0 &&
+                             Options.DiffEarlyExit <= 0 &&
+                             Options.DiffFastPath <= 0 &&
+                             Options.DiffReference < 0 &&
+                             Options.DiffCoverageWindow <= 1)) {
+      Options.DiffFused = 1;
+      Printf("INFO: running the %d callbacks with LLVMFuzzerCustomRunAll()\n",
+             TPC.UC->size);
+    }
+  }
+  if (Options.DifferentialMode)
+    CallbackNewFeatures.assign(TPC.UC->size, 0);
+  if (Options.DifferentialMode && Options.DiffReference >= 0) {
+    if (DiffWorkers.IsRunning() || DiffForkServer.IsRunning() ||
+        Remote.IsRunning() || Options.DiffBatchSize > 0 ||
+        Options.DiffFused || Options.DiffCoverageWindow > 1) {
+      Printf("WARNING: -diff_reference is ignored with -diff_parallel, "
+             "-diff_fork, -diff_remote, -diff_batch, -diff_fused=1 and "
+             "-diff_coverage_window\n");
+      Options.DiffReference = -1;
+    } else if (Options.DiffReference >= TPC.UC->size ||
+               HwTrace.IsTraced(Options.DiffReference)) {
+      Printf("ERROR: -diff_reference: callback %d is not an instrumented "
+             "callback\n", Options.DiffReference);
+      exit(1);
+    } else {
+      ReferenceSampleOneIn = std::max(Options.DiffReferenceSample, 1);
+      Printf("INFO: -diff_reference: coverage from callback %d, the others "
+             "run one in %zd inputs without new coverage\n",
+             Options.DiffReference, ReferenceSampleOneIn);
+    }
+  }
+  if (Options.DifferentialMode && Options.DiffPruneInterval > 0) {
+    if (DiffWorkers.IsRunning() || DiffForkServer.IsRunning() ||
+        Options.DiffBatchSize > 0 || Options.DiffFused) {
+      Printf("WARNING: -diff_prune is ignored with -diff_parallel, "
+             "-diff_fork, -diff_batch and -diff_fused\n");
+      Options.DiffPruneInterval = 0;
+    } else {
+      CallbackSeconds.assign(TPC.UC->size, 0);
+      CallbackUniqueDiffs.assign(TPC.UC->size, 0);
+      CallbackDisabled.assign(TPC.UC->size, false);
+    }
+  }
+  if (Options.DifferentialMode && Options.DiffMemoryLimitMb) {
+    // The executors of -diff_threads allocate off the fuzzing thread, where
+    // the hooks can't tell which callback is running.
+    if (DiffWorkers.IsRunning() || DiffForkServer.IsRunning() ||
+        DiffExecutors.IsRunning() || Options.DiffBatchSize > 0 ||
+        Options.DiffFused) {
+      Printf("WARNING: -diff_memory_limit_mb is ignored with -diff_parallel, "
+             "-diff_fork, -diff_threads, -diff_batch and -diff_fused\n");
+      Options.DiffMemoryLimitMb = 0;
+    } else if (!EF->__sanitizer_install_malloc_and_free_hooks ||
+               !EF->__sanitizer_get_allocated_size) {
+      Printf("WARNING: -diff_memory_limit_mb needs the malloc hooks of a "
+             "sanitizer; ignored\n");
+      Options.DiffMemoryLimitMb = 0;
+    } else {
+      CallbackHeap.Live.assign(TPC.UC->size, 0);
+      CallbackHeap.Peak.assign(TPC.UC->size, 0);
+      CallbackMemoryResets.assign(TPC.UC->size, 0);
+    }
+  }
+  if (Options.DifferentialMode && Options.DiffEarlyExit > 0) {
+    if (DiffWorkers.IsRunning() || DiffForkServer.IsRunning() ||
+        Options.DiffBatchSize > 0 || Options.DiffFused) {
+      Printf("WARNING: -diff_early_exit is ignored with -diff_parallel, "
+             "-diff_fork, -diff_batch and -diff_fused\n");
+      Options.DiffEarlyExit = 0;
+    } else {
+      for (int i = 0; i < TPC.UC->size; i++)
+        CallbackOrder.push_back(i);
+    }
+  }
+  if (Options.DifferentialMode && Options.DiffFastPath > 0) {
+    if (EF->LLVMFuzzerCustomFastCallbacks)
+      FastUC = EF->LLVMFuzzerCustomFastCallbacks();
+    if (!FastUC || !FastUC->callbacks || FastUC->size != TPC.UC->size) {
+      Printf("WARNING: -diff_fast_path requires LLVMFuzzerCustomFastCallbacks() "
+             "with one fast callback per differential callback, ignoring it\n");
+      Options.DiffFastPath = 0;
+    } else if (DiffWorkers.IsRunning() || DiffForkServer.IsRunning() ||
+               Options.DiffBatchSize > 0 || Options.DiffFused ||
+               Options.DiffPruneInterval > 0 || Options.DiffEarlyExit > 0) {
+      Printf("WARNING: -diff_fast_path is ignored with -diff_parallel, "
+             "-diff_fork, -diff_batch, -diff_fused, -diff_prune and "
+             "-diff_early_exit\n");
+      Options.DiffFastPath = 0;
+    } else {
+      FastPathPatterns.SetMaxSize(kMaxFastPathPatterns);
+    }
+  }
+  if (Options.DifferentialMode) {
+    CallbackLatency.resize(TPC.UC->size);
+    CallbackNanos.assign(TPC.UC->size, 0);
+    CallbackLongestSeconds.assign(TPC.UC->size, 0);
+    CallbackLeakAttempts.assign(TPC.UC->size, 0);
+    CallbackLeakChecksOff.assign(TPC.UC->size, false);
+  }
+  if (Options.MetricsPort > 0)
+    Metrics.Start(Options.MetricsPort);
+  if (Options.DifferentialMode && !Options.DiffControl.empty() &&
+      Control.Start(Options.DiffControl))
+    Printf("INFO: reading commands from %s\n", Options.DiffControl.c_str());
+  if (!Options.SyncWith.empty() &&
+      !Sync.Start(Options.SyncWith, Options.SyncIntervalSec))
+    exit(1);
+  if (Options.WriteBatch > 1 && !Options.AsyncWrites)
+    Printf("WARNING: -write_batch is ignored without -async_writes=1\n");
+  if (Options.AsyncWrites &&
+      !FileWriter.Start(static_cast<size_t>(Options.AsyncWriteQueueMb) << 20,
+                        Options.ArtifactPack, Max(Options.WriteBatch, 1),
+                        std::chrono::milliseconds(Options.WriteBatchMs),
+                        Options.FsyncWrites))
+    exit(1);
+  for (DigestSet *S : {&hashMap, &CoverageHash}) {
+    if (Options.DedupBloomBits > 0)
+      S->SetApproximate(Min(Max(Options.DedupBloomBits, 6), 40));
+    if (Options.DedupMaxSize > 0)
+      S->SetMaxSize(Options.DedupMaxSize);
+  }
+  if (!Options.DifferentialMode)
+    Options.DiffRejectCache = 0;
+  if (Options.DiffRejectCache > 0) {
+    if (!EF->LLVMFuzzerCustomInputPrefix) {
+      Printf("WARNING: -diff_reject_cache requires "
+             "LLVMFuzzerCustomInputPrefix(), ignoring it\n");
+      Options.DiffRejectCache = 0;
+    } else {
+      RejectedPrefixes.SetMaxSize(kMaxRejectedPrefixes);
+    }
+  }
+  if (Options.DiffConfirm &&
+      (DiffForkServer.IsRunning() || !Options.DiffRemote.empty())) {
+    Printf("WARNING: -diff_confirm is ignored with -diff_fork and "
+           "-diff_remote\n");
+    Options.DiffConfirm = 0;
+  }
+  FlakyDiffs.SetMaxSize(kMaxFlakyDiffs);
+  if (Options.MutatePipeline > 0 &&
+      ((Options.DifferentialMode &&
+        (Options.DiffBatchSize > 0 || Options.DiffCoverageWindow > 1)) ||
+       Options.DiffCmpDict || Options.DiffInputToState)) {
+    Printf("WARNING: -mutate_pipeline is ignored with -diff_batch, "
+           "-diff_coverage_window, -diff_cmp_dict and -diff_input_to_state\n");
+    Options.MutatePipeline = 0;
+  }
+  LoadDiffCheckpoint();
   IsMyThread = true;
-  if (Options.DetectLeaks && EF->__sanitizer_install_malloc_and_free_hooks)
+  if (Options.MallocSample > 1 && Options.TraceMalloc) {
+    Printf("WARNING: -malloc_sample is ignored with -trace_malloc\n");
+    Options.MallocSample = 1;
+  }
+  if (Options.MallocSample > 1) {
+    uint64_t Buckets = 1;
+    while (Buckets < static_cast<uint64_t>(Options.MallocSample))
+      Buckets *= 2;
+    AllocTracer.SampleMask = Buckets - 1;
+  }
+  if ((Options.DetectLeaks || !CallbackHeap.Live.empty()) &&
+      EF->__sanitizer_install_malloc_and_free_hooks)
     EF->__sanitizer_install_malloc_and_free_hooks(MallocHook, FreeHook);
   TPC.SetUseCounters(Options.UseCounters);
   TPC.SetUseValueProfile(Options.UseValueProfile);
   TPC.SetPrintNewPCs(Options.PrintNewCovPcs);
+  TPC.SetCollectCoveredPCs(Options.DumpCoverage && Options.DifferentialMode);
+  TPC.SetDiffVerdictBits(Options.DiffVerdictBits);
 
   if (Options.Verbosity)
     TPC.PrintModuleInfo();
-  if (!Options.OutputCorpus.empty() && Options.ReloadIntervalSec)
+  if (!Options.OutputCorpus.empty() && Options.ReloadIntervalSec) {
     EpochOfLastReadOfOutputCorpus = GetEpoch(Options.OutputCorpus);
+    OutputCorpusWatcher.Start(Options.OutputCorpus);
+  }
   MaxInputLen = MaxMutationLen = Options.MaxLen;
   AllocateCurrentUnitData();
   CurrentUnitSize = 0;
   memset(BaseSha1, 0, sizeof(BaseSha1));
 }
 
-Fuzzer::~Fuzzer() { }
+Fuzzer::~Fuzzer() {
+  if (GuardedInput)
+    UnmapWithGuardPage(GuardedInput, GuardedInputCapacity);
+}
 
 void Fuzzer::AllocateCurrentUnitData() {
   if (CurrentUnitData || MaxInputLen == 0) return;
   CurrentUnitData = new uint8_t[MaxInputLen];
+  BaseUnitData = new uint8_t[MaxInputLen];
+}
+
+// Copies Data so that its last byte is followed by the guard page, which
+// catches reads past the end much like the heap copy in ExecuteCallback.
+// The mapping is reused and only grows when a larger input shows up.
+uint8_t *Fuzzer::CopyToGuardedInput(const uint8_t *Data, size_t Size) {
+  if (Size > GuardedInputCapacity) {
+    if (GuardedInput)
+      UnmapWithGuardPage(GuardedInput, GuardedInputCapacity);
+    size_t PageSize = GetPageSize();
+    GuardedInputCapacity =
+        (std::max(Size, MaxInputLen) + PageSize - 1) & ~(PageSize - 1);
+    GuardedInput = MapWithGuardPage(GuardedInputCapacity);
+    if (!GuardedInput) {
+      Printf("ERROR: failed to map %zd bytes for -diff_zero_copy\n",
+             GuardedInputCapacity);
+      exit(1);
+    }
+    if (Options.ProtectInput)
+      SetWriteFaultHandler(GuardedInput, GuardedInputCapacity,
+                           StaticCrashOnOverwrittenData);
+  }
+  uint8_t *Copy = GuardedInput + GuardedInputCapacity - Size;
+  memcpy(Copy, Data, Size);
+  return Copy;
+}
+
+// -protect_input=1: the input stays read-only while the callbacks run on it,
+// so a write to it faults right away instead of being found by comparing.
+void Fuzzer::ProtectGuardedInput(bool ReadOnly) {
+  if (!ProtectPages(GuardedInput, GuardedInputCapacity, ReadOnly)) {
+    Printf("ERROR: -protect_input: failed to change the protection of the "
+           "input\n");
+    exit(1);
+  }
+}
+
+void Fuzzer::StaticCrashOnOverwrittenData() {
+  assert(F);
+  F->CrashOnOverwrittenData();
 }
 
 void Fuzzer::StaticDeathCallback() {
@@ -196,66 +618,359 @@ void Fuzzer::StaticDeathCallback() {
 
 void Fuzzer::DumpCurrentUnit(const char *Prefix) {
   if (!CurrentUnitData) return;  // Happens when running individual inputs.
-  MD.PrintMutationSequence();
+  if (DiffParentSequence)
+    Printf("%s", DiffParentSequence->c_str());
+  else
+    MD.PrintMutationSequence();
   Printf("; base unit: %s\n", Sha1ToString(BaseSha1).c_str());
+  const uint8_t *Data = CurrentUnitData;
   size_t UnitSize = CurrentUnitSize;
+  // A -diff_threads executor reports the input it runs.
+  if (const Unit *U = DiffExecutorPool::ThreadInput()) {
+    Data = U->data();
+    UnitSize = U->size();
+  }
   if (UnitSize <= kMaxUnitSizeToPrint) {
-    PrintHexArray(CurrentUnitData, UnitSize, "\n");
-    PrintASCII(CurrentUnitData, UnitSize, "\n");
+    PrintHexArray(Data, UnitSize, "\n");
+    PrintASCII(Data, UnitSize, "\n");
   }
-  WriteUnitToFileWithPrefix({CurrentUnitData, CurrentUnitData + UnitSize},
-                            Prefix);
+  WriteUnitToFileWithPrefix({Data, Data + UnitSize}, Prefix);
 }
 
-void Fuzzer::DumpUnitIfDiff(const uint8_t *Data, size_t Size) {
-  bool has_zero = false;
-  bool has_nonzero = false;
-  std::stringstream SS;
-  for (size_t i = 0; i < TPC.OutputDiffVec.size(); ++i) {
-    if (TPC.OutputDiffVec[i] == 0)
-      has_zero = true;
-    else
-      has_nonzero = true;
-    SS << TPC.OutputDiffVec[i] << "_";
-  }
-
-  if ( has_zero && has_nonzero) {
-    int size = TPC.UC->size;
-    int seq=0; 
-    int index = 0;
-    int pt = 0;
-    uint8_t Mid[TPC.GetNumPCs()*8];
-    uint8_t Coverage[TPC.GetNumPCs()*8];
-    size_t CovSize=0;
-    uint_to_uint8(TPC.PCs(),Mid,TPC.GetNumPCs());
-    memset(Coverage,0,TPC.GetNumPCs()*8);
-    for(int j = 0; j < size; j++)
-    {
-	index = index + 8*TPC.ModuleNum[j];
-        pt = CovSize;
-	if(TPC.OutputDiffVec[j]!=0)
+// True if some callbacks accepted the last input and some rejected it.
+// Uses the verdicts computed by TPC.NewOutputDiff_change().
+bool Fuzzer::IsOutputDiff() const {
+  return TPC.NumOutputRejects() &&
+         TPC.NumOutputRejects() < static_cast<size_t>(TPC.UC->size);
+}
+
+// Fingerprint the guards covered by every disagreeing library in place,
+// reading only that library's slice of the covered bitmap.
+// With -diff_verdict_bits the output signatures of all libraries are
+// part of the fingerprint as well.
+// Guards are numbered from the start of their library rather than
+// identified by PC: PCs move with ASLR, and the fingerprint must be the
+// same in every process of a -jobs=N -diff_shared=1 run or a merge.
+Digest128 Fuzzer::DiffFingerprint() const {
+  int size = TPC.UC->size;
+  Hasher128 Fingerprint;
+  for(int j = 0; j < size; j++)
+  {
+	if (Options.DiffVerdictBits)
+		Fingerprint.Update(static_cast<uint32_t>(TPC.OutputDiffVec[j]));
+	if (TPC.OutputRejected(j))
 	{
-		memcpy(Coverage+pt,Mid+index,8*TPC.ModuleNum[j+1]);
-		CovSize += 8*TPC.ModuleNum[j+1];
+		Fingerprint.Update(j);
+		auto R = TPC.CallbackGuards(j);
+		TPC.ForEachCoveredGuard(R, [&](size_t Idx) {
+		  Fingerprint.Update(static_cast<uint64_t>(Idx - R.Begin));
+		});
 	}
+  }
+  return Fingerprint.Final();
+}
+
+// MinHash of the guards that DiffFingerprint() hashes, for -diff_cluster=1:
+// diffs whose rejecting libraries covered mostly the same code get similar
+// signatures even if their fingerprints differ.
+MinHash Fuzzer::DiffSignature() const {
+  MinHash Sig;
+  for (int j = 0; j < TPC.UC->size; j++) {
+    if (!TPC.OutputRejected(j)) continue;
+    auto R = TPC.CallbackGuards(j);
+    TPC.ForEachCoveredGuard(R, [&](size_t Idx) {
+      Sig.Add((static_cast<uint64_t>(j) << 32) | (Idx - R.Begin));
+    });
+  }
+  return Sig;
+}
+
+// Adds the diff in TPC.OutputDiffVec to its cluster, returns true if it
+// starts a new one.
+bool Fuzzer::IsNewDiffCluster() {
+  bool IsNew;
+  Clusters.Insert(DiffClassHash(), DiffSignature(), &IsNew);
+  return IsNew;
+}
+
+void Fuzzer::DumpUnitIfDiff(const uint8_t *Data, size_t Size) {
+  TraceScope<> Scope(Trace, TS_Dump);
+  if (IsOutputDiff()) {
+    std::stringstream SS;
+    for (size_t i = 0; i < TPC.OutputDiffVec.size(); ++i)
+      SS << TPC.OutputDiffVec[i] << "_";
+    Digest128 D = DiffFingerprint();
+    if (Options.DiffConfirm && !CoverageHash.Contains(D) &&
+        (FlakyDiffs.Contains(D) || !ConfirmDiff(Data, Size)))
+    {
+	FlakyDiffs.Insert(D);
+	NumberOfFlakyDiffs++;
     }
-    
-    
-    uint8_t Hash[kSHA1NumBytes];
-    ComputeSHA1(Coverage,CovSize,Hash);
-    std::string tmp = Sha1ToString(Hash);
-    if(CoverageHash.count(tmp)>0)
+    else if(!CoverageHash.Insert(D) ||
+       (DiffShared.IsActive() && !DiffShared.InsertDiffDigest(D.Lo)))
     {
 	Duplicate++;
     }
+    else if (Options.DiffCluster && !IsNewDiffCluster())
+    {
+	NumberOfClusteredDiffs++;
+    }
     else
     {
-	    CoverageHash[tmp] = true;
 	    UnitHadOutputDiff = true;
 	    NumberOfDiffUnitsAdded++;
-	    WriteUnitToFileWithPrefix({Data, Data + Size},
-		                      ("diff_" + SS.str()).c_str());
+	    if (Options.DiffPruneInterval)
+		    CreditDiffToCallbacks();
+	    ComputeSHA1(Data, Size, DiffUnitSha1);
+	    if (Sync.IsRunning())
+		    Sync.AddDiffFingerprint(D);
+	    if (DiffArtifacts.IsOpen())
+		    AppendDiffRecord(Data, Size, D);
+	    else
+		    QueueUnitToFileWithPrefix({Data, Data + Size},
+		                              ("diff_" + SS.str()).c_str(),
+		                              DiffUnitSha1);
+	    if (EdgeSets.IsOpen())
+		    AppendEdgeSets(D);
+    }
+  }
+}
+
+// The guards every callback covered, whether it accepted the input or not,
+// numbered as in DiffFingerprint().
+void Fuzzer::AppendEdgeSets(Digest128 D) {
+  EdgeSetRecord R;
+  R.ClassHash = DiffClassHash();
+  R.Fingerprint = D;
+  memcpy(R.Sha1, DiffUnitSha1, sizeof(R.Sha1));
+  R.Results = TPC.OutputDiffVec;
+  R.Edges.resize(TPC.UC->size);
+  for (int j = 0; j < TPC.UC->size; j++) {
+    auto G = TPC.CallbackGuards(j);
+    TPC.ForEachCoveredGuard(G, [&](size_t Idx) {
+      R.Edges[j].Add(static_cast<uint32_t>(Idx - G.Begin));
+    });
+  }
+  if (!EdgeSets.Append(R))
+    Printf("WARNING: can't append to the edge store %s\n",
+           Options.DiffEdgeStore.c_str());
+}
+
+// -diff_confirm=K: runs the callbacks whose verdict on Data differs from
+// that of most callbacks, or all running ones if no verdict has a majority,
+// K more times, and returns true if every run gives the verdict in
+// TPC.OutputDiffVec again. A library with state that leaks from one call
+// into the next, such as a static SSL_CTX or a session cache, makes diffs
+// that don't reproduce; those would otherwise be written and added to the
+// corpus. The reruns only add to the coverage of the run what the callbacks
+// cover again, and the results in TPC.OutputDiffVec stay as they were.
+bool Fuzzer::ConfirmDiff(const uint8_t *Data, size_t Size) {
+  std::map<int, size_t> NumWithVerdict;
+  for (int i = 0; i < TPC.UC->size; i++)
+    if (CallbackDisabled.empty() || !CallbackDisabled[i])
+      NumWithVerdict[DiffVerdict(TPC.OutputDiffVec[i])]++;
+  size_t Most = 0, NumMost = 0;
+  int Majority = 0;
+  for (auto &VN : NumWithVerdict) {
+    if (VN.second > Most) {
+      Most = VN.second;
+      Majority = VN.first;
+      NumMost = 0;
+    }
+    NumMost += VN.second == Most;
+  }
+  std::vector<int> Rerun;
+  for (int i = 0; i < TPC.UC->size; i++)
+    if ((CallbackDisabled.empty() || !CallbackDisabled[i]) &&
+        (NumMost > 1 || DiffVerdict(TPC.OutputDiffVec[i]) != Majority))
+      Rerun.push_back(i);
+  // Like those of -diff_cmp_dict, these runs are no part of what Data costs.
+  uint64_t NanosBefore = CallbackNanosSum;
+  bool MallocsBefore = HasMoreMallocsThanFrees;
+  bool Reproduced = true;
+  for (int k = 0; k < Options.DiffConfirm && Reproduced; k++)
+    for (int i : Rerun) {
+      CB = TPC.UC->callbacks[i];
+      TPC.SelectValueProfileMap(i);
+      RunningCallbackIdx = i;
+      int Ret = ExecuteCallback(Data, Size);
+      RunningCallbackIdx = -1;
+      if (Oracle.IsActive())
+        Ret = Oracle.Map(i, Ret);
+      NumberOfConfirmRuns++;
+      if (DiffVerdict(Ret) != DiffVerdict(TPC.OutputDiffVec[i])) {
+        Reproduced = false;
+        break;
+      }
     }
+  TPC.SelectValueProfileMap(0);
+  CallbackNanosSum = NanosBefore;
+  HasMoreMallocsThanFrees = MallocsBefore;
+  return Reproduced;
+}
+
+void Fuzzer::AppendDiffRecord(const uint8_t *Data, size_t Size, Digest128 D) {
+  DiffRecord R;
+  R.ClassHash = DiffClassHash();
+  R.Fingerprint = D;
+  R.Results = TPC.OutputDiffVec;
+  R.Input.assign(Data, Data + Size);
+  if (DiffParentData) {
+    R.Parent.assign(DiffParentData, DiffParentData + DiffParentSize);
+    R.MutationSequence =
+        DiffParentSequence ? *DiffParentSequence : MD.MutationSequenceString();
+  }
+  if (!DiffArtifacts.Append(R))
+    Printf("WARNING: can't append to the diff pack %s\n",
+           Options.DiffPack.c_str());
+}
+
+// The verdict pattern of the run in TPC.OutputDiffVec.
+uint64_t Fuzzer::DiffClassHash() const {
+  Hasher128 Pattern;
+  for (size_t i = 0; i < TPC.OutputDiffVec.size(); i++)
+    Pattern.Update(static_cast<uint32_t>(DiffVerdict(TPC.OutputDiffVec[i])));
+  return Pattern.Final().Lo;
+}
+
+// Files the diff unit Corpus[Idx] under the verdict pattern of the run in
+// TPC.OutputDiffVec, for -diff_energy.
+void Fuzzer::RecordDiffClass(size_t Idx) {
+  size_t NumClasses = Corpus.NumDiffClasses();
+  Corpus.SetDiffInfo(Idx, DiffClassHash(), TPC.OutputRejectMask());
+  if (Options.DiffStopAfterClasses && Corpus.NumDiffClasses() != NumClasses)
+    Printf("DIFF_CLASS: %zd execs: %zd ms: %zd\n", Corpus.NumDiffClasses(),
+           TotalNumberOfRuns,
+           static_cast<size_t>(duration_cast<milliseconds>(
+                                   system_clock::now() - ProcessStartTime)
+                                   .count()));
+}
+
+// A callback is needed for the diff in TPC.OutputDiffVec if the verdicts
+// of the other running callbacks all agree.
+void Fuzzer::CreditDiffToCallbacks() {
+  size_t NumRunning = 0, NumRejects = 0;
+  for (size_t i = 0; i < CallbackDisabled.size(); i++) {
+    if (CallbackDisabled[i]) continue;
+    NumRunning++;
+    NumRejects += TPC.OutputRejected(i);
+  }
+  for (size_t i = 0; i < CallbackDisabled.size(); i++) {
+    if (CallbackDisabled[i]) continue;
+    size_t OtherRejects = NumRejects - TPC.OutputRejected(i);
+    if (!OtherRejects || OtherRejects == NumRunning - 1)
+      CallbackUniqueDiffs[i]++;
+  }
+}
+
+// -diff_early_exit: the key of the result of callback First in AgreeingRuns.
+static uint64_t AgreementKey(int First, int Verdict) {
+  return (static_cast<uint64_t>(First) << 32) | static_cast<uint32_t>(Verdict);
+}
+
+// True if all callbacks agreed on the last -diff_early_exit inputs on which
+// First gave its current result, except on one in -diff_early_exit of them,
+// which still runs all callbacks to check the prediction.
+bool Fuzzer::PredictsAgreement(int First) {
+  auto It = AgreeingRuns.find(
+      AgreementKey(First, DiffVerdict(TPC.OutputDiffVec[First])));
+  if (It == AgreeingRuns.end() ||
+      It->second < static_cast<size_t>(Options.DiffEarlyExit))
+    return false;
+  return MD.GetRand()(Options.DiffEarlyExit) != 0;
+}
+
+// -diff_reference=R: runs callback R alone and returns true if the others
+// are to run Data as well, i.e. if R found new features on it or Data is
+// one of the inputs sampled for diffs.
+bool Fuzzer::RunReferenceCallback(const uint8_t *Data, size_t Size,
+                                  bool MayDeleteFile, InputInfo *II,
+                                  size_t *Features) {
+  int R = Options.DiffReference;
+  CB = TPC.UC->callbacks[R];
+  TPC.SelectValueProfileMap(R);
+  RunningCallbackIdx = R;
+  *Features = RunOneCallback(Data, Size, R, MayDeleteFile, II);
+  RunningCallbackIdx = -1;
+  TPC.SelectValueProfileMap(0);
+  auto Time = UnitStopTime - UnitStartTime;
+  if (!CallbackSeconds.empty())
+    CallbackSeconds[R] += duration<double>(Time).count();
+  RecordCallbackLatency(R, duration_cast<nanoseconds>(Time).count(), Data,
+                        Size);
+  ReferenceSampled = !*Features && !MD.GetRand()(ReferenceSampleOneIn);
+  return *Features || ReferenceSampled;
+}
+
+// After every kReferenceWindow sampled inputs, samples twice as often if
+// one of them was a new diff and half as often otherwise, between every
+// input and one in 16 * -diff_reference_sample.
+void Fuzzer::LearnReferenceSample() {
+  ReferenceSampled = false;
+  NumberOfReferenceSampledRuns++;
+  NumberOfReferenceSampledDiffs += UnitHadOutputDiff;
+  ReferenceWindowDiffs += UnitHadOutputDiff;
+  if (++ReferenceWindowRuns < kReferenceWindow) return;
+  size_t Max =
+      16 * static_cast<size_t>(std::max(Options.DiffReferenceSample, 1));
+  ReferenceSampleOneIn = ReferenceWindowDiffs
+                             ? std::max<size_t>(ReferenceSampleOneIn / 2, 1)
+                             : std::min(ReferenceSampleOneIn * 2, Max);
+  ReferenceWindowRuns = ReferenceWindowDiffs = 0;
+}
+
+// Counts an input on which all callbacks ran: one more in a row on which
+// they agreed after First's result, or none if they disagreed.
+void Fuzzer::LearnAgreement(int First) {
+  int Verdict = DiffVerdict(TPC.OutputDiffVec[First]);
+  bool Agreed = true;
+  for (int i = 0; i < TPC.UC->size; i++)
+    if ((CallbackDisabled.empty() || !CallbackDisabled[i]) &&
+        DiffVerdict(TPC.OutputDiffVec[i]) != Verdict)
+      Agreed = false;
+  size_t &Runs = AgreeingRuns[AgreementKey(First, Verdict)];
+  Runs = Agreed ? Runs + 1 : 0;
+}
+
+// Every kEarlyExitReorderRuns runs, puts the callbacks in the order of their
+// mean latency, so that the cheapest one decides whether to stop early.
+void Fuzzer::MaybeReorderCallbacks() {
+  if (++RunsSinceReorder < kEarlyExitReorderRuns)
+    return;
+  RunsSinceReorder = 0;
+  auto Mean = [&](int i) {
+    const LatencyHistogram &H = CallbackLatency[i];
+    return H.NumValues() ? static_cast<double>(H.SumNanos()) / H.NumValues()
+                         : 0.0;
+  };
+  std::stable_sort(CallbackOrder.begin(), CallbackOrder.end(),
+                   [&](int A, int B) { return Mean(A) < Mean(B); });
+}
+
+// Called after every serial run with -diff_prune=N. Every N runs, the
+// callback that has taken more than half of the execution time so far is
+// disabled if no diff needed it.
+void Fuzzer::MaybePruneCallbacks() {
+  if (++RunsSincePrune < static_cast<size_t>(Options.DiffPruneInterval))
+    return;
+  RunsSincePrune = 0;
+  size_t NumEnabled =
+      std::count(CallbackDisabled.begin(), CallbackDisabled.end(), false);
+  double Total = 0;
+  size_t Slowest = 0;
+  for (size_t i = 0; i < CallbackSeconds.size(); i++) {
+    if (CallbackDisabled[i]) continue;
+    Total += CallbackSeconds[i];
+    if (CallbackDisabled[Slowest] ||
+        CallbackSeconds[i] > CallbackSeconds[Slowest])
+      Slowest = i;
+  }
+  if (NumEnabled > 2 && CallbackSeconds[Slowest] * 2 > Total &&
+      !CallbackUniqueDiffs[Slowest]) {
+    CallbackDisabled[Slowest] = true;
+    Printf("INFO: -diff_prune: disabled callback %zd (%.0f%% of the "
+           "execution time, no unique diffs)\n",
+           Slowest, 100 * CallbackSeconds[Slowest] / Total);
   }
 }
 
@@ -275,6 +990,11 @@ void Fuzzer::StaticCrashSignalCallback() {
   F->CrashCallback();
 }
 
+void Fuzzer::StaticBatchInputDoneCallback(size_t Idx) {
+  assert(F);
+  F->BatchInputDoneCallback(Idx);
+}
+
 void Fuzzer::StaticInterruptCallback() {
   assert(F);
   F->InterruptCallback();
@@ -306,7 +1026,7 @@ void Fuzzer::InterruptCallback() {
 
 NO_SANITIZE_MEMORY
 void Fuzzer::AlarmCallback() {
-  assert(Options.UnitTimeoutSec > 0);
+  assert(Options.UnitTimeoutSec > 0 || Options.DiffCallbackTimeoutSec > 0);
   // In Windows Alarm callback is executed by a different thread.
 #if !LIBFUZZER_WINDOWS
   if (!InFuzzingThread()) return;
@@ -319,7 +1039,16 @@ void Fuzzer::AlarmCallback() {
     return;
   if (Options.Verbosity >= 2)
     Printf("AlarmCallback %zd\n", Seconds);
-  if (Seconds >= (size_t)Options.UnitTimeoutSec) {
+  // With serial callbacks UnitStartTime is the start of the running one.
+  if (Options.DiffCallbackTimeoutSec > 0 &&
+      Seconds >= (size_t)Options.DiffCallbackTimeoutSec &&
+      RunningCallbackIdx >= 0) {
+    Printf("ALARM: callback %d has run for %zd seconds on the last unit\n",
+           RunningCallbackIdx, Seconds);
+    AbandonCallback();  // Only returns if the callback cannot be abandoned.
+  }
+  if (Options.UnitTimeoutSec > 0 &&
+      Seconds >= (size_t)Options.UnitTimeoutSec) {
     Printf("ALARM: working on the last Unit for %zd seconds\n", Seconds);
     Printf("       and the timeout value is %d (use -timeout=N to change)\n",
            Options.UnitTimeoutSec);
@@ -379,11 +1108,50 @@ void Fuzzer::PrintStats(const char *Where, const char *End, size_t Units) {
   Printf("%s", End);
 }
 
+// In diff mode, the coverage of the last run says little: -dump_coverage
+// writes the PCs of all inputs that joined the corpus instead, one .sancov
+// file per module, through the writer thread if there is one.
+void Fuzzer::DumpModuleCoverage() {
+  std::vector<std::pair<std::string, Unit>> Files;
+  TPC.CollectModuleCoverage(&Files);
+  for (auto &F : Files) {
+    Printf("INFO: writing the coverage of %zd PCs to %s\n",
+           F.second.size() / 8 - 1, F.first.c_str());
+    if (!FileWriter.IsRunning() ||
+        !FileWriter.Write(F.second, F.first, /*ToPack=*/false))
+      WriteToFile(F.second, F.first);
+  }
+}
+
+void Fuzzer::WriteDiffCoverageReport() {
+  FILE *Out = fopen(Options.DiffCoverageReport.c_str(), "w");
+  if (!Out) {
+    Printf("ERROR: can't open %s for writing\n",
+           Options.DiffCoverageReport.c_str());
+    return;
+  }
+  CoverageReport.Print(TPC, Out);
+  fclose(Out);
+  Printf("INFO: wrote the coverage report to %s\n",
+         Options.DiffCoverageReport.c_str());
+}
+
 void Fuzzer::PrintFinalStats() {
+  if (InForkedChild) return;  // The parent has the real stats.
+  DiffStatsLog.Stop();
+  Trace.Stop();
+  TPC.FlushNewPCs();
+  if (Options.DumpCoverage && Options.DifferentialMode)
+    DumpModuleCoverage();
+  FileWriter.Stop();
+  if (Metrics.IsRunning())
+    Metrics.Publish(FormatMetrics());
   if (Options.PrintCoverage)
     TPC.PrintCoverage();
-  if (Options.DumpCoverage)
+  if (Options.DumpCoverage && !Options.DifferentialMode)
     TPC.DumpCoverage();
+  if (CoverageReport.IsActive())
+    WriteDiffCoverageReport();
   if (Options.PrintCorpusStats)
     Corpus.PrintStats();
   if (!Options.PrintFinalStats) return;
@@ -391,13 +1159,515 @@ void Fuzzer::PrintFinalStats() {
   Printf("stat::number_of_executed_units: %zd\n", TotalNumberOfRuns);
   Printf("stat::average_exec_per_sec:     %zd\n", ExecPerSec);
   Printf("stat::new_units_added:          %zd\n", NumberOfNewUnitsAdded);
-  if  (Options.DifferentialMode)
+  if (Corpus.NumEvicted())
+    Printf("stat::evicted_units:            %zd\n", Corpus.NumEvicted());
+  if (Corpus.NumPackedUnits()) {
+    Printf("stat::compressed_units:         %zd\n", Corpus.NumPackedUnits());
+    Printf("stat::compression_saved_bytes:  %zd\n",
+           Corpus.NumPackedBytesSaved());
+  }
+  if  (Options.DifferentialMode) {
     Printf("stat::number_of_diffs:          %zd\n", NumberOfDiffUnitsAdded);
+    Printf("stat::diff_classes:             %zd\n", Corpus.NumDiffClasses());
+    if (Options.DiffCluster)
+      Printf("stat::clustered_diffs:          %zd\n", NumberOfClusteredDiffs);
+    if (Options.DiffEdgeBuckets)
+      Printf("stat::edge_bucket_units:        %zd\n", NumberOfEdgeBucketUnits);
+    if (Options.DiffCallbackTimeoutSec > 0)
+      Printf("stat::callback_timeouts:        %zd\n", NumberOfCallbackTimeouts);
+    if (Options.DiffFastPath > 0) {
+      Printf("stat::fast_only_runs:           %zd\n", NumberOfFastOnlyRuns);
+      Printf("stat::fast_path_mismatches:     %zd\n",
+             NumberOfFastPathMismatches);
+    }
+    if (Options.DiffReference >= 0) {
+      Printf("stat::reference_only_runs:      %zd\n",
+             NumberOfReferenceOnlyRuns);
+      Printf("stat::reference_sampled_runs:   %zd\n",
+             NumberOfReferenceSampledRuns);
+      Printf("stat::reference_sampled_diffs:  %zd\n",
+             NumberOfReferenceSampledDiffs);
+      Printf("stat::reference_sample_one_in:  %zd\n", ReferenceSampleOneIn);
+    }
+    if (Options.DiffEarlyExit > 0) {
+      Printf("stat::early_exits:              %zd\n", NumberOfEarlyExits);
+      Printf("stat::saved_callback_runs:      %zd\n", NumberOfSavedCallbacks);
+    }
+    if (Options.DiffRejectCache > 0) {
+      Printf("stat::reject_cache_prefixes:    %zd\n", RejectedPrefixes.size());
+      Printf("stat::reject_cache_hits:        %zd\n", NumberOfRejectCacheHits);
+      Printf("stat::reject_cache_skips:       %zd\n", NumberOfRejectCacheSkips);
+      Printf("stat::reject_cache_skip_ratio:  %.3f\n",
+             NumberOfRejectCacheSkips
+                 ? static_cast<double>(NumberOfRejectCacheSkips) /
+                       (NumberOfRejectCacheSkips + TotalNumberOfRuns)
+                 : 0.0);
+    }
+  }
+  if (FileWriter.NumDropped())
+    Printf("stat::dropped_writes:           %zd\n", FileWriter.NumDropped());
+  if (Options.WriteBatch > 1 && FileWriter.NumBatches())
+    Printf("stat::write_batches:            %zd\n", FileWriter.NumBatches());
+  if (DiffStatsLog.NumDropped())
+    Printf("stat::stats_log_dropped:        %zd\n", DiffStatsLog.NumDropped());
+  if (Options.DiffCmpDict)
+    Printf("stat::diff_cmp_words:           %zd\n", NumberOfMinedCmpWords);
+  if (Options.AdaptiveDepth && NumberOfMutatedUnits)
+    Printf("stat::mean_mutate_depth:        %.1f\n",
+           static_cast<double>(NumberOfMutations) / NumberOfMutatedUnits);
+  if (Options.CostAware)
+    Printf("stat::median_exec_us:           %zd\n",
+           static_cast<size_t>(Corpus.MedianExecTime() / 1000));
+  if (Options.DiffCoverageWindow > 1) {
+    Printf("stat::coverage_windows:         %zd\n", NumberOfCoverageWindows);
+    Printf("stat::window_reruns:            %zd\n", NumberOfWindowReruns);
+  }
+  if (Control.IsActive())
+    Printf("stat::callback_reloads:         %zd\n", NumberOfReloads);
+  if (HwTrace.IsRunning()) {
+    Printf("stat::hw_trace_bytes:           %zd\n", HwTrace.NumTraceBytes());
+    Printf("stat::hw_trace_lost:            %zd\n", HwTrace.NumLostTraces());
+  }
+  if (Trace.CountsStages())
+    Trace.PrintCounterStats();
+  if (Oracle.IsActive())
+    Printf("stat::oracle_agreements:        %zd\n",
+           TPC.NumOracleAgreements());
+  if (Options.DiffConfirm) {
+    Printf("stat::flaky_diffs:              %zd\n", NumberOfFlakyDiffs);
+    Printf("stat::diff_confirm_runs:        %zd\n", NumberOfConfirmRuns);
+  }
+  if (Options.DiffInputToState) {
+    Printf("stat::input_to_state_units:     %zd\n", NumberOfInputToStateUnits);
+    Printf("stat::input_to_state_runs:      %zd\n", NumberOfInputToStateRuns);
+    Printf("stat::input_to_state_new_units: %zd\n",
+           NumberOfInputToStateNewUnits);
+  }
+  if (!Options.SyncWith.empty()) {
+    Printf("stat::synced_units:             %zd\n", NumberOfSyncedUnits);
+    Printf("stat::synced_diffs:             %zd\n", NumberOfSyncedDiffs);
+  }
+  if (Options.MutatePipeline > 0)
+    Printf("stat::pipeline_stalls:          %zd\n", Pipeline.NumStalls());
+  // With -mutate_pipeline the producer's dispatcher did the mutating.
+  MutationDispatcher &Mutator = Pipeline.GetMD() ? *Pipeline.GetMD() : MD;
+  if (Mutator.IsHybrid())
+    Printf("stat::custom_mutator_odds:      %.3f\n",
+           Mutator.CustomMutatorOdds());
+  if (Options.MutatorStats)
+    Mutator.PrintMutatorStats();
+  if (DiffForkServer.IsRunning())
+    Printf("stat::forked_child_failures:    %zd\n",
+           NumberOfForkedChildFailures);
+  if (Options.DiffCrashAsDiff)
+    Printf("stat::callback_crashes:         %zd\n", NumberOfCallbackCrashes);
   Printf("stat::slowest_unit_time_sec:    %zd\n", TimeOfLongestUnitInSeconds);
   Printf("stat::peak_rss_mb:              %zd\n", GetPeakRSSMb());
-  Printf("stat::number_of_duplicates:	%zd\n", NumberOfDuplicate);
+  Printf("stat::number_of_duplicates:	%zd\n",
+         NumberOfDuplicate + Pipeline.NumDuplicates());
   Printf("stat::coverage:	%zd\n", TPC.GetTotalPCCoverage());
   Printf("stat::Duplicate:	%zd\n", Duplicate);
+  if (Options.DifferentialMode)
+    PrintCallbackStats();
+  if (EF->LLVMFuzzerCustomMutatorPrintStats)
+    EF->LLVMFuzzerCustomMutatorPrintStats();
+}
+
+// -diff_cmp_dict=1: runs every callback once more on the new diff Data,
+// recording the operands of its comparisons, and promotes the operands that
+// only some of the implementations compared. Operands whose bytes occur in
+// Data, in either byte order, are taken to come from the input rather than
+// from a constant; both byte orders of the others are promoted, since the
+// inputs of TLS libraries are big-endian.
+void Fuzzer::MineDiffCmpArgs(const uint8_t *Data, size_t Size) {
+  size_t N = TPC.UC->size;
+  std::map<Word, size_t> NumImpls;
+  std::vector<Word> Args;
+  // These runs are no part of what Data costs for -cost_aware.
+  uint64_t NanosBefore = CallbackNanosSum;
+  for (size_t i = 0; i < N; i++) {
+    Args.clear();
+    CB = TPC.UC->callbacks[i];
+    TPC.SelectValueProfileMap(i);
+    TPC.SetCmpArgsOut(&Args);
+    ExecuteCallback(Data, Size);
+    TPC.SetCmpArgsOut(nullptr);
+    std::sort(Args.begin(), Args.end());
+    Args.erase(std::unique(Args.begin(), Args.end()), Args.end());
+    for (const Word &W : Args)
+      NumImpls[W]++;
+  }
+  CallbackNanosSum = NanosBefore;
+  TPC.SelectValueProfileMap(0);
+  size_t NumPromoted = 0;
+  for (auto &WN : NumImpls) {
+    if (WN.second == N) continue;
+    const Word &W = WN.first;
+    uint8_t Swapped[Word::kMaxSize];
+    std::reverse_copy(W.data(), W.data() + W.size(), Swapped);
+    if (std::all_of(W.data(), W.data() + W.size(),
+                    [](uint8_t B) { return B == 0; }) ||
+        SearchMemory(Data, Size, W.data(), W.size()) ||
+        SearchMemory(Data, Size, Swapped, W.size()))
+      continue;
+    MD.AddPriorityWordToPersistentAutoDictionary(W);
+    MD.AddPriorityWordToPersistentAutoDictionary(Word(Swapped, W.size()));
+    if (++NumPromoted == kMaxMinedCmpWordsPerDiff) break;
+  }
+  NumberOfMinedCmpWords += NumPromoted;
+}
+
+// -diff_input_to_state=1: the input-to-state stage of Redqueen, without its
+// colorization. Every callback runs once more on Data, recording the
+// operands of its comparisons. Where an operand of at least two bytes occurs
+// in Data, in either byte order for the integer sizes, the bytes likely
+// flowed from the input into the comparison unchanged, so Data with the
+// other operand written there, in the same order, is likely to take the
+// other side of it. Those candidates, deduplicated and at most
+// kMaxInputToStateCandidates of them, run through RunOne() like mutants of
+// II; a magic value a TLS parser compares the input against then takes one
+// run rather than a lucky mutation.
+void Fuzzer::RunInputToState(InputInfo *II, const uint8_t *Data, size_t Size) {
+  II->InputToStateDone = true;
+  NumberOfInputToStateUnits++;
+  std::vector<Word> Args;
+  std::set<std::pair<size_t, Word>> Substitutions;
+  for (int i = 0; i < TPC.UC->size; i++) {
+    Args.clear();
+    CB = TPC.UC->callbacks[i];
+    TPC.SelectValueProfileMap(i);
+    TPC.SetCmpArgsOut(&Args);
+    ExecuteCallback(Data, Size);
+    TPC.SetCmpArgsOut(nullptr);
+    // The operands of one comparison come in pairs.
+    for (size_t k = 0; k + 1 < Args.size(); k += 2)
+      for (int Dir = 0; Dir < 2; Dir++) {
+        const Word &From = Args[k + Dir], &To = Args[k + 1 - Dir];
+        size_t W = From.size();
+        if (W < 2) continue;
+        uint8_t SwappedFrom[Word::kMaxSize], SwappedTo[Word::kMaxSize];
+        std::reverse_copy(From.data(), From.data() + W, SwappedFrom);
+        std::reverse_copy(To.data(), To.data() + W, SwappedTo);
+        bool IsInteger = W == 2 || W == 4 || W == 8;
+        for (int Swap = 0; Swap < 1 + IsInteger; Swap++) {
+          const uint8_t *Pattern = Swap ? SwappedFrom : From.data();
+          Word Replacement(Swap ? SwappedTo : To.data(), W);
+          for (size_t Off = 0; Off + W <= Size; Off++) {
+            const uint8_t *P = static_cast<const uint8_t *>(
+                SearchMemory(Data + Off, Size - Off, Pattern, W));
+            if (!P) break;
+            Off = P - Data;
+            if (Substitutions.size() < kMaxInputToStateCandidates)
+              Substitutions.insert({Off, Replacement});
+          }
+        }
+      }
+  }
+  TPC.SelectValueProfileMap(0);
+
+  // The candidates are no mutants of Data; their -diff_pack records and
+  // status lines say where they came from instead.
+  static const std::string kInputToStateSequence = "InputToState-";
+  DiffParentSequence = &kInputToStateSequence;
+  Unit Candidate(Data, Data + Size);
+  for (auto &S : Substitutions) {
+    if (TotalNumberOfRuns >= Options.MaxNumberOfRuns) break;
+    const Word &W = S.second;
+    memcpy(Candidate.data() + S.first, W.data(), W.size());
+    NumberOfInputToStateRuns++;
+    if (RunOne(Candidate.data(), Size, /*MayDeleteFile=*/true, II)) {
+      NumberOfInputToStateNewUnits++;
+      ReportNewMutant(II, Candidate);
+    }
+    memcpy(Candidate.data() + S.first, Data + S.first, W.size());
+  }
+  DiffParentSequence = nullptr;
+}
+
+void Fuzzer::MaybePublishMetrics() {
+  if (!Metrics.IsRunning()) return;
+  auto Now = steady_clock::now();
+  if (Now - LastMetricsPublish < seconds(1)) return;
+  LastMetricsPublish = Now;
+  Metrics.Publish(FormatMetrics());
+}
+
+// -diff_control: runs the commands that arrived in the last second.
+void Fuzzer::MaybeRunControlCommands() {
+  if (!Control.IsActive()) return;
+  auto Now = steady_clock::now();
+  if (Now - LastControlPoll < seconds(1)) return;
+  LastControlPoll = Now;
+  std::vector<std::string> Commands;
+  if (!Control.Poll(&Commands)) return;
+  for (auto &C : Commands) {
+    std::istringstream ISS(C);
+    std::string Verb;
+    int Idx = -1;
+    if (!(ISS >> Verb)) continue;
+    if (Verb == "reload" && ISS >> Idx)
+      ReloadCallback(Idx);
+    else
+      Printf("WARNING: -diff_control: unknown command '%s'\n", C.c_str());
+  }
+}
+
+// Has the target load the library of callback Idx again, e.g. once it has
+// been patched, and moves the callback to the guards of the new build. The
+// diffs found so far may no longer be diffs, or be other ones: one unit of
+// every diff class runs again, which also files it under its new class.
+void Fuzzer::ReloadCallback(int Idx) {
+  if (!EF->LLVMFuzzerCustomReload) {
+    Printf("WARNING: -diff_control: reloading needs "
+           "LLVMFuzzerCustomReload()\n");
+    return;
+  }
+  if (Idx < 0 || Idx >= TPC.UC->size) {
+    Printf("WARNING: -diff_control: no callback %d\n", Idx);
+    return;
+  }
+  // The -diff_threads executors run the callbacks on coverage tables sized
+  // at start, which the guards of the new build may not fit.
+  if (DiffForkServer.IsRunning() || Remote.IsRunning() ||
+      DiffExecutors.IsRunning() || HwTrace.IsTraced(Idx)) {
+    Printf("WARNING: -diff_control: can't reload callback %d with "
+           "-diff_fork, -diff_remote, -diff_threads or -diff_hw_trace\n",
+           Idx);
+    return;
+  }
+  auto Start = steady_clock::now();
+  TPC.ForgetCallbackModules(Idx);
+  size_t FirstModule = TPC.NumModulesLoaded();
+  if (EF->LLVMFuzzerCustomReload(Idx)) {
+    Printf("ERROR: -diff_control: callback %d could not be reloaded\n", Idx);
+    exit(1);
+  }
+  TPC.MoveCallbackGuards(Idx, FirstModule);
+  NumberOfReloads++;
+  size_t NumClasses = Corpus.NumDiffClasses(), NumChanged = 0, NumFixed = 0;
+  for (size_t C = 0; C < NumClasses; C++) {
+    size_t Rep = Corpus.DiffClassRepresentative(C);
+    if (Rep == Corpus.size()) continue;
+    // Running it may grow the corpus, so it runs from a copy.
+    UnitRef R = Corpus[Rep];
+    Unit U(R.begin(), R.end());
+    RunOne(U.data(), U.size());
+    if (DiffClassHash() == Corpus.DiffClassPattern(C)) continue;
+    NumChanged++;
+    NumFixed += !IsOutputDiff();
+  }
+  auto GuardsOf = TPC.CallbackGuards(Idx);
+  Printf("INFO: reloaded callback %d (%zd guards) in %.3f s: %zd of %zd diff "
+         "classes changed, %zd of them are no diffs anymore\n",
+         Idx, GuardsOf.End - GuardsOf.Begin,
+         duration<double>(steady_clock::now() - Start).count(), NumChanged,
+         NumClasses, NumFixed);
+}
+
+// The reload frees what the old library held outside of any callback, so
+// the new one starts from nothing. Without a reload the callback is
+// disabled, unless that would leave fewer than two to compare, which is an
+// out-of-memory like that of -rss_limit_mb.
+void Fuzzer::MaybeEnforceCallbackMemoryLimits() {
+  if (Options.DiffMemoryLimitMb <= 0) return;
+  int64_t Limit = static_cast<int64_t>(Options.DiffMemoryLimitMb) << 20;
+  for (int i = 0; i < TPC.UC->size; i++) {
+    if (CallbackHeap.Live[i] <= Limit ||
+        (!CallbackDisabled.empty() && CallbackDisabled[i]))
+      continue;
+    Printf("INFO: -diff_memory_limit_mb: callback %d holds %zd Mb of heap\n",
+           i, static_cast<size_t>(CallbackHeap.Live[i] >> 20));
+    CallbackMemoryResets[i]++;
+    if (EF->LLVMFuzzerCustomReload && !Remote.IsRunning() &&
+        !HwTrace.IsTraced(i)) {
+      CallbackHeap.Live[i] = 0;
+      ReloadCallback(i);
+      continue;
+    }
+    if (CallbackDisabled.empty())
+      CallbackDisabled.assign(TPC.UC->size, false);
+    if (std::count(CallbackDisabled.begin(), CallbackDisabled.end(), false) >
+        2) {
+      CallbackDisabled[i] = true;
+      Printf("INFO: -diff_memory_limit_mb: disabled callback %d\n", i);
+      continue;
+    }
+    Printf("==%d== ERROR: libFuzzer: out-of-memory (callback %d used more "
+           "than %d Mb of heap)\n",
+           GetPid(), i, Options.DiffMemoryLimitMb);
+    Printf("   To change the out-of-memory limit use "
+           "-diff_memory_limit_mb=<N>\n\n");
+    DumpCurrentUnit("oom-");
+    Printf("SUMMARY: libFuzzer: out-of-memory\n");
+    PrintFinalStats();
+    _Exit(Options.ErrorExitCode);
+  }
+}
+
+// The -metrics_port page, in the Prometheus text exposition format.
+std::string Fuzzer::FormatMetrics() {
+  std::string Page;
+  char Line[256];
+  auto Add = [&](const char *Name, const char *Type, const char *Help,
+                 double Value) {
+    snprintf(Line, sizeof(Line), "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n",
+             Name, Help, Name, Type, Name, Value);
+    Page += Line;
+  };
+  auto Ratio = [](double A, double B) { return B ? A / B : 0; };
+  double Uptime =
+      duration<double>(system_clock::now() - ProcessStartTime).count();
+  Add("libfuzzer_uptime_seconds", "gauge", "Seconds since the start.", Uptime);
+  Add("libfuzzer_runs_total", "counter", "Executed inputs.",
+      TotalNumberOfRuns);
+  Add("libfuzzer_execs_per_second", "gauge", "Average executions per second.",
+      Ratio(TotalNumberOfRuns, Uptime));
+  Add("libfuzzer_corpus_units", "gauge", "Units in the corpus.", Corpus.size());
+  Add("libfuzzer_coverage_pcs", "gauge", "Covered PCs.",
+      TPC.GetTotalPCCoverage());
+  Add("libfuzzer_new_units_total", "counter", "Units added for coverage.",
+      NumberOfNewUnitsAdded);
+  Add("libfuzzer_duplicate_mutants_total", "counter",
+      "Mutants that were generated before.", NumberOfDuplicate);
+  Add("libfuzzer_duplicate_mutant_ratio", "gauge",
+      "Share of the runs spent on duplicate mutants.",
+      Ratio(NumberOfDuplicate, TotalNumberOfRuns));
+  Add("libfuzzer_mutate_seconds_total", "counter", "Time spent mutating.",
+      MutateSeconds);
+  Add("libfuzzer_execute_seconds_total", "counter",
+      "Time spent executing mutants.", ExecuteSeconds);
+  Add("libfuzzer_peak_rss_megabytes", "gauge", "Peak RSS.", GetPeakRSSMb());
+  if (Trace.CountsStages())
+    Trace.FormatCounterMetrics(&Page);
+  if (!Options.DifferentialMode) return Page;
+  Add("libfuzzer_diff_units_total", "counter", "Diffs with new fingerprints.",
+      NumberOfDiffUnitsAdded);
+  Add("libfuzzer_diff_duplicates_total", "counter",
+      "Diffs whose fingerprint was seen before.", Duplicate);
+  Add("libfuzzer_diff_duplicate_ratio", "gauge",
+      "Share of the diffs whose fingerprint was seen before.",
+      Ratio(Duplicate, Duplicate + NumberOfDiffUnitsAdded));
+  Add("libfuzzer_diff_classes", "gauge", "Distinct verdict patterns of diffs.",
+      Corpus.NumDiffClasses());
+  Add("libfuzzer_diff_valid_cases_total", "counter",
+      "Runs with a new trace signature.", NumberofValidCases);
+  if (DiffForkServer.IsRunning())
+    Add("libfuzzer_forked_child_failures_total", "counter",
+        "Forked children that died.", NumberOfForkedChildFailures);
+  Page += "# HELP libfuzzer_callback_latency_seconds Latency of each "
+          "callback.\n"
+          "# TYPE libfuzzer_callback_latency_seconds summary\n";
+  for (size_t i = 0; i < CallbackLatency.size(); i++) {
+    const LatencyHistogram &H = CallbackLatency[i];
+    for (double Q : {0.5, 0.9, 0.99}) {
+      snprintf(Line, sizeof(Line),
+               "libfuzzer_callback_latency_seconds{callback=\"%zd\","
+               "quantile=\"%g\"} %.9f\n",
+               i, Q, H.Quantile(Q) * 1e-9);
+      Page += Line;
+    }
+    snprintf(Line, sizeof(Line),
+             "libfuzzer_callback_latency_seconds_sum{callback=\"%zd\"} %.9f\n"
+             "libfuzzer_callback_latency_seconds_count{callback=\"%zd\"} "
+             "%" PRIu64 "\n",
+             i, H.SumNanos() * 1e-9, i, H.NumValues());
+    Page += Line;
+  }
+  Page += "# HELP libfuzzer_callback_execs_per_second Executions per second "
+          "of callback time.\n"
+          "# TYPE libfuzzer_callback_execs_per_second gauge\n";
+  for (size_t i = 0; i < CallbackLatency.size(); i++) {
+    const LatencyHistogram &H = CallbackLatency[i];
+    snprintf(Line, sizeof(Line),
+             "libfuzzer_callback_execs_per_second{callback=\"%zd\"} %.17g\n",
+             i, Ratio(H.NumValues(), H.SumNanos() * 1e-9));
+    Page += Line;
+  }
+  if (!CallbackHeap.Live.empty()) {
+    Page += "# HELP libfuzzer_callback_heap_bytes Heap held by each "
+            "callback.\n"
+            "# TYPE libfuzzer_callback_heap_bytes gauge\n";
+    for (size_t i = 0; i < CallbackHeap.Live.size(); i++) {
+      snprintf(Line, sizeof(Line),
+               "libfuzzer_callback_heap_bytes{callback=\"%zd\"} %" PRId64
+               "\n",
+               i, CallbackHeap.Live[i]);
+      Page += Line;
+    }
+  }
+  if (!MD.TracksMutants())
+    return Page;
+  typedef MutationDispatcher::MutatorStats MS;
+  struct {
+    const char *Name, *Type, *Help;
+    std::function<double(const MS &, size_t)> Value;
+  } MutatorMetrics[] = {
+      {"libfuzzer_mutator_uses_total", "counter", "Calls of each mutator.",
+       [](const MS &S, size_t) { return S.Uses; }},
+      {"libfuzzer_mutator_seconds_total", "counter",
+       "Time spent in each mutator and running its mutants.",
+       [](const MS &S, size_t) { return S.Seconds; }},
+      {"libfuzzer_mutator_new_features_total", "counter",
+       "New features of the mutants of each mutator.",
+       [](const MS &S, size_t) { return S.NewFeatures; }},
+      {"libfuzzer_mutator_new_diff_classes_total", "counter",
+       "New diff classes of the mutants of each mutator.",
+       [](const MS &S, size_t) { return S.NewDiffClasses; }},
+      {"libfuzzer_mutator_duplicates_total", "counter",
+       "Duplicate mutants of each mutator.",
+       [](const MS &S, size_t) { return S.Duplicates; }},
+      {"libfuzzer_mutator_weight", "gauge",
+       "Odds of each mutator among the mutators of its group.",
+       [&](const MS &, size_t i) { return MD.MutatorWeight(i); }},
+  };
+  auto &Stats = MD.GetMutatorStats();
+  for (auto &M : MutatorMetrics) {
+    snprintf(Line, sizeof(Line), "# HELP %s %s\n# TYPE %s %s\n", M.Name,
+             M.Help, M.Name, M.Type);
+    Page += Line;
+    for (size_t i = 0; i < Stats.size(); i++) {
+      snprintf(Line, sizeof(Line), "%s{mutator=\"%s\"} %.17g\n", M.Name,
+               Stats[i].Name, M.Value(Stats[i], i));
+      Page += Line;
+    }
+  }
+  return Page;
+}
+
+// Called for every execution of a differential callback, in every mode.
+// With -report_slow_units, also saves the slowest inputs of each callback.
+void Fuzzer::RecordCallbackLatency(size_t Idx, uint64_t Nanos,
+                                   const uint8_t *Data, size_t Size) {
+  CallbackLatency[Idx].Record(Nanos);
+  double Seconds = Nanos * 1e-9;
+  if (Seconds > CallbackLongestSeconds[Idx] * 1.1 &&
+      Seconds >= Options.ReportSlowUnits) {
+    CallbackLongestSeconds[Idx] = Seconds;
+    Printf("Slowest unit of callback %zd: %.3f s:\n", Idx, Seconds);
+    QueueUnitToFileWithPrefix(
+        {Data, Data + Size},
+        ("slow-unit-callback" + std::to_string(Idx) + "-").c_str());
+  }
+}
+
+void Fuzzer::PrintCallbackStats() {
+  for (size_t i = 0; i < CallbackLatency.size(); i++) {
+    const LatencyHistogram &H = CallbackLatency[i];
+    Printf("stat::callback_%zd_latency_us: p50 %.1f p90 %.1f p99 %.1f "
+           "max %.1f\n",
+           i, H.Quantile(0.5) / 1e3, H.Quantile(0.9) / 1e3,
+           H.Quantile(0.99) / 1e3, H.MaxNanos() / 1e3);
+  }
+  for (size_t i = 0; i < CallbackNewFeatures.size(); i++)
+    Printf("stat::callback_%zd_features: %zd\n", i, CallbackNewFeatures[i]);
+  for (size_t i = 0; i < CallbackHeap.Live.size(); i++)
+    Printf("stat::callback_%zd_heap_mb: %.1f, peak %.1f, %zd resets\n", i,
+           CallbackHeap.Live[i] / 1048576.0, CallbackHeap.Peak[i] / 1048576.0,
+           CallbackMemoryResets[i]);
+  for (size_t i = 0; i < CallbackUniqueDiffs.size(); i++)
+    Printf("stat::callback_%zd: %.3f s, %zd unique diffs%s\n", i,
+           CallbackSeconds[i], CallbackUniqueDiffs[i],
+           CallbackDisabled[i] ? " (disabled)" : "");
 }
 
 void Fuzzer::SetMaxInputLen(size_t MaxInputLen) {
@@ -441,11 +1711,36 @@ void Fuzzer::CheckExitOnSrcPosOrItem() {
 }
 
 void Fuzzer::RereadOutputCorpus(size_t MaxSize) {
+  RunSyncedUnits(MaxSize);
+  if (Packed.IsOpen() && Options.ReloadIntervalSec) {
+    size_t Begin = NumPackedUnitsRun;
+    if (Packed.Refresh() > Begin) {
+      RunPackedUnits(Begin, /*Shuffle=*/false);
+      PrintStats("RELOAD");
+    }
+    return;
+  }
   if (Options.OutputCorpus.empty() || !Options.ReloadIntervalSec) return;
   std::vector<Unit> AdditionalCorpus;
-  ReadDirToVectorOfUnits(Options.OutputCorpus.c_str(), &AdditionalCorpus,
-                         &EpochOfLastReadOfOutputCorpus, MaxSize,
-                         /*ExitOnError*/ false);
+  std::vector<std::string> Names;
+  // Taken before polling, so that a later rescan, should the watcher lose
+  // events, still reads whatever was written during this reload.
+  long EpochBeforePoll = GetEpoch(Options.OutputCorpus);
+  if (OutputCorpusWatcher.IsActive() && OutputCorpusWatcher.Poll(&Names)) {
+    EpochOfLastReadOfOutputCorpus = EpochBeforePoll;
+    for (auto &Name : Names) {
+      if (Corpus.HasUnit(Name))
+        continue;  // Written by this process.
+      auto U = FileToVector(DirPlusFile(Options.OutputCorpus, Name), MaxSize,
+                            /*ExitOnError*/ false);
+      if (!U.empty())
+        AdditionalCorpus.push_back(U);
+    }
+  } else {
+    ReadDirToVectorOfUnits(Options.OutputCorpus.c_str(), &AdditionalCorpus,
+                           &EpochOfLastReadOfOutputCorpus, MaxSize,
+                           /*ExitOnError*/ false);
+  }
   if (Options.Verbosity >= 2)
     Printf("Reload: read %zd new units.\n", AdditionalCorpus.size());
   bool Reloaded = false;
@@ -461,6 +1756,82 @@ void Fuzzer::RereadOutputCorpus(size_t MaxSize) {
     PrintStats("RELOAD");
 }
 
+// Learns the diffs that other nodes of a -sync_with campaign saved, so that
+// they count as duplicates here, and runs the units they added.
+void Fuzzer::RunSyncedUnits(size_t MaxSize) {
+  if (!Sync.IsRunning()) return;
+  SyncBatch B;
+  Sync.TakeIncoming(&B);
+  for (auto &D : B.DiffFingerprints) {
+    CoverageHash.Insert(D);
+    if (DiffShared.IsActive())
+      DiffShared.InsertDiffDigest(D.Lo);
+  }
+  NumberOfSyncedDiffs += B.DiffFingerprints.size();
+  bool Reloaded = false;
+  for (auto &U : B.Units) {
+    if (U.size() > MaxSize)
+      U.resize(MaxSize);
+    if (Corpus.HasUnit(U)) continue;
+    NumberOfSyncedUnits++;
+    if (RunOne(U.data(), U.size()))
+      Reloaded = true;
+  }
+  if (Reloaded)
+    PrintStats("SYNC  ");
+}
+
+// Runs the units that the other jobs of a -diff_shared=1 run have added.
+void Fuzzer::RunSharedUnits() {
+  if (!DiffShared.IsActive()) return;
+  std::vector<Unit> Units;
+  DiffShared.FetchNewUnits(&Units);
+  for (auto &U : Units) {
+    if (U.size() > MaxInputLen)
+      U.resize(MaxInputLen);
+    if (!Corpus.HasUnit(U))
+      RunOne(U.data(), U.size());
+  }
+}
+
+size_t Fuzzer::MaxPackedUnitSize() const {
+  size_t Res = 0;
+  for (size_t i = 0; i < Packed.size(); i++)
+    Res = std::max(Res, Packed.UnitSize(i));
+  return Res;
+}
+
+// Runs the packed units from Begin on, straight from the mapped files. Only
+// the units that make it into the corpus are copied.
+void Fuzzer::RunPackedUnits(size_t Begin, bool Shuffle) {
+  std::vector<size_t> Order;
+  for (size_t i = Begin; i < Packed.size(); i++)
+    Order.push_back(i);
+  NumPackedUnitsRun = Packed.size();
+  if (Shuffle && Options.ShuffleAtStartUp)
+    std::shuffle(Order.begin(), Order.end(), MD.GetRand());
+  if (Shuffle && Options.PreferSmall)
+    std::stable_sort(Order.begin(), Order.end(), [&](size_t A, size_t B) {
+      return Packed.UnitSize(A) < Packed.UnitSize(B);
+    });
+  for (size_t Idx : Order) {
+    const uint8_t *Data = Packed.UnitData(Idx);
+    size_t Size = std::min(Packed.UnitSize(Idx), MaxInputLen);
+    if (!Shuffle && Corpus.HasUnit({Data, Data + Size}))
+      continue;  // Most likely appended by this process.
+    if (RunOne(Data, Size)) {
+      if (Shuffle) {
+        MD.RecordSuccessfulMutationSequence();
+        PrintStatusForNewUnit({Data, Data + Size});
+        NumberOfNewUnitsAdded++;
+        TPC.PrintNewPCs();
+      }
+    }
+    if (TotalNumberOfRuns >= Options.MaxNumberOfRuns)
+      break;
+  }
+}
+
 void Fuzzer::ShuffleCorpus(UnitVector *V) {
   std::shuffle(V->begin(), V->end(), MD.GetRand());
   if (Options.PreferSmall)
@@ -478,20 +1849,31 @@ void Fuzzer::ShuffleAndMinimize(UnitVector *InitialCorpus) {
   uint8_t dummy;
   ExecuteCallback(&dummy, 0);
   int temp = 0;
-  for (const auto &U : *InitialCorpus) {
-    if(RunOne(U.data(), U.size()))
-    {
-      MD.RecordSuccessfulMutationSequence();
-      PrintStatusForNewUnit(U);
-      //WriteToOutputCorpus(U);
-      NumberOfNewUnitsAdded++;
-      TPC.PrintNewPCs();
-    }  
-    if (TotalNumberOfRuns >= Options.MaxNumberOfRuns)
-      break;
-    TryDetectingAMemoryLeak(U.data(), U.size(),/*DuringInitialCorpusExecution*/ true);
+  auto OnNewUnit = [&](const Unit &U) {
+    MD.RecordSuccessfulMutationSequence();
+    PrintStatusForNewUnit(U);
+    //WriteToOutputCorpus(U);
+    NumberOfNewUnitsAdded++;
+    TPC.PrintNewPCs();
+  };
+  if (Options.DifferentialMode && !Remote.IsRunning() &&
+      (Options.SeedWorkers > 1 || !Options.SeedCache.empty())) {
+    TriageSeeds(*InitialCorpus, Options.SeedWorkers, OnNewUnit);
+  } else {
+    for (const auto &U : *InitialCorpus) {
+      if (RunOne(U.data(), U.size()))
+        OnNewUnit(U);
+      if (TotalNumberOfRuns >= Options.MaxNumberOfRuns)
+        break;
+      TryDetectingAMemoryLeak(U.data(), U.size(),
+                              /*DuringInitialCorpusExecution*/ true);
+    }
   }
   Printf("%d \n",temp);
+  if (Packed.size()) {
+    Printf("INFO: running %zd units of the packed corpus\n", Packed.size());
+    RunPackedUnits(0, /*Shuffle=*/true);
+  }
   PrintStats("INITED");
   if (Corpus.empty()) {
     Printf("ERROR: no interesting inputs were found. "
@@ -510,7 +1892,7 @@ void Fuzzer::PrintPulseAndReportSlowInput(const uint8_t *Data, size_t Size) {
       TimeOfUnit >= Options.ReportSlowUnits) {
     TimeOfLongestUnitInSeconds = TimeOfUnit;
     Printf("Slowest unit: %zd s:\n", TimeOfLongestUnitInSeconds);
-    WriteUnitToFileWithPrefix({Data, Data + Size}, "slow-unit-");
+    QueueUnitToFileWithPrefix({Data, Data + Size}, "slow-unit-");
   }
 }
 
@@ -518,20 +1900,39 @@ bool Fuzzer::RunOneCallback(const uint8_t *Data, size_t Size, size_t idx,
                             bool MayDeleteFile, InputInfo *II) {
   if (!Size) return false;
 
-  int ret = ExecuteCallback(Data, Size);
+  int ret;
+  {
+    TraceScope<> Scope(Trace, TS_Execute, idx);
+    bool Traced = HwTrace.IsTraced(static_cast<int>(idx));
+    if (Traced) HwTrace.Begin(static_cast<int>(idx));
+    ret = ExecuteCallback(Data, Size);
+    if (Traced) HwTrace.End(static_cast<int>(idx));
+  }
   if (Options.DifferentialMode) TPC.OutputDiffVec[idx] = ret;
   FeatureSetTmp.clear();
   size_t NumUpdatesBefore = Corpus.NumFeatureUpdates();
-  TPC.CollectFeatures([&](size_t Feature) {
-    Corpus.AddFeature(Feature, Size, Options.Shrink);
-    if (Options.ReduceInputs)
+  {
+    TraceScope<> Scope(Trace, TS_CollectFeatures, idx);
+    // The features are added as one batch, see InputCorpus::AddFeatures().
+    TPC.CollectFeatures([&](size_t Feature) {
       FeatureSetTmp.push_back(Feature);
-  });
+    }, Options.DifferentialMode ? static_cast<int>(idx) : -1);
+    Corpus.AddFeatures(FeatureSetTmp.data(), FeatureSetTmp.size(), Size,
+                       Options.Shrink, [&](uint32_t Feature, bool IsNew) {
+      if (IsNew && Options.DifferentialMode &&
+          TPC.CallbackOfFeature(Feature) == static_cast<int>(idx))
+        CallbackNewFeatures[idx]++;
+    });
+    if (!Options.ReduceInputs)
+      FeatureSetTmp.clear();
+  }
   PrintPulseAndReportSlowInput(Data, Size);
   size_t NumNewFeatures = Corpus.NumFeatureUpdates() - NumUpdatesBefore;
   if (NumNewFeatures) {
+    TraceScope<> Scope(Trace, TS_CorpusAdd);
 	Corpus.AddToCorpus({Data, Data + Size}, NumNewFeatures, MayDeleteFile,
                        FeatureSetTmp);	
+    AnnotateNewUnit();
     CheckExitOnSrcPosOrItem();
     return true;
   }
@@ -542,56 +1943,376 @@ bool Fuzzer::RunOneCallback(const uint8_t *Data, size_t Size, size_t idx,
   return false;
 }
 
-bool Fuzzer::RunOne(const uint8_t *Data, size_t Size, bool MayDeleteFile,
-                    InputInfo *II) {
-  if (Options.DifferentialMode) {      
-    TPC.ResetCoverage();
-    size_t ret = 0, cb_ret = 0, features = 0;
-    UnitHadOutputDiff = false;
-    std::vector<int> feature_vec;
-    size_t CoverageBefore = TPC.GetTotalPCCoverage();
-    
-    //EF->__sanitizer_update_counter_bitset_and_clear_counters(0);
-    for (int i = 0; i < TPC.UC->size; ++i) {
-      CB = TPC.UC->callbacks[i];
-      cb_ret = RunOneCallback(Data, Size, i, MayDeleteFile, II);
-      features += cb_ret;
-      feature_vec.push_back(cb_ret);
+// -diff_hw_trace: once the trace of the last run of callback idx is decoded,
+// moves it into the guards of the callback and adds their features, much
+// like RunOneCallback() does for the instrumented modules.
+bool Fuzzer::AddTraceFeatures(const uint8_t *Data, size_t Size, size_t idx,
+                              bool MayDeleteFile, InputInfo *II) {
+  uint8_t *Counts = HwTrace.Wait(static_cast<int>(idx));
+  FeatureSetTmp.clear();
+  size_t NumUpdatesBefore = Corpus.NumFeatureUpdates();
+  {
+    TraceScope<> Scope(Trace, TS_CollectFeatures, idx);
+    TPC.ImportTraceCounters(TPC.CallbackGuards(idx), Counts,
+                            [&](size_t Feature) {
+      FeatureSetTmp.push_back(Feature);
+    });
+    Corpus.AddFeatures(FeatureSetTmp.data(), FeatureSetTmp.size(), Size,
+                       Options.Shrink, [&](uint32_t, bool IsNew) {
+      if (IsNew)
+        CallbackNewFeatures[idx]++;
+    });
+    if (!Options.ReduceInputs)
+      FeatureSetTmp.clear();
+  }
+  size_t NumNewFeatures = Corpus.NumFeatureUpdates() - NumUpdatesBefore;
+  if (NumNewFeatures) {
+    TraceScope<> Scope(Trace, TS_CorpusAdd);
+    Corpus.AddToCorpus({Data, Data + Size}, NumNewFeatures, MayDeleteFile,
+                       FeatureSetTmp);
+    AnnotateNewUnit();
+    CheckExitOnSrcPosOrItem();
+    return true;
+  }
+  if (II && Corpus.TryToReplace(II, Data, Size, FeatureSetTmp)) {
+    CheckExitOnSrcPosOrItem();
+    return true;
+  }
+  return false;
+}
+
+// Counterpart of the RunOneCallback loop in RunOne for -diff_parallel and
+// -diff_fork: all callbacks execute at once, then the (disjoint) coverage is
+// collected in one pass and every new feature is credited to the callback
+// whose module produced it.
+// Returns the number of callbacks that contributed new features.
+size_t Fuzzer::RunAllCallbacks(const uint8_t *Data, size_t Size,
+                               bool MayDeleteFile, InputInfo *II,
+                               std::vector<int> *FeaturesPerCallback) {
+  FeaturesPerCallback->assign(TPC.UC->size, 0);
+  if (!Size) return 0;
+
+  bool Executed;
+  {
+    TraceScope<> Scope(Trace, TS_Execute);
+    Executed = ExecuteAllCallbacks(Data, Size);
+  }
+  if (!Executed) {
+    std::fill(TPC.OutputDiffVec.begin(), TPC.OutputDiffVec.end(), 0);
+    return 0;
+  }
+  return CollectAllCallbackFeatures(Data, Size, MayDeleteFile, II,
+                                    FeaturesPerCallback);
+}
+
+// Collects the coverage left in TPC by all callbacks at once, crediting
+// every new feature to the callback whose module produced it.
+size_t Fuzzer::CollectAllCallbackFeatures(
+    const uint8_t *Data, size_t Size, bool MayDeleteFile, InputInfo *II,
+    std::vector<int> *FeaturesPerCallback) {
+  FeaturesPerCallback->assign(TPC.UC->size, 0);
+  FeatureSetTmp.clear();
+  size_t NumUpdatesBefore = Corpus.NumFeatureUpdates();
+  {
+    TraceScope<> Scope(Trace, TS_CollectFeatures);
+    TPC.CollectFeatures([&](size_t Feature) {
+      FeatureSetTmp.push_back(Feature);
+    });
+    Corpus.AddFeatures(FeatureSetTmp.data(), FeatureSetTmp.size(), Size,
+                       Options.Shrink, [&](uint32_t Feature, bool IsNew) {
+      int Idx = TPC.CallbackOfFeature(Feature);
+      if (Idx >= 0) {
+        (*FeaturesPerCallback)[Idx] = 1;
+        if (IsNew)
+          CallbackNewFeatures[Idx]++;
+      }
+    });
+    if (!Options.ReduceInputs)
+      FeatureSetTmp.clear();
+  }
+  PrintPulseAndReportSlowInput(Data, Size);
+  size_t NumNewFeatures = Corpus.NumFeatureUpdates() - NumUpdatesBefore;
+  size_t Res = std::count(FeaturesPerCallback->begin(),
+                          FeaturesPerCallback->end(), 1);
+  if (NumNewFeatures) {
+    TraceScope<> Scope(Trace, TS_CorpusAdd);
+    Corpus.AddToCorpus({Data, Data + Size}, NumNewFeatures, MayDeleteFile,
+                       FeatureSetTmp);
+    AnnotateNewUnit();
+    CheckExitOnSrcPosOrItem();
+    return std::max<size_t>(Res, 1);
+  }
+  if (II && Corpus.TryToReplace(II, Data, Size, FeatureSetTmp)) {
+    CheckExitOnSrcPosOrItem();
+    return 1;
+  }
+  return 0;
+}
+
+// The callback ExecuteCallback runs with -diff_fused: one call of
+// LLVMFuzzerCustomRunAll stores the results of all callbacks.
+static int RunFusedCallbacks(const uint8_t *Data, size_t Size) {
+  EF->LLVMFuzzerCustomRunAll(Data, Size, TPC.OutputDiffVec.data());
+  return TPC.OutputDiffVec[0];
+}
+
+// With -cost_aware, the units this run adds get the time all callbacks took
+// on it, which is about what each of their mutants will cost again.
+bool Fuzzer::RunOne(const uint8_t *Data, size_t Size, bool MayDeleteFile,
+                    InputInfo *II) {
+  if (!Options.CostAware)
+    return RunOneUntimed(Data, Size, MayDeleteFile, II);
+  size_t NumUnitsBefore = Corpus.size();
+  uint64_t NanosBefore = CallbackNanosSum;
+  auto Start = steady_clock::now();
+  bool Res = RunOneUntimed(Data, Size, MayDeleteFile, II);
+  uint64_t Nanos = CallbackNanosSum - NanosBefore;
+  if (!Nanos)  // The callbacks ran elsewhere, e.g. in -diff_fork children.
+    Nanos = duration_cast<nanoseconds>(steady_clock::now() - Start).count();
+  for (size_t i = NumUnitsBefore; i < Corpus.size(); i++)
+    Corpus.SetExecTime(i, Nanos);
+  return Res;
+}
+
+bool Fuzzer::RunOneUntimed(const uint8_t *Data, size_t Size,
+                           bool MayDeleteFile, InputInfo *II) {
+  if (Options.DifferentialMode) {      
+    TPC.ResetCoverage();
+    size_t cb_ret = 0, features = 0;
+    std::vector<int> feature_vec;
+    
+    //EF->__sanitizer_update_counter_bitset_and_clear_counters(0);
+    if (DiffWorkers.IsRunning() || DiffForkServer.IsRunning() ||
+        Remote.IsRunning()) {
+      features = RunAllCallbacks(Data, Size, MayDeleteFile, II, &feature_vec);
+    } else if (Options.DiffFused) {
+      feature_vec.assign(TPC.UC->size, 0);
+      if (Size) {
+        CB = RunFusedCallbacks;
+        {
+          TraceScope<> Scope(Trace, TS_Execute);
+          ExecuteCallback(Data, Size);
+        }
+        features = CollectAllCallbackFeatures(Data, Size, MayDeleteFile, II,
+                                              &feature_vec);
+      }
+    } else {
+      bool Fast = Options.DiffFastPath > 0 && Size;
+      if (Fast && !RunFastCallbacks(Data, Size)) {
+        // Nothing new to learn from the instrumented builds.
+        UnitHadOutputDiff = false;
+        NumberOfFastOnlyRuns++;
+        TotalNumberOfRuns++;
+        PrintPulseAndReportSlowInput(Data, Size);
+        return false;
+      }
+      int Reference = -1;
+      if (Options.DiffReference >= 0 && Size &&
+          (CallbackDisabled.empty() ||
+           !CallbackDisabled[Options.DiffReference])) {
+        Reference = Options.DiffReference;
+        if (!RunReferenceCallback(Data, Size, MayDeleteFile, II, &cb_ret)) {
+          UnitHadOutputDiff = false;
+          NumberOfReferenceOnlyRuns++;
+          TotalNumberOfRuns++;
+          PrintPulseAndReportSlowInput(Data, Size);
+          return false;
+        }
+      }
+      if ((Options.DiffZeroCopy || Options.ProtectInput) && Size) {
+        SharedInputCopy = CopyToGuardedInput(Data, Size);
+        if (Options.ProtectInput)
+          ProtectGuardedInput(true);
+      }
+      int FirstEnabled = -1;
+      bool EarlyExit = false;
+      feature_vec.assign(TPC.UC->size, 0);
+      CallbackLeakSuspects.assign(TPC.UC->size, false);
+      if (Reference >= 0) {
+        features = feature_vec[Reference] = cb_ret;
+        CallbackLeakSuspects[Reference] = HasMoreMallocsThanFrees;
+        FirstEnabled = Reference;
+        EarlyExit =
+            Options.DiffEarlyExit > 0 && PredictsAgreement(FirstEnabled);
+      }
+      AllocTracer.BeginInput();
+      for (int k = 0; k < TPC.UC->size && !EarlyExit; ++k) {
+        int i = CallbackOrder.empty() ? k : CallbackOrder[k];
+        if (i == Reference ||
+            (!CallbackDisabled.empty() && CallbackDisabled[i]))
+          continue;
+        CB = TPC.UC->callbacks[i];
+        TPC.SelectValueProfileMap(i);
+        RunningCallbackIdx = i;
+        cb_ret = RunOneCallback(Data, Size, i, MayDeleteFile, II);
+        RunningCallbackIdx = -1;
+        if (Size)
+          CallbackLeakSuspects[i] = HasMoreMallocsThanFrees;
+        features += cb_ret;
+        feature_vec[i] = cb_ret;
+        if (Size) {
+          auto Time = UnitStopTime - UnitStartTime;
+          if (!CallbackSeconds.empty())
+            CallbackSeconds[i] += duration<double>(Time).count();
+          RecordCallbackLatency(i, duration_cast<nanoseconds>(Time).count(),
+                                Data, Size);
+        }
+        if (FirstEnabled < 0) {
+          FirstEnabled = i;
+          EarlyExit = Options.DiffEarlyExit > 0 && Size &&
+                      PredictsAgreement(FirstEnabled);
+        }
+      }
+      HasMoreMallocsThanFrees = AllocTracer.EndInput();
+      TPC.SelectValueProfileMap(0);
+      // The traces were decoded while the later callbacks ran.
+      for (int i = 0; HwTrace.IsRunning() && i < TPC.UC->size; ++i)
+        if (HwTrace.IsTraced(i) && HwTrace.IsPending(i) &&
+            AddTraceFeatures(Data, Size, i, MayDeleteFile, II)) {
+          features += !feature_vec[i];
+          feature_vec[i] = 1;
+        }
+      if (EarlyExit) {
+        // The callbacks that did not run agree with the first one.
+        for (int i = 0; i < TPC.UC->size; ++i)
+          if (i != FirstEnabled) {
+            if (CallbackDisabled.empty() || !CallbackDisabled[i])
+              NumberOfSavedCallbacks++;
+            TPC.OutputDiffVec[i] = TPC.OutputDiffVec[FirstEnabled];
+          }
+        NumberOfEarlyExits++;
+      } else if (Options.DiffEarlyExit > 0 && Size) {
+        LearnAgreement(FirstEnabled);
+      }
+      if (!CallbackDisabled.empty()) {
+        // Disabled callbacks agree with the first running one.
+        for (int i = 0; i < TPC.UC->size; ++i)
+          if (CallbackDisabled[i])
+            TPC.OutputDiffVec[i] = TPC.OutputDiffVec[FirstEnabled];
+        // -diff_memory_limit_mb disables callbacks without -diff_prune,
+        // whose interval of 0 would prune on every run.
+        if (Options.DiffPruneInterval > 0)
+          MaybePruneCallbacks();
+      }
+      if (Options.DiffEarlyExit > 0)
+        MaybeReorderCallbacks();
+      if (Fast && FastResults != TPC.OutputDiffVec)
+        NumberOfFastPathMismatches++;
+      if (SharedInputCopy && Options.ProtectInput) {
+        ProtectGuardedInput(false);
+        SharedInputCopy = nullptr;
+      } else if (SharedInputCopy) {
+        bool InputIntact = !memcmp(SharedInputCopy, Data, Size);
+        SharedInputCopy = nullptr;
+        if (!InputIntact) {
+          CurrentUnitSize = Size;
+          CrashOnOverwrittenData();
+        }
+      }
     }
-    size_t NumCoverage = TPC.GetTotalPCCoverage() - CoverageBefore;
+    bool Res = FinishDiffRun(Data, Size, MayDeleteFile, features, feature_vec);
+    if (ReferenceSampled)
+      LearnReferenceSample();
+    return Res;
+  }
+
+  // No ResetCoverage() here: outside diff mode the covered guards add up
+  // over the run, as "cov:" counts them.
+  return RunOneCallback(Data, Size, 0, MayDeleteFile, II);
+}
+
+// Compares the results in TPC.OutputDiffVec once all callbacks have run on
+// Data and the coverage of that run is in TPC.
+bool Fuzzer::FinishDiffRun(const uint8_t *Data, size_t Size,
+                           bool MayDeleteFile, size_t features,
+                           std::vector<int> &feature_vec) {
+    UnitHadOutputDiff = false;
+    size_t NumCoverage = TPC.GetTotalPCCoverage();
     //bool new_diff = TPC.NewOutputDiff() | (NumCoverage > 0);
     //bool new_diff = TPC.NewOutputDiff() | TPC.NewTraceDiff(feature_vec);
-    bool new_diff = TPC.NewOutputDiff_change();
-    if(TPC.NewTraceDiff(feature_vec))
+    bool new_diff;
     {
-        NumberofValidCases++;
+      TraceScope<> Scope(Trace, TS_DiffCompare);
+      new_diff = TPC.NewOutputDiff_change();
+      if(TPC.NewTraceDiff(feature_vec))
+      {
+          NumberofValidCases++;
+      }
     }
+    if (CoverageReport.IsActive() && Size)
+      CoverageReport.Record(TPC);
+    // Read before MineDiffCmpArgs() runs the callbacks again.
+    bool NewEdgeBuckets = Options.DiffEdgeBuckets && TPC.NewEdgeBucketDiff();
     if (new_diff)
     {
       FeatureSetTmp.clear();
       DumpUnitIfDiff(Data, Size);
       if(UnitHadOutputDiff)
       {
+		TraceScope<> Scope(Trace, TS_CorpusAdd);
 		Corpus.AddToCorpus({Data, Data + Size}, NumCoverage, MayDeleteFile,
-                       FeatureSetTmp);      
+                       FeatureSetTmp, DiffUnitSha1);
+		AnnotateNewUnit();
+		RecordDiffClass(Corpus.size() - 1);
+		if (Options.DiffCmpDict && !DiffForkServer.IsRunning())
+			MineDiffCmpArgs(Data, Size);
       }
       else
       {}
     }
+    // An input on which the libraries cover a new mix of edge counts joins
+    // the corpus even without new features: it is a new way for them to
+    // drift apart, which may end in a diff.
+    if (NewEdgeBuckets && Size && !features && !UnitHadOutputDiff) {
+      TraceScope<> Scope(Trace, TS_CorpusAdd);
+      Corpus.AddToCorpus({Data, Data + Size}, NumCoverage, MayDeleteFile, {});
+      AnnotateNewUnit();
+      NumberOfEdgeBucketUnits++;
+      features = 1;
+    }
     //TPC.ResetCoverage(); 
     TotalNumberOfRuns++;
-    //log 
-    if ((int)TotalNumberOfRuns % 20 == 0)
-    {
-	char message[100];
-	sprintf(message,"%zd\t%zd\t%zd\t%zd",TotalNumberOfRuns,Duplicate,NumberOfDiffUnitsAdded,NumberofValidCases);
-	log_save("./log",message);
-    }
+    if (DiffStatsLog.IsRunning() &&
+        TotalNumberOfRuns % Options.StatsLogInterval == 0)
+      DiffStatsLog.Push({TotalNumberOfRuns, Duplicate, NumberOfDiffUnitsAdded,
+                         NumberofValidCases, secondsSinceProcessStartUp()});
     
     return features > 0 ? features : new_diff;
+}
+
+void Fuzzer::AnnotateNewUnit() {
+  size_t Idx = Corpus.size() - 1;
+  if (Directed.IsActive())
+    Corpus.SetTargetDistance(Idx, Directed.RunDistance(TPC));
+  if (Corpus.HasFeatureHits()) {
+    std::vector<uint32_t> Rarest(TPC.UC->size, ~0U);
+    TPC.CollectFeatures([&](size_t Feature) {
+      int C = TPC.CallbackOfFeature(Feature);
+      if (C < 0) return;
+      if (Rarest[C] == ~0U ||
+          Corpus.FeatureHitCount(Feature) < Corpus.FeatureHitCount(Rarest[C]))
+        Rarest[C] = static_cast<uint32_t>(Feature);
+    });
+    Corpus.SetRarestFeatures(Idx, std::move(Rarest));
   }
+  if (Corpus.OverBudget())
+    Corpus.EvictToBudget();
+}
 
-  return RunOneCallback(Data, Size, 0, MayDeleteFile, II);
+// -rare_edges: the factors of the corpus units follow the hit counts.
+void Fuzzer::MaybeUpdateRareEdgeBoosts() {
+  if (!Corpus.HasFeatureHits() ||
+      TotalNumberOfRuns < LastRareEdgeUpdate + kRareEdgeUpdateRuns)
+    return;
+  LastRareEdgeUpdate = TotalNumberOfRuns;
+  Corpus.UpdateRareEdgeBoosts();
+}
+
+// -cost_aware: the factors of the corpus units follow the median run time.
+void Fuzzer::MaybeUpdateCostWeights() {
+  if (!Options.CostAware || TotalNumberOfRuns < NextCostUpdate) return;
+  NextCostUpdate = TotalNumberOfRuns + kCostUpdateRuns;
+  Corpus.UpdateCostWeights();
 }
 
 size_t Fuzzer::GetCurrentUnitInFuzzingThead(const uint8_t **Data) const {
@@ -618,55 +2339,568 @@ static bool LooseMemeq(const uint8_t *A, const uint8_t *B, size_t Size) {
          !memcmp(A + Size - Limit / 2, B + Size - Limit / 2, Limit / 2);
 }
 
+// The result of a serial differential callback abandoned after
+// -diff_callback_timeout seconds, and with -diff_crash_as_diff of a forked
+// callback that timed out. These results are reserved: they sit next to
+// INT_MIN, far from any return code, and are odd, so that their verdict is
+// not 0 whatever -diff_verdict_bits is.
+static const int kCallbackTimeoutResult = INT_MIN + 1;
+// With -diff_crash_as_diff, the result of a forked callback that crashed.
+static const int kCallbackCrashResult = INT_MIN + 3;
+
+static bool IsReservedCallbackResult(int Res) {
+  return Res == kCallbackTimeoutResult || Res == kCallbackCrashResult;
+}
+// The latency a forked child records for a callback before running it.
+static const uint64_t kCallbackRunningNanos = ~0ULL;
+
 int Fuzzer::ExecuteCallback(const uint8_t *Data, size_t Size) {
  
   assert(InFuzzingThread());
-  if (SMR.IsClient())
-    SMR.WriteByteArray(Data, Size);
+  BeginEquivalenceInput(Data, Size);
   // We copy the contents of Unit into a separate heap buffer
-  // so that we reliably find buffer overflows in it.
-  uint8_t *DataCopy = new uint8_t[Size];
-  memcpy(DataCopy, Data, Size);
+  // so that we reliably find buffer overflows in it. With -diff_zero_copy
+  // RunOne has already made one guarded copy for all the callbacks; with
+  // -protect_input the copy goes before the guard page and is read-only.
+  uint8_t *DataCopy = SharedInputCopy;
+  bool Protected = !DataCopy && Options.ProtectInput && Size;
+  if (Protected) {
+    DataCopy = CopyToGuardedInput(Data, Size);
+    ProtectGuardedInput(true);
+  } else if (!DataCopy) {
+    DataCopy = new uint8_t[Size];
+    memcpy(DataCopy, Data, Size);
+  }
   if (CurrentUnitData && CurrentUnitData != Data)
     memcpy(CurrentUnitData, Data, Size);
   CurrentUnitSize = Size;
   AllocTracer.Start(Options.TraceMalloc);
   UnitStartTime = system_clock::now();
-  TPC.ResetMaps();
+  if (!AccumulatingCoverage)
+    TPC.ResetMaps();
   RunningCB = true;
-  int Res = CB(DataCopy, Size);
+  int Res;
+  bool Abandoned = false;
+  if (Options.DiffCallbackTimeoutSec > 0 && RunningCallbackIdx >= 0)
+    Res = RunAbandonableCallback(CB, DataCopy, Size, &Abandoned);
+  else
+    Res = CB(DataCopy, Size);
+  if (Abandoned) {
+    Printf("INFO: abandoned callback %d, its result is %d\n",
+           RunningCallbackIdx, kCallbackTimeoutResult);
+    Res = kCallbackTimeoutResult;
+    NumberOfCallbackTimeouts++;
+  } else if (Options.DifferentialMode && IsReservedCallbackResult(Res)) {
+    static bool Warned = false;
+    if (!Warned)
+      Printf("WARNING: callback %d returned %d, which libFuzzer reserves "
+             "for callbacks that time out or crash\n",
+             RunningCallbackIdx, Res);
+    Warned = true;
+  }
   RunningCB = false;
   UnitStopTime = system_clock::now();
+  CallbackNanosSum +=
+      duration_cast<nanoseconds>(UnitStopTime - UnitStartTime).count();
+  TPC.UpdateInline8bitCounters();
   if (!Options.DifferentialMode) {
     (void)Res;
     assert(Res == 0);
   }
   HasMoreMallocsThanFrees = AllocTracer.Stop();
-  if (!LooseMemeq(DataCopy, Data, Size))
+  if (Protected) {
+    ProtectGuardedInput(false);
+  } else if (DataCopy != SharedInputCopy) {
+    if (!LooseMemeq(DataCopy, Data, Size))
+      CrashOnOverwrittenData();
+    delete[] DataCopy;
+  }  // Otherwise RunOne checks the input after the last callback.
+  CurrentUnitSize = 0;
+  EndEquivalenceInput();
+  return Res;
+}
+
+// -diff_fast_path: runs Data through the uninstrumented builds of all
+// callbacks and returns true if the instrumented ones are to run it as
+// well: its pattern of verdicts has not been seen before, they disagree, or
+// it is the one in -diff_fast_path inputs that is sampled.
+bool Fuzzer::RunFastCallbacks(const uint8_t *Data, size_t Size) {
+  assert(InFuzzingThread());
+  if (CurrentUnitData && CurrentUnitData != Data)
+    memcpy(CurrentUnitData, Data, Size);
+  CurrentUnitSize = Size;
+  FastInputCopy.assign(Data, Data + Size);
+  FastResults.resize(FastUC->size);
+  UnitStartTime = system_clock::now();
+  RunningCB = true;
+  for (int i = 0; i < FastUC->size; i++)
+    FastResults[i] = FastUC->callbacks[i](FastInputCopy.data(), Size);
+  RunningCB = false;
+  UnitStopTime = system_clock::now();
+  CallbackNanosSum +=
+      duration_cast<nanoseconds>(UnitStopTime - UnitStartTime).count();
+  if (!LooseMemeq(FastInputCopy.data(), Data, Size))
     CrashOnOverwrittenData();
   CurrentUnitSize = 0;
-  delete[] DataCopy;
+  TPC.OutputDiffVec = FastResults;
+  auto Verdict = [&](int i) {
+    int R = FastResults[i];
+    return DiffVerdict(Oracle.IsActive() ? Oracle.Map(i, R) : R);
+  };
+  // Results that differ beyond their verdicts, such as the output digests
+  // in the high bits, would make nearly every input new.
+  bool Agree = true;
+  Hasher128 Pattern;
+  for (int i = 0; i < FastUC->size; i++) {
+    Agree &= Verdict(i) == Verdict(0);
+    Pattern.Update(static_cast<uint32_t>(Verdict(i)));
+  }
+  bool New = FastPathPatterns.Insert(Pattern.Final());
+  return New || !Agree || !MD.GetRand()(Options.DiffFastPath);
+}
+
+// Same as ExecuteCallback, but runs every differential callback at once,
+// on DiffWorkers, in a child of DiffForkServer or on the Remote workers,
+// and stores their
+// results in TPC.OutputDiffVec. Returns false if the forked child died.
+bool Fuzzer::ExecuteAllCallbacks(const uint8_t *Data, size_t Size) {
+  assert(InFuzzingThread());
+  BeginEquivalenceInput(Data, Size);
+  if (CurrentUnitData && CurrentUnitData != Data)
+    memcpy(CurrentUnitData, Data, Size);
+  CurrentUnitSize = Size;
+  bool Res = true;
+  UnitStartTime = system_clock::now();
+  TPC.ResetMaps();
+  if (Remote.IsRunning()) {
+    // The workers enforce the timeout and report their own crashes.
+    Remote.Submit(Data, Size);
+    TakeRemoteReplies();
+  } else if (DiffForkServer.IsRunning()) {
+    // The child enforces the timeout and reports its own crashes. With
+    // -diff_crash_as_diff, the callbacks after one that took the child down
+    // run in the next child; only the coverage of the last one is kept.
+    size_t N = TPC.OutputDiffVec.size();
+    size_t First = 0;
+    while (First < N) {
+      const uint8_t *Reply;
+      size_t ReplySize;
+      auto Start = system_clock::now();
+      Res = DiffForkServer.Run(Data, Size, &Reply, &ReplySize, First);
+      int Crashed = Res ? -1 : CrashedForkedCallback(Reply, First);
+      size_t End = Crashed < 0 ? N : Crashed;
+      memcpy(TPC.OutputDiffVec.data() + First, Reply + First * sizeof(int),
+             (End - First) * sizeof(int));
+      memcpy(CallbackNanos.data() + First,
+             Reply + N * sizeof(int) + First * sizeof(uint64_t),
+             (End - First) * sizeof(uint64_t));
+      if (Res) {
+        size_t ResultsSize = ForkedResultsSize();
+        TPC.ImportCoverage(Reply + ResultsSize, ReplySize - ResultsSize);
+        break;
+      }
+      NumberOfForkedChildFailures++;
+      int Status = DiffForkServer.LastStatus();
+      if (Crashed < 0) {
+        Printf("INFO: forked child died (wait status %d), continuing\n",
+               Status);
+        break;
+      }
+      // Timeouts and crashes exit with the same code by default.
+      bool TimedOut =
+          Options.UnitTimeoutSec > 0 &&
+          duration_cast<seconds>(system_clock::now() - Start).count() >=
+              Options.UnitTimeoutSec;
+      int CrashRes = TimedOut ? kCallbackTimeoutResult : kCallbackCrashResult;
+      TPC.OutputDiffVec[Crashed] = CrashRes;
+      CallbackNanos[Crashed] = 0;
+      NumberOfCallbackCrashes++;
+      Printf("INFO: callback %d died (wait status %d), its result is %d\n",
+             Crashed, Status, CrashRes);
+      First = Crashed + 1;
+      Res = true;
+    }
+  } else {
+    AllocTracer.Start(Options.TraceMalloc);
+    RunningCB = true;
+    bool InputIntact = DiffWorkers.Run(Data, Size, TPC.OutputDiffVec.data(),
+                                       CallbackNanos.data());
+    RunningCB = false;
+    TPC.UpdateInline8bitCounters();
+    TPC.MergeThreadCmpTables();
+    HasMoreMallocsThanFrees = AllocTracer.Stop();
+    if (!InputIntact)
+      CrashOnOverwrittenData();
+  }
+  UnitStopTime = system_clock::now();
+  CallbackNanosSum +=
+      duration_cast<nanoseconds>(UnitStopTime - UnitStartTime).count();
+  CurrentUnitSize = 0;
+  EndEquivalenceInput();
+  if (Res && Size)
+    for (size_t i = 0; i < CallbackNanos.size(); i++)
+      RecordCallbackLatency(i, CallbackNanos[i], Data, Size);
   return Res;
 }
 
+size_t Fuzzer::ForkedResultsSize() const {
+  return TPC.UC->size * (sizeof(int) + sizeof(uint64_t));
+}
+
+// With -diff_crash_as_diff, returns the callback that was running when the
+// child that wrote Reply died, or -1 if the child died outside of them.
+int Fuzzer::CrashedForkedCallback(const uint8_t *Reply,
+                                  size_t FirstCallback) const {
+  if (!Options.DiffCrashAsDiff) return -1;
+  for (int i = FirstCallback; i < TPC.UC->size; i++) {
+    uint64_t Nanos;
+    memcpy(&Nanos, Reply + TPC.UC->size * sizeof(int) + i * sizeof(uint64_t),
+           sizeof(Nanos));
+    if (Nanos == kCallbackRunningNanos) return i;
+  }
+  return -1;
+}
+
+// Runs in a child of DiffForkServer: executes every differential callback on
+// Data and replies with their results followed by the exported coverage.
+size_t Fuzzer::RunCallbacksInForkedChild(const uint8_t *Data, size_t Size,
+                                         uint8_t *Out, size_t MaxOutSize,
+                                         size_t FirstCallback) {
+  if (!InForkedChild) {
+    // Timers are not inherited across fork(), re-arm the unit timeout.
+    InForkedChild = true;
+    SetSignalHandler(Options);
+  }
+  TPC.ResetCoverage();
+  TPC.ResetMaps();
+  if (CurrentUnitData)
+    memcpy(CurrentUnitData, Data, Size);
+  CurrentUnitSize = Size;
+  UnitStartTime = system_clock::now();
+  RunningCB = true;
+  uint8_t *Shared = (Options.DiffZeroCopy || Options.ProtectInput) && Size
+                        ? CopyToGuardedInput(Data, Size)
+                        : nullptr;
+  if (Shared && Options.ProtectInput)
+    ProtectGuardedInput(true);
+  uint8_t *OutNanos = Out + TPC.UC->size * sizeof(int);
+  for (int i = FirstCallback; i < TPC.UC->size; i++)
+    memcpy(OutNanos + i * sizeof(uint64_t), &kCallbackRunningNanos,
+           sizeof(uint64_t));
+  for (int i = FirstCallback; i < TPC.UC->size; i++) {
+    uint8_t *DataCopy = Shared;
+    if (!DataCopy) {
+      DataCopy = new uint8_t[Size];
+      memcpy(DataCopy, Data, Size);
+    }
+    TPC.SelectValueProfileMap(i);
+    auto Start = steady_clock::now();
+    int Res = TPC.UC->callbacks[i](DataCopy, Size);
+    uint64_t Nanos =
+        duration_cast<nanoseconds>(steady_clock::now() - Start).count();
+    if (!Shared) {
+      if (!LooseMemeq(DataCopy, Data, Size))
+        CrashOnOverwrittenData();
+      delete[] DataCopy;
+    }
+    memcpy(Out + i * sizeof(int), &Res, sizeof(int));
+    memcpy(OutNanos + i * sizeof(uint64_t), &Nanos, sizeof(Nanos));
+  }
+  RunningCB = false;
+  TPC.SelectValueProfileMap(0);
+  if (Shared && Options.ProtectInput)
+    ProtectGuardedInput(false);
+  else if (Shared && memcmp(Shared, Data, Size))
+    CrashOnOverwrittenData();
+  CurrentUnitSize = 0;
+  TPC.UpdateInline8bitCounters();
+  size_t ResultsSize = ForkedResultsSize();
+  return ResultsSize +
+         TPC.ExportCoverage(Out + ResultsSize, MaxOutSize - ResultsSize);
+}
+
+// Makes Batch[Idx] the current unit, so that crash and timeout reports of
+// the batch callbacks point at the input that is being executed.
+void Fuzzer::StartBatchInput(size_t Idx) {
+  const Unit &U = Batch[Idx];
+  memcpy(CurrentUnitData, U.data(), U.size());
+  CurrentUnitSize = U.size();
+  TPC.ResetCoverage();
+  TPC.ResetMaps();
+  UnitStartTime = system_clock::now();
+}
+
+void Fuzzer::BatchInputDoneCallback(size_t Idx) {
+  assert(InFuzzingThread());
+  if (!RunningCB || Idx >= Batch.size()) return;
+  UnitStopTime = system_clock::now();
+  RecordCallbackLatency(
+      BatchCallbackIdx,
+      duration_cast<nanoseconds>(UnitStopTime - UnitStartTime).count(),
+      Batch[Idx].data(), Batch[Idx].size());
+  TPC.UpdateInline8bitCounters();
+  size_t Size =
+      TPC.ExportCoverage(BatchExportBuffer.data(), BatchExportBuffer.size());
+  BatchCoverage[BatchCallbackIdx * Batch.size() + Idx].assign(
+      BatchExportBuffer.data(), BatchExportBuffer.data() + Size);
+  if (Idx + 1 < Batch.size())
+    StartBatchInput(Idx + 1);
+}
+
+// Runs every batch callback on all pending mutants, then replays the
+// results and the coverage of each mutant through the same path as RunOne.
+// With -diff_remote the workers run the mutants instead, as many ahead of
+// the one that is replayed as the ring has room for.
+void Fuzzer::RunBatch(InputInfo *II) {
+  auto BatchStart = steady_clock::now();
+  size_t N = Batch.size();
+  size_t NumCallbacks = TPC.UC->size;
+  if (BatchExportBuffer.empty() && !Remote.IsRunning() &&
+      !DiffExecutors.IsRunning())
+    BatchExportBuffer.resize(TPC.MaxExportedCoverageSize());
+  BatchResults.assign(NumCallbacks * N, 0);
+  BatchCoverage.resize(NumCallbacks * N);
+  for (auto &C : BatchCoverage)
+    C.clear();
+
+  if (DiffExecutors.IsRunning()) {
+    BatchNanos.assign(NumCallbacks * N, 0);
+    UnitStartTime = system_clock::now();
+    RunningCB = true;
+    size_t Modified = DiffExecutors.Run(Batch.data(), N, BatchResults.data(),
+                                        BatchCoverage.data(), BatchNanos.data());
+    RunningCB = false;
+    UnitStopTime = system_clock::now();
+    TPC.MergeThreadCmpTables();
+    if (Modified < N) {
+      memcpy(CurrentUnitData, Batch[Modified].data(), Batch[Modified].size());
+      CurrentUnitSize = Batch[Modified].size();
+      CrashOnOverwrittenData();
+    }
+  }
+  std::vector<const uint8_t *> Data(N);
+  std::vector<size_t> Sizes(N);
+  for (size_t i = 0; i < NumCallbacks && !Remote.IsRunning() &&
+                     !DiffExecutors.IsRunning();
+       i++) {
+    // Like ExecuteCallback, give the callback private copies of the inputs.
+    UnitVector Copies(Batch);
+    for (size_t j = 0; j < N; j++) {
+      Data[j] = Copies[j].data();
+      Sizes[j] = Copies[j].size();
+    }
+    BatchCallbackIdx = i;
+    TPC.SelectValueProfileMap(i);
+    StartBatchInput(0);
+    RunningCB = true;
+    TPC.UBC->callbacks[i](Data.data(), Sizes.data(), N, &BatchResults[i * N],
+                          StaticBatchInputDoneCallback);
+    RunningCB = false;
+    for (size_t j = 0; j < N; j++) {
+      if (Copies[j] == Batch[j]) continue;
+      memcpy(CurrentUnitData, Batch[j].data(), Batch[j].size());
+      CurrentUnitSize = Batch[j].size();
+      CrashOnOverwrittenData();
+    }
+    CurrentUnitSize = 0;
+  }
+  TPC.SelectValueProfileMap(0);
+
+  size_t NumSubmitted = 0;
+  for (size_t j = 0; j < N; j++) {
+    const Unit &U = Batch[j];
+    TPC.ResetCoverage();
+    if (Remote.IsRunning()) {
+      for (; NumSubmitted < N && Remote.CanSubmit(); NumSubmitted++)
+        Remote.Submit(Batch[NumSubmitted].data(), Batch[NumSubmitted].size());
+      TakeRemoteReplies();
+      for (size_t i = 0; i < NumCallbacks; i++)
+        RecordCallbackLatency(i, CallbackNanos[i], U.data(), U.size());
+    } else {
+      for (size_t i = 0; i < NumCallbacks; i++) {
+        const auto &C = BatchCoverage[i * N + j];
+        if (!C.empty())
+          TPC.ImportCoverage(C.data(), C.size());
+        TPC.OutputDiffVec[i] = BatchResults[i * N + j];
+        if (DiffExecutors.IsRunning())
+          RecordCallbackLatency(i, BatchNanos[i * N + j], U.data(), U.size());
+      }
+    }
+    std::vector<int> FeatureVec;
+    size_t NumFeaturesBefore = Corpus.NumFeatures();
+    size_t NumDiffClassesBefore = Corpus.NumDiffClasses();
+    size_t Features = CollectAllCallbackFeatures(
+        U.data(), U.size(), /*MayDeleteFile=*/true, II, &FeatureVec);
+    if (!BatchMutationSequences.empty())
+      DiffParentSequence = &BatchMutationSequences[j];
+    bool NewUnit = FinishDiffRun(U.data(), U.size(), /*MayDeleteFile=*/true,
+                                 Features, FeatureVec);
+    if (NewUnit)
+      ReportNewMutant(II, U);
+    if (!BatchMutantOrigins.empty())
+      BatchMutantOutcomes.push_back(MutantOutcomeOf(
+          NewUnit, NumFeaturesBefore, NumDiffClassesBefore, 0));
+  }
+  // The inputs of a batch share its running time.
+  if (!BatchMutantOrigins.empty()) {
+    double Seconds =
+        duration<double>(steady_clock::now() - BatchStart).count() / N;
+    for (size_t j = 0; j < N; j++) {
+      BatchMutantOutcomes[j].Seconds = Seconds;
+      MD.RecordMutantOutcome(BatchMutantOrigins[j], BatchMutantOutcomes[j]);
+    }
+  }
+  DiffParentSequence = nullptr;
+  // The mutation sequence continues from the last mutant.
+  memcpy(CurrentUnitData, Batch.back().data(), Batch.back().size());
+  Batch.clear();
+  BatchMutationSequences.clear();
+  BatchMutantOrigins.clear();
+  BatchMutantOutcomes.clear();
+}
+
+// -diff_coverage_window=W: runs the pending mutants, up to W of them, with
+// the coverage of all their callback runs added up in the maps, and collects
+// the features once for the whole window. The counts of a window add up to
+// buckets no single mutant reaches, so a guard only counts if the corpus has
+// no feature of it at all; other features count as they are. Only if the
+// window has such a new feature do all its mutants run again, one by one
+// through RunOne(), which gives each its own coverage; a mutant on which the
+// callbacks disagree always does, for the fingerprint of its diff. Every
+// other window costs one reset and one collection of the maps instead of one
+// per callback run. A window therefore misses the new count buckets of known
+// guards, and -reduce_inputs sees only the mutants that run again.
+void Fuzzer::RunCoverageWindow(InputInfo *II) {
+  size_t N = Batch.size();
+  std::vector<bool> Disagrees(N);
+  uint32_t MinSize = UINT32_MAX;
+  TPC.ResetCoverage();
+  TPC.ResetMaps();
+  AccumulatingCoverage = true;
+  for (size_t j = 0; j < N; j++) {
+    const Unit &U = Batch[j];
+    MinSize = std::min(MinSize, static_cast<uint32_t>(U.size()));
+    int FirstVerdict = 0;
+    bool First = true;
+    for (int i = 0; i < TPC.UC->size; i++) {
+      if (!CallbackDisabled.empty() && CallbackDisabled[i])
+        continue;
+      CB = TPC.UC->callbacks[i];
+      TPC.SelectValueProfileMap(i);
+      RunningCallbackIdx = i;
+      int Ret = ExecuteCallback(U.data(), U.size());
+      RunningCallbackIdx = -1;
+      int Verdict = DiffVerdict(Oracle.IsActive() ? Oracle.Map(i, Ret) : Ret);
+      auto Time = UnitStopTime - UnitStartTime;
+      if (!CallbackSeconds.empty())
+        CallbackSeconds[i] += duration<double>(Time).count();
+      RecordCallbackLatency(i, duration_cast<nanoseconds>(Time).count(),
+                            U.data(), U.size());
+      if (!First && Verdict != FirstVerdict)
+        Disagrees[j] = true;
+      FirstVerdict = Verdict;
+      First = false;
+    }
+  }
+  AccumulatingCoverage = false;
+  TPC.SelectValueProfileMap(0);
+  bool NewFeatures = false;
+  size_t NumGuardFeatures = TPC.GetNumPCs() * 8;
+  TPC.CollectFeatures([&](size_t Feature) {
+    if (NewFeatures) return;
+    if (Feature >= NumGuardFeatures) {
+      NewFeatures = Corpus.WouldAddFeature(Feature, MinSize, Options.Shrink);
+      return;
+    }
+    NewFeatures = true;
+    for (size_t B = 0; B < 8 && NewFeatures; B++)
+      NewFeatures = Corpus.WouldAddFeature(Feature / 8 * 8 + B, MinSize,
+                                           /*Shrink=*/false);
+  });
+  NumberOfCoverageWindows++;
+
+  for (size_t j = 0; j < N; j++) {
+    const Unit &U = Batch[j];
+    size_t NumFeaturesBefore = Corpus.NumFeatures();
+    size_t NumDiffClassesBefore = Corpus.NumDiffClasses();
+    bool NewUnit = false;
+    if (NewFeatures || Disagrees[j]) {
+      NumberOfWindowReruns++;
+      if (!BatchMutationSequences.empty())
+        DiffParentSequence = &BatchMutationSequences[j];
+      NewUnit = RunOne(U.data(), U.size(), /*MayDeleteFile=*/true, II);
+      if (NewUnit)
+        ReportNewMutant(II, U);
+    } else {
+      TotalNumberOfRuns++;
+      PrintPulseAndReportSlowInput(U.data(), U.size());
+    }
+    if (!BatchMutantOrigins.empty())
+      MD.RecordMutantOutcome(BatchMutantOrigins[j],
+                             MutantOutcomeOf(NewUnit, NumFeaturesBefore,
+                                             NumDiffClassesBefore, 0));
+  }
+  DiffParentSequence = nullptr;
+  // The mutation sequence continues from the last mutant.
+  memcpy(CurrentUnitData, Batch.back().data(), Batch.back().size());
+  Batch.clear();
+  BatchMutationSequences.clear();
+  BatchMutantOrigins.clear();
+}
+
+void Fuzzer::RunPendingMutants(InputInfo *II) {
+  if (Options.DiffBatchSize > 0)
+    RunBatch(II);
+  else
+    RunCoverageWindow(II);
+}
+
 void Fuzzer::WriteToOutputCorpus(const Unit &U) {
   if (Options.OnlyASCII)
     assert(IsASCII(U));
+  if (Packed.IsOpen()) {
+    if (!Packed.Append(U.data(), U.size()))
+      Printf("WARNING: can't append to the packed corpus %s\n",
+             Options.PackedCorpus.c_str());
+    return;
+  }
   if (Options.OutputCorpus.empty())
     return;
   std::string Path = DirPlusFile(Options.OutputCorpus, Hash(U));
-  WriteToFile(U, Path);
+  if (FileWriter.IsRunning())
+    FileWriter.Write(U, Path, /*ToPack=*/false);
+  else
+    WriteToFile(U, Path, Options.FsyncWrites);
   if (Options.Verbosity >= 2)
     Printf("Written to %s\n", Path.c_str());
 }
 
-void Fuzzer::WriteUnitToFileWithPrefix(const Unit &U, const char *Prefix) {
+std::string Fuzzer::ArtifactPath(const Unit &U, const char *Prefix,
+                                 const uint8_t *Sha1) const {
+  if (!Options.ExactArtifactPath.empty())
+    return Options.ExactArtifactPath; // Overrides ArtifactPrefix.
+  return Options.ArtifactPrefix + Prefix +
+         (Sha1 ? Sha1ToString(Sha1) : Hash(U));
+}
+
+void Fuzzer::QueueUnitToFileWithPrefix(const Unit &U, const char *Prefix,
+                                       const uint8_t *Sha1) {
+  if (!FileWriter.IsRunning())
+    return WriteUnitToFileWithPrefix(U, Prefix, Sha1);
   if (!Options.SaveArtifacts)
     return;
-  std::string Path = Options.ArtifactPrefix + Prefix + Hash(U);
-  if (!Options.ExactArtifactPath.empty())
-    Path = Options.ExactArtifactPath; // Overrides ArtifactPrefix.
-  WriteToFile(U, Path);
+  std::string Path = ArtifactPath(U, Prefix, Sha1);
+  if (FileWriter.Write(U, Path, /*ToPack=*/true))
+    Printf("artifact_prefix='%s'; Test unit queued for %s\n",
+           Options.ArtifactPrefix.c_str(), Path.c_str());
+}
+
+void Fuzzer::WriteUnitToFileWithPrefix(const Unit &U, const char *Prefix,
+                                       const uint8_t *Sha1) {
+  if (!Options.SaveArtifacts)
+    return;
+  std::string Path = ArtifactPath(U, Prefix, Sha1);
+  WriteToFile(U, Path, Options.FsyncWrites);
   Printf("artifact_prefix='%s'; Test unit written to %s\n",
          Options.ArtifactPrefix.c_str(), Path.c_str());
   if (U.size() <= kMaxUnitSizeToPrint)
@@ -679,20 +2913,49 @@ void Fuzzer::PrintStatusForNewUnit(const Unit &U) {
   PrintStats("NEW   ", "");
   if (Options.Verbosity) {
     Printf(" L: %zd ", U.size());
-    MD.PrintMutationSequence();
+    if (DiffParentSequence)
+      Printf("%s", DiffParentSequence->c_str());
+    else
+      MD.PrintMutationSequence();
     Printf("\n");
   }
 }
 
 void Fuzzer::ReportNewCoverage(InputInfo *II, const Unit &U) {
   II->NumSuccessfullMutations++;
+  NumberOfSuccessfulMutations++;
   MD.RecordSuccessfulMutationSequence();
   PrintStatusForNewUnit(U);
   WriteToOutputCorpus(U);
+  if (DiffShared.IsActive())
+    DiffShared.PublishUnit(U.data(), U.size());
+  if (Sync.IsRunning())
+    Sync.AddUnit(U.data(), U.size());
   NumberOfNewUnitsAdded++;
   TPC.PrintNewPCs();
 }
 
+// Reports a mutant that RunOne found interesting. A mutant that produced a
+// new output diff is also saved next to the unit it was mutated from, unless
+// its -diff_pack record already holds that unit.
+// A custom mutator may ask to be told about such mutants to steer itself.
+void Fuzzer::ReportNewMutant(InputInfo *II, const Unit &U) {
+  ReportNewCoverage(II, U);
+  if (UnitHadOutputDiff) {
+    II->NumDiffMutations++;
+    NumberOfDiffMutations++;
+  }
+  if (Pipeline.IsRunning())
+    Pipeline.SendFeedback(U, UnitHadOutputDiff);
+  else if (EF->LLVMFuzzerCustomMutatorFeedback)
+    EF->LLVMFuzzerCustomMutatorFeedback(U.data(), U.size(), UnitHadOutputDiff);
+  if (UnitHadOutputDiff && !DiffArtifacts.IsOpen()) {
+    std::string s = Sha1ToString(DiffUnitSha1) + "_BeforeMutationWas_";
+    QueueUnitToFileWithPrefix(
+        {DiffParentData, DiffParentData + DiffParentSize}, s.c_str());
+  }
+}
+
 // Tries detecting a memory leak on the particular input that we have just
 // executed before calling this function.
 void Fuzzer::TryDetectingAMemoryLeak(const uint8_t *Data, size_t Size,
@@ -702,6 +2965,10 @@ void Fuzzer::TryDetectingAMemoryLeak(const uint8_t *Data, size_t Size,
   if (!&(EF->__lsan_enable) || !&(EF->__lsan_disable) ||
       !(EF->__lsan_do_recoverable_leak_check))
     return;  // No lsan.
+  if (Options.DifferentialMode && !Options.DiffFused) {
+    TryDetectingACallbackLeak(Data, Size, DuringInitialCorpusExecution);
+    return;
+  }
   // Run the target once again, but with lsan disabled so that if there is
   // a real leak we do not report it twice.
   EF->__lsan_disable();
@@ -732,6 +2999,67 @@ void Fuzzer::TryDetectingAMemoryLeak(const uint8_t *Data, size_t Size,
   }
 }
 
+// The differential version: runs again, with lsan disabled, only the
+// callbacks that had more mallocs than frees on the input (all of them if
+// the input only had more as a whole). An input on which one still has
+// them waits for a leak check that covers kLeakSuspectsPerCheck inputs.
+void Fuzzer::TryDetectingACallbackLeak(const uint8_t *Data, size_t Size,
+                                       bool DuringInitialCorpusExecution) {
+  int NumCallbacks = TPC.UC->size;
+  bool AnySuspect = std::find(CallbackLeakSuspects.begin(),
+                              CallbackLeakSuspects.end(),
+                              true) != CallbackLeakSuspects.end();
+  UserCallback SavedCB = CB;
+  std::string Suspects;
+  for (int i = 0; i < NumCallbacks; i++) {
+    if (CallbackLeakChecksOff[i] || (AnySuspect && !CallbackLeakSuspects[i]))
+      continue;
+    CB = TPC.UC->callbacks[i];
+    EF->__lsan_disable();
+    ExecuteCallback(Data, Size);
+    EF->__lsan_enable();
+    if (!HasMoreMallocsThanFrees) continue;
+    if (CallbackLeakAttempts[i]++ > 1000) {
+      CallbackLeakChecksOff[i] = true;
+      Printf("INFO: libFuzzer disabled leak detection for callback %d.\n"
+             "      Most likely it accumulates allocated memory in a global\n"
+             "      state w/o actually leaking it.\n", i);
+      continue;
+    }
+    Suspects += (Suspects.empty() ? "" : ",") + std::to_string(i);
+  }
+  CB = SavedCB;
+  CallbackLeakSuspects.assign(NumCallbacks, false);
+  if (Suspects.empty()) return;
+  LeakSuspects.push_back({Data, Data + Size});
+  LeakSuspectCallbacks.push_back(Suspects);
+  if (DuringInitialCorpusExecution ||
+      LeakSuspects.size() >= kLeakSuspectsPerCheck)
+    CheckLeakSuspects(DuringInitialCorpusExecution);
+}
+
+// One lsan pass for all pending suspect inputs. It cannot tell which of
+// them leaked, so all of them are written out.
+void Fuzzer::CheckLeakSuspects(bool DuringInitialCorpusExecution) {
+  if (LeakSuspects.empty()) return;
+  if (!EF->__lsan_do_recoverable_leak_check()) {
+    LeakSuspects.clear();
+    LeakSuspectCallbacks.clear();
+    return;
+  }
+  if (DuringInitialCorpusExecution)
+    Printf("\nINFO: a leak has been found in the initial corpus.\n\n");
+  Printf("INFO: to ignore leaks on libFuzzer side use -detect_leaks=0.\n\n");
+  Printf("INFO: the leak is in one of the %zd inputs below\n",
+         LeakSuspects.size());
+  for (size_t i = 0; i < LeakSuspects.size(); i++) {
+    Printf("callbacks %s: ", LeakSuspectCallbacks[i].c_str());
+    WriteUnitToFileWithPrefix(LeakSuspects[i], "leak-");
+  }
+  PrintFinalStats();
+  _Exit(Options.ErrorExitCode);  // not exit() to disable lsan further on.
+}
+
 static size_t ComputeMutationLen(size_t MaxInputSize, size_t MaxMutationLen,
                                  Random &Rand) {
   assert(MaxInputSize <= MaxMutationLen);
@@ -745,72 +3073,291 @@ static size_t ComputeMutationLen(size_t MaxInputSize, size_t MaxMutationLen,
   return Min(Result, MaxMutationLen);
 }
 
+// The mutation length limit of -len_control=N. It starts at the size of the
+// largest corpus unit and only goes up once the corpus stopped growing for
+// N * log2(limit) runs, by one structural step of the target if it tells
+// them, so that most mutants keep the sizes the target can parse.
+size_t Fuzzer::LenControlMaxMutationLen() {
+  if (NumberOfNewUnitsAdded != LenControlUnits) {
+    LenControlUnits = NumberOfNewUnitsAdded;
+    LenControlRun = TotalNumberOfRuns;
+  }
+  LenControlLen = Min(Max(Max(LenControlLen, Corpus.MaxInputSize()),
+                          (size_t)1),
+                      MaxMutationLen);
+  if (LenControlLen == MaxMutationLen) return LenControlLen;
+  size_t Log = 64 - __builtin_clzll(LenControlLen);
+  if (TotalNumberOfRuns - LenControlRun <
+      static_cast<size_t>(Options.LenControl) * Log)
+    return LenControlLen;
+  size_t Next = LenControlLen + Log;
+  if (EF->LLVMFuzzerCustomLengthStep) {
+    auto Lock = Pipeline.LockMutator();
+    Next = EF->LLVMFuzzerCustomLengthStep(LenControlLen);
+  }
+  LenControlLen = Min(Max(Next, LenControlLen + 1), MaxMutationLen);
+  LenControlRun = TotalNumberOfRuns;
+  if (Options.Verbosity >= 2)
+    Printf("#%zd\tLEN: max mutation length %zd\n", TotalNumberOfRuns,
+           LenControlLen);
+  return LenControlLen;
+}
+
+// Pre-execution duplicate filter for mutants, see -dedup_mutants.
+// Returns true if the unit should be mutated again instead of executed.
+// -diff_reject_cache: sets *Prefix to the digest of the prefix of Data that
+// the target reported, or to zero if there is none, and returns true if Data
+// is to be skipped because all callbacks rejected that prefix alike before.
+// One in -diff_reject_cache such inputs still runs, so that a prefix whose
+// verdict depends on the rest of the input is eventually forgotten.
+bool Fuzzer::SkipRejectedPrefix(const uint8_t *Data, size_t Size,
+                                Digest128 *Prefix) {
+  *Prefix = Digest128{0, 0};
+  if (Options.DiffRejectCache <= 0) return false;
+  size_t PrefixSize = EF->LLVMFuzzerCustomInputPrefix(Data, Size);
+  if (!PrefixSize) return false;
+  *Prefix = Hash128(Data, Min(PrefixSize, Size));
+  if (!RejectedPrefixes.Contains(*Prefix)) return false;
+  NumberOfRejectCacheHits++;
+  if (!MD.GetRand()(Options.DiffRejectCache)) return false;
+  NumberOfRejectCacheSkips++;
+  return true;
+}
+
+// Remembers Prefix if the run of its input taught nothing: every callback
+// returned the same rejecting result and no new unit was added. Otherwise
+// the prefix does not decide the verdict and is forgotten.
+void Fuzzer::LearnRejectedPrefix(Digest128 Prefix, bool NewUnit) {
+  if (Prefix == Digest128{0, 0}) return;
+  const std::vector<int> &Results = TPC.OutputDiffVec;
+  bool Uniform = !Results.empty() && DiffVerdict(Results[0]) &&
+                 std::all_of(Results.begin(), Results.end(),
+                             [&](int R) { return R == Results[0]; });
+  if (Uniform && !NewUnit)
+    RejectedPrefixes.Insert(Prefix);
+  else
+    RejectedPrefixes.Erase(Prefix);
+}
+
+bool Fuzzer::IsDuplicateMutant(const uint8_t *Data, size_t Size) {
+  if (Options.DedupMutants <= 0) return false;
+  TraceScope<> Scope(Trace, TS_DedupHash);
+  if (hashMap.Insert(Hash128(Data, Size))) return false;
+  NumberOfDuplicate++;
+  if (!MD.TracksMutants()) return Options.DedupMutants >= 2;
+  MD.RecordDuplicateMutant();
+  if (Options.DedupMutants < 2) return false;
+  // The mutators that make the next mutant out of this one are not to blame.
+  MD.TakeMutantOrigin();
+  return true;
+}
+
+// What running a mutant found, given the corpus counters from before.
+MutationDispatcher::MutantOutcome
+Fuzzer::MutantOutcomeOf(bool NewUnit, size_t NumFeaturesBefore,
+                        size_t NumDiffClassesBefore, double Seconds) {
+  MutationDispatcher::MutantOutcome O;
+  O.Seconds = Seconds;
+  O.NewFeatures = Corpus.NumFeatures() - NumFeaturesBefore;
+  O.NewUnit = NewUnit;
+  O.NewDiff = NewUnit && UnitHadOutputDiff;
+  O.NewDiffClass = Corpus.NumDiffClasses() != NumDiffClassesBefore;
+  return O;
+}
+
 void Fuzzer::MutateAndTestOne() {
   MD.StartMutationSequence();
 
   auto &II = Corpus.ChooseUnitToMutate(MD.GetRand());
-  const auto &U = II.U;
+  UnitRef U = Corpus.UnitOf(II);
   memcpy(BaseSha1, II.Sha1, sizeof(BaseSha1));
   assert(CurrentUnitData);
   size_t Size = U.size();
   assert(Size <= MaxInputLen && "Oversized Unit");
-  memcpy(CurrentUnitData, U.data(), Size);
+  // The corpus may move or replace U while its mutants run, so the mutants
+  // and the -diff_pack records of their lineage refer to this copy:
+  // BaseUnitData plus MD's mutation sequence gives the current mutant.
+  memcpy(BaseUnitData, U.data(), Size);
+  memcpy(CurrentUnitData, BaseUnitData, Size);
+  DiffParentData = BaseUnitData;
+  DiffParentSize = Size;
+  if (Options.DiffInputToState && Options.DifferentialMode &&
+      !II.InputToStateDone && !DiffForkServer.IsRunning())
+    RunInputToState(&II, BaseUnitData, Size);
 
   assert(MaxMutationLen > 0);
-  uint8_t *PreviousUnit = new uint8_t[MaxInputLen];
-  size_t PreviousSize = 0;
-
-  size_t CurrentMaxMutationLen =
-      Options.ExperimentalLenControl
-          ? ComputeMutationLen(Corpus.MaxInputSize(), MaxMutationLen,
-                               MD.GetRand())
-          : MaxMutationLen;
 
-  for (int i = 0; i < Options.MutateDepth; i++) {
-    if (TotalNumberOfRuns >= Options.MaxNumberOfRuns)
+  size_t CurrentMaxMutationLen = MaxMutationLen;
+  if (Options.LenControl > 0)
+    CurrentMaxMutationLen = LenControlMaxMutationLen();
+  else if (Options.ExperimentalLenControl)
+    CurrentMaxMutationLen = ComputeMutationLen(Corpus.MaxInputSize(),
+                                               MaxMutationLen, MD.GetRand());
+
+  int Depth = Options.AdaptiveDepth ? AdaptiveMutateDepth(II)
+                                     : Options.MutateDepth;
+  NumberOfMutatedUnits++;
+  for (int i = 0; i < Depth; i++) {
+    if (TotalNumberOfRuns + Batch.size() >= Options.MaxNumberOfRuns)
       break;
     
       
     size_t NewSize = 0;
+    size_t NumDuplicateRetries = 0;
+    auto MutateStart = steady_clock::now();
     
-    do{
-	
-	memcpy(PreviousUnit, CurrentUnitData, Size);
-    	PreviousSize = Size;  
-
-	NewSize = MD.Mutate(CurrentUnitData, Size, CurrentMaxMutationLen);
-	uint8_t Hash[kSHA1NumBytes];
-        ComputeSHA1((uint8_t *)(CurrentUnitData), NewSize, Hash);
-	std::string tmp(Hash,Hash+kSHA1NumBytes);
-	if(hashMap.count(tmp) > 0)
-	{	
-		NumberOfDuplicate++;
-		continue;
+    while (true) {
+	{
+		TraceScope<> Scope(Trace, TS_Mutate);
+		NewSize = MD.Mutate(CurrentUnitData, Size, CurrentMaxMutationLen);
 	}
-	hashMap[tmp] = true;
-	
-    }while(NewSize > CurrentMaxMutationLen);
+	if (NewSize > CurrentMaxMutationLen)
+		continue;
+	if (IsDuplicateMutant(CurrentUnitData, NewSize) &&
+	    NumDuplicateRetries++ < kMaxDuplicateMutantRetries)
+		continue;
+	break;
+    }
     
+    if (Metrics.IsRunning())
+      MutateSeconds +=
+          duration<double>(steady_clock::now() - MutateStart).count();
     assert(NewSize > 0 && "Mutator returned empty unit");
     assert(NewSize <= CurrentMaxMutationLen && "Mutator return overisized unit");
     Size = NewSize;
     II.NumExecutedMutations++;
-    if (RunOne(CurrentUnitData, Size, /*MayDeleteFile=*/true, &II)) {
-	ReportNewCoverage(&II, {CurrentUnitData, CurrentUnitData + Size});
-      if (UnitHadOutputDiff) {	
-        
-        uint8_t Hash[kSHA1NumBytes];
-        ComputeSHA1((uint8_t *)(CurrentUnitData), Size, Hash);
-        std::string s = Sha1ToString(Hash) + "_BeforeMutationWas_";
-        WriteUnitToFileWithPrefix({PreviousUnit, PreviousUnit + PreviousSize},
-                                  s.c_str());
-      }
+    NumberOfMutations++;
+    if (Options.DifferentialMode &&
+        (Options.DiffBatchSize > 0 || Options.DiffCoverageWindow > 1)) {
+      Batch.push_back({CurrentUnitData, CurrentUnitData + Size});
+      if (DiffArtifacts.IsOpen())
+        BatchMutationSequences.push_back(MD.MutationSequenceString());
+      if (MD.TracksMutants())
+        BatchMutantOrigins.push_back(MD.TakeMutantOrigin());
+      if (Batch.size() >= static_cast<size_t>(Options.DiffBatchSize > 0
+                                                  ? Options.DiffBatchSize
+                                                  : Options.DiffCoverageWindow))
+        RunPendingMutants(&II);
+      continue;
+    }
+    auto ExecuteStart = steady_clock::now();
+    bool TracksMutants = MD.TracksMutants();
+    MutationDispatcher::MutantOrigin Origin;
+    if (TracksMutants)
+      Origin = MD.TakeMutantOrigin();
+    Digest128 Prefix;
+    if (SkipRejectedPrefix(CurrentUnitData, Size, &Prefix))
+      continue;
+    size_t NumFeaturesBefore = Corpus.NumFeatures();
+    size_t NumDiffClassesBefore = Corpus.NumDiffClasses();
+    bool NewUnit = RunOne(CurrentUnitData, Size, /*MayDeleteFile=*/true, &II);
+    LearnRejectedPrefix(Prefix, NewUnit);
+    if (NewUnit)
+      ReportNewMutant(&II, {CurrentUnitData, CurrentUnitData + Size});
+    if (NewUnit && Options.AdaptiveDepth)
+      Depth = Min(Depth + Options.MutateDepth,
+                  kMaxMutateDepthFactor * Options.MutateDepth);
+    if (Metrics.IsRunning() || TracksMutants) {
+      double Seconds =
+          duration<double>(steady_clock::now() - ExecuteStart).count();
+      ExecuteSeconds += Seconds;
+      if (TracksMutants)
+        MD.RecordMutantOutcome(
+            Origin, MutantOutcomeOf(NewUnit, NumFeaturesBefore,
+                                    NumDiffClassesBefore, Seconds));
     }
 
     TryDetectingAMemoryLeak(CurrentUnitData, Size,
                             /*DuringInitialCorpusExecution*/ false);
   }
-  delete [] PreviousUnit;
+  if (!Batch.empty())
+    RunPendingMutants(&II);
+  DiffParentData = nullptr;
+}
+
+// -adaptive_depth: the number of mutations MutateAndTestOne() starts with on
+// II, -mutate_depth scaled by how the yield of II compares to that of an
+// average unit, with the mutations so far spread evenly over the corpus: an
+// average unit gets -mutate_depth and an exhausted one a single mutation.
+// A unit not mutated yet counts as one in 64 of its mutations finding
+// something, better than most, so it starts deep.
+int Fuzzer::AdaptiveMutateDepth(const InputInfo &II) const {
+  double N = std::max<size_t>(Corpus.NumActiveUnits(), 1);
+  double Ratio = InputCorpus::MutationYield(II) /
+                 InputCorpus::MutationYield(NumberOfSuccessfulMutations / N,
+                                            NumberOfDiffMutations / N,
+                                            NumberOfMutations / N);
+  double Depth = Options.MutateDepth * Ratio;
+  return static_cast<int>(std::max(
+      1.0, std::min(Depth + 0.5, static_cast<double>(kMaxMutateDepthFactor *
+                                                     Options.MutateDepth))));
+}
+
+// -mutate_pipeline: sends the producer the units that joined the corpus,
+// then runs as many of its mutants as MutateAndTestOne() would make.
+void Fuzzer::RunPipelinedMutants() {
+  for (; PipelineSynced < Corpus.size(); PipelineSynced++) {
+    const InputInfo &II = Corpus.Input(PipelineSynced);
+    if (II.Size)
+      Pipeline.AddUnit(Corpus.UnitOf(II), PipelineSynced, II.NumFeatures,
+                       II.TargetDistance);
+  }
+  size_t CurrentMaxMutationLen = MaxMutationLen;
+  if (Options.LenControl > 0)
+    CurrentMaxMutationLen = LenControlMaxMutationLen();
+  else if (Options.ExperimentalLenControl)
+    CurrentMaxMutationLen = ComputeMutationLen(Corpus.MaxInputSize(),
+                                               MaxMutationLen, MD.GetRand());
+  Pipeline.SetMaxMutationLen(CurrentMaxMutationLen);
+
+  for (int i = 0; i < Options.MutateDepth; i++) {
+    if (TotalNumberOfRuns >= Options.MaxNumberOfRuns)
+      break;
+    auto WaitStart = steady_clock::now();
+    auto *M = Pipeline.Take();
+    if (Metrics.IsRunning())
+      MutateSeconds +=
+          duration<double>(steady_clock::now() - WaitStart).count();
+    // The unit may have been replaced or evicted since the producer copied
+    // it; M->Parent is what the mutant was made from.
+    InputInfo &II = Corpus.Input(M->ParentIdx);
+    memcpy(BaseSha1, II.Sha1, sizeof(BaseSha1));
+    size_t Size = M->Data.size();
+    memcpy(CurrentUnitData, M->Data.data(), Size);
+    // The producer filters with a copy of hashMap; this one is what
+    // -diff_checkpoint saves.
+    if (Options.DedupMutants > 0)
+      hashMap.Insert(Hash128(CurrentUnitData, Size));
+    DiffParentData = M->Parent.data();
+    DiffParentSize = M->Parent.size();
+    DiffParentSequence = M->Sequence.empty() ? nullptr : &M->Sequence;
+    II.NumExecutedMutations++;
+    NumberOfMutations++;
+    auto ExecuteStart = steady_clock::now();
+    Digest128 Prefix;
+    if (!SkipRejectedPrefix(CurrentUnitData, Size, &Prefix)) {
+      size_t NumFeaturesBefore = Corpus.NumFeatures();
+      size_t NumDiffClassesBefore = Corpus.NumDiffClasses();
+      bool NewUnit = RunOne(CurrentUnitData, Size, /*MayDeleteFile=*/true, &II);
+      LearnRejectedPrefix(Prefix, NewUnit);
+      if (NewUnit)
+        ReportNewMutant(&II, {CurrentUnitData, CurrentUnitData + Size});
+      if (Metrics.IsRunning() || M->Tracked) {
+        double Seconds =
+            duration<double>(steady_clock::now() - ExecuteStart).count();
+        ExecuteSeconds += Seconds;
+        if (M->Tracked)
+          Pipeline.SendOutcome(
+              M->Origin, MutantOutcomeOf(NewUnit, NumFeaturesBefore,
+                                         NumDiffClassesBefore, Seconds));
+      }
+      TryDetectingAMemoryLeak(CurrentUnitData, Size,
+                              /*DuringInitialCorpusExecution*/ false);
+    }
+    Pipeline.Pop();
+  }
+  DiffParentData = nullptr;
+  DiffParentSequence = nullptr;
 }
 
 void Fuzzer::Loop() {
@@ -819,6 +3366,14 @@ void Fuzzer::Loop() {
   if (Options.DoCrossOver)
     MD.SetCorpus(&Corpus);
   
+  if (Options.MutatePipeline > 0) {
+    Pipeline.Start(Options, MD.GetRand().Split(), MD, hashMap, MaxInputLen,
+                   Options.Verbosity || DiffArtifacts.IsOpen());
+    if (Options.Verbosity)
+      Printf("INFO: mutating on a producer thread, up to %d mutants ahead\n",
+             Options.MutatePipeline);
+  }
+
   srand((int)time(0));
   while (true) {
     auto Now = system_clock::now();
@@ -830,12 +3385,31 @@ void Fuzzer::Loop() {
     if (TotalNumberOfRuns >= Options.MaxNumberOfRuns)
       break;
     if (TimedOut()) break;
+    if (Options.DiffStopAfterClasses &&
+        Corpus.NumDiffClasses() >=
+            static_cast<size_t>(Options.DiffStopAfterClasses))
+      break;
+    RunSharedUnits();
     // Perform several mutations and runs.
-    MutateAndTestOne();
+    if (Pipeline.IsRunning())
+      RunPipelinedMutants();
+    else
+      MutateAndTestOne();
+    MaybePublishMetrics();
+    MaybeRunControlCommands();
+    MaybeEnforceCallbackMemoryLimits();
+    MaybeSaveDiffCheckpoint();
+    MaybeUpdateRareEdgeBoosts();
+    MaybeUpdateCostWeights();
   }
 
+  Pipeline.Stop();
+  CheckLeakSuspects(/*DuringInitialCorpusExecution*/ false);
+  DrainEquivalenceServers();
+  Sync.Stop();
+  SaveDiffCheckpoint();
   PrintStats("DONE  ", "\n");
-  MD.PrintRecommendedDictionary();
+  (Pipeline.GetMD() ? *Pipeline.GetMD() : MD).PrintRecommendedDictionary();
 }
 
 void Fuzzer::MinimizeCrashLoop(const Unit &U) {
@@ -855,26 +3429,216 @@ void Fuzzer::MinimizeCrashLoop(const Unit &U) {
 }
 
 void Fuzzer::AnnounceOutput(const uint8_t *Data, size_t Size) {
-  if (SMR.IsServer()) {
-    SMR.WriteByteArray(Data, Size);
-  } else if (SMR.IsClient()) {
-    SMR.PostClient();
-    SMR.WaitServer();
-    size_t OtherSize = SMR.ReadByteArraySize();
-    uint8_t *OtherData = SMR.GetByteArray();
-    if (Size != OtherSize || memcmp(Data, OtherData, Size) != 0) {
-      size_t i = 0;
-      for (i = 0; i < Min(Size, OtherSize); i++)
-        if (Data[i] != OtherData[i])
-          break;
-      Printf("==%lu== ERROR: libFuzzer: equivalence-mismatch. Sizes: %zd %zd; "
-             "offset %zd\n", GetPid(), Size, OtherSize, i);
-      DumpCurrentUnit("mismatch-");
-      Printf("SUMMARY: libFuzzer: equivalence-mismatch\n");
-      PrintFinalStats();
-      _Exit(Options.ErrorExitCode);
+  for (auto &R : EquivalenceRings)
+    R->Announce(Data, Size);
+}
+
+int Fuzzer::RunEquivalenceServer(const char *Name, size_t NumSlots) {
+  std::unique_ptr<EquivalenceRing> R(new EquivalenceRing);
+  if (!R->Create(Name, NumSlots)) {
+    Printf("ERROR: can't create shared memory region\n");
+    return 1;
+  }
+  EquivalenceRings.push_back(std::move(R));
+  Printf("INFO: EQUIVALENCE SERVER UP\n");
+  EquivalenceRings[0]->Serve([this](const uint8_t *Data, size_t Size) {
+    ExecuteCallback(Data, Size);
+  });
+  return 0;
+}
+
+bool Fuzzer::ConnectToEquivalenceServer(const char *Name) {
+  std::unique_ptr<EquivalenceRing> R(new EquivalenceRing);
+  if (!R->Open(Name)) return false;
+  EquivalenceRings.push_back(std::move(R));
+  return true;
+}
+
+void Fuzzer::BeginEquivalenceInput(const uint8_t *Data, size_t Size) {
+  for (auto &R : EquivalenceRings)
+    if (R->IsClient())
+      R->BeginInput(Data, Size);
+}
+
+void Fuzzer::EndEquivalenceInput() {
+  for (auto &R : EquivalenceRings)
+    if (R->IsClient())
+      R->EndInput();
+  CheckEquivalence();
+}
+
+void Fuzzer::DrainEquivalenceServers() {
+  for (auto &R : EquivalenceRings)
+    if (R->IsClient())
+      R->Drain();
+  CheckEquivalence();
+}
+
+// The servers report mismatches some inputs late, so the input is the one
+// kept in the ring rather than the current unit.
+void Fuzzer::CheckEquivalence() {
+  EquivalenceRing::Mismatch M;
+  for (size_t i = 0; i < EquivalenceRings.size(); i++) {
+    if (!EquivalenceRings[i]->TakeMismatch(&M)) continue;
+    Printf("==%lu== ERROR: libFuzzer: equivalence-mismatch with server %zd. "
+           "Sizes: %zd %zd; offset %zd\n",
+           GetPid(), i, M.Size, M.OtherSize, M.Offset);
+    if (M.Input.size() <= kMaxUnitSizeToPrint) {
+      PrintHexArray(M.Input.data(), M.Input.size(), "\n");
+      PrintASCII(M.Input.data(), M.Input.size(), "\n");
+    }
+    WriteUnitToFileWithPrefix(M.Input, "mismatch-");
+    Printf("SUMMARY: libFuzzer: equivalence-mismatch\n");
+    PrintFinalStats();
+    _Exit(Options.ErrorExitCode);
+  }
+}
+
+// Gives the fuzzer the time to start its workers, say, from a script.
+static const int kRemoteAttachTimeoutSec = 60;
+
+template <size_t Idx>
+static int RemoteCallbackProxy(const uint8_t *Data, size_t Size) {
+  return F->RunRemoteCallback(Idx, Data, Size);
+}
+
+static UserCallback RemoteCallbackProxies[RemoteWorkers::kMaxWorkers] = {
+    RemoteCallbackProxy<0>,  RemoteCallbackProxy<1>,  RemoteCallbackProxy<2>,
+    RemoteCallbackProxy<3>,  RemoteCallbackProxy<4>,  RemoteCallbackProxy<5>,
+    RemoteCallbackProxy<6>,  RemoteCallbackProxy<7>,  RemoteCallbackProxy<8>,
+    RemoteCallbackProxy<9>,  RemoteCallbackProxy<10>, RemoteCallbackProxy<11>,
+    RemoteCallbackProxy<12>, RemoteCallbackProxy<13>, RemoteCallbackProxy<14>,
+    RemoteCallbackProxy<15>};
+
+void Fuzzer::StaticStopRemoteWorkers() {
+  assert(F);
+  F->Remote.Stop();
+}
+
+// Sets up the traces of -diff_hw_trace=IDX:LIBRARY[,IDX:LIBRARY...] and
+// reserves the guards their counters go to.
+void Fuzzer::StartHardwareTrace() {
+  std::istringstream ISS(Options.DiffHwTrace);
+  std::string Entry;
+  while (std::getline(ISS, Entry, ',')) {
+    size_t Colon = Entry.find(':');
+    char *End = nullptr;
+    long Idx = strtol(Entry.c_str(), &End, 10);
+    if (Colon == std::string::npos || Colon == 0 ||
+        End != Entry.c_str() + Colon || Idx < 0 || Idx >= TPC.UC->size ||
+        Colon + 1 == Entry.size()) {
+      Printf("ERROR: -diff_hw_trace: bad entry '%s', expected IDX:LIBRARY "
+             "with IDX below %d\n", Entry.c_str(), TPC.UC->size);
+      exit(1);
     }
+    if (!HwTrace.Add(Idx, Entry.substr(Colon + 1), kHwTraceGuards))
+      exit(1);
+  }
+  TPC.AddTracedCallbackGuards(HwTrace.TracedCallbacks(TPC.UC->size),
+                              kHwTraceGuards);
+}
+
+// Waits for the workers, then reserves a guard range for the coverage of
+// each and makes their proxies the differential callbacks.
+void Fuzzer::StartRemoteWorkers() {
+  size_t N = Options.DiffRemoteWorkers;
+  const char *Name = Options.DiffRemote.c_str();
+  if (N < 1 || N > RemoteWorkers::kMaxWorkers) {
+    Printf("ERROR: -diff_remote requires -diff_remote_workers between 1 and "
+           "%zd\n", RemoteWorkers::kMaxWorkers);
+    exit(1);
+  }
+  if (!Remote.Create(Name, N)) {
+    Printf("ERROR: can't create shared memory region %s\n", Name);
+    exit(1);
+  }
+  Printf("INFO: waiting for %zd remote workers on %s\n", N, Name);
+  if (!Remote.WaitForWorkers(kRemoteAttachTimeoutSec)) {
+    Printf("ERROR: not all remote workers attached within %d seconds\n",
+           kRemoteAttachTimeoutSec);
+    exit(1);
+  }
+  for (size_t W = 0; W < N; W++)
+    TPC.AddRemoteCallbackGuards(Remote.NumGuards(W));
+  RemoteUC.callbacks = RemoteCallbackProxies;
+  RemoteUC.size = N;
+  atexit(StaticStopRemoteWorkers);
+  Printf("INFO: %zd REMOTE WORKERS UP\n", N);
+}
+
+void Fuzzer::TakeRemoteReplies() {
+  size_t Dead;
+  if (!Remote.WaitOldest(&Dead)) {
+    // The worker has reported the crash or timeout in its own log.
+    Printf("==%lu== ERROR: libFuzzer: remote worker %zd died\n", GetPid(),
+           Dead);
+    WriteUnitToFileWithPrefix(Remote.OldestInput(), "crash-");
+    Printf("SUMMARY: libFuzzer: remote worker died\n");
+    PrintFinalStats();
+    _Exit(Options.ErrorExitCode);
+  }
+  for (size_t W = 0; W < Remote.size(); W++) {
+    size_t Size;
+    const uint8_t *Coverage = Remote.Coverage(W, &Size);
+    TPC.ImportCoverage(Coverage, Size, TPC.CallbackGuards(W));
+    TPC.OutputDiffVec[W] = Remote.Result(W);
+    CallbackNanos[W] = Remote.Nanos(W);
+  }
+  Remote.PopOldest();
+}
+
+// Every worker runs every input, so the proxies are only used outside of
+// RunOne and RunBatch, where inputs are not pipelined.
+int Fuzzer::RunRemoteCallback(size_t Idx, const uint8_t *Data, size_t Size) {
+  assert(!Remote.NumPending());
+  Remote.Submit(Data, Size);
+  size_t Dead;
+  if (!Remote.WaitOldest(&Dead)) {
+    Printf("==%lu== ERROR: libFuzzer: remote worker %zd died\n", GetPid(),
+           Dead);
+    DumpCurrentUnit("crash-");
+    PrintFinalStats();
+    _Exit(Options.ErrorExitCode);
+  }
+  size_t CoverageSize;
+  const uint8_t *Coverage = Remote.Coverage(Idx, &CoverageSize);
+  TPC.ImportCoverage(Coverage, CoverageSize, TPC.CallbackGuards(Idx));
+  int Res = Remote.Result(Idx);
+  Remote.PopOldest();
+  return Res;
+}
+
+int Fuzzer::RunRemoteWorker(const char *Name, size_t Idx, size_t Callback) {
+  if (Callback >= static_cast<size_t>(TPC.UC->size)) {
+    Printf("ERROR: -diff_remote_callback=%zd, but there are %d callbacks\n",
+           Callback, TPC.UC->size);
+    return 1;
   }
+  // The coverage of the callback's module, or all of it if the callback
+  // shares a module with others.
+  auto R = TPC.CallbackGuards(Callback);
+  if (R.Begin == R.End)
+    R = {0, TPC.GetNumPCs()};
+  if (!Remote.Attach(Name, Idx, R.End - R.Begin)) {
+    Printf("ERROR: can't attach to shared memory region %s as worker %zd\n",
+           Name, Idx);
+    return 1;
+  }
+  // Crash reports show the input of the fuzzer.
+  if (MaxInputLen == 0)
+    MaxInputLen = MaxMutationLen = RemoteWorkers::kMaxInputSize;
+  AllocateCurrentUnitData();
+  CB = TPC.UC->callbacks[Callback];
+  TPC.SelectValueProfileMap(Callback);
+  Printf("INFO: REMOTE WORKER %zd UP (callback %zd)\n", Idx, Callback);
+  Remote.Serve([&](const uint8_t *Data, size_t Size, int *Result,
+                   uint64_t *Nanos, uint8_t *Out, size_t MaxOutSize) {
+    TPC.ResetCoverage();
+    *Result = ExecuteCallback(Data, Size);
+    *Nanos = duration_cast<nanoseconds>(UnitStopTime - UnitStartTime).count();
+    return TPC.ExportCoverage(Out, MaxOutSize, R);
+  });
+  return 0;
 }
 
 } // namespace fuzzer
@@ -883,6 +3647,8 @@ extern "C" {
 
 size_t LLVMFuzzerMutate(uint8_t *Data, size_t Size, size_t MaxSize) {
   assert(fuzzer::F);
+  if (auto *MD = fuzzer::MutationPipeline::ThreadMD())
+    return MD->DefaultMutate(Data, Size, MaxSize);
   return fuzzer::F->GetMD().DefaultMutate(Data, Size, MaxSize);
 }
 
@@ -15,16 +15,19 @@
 #include "FuzzerTracePC.h"
 #include "FuzzerUtil.h"
 
+#include <atomic>
 #include <fstream>
 #include <iterator>
+#include <map>
 #include <set>
 #include <sstream>
+#include <thread>
 
 namespace fuzzer {
 
 bool Merger::Parse(const std::string &Str, bool ParseCoverage) {
-  std::istringstream SS(Str);
-  return Parse(SS, ParseCoverage);
+  return Parse(reinterpret_cast<const uint8_t *>(Str.data()), Str.size(),
+               ParseCoverage);
 }
 
 void Merger::ParseOrExit(std::istream &IS, bool ParseCoverage) {
@@ -34,6 +37,195 @@ void Merger::ParseOrExit(std::istream &IS, bool ParseCoverage) {
   }
 }
 
+void Merger::ParseFileOrExit(const std::string &Path, bool ParseCoverage) {
+  size_t Size = 0;
+  const uint8_t *Data = MapFile(Path, &Size);
+  bool Ok = Parse(Data, Size, ParseCoverage);
+  UnmapFile(Data, Size);
+  if (!Ok) {
+    Printf("MERGE: failed to parse the control file (unexpected error)\n");
+    exit(1);
+  }
+}
+
+// The binary control file example, for the text one below:
+//
+// LIBFUZZER_MERGE_CONTROL 1
+// 3
+// 1
+// file0
+// file1
+// file2
+// <records>
+//
+// Every record is a tag byte ('S', 'D' or 'R' for STARTED, DONE and RESULTS),
+// the FileID and the size of the payload, both as LEB128 varints, and the
+// payload: the file size, the features as deltas from the previous one, or
+// the zigzag-encoded return codes, all of them varints.
+static const char *kBinaryControlMagic = "LIBFUZZER_MERGE_CONTROL 1";
+
+static void AppendVarint(std::string *Out, uint64_t V) {
+  for (; V >= 0x80; V >>= 7)
+    Out->push_back(static_cast<char>(V | 0x80));
+  Out->push_back(static_cast<char>(V));
+}
+
+static bool ReadVarint(const uint8_t **P, const uint8_t *End, uint64_t *V) {
+  *V = 0;
+  for (int Shift = 0; *P < End && Shift < 64; Shift += 7) {
+    uint8_t B = *(*P)++;
+    *V |= static_cast<uint64_t>(B & 0x7f) << Shift;
+    if (!(B & 0x80)) return true;
+  }
+  return false;
+}
+
+static void AppendRecord(std::string *Out, char Tag, size_t Idx,
+                         const std::string &Payload) {
+  Out->push_back(Tag);
+  AppendVarint(Out, Idx);
+  AppendVarint(Out, Payload.size());
+  Out->append(Payload);
+}
+
+void Merger::AppendStarted(std::string *Out, bool Binary, size_t Idx,
+                           size_t Size) {
+  if (!Binary) {
+    *Out += "STARTED " + std::to_string(Idx) + " " + std::to_string(Size) +
+            "\n";
+    return;
+  }
+  std::string Payload;
+  AppendVarint(&Payload, Size);
+  AppendRecord(Out, 'S', Idx, Payload);
+}
+
+void Merger::AppendDone(std::string *Out, bool Binary, size_t Idx,
+                        const std::set<size_t> &Features) {
+  if (!Binary) {
+    std::ostringstream OS;
+    OS << "DONE " << Idx;
+    for (size_t F : Features)
+      OS << " " << std::hex << F;
+    OS << "\n";
+    *Out += OS.str();
+    return;
+  }
+  std::string Payload;
+  size_t Prev = 0;
+  for (size_t F : Features) {
+    AppendVarint(&Payload, F - Prev);
+    Prev = F;
+  }
+  AppendRecord(Out, 'D', Idx, Payload);
+}
+
+void Merger::AppendResults(std::string *Out, bool Binary, size_t Idx,
+                           const std::vector<int> &Results) {
+  if (!Binary) {
+    *Out += "RESULTS " + std::to_string(Idx);
+    for (int Ret : Results)
+      *Out += " " + std::to_string(Ret);
+    *Out += "\n";
+    return;
+  }
+  std::string Payload;
+  for (int Ret : Results)
+    AppendVarint(&Payload, (static_cast<uint32_t>(Ret) << 1) ^
+                               static_cast<uint32_t>(Ret >> 31));
+  AppendRecord(Out, 'R', Idx, Payload);
+}
+
+bool Merger::Parse(const uint8_t *Data, size_t Size, bool ParseCoverage) {
+  size_t MagicLen = strlen(kBinaryControlMagic);
+  if (Size <= MagicLen || memcmp(Data, kBinaryControlMagic, MagicLen) ||
+      Data[MagicLen] != '\n') {
+    std::istringstream SS(std::string(Data, Data + Size));
+    Binary = false;
+    ParsedSize = Size;
+    TornSize = 0;
+    return Parse(SS, ParseCoverage);
+  }
+  LastFailure.clear();
+  Binary = true;
+  const uint8_t *P = Data + MagicLen + 1, *End = Data + Size;
+  auto NextLine = [&](std::string *Line) {
+    auto *NL = static_cast<const uint8_t *>(memchr(P, '\n', End - P));
+    if (!NL) return false;
+    Line->assign(P, NL);
+    P = NL + 1;
+    return true;
+  };
+  std::string Line;
+  if (!NextLine(&Line)) return false;
+  size_t NumFiles = strtoull(Line.c_str(), nullptr, 10);
+  if (NumFiles == 0 || NumFiles > 10000000) return false;
+  if (!NextLine(&Line)) return false;
+  NumFilesInFirstCorpus = strtoull(Line.c_str(), nullptr, 10);
+  if (NumFilesInFirstCorpus > NumFiles) return false;
+  Files.resize(NumFiles);
+  for (size_t i = 0; i < NumFiles; i++)
+    if (!NextLine(&Files[i].Name))
+      return false;
+
+  size_t ExpectedStartMarker = 0;
+  const size_t kInvalidStartMarker = -1;
+  size_t LastSeenStartMarker = kInvalidStartMarker;
+  while (P < End) {
+    const uint8_t *Record = P;
+    uint8_t Tag = *P++;
+    uint64_t N, Len;
+    if (!ReadVarint(&P, End, &N) || !ReadVarint(&P, End, &Len) ||
+        Len > static_cast<size_t>(End - P)) {
+      P = Record;  // Torn by a crash while it was written.
+      break;
+    }
+    const uint8_t *Payload = P, *PayloadEnd = P + Len;
+    P = PayloadEnd;
+    uint64_t V;
+    if (Tag == 'S') {
+      if (ExpectedStartMarker != N ||
+          !ReadVarint(&Payload, PayloadEnd, &V))
+        return false;
+      Files[ExpectedStartMarker].Size = V;
+      LastSeenStartMarker = ExpectedStartMarker;
+      ExpectedStartMarker++;
+    } else if (Tag == 'D') {
+      if (N != LastSeenStartMarker)
+        return false;
+      LastSeenStartMarker = kInvalidStartMarker;
+      if (!ParseCoverage) continue;
+      auto &Features = Files[N].Features;
+      Features.clear();
+      uint64_t Feature = 0;
+      while (Payload < PayloadEnd) {
+        if (!ReadVarint(&Payload, PayloadEnd, &V)) return false;
+        Feature += V;
+        Features.push_back(static_cast<uint32_t>(Feature));
+      }
+    } else if (Tag == 'R') {
+      if (N >= ExpectedStartMarker)
+        return false;
+      if (!ParseCoverage) continue;
+      auto &Results = Files[N].Results;
+      Results.clear();
+      while (Payload < PayloadEnd) {
+        if (!ReadVarint(&Payload, PayloadEnd, &V)) return false;
+        uint32_t Z = static_cast<uint32_t>(V);
+        Results.push_back(static_cast<int>((Z >> 1) ^ (0U - (Z & 1))));
+      }
+    } else {
+      return false;
+    }
+  }
+  if (LastSeenStartMarker != kInvalidStartMarker)
+    LastFailure = Files[LastSeenStartMarker].Name;
+  FirstNotProcessedFile = ExpectedStartMarker;
+  ParsedSize = P - Data;
+  TornSize = End - P;
+  return true;
+}
+
 // The control file example:
 //
 // 3 # The number of inputs
@@ -46,6 +238,7 @@ void Merger::ParseOrExit(std::istream &IS, bool ParseCoverage) {
 // STARTED 1 456  # If DONE is missing, the input crashed while processing.
 // STARTED 2 567
 // DONE 2 8 9
+// RESULTS 2 0 1 1  # FileID RET1 RET2 ..., only in diff mode
 bool Merger::Parse(std::istream &IS, bool ParseCoverage) {
   LastFailure.clear();
   std::string Line;
@@ -102,6 +295,17 @@ bool Merger::Parse(std::istream &IS, bool ParseCoverage) {
         std::sort(TmpFeatures.begin(), TmpFeatures.end());
         Files[CurrentFileIdx].Features = TmpFeatures;
       }
+    } else if (Marker == "RESULTS") {
+      // RESULTS FILE_ID RET1 RET2 ...
+      if (N >= ExpectedStartMarker)
+        return false;
+      if (ParseCoverage) {
+        auto &Results = Files[N].Results;
+        Results.clear();
+        int Ret;
+        while (ISS1 >> Ret)
+          Results.push_back(Ret);
+      }
     } else {
       return false;
     }
@@ -168,14 +372,45 @@ size_t Merger::Merge(const std::set<uint32_t> &InitialFeatures,
   return AllFeatures.size() - InitialNumFeatures;
 }
 
-void Merger::PrintSummary(std::ostream &OS) {
+// The version 2 summary example:
+//
+// LIBFUZZER_COVERAGE_SUMMARY 2 3  # Version, number of implementations
+// INPUT 2fd4e1c67a2d28fced849ee1bb76e7391b93eb12 123 dir/file0
+// RESULTS 0 0 1  # Return code of every implementation, only in diff mode
+// FEATURES -1 1a 2b  # Features of no particular implementation
+// FEATURES 0 4c 5d 6e  # Features of implementation 0
+// INPUT ...
+//
+// Sizes and return codes are decimal, features hexadecimal. Version 1 was
+// one "NAME size: SIZE features: F1 F2 ..." line (all in hex) per file.
+static const char *kSummaryMagic = "LIBFUZZER_COVERAGE_SUMMARY";
+static const int kSummaryVersion = 2;
+
+void Merger::PrintSummary(std::ostream &OS, size_t NumImpls,
+                          std::function<int(uint32_t)> ImplOfFeature) {
+  OS << kSummaryMagic << " " << kSummaryVersion << " " << NumImpls << "\n";
+  std::map<int, std::vector<uint32_t>> FeaturesOfImpl;
   for (auto &File : Files) {
-    OS << std::hex;
-    OS << File.Name << " size: " << File.Size << " features: ";
+    OS << std::dec << "INPUT " << File.Sha1 << " " << File.Size << " "
+       << File.Name << "\n";
+    if (!File.Results.empty()) {
+      OS << "RESULTS";
+      for (int Ret : File.Results)
+        OS << " " << Ret;
+      OS << "\n";
+    }
+    FeaturesOfImpl.clear();
     for (auto Feature : File.Features)
-      OS << " " << Feature;
-    OS << "\n";
+      FeaturesOfImpl[ImplOfFeature ? ImplOfFeature(Feature) : -1].push_back(
+          Feature);
+    for (auto &It : FeaturesOfImpl) {
+      OS << std::dec << "FEATURES " << It.first << std::hex;
+      for (auto Feature : It.second)
+        OS << " " << Feature;
+      OS << "\n";
+    }
   }
+  OS << std::dec;
 }
 
 std::set<uint32_t> Merger::AllFeatures() const {
@@ -185,10 +420,55 @@ std::set<uint32_t> Merger::AllFeatures() const {
   return S;
 }
 
-std::set<uint32_t> Merger::ParseSummary(std::istream &IS) {
+std::set<uint32_t> Merger::ParseSummary(std::istream &IS,
+                                        std::vector<MergeFileInfo> *Records) {
   std::string Line, Tmp;
   std::set<uint32_t> Res;
-  while (std::getline(IS, Line, '\n')) {
+  if (!std::getline(IS, Line, '\n'))
+    return Res;
+  if (!Line.compare(0, strlen(kSummaryMagic), kSummaryMagic)) {
+    std::istringstream ISS1(Line);
+    int Version = 0;
+    ISS1 >> Tmp >> Version;
+    if (Version != kSummaryVersion) {
+      Printf("MERGE-OUTER: unsupported coverage summary: %s\n", Line.c_str());
+      exit(1);
+    }
+    MergeFileInfo Cur;
+    auto Flush = [&]() {
+      std::sort(Cur.Features.begin(), Cur.Features.end());
+      if (Records && !Cur.Sha1.empty())
+        Records->push_back(Cur);
+      Cur = MergeFileInfo();
+    };
+    while (std::getline(IS, Line, '\n')) {
+      std::istringstream ISS2(Line);
+      ISS2 >> Tmp;
+      if (Tmp == "INPUT") {
+        Flush();
+        ISS2 >> Cur.Sha1 >> Cur.Size;
+        ISS2.get();  // The space before the name, which may contain spaces.
+        std::getline(ISS2, Cur.Name);
+      } else if (Tmp == "RESULTS") {
+        int Ret;
+        while (ISS2 >> Ret)
+          Cur.Results.push_back(Ret);
+      } else if (Tmp == "FEATURES") {
+        int Impl;
+        uint32_t Feature;
+        ISS2 >> Impl;
+        while (ISS2 >> std::hex >> Feature) {
+          Cur.Features.push_back(Feature);
+          Res.insert(Feature);
+        }
+      } else {
+        assert(0 && "Corrupt summary file");
+      }
+    }
+    Flush();
+    return Res;
+  }
+  do {
     size_t N;
     std::istringstream ISS1(Line);
     ISS1 >> Tmp;  // Name
@@ -200,17 +480,55 @@ std::set<uint32_t> Merger::ParseSummary(std::istream &IS) {
     assert(Tmp == "features:" && "Corrupt summary file");
     while (ISS1 >> std::hex >> N)
       Res.insert(N);
-  }
+  } while (std::getline(IS, Line, '\n'));
   return Res;
 }
 
+// Coverage features stay far below this bit.
+static size_t DiffMergeFeature(Digest128 D) {
+  return (1U << 31) | (D.Lo & 0x7fffffff);
+}
+
+// Runs all differential callbacks on Data and collects the coverage of every
+// library. On top of that, the verdict pattern is a feature, and so is the
+// fingerprint DumpUnitIfDiff tells diffs apart by, so that merging keeps an
+// input for every kind of divergence even if it adds no coverage.
+void Fuzzer::CollectDiffMergeFeatures(const uint8_t *Data, size_t Size,
+                                      std::set<size_t> *Features) {
+  auto Insert = [&](size_t Feature) -> bool {
+    Features->insert(Feature);
+    return true;
+  };
+  TPC.ResetCoverage();
+  if (DiffWorkers.IsRunning() || DiffForkServer.IsRunning()) {
+    if (!ExecuteAllCallbacks(Data, Size)) {
+      std::fill(TPC.OutputDiffVec.begin(), TPC.OutputDiffVec.end(), 0);
+      return;
+    }
+    TPC.CollectFeatures(Insert);
+  } else {
+    for (int i = 0; i < TPC.UC->size; i++) {
+      CB = TPC.UC->callbacks[i];
+      TPC.SelectValueProfileMap(i);
+      TPC.OutputDiffVec[i] = ExecuteCallback(Data, Size);
+      TPC.CollectFeatures(Insert, i);
+    }
+    TPC.SelectValueProfileMap(0);
+  }
+  Hasher128 Pattern;
+  for (int Ret : TPC.OutputDiffVec)
+    Pattern.Update(static_cast<uint32_t>(DiffVerdict(Ret)));
+  Features->insert(DiffMergeFeature(Pattern.Final()));
+  TPC.NewOutputDiff_change();
+  if (IsOutputDiff())
+    Features->insert(DiffMergeFeature(DiffFingerprint()));
+}
+
 // Inner process. May crash if the target crashes.
 void Fuzzer::CrashResistantMergeInternalStep(const std::string &CFPath) {
   Printf("MERGE-INNER: using the control file '%s'\n", CFPath.c_str());
   Merger M;
-  std::ifstream IF(CFPath);
-  M.ParseOrExit(IF, false);
-  IF.close();
+  M.ParseFileOrExit(CFPath, false);
   if (!M.LastFailure.empty())
     Printf("MERGE-INNER: '%s' caused a failure at the previous merge step\n",
            M.LastFailure.c_str());
@@ -220,34 +538,48 @@ void Fuzzer::CrashResistantMergeInternalStep(const std::string &CFPath) {
          M.Files.size(), M.FirstNotProcessedFile,
          M.Files.size() - M.FirstNotProcessedFile);
 
-  std::ofstream OF(CFPath, std::ofstream::out | std::ofstream::app);
+  // Records are appended after the last one that is complete.
+  if (M.TornSize && !TruncateFile(CFPath, M.ParsedSize)) {
+    Printf("MERGE-INNER: can't truncate the control file '%s'\n",
+           CFPath.c_str());
+    exit(1);
+  }
+  std::ofstream OF(CFPath, std::ofstream::out | std::ofstream::app |
+                               std::ofstream::binary);
+  std::string Record;
   for (size_t i = M.FirstNotProcessedFile; i < M.Files.size(); i++) {
     auto U = FileToVector(M.Files[i].Name);
     if (U.size() > MaxInputLen) {
       U.resize(MaxInputLen);
       U.shrink_to_fit();
     }
-    std::ostringstream StartedLine;
     // Write the pre-run marker.
-    OF << "STARTED " << std::dec << i << " " << U.size() << "\n";
+    Record.clear();
+    Merger::AppendStarted(&Record, M.Binary, i, U.size());
+    OF.write(Record.data(), Record.size());
     OF.flush();  // Flush is important since ExecuteCommand may crash.
-    // Run.
-    TPC.ResetMaps();
-    ExecuteCallback(U.data(), U.size());
-    // Collect coverage.
     std::set<size_t> Features;
-    TPC.CollectFeatures([&](size_t Feature) -> bool {
-      Features.insert(Feature);
-      return true;
-    });
+    if (Options.DifferentialMode) {
+      CollectDiffMergeFeatures(U.data(), U.size(), &Features);
+    } else {
+      // Run.
+      TPC.ResetMaps();
+      ExecuteCallback(U.data(), U.size());
+      // Collect coverage.
+      TPC.CollectFeatures([&](size_t Feature) -> bool {
+        Features.insert(Feature);
+        return true;
+      });
+    }
     // Show stats.
     if (!(TotalNumberOfRuns & (TotalNumberOfRuns - 1)))
       PrintStats("pulse ");
     // Write the post-run marker and the coverage.
-    OF << "DONE " << i;
-    for (size_t F : Features)
-      OF << " " << std::hex << F;
-    OF << "\n";
+    Record.clear();
+    Merger::AppendDone(&Record, M.Binary, i, Features);
+    if (Options.DifferentialMode)
+      Merger::AppendResults(&Record, M.Binary, i, TPC.OutputDiffVec);
+    OF.write(Record.data(), Record.size());
   }
 }
 
@@ -255,7 +587,8 @@ void Fuzzer::CrashResistantMergeInternalStep(const std::string &CFPath) {
 void Fuzzer::CrashResistantMerge(const std::vector<std::string> &Args,
                                  const std::vector<std::string> &Corpora,
                                  const char *CoverageSummaryInputPathOrNull,
-                                 const char *CoverageSummaryOutputPathOrNull) {
+                                 const char *CoverageSummaryOutputPathOrNull,
+                                 size_t NumShards) {
   if (Corpora.size() <= 1) {
     Printf("Merge requires two or more corpus dirs\n");
     return;
@@ -267,72 +600,154 @@ void Fuzzer::CrashResistantMerge(const std::vector<std::string> &Args,
     ListFilesInDirRecursive(Corpora[i], nullptr, &AllFiles, /*TopDir*/true);
   Printf("MERGE-OUTER: %zd files, %zd in the initial corpus\n",
          AllFiles.size(), NumFilesInFirstCorpus);
-  auto CFPath = DirPlusFile(TmpDir(),
-                       "libFuzzerTemp." + std::to_string(GetPid()) + ".txt");
-  // Write the control file.
-  RemoveFile(CFPath);
-  std::ofstream ControlFile(CFPath);
-  ControlFile << AllFiles.size() << "\n";
-  ControlFile << NumFilesInFirstCorpus << "\n";
-  for (auto &Path: AllFiles)
-    ControlFile << Path << "\n";
-  if (!ControlFile) {
-    Printf("MERGE-OUTER: failed to write to the control file: %s\n",
-           CFPath.c_str());
-    exit(1);
+
+  // Files recorded in a version 2 summary are not executed again.
+  std::set<uint32_t> InitialFeatures;
+  std::vector<MergeFileInfo> Records;
+  if (CoverageSummaryInputPathOrNull) {
+    std::ifstream SummaryIn(CoverageSummaryInputPathOrNull);
+    InitialFeatures = Merger::ParseSummary(SummaryIn, &Records);
+    Printf("MERGE-OUTER: coverage summary loaded from %s, %zd features found\n",
+           CoverageSummaryInputPathOrNull, InitialFeatures.size());
   }
-  ControlFile.close();
+  std::map<std::string, size_t> RecordOfSha1;
+  for (size_t i = 0; i < Records.size(); i++)
+    RecordOfSha1[Records[i].Sha1] = i;
+  std::vector<std::string> Sha1s(AllFiles.size());
+  if (CoverageSummaryInputPathOrNull || CoverageSummaryOutputPathOrNull)
+    for (size_t i = 0; i < AllFiles.size(); i++)
+      Sha1s[i] = Hash(FileToVector(AllFiles[i], MaxInputLen));
+  std::vector<std::string> Files;
+  size_t NumFilesToRunInFirstCorpus = 0;
+  std::vector<MergeFileInfo> KnownFiles[2];  // In the first corpus or not.
+  for (size_t i = 0; i < AllFiles.size(); i++) {
+    bool InFirstCorpus = i < NumFilesInFirstCorpus;
+    auto It = RecordOfSha1.find(Sha1s[i]);
+    if (It != RecordOfSha1.end()) {
+      KnownFiles[!InFirstCorpus].push_back(Records[It->second]);
+      KnownFiles[!InFirstCorpus].back().Name = AllFiles[i];
+      continue;
+    }
+    Files.push_back(AllFiles[i]);
+    NumFilesToRunInFirstCorpus += InFirstCorpus;
+  }
+  if (!Records.empty())
+    Printf("MERGE-OUTER: %zd files found in the summary, %zd to run\n",
+           AllFiles.size() - Files.size(), Files.size());
+
+  // Every shard gets its own control file and inner process, which only has
+  // to restart on the crashes in that shard.
+  NumShards = Files.empty() ? 0 : Min(Max(NumShards, (size_t)1), Files.size());
+  std::vector<std::string> CFPaths(NumShards);
+  std::vector<size_t> ShardBegin(NumShards + 1);
+  for (size_t S = 0; S <= NumShards; S++)
+    ShardBegin[S] = Files.size() * S / Max(NumShards, (size_t)1);
+  for (size_t S = 0; S < NumShards; S++) {
+    CFPaths[S] = DirPlusFile(
+        TmpDir(), "libFuzzerTemp." + std::to_string(GetPid()) +
+                      (NumShards > 1 ? "." + std::to_string(S) : "") + ".txt");
+    // Write the control file.
+    size_t Begin = ShardBegin[S], End = ShardBegin[S + 1];
+    RemoveFile(CFPaths[S]);
+    std::ofstream ControlFile(CFPaths[S]);
+    if (!Options.MergeTextControl)
+      ControlFile << kBinaryControlMagic << "\n";
+    ControlFile << End - Begin << "\n";
+    ControlFile << Min(End, Max(NumFilesToRunInFirstCorpus, Begin)) - Begin
+                << "\n";
+    for (size_t i = Begin; i < End; i++)
+      ControlFile << Files[i] << "\n";
+    if (!ControlFile) {
+      Printf("MERGE-OUTER: failed to write to the control file: %s\n",
+             CFPaths[S].c_str());
+      exit(1);
+    }
+  }
+  if (NumShards > 1)
+    Printf("MERGE-OUTER: merging in %zd shards\n", NumShards);
 
   // Execute the inner process untill it passes.
   // Every inner process should execute at least one input.
   auto BaseCmd = SplitBefore("-ignore_remaining_args=1",
                              CloneArgsWithoutX(Args, "keep-all-flags"));
-  bool Success = false;
-  for (size_t i = 1; i <= AllFiles.size(); i++) {
-    Printf("MERGE-OUTER: attempt %zd\n", i);
-    auto ExitCode = ExecuteCommand(BaseCmd.first + " -merge_control_file=" +
-                                   CFPath + " " + BaseCmd.second);
-    if (!ExitCode) {
-      Printf("MERGE-OUTER: succesfull in %zd attempt(s)\n", i);
-      Success = true;
-      break;
+  std::atomic<size_t> NumFailedShards(0);
+  // The lines of the shards interleave, so they say which shard they are of.
+  auto ShardPrefix = [&](size_t S) {
+    return NumShards > 1 ? "shard " + std::to_string(S) + ": " : "";
+  };
+  auto RunShard = [&](size_t S) {
+    std::string Prefix = ShardPrefix(S);
+    for (size_t i = 1; i <= ShardBegin[S + 1] - ShardBegin[S]; i++) {
+      Printf("MERGE-OUTER: %sattempt %zd\n", Prefix.c_str(), i);
+      auto ExitCode = ExecuteCommand(BaseCmd.first + " -merge_control_file=" +
+                                     CFPaths[S] + " " + BaseCmd.second);
+      if (!ExitCode) {
+        Printf("MERGE-OUTER: %ssuccesfull in %zd attempt(s)\n",
+               Prefix.c_str(), i);
+        return;
+      }
     }
-  }
-  if (!Success) {
+    Printf("MERGE-OUTER: %szero succesfull attempts\n", Prefix.c_str());
+    NumFailedShards++;
+  };
+  std::vector<std::thread> Threads;
+  for (size_t S = 1; S < NumShards; S++)
+    Threads.push_back(std::thread(RunShard, S));
+  if (NumShards)
+    RunShard(0);
+  for (auto &T : Threads)
+    T.join();
+  if (NumFailedShards) {
     Printf("MERGE-OUTER: zero succesfull attempts, exiting\n");
     exit(1);
   }
-  // Read the control file and do the merge.
+  // Read the control files and do the merge. The files of the first corpus
+  // go first, in the order of the shards, and the files known from the
+  // summary after those that were run.
   Merger M;
-  std::ifstream IF(CFPath);
-  IF.seekg(0, IF.end);
-  Printf("MERGE-OUTER: the control file has %zd bytes\n", (size_t)IF.tellg());
-  IF.seekg(0, IF.beg);
-  M.ParseOrExit(IF, true);
-  IF.close();
+  std::vector<MergeFileInfo> OtherFiles;
+  for (size_t S = 0; S < NumShards; S++) {
+    Merger Shard;
+    Shard.ParseFileOrExit(CFPaths[S], true);
+    Printf("MERGE-OUTER: %sthe control file has %zd bytes\n",
+           ShardPrefix(S).c_str(), Shard.ParsedSize);
+    auto FirstOther = Shard.Files.begin() + Shard.NumFilesInFirstCorpus;
+    std::move(Shard.Files.begin(), FirstOther, std::back_inserter(M.Files));
+    std::move(FirstOther, Shard.Files.end(), std::back_inserter(OtherFiles));
+  }
+  std::move(KnownFiles[0].begin(), KnownFiles[0].end(),
+            std::back_inserter(M.Files));
+  M.NumFilesInFirstCorpus = M.Files.size();
+  std::move(OtherFiles.begin(), OtherFiles.end(), std::back_inserter(M.Files));
+  std::move(KnownFiles[1].begin(), KnownFiles[1].end(),
+            std::back_inserter(M.Files));
   Printf("MERGE-OUTER: consumed %zdMb (%zdMb rss) to parse the control file\n",
          M.ApproximateMemoryConsumption() >> 20, GetPeakRSSMb());
   if (CoverageSummaryOutputPathOrNull) {
+    std::map<std::string, std::string> Sha1OfName;
+    for (size_t i = 0; i < AllFiles.size(); i++)
+      Sha1OfName[AllFiles[i]] = Sha1s[i];
+    for (auto &F : M.Files)
+      F.Sha1 = Sha1OfName[F.Name];
     Printf("MERGE-OUTER: writing coverage summary for %zd files to %s\n",
            M.Files.size(), CoverageSummaryOutputPathOrNull);
     std::ofstream SummaryOut(CoverageSummaryOutputPathOrNull);
-    M.PrintSummary(SummaryOut);
+    if (Options.DifferentialMode)
+      M.PrintSummary(SummaryOut, TPC.UC->size, [](uint32_t Feature) {
+        return Feature >> 31 ? -1 : TPC.CallbackOfFeature(Feature);
+      });
+    else
+      M.PrintSummary(SummaryOut);
   }
   std::vector<std::string> NewFiles;
-  std::set<uint32_t> InitialFeatures;
-  if (CoverageSummaryInputPathOrNull) {
-    std::ifstream SummaryIn(CoverageSummaryInputPathOrNull);
-    InitialFeatures = M.ParseSummary(SummaryIn);
-    Printf("MERGE-OUTER: coverage summary loaded from %s, %zd features found\n",
-           CoverageSummaryInputPathOrNull, InitialFeatures.size());
-  }
   size_t NumNewFeatures = M.Merge(InitialFeatures, &NewFiles);
   Printf("MERGE-OUTER: %zd new files with %zd new features added\n",
          NewFiles.size(), NumNewFeatures);
   for (auto &F: NewFiles)
     WriteToOutputCorpus(FileToVector(F));
-  // We are done, delete the control file.
-  RemoveFile(CFPath);
+  // We are done, delete the control files.
+  for (auto &CFPath : CFPaths)
+    RemoveFile(CFPath);
 }
 
 } // namespace fuzzer
@@ -29,6 +29,12 @@
 //   file will be "STARTED INPUT_ID" and so the next process will know
 //   where to resume.
 //
+//   Unless -merge_text_control=1, the outer process writes a
+//   "LIBFUZZER_MERGE_CONTROL 1" line before the list of inputs, and the inner
+//   process then writes its markers as binary records instead of lines, with
+//   the features delta-encoded. Such a control file is parsed in place from
+//   a mapping of it.
+//
 //   Once all inputs are processed by the innner process(es) the outer process
 //   reads the control files and does the merge based entirely on the contents
 //   of control file.
@@ -42,6 +48,7 @@
 
 #include "FuzzerDefs.h"
 
+#include <functional>
 #include <istream>
 #include <ostream>
 #include <set>
@@ -53,6 +60,8 @@ struct MergeFileInfo {
   std::string Name;
   size_t Size = 0;
   std::vector<uint32_t> Features;
+  std::vector<int> Results;  // Of every callback, in diff mode.
+  std::string Sha1;          // Only used for coverage summaries.
 };
 
 struct Merger {
@@ -61,11 +70,34 @@ struct Merger {
   size_t FirstNotProcessedFile = 0;
   std::string LastFailure;
 
+  // Set by the parsers: whether the records are binary, and how many bytes
+  // of the control file they parsed. A torn record at the end of a binary
+  // control file is left out and counted in TornSize.
+  bool Binary = false;
+  size_t ParsedSize = 0;
+  size_t TornSize = 0;
+
   bool Parse(std::istream &IS, bool ParseCoverage);
   bool Parse(const std::string &Str, bool ParseCoverage);
+  // Parses a control file of either format.
+  bool Parse(const uint8_t *Data, size_t Size, bool ParseCoverage);
   void ParseOrExit(std::istream &IS, bool ParseCoverage);
-  void PrintSummary(std::ostream &OS);
-  std::set<uint32_t> ParseSummary(std::istream &IS);
+  void ParseFileOrExit(const std::string &Path, bool ParseCoverage);
+  // Append a STARTED, DONE or RESULTS marker for file Idx to Out.
+  static void AppendStarted(std::string *Out, bool Binary, size_t Idx,
+                            size_t Size);
+  static void AppendDone(std::string *Out, bool Binary, size_t Idx,
+                         const std::set<size_t> &Features);
+  static void AppendResults(std::string *Out, bool Binary, size_t Idx,
+                            const std::vector<int> &Results);
+  // Writes a version 2 summary. ImplOfFeature tells which implementation
+  // (callback) of NumImpls a feature comes from, or -1.
+  void PrintSummary(std::ostream &OS, size_t NumImpls = 0,
+                    std::function<int(uint32_t)> ImplOfFeature = nullptr);
+  // Reads a summary of any version and returns all of its features. Files
+  // of a version 2 summary are also added to Records, if given.
+  static std::set<uint32_t>
+  ParseSummary(std::istream &IS, std::vector<MergeFileInfo> *Records = nullptr);
   size_t Merge(const std::set<uint32_t> &InitialFeatures,
                std::vector<std::string> *NewFiles);
   size_t Merge(std::vector<std::string> *NewFiles) {
@@ -0,0 +1,50 @@
+//===- FuzzerMetrics.h - Prometheus metrics endpoint ------------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::MetricsServer
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_METRICS_H
+#define LLVM_FUZZER_METRICS_H
+
+#include "FuzzerDefs.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace fuzzer {
+
+// Serves the last published page of metrics, in the Prometheus text format,
+// to every HTTP request on 127.0.0.1:Port. The page is formatted by the
+// fuzzing thread and swapped in under a lock, so a scrape never sees the
+// counters halfway through an update and never waits for an execution.
+class MetricsServer {
+ public:
+  ~MetricsServer() { Stop(); }
+
+  bool Start(int Port);
+  void Stop();
+  bool IsRunning() const { return ListenFd >= 0; }
+
+  void Publish(std::string Page);
+
+ private:
+  void ServeLoop();
+
+  int ListenFd = -1;
+  std::thread Server;
+  std::atomic<bool> Exiting{false};
+  std::mutex Mu;
+  std::string Page;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_METRICS_H
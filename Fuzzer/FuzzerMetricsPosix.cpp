@@ -0,0 +1,112 @@
+//===- FuzzerMetricsPosix.cpp - Prometheus metrics endpoint -----*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// MetricsServer
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if LIBFUZZER_POSIX
+
+#include "FuzzerIO.h"
+#include "FuzzerMetrics.h"
+#include "FuzzerUtil.h"
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace fuzzer {
+
+namespace {
+// How long a scrape may take to send its request, and how often the server
+// checks whether it should exit.
+const int kPollTimeoutMs = 200;
+
+void SendAll(int Fd, const char *Data, size_t Size) {
+  while (Size) {
+    ssize_t Res = send(Fd, Data, Size, MSG_NOSIGNAL);
+    if (Res < 0 && errno == EINTR) continue;
+    if (Res <= 0) return;
+    Data += Res;
+    Size -= Res;
+  }
+}
+}  // namespace
+
+bool MetricsServer::Start(int Port) {
+  assert(!IsRunning());
+  int Fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (Fd < 0) {
+    Printf("WARNING: can't create the metrics socket: %s\n", strerror(errno));
+    return false;
+  }
+  int One = 1;
+  setsockopt(Fd, SOL_SOCKET, SO_REUSEADDR, &One, sizeof(One));
+  sockaddr_in Addr = {};
+  Addr.sin_family = AF_INET;
+  Addr.sin_port = htons(static_cast<uint16_t>(Port));
+  Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(Fd, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)) ||
+      listen(Fd, 16)) {
+    Printf("WARNING: can't serve metrics on 127.0.0.1:%d: %s\n", Port,
+           strerror(errno));
+    close(Fd);
+    return false;
+  }
+  ListenFd = Fd;
+  Exiting = false;
+  Server = std::thread(&MetricsServer::ServeLoop, this);
+  return true;
+}
+
+void MetricsServer::Stop() {
+  if (!IsRunning()) return;
+  Exiting = true;
+  Server.join();
+  close(ListenFd);
+  ListenFd = -1;
+}
+
+void MetricsServer::Publish(std::string NewPage) {
+  std::lock_guard<std::mutex> Lock(Mu);
+  Page.swap(NewPage);
+}
+
+void MetricsServer::ServeLoop() {
+  BlockAlarmSignalForCurrentThread();
+  while (!Exiting) {
+    pollfd P = {ListenFd, POLLIN, 0};
+    if (poll(&P, 1, kPollTimeoutMs) <= 0) continue;
+    int Fd = accept(ListenFd, nullptr, nullptr);
+    if (Fd < 0) continue;
+    // Any request gets the page; only wait for it to arrive.
+    pollfd C = {Fd, POLLIN, 0};
+    char Request[4096];
+    if (poll(&C, 1, kPollTimeoutMs) > 0)
+      (void)recv(Fd, Request, sizeof(Request), 0);
+    std::string Body;
+    {
+      std::lock_guard<std::mutex> Lock(Mu);
+      Body = Page;
+    }
+    std::string Header =
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " + std::to_string(Body.size()) + "\r\n\r\n";
+    SendAll(Fd, Header.data(), Header.size());
+    SendAll(Fd, Body.data(), Body.size());
+    close(Fd);
+  }
+}
+
+}  // namespace fuzzer
+
+#endif  // LIBFUZZER_POSIX
@@ -0,0 +1,32 @@
+//===- FuzzerMetricsWindows.cpp - Prometheus metrics endpoint ---*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// MetricsServer
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if LIBFUZZER_WINDOWS
+
+#include "FuzzerIO.h"
+#include "FuzzerMetrics.h"
+
+namespace fuzzer {
+
+bool MetricsServer::Start(int Port) {
+  Printf("WARNING: -metrics_port is not supported on Windows\n");
+  return false;
+}
+
+void MetricsServer::Stop() {}
+
+void MetricsServer::Publish(std::string NewPage) {}
+
+void MetricsServer::ServeLoop() {}
+
+}  // namespace fuzzer
+
+#endif  // LIBFUZZER_WINDOWS
@@ -15,6 +15,7 @@
 #include "FuzzerExtFunctions.h"
 #include "FuzzerIO.h"
 #include "FuzzerOptions.h"
+#include <chrono>
 
 namespace fuzzer {
 
@@ -30,35 +31,76 @@ MutationDispatcher::MutationDispatcher(Random &Rand,
   DefaultMutators.insert(
       DefaultMutators.begin(),
       {
-          {&MutationDispatcher::Mutate_EraseBytes, "EraseBytes"},
-          {&MutationDispatcher::Mutate_InsertByte, "InsertByte"},
+          {&MutationDispatcher::Mutate_EraseBytes, "EraseBytes", 0},
+          {&MutationDispatcher::Mutate_InsertByte, "InsertByte", 0},
           {&MutationDispatcher::Mutate_InsertRepeatedBytes,
-           "InsertRepeatedBytes"},
-          {&MutationDispatcher::Mutate_ChangeByte, "ChangeByte"},
-          {&MutationDispatcher::Mutate_ChangeBit, "ChangeBit"},
-          {&MutationDispatcher::Mutate_ShuffleBytes, "ShuffleBytes"},
-          {&MutationDispatcher::Mutate_ChangeASCIIInteger, "ChangeASCIIInt"},
-          {&MutationDispatcher::Mutate_ChangeBinaryInteger, "ChangeBinInt"},
-          {&MutationDispatcher::Mutate_CopyPart, "CopyPart"},
-          {&MutationDispatcher::Mutate_CrossOver, "CrossOver"},
+           "InsertRepeatedBytes", 0},
+          {&MutationDispatcher::Mutate_ChangeByte, "ChangeByte", 0},
+          {&MutationDispatcher::Mutate_ChangeBit, "ChangeBit", 0},
+          {&MutationDispatcher::Mutate_ShuffleBytes, "ShuffleBytes", 0},
+          {&MutationDispatcher::Mutate_ChangeASCIIInteger, "ChangeASCIIInt",
+           0},
+          {&MutationDispatcher::Mutate_ChangeBinaryInteger, "ChangeBinInt",
+           0},
+          {&MutationDispatcher::Mutate_CopyPart, "CopyPart", 0},
+          {&MutationDispatcher::Mutate_CrossOver, "CrossOver", 0},
           {&MutationDispatcher::Mutate_AddWordFromManualDictionary,
-           "ManualDict"},
+           "ManualDict", 0},
           {&MutationDispatcher::Mutate_AddWordFromPersistentAutoDictionary,
-           "PersAutoDict"},
+           "PersAutoDict", 0},
       });
   if(Options.UseCmp)
     DefaultMutators.push_back(
-        {&MutationDispatcher::Mutate_AddWordFromTORC, "CMP"});
+        {&MutationDispatcher::Mutate_AddWordFromTORC, "CMP", 0});
 
   if (EF->LLVMFuzzerCustomMutator)
-    Mutators.push_back({&MutationDispatcher::Mutate_Custom, "Custom"});
+    Mutators.push_back({&MutationDispatcher::Mutate_Custom, "Custom", 0});
   else
     Mutators = DefaultMutators;
+  Hybrid = Options.MutateHybrid && EF->LLVMFuzzerCustomMutator;
 
   if (EF->LLVMFuzzerCustomCrossOver)
     Mutators.push_back(
-        {&MutationDispatcher::Mutate_CustomCrossOver, "CustomCrossOver"});
-}
+        {&MutationDispatcher::Mutate_CustomCrossOver, "CustomCrossOver", 0});
+
+  // The default mutators come first, so Mutators shares their Ids.
+  for (auto &M : DefaultMutators) {
+    M.Id = Stats.size();
+    Stats.push_back(MutatorStats());
+    Stats.back().Name = M.Name;
+  }
+  for (auto &M : Mutators) {
+    auto It = std::find_if(
+        DefaultMutators.begin(), DefaultMutators.end(),
+        [&](const Mutator &D) { return D.Fn == M.Fn; });
+    if (It != DefaultMutators.end()) {
+      M.Id = It->Id;
+      continue;
+    }
+    M.Id = Stats.size();
+    Stats.push_back(MutatorStats());
+    Stats.back().Name = M.Name;
+  }
+  assert(Stats.size() <= 32 && "MutantOrigin has a bit per mutator");
+  Adaptive = Options.MutateAdaptive;
+  TrackMutants = Hybrid || Adaptive || Options.MutatorStats;
+  Swarm.resize(Stats.size());
+  for (auto &P : Swarm)
+    P.Weight = P.BestWeight = 1.0 / Stats.size();
+}
+
+// -mutate_hybrid: how often the odds are updated, how much of the yield
+// is kept from one update to the next, and the least odds of a group.
+static const size_t kHybridUpdateInterval = 1024;
+static const double kYieldDecay = 0.9;
+static const double kMinGroupOdds = 0.05;
+static const size_t kOddsScale = 1 << 20;
+// -mutate_adaptive: mutants per swarm step, the share of its velocity a
+// weight keeps, and the bounds of a weight before normalization.
+static const size_t kSwarmPeriod = 4096;
+static const double kSwarmInertia = 0.7;
+static const double kMinMutatorWeight = 0.01;
+static const double kMaxMutatorWeight = 1;
 
 static char RandCh(Random &Rand) {
   if (Rand.RandBool()) return Rand(256);
@@ -76,7 +118,7 @@ size_t MutationDispatcher::Mutate_CustomCrossOver(uint8_t *Data, size_t Size,
   if (!Corpus || Corpus->size() < 2 || Size == 0)
     return 0;
   size_t Idx = Rand(Corpus->size());
-  const Unit &Other = (*Corpus)[Idx];
+  UnitRef Other = (*Corpus)[Idx];
   if (Other.empty())
     return 0;
   CustomCrossOverInPlaceHere.resize(MaxSize);
@@ -246,22 +288,22 @@ size_t MutationDispatcher::Mutate_AddWordFromTORC(
   DictionaryEntry DE;
   switch (Rand(4)) {
   case 0: {
-    auto X = TPC.TORC8.Get(Rand.Rand());
+    auto X = TPC.Cmp.TORC8.Get(Rand.Rand());
     DE = MakeDictionaryEntryFromCMP(X.A, X.B, Data, Size);
   } break;
   case 1: {
-    auto X = TPC.TORC4.Get(Rand.Rand());
+    auto X = TPC.Cmp.TORC4.Get(Rand.Rand());
     if ((X.A >> 16) == 0 && (X.B >> 16) == 0 && Rand.RandBool())
       DE = MakeDictionaryEntryFromCMP((uint16_t)X.A, (uint16_t)X.B, Data, Size);
     else
       DE = MakeDictionaryEntryFromCMP(X.A, X.B, Data, Size);
   } break;
   case 2: {
-    auto X = TPC.TORCW.Get(Rand.Rand());
+    auto X = TPC.Cmp.TORCW.Get(Rand.Rand());
     DE = MakeDictionaryEntryFromCMP(X.A, X.B, Data, Size);
   } break;
   case 3: if (Options.UseMemmem) {
-    auto X = TPC.MMT.Get(Rand.Rand());
+    auto X = TPC.Cmp.MMT.Get(Rand.Rand());
     DE = DictionaryEntry(X);
   } break;
   default:
@@ -280,14 +322,32 @@ size_t MutationDispatcher::Mutate_AddWordFromTORC(
 
 size_t MutationDispatcher::Mutate_AddWordFromPersistentAutoDictionary(
     uint8_t *Data, size_t Size, size_t MaxSize) {
+  if (!PriorityPersistentWords.empty() && Rand.RandBool())
+    return AddWordFromDictionary(
+        PersistentAutoDictionary, Data, Size, MaxSize,
+        PriorityPersistentWords[Rand(PriorityPersistentWords.size())]);
   return AddWordFromDictionary(PersistentAutoDictionary, Data, Size, MaxSize);
 }
 
+void MutationDispatcher::AddPriorityWordToPersistentAutoDictionary(
+    const Word &W) {
+  auto &D = PersistentAutoDictionary;
+  size_t Idx = D.IndexOf(W);
+  if (Idx == D.size()) {
+    if (D.size() == Dictionary::kMaxDictSize) return;
+    D.push_back(W);
+  }
+  if (std::find(PriorityPersistentWords.begin(), PriorityPersistentWords.end(),
+                Idx) == PriorityPersistentWords.end())
+    PriorityPersistentWords.push_back(Idx);
+}
+
 size_t MutationDispatcher::AddWordFromDictionary(Dictionary &D, uint8_t *Data,
-                                                 size_t Size, size_t MaxSize) {
+                                                 size_t Size, size_t MaxSize,
+                                                 size_t Idx) {
   if (Size > MaxSize) return 0;
   if (D.empty()) return 0;
-  DictionaryEntry &DE = D[Rand(D.size())];
+  DictionaryEntry &DE = D[Idx < D.size() ? Idx : Rand(D.size())];
   Size = ApplyDictionaryEntry(Data, Size, MaxSize, DE);
   if (!Size) return 0;
   DE.IncUseCount();
@@ -423,7 +483,7 @@ size_t MutationDispatcher::Mutate_CrossOver(uint8_t *Data, size_t Size,
   if (Size > MaxSize) return 0;
   if (!Corpus || Corpus->size() < 2 || Size == 0) return 0;
   size_t Idx = Rand(Corpus->size());
-  const Unit &O = (*Corpus)[Idx];
+  UnitRef O = (*Corpus)[Idx];
   if (O.empty()) return 0;
   MutateInPlaceHere.resize(MaxSize);
   auto &U = MutateInPlaceHere;
@@ -451,6 +511,7 @@ size_t MutationDispatcher::Mutate_CrossOver(uint8_t *Data, size_t Size,
 void MutationDispatcher::StartMutationSequence() {
   CurrentMutatorSequence.clear();
   CurrentDictionaryEntrySequence.clear();
+  PendingMutators = 0;
 }
 
 // Copy successful dictionary entries to PersistentAutoDictionary.
@@ -459,7 +520,6 @@ void MutationDispatcher::RecordSuccessfulMutationSequence() {
     // PersistentAutoDictionary.AddWithSuccessCountOne(DE);
     DE->IncSuccessCount();
     assert(DE->GetW().size());
-    // Linear search is fine here as this happens seldom.
     if (!PersistentAutoDictionary.ContainsWord(DE->GetW()))
       PersistentAutoDictionary.push_back({DE->GetW(), 1});
   }
@@ -494,8 +554,152 @@ void MutationDispatcher::PrintMutationSequence() {
   }
 }
 
+std::string MutationDispatcher::MutationSequenceString() const {
+  std::string Res =
+      "MS: " + std::to_string(CurrentMutatorSequence.size()) + " ";
+  for (auto M : CurrentMutatorSequence)
+    Res += std::string(M.Name) + "-";
+  if (!CurrentDictionaryEntrySequence.empty()) {
+    Res += " DE: ";
+    for (auto DE : CurrentDictionaryEntrySequence) {
+      Res += "\"";
+      const Word &W = DE->GetW();
+      for (size_t i = 0; i < W.size(); i++) {
+        uint8_t Byte = W.data()[i];
+        char Buf[5];
+        if (Byte == '\\' || Byte == '"')
+          snprintf(Buf, sizeof(Buf), "\\%c", Byte);
+        else if (Byte >= 32 && Byte < 127)
+          snprintf(Buf, sizeof(Buf), "%c", Byte);
+        else
+          snprintf(Buf, sizeof(Buf), "\\x%02x", Byte);
+        Res += Buf;
+      }
+      Res += "\"-";
+    }
+  }
+  return Res;
+}
+
 size_t MutationDispatcher::Mutate(uint8_t *Data, size_t Size, size_t MaxSize) {
-  return MutateImpl(Data, Size, MaxSize, Mutators);
+  if (!Hybrid)
+    return MutateImpl(Data, Size, MaxSize, Mutators);
+  LastGroup = Rand(kOddsScale) < CustomOdds * kOddsScale ? MG_Custom
+                                                          : MG_Default;
+  auto Start = std::chrono::steady_clock::now();
+  size_t NewSize = MutateImpl(Data, Size, MaxSize,
+                              LastGroup == MG_Custom ? Mutators
+                                                     : DefaultMutators);
+  Yield[LastGroup].Seconds += std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - Start).count();
+  return NewSize;
+}
+
+MutationDispatcher::MutantOrigin MutationDispatcher::TakeMutantOrigin() {
+  MutantOrigin O;
+  O.Mutators = PendingMutators;
+  O.Group = LastGroup;
+  PendingMutators = 0;
+  return O;
+}
+
+void MutationDispatcher::RecordDuplicateMutant() {
+  for (size_t i = 0; i < Stats.size(); i++)
+    if (PendingMutators & (1U << i))
+      Stats[i].Duplicates++;
+}
+
+void MutationDispatcher::RecordMutantOutcome(const MutantOrigin &O,
+                                             const MutantOutcome &Outcome) {
+  double Finds = Outcome.NewUnit + Outcome.NewDiff + Outcome.NewDiffClass;
+  size_t NumMutators = __builtin_popcount(O.Mutators);
+  for (size_t i = 0; NumMutators && i < Stats.size(); i++) {
+    if (!(O.Mutators & (1U << i))) continue;
+    auto &S = Stats[i];
+    S.Mutants++;
+    S.Seconds += Outcome.Seconds / NumMutators;
+    S.NewFeatures += Outcome.NewFeatures;
+    S.NewDiffClasses += Outcome.NewDiffClass;
+    Swarm[i].PeriodSeconds += Outcome.Seconds / NumMutators;
+    Swarm[i].PeriodFinds += Finds;
+  }
+  if (Hybrid) {
+    Yield[O.Group].Seconds += Outcome.Seconds;
+    Yield[O.Group].Finds += Finds;
+    if (++OutcomesSinceUpdate >= kHybridUpdateInterval)
+      UpdateHybridOdds();
+  }
+  if (Adaptive && ++OutcomesSinceWeightUpdate >= kSwarmPeriod)
+    UpdateMutatorWeights();
+}
+
+void MutationDispatcher::UpdateHybridOdds() {
+  OutcomesSinceUpdate = 0;
+  // One find of prior keeps a group that found nothing yet in the running.
+  double Rate[MG_NumGroups];
+  for (int i = 0; i < MG_NumGroups; i++)
+    Rate[i] = (Yield[i].Finds + 1) / (Yield[i].Seconds + 1e-3);
+  CustomOdds = Rate[MG_Custom] / (Rate[MG_Custom] + Rate[MG_Default]);
+  CustomOdds =
+      std::min(std::max(CustomOdds, kMinGroupOdds), 1 - kMinGroupOdds);
+  // Let old outcomes fade so that the odds follow the campaign.
+  for (auto &Y : Yield) {
+    Y.Seconds *= kYieldDecay;
+    Y.Finds *= kYieldDecay;
+  }
+}
+
+// One step of the swarm: every weight moves towards the weight its mutator
+// had at its best finds per second and towards the mutator's share of all
+// finds so far, then the weights are normalized again.
+void MutationDispatcher::UpdateMutatorWeights() {
+  OutcomesSinceWeightUpdate = 0;
+  double TotalFinds = 0;
+  for (auto &P : Swarm) {
+    P.Finds += P.PeriodFinds;
+    TotalFinds += P.Finds + 1;
+  }
+  double Sum = 0;
+  for (auto &P : Swarm) {
+    if (P.PeriodSeconds > 0) {
+      double Rate = P.PeriodFinds / P.PeriodSeconds;
+      if (Rate > P.BestRate) {
+        P.BestRate = Rate;
+        P.BestWeight = P.Weight;
+      }
+    }
+    double GlobalWeight = (P.Finds + 1) / TotalFinds;
+    double R1 = Rand(kOddsScale) / static_cast<double>(kOddsScale);
+    double R2 = Rand(kOddsScale) / static_cast<double>(kOddsScale);
+    P.Velocity = kSwarmInertia * P.Velocity + R1 * (P.BestWeight - P.Weight) +
+                 R2 * (GlobalWeight - P.Weight);
+    P.Weight = std::min(std::max(P.Weight + P.Velocity, kMinMutatorWeight),
+                        kMaxMutatorWeight);
+    P.PeriodSeconds = P.PeriodFinds = 0;
+    Sum += P.Weight;
+  }
+  for (auto &P : Swarm)
+    P.Weight /= Sum;
+}
+
+double MutationDispatcher::MutatorWeight(size_t Id) const {
+  bool InMutators = std::any_of(Mutators.begin(), Mutators.end(),
+                                [&](const Mutator &M) { return M.Id == Id; });
+  double Sum = 0;
+  for (auto &M : InMutators ? Mutators : DefaultMutators)
+    Sum += Adaptive ? Swarm[M.Id].Weight : 1;
+  return (Adaptive ? Swarm[Id].Weight : 1) / Sum;
+}
+
+void MutationDispatcher::PrintMutatorStats() {
+  Printf("stat::mutators: name uses seconds mutants new_features "
+         "new_diff_classes duplicates weight\n");
+  for (size_t i = 0; i < Stats.size(); i++) {
+    const auto &S = Stats[i];
+    Printf("stat::mutator: %s %zd %.3f %zd %zd %zd %zd %.3f\n", S.Name, S.Uses,
+           S.Seconds, S.Mutants, S.NewFeatures, S.NewDiffClasses,
+           S.Duplicates, MutatorWeight(i));
+  }
 }
 
 size_t MutationDispatcher::DefaultMutate(uint8_t *Data, size_t Size,
@@ -503,24 +707,54 @@ size_t MutationDispatcher::DefaultMutate(uint8_t *Data, size_t Size,
   return MutateImpl(Data, Size, MaxSize, DefaultMutators);
 }
 
+const MutationDispatcher::Mutator &
+MutationDispatcher::PickMutator(const std::vector<Mutator> &Mutators) {
+  if (!Adaptive)
+    return Mutators[Rand(Mutators.size())];
+  double Sum = 0;
+  for (auto &M : Mutators)
+    Sum += Swarm[M.Id].Weight;
+  double X = Rand(kOddsScale) * Sum / kOddsScale;
+  for (auto &M : Mutators) {
+    X -= Swarm[M.Id].Weight;
+    if (X < 0) return M;
+  }
+  return Mutators.back();
+}
+
 // Mutates Data in place, returns new size.
 size_t MutationDispatcher::MutateImpl(uint8_t *Data, size_t Size,
                                       size_t MaxSize,
                                       const std::vector<Mutator> &Mutators) {
   assert(MaxSize > 0);
+  // Only the outermost call is accounted for: a custom mutator that calls
+  // LLVMFuzzerMutate is charged for the mutations it asks for.
+  bool Account = MutateNesting++ == 0 && TrackMutants;
   // Some mutations may fail (e.g. can't insert more bytes if Size == MaxSize),
   // in which case they will return 0.
   // Try several times before returning un-mutated data.
   for (int Iter = 0; Iter < 100; Iter++) {
-    auto M = Mutators[Rand(Mutators.size())];
+    auto M = PickMutator(Mutators);
+    std::chrono::steady_clock::time_point Start;
+    if (Account)
+      Start = std::chrono::steady_clock::now();
     size_t NewSize = (this->*(M.Fn))(Data, Size, MaxSize);
+    if (Account) {
+      Stats[M.Id].Uses++;
+      Stats[M.Id].Seconds += std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - Start).count();
+    }
     if (NewSize && NewSize <= MaxSize) {
       if (Options.OnlyASCII)
         ToASCII(Data, NewSize);
       CurrentMutatorSequence.push_back(M);
+      if (Account)
+        PendingMutators |= 1U << M.Id;
+      MutateNesting--;
       return NewSize;
     }
   }
+  MutateNesting--;
   *Data = ' ';
   return 1;   // Fallback, should not happen frequently.
 }
@@ -530,4 +764,10 @@ void MutationDispatcher::AddWordToManualDictionary(const Word &W) {
       {W, std::numeric_limits<size_t>::max()});
 }
 
+void MutationDispatcher::CopyDictionaries(const MutationDispatcher &Other) {
+  ManualDictionary = Other.ManualDictionary;
+  PersistentAutoDictionary = Other.PersistentAutoDictionary;
+  PriorityPersistentWords = Other.PriorityPersistentWords;
+}
+
 }  // namespace fuzzer
@@ -27,6 +27,8 @@ public:
   void StartMutationSequence();
   /// Print the current sequence of mutations.
   void PrintMutationSequence();
+  /// The current sequence of mutations, as PrintMutationSequence prints it.
+  std::string MutationSequenceString() const;
   /// Indicate that the current sequence of mutations was successfull.
   void RecordSuccessfulMutationSequence();
   /// Mutates data by invoking user-provided mutator.
@@ -80,10 +82,68 @@ public:
 
   void AddWordToManualDictionary(const Word &W);
 
+  /// Adds W to the persistent automatic dictionary, from which the words
+  /// added this way are then picked half of the time.
+  void AddPriorityWordToPersistentAutoDictionary(const Word &W);
+
   void PrintRecommendedDictionary();
 
+  /// Replaces the manual and persistent automatic dictionaries by copies of
+  /// the ones of Other.
+  void CopyDictionaries(const MutationDispatcher &Other);
+
   void SetCorpus(const InputCorpus *Corpus) { this->Corpus = Corpus; }
 
+  /// With -mutate_hybrid, Mutate applies either the custom mutator or the
+  /// default ones, picking the custom mutator with CustomMutatorOdds().
+  enum MutatorGroup { MG_Custom, MG_Default, MG_NumGroups };
+  bool IsHybrid() const { return Hybrid; }
+  double CustomMutatorOdds() const { return CustomOdds; }
+
+  /// What made a mutant: bit i of Mutators is set if the mutator with Id i
+  /// was applied since the previous mutant, and Group is the -mutate_hybrid
+  /// group of the last Mutate call.
+  struct MutantOrigin {
+    uint32_t Mutators = 0;
+    MutatorGroup Group = MG_Custom;
+  };
+  /// What running a mutant found.
+  struct MutantOutcome {
+    double Seconds = 0;
+    size_t NewFeatures = 0;
+    bool NewUnit = false;
+    bool NewDiff = false;
+    bool NewDiffClass = false;
+  };
+  struct MutatorStats {
+    const char *Name = nullptr;
+    size_t Uses = 0;
+    // Spent in the mutator and, split between the mutators of each mutant,
+    // in running its mutants.
+    double Seconds = 0;
+    size_t Mutants = 0;
+    size_t NewFeatures = 0;
+    size_t NewDiffClasses = 0;
+    // Mutants the -dedup_mutants filter had seen before.
+    size_t Duplicates = 0;
+  };
+  /// True if the fuzzer has to report the outcome of every mutant, i.e. with
+  /// -mutate_hybrid, -mutator_stats or -mutate_adaptive.
+  bool TracksMutants() const { return TrackMutants; }
+  /// Returns the origin of the current mutant and starts a new one.
+  MutantOrigin TakeMutantOrigin();
+  /// Credits the mutators of O with Outcome. Every so often this moves the
+  /// -mutate_hybrid odds towards the group with more finds per second and,
+  /// with -mutate_adaptive, the mutator weights towards the mutators with
+  /// more finds per second.
+  void RecordMutantOutcome(const MutantOrigin &O, const MutantOutcome &Outcome);
+  /// Counts the current mutant as a duplicate for the mutators that made it.
+  void RecordDuplicateMutant();
+  const std::vector<MutatorStats> &GetMutatorStats() const { return Stats; }
+  /// The probability of picking mutator Id among the mutators of its group.
+  double MutatorWeight(size_t Id) const;
+  void PrintMutatorStats();
+
   Random &GetRand() { return Rand; }
 
 private:
@@ -91,12 +151,17 @@ private:
   struct Mutator {
     size_t (MutationDispatcher::*Fn)(uint8_t *Data, size_t Size, size_t Max);
     const char *Name;
+    size_t Id;  // Index into Stats.
   };
 
+  // Picks entry Idx of D, or a random one if Idx is out of range.
   size_t AddWordFromDictionary(Dictionary &D, uint8_t *Data, size_t Size,
-                               size_t MaxSize);
+                               size_t MaxSize, size_t Idx = -1);
   size_t MutateImpl(uint8_t *Data, size_t Size, size_t MaxSize,
                     const std::vector<Mutator> &Mutators);
+  const Mutator &PickMutator(const std::vector<Mutator> &Mutators);
+  void UpdateHybridOdds();
+  void UpdateMutatorWeights();
 
   size_t InsertPartOf(const uint8_t *From, size_t FromSize, uint8_t *To,
                       size_t ToSize, size_t MaxToSize);
@@ -127,6 +192,8 @@ private:
   // Persistent dictionary modified by the fuzzer, consists of
   // entries that led to successfull discoveries in the past mutations.
   Dictionary PersistentAutoDictionary;
+  // Indices of the priority words in PersistentAutoDictionary.
+  std::vector<size_t> PriorityPersistentWords;
 
   std::vector<Mutator> CurrentMutatorSequence;
   std::vector<DictionaryEntry *> CurrentDictionaryEntrySequence;
@@ -143,6 +210,39 @@ private:
 
   std::vector<Mutator> Mutators;
   std::vector<Mutator> DefaultMutators;
+
+  struct GroupYield {
+    double Seconds = 0;  // Spent mutating and running the group's mutants.
+    double Finds = 0;
+  };
+  bool Hybrid = false;
+  MutatorGroup LastGroup = MG_Custom;
+  GroupYield Yield[MG_NumGroups];
+  double CustomOdds = 0.5;
+  size_t OutcomesSinceUpdate = 0;
+
+  bool TrackMutants = false;
+  bool Adaptive = false;
+  // Depth of MutateImpl calls; a custom mutator may call LLVMFuzzerMutate.
+  int MutateNesting = 0;
+  uint32_t PendingMutators = 0;
+  std::vector<MutatorStats> Stats;
+
+  // -mutate_adaptive: a particle swarm over the mutator weights, as in MOpt.
+  // Every mutator has a weight, a velocity, and the weight it had when it
+  // reached its best finds per second; the finds of the current period
+  // decide the next move.
+  struct MutatorParticle {
+    double Weight = 0;
+    double Velocity = 0;
+    double BestWeight = 0;
+    double BestRate = -1;
+    double PeriodSeconds = 0;
+    double PeriodFinds = 0;
+    double Finds = 0;
+  };
+  std::vector<MutatorParticle> Swarm;
+  size_t OutcomesSinceWeightUpdate = 0;
 };
 
 }  // namespace fuzzer
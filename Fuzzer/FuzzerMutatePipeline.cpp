@@ -0,0 +1,219 @@
+//===- FuzzerMutatePipeline.cpp - Mutating on a producer thread -----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// The producer thread used by -mutate_pipeline=N.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerMutatePipeline.h"
+#include "FuzzerExtFunctions.h"
+#include "FuzzerHash.h"
+#include "FuzzerUtil.h"
+#include <algorithm>
+#include <chrono>
+
+namespace fuzzer {
+
+// As in MutateAndTestOne().
+static const size_t kMaxDuplicateMutantRetries = 16;
+// How long the producer sleeps while the ring is full or the corpus empty.
+static const std::chrono::microseconds kProducerWait(50);
+static const size_t kNumUpdateSlots = 1024;
+
+thread_local MutationDispatcher *MutationPipeline::ProducerMD;
+
+void MutationPipeline::Start(const FuzzingOptions &Opts, const Random &Stream,
+                             const MutationDispatcher &Dictionaries,
+                             const DigestSet &Filter, size_t MaxInputLen,
+                             bool Sequences) {
+  assert(!IsRunning());
+  assert(Opts.MutatePipeline > 0);
+  Options = Opts;
+  // The TORC and memmem tables are written by the callbacks on the fuzzing
+  // thread.
+  Options.UseCmp = false;
+  Options.UseMemmem = false;
+  Rand.reset(new Random(Stream));
+  MD.reset(new MutationDispatcher(*Rand, Options));
+  MD->CopyDictionaries(Dictionaries);
+  Snapshot.reset(new InputCorpus(""));
+  if (Options.DoCrossOver)
+    MD->SetCorpus(Snapshot.get());
+  SnapshotIdx.clear();
+  Seen = Filter;
+  Work.resize(MaxInputLen);
+  RecordSequences = Sequences;
+  Mutants.reset(new SpscRing<Mutant>(Options.MutatePipeline));
+  Updates.reset(new SpscRing<Update>(kNumUpdateSlots));
+  MaxMutationLen = MaxInputLen;
+  Exiting = false;
+  Producer = std::thread(&MutationPipeline::ProducerLoop, this);
+}
+
+void MutationPipeline::Stop() {
+  if (!IsRunning()) return;
+  Exiting = true;
+  Producer.join();
+}
+
+void MutationPipeline::Flush() {
+  size_t Sent = 0;
+  for (; Sent < Backlog.size(); Sent++) {
+    Update *Slot = Updates->Back();
+    if (!Slot) break;
+    std::swap(*Slot, Backlog[Sent]);
+    Updates->Push();
+  }
+  Backlog.erase(Backlog.begin(), Backlog.begin() + Sent);
+}
+
+void MutationPipeline::Send(Update &&U) {
+  Flush();
+  Update *Slot = Backlog.empty() ? Updates->Back() : nullptr;
+  if (!Slot) {
+    Backlog.push_back(std::move(U));
+    return;
+  }
+  std::swap(*Slot, U);
+  Updates->Push();
+}
+
+void MutationPipeline::AddUnit(UnitRef U, size_t Idx, size_t NumFeatures,
+                               double TargetDistance) {
+  Update Up;
+  Up.Kind = Update::kUnit;
+  Up.U.assign(U.begin(), U.end());
+  Up.Idx = Idx;
+  Up.NumFeatures = NumFeatures;
+  Up.TargetDistance = TargetDistance;
+  Send(std::move(Up));
+}
+
+void MutationPipeline::SendFeedback(const Unit &U, bool HadDiff) {
+  Update Up;
+  Up.Kind = Update::kFeedback;
+  Up.U = U;
+  Up.HadDiff = HadDiff;
+  Send(std::move(Up));
+}
+
+void MutationPipeline::SendOutcome(
+    const MutationDispatcher::MutantOrigin &O,
+    const MutationDispatcher::MutantOutcome &Outcome) {
+  Update Up;
+  Up.Kind = Update::kOutcome;
+  Up.Origin = O;
+  Up.Outcome = Outcome;
+  Send(std::move(Up));
+}
+
+MutationPipeline::Mutant *MutationPipeline::Take() {
+  // Updates stuck in the backlog would leave the producer waiting for its
+  // first unit.
+  Flush();
+  Mutant *M = Mutants->Front();
+  if (M) return M;
+  Stalls++;
+  while (!(M = Mutants->Front()))
+    std::this_thread::yield();
+  return M;
+}
+
+void MutationPipeline::TakeUpdates() {
+  while (Update *Up = Updates->Front()) {
+    switch (Up->Kind) {
+    case Update::kUnit:
+      Snapshot->AddToCorpus(Up->U, std::max(Up->NumFeatures, (size_t)1),
+                            /*MayDeleteFile=*/false, {});
+      Snapshot->SetTargetDistance(Snapshot->size() - 1, Up->TargetDistance);
+      SnapshotIdx.push_back(Up->Idx);
+      break;
+    case Update::kFeedback:
+      if (EF->LLVMFuzzerCustomMutatorFeedback) {
+        std::lock_guard<std::mutex> Lock(MutatorMu);
+        EF->LLVMFuzzerCustomMutatorFeedback(Up->U.data(), Up->U.size(),
+                                            Up->HadDiff);
+      }
+      break;
+    case Update::kOutcome:
+      MD->RecordMutantOutcome(Up->Origin, Up->Outcome);
+      break;
+    }
+    Updates->Pop();
+  }
+}
+
+// The producer's version of Fuzzer::IsDuplicateMutant().
+bool MutationPipeline::IsDuplicate(const uint8_t *Data, size_t Size) {
+  if (Options.DedupMutants <= 0) return false;
+  if (Seen.Insert(Hash128(Data, Size))) return false;
+  Duplicates++;
+  if (!MD->TracksMutants()) return Options.DedupMutants >= 2;
+  MD->RecordDuplicateMutant();
+  if (Options.DedupMutants < 2) return false;
+  MD->TakeMutantOrigin();
+  return true;
+}
+
+void MutationPipeline::ProducerLoop() {
+  ProducerMD = MD.get();
+  Unit Parent;
+  while (!Exiting) {
+    TakeUpdates();
+    if (Snapshot->empty()) {
+      std::this_thread::sleep_for(kProducerWait);
+      continue;
+    }
+    // Like MutateAndTestOne(), make -mutate_depth mutants, each one from the
+    // one before.
+    size_t Idx = Snapshot->ChooseUnitIdxToMutate(*Rand);
+    UnitRef U = (*Snapshot)[Idx];
+    Parent.assign(U.begin(), U.end());
+    size_t Size = std::min(Parent.size(), Work.size());
+    std::copy(Parent.begin(), Parent.begin() + Size, Work.begin());
+    MD->StartMutationSequence();
+    for (int i = 0; i < Options.MutateDepth && !Exiting; i++) {
+      size_t MaxLen = std::min(MaxMutationLen.load(std::memory_order_relaxed),
+                               Work.size());
+      size_t NewSize = 0;
+      size_t NumDuplicateRetries = 0;
+      {
+        std::lock_guard<std::mutex> Lock(MutatorMu);
+        while (true) {
+          NewSize = MD->Mutate(Work.data(), Size, MaxLen);
+          if (NewSize > MaxLen)
+            continue;
+          if (IsDuplicate(Work.data(), NewSize) &&
+              NumDuplicateRetries++ < kMaxDuplicateMutantRetries)
+            continue;
+          break;
+        }
+      }
+      assert(NewSize > 0 && "Mutator returned empty unit");
+      Size = NewSize;
+      Mutant *M;
+      while (!(M = Mutants->Back()) && !Exiting) {
+        // The outcomes of the mutants that are running still count.
+        TakeUpdates();
+        std::this_thread::sleep_for(kProducerWait);
+      }
+      if (!M) break;
+      M->Data.assign(Work.begin(), Work.begin() + Size);
+      M->Parent = Parent;
+      M->ParentIdx = SnapshotIdx[Idx];
+      if (RecordSequences)
+        M->Sequence = MD->MutationSequenceString();
+      M->Tracked = MD->TracksMutants();
+      if (M->Tracked)
+        M->Origin = MD->TakeMutantOrigin();
+      Mutants->Push();
+    }
+  }
+  ProducerMD = nullptr;
+}
+
+}  // namespace fuzzer
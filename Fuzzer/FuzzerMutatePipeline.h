@@ -0,0 +1,171 @@
+//===- FuzzerMutatePipeline.h - Mutating on a producer thread ---*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::MutationPipeline
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_MUTATE_PIPELINE_H
+#define LLVM_FUZZER_MUTATE_PIPELINE_H
+
+#include "FuzzerCorpus.h"
+#include "FuzzerDefs.h"
+#include "FuzzerDigestSet.h"
+#include "FuzzerMutate.h"
+#include "FuzzerOptions.h"
+#include "FuzzerRandom.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fuzzer {
+
+// A bounded queue between one producer and one consumer thread. Both work
+// on the slots in place: the producer fills Back() and publishes it with
+// Push(), the consumer reads Front() and hands it back with Pop(), so the
+// buffers of the slots are reused instead of allocated for every element.
+template <class T> class SpscRing {
+ public:
+  explicit SpscRing(size_t Capacity = 1) : Slots(Capacity) {}
+  size_t capacity() const { return Slots.size(); }
+
+  // Producer: the free slot to fill, or nullptr if the ring is full.
+  T *Back() {
+    size_t H = Head.load(std::memory_order_relaxed);
+    if (H - Tail.load(std::memory_order_acquire) == Slots.size())
+      return nullptr;
+    return &Slots[H % Slots.size()];
+  }
+  void Push() { Head.fetch_add(1, std::memory_order_release); }
+
+  // Consumer: the oldest element, or nullptr if the ring is empty.
+  T *Front() {
+    size_t T0 = Tail.load(std::memory_order_relaxed);
+    if (T0 == Head.load(std::memory_order_acquire))
+      return nullptr;
+    return &Slots[T0 % Slots.size()];
+  }
+  void Pop() { Tail.fetch_add(1, std::memory_order_release); }
+
+ private:
+  std::vector<T> Slots;
+  std::atomic<size_t> Head{0};  // Elements pushed by the producer.
+  std::atomic<size_t> Tail{0};  // Elements popped by the consumer.
+};
+
+// -mutate_pipeline=N: a producer thread mutates units of the corpus into
+// a ring of N mutants, which the fuzzing thread runs, so that an expensive
+// custom mutator works while the target runs the mutants it made before.
+//
+// The producer has a dispatcher, random generator and duplicate filter of
+// its own, and mutates units of its own copy of the corpus. What the
+// fuzzing thread learns goes back to it through a second ring: the units
+// that joined the corpus, the mutator feedback on new units and the
+// outcomes of the tracked mutants. The producer takes them in between
+// mutations, so it mutates a corpus up to N mutants old.
+//
+// The custom mutator and LLVMFuzzerMutate() only run on the producer
+// thread; LockMutator() keeps it out of them while the fuzzing thread
+// calls another hook of the mutator.
+class MutationPipeline {
+ public:
+  struct Mutant {
+    Unit Data;
+    Unit Parent;         // The corpus unit it was made from.
+    size_t ParentIdx;    // The index of that unit in the fuzzer's corpus.
+    std::string Sequence;  // Only kept with RecordSequences.
+    bool Tracked;
+    MutationDispatcher::MutantOrigin Origin;  // Set if Tracked.
+  };
+
+  ~MutationPipeline() { Stop(); }
+
+  // The producer's dispatcher is made with Options, draws from Stream and
+  // starts with the dictionaries of Dictionaries; Seen is the filter of
+  // -dedup_mutants. Mutants get the mutation sequence that made them if
+  // RecordSequences.
+  void Start(const FuzzingOptions &Options, const Random &Stream,
+             const MutationDispatcher &Dictionaries, const DigestSet &Seen,
+             size_t MaxInputLen, bool RecordSequences);
+  void Stop();
+  bool IsRunning() const { return Producer.joinable(); }
+
+  // The dispatcher that mutates on this thread: the producer's on the
+  // producer thread, nullptr on all others.
+  static MutationDispatcher *ThreadMD() { return ProducerMD; }
+  // The producer's dispatcher, for its stats once the pipeline has stopped.
+  MutationDispatcher *GetMD() { return MD.get(); }
+
+  // Fuzzing thread. Idx is the index of U in the fuzzer's corpus.
+  void AddUnit(UnitRef U, size_t Idx, size_t NumFeatures,
+               double TargetDistance);
+  void SendFeedback(const Unit &U, bool HadDiff);
+  void SendOutcome(const MutationDispatcher::MutantOrigin &O,
+                   const MutationDispatcher::MutantOutcome &Outcome);
+  void SetMaxMutationLen(size_t Len) {
+    MaxMutationLen.store(Len, std::memory_order_relaxed);
+  }
+  // Waits for the next mutant, which stays valid until Pop().
+  Mutant *Take();
+  void Pop() { Mutants->Pop(); }
+  std::unique_lock<std::mutex> LockMutator() {
+    return std::unique_lock<std::mutex>(MutatorMu);
+  }
+
+  size_t NumDuplicates() const { return Duplicates.load(); }
+  // How often the fuzzing thread had to wait for a mutant.
+  size_t NumStalls() const { return Stalls; }
+
+ private:
+  struct Update {
+    enum { kUnit, kFeedback, kOutcome } Kind;
+    Unit U;
+    size_t Idx;
+    size_t NumFeatures;
+    double TargetDistance;
+    bool HadDiff;
+    MutationDispatcher::MutantOrigin Origin;
+    MutationDispatcher::MutantOutcome Outcome;
+  };
+
+  void ProducerLoop();
+  void TakeUpdates();
+  bool IsDuplicate(const uint8_t *Data, size_t Size);
+  void Flush();
+  void Send(Update &&U);
+
+  std::unique_ptr<SpscRing<Mutant>> Mutants;
+  std::unique_ptr<SpscRing<Update>> Updates;
+  // Fuzzing thread: updates that did not fit into the ring yet.
+  std::vector<Update> Backlog;
+  size_t Stalls = 0;
+
+  // Producer thread.
+  FuzzingOptions Options;
+  std::unique_ptr<Random> Rand;
+  std::unique_ptr<MutationDispatcher> MD;
+  std::unique_ptr<InputCorpus> Snapshot;
+  std::vector<size_t> SnapshotIdx;  // The fuzzer's index of each unit.
+  DigestSet Seen;
+  Unit Work;
+  bool RecordSequences = false;
+  static thread_local MutationDispatcher *ProducerMD;
+
+  std::mutex MutatorMu;
+  std::atomic<size_t> MaxMutationLen{0};
+  std::atomic<size_t> Duplicates{0};
+  std::atomic<bool> Exiting{false};
+  std::thread Producer;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_MUTATE_PIPELINE_H
@@ -19,6 +19,7 @@ struct FuzzingOptions {
   int Verbosity = 1;
   size_t MaxLen = 0;
   bool ExperimentalLenControl = false;
+  int LenControl = 0;
   int UnitTimeoutSec = 300;
   int TimeoutExitCode = 77;
   int ErrorExitCode = 77;
@@ -26,12 +27,82 @@ struct FuzzingOptions {
   int RssLimitMb = 0;
   bool DoCrossOver = true;
   bool DifferentialMode = false;
+  bool DiffParallel = false;
+  int DiffThreads = 0;
+  int DiffForkInputs = 0;
+  int SeedWorkers = 0;
+  std::string SeedCache;
+  bool DiffCrashAsDiff = false;
+  bool DiffZeroCopy = false;
+  bool ProtectInput = false;
+  bool DiffCmpDict = false;
+  bool DiffInputToState = false;
+  int DiffConfirm = 0;
+  int DiffBatchSize = 0;
+  int DiffCoverageWindow = 0;
+  int DiffFused = -1;
+  int DiffVerdictBits = 0;
+  std::string DiffOracle;
+  int DiffPruneInterval = 0;
+  int DiffEarlyExit = 0;
+  int DiffFastPath = 0;
+  int DiffReference = -1;
+  int DiffReferenceSample = 64;
+  int DiffCallbackTimeoutSec = 0;
+  int DiffEnergy = 0;
+  bool DiffCluster = false;
+  int DiffClusterSimilarity = 80;
+  bool DiffEdgeBuckets = false;
+  int DiffEdgeBucketsLimit = 65536;
+  int DiffSignatureLimit = 0;
+  int DiffRejectCache = 0;
+  std::string DiffSharedName;
+  std::string DiffHwTrace;
+  std::string DiffRemote;
+  int DiffRemoteWorkers = 0;
+  std::string StatsLogPath = "./log";
+  int StatsLogInterval = 20;
+  std::string DiffControl;
+  int DiffMemoryLimitMb = 0;
+  int MetricsPort = 0;
+  std::string SyncWith;
+  int SyncIntervalSec = 10;
+  bool AsyncWrites = false;
+  int AsyncWriteQueueMb = 64;
+  bool MergeTextControl = false;
+  int WriteBatch = 0;
+  int WriteBatchMs = 100;
+  bool FsyncWrites = false;
+  std::string ArtifactPack;
+  std::string DiffPack;
+  std::string DiffEdgeStore;
+  std::string DiffCoverageReport;
+  std::string DirectedTargets;
+  bool RareEdges = false;
+  bool CostAware = false;
+  int CorpusMaxUnits = 0;
+  int CorpusMaxMb = 0;
+  bool CompressCorpus = false;
+  int DiffStopAfterClasses = 0;
+  std::string TraceFile;
+  bool PerfCounters = false;
+  int DedupMutants = 1;
+  int DedupMaxSize = 0;
+  int DedupBloomBits = 0;
+  std::string DiffCheckpoint;
+  int DiffCheckpointIntervalSec = 300;
   int MutateDepth = 5;
+  bool AdaptiveDepth = false;
+  bool MutateHybrid = false;
+  bool MutateAdaptive = false;
+  bool MutatorStats = false;
+  int MutatePipeline = 0;
   bool UseCounters = false;
   bool UseIndirCalls = true;
   bool UseMemmem = true;
   bool UseCmp = false;
   bool UseValueProfile = false;
+  int ValueProfileMapBits = 16;
   bool Shrink = false;
   bool ReduceInputs = false;
   int ReloadIntervalSec = 1;
@@ -41,6 +112,7 @@ struct FuzzingOptions {
   int ReportSlowUnits = 10;
   bool OnlyASCII = false;
   std::string OutputCorpus;
+  std::string PackedCorpus;
   std::string ArtifactPrefix = "./";
   std::string ExactArtifactPath;
   std::string ExitOnSrcPos;
@@ -54,6 +126,7 @@ struct FuzzingOptions {
   bool DumpCoverage = false;
   bool DetectLeaks = true;
   int  TraceMalloc = 0;
+  int MallocSample = 1;
   bool HandleAbrt = false;
   bool HandleBus = false;
   bool HandleFpe = false;
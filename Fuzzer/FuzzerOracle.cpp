@@ -0,0 +1,126 @@
+//===- FuzzerOracle.cpp - Equivalent return codes ---------------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::OutputOracle
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerOracle.h"
+#include "FuzzerIO.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <sstream>
+
+namespace fuzzer {
+
+// N or N-M, where both may be negative: -3--1.
+static bool ParseCodes(const std::string &S, long *Lo, long *Hi) {
+  const char *Begin = S.c_str();
+  char *End;
+  *Lo = strtol(Begin, &End, 10);
+  if (End == Begin) return false;
+  *Hi = *Lo;
+  if (*End == '-') {
+    Begin = End + 1;
+    *Hi = strtol(Begin, &End, 10);
+    if (End == Begin) return false;
+  }
+  return !*End && *Lo <= *Hi && *Lo >= INT_MIN && *Hi <= INT_MAX;
+}
+
+bool OutputOracle::Parse(const std::string &Text, size_t NumCallbacks,
+                         int VerdictBits) {
+  struct Class {
+    long Callback;  // -1 for all.
+    std::vector<std::pair<long, long>> Ranges;
+  };
+  std::vector<Class> Parsed;
+  long Lowest = LONG_MAX, Highest = LONG_MIN;
+  long MaxCode = VerdictBits ? (1L << VerdictBits) - 1 : INT_MAX;
+  long MinCode = VerdictBits ? 0 : INT_MIN;
+  std::istringstream ISS(Text);
+  std::string L;
+  while (std::getline(ISS, L)) {
+    L = L.substr(0, L.find('#'));
+    std::istringstream Words(L);
+    std::string W;
+    if (!(Words >> W)) continue;
+    Class C;
+    char *End;
+    C.Callback = W == "*" ? -1 : strtol(W.c_str(), &End, 10);
+    if (W != "*" && (*End || C.Callback < 0 ||
+                     static_cast<size_t>(C.Callback) >= NumCallbacks)) {
+      Printf("ERROR: -diff_oracle: no callback %s in \"%s\"\n", W.c_str(),
+             L.c_str());
+      return false;
+    }
+    while (Words >> W) {
+      long Lo, Hi;
+      if (!ParseCodes(W, &Lo, &Hi) || Lo < MinCode || Hi > MaxCode) {
+        Printf("ERROR: -diff_oracle: bad code %s in \"%s\"\n", W.c_str(),
+               L.c_str());
+        return false;
+      }
+      C.Ranges.push_back({Lo, Hi});
+      Lowest = std::min(Lowest, Lo);
+      Highest = std::max(Highest, Hi);
+    }
+    if (C.Ranges.empty()) {
+      Printf("ERROR: -diff_oracle: no codes in \"%s\"\n", L.c_str());
+      return false;
+    }
+    Parsed.push_back(C);
+  }
+  if (Parsed.empty()) {
+    Printf("ERROR: -diff_oracle: no classes\n");
+    return false;
+  }
+  if (static_cast<unsigned long>(Highest - Lowest) >= kMaxSpan) {
+    Printf("ERROR: -diff_oracle: the codes span more than %zd values\n",
+           kMaxSpan);
+    return false;
+  }
+  VerdictMask = VerdictBits ? (1 << VerdictBits) - 1 : -1;
+  Min = static_cast<int>(Lowest);
+  Span = static_cast<size_t>(Highest - Lowest) + 1;
+  Table.resize(NumCallbacks * Span);
+  for (size_t i = 0; i < Table.size(); i++)
+    Table[i] = Min + static_cast<int>(i % Span);
+  std::vector<bool> Listed(Table.size());
+  Codes = 0;
+  Classes = Parsed.size();
+  for (auto &C : Parsed) {
+    int First = static_cast<int>(C.Ranges[0].first);
+    for (size_t Idx = 0; Idx < NumCallbacks; Idx++) {
+      if (C.Callback >= 0 && static_cast<size_t>(C.Callback) != Idx)
+        continue;
+      for (auto &R : C.Ranges)
+        for (long Code = R.first; Code <= R.second; Code++) {
+          size_t K = Idx * Span + static_cast<size_t>(Code - Lowest);
+          if (Listed[K]) {
+            Printf("ERROR: -diff_oracle: code %ld of callback %zd is in two "
+                   "classes\n", Code, Idx);
+            Span = 0;
+            return false;
+          }
+          Listed[K] = true;
+          Table[K] = First;
+          Codes++;
+        }
+    }
+  }
+  return true;
+}
+
+bool OutputOracle::Load(const std::string &Path, size_t NumCallbacks,
+                        int VerdictBits) {
+  return Parse(FileToString(Path), NumCallbacks, VerdictBits);
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,70 @@
+//===- FuzzerOracle.h - INTERNAL - Equivalent return codes ------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::OutputOracle
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_ORACLE_H
+#define LLVM_FUZZER_ORACLE_H
+
+#include "FuzzerDefs.h"
+
+#include <string>
+#include <vector>
+
+namespace fuzzer {
+
+// -diff_oracle: the return codes of each differential callback that mean the
+// same, such as two alerts for one rejection. Every line of the file is a
+// class, 'CALLBACK CODE...' with an index or '*' for all callbacks, and
+// codes N or ranges N-M; each code of the class stands for its first one.
+// With -diff_verdict_bits the codes are verdicts and the bits above them are
+// kept. A '#' starts a comment.
+//
+// The classes are compiled into one table per callback over the range from
+// the lowest to the highest code listed, so mapping a result is a subtraction,
+// a compare and a load.
+class OutputOracle {
+ public:
+  // Returns false, after printing why, if Text can't be parsed.
+  bool Parse(const std::string &Text, size_t NumCallbacks, int VerdictBits);
+  bool Load(const std::string &Path, size_t NumCallbacks, int VerdictBits);
+  bool IsActive() const { return Span != 0; }
+  size_t NumCodes() const { return Codes; }
+  size_t NumClasses() const { return Classes; }
+
+  int Map(size_t Idx, int Ret) const {
+    int Key = Ret & VerdictMask;
+    size_t K = static_cast<unsigned>(Key) - static_cast<unsigned>(Min);
+    if (K >= Span) return Ret;
+    return (Ret & ~VerdictMask) | Table[Idx * Span + K];
+  }
+  // Maps the results of all callbacks in place; returns true if any changed.
+  bool Apply(int *Results, size_t N) const {
+    bool Changed = false;
+    for (size_t i = 0; i < N; i++) {
+      int M = Map(i, Results[i]);
+      Changed |= M != Results[i];
+      Results[i] = M;
+    }
+    return Changed;
+  }
+
+  static const size_t kMaxSpan = 1 << 16;
+
+ private:
+  int VerdictMask = -1;
+  int Min = 0;
+  size_t Span = 0;
+  std::vector<int> Table;  // Span entries per callback.
+  size_t Codes = 0, Classes = 0;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_ORACLE_H
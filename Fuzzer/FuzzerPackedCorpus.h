@@ -0,0 +1,73 @@
+//===- FuzzerPackedCorpus.h - Memory-mapped corpus files --------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::PackedCorpus
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_PACKED_CORPUS_H
+#define LLVM_FUZZER_PACKED_CORPUS_H
+
+#include "FuzzerDefs.h"
+
+#include <string>
+
+namespace fuzzer {
+
+// A corpus packed into two append-only files instead of one file per unit:
+// Path.blob holds the units back to back and Path.idx, after a header, one
+// {Offset, Size} entry per unit. Both files are memory-mapped, so opening a
+// corpus takes O(1) and a unit is only paged in when it is read.
+//
+// Several processes may append to the same files. Appends are serialized
+// with a lock on the index, and the index entry is written after the unit,
+// so a reader never sees an entry whose bytes are not in the blob yet.
+class PackedCorpus {
+ public:
+  ~PackedCorpus() { Close(); }
+
+  // Opens the corpus at Path, creating empty files if there are none, or,
+  // if ReadOnly, only if it exists, for reading.
+  bool Open(const std::string &Path, bool ReadOnly = false);
+  void Close();
+  bool IsOpen() const { return IdxFd >= 0; }
+
+  // Maps the units appended since the last call, by this or by other
+  // processes. Invalidates the pointers returned by UnitData().
+  // Returns the number of units.
+  size_t Refresh();
+
+  size_t size() const { return NumUnits; }
+  size_t UnitSize(size_t Idx) const;
+  const uint8_t *UnitData(size_t Idx) const;
+
+  // The unit becomes visible to size() and UnitData() after Refresh().
+  bool Append(const uint8_t *Data, size_t Size);
+
+ private:
+  struct Entry {
+    uint64_t Offset;
+    uint64_t Size;
+  };
+  static const uint64_t kMagic = 0x3130504b43415046ULL;  // "FPACKP01"
+  static const size_t kHeaderSize = sizeof(Entry);
+
+  const Entry *Entries() const {
+    return reinterpret_cast<const Entry *>(Index + kHeaderSize);
+  }
+
+  int IdxFd = -1, BlobFd = -1;
+  const uint8_t *Index = nullptr;
+  size_t IndexMapSize = 0;
+  const uint8_t *Blob = nullptr;
+  size_t BlobMapSize = 0;
+  size_t NumUnits = 0;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_PACKED_CORPUS_H
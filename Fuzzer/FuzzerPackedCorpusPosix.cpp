@@ -0,0 +1,147 @@
+//===- FuzzerPackedCorpusPosix.cpp - Memory-mapped corpus files -*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// PackedCorpus
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if LIBFUZZER_POSIX
+
+#include "FuzzerIO.h"
+#include "FuzzerPackedCorpus.h"
+
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace fuzzer {
+
+namespace {
+bool WriteAll(int Fd, const uint8_t *Data, size_t Size, off_t Offset) {
+  while (Size) {
+    ssize_t Res = pwrite(Fd, Data, Size, Offset);
+    if (Res < 0 && errno == EINTR) continue;
+    if (Res <= 0) return false;
+    Data += Res;
+    Size -= Res;
+    Offset += Res;
+  }
+  return true;
+}
+
+size_t FileSize(int Fd) {
+  struct stat St;
+  return fstat(Fd, &St) ? 0 : St.st_size;
+}
+
+// Maps Size bytes of Fd in place of the Size of them mapped at *Map.
+const uint8_t *Remap(int Fd, const uint8_t *Map, size_t OldSize,
+                     size_t Size) {
+  if (Map)
+    munmap(const_cast<uint8_t *>(Map), OldSize);
+  if (!Size) return nullptr;
+  void *Res = mmap(nullptr, Size, PROT_READ, MAP_SHARED, Fd, 0);
+  return Res == MAP_FAILED ? nullptr : static_cast<const uint8_t *>(Res);
+}
+}  // namespace
+
+bool PackedCorpus::Open(const std::string &Path, bool ReadOnly) {
+  assert(!IsOpen());
+  int Flags = ReadOnly ? O_RDONLY : O_RDWR | O_CREAT;
+  IdxFd = open((Path + ".idx").c_str(), Flags, 0644);
+  BlobFd = open((Path + ".blob").c_str(), Flags, 0644);
+  if (IdxFd < 0 || BlobFd < 0) {
+    Printf("ERROR: can't open packed corpus %s: %s\n", Path.c_str(),
+           strerror(errno));
+    Close();
+    return false;
+  }
+  flock(IdxFd, ReadOnly ? LOCK_SH : LOCK_EX);
+  uint64_t Header[2] = {kMagic, 0};
+  bool Ok = true;
+  if (FileSize(IdxFd) < kHeaderSize)
+    Ok = !ReadOnly &&
+         WriteAll(IdxFd, reinterpret_cast<const uint8_t *>(Header),
+                  kHeaderSize, 0);
+  else
+    Ok = pread(IdxFd, Header, kHeaderSize, 0) == (ssize_t)kHeaderSize &&
+         Header[0] == kMagic;
+  flock(IdxFd, LOCK_UN);
+  if (!Ok) {
+    Printf("ERROR: %s.idx is not a packed corpus index\n", Path.c_str());
+    Close();
+    return false;
+  }
+  Refresh();
+  return true;
+}
+
+void PackedCorpus::Close() {
+  Index = Remap(IdxFd, Index, IndexMapSize, 0);
+  Blob = Remap(BlobFd, Blob, BlobMapSize, 0);
+  IndexMapSize = BlobMapSize = NumUnits = 0;
+  if (IdxFd >= 0) close(IdxFd);
+  if (BlobFd >= 0) close(BlobFd);
+  IdxFd = BlobFd = -1;
+}
+
+size_t PackedCorpus::Refresh() {
+  assert(IsOpen());
+  size_t IdxSize = FileSize(IdxFd);
+  size_t BlobSize = FileSize(BlobFd);
+  if (IdxSize != IndexMapSize) {
+    Index = Remap(IdxFd, Index, IndexMapSize, IdxSize);
+    IndexMapSize = Index ? IdxSize : 0;
+  }
+  if (BlobSize != BlobMapSize) {
+    Blob = Remap(BlobFd, Blob, BlobMapSize, BlobSize);
+    BlobMapSize = Blob ? BlobSize : 0;
+  }
+  // A torn entry at the end of the index, or one whose unit is not fully in
+  // the mapped blob, is left for a later Refresh().
+  size_t N = IndexMapSize < kHeaderSize
+                 ? 0
+                 : (IndexMapSize - kHeaderSize) / sizeof(Entry);
+  const Entry *E = Entries();
+  NumUnits = 0;
+  while (NumUnits < N && E[NumUnits].Offset + E[NumUnits].Size <= BlobMapSize)
+    NumUnits++;
+  return NumUnits;
+}
+
+size_t PackedCorpus::UnitSize(size_t Idx) const {
+  assert(Idx < NumUnits);
+  return Entries()[Idx].Size;
+}
+
+const uint8_t *PackedCorpus::UnitData(size_t Idx) const {
+  assert(Idx < NumUnits);
+  return Blob + Entries()[Idx].Offset;
+}
+
+bool PackedCorpus::Append(const uint8_t *Data, size_t Size) {
+  assert(IsOpen());
+  flock(IdxFd, LOCK_EX);
+  Entry E = {FileSize(BlobFd), Size};
+  // Drop a torn entry left behind by a process that died while appending.
+  size_t IdxSize = FileSize(IdxFd);
+  IdxSize -= (IdxSize - kHeaderSize) % sizeof(Entry);
+  bool Ok = WriteAll(BlobFd, Data, Size, E.Offset) &&
+            WriteAll(IdxFd, reinterpret_cast<const uint8_t *>(&E), sizeof(E),
+                     IdxSize);
+  flock(IdxFd, LOCK_UN);
+  return Ok;
+}
+
+}  // namespace fuzzer
+
+#endif  // LIBFUZZER_POSIX
@@ -0,0 +1,45 @@
+//===- FuzzerPackedCorpusWindows.cpp - Memory-mapped corpus files -*- C++ -*-=//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// PackedCorpus
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if LIBFUZZER_WINDOWS
+
+#include "FuzzerIO.h"
+#include "FuzzerPackedCorpus.h"
+
+namespace fuzzer {
+
+bool PackedCorpus::Open(const std::string &Path, bool ReadOnly) {
+  Printf("ERROR: packed corpora are not supported on Windows\n");
+  return false;
+}
+
+void PackedCorpus::Close() {}
+
+size_t PackedCorpus::Refresh() { return 0; }
+
+size_t PackedCorpus::UnitSize(size_t Idx) const {
+  assert(0 && "UNIMPLEMENTED");
+  return 0;
+}
+
+const uint8_t *PackedCorpus::UnitData(size_t Idx) const {
+  assert(0 && "UNIMPLEMENTED");
+  return nullptr;
+}
+
+bool PackedCorpus::Append(const uint8_t *Data, size_t Size) {
+  assert(0 && "UNIMPLEMENTED");
+  return false;
+}
+
+}  // namespace fuzzer
+
+#endif  // LIBFUZZER_WINDOWS
@@ -0,0 +1,418 @@
+//===- FuzzerPcap.cpp - TLS seeds from packet captures --------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// PcapSeedImporter
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerPcap.h"
+#include "FuzzerIO.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+namespace fuzzer {
+
+namespace {
+const uint32_t kPcapNgSectionHeader = 0x0A0D0D0A;
+const uint32_t kPcapNgInterface = 1;
+const uint32_t kPcapNgObsoletePacket = 2;
+const uint32_t kPcapNgSimplePacket = 3;
+const uint32_t kPcapNgEnhancedPacket = 6;
+
+const uint8_t kProtoTcp = 6;
+const uint8_t kTlsChangeCipherSpec = 20;
+const uint8_t kTlsHandshake = 22;
+const uint8_t kTlsClientHello = 1;
+
+// Anything larger is taken for a corrupt file.
+const size_t kMaxBlockSize = 1 << 24;
+// Streams tracked at once. Done ones are forgotten to make room; beyond
+// that, new ones are ignored.
+const size_t kMaxStreams = 1 << 16;
+// Out-of-order segments kept per stream.
+const size_t kMaxSegmentsAhead = 64;
+// A client stream whose seed is not complete by then is cut here.
+const size_t kMaxStreamBytes = 1 << 18;
+
+uint16_t Be16(const uint8_t *P) {
+  return static_cast<uint16_t>(P[0] << 8 | P[1]);
+}
+
+uint32_t Be32(const uint8_t *P) {
+  return static_cast<uint32_t>(P[0]) << 24 | P[1] << 16 | P[2] << 8 | P[3];
+}
+
+uint32_t Le32(const uint8_t *P) {
+  return static_cast<uint32_t>(P[3]) << 24 | P[2] << 16 | P[1] << 8 | P[0];
+}
+
+// Integers of the file, in its byte order.
+uint16_t Rd16(const uint8_t *P, bool BigEndian) {
+  return BigEndian ? Be16(P) : static_cast<uint16_t>(P[1] << 8 | P[0]);
+}
+
+uint32_t Rd32(const uint8_t *P, bool BigEndian) {
+  return BigEndian ? Be32(P) : Le32(P);
+}
+}  // namespace
+
+size_t PcapSeedImporter::SeedLength(const uint8_t *D, size_t Size,
+                                    size_t Flights, bool *Complete) {
+  *Complete = false;
+  if (Size >= 6 && (D[0] != kTlsHandshake || D[5] != kTlsClientHello)) {
+    *Complete = true;
+    return 0;
+  }
+  size_t Off = 0, HelloEnd = 0, HelloSize = 0, HandshakeBytes = 0;
+  bool SawChangeCipherSpec = false;
+  while (Off + 5 <= Size) {
+    uint8_t Type = D[Off];
+    size_t Len = Be16(D + Off + 3);
+    bool Handshake = Type == kTlsHandshake;
+    if (D[Off + 1] != 3 ||
+        !(Handshake || (HelloEnd && Type == kTlsChangeCipherSpec))) {
+      *Complete = true;
+      break;
+    }
+    if (Off + 5 + Len > Size) break;
+    if (!Off) {
+      // The ClientHello may span several records.
+      if (Len < 4) {
+        *Complete = true;
+        return 0;
+      }
+      HelloSize = 4 + (D[6] << 16 | D[7] << 8 | D[8]);
+    }
+    Off += 5 + Len;
+    if (!HelloEnd) {
+      HandshakeBytes += Len;
+      if (HandshakeBytes < HelloSize) continue;
+      HelloEnd = Off;
+      if (Flights < 2) {
+        *Complete = true;
+        return HelloEnd;
+      }
+    } else if (!Handshake) {
+      SawChangeCipherSpec = true;
+    } else if (SawChangeCipherSpec) {
+      *Complete = true;  // The Finished message ends the second flight.
+      return Off;
+    }
+  }
+  return HelloEnd ? Off : 0;
+}
+
+bool PcapSeedImporter::ReadFile(const std::string &Path, UnitVector *V) {
+  FILE *In = fopen(Path.c_str(), "rb");
+  if (!In) return false;
+  Out = V;
+  uint8_t Magic[4];
+  bool Res = false;
+  if (fread(Magic, 1, sizeof(Magic), In) == sizeof(Magic))
+    Res = Le32(Magic) == kPcapNgSectionHeader ? ReadPcapNg(In, Magic)
+                                              : ReadPcap(In, Le32(Magic));
+  fclose(In);
+  Flush();
+  Out = nullptr;
+  return Res;
+}
+
+bool PcapSeedImporter::ReadPcap(FILE *In, uint32_t Magic) {
+  bool BigEndian;
+  switch (Magic) {
+  case 0xa1b2c3d4:  // Microsecond timestamps.
+  case 0xa1b23c4d:  // Nanosecond timestamps.
+    BigEndian = false;
+    break;
+  case 0xd4c3b2a1:
+  case 0x4d3cb2a1:
+    BigEndian = true;
+    break;
+  default:
+    return false;
+  }
+  // The rest of the file header, then a header of 16 bytes per packet.
+  uint8_t Header[20];
+  if (fread(Header, 1, sizeof(Header), In) != sizeof(Header))
+    return false;
+  // The upper bits of the link type may tell about frame check sequences.
+  uint32_t LinkType = Rd32(Header + 16, BigEndian) & 0xffff;
+  Unit Frame;
+  uint8_t Record[16];
+  while (fread(Record, 1, sizeof(Record), In) == sizeof(Record)) {
+    uint32_t CapLen = Rd32(Record + 8, BigEndian);
+    if (CapLen > kMaxBlockSize) break;
+    Frame.resize(CapLen);
+    if (fread(Frame.data(), 1, CapLen, In) != CapLen) break;
+    HandleFrame(LinkType, Frame.data(), CapLen);
+  }
+  return true;
+}
+
+bool PcapSeedImporter::ReadPcapNg(FILE *In, const uint8_t *FirstBlockType) {
+  // Every block is its type, its total length, the body and the length
+  // again. A section header block, whose type reads the same in both byte
+  // orders, gives the byte order of the blocks up to the next one and starts
+  // a new list of interfaces.
+  bool BigEndian = false;
+  std::vector<uint32_t> LinkTypes;
+  uint8_t Header[8];
+  memcpy(Header, FirstBlockType, 4);
+  size_t Have = 4;
+  Unit Body;
+  while (fread(Header + Have, 1, sizeof(Header) - Have, In) ==
+         sizeof(Header) - Have) {
+    Have = 0;
+    uint32_t Type = Rd32(Header, BigEndian);
+    size_t Consumed = sizeof(Header);
+    if (Type == kPcapNgSectionHeader) {
+      uint8_t ByteOrder[4];
+      if (fread(ByteOrder, 1, 4, In) != 4) break;
+      if (Le32(ByteOrder) == 0x1A2B3C4D)
+        BigEndian = false;
+      else if (Le32(ByteOrder) == 0x4D3C2B1A)
+        BigEndian = true;
+      else
+        return false;
+      LinkTypes.clear();
+      Consumed += 4;
+    }
+    size_t Len = Rd32(Header + 4, BigEndian);
+    if (Len < Consumed + 4 || Len > kMaxBlockSize) break;
+    Body.resize(Len - Consumed);
+    if (fread(Body.data(), 1, Body.size(), In) != Body.size()) break;
+    const uint8_t *B = Body.data();
+    size_t BodySize = Body.size() - 4;  // Without the trailing length.
+    switch (Type) {
+    case kPcapNgInterface:
+      if (BodySize >= 2)
+        LinkTypes.push_back(Rd16(B, BigEndian));
+      break;
+    case kPcapNgEnhancedPacket:
+    case kPcapNgObsoletePacket: {
+      if (BodySize < 20) break;
+      uint32_t Interface = Type == kPcapNgEnhancedPacket
+                               ? Rd32(B, BigEndian)
+                               : Rd16(B, BigEndian);
+      size_t CapLen = Rd32(B + 12, BigEndian);
+      if (Interface < LinkTypes.size() && CapLen <= BodySize - 20)
+        HandleFrame(LinkTypes[Interface], B + 20, CapLen);
+      break;
+    }
+    case kPcapNgSimplePacket:
+      if (BodySize >= 4 && !LinkTypes.empty())
+        HandleFrame(LinkTypes[0], B + 4,
+                    std::min<size_t>(Rd32(B, BigEndian), BodySize - 4));
+      break;
+    }
+  }
+  return true;
+}
+
+void PcapSeedImporter::HandleFrame(uint32_t LinkType, const uint8_t *Data,
+                                   size_t Size) {
+  Packets++;
+  // 0 if the IP version tells.
+  uint16_t EtherType = 0;
+  size_t Off;
+  switch (LinkType) {
+  case 1:  // Ethernet, maybe with VLAN tags.
+    if (Size < 14) return;
+    EtherType = Be16(Data + 12);
+    Off = 14;
+    while ((EtherType == 0x8100 || EtherType == 0x88a8) && Off + 4 <= Size) {
+      EtherType = Be16(Data + Off + 2);
+      Off += 4;
+    }
+    break;
+  case 113:  // Linux cooked capture (-i any).
+    if (Size < 16) return;
+    EtherType = Be16(Data + 14);
+    Off = 16;
+    break;
+  case 276:  // Linux cooked capture v2.
+    if (Size < 20) return;
+    EtherType = Be16(Data);
+    Off = 20;
+    break;
+  case 0:    // BSD loopback.
+  case 108:  // OpenBSD loopback.
+    Off = 4;
+    break;
+  case 12:   // Raw IP.
+  case 14:
+  case 101:
+  case 228:  // IPv4.
+  case 229:  // IPv6.
+    Off = 0;
+    break;
+  default:
+    return;
+  }
+  if (Off > Size) return;
+  if (EtherType && EtherType != 0x0800 && EtherType != 0x86DD) return;
+  HandleIp(Data + Off, Size - Off);
+}
+
+void PcapSeedImporter::HandleIp(const uint8_t *Data, size_t Size) {
+  if (!Size) return;
+  std::string Key;
+  if (Data[0] >> 4 == 4) {
+    size_t HeaderLen = (Data[0] & 15) * 4;
+    if (Size < 20 || HeaderLen < 20 || HeaderLen > Size) return;
+    // Fragments are not reassembled.
+    if (Data[9] != kProtoTcp || (Be16(Data + 6) & 0x3fff)) return;
+    size_t Len = Be16(Data + 2);
+    if (Len >= HeaderLen && Len < Size) Size = Len;  // Link layer padding.
+    Key.assign(reinterpret_cast<const char *>(Data + 12), 8);
+    HandleTcp(Key, Data + HeaderLen, Size - HeaderLen);
+  } else if (Data[0] >> 4 == 6) {
+    if (Size < 40) return;
+    if (size_t Len = Be16(Data + 4))
+      Size = std::min(Size, 40 + Len);
+    uint8_t Next = Data[6];
+    size_t Off = 40;
+    // Hop-by-hop, routing, destination options and authentication headers.
+    while (Next == 0 || Next == 43 || Next == 60 || Next == 51) {
+      if (Off + 2 > Size) return;
+      size_t Len = Next == 51 ? (Data[Off + 1] + 2) * 4
+                              : (Data[Off + 1] + 1) * 8;
+      Next = Data[Off];
+      Off += Len;
+    }
+    if (Next != kProtoTcp || Off > Size) return;
+    Key.assign(reinterpret_cast<const char *>(Data + 8), 32);
+    HandleTcp(Key, Data + Off, Size - Off);
+  }
+}
+
+void PcapSeedImporter::HandleTcp(std::string Key, const uint8_t *Data,
+                                 size_t Size) {
+  if (Size < 20) return;
+  size_t HeaderLen = (Data[12] >> 4) * 4;
+  if (HeaderLen < 20 || HeaderLen > Size) return;
+  Key.append(reinterpret_cast<const char *>(Data), 4);  // The ports.
+  uint32_t Seq = Be32(Data + 4);
+  bool Syn = Data[13] & 2, End = Data[13] & 5;  // FIN or RST.
+  size_t PayloadSize = Size - HeaderLen;
+  auto It = Streams.find(Key);
+  if (It == Streams.end()) {
+    if (!Syn && !PayloadSize) return;
+    if (Streams.size() >= kMaxStreams) {
+      // Streams that are done only wait for their FIN, which may never
+      // come; forget them to make room.
+      for (auto J = Streams.begin(); J != Streams.end();)
+        J = J->second.Done ? Streams.erase(J) : std::next(J);
+      if (Streams.size() >= kMaxStreams) {
+        DroppedStreams++;
+        return;
+      }
+    }
+    It = Streams.emplace(Key, Stream()).first;
+  }
+  Stream &S = It->second;
+  if (Syn) {
+    S = Stream();
+    S.Next = Seq + 1;
+    S.Started = true;
+  } else if (!S.Started) {
+    // The capture began after the handshake.
+    S.Next = Seq;
+    S.Started = true;
+  }
+  if (!S.Done && PayloadSize) {
+    Append(&S, Seq, Data + HeaderLen, PayloadSize);
+    Update(&S, /*AtEnd=*/false);
+  }
+  if (End) {
+    if (!S.Done) Update(&S, /*AtEnd=*/true);
+    Streams.erase(It);
+  }
+}
+
+void PcapSeedImporter::Append(Stream *S, uint32_t Seq, const uint8_t *Data,
+                              size_t Size) {
+  if (static_cast<int32_t>(Seq - S->Next) > 0) {
+    if (S->Ahead.size() < kMaxSegmentsAhead) {
+      Unit &U = S->Ahead[Seq];
+      if (U.size() < Size) U.assign(Data, Data + Size);
+    }
+    return;
+  }
+  // Retransmitted bytes are skipped.
+  auto Take = [&](uint32_t At, const uint8_t *D, size_t N) {
+    size_t Known = S->Next - At;
+    if (Known >= N) return;
+    S->Data.insert(S->Data.end(), D + Known, D + N);
+    S->Next += static_cast<uint32_t>(N - Known);
+  };
+  Take(Seq, Data, Size);
+  // The segments the new bytes reach.
+  for (auto It = S->Ahead.begin(); It != S->Ahead.end();) {
+    if (static_cast<int32_t>(It->first - S->Next) > 0) {
+      ++It;
+      continue;
+    }
+    Take(It->first, It->second.data(), It->second.size());
+    S->Ahead.erase(It);
+    It = S->Ahead.begin();
+  }
+}
+
+void PcapSeedImporter::Update(Stream *S, bool AtEnd) {
+  bool Complete;
+  size_t Len = SeedLength(S->Data.data(), S->Data.size(), Flights, &Complete);
+  if (!Complete && !AtEnd && S->Data.size() < kMaxStreamBytes) return;
+  if (Len)
+    Emit(S->Data.data(), MaxSize ? std::min(Len, MaxSize) : Len);
+  S->Done = true;
+  Unit().swap(S->Data);
+  S->Ahead.clear();
+}
+
+void PcapSeedImporter::Emit(const uint8_t *Data, size_t Size) {
+  if (!Seen.Insert(Hash128(Data, Size))) {
+    Duplicates++;
+    return;
+  }
+  Out->push_back(Unit(Data, Data + Size));
+  Seeds++;
+}
+
+void PcapSeedImporter::Flush() {
+  for (auto &KV : Streams)
+    if (!KV.second.Done)
+      Update(&KV.second, /*AtEnd=*/true);
+  Streams.clear();
+}
+
+size_t ReadPcapSeeds(const std::string &Path, size_t Flights, size_t MaxSize,
+                     UnitVector *V) {
+  std::vector<std::string> Files;
+  if (IsFile(Path))
+    Files.push_back(Path);
+  else
+    ListFilesInDirRecursive(Path, nullptr, &Files, /*TopDir=*/true);
+  std::sort(Files.begin(), Files.end());
+  PcapSeedImporter Importer(Flights, MaxSize);
+  for (auto &File : Files)
+    if (!Importer.ReadFile(File, V))
+      Printf("WARNING: -seed_pcap: %s is not a pcap or pcapng file\n",
+             File.c_str());
+  Printf("INFO: -seed_pcap: %zd seeds from %zd packets of %zd file(s), "
+         "%zd duplicates\n",
+         Importer.NumSeeds(), Importer.NumPackets(), Files.size(),
+         Importer.NumDuplicates());
+  if (Importer.NumDroppedStreams())
+    Printf("WARNING: -seed_pcap: ignored %zd streams while %zd were open\n",
+           Importer.NumDroppedStreams(), kMaxStreams);
+  return Importer.NumSeeds();
+}
+
+}  // namespace fuzzer
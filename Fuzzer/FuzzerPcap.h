@@ -0,0 +1,99 @@
+//===- FuzzerPcap.h - TLS seeds from packet captures ------------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::PcapSeedImporter
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_PCAP_H
+#define LLVM_FUZZER_PCAP_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerDigestSet.h"
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+namespace fuzzer {
+
+// Turns the TLS handshakes of pcap and pcapng files into seeds (-seed_pcap).
+//
+// Every TCP stream over IPv4 or IPv6 that starts with a ClientHello is
+// reassembled just far enough to cover its leading TLS records: those of the
+// ClientHello with Flights == 1, with Flights == 2 also the client's second
+// flight (ClientKeyExchange, ChangeCipherSpec, Finished), which is the input
+// format of the multi-flight handshake targets. Those records, byte for byte
+// as the client sent them, are one seed. Streams that start with anything
+// else are dropped after their first six bytes, and a stream is forgotten
+// as soon as its seed is known, so a capture is read one packet at a time
+// in little memory. Seeds seen before, in this file or an earlier one, are
+// dropped.
+class PcapSeedImporter {
+ public:
+  PcapSeedImporter(size_t Flights, size_t MaxSize)
+      : Flights(Flights), MaxSize(MaxSize) {}
+
+  // Appends the new seeds of the capture at Path to *V. Returns false if it
+  // is not a pcap or pcapng file; a truncated one keeps the seeds found
+  // before the cut.
+  bool ReadFile(const std::string &Path, UnitVector *V);
+
+  size_t NumPackets() const { return Packets; }
+  size_t NumSeeds() const { return Seeds; }
+  size_t NumDuplicates() const { return Duplicates; }
+  // Streams that began while the most streams were open.
+  size_t NumDroppedStreams() const { return DroppedStreams; }
+
+  // The length of the seed at the start of the client stream Data, 0 if it
+  // has none (yet). Sets *Complete once more bytes can't change that.
+  static size_t SeedLength(const uint8_t *Data, size_t Size, size_t Flights,
+                           bool *Complete);
+
+ private:
+  struct Stream {
+    bool Started = false;  // Whether Next is known.
+    bool Done = false;     // Seeded or not TLS; only waits for its FIN.
+    uint32_t Next = 0;     // The sequence number of the next byte in order.
+    Unit Data;             // The bytes in order so far.
+    std::map<uint32_t, Unit> Ahead;  // Segments past a gap, by sequence.
+  };
+
+  bool ReadPcap(FILE *In, uint32_t Magic);
+  bool ReadPcapNg(FILE *In, const uint8_t *FirstBlockType);
+  // Handles one captured frame of the given link type (LINKTYPE_*).
+  void HandleFrame(uint32_t LinkType, const uint8_t *Data, size_t Size);
+  void HandleIp(const uint8_t *Data, size_t Size);
+  void HandleTcp(std::string Key, const uint8_t *Data, size_t Size);
+  void Append(Stream *S, uint32_t Seq, const uint8_t *Data, size_t Size);
+  void Update(Stream *S, bool AtEnd);
+  void Emit(const uint8_t *Data, size_t Size);
+  // Turns the streams still open into seeds where they hold a whole
+  // ClientHello. Ends a capture.
+  void Flush();
+
+  size_t Flights;
+  size_t MaxSize;
+  UnitVector *Out = nullptr;
+  std::unordered_map<std::string, Stream> Streams;
+  DigestSet Seen;
+  size_t Packets = 0;
+  size_t Seeds = 0;
+  size_t Duplicates = 0;
+  size_t DroppedStreams = 0;
+};
+
+// Reads the seeds of the capture at Path, or of every file under the
+// directory Path, into *V and prints how many there were. Returns their
+// number.
+size_t ReadPcapSeeds(const std::string &Path, size_t Flights, size_t MaxSize,
+                     UnitVector *V);
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_PCAP_H
@@ -0,0 +1,68 @@
+//===- FuzzerPerfCounters.h - Hardware counters of the thread ---*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::PerfCounters
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_PERF_COUNTERS_H
+#define LLVM_FUZZER_PERF_COUNTERS_H
+
+#include "FuzzerDefs.h"
+
+#include <cstdint>
+
+namespace fuzzer {
+
+// -perf_counters=1: cycles, instructions, last-level cache misses and branch
+// misses of the fuzzing thread, in user space, as one perf_event_open()
+// group. Read() takes all of them with one read(). A counter that the CPU
+// or the hypervisor does not offer stays at 0 and IsAvailable() says so;
+// without cycles nothing is counted.
+class PerfCounters {
+ public:
+  enum Counter {
+    PC_Cycles,
+    PC_Instructions,
+    PC_CacheMisses,
+    PC_BranchMisses,
+    kNumCounters,
+  };
+
+  struct Sample {
+    uint64_t Values[kNumCounters];
+  };
+
+  PerfCounters() {
+    for (int i = 0; i < kNumCounters; i++) Fds[i] = Slots[i] = -1;
+  }
+  ~PerfCounters();
+
+  // Opens the group in the calling thread, which must be the one that calls
+  // Read().
+  bool Start();
+  bool IsRunning() const { return Fds[PC_Cycles] >= 0; }
+  bool IsAvailable(int C) const { return Slots[C] >= 0; }
+
+  void Read(Sample *S) const;
+
+  // The names of the counters in the stats and the metrics.
+  static const char *Name(int C) {
+    static const char *const kNames[] = {"cycles", "instructions",
+                                         "llc_misses", "branch_misses"};
+    return kNames[C];
+  }
+
+ private:
+  int Fds[kNumCounters];
+  int Slots[kNumCounters];  // The position of each counter in the group.
+  int NumOpen = 0;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_PERF_COUNTERS_H
@@ -0,0 +1,82 @@
+//===- FuzzerPerfCountersLinux.cpp - Counters through perf_event_open -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// PerfCounters on top of the hardware events of Linux perf.
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if LIBFUZZER_LINUX
+
+#include "FuzzerIO.h"
+#include "FuzzerPerfCounters.h"
+
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace fuzzer {
+
+// Indexed by PerfCounters::Counter.
+static const uint64_t kEventConfigs[] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+PerfCounters::~PerfCounters() {
+  for (int i = 0; i < kNumCounters; i++)
+    if (Fds[i] >= 0) close(Fds[i]);
+}
+
+bool PerfCounters::Start() {
+  for (int i = 0; i < kNumCounters; i++) {
+    struct perf_event_attr A;
+    memset(&A, 0, sizeof(A));
+    A.size = sizeof(A);
+    A.type = PERF_TYPE_HARDWARE;
+    A.config = kEventConfigs[i];
+    A.read_format = PERF_FORMAT_GROUP;
+    // The leader starts the whole group once it is complete.
+    A.disabled = i == PC_Cycles;
+    A.exclude_kernel = 1;
+    A.exclude_hv = 1;
+    Fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &A, 0, -1,
+                                      i == PC_Cycles ? -1 : Fds[PC_Cycles],
+                                      PERF_FLAG_FD_CLOEXEC));
+    if (Fds[i] >= 0) {
+      Slots[i] = NumOpen++;
+      continue;
+    }
+    if (i == PC_Cycles) {
+      Printf("ERROR: -perf_counters: perf_event_open: %s\n", strerror(errno));
+      return false;
+    }
+    Printf("WARNING: -perf_counters: no %s here: %s\n", Name(i),
+           strerror(errno));
+  }
+  ioctl(Fds[PC_Cycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(Fds[PC_Cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return true;
+}
+
+void PerfCounters::Read(Sample *S) const {
+  // {nr, values[nr]}, in the order the counters joined the group.
+  uint64_t Buf[1 + kNumCounters];
+  ssize_t Want = static_cast<ssize_t>((1 + NumOpen) * sizeof(uint64_t));
+  if (read(Fds[PC_Cycles], Buf, sizeof(Buf)) != Want) {
+    memset(S, 0, sizeof(*S));
+    return;
+  }
+  for (int i = 0; i < kNumCounters; i++)
+    S->Values[i] = Slots[i] >= 0 ? Buf[1 + Slots[i]] : 0;
+}
+
+}  // namespace fuzzer
+
+#endif  // LIBFUZZER_LINUX
@@ -0,0 +1,32 @@
+//===- FuzzerPerfCountersOther.cpp - PerfCounters stub --------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// PerfCounters stub for platforms without Linux perf.
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if !LIBFUZZER_LINUX
+
+#include "FuzzerIO.h"
+#include "FuzzerPerfCounters.h"
+
+#include <cstring>
+
+namespace fuzzer {
+
+PerfCounters::~PerfCounters() {}
+
+bool PerfCounters::Start() {
+  Printf("ERROR: -perf_counters is only supported on Linux\n");
+  return false;
+}
+
+void PerfCounters::Read(Sample *S) const { memset(S, 0, sizeof(*S)); }
+
+}  // namespace fuzzer
+
+#endif  // !LIBFUZZER_LINUX
@@ -12,21 +12,103 @@
 #ifndef LLVM_FUZZER_RANDOM_H
 #define LLVM_FUZZER_RANDOM_H
 
-#include <random>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 
 namespace fuzzer {
-class Random : public std::mt19937 {
+
+// xoshiro256**: 32 bytes of state, where std::mt19937 had 2.5 KB, and a
+// few cycles per 64-bit value. It is a UniformRandomBitGenerator, so it
+// also works with std::shuffle and the <random> distributions.
+class Random {
  public:
-  Random(unsigned int seed) : std::mt19937(seed) {}
-  result_type operator()() { return this->std::mt19937::operator()(); }
+  typedef uint64_t result_type;
+
+  Random(uint64_t Seed) {
+    // The state is expanded from the seed with splitmix64, so that close
+    // seeds give unrelated streams and the state is never all zeros.
+    for (uint64_t &W : S) {
+      Seed += 0x9e3779b97f4a7c15ULL;
+      uint64_t Z = Seed;
+      Z = (Z ^ (Z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      Z = (Z ^ (Z >> 27)) * 0x94d049bb133111ebULL;
+      W = Z ^ (Z >> 31);
+    }
+  }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+
+  result_type operator()() {
+    uint64_t Res = Rotl(S[1] * 5, 7) * 9;
+    uint64_t T = S[1] << 17;
+    S[2] ^= S[0];
+    S[3] ^= S[1];
+    S[1] ^= S[2];
+    S[0] ^= S[3];
+    S[2] ^= T;
+    S[3] = Rotl(S[3], 45);
+    return Res;
+  }
   size_t Rand() { return this->operator()(); }
-  size_t RandBool() { return Rand() % 2; }
-  size_t operator()(size_t n) { return n ? Rand() % n : 0; }
+  size_t RandBool() { return this->operator()() >> 63; }
+  // Uniform in [0, n), without the bias of Rand() % n (Lemire's method).
+  size_t operator()(size_t n) {
+    if (!n) return 0;
+    uint64_t N = n;
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 M = (unsigned __int128)this->operator()() * N;
+    if (static_cast<uint64_t>(M) < N) {
+      uint64_t Threshold = -N % N;
+      while (static_cast<uint64_t>(M) < Threshold)
+        M = (unsigned __int128)this->operator()() * N;
+    }
+    return static_cast<size_t>(M >> 64);
+#else
+    uint64_t Threshold = -N % N;
+    uint64_t R;
+    do
+      R = this->operator()();
+    while (R < Threshold);
+    return static_cast<size_t>(R % N);
+#endif
+  }
   intptr_t operator()(intptr_t From, intptr_t To) {
     assert(From < To);
     intptr_t RangeSize = To - From + 1;
     return operator()(RangeSize) + From;
   }
+
+  // Splits off an independent stream: the returned generator continues
+  // where this one was, and this one jumps 2^128 values ahead. Streams
+  // split in the same order from the same seed are the same in every run.
+  Random Split() {
+    Random Res = *this;
+    static const uint64_t kJump[] = {0x180ec6d33cfd0abaULL,
+                                     0xd5a61266f0c9392cULL,
+                                     0xa9582618e03fc9aaULL,
+                                     0x39abdc4529b1661cULL};
+    uint64_t T[4] = {0, 0, 0, 0};
+    for (uint64_t J : kJump)
+      for (int b = 0; b < 64; b++) {
+        if (J & (1ULL << b))
+          for (int i = 0; i < 4; i++)
+            T[i] ^= S[i];
+        this->operator()();
+      }
+    for (int i = 0; i < 4; i++)
+      S[i] = T[i];
+    return Res;
+  }
+
+ private:
+  static uint64_t Rotl(uint64_t X, int K) { return (X << K) | (X >> (64 - K)); }
+
+  uint64_t S[4];
 };
 
 }  // namespace fuzzer
@@ -0,0 +1,150 @@
+//===- FuzzerRemote.cpp - Callbacks in other processes --------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// The input ring between a fuzzer and its remote workers.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerRemote.h"
+#include "FuzzerIO.h"
+#include "FuzzerUtil.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+namespace fuzzer {
+
+// Spins before a waiting side sleeps; a worker that replies in a few
+// microseconds is not worth a system call.
+static const size_t kSpins = 1 << 12;
+
+bool RemoteWorkers::Create(const char *Name, size_t NumWorkers) {
+  assert(NumWorkers > 0 && NumWorkers <= kMaxWorkers);
+  Region.Destroy(Name);
+  size_t Size = sizeof(Layout) +
+                kNumSlots * (sizeof(Slot) + NumWorkers * sizeof(Reply));
+  if (!Region.Create(Name, Size, NumWorkers)) return false;
+  // A fresh file is zero-filled: no worker has attached yet.
+  L = reinterpret_cast<Layout *>(Region.GetData());
+  L->NumWorkers = NumWorkers;
+  L->NumSlots = kNumSlots;
+  L->FuzzerPid = GetPid();
+  L->Magic = kMagic;
+  return true;
+}
+
+bool RemoteWorkers::WaitForWorkers(int TimeoutSec) {
+  auto Deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(TimeoutSec);
+  for (size_t W = 0; W < L->NumWorkers; W++)
+    while (!L->Workers[W].Attached.load(std::memory_order_acquire)) {
+      if (std::chrono::steady_clock::now() > Deadline) return false;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  return true;
+}
+
+void RemoteWorkers::Stop() {
+  if (!IsRunning()) return;
+  L->Stopping.store(1);
+  for (size_t W = 0; W < L->NumWorkers; W++)
+    if (L->Workers[W].Waiting.exchange(0))
+      Region.Post(W);
+}
+
+void RemoteWorkers::Submit(const uint8_t *Data, size_t Size) {
+  assert(IsRunning() && CanSubmit());
+  if (Size > kMaxInputSize) {
+    Printf("ERROR: an input of %zd bytes does not fit in a remote slot\n",
+           Size);
+    exit(1);
+  }
+  uint64_t Idx = Head();
+  Slot *S = GetSlot(Idx);
+  S->InputSize = Size;
+  memcpy(S->Input, Data, Size);
+  L->Head.store(Idx + 1);
+  // The store above is sequentially consistent, like the worker's store of
+  // Waiting, so a worker either sees the input or is woken here.
+  for (size_t W = 0; W < L->NumWorkers; W++)
+    if (L->Workers[W].Waiting.load() && L->Workers[W].Waiting.exchange(0))
+      Region.Post(W);
+}
+
+bool RemoteWorkers::WaitOldest(size_t *Dead) {
+  assert(IsRunning() && NumPending());
+  for (size_t W = 0; W < L->NumWorkers; W++) {
+    WorkerState &S = L->Workers[W];
+    for (size_t i = 0; S.Tail.load(std::memory_order_acquire) <= Consumed;
+         i++) {
+      if (i < kSpins) {
+        std::this_thread::yield();
+        continue;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+      if (i % 1024 == 0 && !IsProcessAlive(S.Pid)) {
+        *Dead = W;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool RemoteWorkers::Attach(const char *Name, size_t Idx, size_t NumGuards) {
+  if (!Region.Open(Name, Idx + 1)) return false;
+  L = reinterpret_cast<Layout *>(Region.GetData());
+  if (Region.GetSize() < sizeof(Layout) || L->Magic != kMagic ||
+      Idx >= L->NumWorkers ||
+      Region.GetSize() < sizeof(Layout) + L->NumSlots * SlotSize()) {
+    L = nullptr;
+    return false;
+  }
+  MyIdx = Idx;
+  WorkerState &S = L->Workers[Idx];
+  S.Pid = GetPid();
+  S.NumGuards = NumGuards;
+  S.Tail.store(L->Head.load());
+  S.Attached.store(1, std::memory_order_release);
+  return true;
+}
+
+void RemoteWorkers::Serve(const WorkerCallback &Run) {
+  assert(L && Region.IsClient());
+  WorkerState &S = L->Workers[MyIdx];
+  uint64_t Tail = S.Tail.load(std::memory_order_relaxed);
+  size_t Idle = 0;
+  while (!L->Stopping.load(std::memory_order_relaxed)) {
+    if (L->Head.load(std::memory_order_acquire) == Tail) {
+      if (Idle++ < kSpins) {
+        std::this_thread::yield();
+        continue;
+      }
+      // Announce that we sleep, then look once more: the fuzzer checks the
+      // flag after it publishes an input.
+      S.Waiting.store(1);
+      if (L->Head.load() == Tail && !L->Stopping.load())
+        Region.Wait(MyIdx);
+      else
+        S.Waiting.store(0);
+      continue;
+    }
+    Idle = 0;
+    Slot *In = GetSlot(Tail);
+    Reply *R = GetReply(Tail, MyIdx);
+    int Result = 0;
+    uint64_t Nanos = 0;
+    R->Size = Run(In->Input, In->InputSize, &Result, &Nanos, R->Bytes,
+                  kMaxReplySize);
+    R->Result = Result;
+    R->Nanos = Nanos;
+    S.Tail.store(++Tail, std::memory_order_release);
+  }
+}
+
+}  // namespace fuzzer
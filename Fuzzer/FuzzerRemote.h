@@ -0,0 +1,134 @@
+//===- FuzzerRemote.h - INTERNAL - Callbacks in other processes -*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::RemoteWorkers
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_REMOTE_H
+#define LLVM_FUZZER_REMOTE_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerShmem.h"
+
+#include <atomic>
+#include <functional>
+
+namespace fuzzer {
+
+// Differential callbacks that run in processes of their own (-diff_remote),
+// e.g. because their libraries clash in one address space or need different
+// sanitizers. The fuzzer creates a SharedMemoryRegion with a ring of input
+// slots; every worker (-diff_remote_worker) runs one callback of its own
+// build on each input and writes its return value and its coverage into its
+// reply area of the slot. An input is written into the ring once for all
+// workers, and the fuzzer may submit the next inputs while it analyses the
+// replies to the earlier ones.
+//
+// A worker only sleeps (on a semaphore of its own) when the ring is empty;
+// the fuzzer waits for replies by spinning, then sleeping in short steps,
+// and gives up on a worker whose process is gone.
+class RemoteWorkers {
+ public:
+  static const size_t kMaxWorkers = 16;
+  static const size_t kNumSlots = 16;
+  static const size_t kMaxInputSize = 1 << 20;
+  static const size_t kMaxReplySize = 1 << 20;
+
+  // Fuzzer side.
+  bool Create(const char *Name, size_t NumWorkers);
+  // Waits until every worker has attached, for at most TimeoutSec seconds.
+  bool WaitForWorkers(int TimeoutSec);
+  bool IsRunning() const { return L && Region.IsServer(); }
+  size_t size() const { return L->NumWorkers; }
+  // The number of guards worker W reports coverage for.
+  size_t NumGuards(size_t W) const { return L->Workers[W].NumGuards; }
+  // Makes the workers exit once they are idle.
+  void Stop();
+
+  bool CanSubmit() const { return Head() - Consumed < L->NumSlots; }
+  size_t NumPending() const { return Head() - Consumed; }
+  // Sends Data to all workers. Requires CanSubmit().
+  void Submit(const uint8_t *Data, size_t Size);
+  // Waits for every reply to the oldest pending input. Returns false and
+  // the worker in *Dead if a worker died instead.
+  bool WaitOldest(size_t *Dead);
+  // The replies to the oldest pending input, once WaitOldest() returned.
+  int Result(size_t W) { return GetReply(Consumed, W)->Result; }
+  uint64_t Nanos(size_t W) { return GetReply(Consumed, W)->Nanos; }
+  const uint8_t *Coverage(size_t W, size_t *Size) {
+    Reply *R = GetReply(Consumed, W);
+    *Size = R->Size;
+    return R->Bytes;
+  }
+  Unit OldestInput() {
+    Slot *S = GetSlot(Consumed);
+    return Unit(S->Input, S->Input + S->InputSize);
+  }
+  void PopOldest() { Consumed++; }
+
+  // Worker side. Run gets an input, stores the callback's return value and
+  // running time, writes the coverage into Out and returns its size.
+  typedef std::function<size_t(const uint8_t *Data, size_t Size, int *Result,
+                               uint64_t *Nanos, uint8_t *Out,
+                               size_t MaxOutSize)>
+      WorkerCallback;
+  bool Attach(const char *Name, size_t Idx, size_t NumGuards);
+  // Serves inputs until the fuzzer stops.
+  void Serve(const WorkerCallback &Run);
+
+ private:
+  struct Slot {
+    uint64_t InputSize;
+    uint8_t Input[kMaxInputSize];
+  };
+  struct Reply {
+    int32_t Result;
+    uint64_t Nanos;
+    uint64_t Size;
+    uint8_t Bytes[kMaxReplySize];
+  };
+  struct alignas(64) WorkerState {
+    std::atomic<uint64_t> Tail;  // Inputs done by the worker.
+    std::atomic<uint32_t> Attached;
+    std::atomic<uint32_t> Waiting;
+    uint64_t Pid;
+    uint64_t NumGuards;
+  };
+  struct Layout {
+    uint64_t Magic;
+    uint64_t NumWorkers;
+    uint64_t NumSlots;
+    uint64_t FuzzerPid;
+    std::atomic<uint64_t> Head;  // Inputs submitted by the fuzzer.
+    std::atomic<uint32_t> Stopping;
+    WorkerState Workers[kMaxWorkers];
+  };
+  static const uint64_t kMagic = 0x52454D4F54455752ULL;  // "REMOTEWR"
+
+  size_t SlotSize() const {
+    return sizeof(Slot) + L->NumWorkers * sizeof(Reply);
+  }
+  Slot *GetSlot(uint64_t Idx) {
+    return reinterpret_cast<Slot *>(Region.GetData() + sizeof(Layout) +
+                                    (Idx % L->NumSlots) * SlotSize());
+  }
+  Reply *GetReply(uint64_t Idx, size_t W) {
+    return reinterpret_cast<Reply *>(reinterpret_cast<uint8_t *>(GetSlot(Idx)) +
+                                     sizeof(Slot) + W * sizeof(Reply));
+  }
+  uint64_t Head() const { return L->Head.load(std::memory_order_relaxed); }
+
+  SharedMemoryRegion Region;
+  Layout *L = nullptr;
+  uint64_t Consumed = 0;  // Fuzzer: inputs whose replies were taken.
+  size_t MyIdx = 0;       // Worker: the index of this worker.
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_REMOTE_H
@@ -0,0 +1,426 @@
+//===- FuzzerReplay.cpp - Bulk replay of diff artifacts -------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Replaying many inputs through all differential callbacks.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerDiffPack.h"
+#include "FuzzerForkServer.h"
+#include "FuzzerHash.h"
+#include "FuzzerIO.h"
+#include "FuzzerInternal.h"
+#include "FuzzerSeedCache.h"
+#include "FuzzerTracePC.h"
+#include "FuzzerUtil.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <thread>
+
+namespace fuzzer {
+
+namespace {
+// Inputs served by one forked child when -diff_fork is not given.
+const size_t kReplayInputsPerChild = 1000;
+
+struct ReplayInput {
+  std::string Name;
+  std::string Path;     // Empty for a -diff_pack record.
+  size_t PackIdx = 0;
+};
+
+struct ReplayRow {
+  std::vector<int> Results;
+  std::vector<int> Recorded;  // The results stored in the -diff_pack record.
+  bool Died = false;
+  int Status = 0;
+  size_t Size = 0;
+  MinHash Sig;  // Of the rejecting callbacks' coverage, for -diff_cluster=1.
+};
+
+std::string ResultsToString(const std::vector<int> &Results) {
+  std::string Res;
+  for (int R : Results)
+    Res += std::to_string(R) + "_";
+  return Res;
+}
+
+// -seed_cache keeps a PC as a pair that survives ASLR: the object it is in,
+// as one plus the line of its ObjectFileId() in TracePC::CodeId(), which
+// the cache is made for, in the top 16 bits, and its offset from the load
+// address of that object below. Bases are the load addresses of this run.
+// A PC that can't be placed, or 0, becomes 0.
+const int kObjectShift = sizeof(uintptr_t) * 8 - 16;
+
+uintptr_t PCToOffset(uintptr_t PC, const std::vector<uintptr_t> &Bases) {
+  // The objects do not overlap, so PC is in the one loaded last below it.
+  size_t Object = Bases.size();
+  for (size_t i = 0; i < Bases.size(); i++)
+    if (Bases[i] <= PC && (Object == Bases.size() || Bases[i] > Bases[Object]))
+      Object = i;
+  if (!PC || Object == Bases.size() || (PC - Bases[Object]) >> kObjectShift)
+    return 0;
+  return static_cast<uintptr_t>(Object + 1) << kObjectShift |
+         (PC - Bases[Object]);
+}
+
+uintptr_t OffsetToPC(uintptr_t Offset, const std::vector<uintptr_t> &Bases) {
+  size_t Object = Offset >> kObjectShift;
+  if (!Object || Object > Bases.size()) return 0;
+  return Bases[Object - 1] +
+         (Offset & ((static_cast<uintptr_t>(1) << kObjectShift) - 1));
+}
+}  // namespace
+
+// Runs every file under Inputs and every -diff_pack record through all the
+// differential callbacks, in forked children driven by NumWorkers threads,
+// and writes one row of callback results per input to TablePathOrNull, or
+// to stdout. A child that crashes or hangs only costs its current input.
+// With -diff_cluster=1 the diffs are also grouped into clusters, whose
+// smallest inputs are copied to ClusterDirOrNull.
+void Fuzzer::ReplayDiffs(const std::vector<std::string> &Inputs,
+                         size_t NumWorkers, const char *TablePathOrNull,
+                         const char *ClusterDirOrNull) {
+  std::vector<ReplayInput> Work;
+  for (auto &Inp : Inputs) {
+    std::vector<std::string> Files;
+    if (IsFile(Inp))
+      Files.push_back(Inp);
+    else
+      ListFilesInDirRecursive(Inp, nullptr, &Files, /*TopDir*/true);
+    std::sort(Files.begin(), Files.end());
+    for (auto &File : Files) {
+      Work.push_back(ReplayInput());
+      Work.back().Name = Work.back().Path = File;
+    }
+  }
+  for (size_t i = 0; i < DiffArtifacts.size(); i++) {
+    Work.push_back(ReplayInput());
+    Work.back().Name = Options.DiffPack + "#" + std::to_string(i);
+    Work.back().PackIdx = i;
+  }
+  size_t NumCallbacks = TPC.UC->size;
+  NumWorkers = NumWorkers ? NumWorkers : NumberOfCpuCores();
+  NumWorkers = Min(Max(NumWorkers, (size_t)1), Max(Work.size(), (size_t)1));
+  Printf("REPLAY: %zd inputs, %zd callbacks, %zd workers\n", Work.size(),
+         NumCallbacks, NumWorkers);
+
+  size_t InputsPerChild = Options.DiffForkInputs > 0
+                              ? static_cast<size_t>(Options.DiffForkInputs)
+                              : kReplayInputsPerChild;
+  std::unique_ptr<ForkServer[]> Servers(new ForkServer[NumWorkers]);
+  for (size_t W = 0; W < NumWorkers; W++)
+    if (!Servers[W].Start(
+            InputsPerChild,
+            ForkedResultsSize() + TPC.MaxExportedCoverageSize(),
+            [this](const uint8_t *Data, size_t Size, uint8_t *Out,
+                   size_t MaxOutSize) {
+              return RunCallbacksInForkedChild(Data, Size, Out, MaxOutSize);
+            }))
+      exit(1);
+
+  // Work[i], and the results recorded for it if it is a -diff_pack record.
+  auto Load = [&](size_t i, std::vector<int> *Recorded) {
+    Unit U;
+    DiffRecord R;
+    if (!Work[i].Path.empty()) {
+      U = FileToVector(Work[i].Path, MaxInputLen);
+    } else if (DiffArtifacts.Read(Work[i].PackIdx, &R)) {
+      U.swap(R.Input);
+      Recorded->swap(R.Results);
+      if (U.size() > MaxInputLen)
+        U.resize(MaxInputLen);
+    }
+    return U;
+  };
+  std::vector<ReplayRow> Rows(Work.size());
+  std::atomic<size_t> NextInput(0), NumDone(0);
+  auto RunWorker = [&](size_t W) {
+    while (true) {
+      size_t i = NextInput++;
+      if (i >= Work.size()) return;
+      ReplayRow &Row = Rows[i];
+      Unit U = Load(i, &Row.Recorded);
+      Row.Size = U.size();
+      const uint8_t *Reply;
+      size_t ReplySize;
+      if (Servers[W].Run(U.data(), U.size(), &Reply, &ReplySize)) {
+        Row.Results.resize(NumCallbacks);
+        memcpy(Row.Results.data(), Reply, NumCallbacks * sizeof(int));
+        if (Options.DiffCluster)
+          TPC.ForEachExportedGuard(
+              Reply + ForkedResultsSize(), ReplySize - ForkedResultsSize(),
+              [&](size_t Idx, uintptr_t PC) {
+                int j = TPC.CallbackOfFeature(Idx * 8);
+                if (j >= 0 && DiffVerdict(Row.Results[j]) != 0)
+                  Row.Sig.Add(PC ? PC : Idx);
+              });
+      } else {
+        Row.Died = true;
+        Row.Status = Servers[W].LastStatus();
+      }
+      NumDone++;
+    }
+  };
+  std::vector<std::thread> Threads;
+  for (size_t W = 0; W < NumWorkers; W++)
+    Threads.push_back(std::thread(RunWorker, W));
+  while (NumDone < Work.size()) {
+    SleepSeconds(1);
+    if (Options.Verbosity)
+      Printf("REPLAY: %zd/%zd inputs done\n", NumDone.load(), Work.size());
+  }
+  for (auto &T : Threads)
+    T.join();
+
+  FILE *Table = TablePathOrNull ? fopen(TablePathOrNull, "w") : stdout;
+  if (!Table) {
+    Printf("ERROR: can't open %s for writing\n", TablePathOrNull);
+    exit(1);
+  }
+  std::map<std::string, size_t> Vectors;
+  size_t NumDiffs = 0, NumDied = 0, NumChanged = 0;
+  for (size_t i = 0; i < Work.size(); i++) {
+    const ReplayRow &Row = Rows[i];
+    std::string Results = Row.Died
+                              ? "died(" + std::to_string(Row.Status) + ")"
+                              : ResultsToString(Row.Results);
+    fprintf(Table, "%s\t%s", Work[i].Name.c_str(), Results.c_str());
+    if (Work[i].Path.empty()) {
+      bool Changed = Row.Died || Row.Results != Row.Recorded;
+      fprintf(Table, "\t%s\t%s", ResultsToString(Row.Recorded).c_str(),
+              Changed ? "changed" : "same");
+      NumChanged += Changed;
+    }
+    fprintf(Table, "\n");
+    Vectors[Results]++;
+    NumDied += Row.Died;
+    for (size_t j = 1; !Row.Died && j < Row.Results.size(); j++)
+      if (DiffVerdict(Row.Results[j]) != DiffVerdict(Row.Results[0])) {
+        NumDiffs++;
+        break;
+      }
+  }
+  if (Table != stdout)
+    fclose(Table);
+  else
+    fflush(stdout);
+
+  std::vector<std::pair<size_t, std::string>> ByCount;
+  for (auto &V : Vectors)
+    ByCount.push_back({V.second, V.first});
+  std::sort(ByCount.rbegin(), ByCount.rend());
+  for (auto &V : ByCount)
+    Printf("REPLAY: %zd x %s\n", V.first, V.second.c_str());
+  Printf("REPLAY: %zd inputs, %zd distinct result vectors, %zd diffs, "
+         "%zd died",
+         Work.size(), Vectors.size(), NumDiffs, NumDied);
+  if (DiffArtifacts.size())
+    Printf(", %zd of %zd pack records changed", NumChanged,
+           DiffArtifacts.size());
+  Printf("\n");
+
+  if (!Options.DiffCluster) return;
+
+  // Cluster the diffs in input order; the head of a cluster is its smallest
+  // input.
+  struct Cluster {
+    size_t Size = 0, Head = 0;
+    std::string Verdicts;
+  };
+  std::vector<Cluster> ClusterList;
+  std::vector<int> Verdicts(NumCallbacks);
+  for (size_t i = 0; i < Work.size(); i++) {
+    const ReplayRow &Row = Rows[i];
+    if (Row.Died) continue;
+    Hasher128 Pattern;
+    bool IsDiff = false;
+    for (size_t j = 0; j < NumCallbacks; j++) {
+      Verdicts[j] = DiffVerdict(Row.Results[j]);
+      Pattern.Update(static_cast<uint32_t>(Verdicts[j]));
+      IsDiff |= Verdicts[j] != Verdicts[0];
+    }
+    if (!IsDiff) continue;
+    bool IsNew;
+    size_t C = Clusters.Insert(Pattern.Final().Lo, Row.Sig, &IsNew);
+    if (IsNew) {
+      ClusterList.push_back(Cluster());
+      ClusterList.back().Head = i;
+      ClusterList.back().Verdicts = ResultsToString(Verdicts);
+    }
+    Cluster &Cl = ClusterList[C];
+    Cl.Size++;
+    if (Row.Size < Rows[Cl.Head].Size)
+      Cl.Head = i;
+  }
+  for (size_t C = 0; C < ClusterList.size(); C++) {
+    const Cluster &Cl = ClusterList[C];
+    Printf("CLUSTER: %zd %zd x %s head %s\n", C, Cl.Size,
+           Cl.Verdicts.c_str(), Work[Cl.Head].Name.c_str());
+    if (!ClusterDirOrNull) continue;
+    std::vector<int> Recorded;
+    Unit U = Load(Cl.Head, &Recorded);
+    WriteToFile(U, DirPlusFile(ClusterDirOrNull,
+                               "cluster-" + std::to_string(C) + "-" +
+                                   Hash(U)));
+  }
+  Printf("CLUSTER: %zd diffs in %zd clusters\n", Clusters.NumDiffs(),
+         Clusters.size());
+}
+
+// Analyses the reply of a forked child to (Data, Size) like RunOne analyses a
+// -diff_fork run. Returns true if the input joined the corpus.
+bool Fuzzer::RunOneFromForkedReply(const uint8_t *Data, size_t Size,
+                                   const uint8_t *Reply, size_t ReplySize) {
+  TPC.ResetCoverage();
+  TPC.ResetMaps();
+  size_t N = TPC.OutputDiffVec.size();
+  memcpy(TPC.OutputDiffVec.data(), Reply, N * sizeof(int));
+  memcpy(CallbackNanos.data(), Reply + N * sizeof(int), N * sizeof(uint64_t));
+  size_t ResultsSize = ForkedResultsSize();
+  TPC.ImportCoverage(Reply + ResultsSize, ReplySize - ResultsSize);
+  for (size_t i = 0; i < N; i++)
+    RecordCallbackLatency(i, CallbackNanos[i], Data, Size);
+  // The time of the run was spent in the child.
+  UnitStartTime = UnitStopTime = system_clock::now();
+  std::vector<int> FeaturesPerCallback;
+  size_t Features = CollectAllCallbackFeatures(Data, Size, false, nullptr,
+                                               &FeaturesPerCallback);
+  return FinishDiffRun(Data, Size, false, Features, FeaturesPerCallback);
+}
+
+// Runs Seeds through all differential callbacks in forked children driven
+// by NumWorkers threads, a chunk at a time, and then hands the replies of
+// the chunk to RunOneFromForkedReply() in the order of Seeds, so that the
+// corpus, the diffs and the statistics come out as after a serial pass. The
+// coverage of every reply goes through the coverage tables on its own, as
+// with -diff_fork. With -seed_cache the replies come from the cache where
+// they can, and all of them are saved in it for the next run, with their PCs
+// relative to the objects they are in.
+void Fuzzer::TriageSeeds(const UnitVector &Seeds, size_t NumWorkers,
+                         const std::function<void(const Unit &)> &OnNewUnit) {
+  NumWorkers = Min(Max(NumWorkers, (size_t)1), Max(Seeds.size(), (size_t)1));
+  SeedCache Cache;
+  std::vector<uintptr_t> Bases;
+  if (!Options.SeedCache.empty()) {
+    // Anything that changes the exported coverage is part of the Id.
+    std::string Id = TPC.CodeId(&Bases);
+    if (Id.empty())
+      Printf("WARNING: can't identify the instrumented code, -seed_cache is "
+             "ignored\n");
+    else if (Cache.Open(Options.SeedCache,
+                        Id + "counters=" + std::to_string(Options.UseCounters) +
+                            " value_profile=" +
+                            std::to_string(Options.UseValueProfile) + "/" +
+                            std::to_string(Options.ValueProfileMapBits)))
+      Printf("INFO: %zd seeds in the seed cache\n", Cache.size());
+  }
+  size_t InputsPerChild = Options.DiffForkInputs > 0
+                              ? static_cast<size_t>(Options.DiffForkInputs)
+                              : kReplayInputsPerChild;
+  size_t ResultsSize = ForkedResultsSize();
+  size_t MaxReplySize = ResultsSize + TPC.MaxExportedCoverageSize();
+  std::unique_ptr<ForkServer[]> Servers(new ForkServer[NumWorkers]);
+  for (size_t W = 0; W < NumWorkers; W++)
+    if (!Servers[W].Start(
+            InputsPerChild, MaxReplySize,
+            [this](const uint8_t *Data, size_t Size, uint8_t *Out,
+                   size_t MaxOutSize) {
+              return RunCallbacksInForkedChild(Data, Size, Out, MaxOutSize);
+            }))
+      exit(1);
+  Printf("INFO: running %zd seeds on %zd workers\n", Seeds.size(),
+         NumWorkers);
+
+  // Replies are kept for one chunk of seeds at a time.
+  const size_t kChunkSize = 64 * NumWorkers;
+  std::vector<std::vector<uint8_t>> Replies(kChunkSize);
+  std::vector<int> Statuses(kChunkSize);
+  std::vector<char> Cached(kChunkSize);
+  std::vector<uint8_t> CacheReply;
+  size_t NumCached = 0;
+  for (size_t Begin = 0; Begin < Seeds.size(); Begin += kChunkSize) {
+    if (TotalNumberOfRuns >= Options.MaxNumberOfRuns) break;
+    size_t End = Min(Begin + kChunkSize, Seeds.size());
+    size_t RunsLeft = Options.MaxNumberOfRuns - TotalNumberOfRuns;
+    if (End - Begin > RunsLeft)
+      End = Begin + RunsLeft;
+    for (size_t i = Begin; i < End; i++) {
+      const uint8_t *Reply = nullptr;
+      size_t Size = 0;
+      if (Cache.IsOpen() && !Seeds[i].empty())
+        Reply = Cache.Find(Seeds[i], &Size);
+      Cached[i - Begin] = Reply != nullptr;
+      if (!Reply) continue;
+      std::vector<uint8_t> &R = Replies[i - Begin];
+      R.assign(Reply, Reply + Size);
+      if (Size > ResultsSize)
+        TPC.MapExportedPCs(R.data() + ResultsSize, Size - ResultsSize,
+                           [&](uintptr_t O) { return OffsetToPC(O, Bases); });
+    }
+    std::atomic<size_t> Next(Begin);
+    auto RunWorker = [&](size_t W) {
+      while (true) {
+        size_t i = Next++;
+        if (i >= End) return;
+        if (Cached[i - Begin]) continue;
+        std::vector<uint8_t> &Reply = Replies[i - Begin];
+        const Unit &U = Seeds[i];
+        const uint8_t *Out;
+        size_t OutSize;
+        Reply.clear();
+        Statuses[i - Begin] = 0;
+        if (U.empty()) continue;
+        if (Servers[W].Run(U.data(), U.size(), &Out, &OutSize))
+          Reply.assign(Out, Out + OutSize);
+        else
+          Statuses[i - Begin] = Servers[W].LastStatus();
+      }
+    };
+    std::vector<std::thread> Threads;
+    for (size_t W = 0; W < NumWorkers; W++)
+      Threads.push_back(std::thread(RunWorker, W));
+    for (auto &T : Threads)
+      T.join();
+    for (size_t i = Begin; i < End; i++) {
+      const Unit &U = Seeds[i];
+      const std::vector<uint8_t> &Reply = Replies[i - Begin];
+      if (U.empty()) {
+        RunOne(U.data(), U.size());
+        continue;
+      }
+      if (Reply.empty()) {
+        NumberOfForkedChildFailures++;
+        Printf("INFO: seed %zd died (wait status %d), skipping it\n", i,
+               Statuses[i - Begin]);
+        continue;
+      }
+      NumCached += Cached[i - Begin];
+      if (Cache.IsOpen()) {
+        CacheReply = Reply;
+        if (CacheReply.size() > ResultsSize)
+          TPC.MapExportedPCs(
+              CacheReply.data() + ResultsSize, CacheReply.size() - ResultsSize,
+              [&](uintptr_t PC) { return PCToOffset(PC, Bases); });
+        Cache.Add(U, CacheReply.data(), CacheReply.size());
+      }
+      if (RunOneFromForkedReply(U.data(), U.size(), Reply.data(),
+                                Reply.size()))
+        OnNewUnit(U);
+    }
+  }
+  if (Cache.IsOpen()) {
+    Printf("INFO: %zd seeds admitted from the seed cache\n", NumCached);
+    Cache.Commit();
+  }
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,266 @@
+//===- FuzzerRoaring.cpp - Compressed sets of guards ------------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::RoaringBitmap
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerRoaring.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+namespace fuzzer {
+
+void RoaringBitmap::Add(uint32_t Value) {
+  uint16_t Key = static_cast<uint16_t>(Value >> 16);
+  uint16_t Low = static_cast<uint16_t>(Value);
+  if (Containers.empty() || Containers.back().Key < Key) {
+    Containers.emplace_back();
+    Containers.back().Key = Key;
+  }
+  Container *C = &Containers.back();
+  if (C->Key != Key) {
+    auto It = std::lower_bound(
+        Containers.begin(), Containers.end(), Key,
+        [](const Container &A, uint16_t K) { return A.Key < K; });
+    if (It->Key != Key) {
+      It = Containers.emplace(It);
+      It->Key = Key;
+    }
+    C = &*It;
+  }
+  if (!C->Bits.empty()) {
+    uint64_t Mask = 1ULL << (Low % 64);
+    if (C->Bits[Low / 64] & Mask) return;
+    C->Bits[Low / 64] |= Mask;
+    C->Cardinality++;
+    return;
+  }
+  if (C->Array.empty() || C->Array.back() < Low) {
+    C->Array.push_back(Low);
+  } else {
+    auto It = std::lower_bound(C->Array.begin(), C->Array.end(), Low);
+    if (*It == Low) return;
+    C->Array.insert(It, Low);
+  }
+  C->Cardinality++;
+  if (C->Array.size() > kMaxArraySize) {
+    ToBits(*C, &C->Bits);
+    std::vector<uint16_t>().swap(C->Array);
+  }
+}
+
+bool RoaringBitmap::Contains(uint32_t Value) const {
+  uint16_t Key = static_cast<uint16_t>(Value >> 16);
+  uint16_t Low = static_cast<uint16_t>(Value);
+  auto It = std::lower_bound(
+      Containers.begin(), Containers.end(), Key,
+      [](const Container &A, uint16_t K) { return A.Key < K; });
+  if (It == Containers.end() || It->Key != Key) return false;
+  if (!It->Bits.empty())
+    return It->Bits[Low / 64] & (1ULL << (Low % 64));
+  return std::binary_search(It->Array.begin(), It->Array.end(), Low);
+}
+
+size_t RoaringBitmap::Cardinality() const {
+  size_t Res = 0;
+  for (auto &C : Containers)
+    Res += C.Cardinality;
+  return Res;
+}
+
+void RoaringBitmap::ToBits(const Container &C, std::vector<uint64_t> *Bits) {
+  if (!C.Bits.empty()) {
+    *Bits = C.Bits;
+    return;
+  }
+  Bits->assign(kBitmapWords, 0);
+  for (uint16_t Low : C.Array)
+    (*Bits)[Low / 64] |= 1ULL << (Low % 64);
+}
+
+bool RoaringBitmap::Shrink(Container *C) {
+  if (!C->Bits.empty() && C->Cardinality <= kMaxArraySize) {
+    C->Array.clear();
+    C->Array.reserve(C->Cardinality);
+    for (size_t W = 0; W < kBitmapWords; W++)
+      for (uint64_t Word = C->Bits[W]; Word; Word &= Word - 1)
+        C->Array.push_back(
+            static_cast<uint16_t>(W * 64 + __builtin_ctzll(Word)));
+    std::vector<uint64_t>().swap(C->Bits);
+  }
+  return C->Cardinality != 0;
+}
+
+// Out gets the Key of A. Two arrays are merged as arrays; an array is
+// filtered by a bitmap where the result can't be larger than the array;
+// anything else is done word by word on bitmaps.
+bool RoaringBitmap::Combine(const Container &A, const Container &B,
+                            Operation Op, Container *Out) {
+  Out->Key = A.Key;
+  Out->Array.clear();
+  Out->Bits.clear();
+  if (A.Bits.empty() && B.Bits.empty()) {
+    auto Into = std::back_inserter(Out->Array);
+    auto AB = A.Array.begin(), AE = A.Array.end();
+    auto BB = B.Array.begin(), BE = B.Array.end();
+    if (Op == kAnd)
+      std::set_intersection(AB, AE, BB, BE, Into);
+    else if (Op == kOr)
+      std::set_union(AB, AE, BB, BE, Into);
+    else
+      std::set_difference(AB, AE, BB, BE, Into);
+    Out->Cardinality = Out->Array.size();
+    if (Out->Cardinality > kMaxArraySize) {
+      ToBits(*Out, &Out->Bits);
+      std::vector<uint16_t>().swap(Out->Array);
+    }
+    return Out->Cardinality != 0;
+  }
+  if (Op != kOr && (A.Bits.empty() || (Op == kAnd && B.Bits.empty()))) {
+    const Container &Small = A.Bits.empty() ? A : B;
+    const std::vector<uint64_t> &Big = A.Bits.empty() ? B.Bits : A.Bits;
+    bool Keep = Op == kAnd;
+    for (uint16_t Low : Small.Array)
+      if (((Big[Low / 64] >> (Low % 64)) & 1) == Keep)
+        Out->Array.push_back(Low);
+    Out->Cardinality = Out->Array.size();
+    return Out->Cardinality != 0;
+  }
+  std::vector<uint64_t> Other;
+  ToBits(A, &Out->Bits);
+  ToBits(B, &Other);
+  Out->Cardinality = 0;
+  for (size_t W = 0; W < kBitmapWords; W++) {
+    uint64_t &Word = Out->Bits[W];
+    Word = Op == kAnd ? Word & Other[W]
+         : Op == kOr  ? Word | Other[W]
+                      : Word & ~Other[W];
+    Out->Cardinality += __builtin_popcountll(Word);
+  }
+  return Shrink(Out);
+}
+
+void RoaringBitmap::Apply(const RoaringBitmap &Other, Operation Op) {
+  std::vector<Container> Res;
+  auto A = Containers.begin(), AE = Containers.end();
+  auto B = Other.Containers.begin(), BE = Other.Containers.end();
+  while (A != AE || B != BE) {
+    if (B == BE || (A != AE && A->Key < B->Key)) {
+      if (Op != kAnd)
+        Res.push_back(std::move(*A));
+      ++A;
+    } else if (A == AE || B->Key < A->Key) {
+      if (Op == kOr)
+        Res.push_back(*B);
+      ++B;
+    } else {
+      Container C;
+      if (Combine(*A, *B, Op, &C))
+        Res.push_back(std::move(C));
+      ++A;
+      ++B;
+    }
+  }
+  Containers.swap(Res);
+}
+
+void RoaringBitmap::IntersectWith(const RoaringBitmap &Other) {
+  Apply(Other, kAnd);
+}
+
+void RoaringBitmap::UnionWith(const RoaringBitmap &Other) {
+  Apply(Other, kOr);
+}
+
+void RoaringBitmap::Subtract(const RoaringBitmap &Other) {
+  Apply(Other, kAndNot);
+}
+
+// The cookie and the number of containers, a {Key, Cardinality - 1} pair of
+// 16-bit words and a 32-bit offset for every container, then the containers.
+// Whether a container is an array or a bitmap follows from its cardinality.
+size_t RoaringBitmap::SerializedSize() const {
+  size_t Size = 8 + 8 * Containers.size();
+  for (auto &C : Containers)
+    Size += C.Bits.empty() ? 2 * C.Array.size() : 8 * kBitmapWords;
+  return Size;
+}
+
+void RoaringBitmap::Serialize(uint8_t *Out) const {
+  uint32_t Header[2] = {kCookie, static_cast<uint32_t>(Containers.size())};
+  memcpy(Out, Header, sizeof(Header));
+  uint8_t *Descriptive = Out + 8;
+  uint8_t *Offsets = Descriptive + 4 * Containers.size();
+  uint8_t *P = Offsets + 4 * Containers.size();
+  for (auto &C : Containers) {
+    uint16_t KeyAndCard[2] = {C.Key, static_cast<uint16_t>(C.Cardinality - 1)};
+    memcpy(Descriptive, KeyAndCard, sizeof(KeyAndCard));
+    Descriptive += sizeof(KeyAndCard);
+    uint32_t Offset = static_cast<uint32_t>(P - Out);
+    memcpy(Offsets, &Offset, sizeof(Offset));
+    Offsets += sizeof(Offset);
+    if (C.Bits.empty()) {
+      memcpy(P, C.Array.data(), 2 * C.Array.size());
+      P += 2 * C.Array.size();
+    } else {
+      memcpy(P, C.Bits.data(), 8 * kBitmapWords);
+      P += 8 * kBitmapWords;
+    }
+  }
+}
+
+bool RoaringBitmap::Deserialize(const uint8_t *Data, size_t Size) {
+  clear();
+  uint32_t Header[2];
+  if (Size < sizeof(Header)) return false;
+  memcpy(Header, Data, sizeof(Header));
+  size_t N = Header[1];
+  if (Header[0] != kCookie || N > 65536 || Size < 8 + 8 * N) return false;
+  Containers.resize(N);
+  for (size_t i = 0; i < N; i++) {
+    Container &C = Containers[i];
+    uint16_t KeyAndCard[2];
+    uint32_t Offset;
+    memcpy(KeyAndCard, Data + 8 + 4 * i, sizeof(KeyAndCard));
+    memcpy(&Offset, Data + 8 + 4 * N + 4 * i, sizeof(Offset));
+    C.Key = KeyAndCard[0];
+    C.Cardinality = static_cast<size_t>(KeyAndCard[1]) + 1;
+    bool IsBitmap = C.Cardinality > kMaxArraySize;
+    size_t Bytes = IsBitmap ? 8 * kBitmapWords : 2 * C.Cardinality;
+    if ((i && C.Key <= Containers[i - 1].Key) || Offset > Size ||
+        Size - Offset < Bytes) {
+      clear();
+      return false;
+    }
+    size_t Count = 0;
+    if (IsBitmap) {
+      C.Bits.resize(kBitmapWords);
+      memcpy(C.Bits.data(), Data + Offset, Bytes);
+      for (uint64_t Word : C.Bits)
+        Count += __builtin_popcountll(Word);
+    } else {
+      C.Array.resize(C.Cardinality);
+      memcpy(C.Array.data(), Data + Offset, Bytes);
+      Count = std::adjacent_find(C.Array.begin(), C.Array.end(),
+                                 [](uint16_t A, uint16_t B) {
+                                   return A >= B;
+                                 }) == C.Array.end()
+                  ? C.Cardinality
+                  : 0;
+    }
+    if (Count != C.Cardinality) {
+      clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace fuzzer
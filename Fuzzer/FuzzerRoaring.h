@@ -0,0 +1,97 @@
+//===- FuzzerRoaring.h - Compressed sets of guards --------------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::RoaringBitmap
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_ROARING_H
+#define LLVM_FUZZER_ROARING_H
+
+#include "FuzzerDefs.h"
+
+#include <vector>
+
+namespace fuzzer {
+
+// A set of 32-bit values, such as the guards a callback covered, as a Roaring
+// bitmap: the values are split by their upper 16 bits into containers, each a
+// sorted array of the lower 16 bits while it holds at most 4096 of them and a
+// 65536-bit bitmap after that. A few hundred scattered guards take two bytes
+// each, a dense run of a library's code one bit each.
+//
+// Serialize() writes the portable Roaring format without run containers
+// (cookie 12346), which CRoaring, Java's RoaringBitmap and pyroaring read.
+class RoaringBitmap {
+ public:
+  // Adding in increasing order, as ForEachCoveredGuard() does, only appends.
+  void Add(uint32_t Value);
+  bool Contains(uint32_t Value) const;
+  size_t Cardinality() const;
+  bool empty() const { return Containers.empty(); }
+  void clear() { Containers.clear(); }
+
+  // The values in increasing order.
+  template <class Callback>
+  void ForEach(Callback CB) const {
+    for (auto &C : Containers) {
+      uint32_t High = static_cast<uint32_t>(C.Key) << 16;
+      if (C.Bits.empty()) {
+        for (uint16_t Low : C.Array)
+          CB(High | Low);
+        continue;
+      }
+      for (size_t W = 0; W < kBitmapWords; W++)
+        for (uint64_t Word = C.Bits[W]; Word; Word &= Word - 1)
+          CB(High | static_cast<uint32_t>(W * 64 + __builtin_ctzll(Word)));
+    }
+  }
+
+  void IntersectWith(const RoaringBitmap &Other);
+  void UnionWith(const RoaringBitmap &Other);
+  void Subtract(const RoaringBitmap &Other);
+
+  size_t SerializedSize() const;
+  // Writes SerializedSize() bytes to Out.
+  void Serialize(uint8_t *Out) const;
+  // Returns false, leaving the set empty, if Data is not a bitmap written by
+  // Serialize().
+  bool Deserialize(const uint8_t *Data, size_t Size);
+
+  bool operator==(const RoaringBitmap &Other) const {
+    return Containers == Other.Containers;
+  }
+
+ private:
+  static const size_t kMaxArraySize = 4096;
+  static const size_t kBitmapWords = 1024;
+  static const uint32_t kCookie = 12346;
+
+  struct Container {
+    uint16_t Key;
+    std::vector<uint16_t> Array;  // Empty if Bits is used.
+    std::vector<uint64_t> Bits;   // kBitmapWords words, or none.
+    size_t Cardinality = 0;
+    bool operator==(const Container &Other) const {
+      return Key == Other.Key && Array == Other.Array && Bits == Other.Bits;
+    }
+  };
+  enum Operation { kAnd, kOr, kAndNot };
+
+  static void ToBits(const Container &C, std::vector<uint64_t> *Bits);
+  // Turns a bitmap that got small into an array; false if it got empty.
+  static bool Shrink(Container *C);
+  static bool Combine(const Container &A, const Container &B, Operation Op,
+                      Container *Out);
+  void Apply(const RoaringBitmap &Other, Operation Op);
+
+  std::vector<Container> Containers;  // By increasing Key.
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_ROARING_H
@@ -0,0 +1,91 @@
+//===- FuzzerSampler.h - INTERNAL - Weighted index sampler ------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// WeightedSampler.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_SAMPLER_H
+#define LLVM_FUZZER_SAMPLER_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerRandom.h"
+#include <vector>
+
+namespace fuzzer {
+
+// Picks index i with probability Weight(i) / Total(). The weights live in a
+// Fenwick tree, so appending an index, changing a weight and sampling all
+// take O(log N). Weights are integers, which keeps the sums exact no matter
+// how many updates have been applied.
+class WeightedSampler {
+ public:
+  size_t size() const { return Weights.size(); }
+  uint64_t Weight(size_t Idx) const { return Weights[Idx]; }
+  uint64_t Total() const { return Sum; }
+
+  void PushBack(uint64_t W) {
+    Weights.push_back(W);
+    size_t N = Weights.size();  // 1-based index of the new node.
+    // The new node covers (N - LowBit(N), N]: W plus the nodes below it.
+    uint64_t Node = W;
+    for (size_t Child = N - 1; Child > N - LowBit(N); Child -= LowBit(Child))
+      Node += Tree[Child - 1];
+    Tree.push_back(Node);
+    Sum += W;
+  }
+
+  void Set(size_t Idx, uint64_t W) {
+    assert(Idx < Weights.size());
+    uint64_t Old = Weights[Idx];
+    if (Old == W) return;
+    Weights[Idx] = W;
+    Sum += W - Old;
+    // Unsigned wrap-around makes the same loop work for decreases.
+    for (size_t I = Idx + 1; I <= Tree.size(); I += LowBit(I))
+      Tree[I - 1] += W - Old;
+  }
+
+  // Returns the index whose range of cumulative weight contains X < Total().
+  size_t Find(uint64_t X) const {
+    assert(X < Sum);
+    size_t Pos = 0;  // Number of indices known to end at or below X.
+    size_t Step = 1;
+    while (Step * 2 <= Tree.size()) Step *= 2;
+    for (; Step; Step /= 2) {
+      if (Pos + Step <= Tree.size() && Tree[Pos + Step - 1] <= X) {
+        Pos += Step;
+        X -= Tree[Pos - 1];
+      }
+    }
+    return Pos;
+  }
+
+  // Falls back to a uniform choice while all weights are zero.
+  size_t Sample(Random &Rand) const {
+    assert(!Weights.empty());
+    if (!Sum) return Rand(Weights.size());
+    return Find(Rand(Sum));
+  }
+
+  void clear() {
+    Weights.clear();
+    Tree.clear();
+    Sum = 0;
+  }
+
+ private:
+  static size_t LowBit(size_t I) { return I & (~I + 1); }
+
+  std::vector<uint64_t> Weights;
+  std::vector<uint64_t> Tree;  // Tree[I - 1] sums (I - LowBit(I), I].
+  uint64_t Sum = 0;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_SAMPLER_H
@@ -0,0 +1,113 @@
+//===- FuzzerSeedCache.cpp - Cached seed replies --------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// SeedCache
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerSeedCache.h"
+#include "FuzzerIO.h"
+
+#include <cstring>
+
+namespace fuzzer {
+
+namespace {
+const char kSeedCacheMagic[8] = {'F', 'S', 'E', 'E', 'D', 'C', '0', '2'};
+
+// The file is the magic and the Id digest, then one record per seed: the
+// SHA1 of the seed, the size of the reply as 32 bits, the reply.
+const size_t kHeaderSize = sizeof(kSeedCacheMagic) + kSHA1NumBytes;
+const size_t kRecordHeaderSize = kSHA1NumBytes + sizeof(uint32_t);
+
+std::string IdDigest(const std::string &Id) {
+  uint8_t Sha1[kSHA1NumBytes];
+  ComputeSHA1(reinterpret_cast<const uint8_t *>(Id.data()), Id.size(), Sha1);
+  return std::string(reinterpret_cast<char *>(Sha1), sizeof(Sha1));
+}
+}  // namespace
+
+std::string SeedCache::Key(const Unit &U) {
+  uint8_t Sha1[kSHA1NumBytes];
+  ComputeSHA1(U.data(), U.size(), Sha1);
+  return std::string(reinterpret_cast<char *>(Sha1), sizeof(Sha1));
+}
+
+bool SeedCache::Open(const std::string &Path, const std::string &Id) {
+  assert(!IsOpen());
+  this->Path = Path;
+  std::string Digest = IdDigest(Id);
+  Map = MapFile(Path, &MapSize);
+  if (Map && MapSize >= kHeaderSize &&
+      !memcmp(Map, kSeedCacheMagic, sizeof(kSeedCacheMagic)) &&
+      !memcmp(Map + sizeof(kSeedCacheMagic), Digest.data(), Digest.size())) {
+    const uint8_t *P = Map + kHeaderSize, *End = Map + MapSize;
+    while (static_cast<size_t>(End - P) >= kRecordHeaderSize) {
+      uint32_t Size;
+      memcpy(&Size, P + kSHA1NumBytes, sizeof(Size));
+      if (Size > static_cast<size_t>(End - P) - kRecordHeaderSize) break;
+      Entries[std::string(reinterpret_cast<const char *>(P), kSHA1NumBytes)] =
+          {P + kRecordHeaderSize, Size};
+      P += kRecordHeaderSize + Size;
+    }
+  } else if (Map) {
+    Printf("INFO: %s was made for other code, not using it\n", Path.c_str());
+  }
+  Out = fopen((Path + ".tmp").c_str(), "wb");
+  if (!Out) {
+    Printf("ERROR: can't write %s.tmp\n", Path.c_str());
+    Close();
+    return false;
+  }
+  fwrite(kSeedCacheMagic, sizeof(kSeedCacheMagic), 1, Out);
+  fwrite(Digest.data(), Digest.size(), 1, Out);
+  return true;
+}
+
+void SeedCache::Close() {
+  Entries.clear();
+  UnmapFile(Map, MapSize);
+  Map = nullptr;
+  MapSize = 0;
+  if (Out) {
+    fclose(Out);
+    Out = nullptr;
+    RemoveFile(Path + ".tmp");
+  }
+}
+
+const uint8_t *SeedCache::Find(const Unit &U, size_t *Size) const {
+  auto It = Entries.find(Key(U));
+  if (It == Entries.end()) return nullptr;
+  *Size = It->second.Size;
+  return It->second.Reply;
+}
+
+void SeedCache::Add(const Unit &U, const uint8_t *Reply, size_t Size) {
+  assert(IsOpen());
+  uint32_t Size32 = static_cast<uint32_t>(Size);
+  std::string K = Key(U);
+  fwrite(K.data(), K.size(), 1, Out);
+  fwrite(&Size32, sizeof(Size32), 1, Out);
+  fwrite(Reply, Size, 1, Out);
+}
+
+bool SeedCache::Commit() {
+  assert(IsOpen());
+  bool Ok = !ferror(Out);
+  Ok &= !fclose(Out);
+  Out = nullptr;
+  Ok = Ok && RenameFile(Path + ".tmp", Path);
+  if (!Ok) {
+    Printf("WARNING: can't save the seed cache %s\n", Path.c_str());
+    RemoveFile(Path + ".tmp");
+  }
+  Close();
+  return Ok;
+}
+
+}  // namespace fuzzer
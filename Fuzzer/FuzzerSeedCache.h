@@ -0,0 +1,65 @@
+//===- FuzzerSeedCache.h - Cached seed replies ------------------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::SeedCache
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_SEED_CACHE_H
+#define LLVM_FUZZER_SEED_CACHE_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerSHA1.h"
+
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+
+namespace fuzzer {
+
+// The replies of forked children to the seeds (results, latencies and
+// exported coverage of all callbacks), keyed by the SHA1 of the seed, so
+// that a restarted fuzzer can admit a seed without running it. A cache is
+// only valid for the code it was made with: Open() ignores a file written
+// for another Id.
+//
+// The old cache is mapped while the new one is written next to it; Commit()
+// renames the new one over it, so the file only ever holds the replies to
+// the seeds of the last run.
+class SeedCache {
+ public:
+  ~SeedCache() { Close(); }
+
+  bool Open(const std::string &Path, const std::string &Id);
+  void Close();
+  bool IsOpen() const { return Out != nullptr; }
+  // The number of replies found in the old cache.
+  size_t size() const { return Entries.size(); }
+
+  // The cached reply to U, or nullptr.
+  const uint8_t *Find(const Unit &U, size_t *Size) const;
+  // Records the reply to U in the new cache.
+  void Add(const Unit &U, const uint8_t *Reply, size_t Size);
+  bool Commit();
+
+ private:
+  struct Entry {
+    const uint8_t *Reply;
+    size_t Size;
+  };
+  static std::string Key(const Unit &U);
+
+  std::string Path;
+  const uint8_t *Map = nullptr;
+  size_t MapSize = 0;
+  std::unordered_map<std::string, Entry> Entries;
+  FILE *Out = nullptr;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_SEED_CACHE_H
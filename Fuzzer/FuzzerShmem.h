@@ -15,6 +15,7 @@
 #include <algorithm>
 #include <cstring>
 #include <string>
+#include <vector>
 
 #include "FuzzerDefs.h"
 
@@ -22,17 +23,24 @@ namespace fuzzer {
 
 class SharedMemoryRegion {
  public:
-  bool Create(const char *Name);
-  bool Open(const char *Name);
+  // The region starts zero-filled, even if a stale one of the same name
+  // exists. It comes with NumSemaphores semaphores, numbered from 0; the
+  // first two serve PostServer() and friends.
+  bool Create(const char *Name, size_t Size = kShmemSize,
+              size_t NumSemaphores = 2);
+  bool Open(const char *Name, size_t NumSemaphores = 2);
   bool Destroy(const char *Name);
   uint8_t *GetData() { return Data; }
+  size_t GetSize() const { return Size; }
   void PostServer() {Post(0);}
   void WaitServer() {Wait(0);}
   void PostClient() {Post(1);}
   void WaitClient() {Wait(1);}
+  void Post(int Idx);
+  void Wait(int Idx);
 
   size_t WriteByteArray(const uint8_t *Bytes, size_t N) {
-    assert(N <= kShmemSize - sizeof(N));
+    assert(N <= Size - sizeof(N));
     memcpy(GetData(), &N, sizeof(N));
     memcpy(GetData() + sizeof(N), Bytes, N);
     assert(N == ReadByteArraySize());
@@ -48,22 +56,20 @@ class SharedMemoryRegion {
   bool IsServer() const { return Data && IAmServer; }
   bool IsClient() const { return Data && !IAmServer; }
 
-private:
-
   static const size_t kShmemSize = 1 << 22;
+
+private:
   bool IAmServer;
   std::string Path(const char *Name);
   std::string SemName(const char *Name, int Idx);
-  void Post(int Idx);
-  void Wait(int Idx);
+  bool OpenSemaphores(const char *Name, size_t N, bool Create);
 
   bool Map(int fd);
   uint8_t *Data = nullptr;
-  void *Semaphore[2];
+  size_t Size = kShmemSize;
+  std::vector<void *> Semaphore;
 };
 
-extern SharedMemoryRegion SMR;
-
 }  // namespace fuzzer
 
 #endif  // LLVM_FUZZER_SHMEM_H
@@ -37,42 +37,51 @@ std::string SharedMemoryRegion::SemName(const char *Name, int Idx) {
 
 bool SharedMemoryRegion::Map(int fd) {
   Data =
-      (uint8_t *)mmap(0, kShmemSize, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
+      (uint8_t *)mmap(0, Size, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
   if (Data == (uint8_t*)-1)
     return false;
   return true;
 }
 
-bool SharedMemoryRegion::Create(const char *Name) {
-  int fd = open(Path(Name).c_str(), O_CREAT | O_RDWR, 0777);
-  if (fd < 0) return false;
-  if (ftruncate(fd, kShmemSize) < 0) return false;
-  if (!Map(fd))
-    return false;
-  for (int i = 0; i < 2; i++) {
-    sem_unlink(SemName(Name, i).c_str());
-    Semaphore[i] = sem_open(SemName(Name, i).c_str(), O_CREAT, 0644, 0);
+bool SharedMemoryRegion::OpenSemaphores(const char *Name, size_t N,
+                                        bool Create) {
+  Semaphore.resize(N);
+  for (size_t i = 0; i < N; i++) {
+    std::string S = SemName(Name, i);
+    if (Create) sem_unlink(S.c_str());
+    Semaphore[i] = Create ? sem_open(S.c_str(), O_CREAT, 0644, 0)
+                          : sem_open(S.c_str(), 0);
     if (Semaphore[i] == (void *)-1)
       return false;
   }
+  return true;
+}
+
+bool SharedMemoryRegion::Create(const char *Name, size_t Size,
+                                size_t NumSemaphores) {
+  int fd = open(Path(Name).c_str(), O_CREAT | O_TRUNC | O_RDWR, 0777);
+  if (fd < 0) return false;
+  this->Size = Size;
+  if (ftruncate(fd, Size) < 0) return false;
+  if (!Map(fd))
+    return false;
+  if (!OpenSemaphores(Name, NumSemaphores, /*Create=*/true))
+    return false;
   IAmServer = true;
   return true;
 }
 
-bool SharedMemoryRegion::Open(const char *Name) {
+bool SharedMemoryRegion::Open(const char *Name, size_t NumSemaphores) {
   int fd = open(Path(Name).c_str(), O_RDWR);
   if (fd < 0) return false;
   struct stat stat_res;
   if (0 != fstat(fd, &stat_res))
     return false;
-  assert(stat_res.st_size == kShmemSize);
+  Size = stat_res.st_size;
   if (!Map(fd))
     return false;
-  for (int i = 0; i < 2; i++) {
-    Semaphore[i] = sem_open(SemName(Name, i).c_str(), 0);
-    if (Semaphore[i] == (void *)-1)
-      return false;
-  }
+  if (!OpenSemaphores(Name, NumSemaphores, /*Create=*/false))
+    return false;
   IAmServer = false;
   return true;
 }
@@ -82,12 +91,12 @@ bool SharedMemoryRegion::Destroy(const char *Name) {
 }
 
 void SharedMemoryRegion::Post(int Idx) {
-  assert(Idx == 0 || Idx == 1);
+  assert(Idx >= 0 && static_cast<size_t>(Idx) < Semaphore.size());
   sem_post((sem_t*)Semaphore[Idx]);
 }
 
 void SharedMemoryRegion::Wait(int Idx) {
-  assert(Idx == 0 || Idx == 1);
+  assert(Idx >= 0 && static_cast<size_t>(Idx) < Semaphore.size());
   for (int i = 0; i < 10 && sem_wait((sem_t*)Semaphore[Idx]); i++) {
     // sem_wait may fail if interrupted by a signal.
     sleep(i);
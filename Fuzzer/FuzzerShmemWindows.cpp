@@ -35,12 +35,19 @@ bool SharedMemoryRegion::Map(int fd) {
   return false;
 }
 
-bool SharedMemoryRegion::Create(const char *Name) {
+bool SharedMemoryRegion::OpenSemaphores(const char *Name, size_t N,
+                                        bool Create) {
   assert(0 && "UNIMPLEMENTED");
   return false;
 }
 
-bool SharedMemoryRegion::Open(const char *Name) {
+bool SharedMemoryRegion::Create(const char *Name, size_t Size,
+                                size_t NumSemaphores) {
+  assert(0 && "UNIMPLEMENTED");
+  return false;
+}
+
+bool SharedMemoryRegion::Open(const char *Name, size_t NumSemaphores) {
   assert(0 && "UNIMPLEMENTED");
   return false;
 }
@@ -55,7 +62,6 @@ void SharedMemoryRegion::Post(int Idx) {
 }
 
 void SharedMemoryRegion::Wait(int Idx) {
-  Semaphore[1] = nullptr;
   assert(0 && "UNIMPLEMENTED");
 }
 
@@ -0,0 +1,175 @@
+//===- FuzzerSignatureSet.h - INTERNAL - Set of 64-bit signatures -*- C++ -*-=//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// SignatureSet.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_SIGNATURE_SET_H
+#define LLVM_FUZZER_SIGNATURE_SET_H
+
+#include "FuzzerDefs.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace fuzzer {
+
+// Packs one int per differential callback into a 64-bit signature. Up to
+// kMaxPackedCallbacks values that fit in a signed byte are stored exactly,
+// with their count in the top byte; anything else is hashed, with the top
+// bit set so that a hash never equals an exact signature.
+static const size_t kMaxPackedCallbacks = 7;
+
+inline uint64_t PackSignature(const int *Values, size_t N) {
+  uint64_t Res = static_cast<uint64_t>(N) << 56;
+  bool Exact = N <= kMaxPackedCallbacks;
+  for (size_t i = 0; i < N && Exact; i++) {
+    Exact = Values[i] >= -128 && Values[i] < 128;
+    Res |= static_cast<uint64_t>(static_cast<uint8_t>(Values[i])) << (8 * i);
+  }
+  if (Exact) return Res;
+  uint64_t H = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < N; i++)
+    H = (H ^ static_cast<uint32_t>(Values[i])) * 0x100000001b3ULL;
+  return H | (1ULL << 63);
+}
+
+// A set of 64-bit signatures in a flat open-addressing table, so that an
+// insertion only allocates when the table grows.
+//
+// With SetLimit(L) memory stays bounded: the set keeps two generations of at
+// most L signatures each. Once the current generation is full it replaces the
+// previous one, so a signature is forgotten unless it is inserted again
+// within about L newer ones.
+class SignatureSet {
+ public:
+  void SetLimit(size_t L) {
+    Limit = L;
+    clear();
+    if (!Limit) return;
+    Cur.Init(Limit);
+    Prev.Init(Limit);
+  }
+  size_t GetLimit() const { return Limit; }
+
+  // Returns true if S was not in the set.
+  bool Insert(uint64_t S) {
+    if (Cur.Contains(S)) return false;
+    bool New = !Prev.Contains(S);
+    if (Limit && Cur.Size == Limit) {
+      std::swap(Cur, Prev);
+      Cur.clear();
+    }
+    if (!Limit && (Cur.Size + 1) * 2 > Cur.Slots.size())
+      Cur.Grow();
+    Cur.Add(S);
+    return New;
+  }
+
+  bool Contains(uint64_t S) const { return Cur.Contains(S) || Prev.Contains(S); }
+
+  // Counts a signature that is in both generations once.
+  size_t size() const {
+    size_t N = Cur.Size;
+    Prev.ForEach([&](uint64_t S) { N += !Cur.Contains(S); });
+    return N;
+  }
+
+  void clear() {
+    Cur.clear();
+    Prev.clear();
+  }
+
+  // Appends the signatures to Out, the previous generation first.
+  void Save(std::vector<uint8_t> *Out) const {
+    uint64_t N = Cur.Size + Prev.Size;
+    size_t Begin = Out->size();
+    Out->resize(Begin + (N + 1) * sizeof(uint64_t));
+    uint8_t *P = Out->data() + Begin;
+    memcpy(P, &N, sizeof(N));
+    auto Put = [&](uint64_t S) { memcpy(P += sizeof(S), &S, sizeof(S)); };
+    Prev.ForEach(Put);
+    Cur.ForEach(Put);
+  }
+
+  // Inserts what Save() wrote at *P and moves *P past it. Returns false if
+  // that is not there.
+  bool Load(const uint8_t **P, const uint8_t *End) {
+    uint64_t N;
+    if (static_cast<size_t>(End - *P) < sizeof(N)) return false;
+    memcpy(&N, *P, sizeof(N));
+    if ((End - *P) / sizeof(uint64_t) - 1 < N) return false;
+    for (uint64_t i = 1; i <= N; i++) {
+      uint64_t S;
+      memcpy(&S, *P + i * sizeof(S), sizeof(S));
+      Insert(S);
+    }
+    *P += (N + 1) * sizeof(uint64_t);
+    return true;
+  }
+
+ private:
+  struct Table {
+    std::vector<uint64_t> Slots;  // Zero marks a free slot.
+    bool HasZero = false;         // Zero itself is kept here.
+    size_t Size = 0;
+
+    // Room for N signatures at a load factor of at most 1/2.
+    void Init(size_t N) {
+      size_t Cap = 16;
+      while (Cap < 2 * N) Cap *= 2;
+      Slots.assign(Cap, 0);
+      HasZero = false;
+      Size = 0;
+    }
+    void Grow() {
+      std::vector<uint64_t> Old;
+      Old.swap(Slots);
+      bool OldHasZero = HasZero;
+      Init(Old.empty() ? 8 : Old.size());
+      for (uint64_t S : Old)
+        if (S) Add(S);
+      if (OldHasZero) Add(0);
+    }
+    size_t Find(uint64_t S) const {
+      size_t Mask = Slots.size() - 1;
+      size_t I = (S * 0x9E3779B97F4A7C15ULL) >> 32;
+      while (Slots[I & Mask] && Slots[I & Mask] != S) I++;
+      return I & Mask;
+    }
+    bool Contains(uint64_t S) const {
+      if (!S) return HasZero;
+      return !Slots.empty() && Slots[Find(S)] == S;
+    }
+    void Add(uint64_t S) {
+      if (!S)
+        HasZero = true;
+      else
+        Slots[Find(S)] = S;
+      Size++;
+    }
+    template <class Callback>
+    void ForEach(Callback CB) const {
+      if (HasZero) CB(0);
+      for (uint64_t S : Slots)
+        if (S) CB(S);
+    }
+    void clear() {
+      if (Size) std::fill(Slots.begin(), Slots.end(), 0);
+      HasZero = false;
+      Size = 0;
+    }
+  };
+
+  size_t Limit = 0;  // 0 means unbounded.
+  Table Cur, Prev;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_SIGNATURE_SET_H
@@ -0,0 +1,85 @@
+//===- FuzzerStatsLog.cpp - Background writer for -stats_log --------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// The -stats_log time series.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerStatsLog.h"
+#include "FuzzerIO.h"
+#include "FuzzerUtil.h"
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+
+namespace fuzzer {
+
+// How often the writer thread wakes up to write out the pending records.
+static const std::chrono::milliseconds kFlushInterval(500);
+
+bool StatsLog::Start(const std::string &Path) {
+  assert(!IsRunning());
+  Out = fopen(Path.c_str(), "a");
+  if (!Out) {
+    Printf("ERROR: can't open the stats log %s: %s\n", Path.c_str(),
+           strerror(errno));
+    return false;
+  }
+  Exiting = false;
+  Writer = std::thread(&StatsLog::WriterLoop, this);
+  return true;
+}
+
+void StatsLog::Stop() {
+  if (!IsRunning()) return;
+  {
+    std::lock_guard<std::mutex> Lock(Mu);
+    Exiting = true;
+  }
+  CV.notify_one();
+  Writer.join();
+  fclose(Out);
+  Out = nullptr;
+}
+
+void StatsLog::Push(const StatsRecord &R) {
+  size_t H = Head.load(std::memory_order_relaxed);
+  if (H - Tail.load(std::memory_order_acquire) == kRingSize) {
+    Dropped++;
+    return;
+  }
+  Ring[H % kRingSize] = R;
+  Head.store(H + 1, std::memory_order_release);
+}
+
+void StatsLog::Drain() {
+  size_t T = Tail.load(std::memory_order_relaxed);
+  size_t H = Head.load(std::memory_order_acquire);
+  if (T == H) return;
+  for (; T != H; T++) {
+    const StatsRecord &R = Ring[T % kRingSize];
+    fprintf(Out, "%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64
+                 "\t%" PRIu64 "\n",
+            R.Runs, R.Duplicates, R.DiffUnits, R.ValidCases, R.Seconds);
+    Tail.store(T + 1, std::memory_order_release);
+  }
+  fflush(Out);
+}
+
+void StatsLog::WriterLoop() {
+  BlockAlarmSignalForCurrentThread();
+  std::unique_lock<std::mutex> Lock(Mu);
+  while (true) {
+    CV.wait_for(Lock, kFlushInterval,
+                [&] { return Exiting; });
+    Drain();
+    if (Exiting) return;
+  }
+}
+
+}  // namespace fuzzer
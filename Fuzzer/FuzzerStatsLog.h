@@ -0,0 +1,72 @@
+//===- FuzzerStatsLog.h - Background writer for -stats_log ------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::StatsLog
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_STATS_LOG_H
+#define LLVM_FUZZER_STATS_LOG_H
+
+#include "FuzzerDefs.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace fuzzer {
+
+// One line of the diff mode time series.
+struct StatsRecord {
+  uint64_t Runs;
+  uint64_t Duplicates;
+  uint64_t DiffUnits;
+  uint64_t ValidCases;
+  uint64_t Seconds;  // Since the fuzzer started.
+};
+
+// Appends StatsRecords to a file as tab-separated lines, from a thread of
+// its own. The fuzzing thread only copies a record into a single-producer
+// ring buffer, so a slow file system never stalls it; if the writer falls
+// behind by a whole ring, records are dropped and counted.
+class StatsLog {
+ public:
+  ~StatsLog() { Stop(); }
+
+  bool Start(const std::string &Path);
+  // Writes out the pending records and joins the writer thread.
+  void Stop();
+  bool IsRunning() const { return Out != nullptr; }
+
+  // Called from one thread only. Never blocks.
+  void Push(const StatsRecord &R);
+  size_t NumDropped() const { return Dropped; }
+
+ private:
+  static const size_t kRingSize = 1 << 12;
+
+  void WriterLoop();
+  void Drain();
+
+  StatsRecord Ring[kRingSize];
+  std::atomic<size_t> Head{0};  // Next slot to fill, owned by Push().
+  std::atomic<size_t> Tail{0};  // Next slot to write, owned by Drain().
+  size_t Dropped = 0;
+
+  FILE *Out = nullptr;
+  std::thread Writer;
+  std::mutex Mu;
+  std::condition_variable CV;
+  bool Exiting = false;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_STATS_LOG_H
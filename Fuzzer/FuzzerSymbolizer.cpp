@@ -0,0 +1,83 @@
+//===- FuzzerSymbolizer.cpp - Background PC symbolizer --------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// The symbolizer thread used by -print_pcs=1.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerSymbolizer.h"
+#include "FuzzerExtFunctions.h"
+#include "FuzzerUtil.h"
+
+namespace fuzzer {
+
+static void PrintNewPC(uintptr_t PC) {
+  PrintPC("\tNEW_PC: %p %F %L\n", "\tNEW_PC: %p\n", PC);
+}
+
+void PCSymbolizer::Start() {
+  assert(!IsRunning());
+  Exiting = false;
+  Printer = std::thread(&PCSymbolizer::PrinterLoop, this);
+}
+
+void PCSymbolizer::Stop() {
+  if (!IsRunning()) return;
+  {
+    std::lock_guard<std::mutex> Lock(Mu);
+    Exiting = true;
+  }
+  CV.notify_one();
+  Printer.join();
+}
+
+void PCSymbolizer::Print(uintptr_t PC) {
+  if (!IsRunning()) {
+    PrintNewPC(PC);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> Lock(Mu);
+    Queue.push_back(PC);
+  }
+  CV.notify_one();
+}
+
+void PCSymbolizer::PrinterLoop() {
+  std::vector<uintptr_t> Batch;
+  std::unique_lock<std::mutex> Lock(Mu);
+  while (true) {
+    CV.wait(Lock, [&] { return Exiting || !Queue.empty(); });
+    if (Queue.empty()) return;
+    Batch.swap(Queue);
+    Lock.unlock();
+    for (uintptr_t PC : Batch)
+      PrintNewPC(PC);
+    Batch.clear();
+    Lock.lock();
+  }
+}
+
+const PCSymbolizer::PCInfo &PCSymbolizer::Describe(uintptr_t PC) {
+  auto It = Cache.find(PC);
+  if (It != Cache.end()) return It->second;
+  PCInfo &Info = Cache[PC];
+  if (!EF->__sanitizer_symbolize_pc) return Info;
+  // The function goes last: its name may contain anything but a newline.
+  std::string S = DescribePC("%p\n%s\n%l\n%F", PC);
+  size_t A = S.find('\n');
+  size_t B = A == std::string::npos ? A : S.find('\n', A + 1);
+  size_t C = B == std::string::npos ? B : S.find('\n', B + 1);
+  if (C == std::string::npos) return Info;
+  Info.FixedPC = std::stoull(S.substr(0, A), 0, 16);
+  Info.File = S.substr(A + 1, B - A - 1);
+  Info.Line = S.substr(B + 1, C - B - 1);
+  Info.Function = S.substr(C + 1);
+  return Info;
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,66 @@
+//===- FuzzerSymbolizer.h - Background PC symbolizer ------------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::PCSymbolizer
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_SYMBOLIZER_H
+#define LLVM_FUZZER_SYMBOLIZER_H
+
+#include "FuzzerDefs.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace fuzzer {
+
+// Symbolizes PCs with __sanitizer_symbolize_pc, which runs an external
+// symbolizer and easily takes longer than an input.
+//
+// While started, the NEW_PC lines of -print_pcs=1 are printed from a thread
+// of its own: Print() only queues the PC, and the thread takes all PCs
+// queued since its last wakeup at once. Describe() symbolizes on the calling
+// thread, with one symbolizer call per PC, and remembers the answer.
+class PCSymbolizer {
+ public:
+  struct PCInfo {
+    uintptr_t FixedPC = 0;  // 0 if the PC could not be symbolized.
+    std::string Function, File, Line;
+  };
+
+  ~PCSymbolizer() { Stop(); }
+
+  void Start();
+  // Prints the queued PCs and joins the thread.
+  void Stop();
+  bool IsRunning() const { return Printer.joinable(); }
+
+  // Prints "\tNEW_PC: ..." for PC; from the thread if it is running.
+  void Print(uintptr_t PC);
+  const PCInfo &Describe(uintptr_t PC);
+
+ private:
+  void PrinterLoop();
+
+  std::mutex Mu;
+  std::condition_variable CV;
+  std::vector<uintptr_t> Queue;
+  bool Exiting = false;
+  std::thread Printer;
+
+  // Only used by Describe(), on one thread.
+  std::unordered_map<uintptr_t, PCInfo> Cache;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_SYMBOLIZER_H
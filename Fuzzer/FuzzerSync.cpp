@@ -0,0 +1,123 @@
+//===- FuzzerSync.cpp - Corpus sync across hosts --------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// The batches of -sync_with and the log of -sync_server; the sockets are in
+// FuzzerSyncPosix.cpp.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerSync.h"
+#include <cstring>
+
+namespace fuzzer {
+
+namespace {
+enum RecordKind : uint8_t { kUnitRecord = 1, kDiffRecord = 2 };
+const size_t kRecordHeaderSize = 1 + sizeof(uint32_t);
+
+void PutRecord(std::vector<uint8_t> *Out, RecordKind Kind,
+               const uint8_t *Data, size_t Size) {
+  Out->push_back(Kind);
+  uint32_t Size32 = static_cast<uint32_t>(Size);
+  const uint8_t *P = reinterpret_cast<const uint8_t *>(&Size32);
+  Out->insert(Out->end(), P, P + sizeof(Size32));
+  Out->insert(Out->end(), Data, Data + Size);
+}
+}  // namespace
+
+size_t SyncBatch::ByteSize() const {
+  size_t Res = DiffFingerprints.size() * (kRecordHeaderSize + sizeof(Digest128));
+  for (auto &U : Units)
+    Res += kRecordHeaderSize + U.size();
+  return Res;
+}
+
+void SyncBatch::Append(SyncBatch &&Other) {
+  for (auto &U : Other.Units)
+    Units.push_back(std::move(U));
+  DiffFingerprints.insert(DiffFingerprints.end(),
+                          Other.DiffFingerprints.begin(),
+                          Other.DiffFingerprints.end());
+  Other.clear();
+}
+
+std::vector<uint8_t> SyncBatch::Encode() const {
+  std::vector<uint8_t> Out;
+  Out.reserve(ByteSize());
+  for (auto &U : Units)
+    PutRecord(&Out, kUnitRecord, U.data(), U.size());
+  for (auto &D : DiffFingerprints)
+    PutRecord(&Out, kDiffRecord, reinterpret_cast<const uint8_t *>(&D),
+              sizeof(D));
+  return Out;
+}
+
+bool SyncBatch::Decode(const uint8_t *Data, size_t Size) {
+  clear();
+  const uint8_t *End = Data + Size;
+  while (Data != End) {
+    if (End - Data < static_cast<ptrdiff_t>(kRecordHeaderSize)) return false;
+    uint8_t Kind = Data[0];
+    uint32_t RecordSize;
+    memcpy(&RecordSize, Data + 1, sizeof(RecordSize));
+    Data += kRecordHeaderSize;
+    if (RecordSize > static_cast<size_t>(End - Data)) return false;
+    if (Kind == kUnitRecord) {
+      Units.push_back(Unit(Data, Data + RecordSize));
+    } else if (Kind == kDiffRecord && RecordSize == sizeof(Digest128)) {
+      Digest128 D;
+      memcpy(&D, Data, sizeof(D));
+      DiffFingerprints.push_back(D);
+    } else {
+      return false;
+    }
+    Data += RecordSize;
+  }
+  return true;
+}
+
+size_t SyncLog::Add(uint64_t NodeId, const SyncBatch &B) {
+  size_t Before = Entries.size();
+  for (auto &U : B.Units) {
+    if (!UnitDigests.insert(Hash128(U.data(), U.size()).Lo).second) {
+      Duplicates++;
+      continue;
+    }
+    Entries.push_back({NodeId, /*IsUnit=*/true, U, {0, 0}});
+  }
+  for (auto &D : B.DiffFingerprints) {
+    if (!DiffDigests.insert(D.Lo).second) {
+      Duplicates++;
+      continue;
+    }
+    Entries.push_back({NodeId, /*IsUnit=*/false, {}, D});
+  }
+  return Entries.size() - Before;
+}
+
+uint64_t SyncLog::Collect(uint64_t NodeId, uint64_t Cursor, size_t MaxBytes,
+                          SyncBatch *B) const {
+  B->clear();
+  // A node that is ahead of us has seen a coordinator before this one.
+  if (Cursor > Entries.size())
+    Cursor = 0;
+  size_t Bytes = 0;
+  for (; Cursor < Entries.size() && Bytes < MaxBytes; Cursor++) {
+    const Entry &E = Entries[Cursor];
+    if (E.NodeId == NodeId) continue;
+    if (E.IsUnit) {
+      B->Units.push_back(E.U);
+      Bytes += kRecordHeaderSize + E.U.size();
+    } else {
+      B->DiffFingerprints.push_back(E.Fingerprint);
+      Bytes += kRecordHeaderSize + sizeof(Digest128);
+    }
+  }
+  return Cursor;
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,134 @@
+//===- FuzzerSync.h - INTERNAL - Corpus sync across hosts -------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::SyncBatch, fuzzer::SyncLog, fuzzer::SyncClient, fuzzer::SyncServer
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_SYNC_H
+#define LLVM_FUZZER_SYNC_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerHash.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace fuzzer {
+
+// The nodes of a campaign (-sync_with=HOST:PORT) and its coordinator
+// (-sync_server=PORT) exchange batches of new corpus units and of the
+// fingerprints of the diffs the nodes saved. Every -sync_interval seconds a
+// node connects, sends what it found since the last exchange and gets back
+// what the other nodes found since then; the coordinator keeps one log of
+// everything, without duplicates. On the wire a batch is a SyncHeader
+// followed by the records, compressed with Compress(), in the byte order of
+// the hosts.
+struct SyncBatch {
+  std::vector<Unit> Units;
+  std::vector<Digest128> DiffFingerprints;
+
+  bool empty() const { return Units.empty() && DiffFingerprints.empty(); }
+  size_t ByteSize() const;
+  void clear() {
+    Units.clear();
+    DiffFingerprints.clear();
+  }
+  void Append(SyncBatch &&Other);
+  std::vector<uint8_t> Encode() const;
+  bool Decode(const uint8_t *Data, size_t Size);
+};
+
+struct SyncHeader {
+  uint32_t Magic;
+  uint32_t Version;
+  uint64_t NodeId;  // 0 in replies.
+  // Requests: the entries of the log the node has seen; replies: how far
+  // the node has seen it once it has the batch.
+  uint64_t Cursor;
+  uint32_t RawSize;
+  uint32_t PackedSize;
+};
+static const uint32_t kSyncMagic = 0x434E5953;  // "SYNC"
+static const uint32_t kSyncVersion = 1;
+static const size_t kMaxSyncBatchSize = 1 << 26;
+
+// The coordinator's log of units and fingerprints, deduplicated by digest.
+class SyncLog {
+ public:
+  // Appends what is new in B. Returns the number of entries appended.
+  size_t Add(uint64_t NodeId, const SyncBatch &B);
+  // The entries after Cursor that other nodes than NodeId added, up to
+  // about MaxBytes of them. Returns the cursor past the last one taken.
+  uint64_t Collect(uint64_t NodeId, uint64_t Cursor, size_t MaxBytes,
+                   SyncBatch *B) const;
+  size_t size() const { return Entries.size(); }
+  size_t NumDuplicates() const { return Duplicates; }
+
+ private:
+  struct Entry {
+    uint64_t NodeId;
+    bool IsUnit;
+    Unit U;
+    Digest128 Fingerprint;
+  };
+  std::vector<Entry> Entries;
+  std::unordered_set<uint64_t> UnitDigests;
+  std::unordered_set<uint64_t> DiffDigests;
+  size_t Duplicates = 0;
+};
+
+// The node's end: a thread that exchanges batches with the coordinator.
+class SyncClient {
+ public:
+  ~SyncClient() { Stop(); }
+
+  bool Start(const std::string &HostPort, int IntervalSec);
+  // Sends what is still pending once more, then stops the thread.
+  void Stop();
+  bool IsRunning() const { return Client.joinable(); }
+
+  // Called by the fuzzing thread.
+  void AddUnit(const uint8_t *Data, size_t Size);
+  void AddDiffFingerprint(Digest128 D);
+  // Moves what the coordinator sent since the last call into *B. Takes the
+  // lock only once a batch has come in.
+  void TakeIncoming(SyncBatch *B);
+
+ private:
+  void SyncLoop();
+  bool Exchange(const SyncBatch &Out, SyncBatch *In);
+
+  std::string Host, Port;
+  int IntervalSec = 0;
+  uint64_t NodeId = 0;
+  uint64_t Cursor = 0;
+  std::thread Client;
+  std::atomic<bool> Exiting{false};
+  std::atomic<bool> HasIncoming{false};
+  std::mutex Mu;
+  SyncBatch Outgoing, Incoming;  // Guarded by Mu.
+};
+
+// The coordinator: serves the nodes one connection at a time, forever, on
+// Port of the IPv4 address Bind.
+class SyncServer {
+ public:
+  int Run(int Port, const char *Bind);
+
+ private:
+  void Serve(int Fd);
+  SyncLog Log;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_SYNC_H
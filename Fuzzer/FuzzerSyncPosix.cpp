@@ -0,0 +1,248 @@
+//===- FuzzerSyncPosix.cpp - Corpus sync across hosts -----------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// SyncClient, SyncServer
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if LIBFUZZER_POSIX
+
+#include "FuzzerCompress.h"
+#include "FuzzerIO.h"
+#include "FuzzerSync.h"
+#include "FuzzerUtil.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace fuzzer {
+
+namespace {
+// How long a peer may take to send or accept a batch.
+const int kIoTimeoutSec = 10;
+// What a node keeps while the coordinator is away; newer units are dropped.
+const size_t kMaxPendingBytes = 16 << 20;
+// The most a coordinator sends in one reply; the node gets the rest on its
+// next exchange.
+const size_t kMaxReplyBytes = 4 << 20;
+
+void SetTimeouts(int Fd) {
+  timeval T = {kIoTimeoutSec, 0};
+  setsockopt(Fd, SOL_SOCKET, SO_RCVTIMEO, &T, sizeof(T));
+  setsockopt(Fd, SOL_SOCKET, SO_SNDTIMEO, &T, sizeof(T));
+}
+
+bool SendAll(int Fd, const uint8_t *Data, size_t Size) {
+  while (Size) {
+    ssize_t Res = send(Fd, Data, Size, MSG_NOSIGNAL);
+    if (Res < 0 && errno == EINTR) continue;
+    if (Res <= 0) return false;
+    Data += Res;
+    Size -= Res;
+  }
+  return true;
+}
+
+bool RecvAll(int Fd, uint8_t *Data, size_t Size) {
+  while (Size) {
+    ssize_t Res = recv(Fd, Data, Size, 0);
+    if (Res < 0 && errno == EINTR) continue;
+    if (Res <= 0) return false;
+    Data += Res;
+    Size -= Res;
+  }
+  return true;
+}
+
+bool WriteBatch(int Fd, uint64_t NodeId, uint64_t Cursor, const SyncBatch &B) {
+  std::vector<uint8_t> Raw = B.Encode();
+  std::vector<uint8_t> Packed = Compress(Raw.data(), Raw.size());
+  SyncHeader H = {kSyncMagic,
+                  kSyncVersion,
+                  NodeId,
+                  Cursor,
+                  static_cast<uint32_t>(Raw.size()),
+                  static_cast<uint32_t>(Packed.size())};
+  return SendAll(Fd, reinterpret_cast<const uint8_t *>(&H), sizeof(H)) &&
+         SendAll(Fd, Packed.data(), Packed.size());
+}
+
+bool ReadBatch(int Fd, SyncHeader *H, SyncBatch *B) {
+  if (!RecvAll(Fd, reinterpret_cast<uint8_t *>(H), sizeof(*H)) ||
+      H->Magic != kSyncMagic || H->Version != kSyncVersion ||
+      H->RawSize > kMaxSyncBatchSize || H->PackedSize > kMaxSyncBatchSize)
+    return false;
+  std::vector<uint8_t> Packed(H->PackedSize), Raw;
+  return RecvAll(Fd, Packed.data(), Packed.size()) &&
+         Decompress(Packed.data(), Packed.size(), H->RawSize, &Raw) &&
+         B->Decode(Raw.data(), Raw.size());
+}
+}  // namespace
+
+bool SyncClient::Start(const std::string &HostPort, int IntervalSec) {
+  assert(!IsRunning());
+  size_t Colon = HostPort.rfind(':');
+  if (Colon == std::string::npos || Colon == 0 ||
+      Colon + 1 == HostPort.size()) {
+    Printf("ERROR: -sync_with=%s is not HOST:PORT\n", HostPort.c_str());
+    return false;
+  }
+  Host = HostPort.substr(0, Colon);
+  Port = HostPort.substr(Colon + 1);
+  this->IntervalSec = Max(IntervalSec, 1);
+  Hasher128 Id(GetPid());
+  Id.Update(static_cast<uint64_t>(
+      std::chrono::steady_clock::now().time_since_epoch().count()));
+  Id.Update(static_cast<uint64_t>(time(nullptr)));
+  NodeId = Id.Final().Lo | 1;
+  Exiting = false;
+  Client = std::thread(&SyncClient::SyncLoop, this);
+  return true;
+}
+
+void SyncClient::Stop() {
+  if (!IsRunning()) return;
+  Exiting = true;
+  Client.join();
+}
+
+void SyncClient::AddUnit(const uint8_t *Data, size_t Size) {
+  std::lock_guard<std::mutex> Lock(Mu);
+  if (Outgoing.ByteSize() + Size > kMaxPendingBytes) return;
+  Outgoing.Units.push_back(Unit(Data, Data + Size));
+}
+
+void SyncClient::AddDiffFingerprint(Digest128 D) {
+  std::lock_guard<std::mutex> Lock(Mu);
+  Outgoing.DiffFingerprints.push_back(D);
+}
+
+void SyncClient::TakeIncoming(SyncBatch *B) {
+  B->clear();
+  if (!HasIncoming.load(std::memory_order_acquire)) return;
+  std::lock_guard<std::mutex> Lock(Mu);
+  std::swap(*B, Incoming);
+  HasIncoming.store(false, std::memory_order_relaxed);
+}
+
+void SyncClient::SyncLoop() {
+  BlockAlarmSignalForCurrentThread();
+  bool Failing = false;
+  while (true) {
+    for (int i = 0; i < IntervalSec * 10 && !Exiting; i++)
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    bool Last = Exiting;
+    SyncBatch Out, In;
+    {
+      std::lock_guard<std::mutex> Lock(Mu);
+      std::swap(Out, Outgoing);
+    }
+    if (Exchange(Out, &In)) {
+      if (Failing)
+        Printf("INFO: sync with %s:%s is back\n", Host.c_str(), Port.c_str());
+      Failing = false;
+      if (!In.empty()) {
+        std::lock_guard<std::mutex> Lock(Mu);
+        Incoming.Append(std::move(In));
+        HasIncoming.store(true, std::memory_order_release);
+      }
+    } else {
+      if (!Failing)
+        Printf("WARNING: can't sync with %s:%s, will retry\n", Host.c_str(),
+               Port.c_str());
+      Failing = true;
+      // Keep what did not go out, in front of what came up meanwhile.
+      std::lock_guard<std::mutex> Lock(Mu);
+      if (Out.ByteSize() + Outgoing.ByteSize() <= kMaxPendingBytes) {
+        Out.Append(std::move(Outgoing));
+        std::swap(Out, Outgoing);
+      }
+    }
+    if (Last) break;
+  }
+}
+
+bool SyncClient::Exchange(const SyncBatch &Out, SyncBatch *In) {
+  addrinfo Hints = {};
+  Hints.ai_family = AF_UNSPEC;
+  Hints.ai_socktype = SOCK_STREAM;
+  addrinfo *Addrs;
+  if (getaddrinfo(Host.c_str(), Port.c_str(), &Hints, &Addrs)) return false;
+  int Fd = -1;
+  for (addrinfo *A = Addrs; A; A = A->ai_next) {
+    Fd = socket(A->ai_family, A->ai_socktype, A->ai_protocol);
+    if (Fd < 0) continue;
+    SetTimeouts(Fd);
+    if (!connect(Fd, A->ai_addr, A->ai_addrlen)) break;
+    close(Fd);
+    Fd = -1;
+  }
+  freeaddrinfo(Addrs);
+  if (Fd < 0) return false;
+  SyncHeader H;
+  bool Ok = WriteBatch(Fd, NodeId, Cursor, Out) && ReadBatch(Fd, &H, In);
+  close(Fd);
+  if (Ok)
+    Cursor = H.Cursor;
+  return Ok;
+}
+
+int SyncServer::Run(int Port, const char *Bind) {
+  sockaddr_in Addr = {};
+  Addr.sin_family = AF_INET;
+  Addr.sin_port = htons(static_cast<uint16_t>(Port));
+  if (inet_pton(AF_INET, Bind, &Addr.sin_addr) != 1) {
+    Printf("ERROR: -sync_bind=%s is not an IPv4 address\n", Bind);
+    return 1;
+  }
+  int Fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (Fd < 0) {
+    Printf("ERROR: can't create the sync socket: %s\n", strerror(errno));
+    return 1;
+  }
+  int One = 1;
+  setsockopt(Fd, SOL_SOCKET, SO_REUSEADDR, &One, sizeof(One));
+  if (bind(Fd, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)) ||
+      listen(Fd, 64)) {
+    Printf("ERROR: can't serve sync on port %d: %s\n", Port, strerror(errno));
+    close(Fd);
+    return 1;
+  }
+  Printf("INFO: SYNC SERVER UP on %s:%d\n", Bind, Port);
+  while (true) {
+    int C = accept(Fd, nullptr, nullptr);
+    if (C < 0) continue;
+    SetTimeouts(C);
+    Serve(C);
+    close(C);
+  }
+}
+
+void SyncServer::Serve(int Fd) {
+  SyncHeader H;
+  SyncBatch In, Out;
+  if (!ReadBatch(Fd, &H, &In)) return;
+  size_t Added = Log.Add(H.NodeId, In);
+  uint64_t Cursor = Log.Collect(H.NodeId, H.Cursor, kMaxReplyBytes, &Out);
+  if (!WriteBatch(Fd, 0, Cursor, Out)) return;
+  if (Added || !Out.empty())
+    Printf("SYNC: node %016llx: %zd new, %zd sent; log %zd, duplicates %zd\n",
+           static_cast<unsigned long long>(H.NodeId), Added,
+           Out.Units.size() + Out.DiffFingerprints.size(), Log.size(),
+           Log.NumDuplicates());
+}
+
+}  // namespace fuzzer
+
+#endif  // LIBFUZZER_POSIX
@@ -0,0 +1,47 @@
+//===- FuzzerSyncWindows.cpp - Corpus sync across hosts ---------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// SyncClient, SyncServer
+//===----------------------------------------------------------------------===//
+#include "FuzzerDefs.h"
+#if LIBFUZZER_WINDOWS
+
+#include "FuzzerIO.h"
+#include "FuzzerSync.h"
+
+namespace fuzzer {
+
+bool SyncClient::Start(const std::string &HostPort, int IntervalSec) {
+  Printf("ERROR: -sync_with is not supported on Windows\n");
+  return false;
+}
+
+void SyncClient::Stop() {}
+
+void SyncClient::AddUnit(const uint8_t *Data, size_t Size) {}
+
+void SyncClient::AddDiffFingerprint(Digest128 D) {}
+
+void SyncClient::TakeIncoming(SyncBatch *B) { B->clear(); }
+
+void SyncClient::SyncLoop() {}
+
+bool SyncClient::Exchange(const SyncBatch &Out, SyncBatch *In) {
+  return false;
+}
+
+int SyncServer::Run(int Port, const char *Bind) {
+  Printf("ERROR: -sync_server is not supported on Windows\n");
+  return 1;
+}
+
+void SyncServer::Serve(int Fd) {}
+
+}  // namespace fuzzer
+
+#endif  // LIBFUZZER_WINDOWS
@@ -0,0 +1,175 @@
+//===- FuzzerTrace.cpp - Trace points of the main loop ----------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::Tracer
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerTrace.h"
+#include "FuzzerIO.h"
+#include "FuzzerUtil.h"
+
+#include <cerrno>
+#include <cinttypes>
+
+namespace fuzzer {
+
+namespace {
+// Indexed by TraceStage.
+const char *const kStageNames[] = {
+    "Mutate",      "DedupHash", "Execute",   "CollectFeatures",
+    "DiffCompare", "Dump",      "CorpusAdd",
+};
+
+// The same, in the stats and the metrics.
+const char *const kStageStatNames[] = {
+    "mutate",       "dedup_hash", "execute",    "collect_features",
+    "diff_compare", "dump",       "corpus_add",
+};
+}  // namespace
+
+bool Tracer::Start(const std::string &Path) {
+  assert(!IsRunning());
+  if (!kTraceHooks) {
+    Printf("WARNING: built with LIBFUZZER_TRACING=0, -trace_file is ignored\n");
+    return true;
+  }
+  Out = fopen(Path.c_str(), "w");
+  if (!Out) {
+    Printf("ERROR: can't open the trace file %s: %s\n", Path.c_str(),
+           strerror(errno));
+    return false;
+  }
+  fputs("[\n", Out);
+  Events.reserve(kMaxBufferedEvents);
+  OriginNs = NowNs();
+  Pid = GetPid();
+  NeedComma = false;
+  Active = true;
+  return true;
+}
+
+bool Tracer::StartCounters() {
+  assert(!CountsStages());
+  if (!kTraceHooks) {
+    Printf("WARNING: built with LIBFUZZER_TRACING=0, -perf_counters is "
+           "ignored\n");
+    return true;
+  }
+  if (!Counters.Start()) return false;
+  Counts.resize(kNumTraceStages);
+  Active = true;
+  return true;
+}
+
+void Tracer::Stop() {
+  if (!IsRunning()) return;
+  Flush();
+  fputs("\n]\n", Out);
+  fclose(Out);
+  Out = nullptr;
+  Active = CountsStages();
+}
+
+void Tracer::Record(TraceStage Stage, int Arg, uint64_t BeginNs,
+                    uint64_t EndNs) {
+  Events.push_back({BeginNs, EndNs, Stage, Arg});
+  if (Events.size() >= kMaxBufferedEvents)
+    Flush();
+}
+
+void Tracer::AddCounts(TraceStage Stage, int Arg,
+                       const PerfCounters::Sample &Begin) {
+  PerfCounters::Sample End;
+  Counters.Read(&End);
+  size_t Idx = (Arg + 1) * kNumTraceStages + Stage;
+  if (Idx >= Counts.size()) Counts.resize(Idx + 1);
+  StageCounts &C = Counts[Idx];
+  C.Scopes++;
+  for (int i = 0; i < PerfCounters::kNumCounters; i++)
+    C.Values[i] += End.Values[i] - Begin.Values[i];
+}
+
+template <class Callback> void Tracer::ForEachStage(Callback CB) const {
+  for (size_t Idx = 0; Idx < Counts.size(); Idx++) {
+    if (!Counts[Idx].Scopes) continue;
+    int Arg = static_cast<int>(Idx / kNumTraceStages) - 1;
+    CB(kStageStatNames[Idx % kNumTraceStages], Arg, Counts[Idx]);
+  }
+}
+
+void Tracer::PrintCounterStats() const {
+  ForEachStage([&](const char *Stage, int Arg, const StageCounts &C) {
+    char Name[64];
+    if (Arg < 0)
+      snprintf(Name, sizeof(Name), "%s:", Stage);
+    else
+      snprintf(Name, sizeof(Name), "%s_%d:", Stage, Arg);
+    Printf("stat::perf_%-21s%zd scopes", Name, C.Scopes);
+    for (int i = 0; i < PerfCounters::kNumCounters; i++)
+      if (Counters.IsAvailable(i))
+        Printf(", %" PRIu64 " %s", C.Values[i], PerfCounters::Name(i));
+    if (C.Values[PerfCounters::PC_Cycles])
+      Printf(", %.2f IPC",
+             static_cast<double>(C.Values[PerfCounters::PC_Instructions]) /
+                 C.Values[PerfCounters::PC_Cycles]);
+    Printf("\n");
+  });
+}
+
+void Tracer::FormatCounterMetrics(std::string *Page) const {
+  char Line[256], Labels[64];
+  // The stages outside of a callback have no callback label.
+  auto Label = [&](const char *Stage, int Arg) {
+    if (Arg < 0)
+      snprintf(Labels, sizeof(Labels), "stage=\"%s\"", Stage);
+    else
+      snprintf(Labels, sizeof(Labels), "stage=\"%s\",callback=\"%d\"",
+               Stage, Arg);
+    return Labels;
+  };
+  *Page += "# HELP libfuzzer_stage_scopes_total Runs of each stage of the "
+           "main loop.\n"
+           "# TYPE libfuzzer_stage_scopes_total counter\n";
+  ForEachStage([&](const char *Stage, int Arg, const StageCounts &C) {
+    snprintf(Line, sizeof(Line), "libfuzzer_stage_scopes_total{%s} %zd\n",
+             Label(Stage, Arg), C.Scopes);
+    *Page += Line;
+  });
+  *Page += "# HELP libfuzzer_stage_perf_events_total Hardware events of the "
+           "fuzzing thread in each stage of the main loop.\n"
+           "# TYPE libfuzzer_stage_perf_events_total counter\n";
+  ForEachStage([&](const char *Stage, int Arg, const StageCounts &C) {
+    for (int i = 0; i < PerfCounters::kNumCounters; i++) {
+      if (!Counters.IsAvailable(i)) continue;
+      snprintf(Line, sizeof(Line),
+               "libfuzzer_stage_perf_events_total{%s,event=\"%s\"} "
+               "%" PRIu64 "\n",
+               Label(Stage, Arg), PerfCounters::Name(i), C.Values[i]);
+      *Page += Line;
+    }
+  });
+}
+
+// Timestamps are in microseconds since Start().
+void Tracer::Flush() {
+  for (auto &E : Events) {
+    fprintf(Out,
+            "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%lu,\"tid\":0,"
+            "\"ts\":%.3f,\"dur\":%.3f",
+            NeedComma ? ",\n" : "", kStageNames[E.Stage], Pid,
+            (E.BeginNs - OriginNs) / 1e3, (E.EndNs - E.BeginNs) / 1e3);
+    if (E.Arg >= 0)
+      fprintf(Out, ",\"args\":{\"callback\":%d}", E.Arg);
+    fputs("}", Out);
+    NeedComma = true;
+  }
+  Events.clear();
+  fflush(Out);
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,146 @@
+//===- FuzzerTrace.h - INTERNAL - Trace points of the main loop -*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::Tracer, fuzzer::TraceScope
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_TRACE_H
+#define LLVM_FUZZER_TRACE_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerPerfCounters.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace fuzzer {
+
+enum TraceStage {
+  TS_Mutate,
+  TS_DedupHash,
+  TS_Execute,
+  TS_CollectFeatures,
+  TS_DiffCompare,
+  TS_Dump,
+  TS_CorpusAdd,
+  kNumTraceStages,
+};
+
+// Writes the stages of the main loop as complete events of the Chrome trace
+// event format, which chrome://tracing and Perfetto show as a timeline.
+// Events are buffered and written in large chunks by the thread that
+// records them, which must be the fuzzing thread.
+//
+// With -perf_counters=1 the same stages also add up the hardware counters
+// of the fuzzing thread, per stage and, for the stages of a callback, per
+// callback. Nested stages count in both.
+class Tracer {
+ public:
+  ~Tracer() { Stop(); }
+
+  bool Start(const std::string &Path);
+  // Writes out the buffered events and closes the JSON array.
+  void Stop();
+  bool IsRunning() const { return Out != nullptr; }
+
+  bool StartCounters();
+  bool CountsStages() const { return Counters.IsRunning(); }
+  // Whether a TraceScope has anything to do.
+  bool IsActive() const { return Active; }
+
+  // What a TraceScope takes at its start.
+  struct Mark {
+    uint64_t Ns;
+    PerfCounters::Sample Counts;
+  };
+  void Begin(Mark *M) {
+    M->Ns = Out ? NowNs() : 0;
+    if (Counters.IsRunning()) Counters.Read(&M->Counts);
+  }
+  void End(TraceStage Stage, int Arg, const Mark &M) {
+    if (Counters.IsRunning()) AddCounts(Stage, Arg, M.Counts);
+    if (Out) Record(Stage, Arg, M.Ns, NowNs());
+  }
+  // The stat::perf_ lines, and the counters on the -metrics_port page.
+  void PrintCounterStats() const;
+  void FormatCounterMetrics(std::string *Page) const;
+
+  // Arg is the index of the callback of the stage, or -1.
+  void Record(TraceStage Stage, int Arg, uint64_t BeginNs, uint64_t EndNs);
+
+  static uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+ private:
+  static const size_t kMaxBufferedEvents = 1 << 14;
+
+  struct Event {
+    uint64_t BeginNs, EndNs;
+    TraceStage Stage;
+    int Arg;
+  };
+
+  void Flush();
+
+  // Totals of the counters of one stage, or of one stage of a callback.
+  struct StageCounts {
+    size_t Scopes = 0;
+    uint64_t Values[PerfCounters::kNumCounters] = {};
+  };
+  void AddCounts(TraceStage Stage, int Arg, const PerfCounters::Sample &Begin);
+  // The stages with counts, in the order of the stats: each stage, then
+  // each stage of callback 0, 1, ...
+  template <class Callback> void ForEachStage(Callback CB) const;
+
+  FILE *Out = nullptr;
+  bool Active = false;
+  PerfCounters Counters;
+  // Indexed by (Arg + 1) * kNumTraceStages + Stage.
+  std::vector<StageCounts> Counts;
+  std::vector<Event> Events;
+  uint64_t OriginNs = 0;
+  unsigned long Pid = 0;
+  bool NeedComma = false;
+};
+
+// Records the lifetime of the scope as one Stage event while T is running,
+// and adds what the counters counted in it while T counts stages.
+// With LIBFUZZER_TRACING=0 it is an empty object and costs nothing;
+// otherwise an inactive tracer costs one load and one branch.
+template <bool Enabled = kTraceHooks>
+class TraceScope {
+ public:
+  TraceScope(Tracer &Tr, TraceStage Stage, int Arg = -1)
+      : T(Tr.IsActive() ? &Tr : nullptr), Stage(Stage), Arg(Arg) {
+    if (T) T->Begin(&M);
+  }
+  ~TraceScope() {
+    if (T) T->End(Stage, Arg, M);
+  }
+
+ private:
+  Tracer *T;
+  TraceStage Stage;
+  int Arg;
+  Tracer::Mark M;
+};
+
+template <>
+class TraceScope<false> {
+ public:
+  TraceScope(Tracer &, TraceStage, int = -1) {}
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_TRACE_H
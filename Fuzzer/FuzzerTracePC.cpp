@@ -20,77 +20,772 @@
 #include "FuzzerIO.h"
 #include "FuzzerUtil.h"
 #include "FuzzerValueBitMap.h"
+#include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <sstream>
+#include <unordered_set>
+#if defined(__x86_64)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 // The coverage counters and PCs.
-// These are declared as global variables named "__sancov_*" to simplify
-// experiments with inlined instrumentation.
-alignas(64) ATTRIBUTE_INTERFACE
-uint8_t __sancov_trace_pc_guard_8bit_counters[fuzzer::TracePC::kNumPCs];
+// Those of the process are also published as global variables named
+// "__sancov_*" to simplify experiments with inlined instrumentation.
+// They start out in the static tables below, which fit the trace-pc hash and
+// most single-library targets, and are moved to larger mappings by
+// GrowCoverageTables() if the modules have more guards.
+alignas(64) static uint8_t
+    DefaultCounters[fuzzer::TracePC::kDefaultNumPCs];
+static uintptr_t DefaultPCs[fuzzer::TracePC::kDefaultNumPCs];
+alignas(64) static uint64_t
+    DefaultCoveredBits[fuzzer::TracePC::kDefaultNumPCs / 64];
+static uint32_t DefaultTouchedWords[fuzzer::TracePC::kDefaultNumPCs / 64];
+static size_t NumPCsCapacity = fuzzer::TracePC::kDefaultNumPCs;
 
 ATTRIBUTE_INTERFACE
-uintptr_t __sancov_trace_pc_pcs[fuzzer::TracePC::kNumPCs];
+uint8_t *__sancov_trace_pc_guard_8bit_counters = DefaultCounters;
+
+ATTRIBUTE_INTERFACE
+uintptr_t *__sancov_trace_pc_pcs = DefaultPCs;
+
+ATTRIBUTE_INTERFACE
+uint64_t *__sancov_trace_pc_covered_bits = DefaultCoveredBits;
+
+ATTRIBUTE_INTERFACE
+uint32_t *__sancov_trace_pc_touched_words = DefaultTouchedWords;
+ATTRIBUTE_INTERFACE size_t __sancov_trace_pc_num_touched_words;
+ATTRIBUTE_INTERFACE size_t __sancov_trace_pc_num_covered;
+
+namespace {
+struct CoverageTables {
+  uint8_t *Counters;
+  uintptr_t *PCs;
+  uint64_t *CoveredBits;
+  // Indices of the non-zero words of CoveredBits and the number of set bits,
+  // so that reset and count do not scan the whole bitmap. For the process
+  // they are the exported __sancov_trace_pc_num_* variables, for a thread
+  // OwnNumTouchedWords and OwnNumCovered.
+  uint32_t *TouchedWords;
+  size_t *NumTouchedWords;
+  size_t *NumCovered;
+  bool OnHugePages;  // Mapped by MapHugePages().
+  size_t OwnNumTouchedWords;
+  size_t OwnNumCovered;
+};
+}  // namespace
+
+static CoverageTables ProcessTables = {
+    DefaultCounters,
+    DefaultPCs,
+    DefaultCoveredBits,
+    DefaultTouchedWords,
+    &__sancov_trace_pc_num_touched_words,
+    &__sancov_trace_pc_num_covered,
+    false,
+    0,
+    0};
+// The number of -diff_threads executors with tables of their own. Those are
+// sized when the executor starts, so the tables must not grow meanwhile.
+static std::atomic<size_t> NumThreadTables;
+// Whether tables mapped from now on go on huge pages (-huge_pages).
+static bool HugeTables = false;
+// The tables the guards of the calling thread go to: those of the process,
+// or those of a -diff_threads executor (TracePC::UseThreadCoverage()).
+static thread_local CoverageTables *Tables = &ProcessTables;
+
+// Sets the covered bit of Idx. Only the first hit of a guard after a reset
+// pays for the atomics, which keep the touched list exact when callbacks run
+// on several threads (-diff_parallel=1).
+ATTRIBUTE_NO_SANITIZE_ALL ALWAYS_INLINE
+static void MarkCovered(CoverageTables *T, uintptr_t Idx) {
+  uint64_t *Word = &T->CoveredBits[Idx / 64];
+  uint64_t Bit = 1ULL << (Idx % 64);
+  if (*Word & Bit) return;
+  uint64_t Old = __atomic_fetch_or(Word, Bit, __ATOMIC_RELAXED);
+  if (Old & Bit) return;
+  if (!Old)
+    T->TouchedWords[__atomic_fetch_add(T->NumTouchedWords, 1,
+                                       __ATOMIC_RELAXED)] = Idx / 64;
+  __atomic_fetch_add(T->NumCovered, 1, __ATOMIC_RELAXED);
+}
+
+static void MarkCovered(uintptr_t Idx) { MarkCovered(Tables, Idx); }
 
 namespace fuzzer {
 
 TracePC TPC;
 
+// The value profile map the values of the calling thread go to.
+static thread_local size_t ValueProfileMapIdx;
+// The tables the comparisons of the calling thread go to.
+static thread_local CmpTables *ThreadCmp = &TPC.Cmp;
+
+static void UnmapCoverageTables(const CoverageTables &T, size_t Cap) {
+  auto Unmap = [&](void *Ptr, size_t Size) {
+    if (!Ptr) return;
+    if (T.OnHugePages)
+      UnmapHugePages(Ptr, Size);
+    else
+      UnmapPages(Ptr, Size);
+  };
+  Unmap(T.Counters, Cap);
+  Unmap(T.PCs, Cap * sizeof(uintptr_t));
+  Unmap(T.CoveredBits, Cap / 8);
+  Unmap(T.TouchedWords, Cap / 64 * sizeof(uint32_t));
+}
+
+// Maps the tables of T for Cap guards, or nothing if one of them fails.
+static bool MapCoverageTables(CoverageTables *T, size_t Cap, bool Huge) {
+  auto Map = [&](size_t Size) {
+    return Huge ? MapHugePages(Size) : MapZeroedPages(Size);
+  };
+  T->Counters = static_cast<uint8_t *>(Map(Cap));
+  T->PCs = static_cast<uintptr_t *>(Map(Cap * sizeof(uintptr_t)));
+  T->CoveredBits = static_cast<uint64_t *>(Map(Cap / 8));
+  T->TouchedWords = static_cast<uint32_t *>(Map(Cap / 64 * sizeof(uint32_t)));
+  T->OnHugePages = Huge;
+  if (T->Counters && T->PCs && T->CoveredBits && T->TouchedWords)
+    return true;
+  UnmapCoverageTables(*T, Cap);
+  return false;
+}
+
+// Moves the coverage tables of the process to new mappings with room for
+// NewCap guards. Runs while modules are loaded, before any of them executes,
+// or before the fuzzing starts.
+static bool MoveCoverageTables(size_t NewCap, bool Huge) {
+  CoverageTables New = {};
+  if (!MapCoverageTables(&New, NewCap, Huge))
+    return false;
+  CoverageTables &T = ProcessTables;
+  size_t OldCap = NumPCsCapacity;
+  memcpy(New.Counters, T.Counters, OldCap);
+  memcpy(New.PCs, T.PCs, OldCap * sizeof(uintptr_t));
+  memcpy(New.CoveredBits, T.CoveredBits, OldCap / 8);
+  memcpy(New.TouchedWords, T.TouchedWords, OldCap / 64 * sizeof(uint32_t));
+  if (T.Counters != DefaultCounters)
+    UnmapCoverageTables(T, OldCap);
+  T.Counters = New.Counters;
+  T.PCs = New.PCs;
+  T.CoveredBits = New.CoveredBits;
+  T.TouchedWords = New.TouchedWords;
+  T.OnHugePages = Huge;
+  NumPCsCapacity = NewCap;
+  __sancov_trace_pc_guard_8bit_counters = T.Counters;
+  __sancov_trace_pc_pcs = T.PCs;
+  __sancov_trace_pc_covered_bits = T.CoveredBits;
+  __sancov_trace_pc_touched_words = T.TouchedWords;
+  return true;
+}
+
+// Moves the coverage tables to mappings with room for at least MinNumPCs
+// guards. Refused while -diff_threads executors run on tables of their own,
+// which were sized for the old capacity; the new guards then share indices
+// with the old ones (see HandleInit()).
+static bool GrowCoverageTables(size_t MinNumPCs) {
+  size_t NewCap = NumPCsCapacity;
+  while (NewCap < MinNumPCs && NewCap < TracePC::kMaxNumPCs)
+    NewCap *= 2;
+  if (NewCap == NumPCsCapacity)
+    return false;
+  if (NumThreadTables.load()) {
+    Printf("WARNING: not growing the coverage tables to %zd guards while "
+           "the -diff_threads executors are running\n", NewCap);
+    return false;
+  }
+  return MoveCoverageTables(NewCap, HugeTables);
+}
+
+// Bucket B covers the values whose row below is marked B.
+const uint8_t kCounterBucket[256] = {
+    0, 0, 1, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4,  // 0-15
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,  // 16-31
+#define ROW(B) B, B, B, B, B, B, B, B, B, B, B, B, B, B, B, B
+    ROW(6), ROW(6), ROW(6), ROW(6), ROW(6), ROW(6),  // 32-127
+    ROW(7), ROW(7), ROW(7), ROW(7), ROW(7), ROW(7), ROW(7), ROW(7),  // 128-255
+#undef ROW
+};
+
+namespace {
+
+typedef const uint8_t *(*SkipZeroBlocksFn)(const uint8_t *, const uint8_t *);
+
+ATTRIBUTE_NO_SANITIZE_ALL
+const uint8_t *SkipZeroBlocksWords(const uint8_t *P, const uint8_t *End) {
+  for (; P + kZeroScanBlockSize <= End; P += kZeroScanBlockSize) {
+    uint64_t W[kZeroScanBlockSize / 8];
+    memcpy(W, P, sizeof(W));
+    if (W[0] | W[1] | W[2] | W[3]) break;
+  }
+  return P;
+}
+
+#if defined(__x86_64)
+__attribute__((target("avx2"))) ATTRIBUTE_NO_SANITIZE_ALL
+const uint8_t *SkipZeroBlocksAVX2(const uint8_t *P, const uint8_t *End) {
+  for (; P + kZeroScanBlockSize <= End; P += kZeroScanBlockSize) {
+    __m256i V = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(P));
+    if (!_mm256_testz_si256(V, V)) break;
+  }
+  return P;
+}
+#elif defined(__aarch64__)
+ATTRIBUTE_NO_SANITIZE_ALL
+const uint8_t *SkipZeroBlocksNEON(const uint8_t *P, const uint8_t *End) {
+  for (; P + kZeroScanBlockSize <= End; P += kZeroScanBlockSize)
+    if (vmaxvq_u8(vorrq_u8(vld1q_u8(P), vld1q_u8(P + 16))))
+      break;
+  return P;
+}
+#endif
+
+SkipZeroBlocksFn ChooseSkipZeroBlocks() {
+#if defined(__x86_64)
+  if (__builtin_cpu_supports("avx2"))
+    return SkipZeroBlocksAVX2;
+#elif defined(__aarch64__)
+  return SkipZeroBlocksNEON;
+#endif
+  return SkipZeroBlocksWords;
+}
+
+}  // namespace
+
+ATTRIBUTE_NO_SANITIZE_ALL
+const uint8_t *SkipZeroBlocks(const uint8_t *P, const uint8_t *End) {
+  static const SkipZeroBlocksFn Impl = ChooseSkipZeroBlocks();
+  return Impl(P, End);
+}
+
 int ScopedDoingMyOwnMemOrStr::DoingMyOwnMemOrStr;
 
 bool TracePC::NewTraceDiff(std::vector<int>& feature_v) {
    //return OutputDiffVec[0]==0||OutputDiffVec[1]==0||OutputDiffVec[2]==0;
-   return FeatureTraceDiff.insert(feature_v).second;
+   return FeatureTraceDiff.Insert(
+       PackSignature(feature_v.data(), feature_v.size()));
+}
+
+ATTRIBUTE_NO_SANITIZE_ALL
+size_t TracePC::NumCoveredGuards(GuardRange R) const {
+  const uint64_t *Bits = CoveredBits();
+  R.End = Min(R.End, GetNumPCs());
+  if (R.Begin >= R.End) return 0;
+  size_t First = R.Begin / 64, Last = (R.End - 1) / 64;
+  uint64_t FirstMask = ~0ULL << (R.Begin % 64);
+  uint64_t LastMask = ~0ULL >> (63 - (R.End - 1) % 64);
+  if (First == Last)
+    return __builtin_popcountll(Bits[First] & FirstMask & LastMask);
+  size_t N = __builtin_popcountll(Bits[First] & FirstMask) +
+             __builtin_popcountll(Bits[Last] & LastMask);
+  for (size_t W = First + 1; W < Last; W++)
+    N += __builtin_popcountll(Bits[W]);
+  return N;
+}
+
+bool TracePC::NewEdgeBucketDiff() {
+  EdgeBuckets.resize(UC->size);
+  for (int i = 0; i < UC->size; i++)
+    EdgeBuckets[i] = EdgeCountBucket(NumCoveredGuards(CallbackGuards(i)));
+  return EdgeBucketDiff.Insert(
+      PackSignature(EdgeBuckets.data(), EdgeBuckets.size()));
 }
 
 bool TracePC::NewOutputDiff() {
-  return OutputTraceDiff.insert(OutputDiffVec).second;  
-}
-bool TracePC::NewOutputDiff_change(){
-	bool flag = false;
-	for(int j = 0 ;j < UC->size; j++)
-	{
-		for(int i = j+1; i < UC->size; i++)
-		{
-			if(OutputDiffVec[j]!=OutputDiffVec[i])
-				flag = true;
-		}
-	}
-	return flag;
-}
-
-void TracePC::InitializeDiffCallbacks(ExternalFunctions *EF) {
-  assert(EF->LLVMFuzzerCustomCallbacks);
+  return OutputTraceDiff.Insert(
+      PackSignature(OutputDiffVec.data(), OutputDiffVec.size()));
+}
+bool TracePC::NewOutputDiff_change() {
+  size_t N = OutputDiffVec.size();
+  int VerdictMask = DiffVerdictBits ? (1 << DiffVerdictBits) - 1 : -1;
+  bool Mapped = false;
+  if (Oracle) {
+    Mapped = std::adjacent_find(OutputDiffVec.begin(), OutputDiffVec.end(),
+                                std::not_equal_to<int>()) !=
+             OutputDiffVec.end();
+    Mapped &= Oracle->Apply(OutputDiffVec.data(), N);
+  }
+  if (SortedOutputs.size() != N) {
+    SortedOutputs.resize(N);
+    OutputClasses.resize(N);
+    RejectMask.resize((N + 63) / 64 + !N);
+  }
+  std::fill(RejectMask.begin(), RejectMask.end(), 0);
+  NumRejects = 0;
+  for (size_t i = 0; i < N; i++) {
+    SortedOutputs[i] = {OutputDiffVec[i], static_cast<uint32_t>(i)};
+    if (OutputDiffVec[i] & VerdictMask) {
+      RejectMask[i / 64] |= 1ULL << (i % 64);
+      NumRejects++;
+    }
+  }
+  // Equal values end up next to each other, ordered by callback; the class
+  // of a run of them is numbered below by its first callback.
+  std::sort(SortedOutputs.begin(), SortedOutputs.end());
+  for (size_t i = 0; i < N; i++) {
+    uint32_t First = SortedOutputs[i].second;
+    if (i && SortedOutputs[i].first == SortedOutputs[i - 1].first)
+      First = OutputClasses[SortedOutputs[i - 1].second];
+    OutputClasses[SortedOutputs[i].second] = First;
+  }
+  // Renumber the classes 0, 1, ... in the order of their first callback.
+  NumClasses = 0;
+  for (size_t i = 0; i < N; i++)
+    OutputClasses[i] = OutputClasses[i] == i ? NumClasses++
+                                             : OutputClasses[OutputClasses[i]];
+  OracleAgreements += Mapped && NumClasses == 1;
+  return NumClasses > 1;
+}
+
+void TracePC::InitializeDiffCallbacks(ExternalFunctions *EF,
+                                      UserCallbacks *Remote) {
+  assert(Remote || EF->LLVMFuzzerCustomCallbacks);
   assert(EF->__sanitizer_cov_reset);
-  UC = EF->LLVMFuzzerCustomCallbacks();
+  UC = Remote ? Remote : EF->LLVMFuzzerCustomCallbacks();
   assert(UC && UC->callbacks && UC->size > 0);
-  OutputDiffVec = std::vector<int>(UC->size);;
+  OutputDiffVec = std::vector<int>(UC->size);
+  if (EF->LLVMFuzzerCustomBatchCallbacks)
+    UBC = EF->LLVMFuzzerCustomBatchCallbacks();
 }
 
-uint8_t *TracePC::Counters() const {
-  return __sancov_trace_pc_guard_8bit_counters;
+// The exported coverage is a list of {guard, counter, PC} records for every
+// covered guard, followed by the set bits of the value profile.
+namespace {
+struct ExportedGuard {
+  uint32_t Idx;
+  uint8_t Counter;
+  uintptr_t PC;
+};
+}  // namespace
+
+size_t TracePC::MaxExportedCoverageSize() const {
+  size_t NumExtraCounters = ExtraCountersEnd() - ExtraCountersBegin();
+  return 3 * sizeof(uint32_t) + GetNumPCs() * sizeof(ExportedGuard) +
+         ValueProfileMap.SizeInBits() * sizeof(uint32_t) +
+         NumExtraCounters * sizeof(uint32_t);
 }
 
-uintptr_t *TracePC::PCs() const {
-  return __sancov_trace_pc_pcs;
+ATTRIBUTE_NO_SANITIZE_ALL
+size_t TracePC::ExportCoverage(uint8_t *Out, size_t MaxSize) const {
+  assert(MaxSize >= MaxExportedCoverageSize());
+  uint8_t *P = Out + sizeof(uint32_t);
+  uint32_t N = 0;
+  ForEachCoveredGuard({0, GetNumPCs()}, [&](size_t Idx) {
+    ExportedGuard G = {static_cast<uint32_t>(Idx), Counters()[Idx],
+                       PCs()[Idx]};
+    memcpy(P, &G, sizeof(G));
+    P += sizeof(G);
+    N++;
+  });
+  memcpy(Out, &N, sizeof(N));
+  uint8_t *NumValues = P;
+  P += sizeof(uint32_t);
+  N = 0;
+  if (UseValueProfile)
+    ValueProfileMap.ForEach([&](size_t Idx) {
+      uint32_t V = static_cast<uint32_t>(Idx);
+      memcpy(P, &V, sizeof(V));
+      P += sizeof(V);
+      N++;
+    });
+  memcpy(NumValues, &N, sizeof(N));
+  // An extra counter is its index and its value in one word.
+  uint8_t *NumCounters = P;
+  P += sizeof(uint32_t);
+  N = 0;
+  uint8_t *Extra = ExtraCountersBegin();
+  size_t NumExtra = std::min<size_t>(ExtraCountersEnd() - Extra, 1 << 24);
+  for (size_t i = 0; i < NumExtra; i++) {
+    if (!Extra[i]) continue;
+    uint32_t C = static_cast<uint32_t>(i << 8) | Extra[i];
+    memcpy(P, &C, sizeof(C));
+    P += sizeof(C);
+    N++;
+  }
+  memcpy(NumCounters, &N, sizeof(N));
+  return P - Out;
 }
 
-size_t TracePC::GetTotalPCCoverage() {
-  size_t Res = 0;
-  for (size_t i = 1, N = GetNumPCs(); i < N; i++)
-    if (PCs()[i])
-      Res++;
-  return Res;
+ATTRIBUTE_NO_SANITIZE_ALL
+void TracePC::ImportCoverage(const uint8_t *In, size_t Size) {
+  const uint8_t *End = In + Size;
+  uint32_t N;
+  memcpy(&N, In, sizeof(N));
+  In += sizeof(N);
+  for (uint32_t i = 0; i < N && In + sizeof(ExportedGuard) <= End; i++) {
+    ExportedGuard G;
+    memcpy(&G, In, sizeof(G));
+    In += sizeof(G);
+    if (G.Idx >= NumPCsCapacity()) continue;
+    PCs()[G.Idx] = G.PC;
+    Counters()[G.Idx] = G.Counter;
+    MarkCovered(G.Idx);
+  }
+  if (In + sizeof(N) > End) return;
+  memcpy(&N, In, sizeof(N));
+  In += sizeof(N);
+  for (uint32_t i = 0; i < N && In + sizeof(uint32_t) <= End; i++) {
+    uint32_t V;
+    memcpy(&V, In, sizeof(V));
+    In += sizeof(V);
+    if (V < ValueProfileMap.SizeInBits())
+      ValueProfileMap.SetBit(V);
+  }
+  if (In + sizeof(N) > End) return;
+  memcpy(&N, In, sizeof(N));
+  In += sizeof(N);
+  uint8_t *Extra = ExtraCountersBegin();
+  size_t NumExtra = ExtraCountersEnd() - Extra;
+  for (uint32_t i = 0; i < N && In + sizeof(uint32_t) <= End; i++) {
+    uint32_t C;
+    memcpy(&C, In, sizeof(C));
+    In += sizeof(C);
+    if ((C >> 8) < NumExtra)
+      Extra[C >> 8] = static_cast<uint8_t>(C);
+  }
+}
+
+ATTRIBUTE_NO_SANITIZE_ALL
+size_t TracePC::ExportCoverage(uint8_t *Out, size_t MaxSize,
+                               GuardRange R) const {
+  assert(MaxSize >= 2 * sizeof(uint32_t));
+  uint8_t *P = Out + sizeof(uint32_t);
+  uint8_t *End = Out + MaxSize - sizeof(uint32_t);
+  uint32_t N = 0;
+  ForEachCoveredGuard(R, [&](size_t Idx) {
+    if (P + sizeof(ExportedGuard) > End) return;
+    ExportedGuard G = {static_cast<uint32_t>(Idx - R.Begin), Counters()[Idx],
+                       PCs()[Idx]};
+    memcpy(P, &G, sizeof(G));
+    P += sizeof(G);
+    N++;
+  });
+  memcpy(Out, &N, sizeof(N));
+  N = 0;
+  memcpy(P, &N, sizeof(N));
+  return P + sizeof(N) - Out;
+}
+
+ATTRIBUTE_NO_SANITIZE_ALL
+void TracePC::ImportCoverage(const uint8_t *In, size_t Size,
+                             GuardRange Into) {
+  const uint8_t *End = In + Size;
+  uint32_t N;
+  if (Size < sizeof(N)) return;
+  memcpy(&N, In, sizeof(N));
+  In += sizeof(N);
+  for (uint32_t i = 0; i < N && In + sizeof(ExportedGuard) <= End; i++) {
+    ExportedGuard G;
+    memcpy(&G, In, sizeof(G));
+    In += sizeof(G);
+    size_t Idx = Into.Begin + G.Idx;
+    if (Idx >= Into.End) continue;
+    PCs()[Idx] = G.PC;
+    Counters()[Idx] = G.Counter;
+    MarkCovered(Idx);
+  }
+}
+
+void TracePC::ForEachExportedGuard(
+    const uint8_t *In, size_t Size,
+    const std::function<void(size_t, uintptr_t)> &CB) const {
+  const uint8_t *End = In + Size;
+  uint32_t N;
+  if (In + sizeof(N) > End) return;
+  memcpy(&N, In, sizeof(N));
+  In += sizeof(N);
+  for (uint32_t i = 0; i < N && In + sizeof(ExportedGuard) <= End; i++) {
+    ExportedGuard G;
+    memcpy(&G, In, sizeof(G));
+    In += sizeof(G);
+    CB(G.Idx, G.PC);
+  }
+}
+
+void TracePC::MapExportedPCs(
+    uint8_t *In, size_t Size,
+    const std::function<uintptr_t(uintptr_t)> &F) const {
+  const uint8_t *End = In + Size;
+  uint32_t N;
+  if (In + sizeof(N) > End) return;
+  memcpy(&N, In, sizeof(N));
+  In += sizeof(N);
+  for (uint32_t i = 0; i < N && In + sizeof(ExportedGuard) <= End; i++) {
+    ExportedGuard G;
+    memcpy(&G, In, sizeof(G));
+    G.PC = F(G.PC);
+    memcpy(In, &G, sizeof(G));
+    In += sizeof(G);
+  }
+}
+
+int TracePC::CallbackOfFeature(size_t Feature) const {
+  size_t Idx = Feature / 8;
+  if (Idx >= GetNumPCs()) {
+    // A value profile feature, see CollectFeatures().
+    size_t Value = Feature - GetNumPCs() * 8;
+    if (!UseValueProfile || ValueProfileMap.NumMaps() != (size_t)UC->size ||
+        Value >= ValueProfileMap.SizeInBits())
+      return -1;
+    return Value / ValueProfileMap.MapSizeInBits();
+  }
+  for (int i = 0; i < UC->size; i++) {
+    GuardRange R = CallbackGuards(i);
+    if (Idx >= R.Begin && Idx < R.End)
+      return i;
+  }
+  return -1;
+}
+
+TracePC::GuardRange TracePC::CallbackGuards(size_t Idx) const {
+  if (!RemoteCallbackGuards.empty())
+    return Idx < RemoteCallbackGuards.size() ? RemoteCallbackGuards[Idx]
+                                             : GuardRange{0, 0};
+  if (!MovedCallbackGuards.empty())
+    return Idx < MovedCallbackGuards.size() ? MovedCallbackGuards[Idx]
+                                            : GuardRange{0, 0};
+  if (Idx + 1 >= NumModuleGuards) return {0, 0};
+  return ModuleGuards[Idx + 1];
+}
+
+// Only the counters of the guards covered since the last ResetCoverage()
+// can be non-zero, so just the 64 counters of every touched word of the
+// covered bitmap are cleared, one cache line each. Once a large part of the
+// map has been touched, one memset of the whole map is cheaper.
+ATTRIBUTE_NO_SANITIZE_ALL
+void TracePC::ClearCounters() {
+  uint8_t *C = Counters();
+  size_t NumWords = *Tables->NumTouchedWords;
+  if (NumWords * 64 * kDenseClearFraction >= GetNumPCs()) {
+    memset(C, 0, GetNumPCs());
+    return;
+  }
+  for (size_t i = 0; i < NumWords; i++)
+    memset(C + Tables->TouchedWords[i] * 64, 0, 64);
+}
+
+size_t TracePC::NumPCsCapacity() const { return ::NumPCsCapacity; }
+
+bool TracePC::SetValueProfileMaps(size_t MapSizeLog, size_t NumMaps) {
+  // Spread the PCs over the map as much as the hashed values leave room for.
+  ValueProfilePCBits = Max<size_t>(12, MapSizeLog - 6);
+  return ValueProfileMap.Allocate(MapSizeLog, NumMaps);
+}
+
+void TracePC::SelectValueProfileMap(size_t Idx) { ValueProfileMapIdx = Idx; }
+
+void TracePC::UseThreadCmpTables() {
+  if (ThreadCmp != &Cmp) return;
+  ThreadCmp = new CmpTables;
+  std::lock_guard<std::mutex> Lock(ThreadCmpTablesMu);
+  ThreadCmpTables.push_back(ThreadCmp);
+}
+
+void TracePC::RecordCmpArgs(const uint8_t *A, const uint8_t *B, size_t Size) {
+  if (ThreadCmp != &Cmp) return;  // A -diff_parallel worker.
+  for (const uint8_t *P : {A, B})
+    if (CmpArgsOut->size() < kMaxRecordedCmpArgs)
+      CmpArgsOut->push_back(Word(P, Size));
+}
+
+void TracePC::MergeThreadCmpTables() {
+  std::lock_guard<std::mutex> Lock(ThreadCmpTablesMu);
+  for (CmpTables *T : ThreadCmpTables)
+    Cmp.MergeFrom(*T);
 }
 
+bool TracePC::UseThreadCoverage() {
+  if (Tables != &ProcessTables) return true;
+  auto *T = new CoverageTables();
+  // Counted before the tables are sized, so that no growth slips in between.
+  NumThreadTables++;
+  if (!MapCoverageTables(T, ::NumPCsCapacity, HugeTables)) {
+    NumThreadTables--;
+    delete T;
+    return false;
+  }
+  T->NumTouchedWords = &T->OwnNumTouchedWords;
+  T->NumCovered = &T->OwnNumCovered;
+  Tables = T;
+  return true;
+}
+
+void TracePC::FreeThreadCoverage() {
+  CoverageTables *T = Tables;
+  if (T == &ProcessTables) return;
+  UnmapCoverageTables(*T, ::NumPCsCapacity);
+  delete T;
+  Tables = &ProcessTables;
+  NumThreadTables--;
+}
+
+bool TracePC::UseHugePages(size_t *Size, size_t *HugeSize) {
+  assert(Tables == &ProcessTables);
+  HugeTables = true;
+  if (!ProcessTables.OnHugePages &&
+      !MoveCoverageTables(::NumPCsCapacity, true))
+    return false;
+  const CoverageTables &T = ProcessTables;
+  size_t Cap = ::NumPCsCapacity;
+  *Size = *HugeSize = 0;
+  auto Add = [&](const void *Ptr, size_t Bytes) {
+    Bytes = (Bytes + kHugePageSize - 1) & ~(kHugePageSize - 1);
+    *Size += Bytes;
+    *HugeSize += HugePageBytes(Ptr, Bytes);
+  };
+  Add(T.Counters, Cap);
+  Add(T.PCs, Cap * sizeof(uintptr_t));
+  Add(T.CoveredBits, Cap / 8);
+  Add(T.TouchedWords, Cap / 64 * sizeof(uint32_t));
+  return true;
+}
+
+uint8_t *TracePC::Counters() const { return Tables->Counters; }
+
+uintptr_t *TracePC::PCs() const { return Tables->PCs; }
+
+const uint64_t *TracePC::CoveredBits() const { return Tables->CoveredBits; }
+
+const uint32_t *TracePC::TouchedCoverageWords(size_t *NumWords) const {
+  *NumWords = *Tables->NumTouchedWords;
+  return Tables->TouchedWords;
+}
+
+void TracePC::SelectFeaturePasses() {
+  FeaturePasses = 0;
+  if (ExtraCountersBegin() != ExtraCountersEnd())
+    FeaturePasses |= kExtraCountersPass;
+  if (UseValueProfile)
+    FeaturePasses |= kValueProfilePass;
+}
+
+size_t TracePC::GetTotalPCCoverage() {
+  // Index 0 is never handed out to a guard.
+  return *Tables->NumCovered - (CoveredBits()[0] & 1);
+}
 
 //change on 11.6
-void TracePC::ResetCoverage() {  
-  for (size_t i = 1, N = GetNumPCs(); i < N; i++)
-  {
-      __sancov_trace_pc_pcs[i] = 0;
+// Only visits the bitmap words touched since the previous reset.
+ATTRIBUTE_NO_SANITIZE_ALL
+void TracePC::ResetCoverage() {
+  // ClearCounters() relies on the touched words, so clear the counters while
+  // they are still known.
+  ClearCounters();
+  CoverageTables *T = Tables;
+  for (size_t i = 0; i < *T->NumTouchedWords; i++) {
+    uint32_t W = T->TouchedWords[i];
+    for (uint64_t Word = T->CoveredBits[W]; Word; Word &= Word - 1)
+      T->PCs[W * 64 + __builtin_ctzll(Word)] = 0;
+    T->CoveredBits[W] = 0;
+  }
+  *T->NumTouchedWords = 0;
+  *T->NumCovered = 0;
+}
+
+size_t TracePC::AddModuleGuards(size_t N) {
+  assert(NumModuleGuards < sizeof(ModuleGuards) / sizeof(ModuleGuards[0]));
+  // Start each extra module on a fresh word of the covered bitmap.
+  if (NumModuleGuards)
+    NumGuards = (NumGuards + 1 + 63) / 64 * 64 - 1;
+  size_t FirstGuard = NumGuards + 1;
+  if (FirstGuard + N > NumPCsCapacity())
+    GrowCoverageTables(FirstGuard + N);
+  size_t Cap = NumPCsCapacity();
+  if (FirstGuard + N > Cap)
+    RawPrint(
+        "WARNING: The binary has too many instrumented PCs.\n"
+        "         You may want to reduce the size of the binary\n"
+        "         for more efficient fuzzing and precise coverage data\n");
+  NumGuards += N;
+  ModuleGuards[NumModuleGuards++] = {Min(FirstGuard, Cap),
+                                     Min(NumGuards + 1, Cap)};
+  return FirstGuard;
+}
+
+TracePC::GuardRange TracePC::AddRemoteCallbackGuards(size_t N) {
+  AddModuleGuards(N);
+  RemoteCallbackGuards.push_back(ModuleGuards[NumModuleGuards - 1]);
+  return RemoteCallbackGuards.back();
+}
+
+void TracePC::AddTracedCallbackGuards(const std::vector<bool> &Traced,
+                                      size_t N) {
+  std::vector<GuardRange> Ranges(Traced.size(), GuardRange{0, 0});
+  size_t NextModule = 1;
+  for (size_t i = 0; i < Traced.size(); i++)
+    if (!Traced[i] && NextModule < NumModuleGuards)
+      Ranges[i] = ModuleGuards[NextModule++];
+  for (size_t i = 0; i < Traced.size(); i++)
+    if (Traced[i]) {
+      AddModuleGuards(N);
+      Ranges[i] = ModuleGuards[NumModuleGuards - 1];
+    }
+  SetCallbackGuards(Ranges);
+}
+
+void TracePC::SetCallbackGuards(const std::vector<GuardRange> &Ranges) {
+  MovedCallbackGuards = Ranges;
+  CallbackGuardOrder.resize(Ranges.size());
+  for (size_t i = 0; i < Ranges.size(); i++)
+    CallbackGuardOrder[i] = static_cast<int>(i);
+  std::stable_sort(
+      CallbackGuardOrder.begin(), CallbackGuardOrder.end(),
+      [&](int A, int B) { return Ranges[A].Begin < Ranges[B].Begin; });
+}
+
+// The guard arrays and inline counters of the modules in the callback's
+// range go away with its library, so their entries are dropped while they
+// can still be told apart by their first guard.
+void TracePC::ForgetCallbackModules(size_t Idx) {
+  GuardRange R = CallbackGuards(Idx);
+  auto InRange = [&](size_t G) { return G >= R.Begin && G < R.End; };
+  size_t N = 0;
+  for (size_t i = 0; i < NumModules; i++)
+    if (!InRange(*Modules[i].Start))
+      Modules[N++] = Modules[i];
+  NumModules = N;
+  N = 0;
+  size_t NumWithPCs = 0;
+  for (size_t i = 0; i < NumModulesWithInline8bitCounters; i++) {
+    auto &M = ModuleCounters[i];
+    if (InRange(M.Guards.Begin)) {
+      NumInline8bitCounters -= M.Stop - M.Start;
+      continue;
+    }
+    NumWithPCs += i < NumModulesWithPCs;
+    ModuleCounters[N++] = M;
   }
+  NumModulesWithInline8bitCounters = N;
+  NumModulesWithPCs = NumWithPCs;
+}
+
+void TracePC::MoveCallbackGuards(size_t Idx, size_t FirstModule) {
+  std::vector<GuardRange> Ranges(UC->size);
+  for (size_t i = 0; i < Ranges.size(); i++)
+    Ranges[i] = CallbackGuards(i);
+  Ranges[Idx] = FirstModule < NumModuleGuards
+                    ? GuardRange{ModuleGuards[FirstModule].Begin,
+                                 ModuleGuards[NumModuleGuards - 1].End}
+                    : GuardRange{0, 0};
+  SetCallbackGuards(Ranges);
+}
+
+void TracePC::ImportTraceCounters(
+    GuardRange Into, uint8_t *Counts,
+    const std::function<void(size_t)> &HandleFeature) {
+  uint8_t *C = Counters();
+  uintptr_t *PCs = this->PCs();
+  ForEachNonZeroByte(Counts, Counts + (Into.End - Into.Begin), Into.Begin,
+                     [&](size_t Idx, uint8_t V) {
+                       Counts[Idx - Into.Begin] = 0;
+                       PCs[Idx] = 0;
+                       MarkCovered(Idx);
+                       C[Idx] = V;
+                       HandleFeature(Idx * 8 + kCounterBucket[V]);
+                     });
 }
 
 void TracePC::HandleInline8bitCountersInit(uint8_t *Start, uint8_t *Stop) {
@@ -99,30 +794,75 @@ void TracePC::HandleInline8bitCountersInit(uint8_t *Start, uint8_t *Stop) {
       ModuleCounters[NumModulesWithInline8bitCounters-1].Start == Start) return;
   assert(NumModulesWithInline8bitCounters <
          sizeof(ModuleCounters) / sizeof(ModuleCounters[0]));
-  ModuleCounters[NumModulesWithInline8bitCounters++] = {Start, Stop};
+  AddModuleGuards(Stop - Start);
+  ModuleCounters[NumModulesWithInline8bitCounters++] = {
+      Start, Stop, ModuleGuards[NumModuleGuards - 1], nullptr};
   NumInline8bitCounters += Stop - Start;
 }
 
+// The PC table of a module comes right after its counters, with one entry
+// per counter.
+void TracePC::HandlePCsInit(const uintptr_t *Start, const uintptr_t *Stop) {
+  if (NumModulesWithPCs == NumModulesWithInline8bitCounters) return;
+  auto &M = ModuleCounters[NumModulesWithPCs++];
+  if (Stop - Start == 2 * (M.Stop - M.Start))
+    M.PCs = Start;
+}
+
 void TracePC::HandleInit(uint32_t *Start, uint32_t *Stop) {
   if (Start == Stop || *Start) return;
   assert(NumModules < sizeof(Modules) / sizeof(Modules[0]));
-  int num_tmp  = 0;
-  for (uint32_t *P = Start; P < Stop; P++) {
-    NumGuards++;
-    if (NumGuards == kNumPCs) {
-      RawPrint(
-          "WARNING: The binary has too many instrumented PCs.\n"
-          "         You may want to reduce the size of the binary\n"
-          "         for more efficient fuzzing and precise coverage data\n");
-    }
-    *P = NumGuards % kNumPCs;
-    num_tmp++;
-  }
+  size_t FirstGuard = AddModuleGuards(Stop - Start);
+  size_t Cap = NumPCsCapacity();
+  for (uint32_t *P = Start; P < Stop; P++)
+    *P = (FirstGuard + (P - Start)) % Cap;
   Modules[NumModules].Start = Start;
   Modules[NumModules].Stop = Stop;
-  ModuleNum[NumModules] = num_tmp;
   NumModules++;
-  
+}
+
+// Inline counters without a PC table are recorded with PC 0, which the PC
+// printers skip.
+ATTRIBUTE_NO_SANITIZE_ALL
+void TracePC::UpdateInline8bitCounters() {
+  uint8_t *C = Counters();
+  uintptr_t *PCs = this->PCs();
+  for (size_t i = 0; i < NumModulesWithInline8bitCounters; i++) {
+    auto &M = ModuleCounters[i];
+    uint8_t *Begin = M.Start;
+    ForEachNonZeroByte(
+        Begin, Begin + (M.Guards.End - M.Guards.Begin), M.Guards.Begin,
+        [&](size_t Idx, uint8_t V) {
+          size_t Offset = Idx - M.Guards.Begin;
+          Begin[Offset] = 0;
+          if (M.PCs)
+            PCs[Idx] = M.PCs[2 * Offset];
+          MarkCovered(Idx);
+          C[Idx] = V;
+        });
+  }
+}
+
+std::string TracePC::CodeId(std::vector<uintptr_t> *Bases) const {
+  std::string Res;
+  if (Bases) Bases->clear();
+  auto Add = [&](const void *Start) {
+    std::string Id = ObjectFileId(Start);
+    uintptr_t Base = 0;
+    if (Id.empty() || (Bases && !ObjectFileBase(Start, &Base))) return false;
+    Res += Id + "\n";
+    if (Bases) Bases->push_back(Base);
+    return true;
+  };
+  for (size_t i = 0; i < NumModules; i++)
+    if (!Add(Modules[i].Start)) return "";
+  for (size_t i = 0; i < NumModulesWithInline8bitCounters; i++)
+    if (!Add(ModuleCounters[i].Start)) return "";
+  for (int i = 0; UC && i < UC->size; i++)
+    if (!Add(reinterpret_cast<const void *>(
+            reinterpret_cast<uintptr_t>(UC->callbacks[i]))))
+      return "";
+  return Res;
 }
 
 void TracePC::PrintModuleInfo() {
@@ -144,24 +884,31 @@ void TracePC::HandleCallerCallee(uintptr_t Caller, uintptr_t Callee) {
   const uintptr_t kBits = 12;
   const uintptr_t kMask = (1 << kBits) - 1;
   uintptr_t Idx = (Caller & kMask) | ((Callee & kMask) << kBits);
-  ValueProfileMap.AddValueModPrime(Idx);
+  ValueProfileMap.AddValueModPrime(Idx, ValueProfileMapIdx);
+}
+
+void TracePC::StartSeeingPCs() {
+  SeenPCs = new std::unordered_set<uintptr_t>;
+  if (DoPrintNewPCs && EF->__sanitizer_symbolize_pc)
+    Symbolizer.Start();
 }
 
 void TracePC::InitializePrintNewPCs() {
-  if (!DoPrintNewPCs) return;
-  assert(!PrintedPCs);
-  PrintedPCs = new std::set<uintptr_t>;
-  for (size_t i = 1; i < GetNumPCs(); i++)
-    if (PCs()[i])
-      PrintedPCs->insert(PCs()[i]);
+  if (!DoPrintNewPCs && !DoCollectCoveredPCs) return;
+  if (SeenPCs) return;  // The seed corpus found new units.
+  StartSeeingPCs();
+  ForEachCoveredGuard({1, GetNumPCs()},
+                      [&](size_t Idx) { SeenPCs->insert(PCs()[Idx]); });
 }
 
 void TracePC::PrintNewPCs() {
-  if (!DoPrintNewPCs) return;
-  assert(PrintedPCs);
-  for (size_t i = 1; i < GetNumPCs(); i++)
-    if (PCs()[i] && PrintedPCs->insert(PCs()[i]).second)
-      PrintPC("\tNEW_PC: %p %F %L\n", "\tNEW_PC: %p\n", PCs()[i]);
+  if (!DoPrintNewPCs && !DoCollectCoveredPCs) return;
+  if (!SeenPCs) StartSeeingPCs();
+  ForEachCoveredGuard({1, GetNumPCs()}, [&](size_t Idx) {
+    uintptr_t PC = PCs()[Idx];
+    if (PC && SeenPCs->insert(PC).second && DoPrintNewPCs)
+      Symbolizer.Print(PC);
+  });
 }
 
 void TracePC::PrintCoverage() {
@@ -180,11 +927,11 @@ void TracePC::PrintCoverage() {
   for (size_t i = 1; i < GetNumPCs(); i++) {
     uintptr_t PC = PCs()[i];
     if (!PC) continue;
-    std::string FileStr = DescribePC("%s", PC);
-    if (!IsInterestingCoverageFile(FileStr)) continue;
-    std::string FixedPCStr = DescribePC("%p", PC);
-    std::string FunctionStr = DescribePC("%F", PC);
-    std::string LineStr = DescribePC("%l", PC);
+    auto &Info = Symbolizer.Describe(PC);
+    const std::string &FileStr = Info.File;
+    if (!Info.FixedPC || !IsInterestingCoverageFile(FileStr)) continue;
+    const std::string &FunctionStr = Info.Function;
+    const std::string &LineStr = Info.Line;
     char ModulePathRaw[4096] = "";  // What's PATH_MAX in portable C++?
     void *OffsetRaw = nullptr;
     if (!EF->__sanitizer_get_module_and_offset_for_pc(
@@ -192,7 +939,7 @@ void TracePC::PrintCoverage() {
             sizeof(ModulePathRaw), &OffsetRaw))
       continue;
     std::string Module = ModulePathRaw;
-    uintptr_t FixedPC = std::stoull(FixedPCStr, 0, 16);
+    uintptr_t FixedPC = Info.FixedPC;
     uintptr_t PcOffset = reinterpret_cast<uintptr_t>(OffsetRaw);
     ModuleOffsets[Module] = FixedPC - PcOffset;
     CoveredPCsPerModule[Module].push_back(PcOffset);
@@ -241,18 +988,19 @@ void TracePC::PrintCoverage() {
       if (!std::binary_search(CoveredOffsets.begin(), CoveredOffsets.end(),
                               PcOffset)) {
         uintptr_t PC = ModuleOffset + PcOffset;
-        auto FileStr = DescribePC("%s", PC);
-        if (!IsInterestingCoverageFile(FileStr)) continue;
+        auto &Info = Symbolizer.Describe(PC);
+        const std::string &FileStr = Info.File;
+        if (!Info.FixedPC || !IsInterestingCoverageFile(FileStr)) continue;
         if (CoveredFiles.count(FileStr) == 0) {
           UncoveredFiles.insert(FileStr);
           continue;
         }
-        auto FunctionStr = DescribePC("%F", PC);
+        const std::string &FunctionStr = Info.Function;
         if (CoveredFunctions.count(FunctionStr) == 0) {
           UncoveredFunctions.insert(FunctionStr);
           continue;
         }
-        std::string LineStr = DescribePC("%l", PC);
+        const std::string &LineStr = Info.Line;
         uintptr_t Line = std::stoi(LineStr);
         std::string FileLineStr = FileStr + ":" + LineStr;
         if (CoveredLines.count(FileLineStr) == 0)
@@ -284,6 +1032,35 @@ void TracePC::DumpCoverage() {
   }
 }
 
+void TracePC::CollectModuleCoverage(
+    std::vector<std::pair<std::string, Unit>> *Files) const {
+  if (!SeenPCs || !EF->__sanitizer_get_module_and_offset_for_pc) return;
+  std::map<std::string, std::vector<uint64_t>> OffsetsPerModule;
+  for (uintptr_t PC : *SeenPCs) {
+    char ModulePathRaw[4096] = "";
+    void *OffsetRaw = nullptr;
+    if (!EF->__sanitizer_get_module_and_offset_for_pc(
+            reinterpret_cast<void *>(GetPreviousInstructionPc(PC)),
+            ModulePathRaw, sizeof(ModulePathRaw), &OffsetRaw))
+      continue;
+    OffsetsPerModule[ModulePathRaw].push_back(
+        reinterpret_cast<uintptr_t>(OffsetRaw));
+  }
+  // The 64-bit .sancov format: a magic word, then the sorted PC offsets.
+  const uint64_t kMagic = 0xC0BFFFFFFFFFFF64ULL;
+  for (auto &M : OffsetsPerModule) {
+    auto &Offsets = M.second;
+    std::sort(Offsets.begin(), Offsets.end());
+    Unit U(sizeof(kMagic) * (Offsets.size() + 1));
+    memcpy(U.data(), &kMagic, sizeof(kMagic));
+    memcpy(U.data() + sizeof(kMagic), Offsets.data(),
+           Offsets.size() * sizeof(kMagic));
+    std::string Name = M.first.substr(M.first.find_last_of('/') + 1);
+    Files->push_back(
+        {Name + "." + std::to_string(GetPid()) + ".sancov", std::move(U)});
+  }
+}
+
 // Value profile.
 // We keep track of various values that affect control flow.
 // These values are inserted into a bit-set-based hash map.
@@ -318,8 +1095,12 @@ void TracePC::AddValueForMemcmp(void *caller_pc, const void *s1, const void *s2,
       break;
   size_t PC = reinterpret_cast<size_t>(caller_pc);
   size_t Idx = (PC & 4095) | (I << 12);
-  ValueProfileMap.AddValue(Idx);
-  TORCW.Insert(Idx ^ Hash, Word(B1, Len), Word(B2, Len));
+  ValueProfileMap.AddValue(
+      (PC & ((1ULL << ValueProfilePCBits) - 1)) | (I << ValueProfilePCBits),
+      ValueProfileMapIdx);
+  ThreadCmp->TORCW.Insert(Idx ^ Hash, Word(B1, Len), Word(B2, Len));
+  if (CmpArgsOut && I < Len)
+    RecordCmpArgs(B1, B2, Len);
 }
 
 template <class T>
@@ -328,12 +1109,16 @@ ATTRIBUTE_NO_SANITIZE_ALL
 void TracePC::HandleCmp(uintptr_t PC, T Arg1, T Arg2) {
   uint64_t ArgXor = Arg1 ^ Arg2;
   uint64_t ArgDistance = __builtin_popcountll(ArgXor) + 1; // [1,65]
-  uintptr_t Idx = ((PC & 4095) + 1) * ArgDistance;
+  uintptr_t Idx =
+      ((PC & ((1ULL << ValueProfilePCBits) - 1)) + 1) * ArgDistance;
   if (sizeof(T) == 4)
-      TORC4.Insert(ArgXor, Arg1, Arg2);
+      ThreadCmp->TORC4.Insert(ArgXor, Arg1, Arg2);
   else if (sizeof(T) == 8)
-      TORC8.Insert(ArgXor, Arg1, Arg2);
-  ValueProfileMap.AddValue(Idx);
+      ThreadCmp->TORC8.Insert(ArgXor, Arg1, Arg2);
+  ValueProfileMap.AddValue(Idx, ValueProfileMapIdx);
+  if (CmpArgsOut && ArgXor)
+    RecordCmpArgs(reinterpret_cast<const uint8_t *>(&Arg1),
+                  reinterpret_cast<const uint8_t *>(&Arg2), sizeof(T));
 }
 
 static size_t InternalStrnlen(const char *S, size_t MaxLen) {
@@ -358,8 +1143,10 @@ ATTRIBUTE_NO_SANITIZE_ALL
 void __sanitizer_cov_trace_pc_guard(uint32_t *Guard) {
   uintptr_t PC = reinterpret_cast<uintptr_t>(__builtin_return_address(0));
   uint32_t Idx = *Guard;
-  __sancov_trace_pc_pcs[Idx] = PC;
-  __sancov_trace_pc_guard_8bit_counters[Idx]++;
+  CoverageTables *T = Tables;
+  T->PCs[Idx] = PC;
+  MarkCovered(T, Idx);
+  T->Counters[Idx]++;
 }
 
 // Best-effort support for -fsanitize-coverage=trace-pc, which is available
@@ -369,8 +1156,10 @@ ATTRIBUTE_NO_SANITIZE_ALL
 void __sanitizer_cov_trace_pc() {
   uintptr_t PC = reinterpret_cast<uintptr_t>(__builtin_return_address(0));
   uintptr_t Idx = PC & (((uintptr_t)1 << fuzzer::TracePC::kTracePcBits) - 1);
-  __sancov_trace_pc_pcs[Idx] = PC;
-  __sancov_trace_pc_guard_8bit_counters[Idx]++;
+  CoverageTables *T = Tables;
+  T->PCs[Idx] = PC;
+  MarkCovered(T, Idx);
+  T->Counters[Idx]++;
 }
 
 ATTRIBUTE_INTERFACE
@@ -383,6 +1172,12 @@ void __sanitizer_cov_8bit_counters_init(uint8_t *Start, uint8_t *Stop) {
   fuzzer::TPC.HandleInline8bitCountersInit(Start, Stop);
 }
 
+ATTRIBUTE_INTERFACE
+void __sanitizer_cov_pcs_init(const uintptr_t *pcs_beg,
+                              const uintptr_t *pcs_end) {
+  fuzzer::TPC.HandlePCsInit(pcs_beg, pcs_end);
+}
+
 ATTRIBUTE_INTERFACE
 ATTRIBUTE_NO_SANITIZE_ALL
 void __sanitizer_cov_trace_pc_indir(uintptr_t Callee) {
@@ -523,20 +1318,20 @@ ATTRIBUTE_INTERFACE ATTRIBUTE_NO_SANITIZE_MEMORY
 void __sanitizer_weak_hook_strstr(void *called_pc, const char *s1,
                                   const char *s2, char *result) {
   if (fuzzer::ScopedDoingMyOwnMemOrStr::DoingMyOwnMemOrStr) return;
-  fuzzer::TPC.MMT.Add(reinterpret_cast<const uint8_t *>(s2), strlen(s2));
+  fuzzer::ThreadCmp->MMT.Add(reinterpret_cast<const uint8_t *>(s2), strlen(s2));
 }
 
 ATTRIBUTE_INTERFACE ATTRIBUTE_NO_SANITIZE_MEMORY
 void __sanitizer_weak_hook_strcasestr(void *called_pc, const char *s1,
                                       const char *s2, char *result) {
   if (fuzzer::ScopedDoingMyOwnMemOrStr::DoingMyOwnMemOrStr) return;
-  fuzzer::TPC.MMT.Add(reinterpret_cast<const uint8_t *>(s2), strlen(s2));
+  fuzzer::ThreadCmp->MMT.Add(reinterpret_cast<const uint8_t *>(s2), strlen(s2));
 }
 
 ATTRIBUTE_INTERFACE ATTRIBUTE_NO_SANITIZE_MEMORY
 void __sanitizer_weak_hook_memmem(void *called_pc, const void *s1, size_t len1,
                                   const void *s2, size_t len2, void *result) {
   if (fuzzer::ScopedDoingMyOwnMemOrStr::DoingMyOwnMemOrStr) return;
-  fuzzer::TPC.MMT.Add(reinterpret_cast<const uint8_t *>(s2), len2);
+  fuzzer::ThreadCmp->MMT.Add(reinterpret_cast<const uint8_t *>(s2), len2);
 }
 }  // extern "C"
@@ -15,8 +15,13 @@
 #include "FuzzerDefs.h"
 #include "FuzzerDictionary.h"
 #include "FuzzerExtFunctions.h"
+#include "FuzzerOracle.h"
+#include "FuzzerSignatureSet.h"
+#include "FuzzerSymbolizer.h"
 #include "FuzzerValueBitMap.h"
 
+#include <functional>
+#include <mutex>
 #include <set>
 #include <unordered_set>
 #include <vector>
@@ -33,6 +38,7 @@ namespace fuzzer {
 template<class T, size_t kSizeT>
 struct TableOfRecentCompares {
   static const size_t kSize = kSizeT;
+  static_assert(kSize <= 64, "Dirty has one bit per entry");
   struct Pair {
     T A, B;
   };
@@ -41,11 +47,22 @@ struct TableOfRecentCompares {
     Idx = Idx % kSize;
     Table[Idx].A = Arg1;
     Table[Idx].B = Arg2;
+    Dirty |= 1ULL << Idx;
   }
 
   Pair Get(size_t I) { return Table[I % kSize]; }
 
+  // Copies the entries inserted into Other since its previous merge.
+  void MergeFrom(TableOfRecentCompares &Other) {
+    for (uint64_t D = Other.Dirty; D; D &= D - 1) {
+      size_t Idx = __builtin_ctzll(D);
+      Table[Idx] = Other.Table[Idx];
+    }
+    Other.Dirty = 0;
+  }
+
   Pair Table[kSize];
+  uint64_t Dirty = 0;  // Entries inserted since the previous MergeFrom().
 };
 
 template <size_t kSizeT>
@@ -59,6 +76,7 @@ struct MemMemTable {
     Size = std::min(Size, Word::GetMaxSize());
     size_t Idx = SimpleFastHash(Data, Size) % kSize;
     MemMemWords[Idx].Set(Data, Size);
+    Dirty[Idx / 64] |= 1ULL << (Idx % 64);
   }
   const Word &Get(size_t Idx) {
     for (size_t i = 0; i < kSize; i++) {
@@ -68,40 +86,100 @@ struct MemMemTable {
     EmptyWord.Set(nullptr, 0);
     return EmptyWord;
   }
-};
 
-struct VectorIntHash {
-  size_t operator()(const std::vector<int>& v) const {
-    std::hash<int> hasher;
-    size_t seed = 0;
-    for (int i : v) {
-      seed ^= hasher(i) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+  // Copies the words added to Other since its previous merge.
+  void MergeFrom(MemMemTable &Other) {
+    for (size_t i = 0; i < kNumDirtyWords; i++) {
+      for (uint64_t D = Other.Dirty[i]; D; D &= D - 1) {
+        size_t Idx = i * 64 + __builtin_ctzll(D);
+        MemMemWords[Idx] = Other.MemMemWords[Idx];
+      }
+      Other.Dirty[i] = 0;
     }
-    return seed;
+  }
+
+  static const size_t kNumDirtyWords = (kSize + 63) / 64;
+  uint64_t Dirty[kNumDirtyWords] = {};
+};
+
+// The comparison operands recorded for the mutator. Every -diff_parallel
+// worker thread records into tables of its own, so that the workers do not
+// write to the same cache lines on every comparison; the fuzzing thread
+// merges them into its tables after each run.
+struct CmpTables {
+  TableOfRecentCompares<uint32_t, 32> TORC4;
+  TableOfRecentCompares<uint64_t, 32> TORC8;
+  TableOfRecentCompares<Word, 32> TORCW;
+  MemMemTable<1024> MMT;
+
+  void MergeFrom(CmpTables &Other) {
+    TORC4.MergeFrom(Other.TORC4);
+    TORC8.MergeFrom(Other.TORC8);
+    TORCW.MergeFrom(Other.TORCW);
+    MMT.MergeFrom(Other.MMT);
   }
 };
-using SetOfIntVectors = std::unordered_set<std::vector<int>, VectorIntHash>;
 
 class TracePC {
  public:
-  static const size_t kNumPCs = 1 << 21;
+  // The coverage tables start with room for kDefaultNumPCs guards and grow
+  // in HandleInit, up to kMaxNumPCs, to fit the guards of all modules.
+  static const size_t kDefaultNumPCs = 1 << 18;
+  static const size_t kMaxNumPCs = 1 << 26;
   // How many bits of PC are used from __sanitizer_cov_trace_pc.
   static const size_t kTracePcBits = 18;
 
   void HandleInit(uint32_t *Start, uint32_t *Stop);
   void HandleInline8bitCountersInit(uint8_t *Start, uint8_t *Stop);
+  void HandlePCsInit(const uintptr_t *Start, const uintptr_t *Stop);
   void HandleCallerCallee(uintptr_t Caller, uintptr_t Callee);
   template <class T> void HandleCmp(uintptr_t PC, T Arg1, T Arg2);
   size_t GetTotalPCCoverage();
+  // Clears the PCs and the covered-guard bitmap. Only the diff mode paths
+  // call it, before every input or window; otherwise both accumulate over
+  // the whole run, which is the coverage the status lines and -print_pcs
+  // report.
   void ResetCoverage(); //change on 11.6
   void SetUseCounters(bool UC) { UseCounters = UC; }
-  void SetUseValueProfile(bool VP) { UseValueProfile = VP; }
+  void SetUseValueProfile(bool VP) {
+    UseValueProfile = VP;
+    SelectFeaturePasses();
+  }
+  // Allocates NumMaps value profile maps of 1 << MapSizeLog bits, one per
+  // differential callback in diff mode. Until then values are dropped.
+  bool SetValueProfileMaps(size_t MapSizeLog, size_t NumMaps);
+  // Selects the value profile map of the calling thread.
+  static void SelectValueProfileMap(size_t Idx);
   void SetPrintNewPCs(bool P) { DoPrintNewPCs = P; }
-  template <class Callback> void CollectFeatures(Callback CB) const;
+  // Keeps the PCs PrintNewPCs() sees even without -print_pcs=1, for
+  // CollectModuleCoverage().
+  void SetCollectCoveredPCs(bool C) { DoCollectCoveredPCs = C; }
+  // With OnlyCallback >= 0, the guards of the other differential callbacks
+  // are skipped: their counters are known to be zero.
+  //
+  // It runs the instance of CollectFeaturesWith() for the passes this
+  // configuration needs, which the guard counters (and the inline 8-bit
+  // counters moved into them) always are: there is one for every subset of
+  // the extra counters and the value profile, picked when the value profile
+  // is set up, so the loops over the guards don't test for the others.
+  template <class Callback>
+  void CollectFeatures(Callback CB, int OnlyCallback = -1) const;
+  enum FeaturePass : unsigned {
+    kExtraCountersPass = 1,
+    kValueProfilePass = 2,
+    kAllFeaturePasses = 3,
+  };
+  unsigned FeaturePassesInUse() const { return FeaturePasses; }
+
+  // Moves the inline 8-bit counters hit by the last run into the guard
+  // tables and zeroes them. Every module with inline counters owns a range
+  // of guard indices, so the rest of TracePC (features, covered bitmap,
+  // CallbackGuards, coverage export) treats them like guard counters.
+  void UpdateInline8bitCounters();
 
   void ResetMaps() {
     ValueProfileMap.Reset();
-    memset(Counters(), 0, GetNumPCs());
+    ClearCounters();
     ClearExtraCounters();
   }
 
@@ -109,40 +187,191 @@ class TracePC {
   void PrintFeatureSet();
 
   void PrintModuleInfo();
+  // ObjectFileId() of every instrumented module, in load order, and of the
+  // objects with the differential callbacks, one per line; empty if one is
+  // not known. Bases, if given, gets their ObjectFileBase()s.
+  std::string CodeId(std::vector<uintptr_t> *Bases = nullptr) const;
 
   void PrintCoverage();
   void DumpCoverage();
+  // The PCs PrintNewPCs() has seen, as .sancov files named like those of
+  // DumpCoverage(): one for each module, so one for each differential
+  // callback in its own library. Needs SetCollectCoveredPCs().
+  void CollectModuleCoverage(
+      std::vector<std::pair<std::string, Unit>> *Files) const;
 
   void AddValueForMemcmp(void *caller_pc, const void *s1, const void *s2,
                          size_t n, bool StopAtZero);
 
-  TableOfRecentCompares<uint32_t, 32> TORC4;
-  TableOfRecentCompares<uint64_t, 32> TORC8;
-  TableOfRecentCompares<Word, 32> TORCW;
-  MemMemTable<1024> MMT;
+  // The tables of the fuzzing thread, which the mutator reads.
+  CmpTables Cmp;
+  // Makes the calling thread record its comparisons in tables of its own.
+  void UseThreadCmpTables();
+  // Merges the tables of all such threads into Cmp. The threads must not be
+  // running callbacks.
+  void MergeThreadCmpTables();
+  // Makes the guards hit on the calling thread, and the coverage TracePC
+  // reports to it, go to zeroed tables of its own until
+  // FreeThreadCoverage(). The inline 8-bit counters and the value profile
+  // stay shared. The coverage tables do not grow while such threads exist.
+  static bool UseThreadCoverage();
+  static void FreeThreadCoverage();
+  // Moves the coverage tables to huge pages (MapHugePages()), as well as
+  // those of the threads and modules that come later. Call before any thread
+  // uses its own tables. *Size is the size of the mappings and *HugeSize the
+  // part of it the kernel backs with huge pages.
+  static bool UseHugePages(size_t *Size, size_t *HugeSize);
+
+  // While Out is set, the operands of the comparisons that do not match are
+  // appended to it, both of them, up to kMaxRecordedCmpArgs words. Only
+  // comparisons made on the fuzzing thread are recorded.
+  void SetCmpArgsOut(std::vector<Word> *Out) { CmpArgsOut = Out; }
+  static const size_t kMaxRecordedCmpArgs = 1024;
 
   void PrintNewPCs();
   void InitializePrintNewPCs();
-  void InitializeDiffCallbacks(ExternalFunctions *EF);
+  // Waits for the NEW_PC lines still being symbolized.
+  void FlushNewPCs() { Symbolizer.Stop(); }
+  // With Remote, the differential callbacks are Remote's proxies rather than
+  // those of LLVMFuzzerCustomCallbacks().
+  void InitializeDiffCallbacks(ExternalFunctions *EF,
+                               UserCallbacks *Remote = nullptr);
   size_t GetNumPCs() const {
-    return NumGuards == 0 ? (1 << kTracePcBits) : Min(kNumPCs, NumGuards + 1);
+    return NumGuards == 0 ? (1 << kTracePcBits)
+                          : Min(NumPCsCapacity(), NumGuards + 1);
   }
   uintptr_t GetPC(size_t Idx) {
     assert(Idx < GetNumPCs());
     return PCs()[Idx];
   }
   uintptr_t *PCs() const;
+  // The number of guards the coverage tables have room for.
+  size_t NumPCsCapacity() const;
+
+  // One bit per guard, set together with PCs()[Idx]. Every module after the
+  // first one starts on a 64-bit word boundary, so the bitmap splits into
+  // private per-module slices.
+  const uint64_t *CoveredBits() const;
+  // The indices of the words of CoveredBits() that got their first bit since
+  // the last ResetCoverage().
+  const uint32_t *TouchedCoverageWords(size_t *NumWords) const;
+  // Half-open range of guard indices.
+  struct GuardRange {
+    size_t Begin, End;
+  };
+  // Guards of the module instrumenting differential callback Idx
+  // (module 0 is the main binary, module Idx+1 is the library of callback Idx).
+  // Modules are counted in load order, whether they use trace-pc-guard or
+  // inline 8-bit counters.
+  GuardRange CallbackGuards(size_t Idx) const;
+  // Reserves N guards for the coverage of the next remote callback (see
+  // RemoteWorkers), which CallbackGuards() then reports instead of modules.
+  GuardRange AddRemoteCallbackGuards(size_t N);
+  // Reserves N guards for each callback i with Traced[i], whose library has
+  // no instrumented module (see HardwareTrace); the modules of the others
+  // keep the order of the callbacks.
+  void AddTracedCallbackGuards(const std::vector<bool> &Traced, size_t N);
+  // Moves the 8-bit counters of a hardware trace into the guards Into,
+  // zeroes them and passes the feature of every such guard to HandleFeature,
+  // in increasing order, as CollectFeatures() would.
+  void ImportTraceCounters(GuardRange Into, uint8_t *Counts,
+                           const std::function<void(size_t)> &HandleFeature);
+  // For reloading the library of callback Idx: before it is unloaded, the
+  // counters of its modules are no longer read; once it is loaded again,
+  // its guards are those of the modules from FirstModule on, which
+  // NumModulesLoaded() returned before.
+  void ForgetCallbackModules(size_t Idx);
+  void MoveCallbackGuards(size_t Idx, size_t FirstModule);
+  size_t NumModulesLoaded() const { return NumModuleGuards; }
+  template <class Callback>  // void Callback(size_t GuardIdx);
+  void ForEachCoveredGuard(GuardRange R, Callback CB) const;
+
+  // Flat copy of the coverage of the last run, used to ship it from a
+  // forked child (-diff_fork) back to the parent: the covered guards, the
+  // value profile and the non-zero extra counters.
+  size_t MaxExportedCoverageSize() const;
+  size_t ExportCoverage(uint8_t *Out, size_t MaxSize) const;
+  void ImportCoverage(const uint8_t *In, size_t Size);
+  // The same for the coverage of one callback in another process: only the
+  // guards in R, numbered from R.Begin, without the value profile; stops
+  // when Out is full. Importing such a coverage moves it Into a range of
+  // this process.
+  size_t ExportCoverage(uint8_t *Out, size_t MaxSize, GuardRange R) const;
+  void ImportCoverage(const uint8_t *In, size_t Size, GuardRange Into);
+  // Calls CB(GuardIdx, PC) for every guard of an exported coverage, without
+  // touching the maps of this process.
+  void ForEachExportedGuard(
+      const uint8_t *In, size_t Size,
+      const std::function<void(size_t, uintptr_t)> &CB) const;
+  // Replaces the PC of every guard of an exported coverage with F(PC).
+  void MapExportedPCs(uint8_t *In, size_t Size,
+                      const std::function<uintptr_t(uintptr_t)> &F) const;
+
   std::vector<int> OutputDiffVec;
   UserCallbacks *UC;
+  UserBatchCallbacks *UBC = nullptr;  // Optional.
   bool NewOutputDiff();
+  // Classifies OutputDiffVec in one pass over its sorted values and returns
+  // true if the callbacks did not all return the same value. With an
+  // oracle, OutputDiffVec is first mapped to the first code of every class
+  // of equivalent codes, which the rest of the run then sees.
   bool NewOutputDiff_change();
+  void SetOutputOracle(const OutputOracle *O) { Oracle = O; }
+  // The runs whose results only differed in codes the oracle holds equal.
+  size_t NumOracleAgreements() const { return OracleAgreements; }
+  // Set by NewOutputDiff_change(). Callbacks i and j returned the same value
+  // iff OutputClass(i) == OutputClass(j); classes are numbered in the order
+  // of their first callback, so OutputClass(0) == 0.
+  uint32_t OutputClass(size_t Idx) const { return OutputClasses[Idx]; }
+  size_t NumOutputClasses() const { return NumClasses; }
+  // Also set by NewOutputDiff_change(): whether callback Idx rejected the
+  // input, i.e. the low -diff_verdict_bits of its return value are non-zero.
+  bool OutputRejected(size_t Idx) const {
+    return RejectMask[Idx / 64] >> (Idx % 64) & 1;
+  }
+  // The rejecting callbacks among the first 64, as a bitmask.
+  uint64_t OutputRejectMask() const { return RejectMask[0]; }
+  size_t NumOutputRejects() const { return NumRejects; }
+  void SetDiffVerdictBits(int Bits) { DiffVerdictBits = Bits; }
   bool NewTraceDiff(std::vector<int>& feature_v);
+  // Bounds the signatures remembered by NewOutputDiff() and NewTraceDiff()
+  // to about 2 * L each, forgetting the least recently seen; 0 = unbounded.
+  void SetDiffSignatureLimit(size_t L) {
+    FeatureTraceDiff.SetLimit(L);
+    OutputTraceDiff.SetLimit(L);
+  }
+  // The signatures behind NewTraceDiff() and NewOutputDiff(), for
+  // -diff_checkpoint.
+  SignatureSet *TraceDiffSignatures() { return &FeatureTraceDiff; }
+  SignatureSet *OutputDiffSignatures() { return &OutputTraceDiff; }
+  // The tuple of the edges every callback's module covered in the last run,
+  // each count mapped to EdgeCountBucket(). Returns true if the tuple is not
+  // among the SetEdgeBucketLimit() ones seen most recently.
+  bool NewEdgeBucketDiff();
+  void SetEdgeBucketLimit(size_t L) { EdgeBucketDiff.SetLimit(L); }
+  // 0 for no edge, otherwise 1 + floor(log2(NumEdges)).
+  static int EdgeCountBucket(size_t NumEdges) {
+    return NumEdges ? 64 - __builtin_clzll(NumEdges) : 0;
+  }
+  // The number of guards in R covered since the last ResetCoverage().
+  size_t NumCoveredGuards(GuardRange R) const;
   bool NewCoverage();
-  size_t ModuleNum[10];
+  // Returns the index of the differential callback whose module produced
+  // the given feature, or -1 if the feature belongs to no callback.
+  int CallbackOfFeature(size_t Feature) const;
 private:
+  template <class Callback, unsigned Passes>
+  void CollectFeaturesWith(Callback &CB, int OnlyCallback) const;
+  void SelectFeaturePasses();
+
   bool UseCounters = false;
   bool UseValueProfile = false;
+  // Until SelectFeaturePasses(), CollectFeatures() checks for everything.
+  unsigned FeaturePasses = kAllFeaturePasses;
   bool DoPrintNewPCs = false;
+  bool DoCollectCoveredPCs = false;
+  // How many low bits of a PC are hashed into a value profile index.
+  size_t ValueProfilePCBits = 12;
 
   struct Module {
     uint32_t *Start, *Stop;
@@ -152,81 +381,154 @@ private:
   size_t NumModules;  // linker-initialized.
   size_t NumGuards;  // linker-initialized.
 
-  struct { uint8_t *Start, *Stop; } ModuleCounters[4096];
+  struct {
+    uint8_t *Start, *Stop;
+    GuardRange Guards;
+    const uintptr_t *PCs;  // {PC, Flags} pairs from -fsanitize-coverage=pc-table.
+  } ModuleCounters[4096];
   size_t NumModulesWithInline8bitCounters;  // linker-initialized.
   size_t NumInline8bitCounters;
+  size_t NumModulesWithPCs;  // linker-initialized.
+
+  // Guard ranges of all modules, in load order.
+  GuardRange ModuleGuards[8192];
+  std::vector<GuardRange> RemoteCallbackGuards;
+  // The guards of every callback, once they are not those of module Idx+1
+  // (see AddTracedCallbackGuards() and MoveCallbackGuards()), and the
+  // callbacks in the order of their guards.
+  std::vector<GuardRange> MovedCallbackGuards;
+  std::vector<int> CallbackGuardOrder;
+  void SetCallbackGuards(const std::vector<GuardRange> &Ranges);
+  size_t NumModuleGuards;  // linker-initialized.
+  // Appends a module of N guards, starting on a fresh word of the covered
+  // bitmap, and returns its first guard index (which may be past the tables).
+  size_t AddModuleGuards(size_t N);
   
   uint8_t *Counters() const;
+  void ClearCounters();
+  // ClearCounters() clears the whole map once 1/kDenseClearFraction of it
+  // may be non-zero.
+  static const size_t kDenseClearFraction = 4;
   
 
-  std::set<uintptr_t> *PrintedPCs;
+  // The PCs covered by the inputs PrintNewPCs() was called for.
+  std::unordered_set<uintptr_t> *SeenPCs;
+  PCSymbolizer Symbolizer;
+  void StartSeeingPCs();
 
   ValueBitMap ValueProfileMap;
-  SetOfIntVectors FeatureTraceDiff;
-  SetOfIntVectors OutputTraceDiff;
+  std::mutex ThreadCmpTablesMu;
+  std::vector<CmpTables *> ThreadCmpTables;
+  void RecordCmpArgs(const uint8_t *A, const uint8_t *B, size_t Size);
+  std::vector<Word> *CmpArgsOut = nullptr;
+  std::vector<std::pair<int, uint32_t>> SortedOutputs;
+  std::vector<uint32_t> OutputClasses;
+  size_t NumClasses = 0;
+  std::vector<uint64_t> RejectMask;
+  size_t NumRejects = 0;
+  int DiffVerdictBits = 0;
+  const OutputOracle *Oracle = nullptr;
+  size_t OracleAgreements = 0;
+  SignatureSet FeatureTraceDiff;
+  SignatureSet OutputTraceDiff;
+  SignatureSet EdgeBucketDiff;
+  std::vector<int> EdgeBuckets;
 };
 
+// Maps a non-zero 8-bit counter to one of 8 buckets:
+// 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128-255.
+extern const uint8_t kCounterBucket[256];
+
+// Returns the first P' >= P, stepping by kZeroScanBlockSize, such that the
+// block at P' has a non-zero byte or is shorter than a full block. Uses the
+// widest vector unit of the CPU (AVX2, NEON) when there is one.
+static const size_t kZeroScanBlockSize = 32;
+const uint8_t *SkipZeroBlocks(const uint8_t *P, const uint8_t *End);
+
 template <class Callback> // void Callback(size_t Idx, uint8_t Value);
 ATTRIBUTE_NO_SANITIZE_ALL
 void ForEachNonZeroByte(const uint8_t *Begin, const uint8_t *End,
                         size_t FirstFeature, Callback Handle8bitCounter) {
-  typedef uintptr_t LargeType;
-  const size_t Step = sizeof(LargeType) / sizeof(uint8_t);
-  const size_t StepMask = Step - 1;
-  auto P = Begin;
-  // Iterate by 1 byte until either the alignment boundary or the end.
-  for (; reinterpret_cast<uintptr_t>(P) & StepMask && P < End; P++)
-    if (uint8_t V = *P)
-      Handle8bitCounter(FirstFeature + P - Begin, V);
-
-  // Iterate by Step bytes at a time.
-  for (; P < End; P += Step)
-    if (LargeType Bundle = *reinterpret_cast<const LargeType *>(P))
-      for (size_t I = 0; I < Step; I++, Bundle >>= 8)
-        if (uint8_t V = Bundle & 0xff)
-          Handle8bitCounter(FirstFeature + P - Begin + I, V);
-
-  // Iterate by 1 byte until the end.
-  for (; P < End; P++)
-    if (uint8_t V = *P)
-      Handle8bitCounter(FirstFeature + P - Begin, V);
+  for (auto P = Begin; P < End;) {
+    P = SkipZeroBlocks(P, End);
+    auto BlockEnd = P + Min(kZeroScanBlockSize, static_cast<size_t>(End - P));
+    for (; P < BlockEnd; P++)
+      if (uint8_t V = *P)
+        Handle8bitCounter(FirstFeature + P - Begin, V);
+  }
+}
+
+template <class Callback>  // void Callback(size_t GuardIdx);
+ATTRIBUTE_NO_SANITIZE_ALL
+void TracePC::ForEachCoveredGuard(GuardRange R, Callback CB) const {
+  const uint64_t *Bits = CoveredBits();
+  R.End = Min(R.End, GetNumPCs());
+  for (size_t W = R.Begin / 64, E = (R.End + 63) / 64; W < E; W++) {
+    uint64_t Word = Bits[W];
+    while (Word) {
+      size_t Idx = W * 64 + __builtin_ctzll(Word);
+      Word &= Word - 1;
+      if (Idx >= R.Begin && Idx < R.End)
+        CB(Idx);
+    }
+  }
 }
 
 template <class Callback>  // bool Callback(size_t Feature)
+void TracePC::CollectFeatures(Callback HandleFeature, int OnlyCallback) const {
+  typedef void (TracePC::*Instance)(Callback &, int) const;
+  static const Instance Instances[] = {
+      &TracePC::CollectFeaturesWith<Callback, 0>,
+      &TracePC::CollectFeaturesWith<Callback, kExtraCountersPass>,
+      &TracePC::CollectFeaturesWith<Callback, kValueProfilePass>,
+      &TracePC::CollectFeaturesWith<Callback, kAllFeaturePasses>};
+  (this->*Instances[FeaturePasses])(HandleFeature, OnlyCallback);
+}
+
+template <class Callback, unsigned Passes>
 ATTRIBUTE_NO_SANITIZE_ALL
 __attribute__((noinline))
-void TracePC::CollectFeatures(Callback HandleFeature) const {
+void TracePC::CollectFeaturesWith(Callback &HandleFeature,
+                                  int OnlyCallback) const {
   uint8_t *Counters = this->Counters();
   size_t N = GetNumPCs();
   auto Handle8bitCounter = [&](size_t Idx, uint8_t Counter) {
     assert(Counter);
-    unsigned Bit = 0;
-    /**/ if (Counter >= 128) Bit = 7;
-    else if (Counter >= 32) Bit = 6;
-    else if (Counter >= 16) Bit = 5;
-    else if (Counter >= 8) Bit = 4;
-    else if (Counter >= 4) Bit = 3;
-    else if (Counter >= 3) Bit = 2;
-    else if (Counter >= 2) Bit = 1;
-    HandleFeature(Idx * 8 + Bit);
+    HandleFeature(Idx * 8 + kCounterBucket[Counter]);
   };
 
+  // Only the guards hit since the last ResetCoverage() can have non-zero
+  // counters, so walk the covered bitmap instead of all N counters.
   size_t FirstFeature = 0;
-  ForEachNonZeroByte(Counters, Counters + N, FirstFeature, Handle8bitCounter);
-  FirstFeature += N * 8;
-  for (size_t i = 0; i < NumModulesWithInline8bitCounters; i++) {
-    ForEachNonZeroByte(ModuleCounters[i].Start, ModuleCounters[i].Stop,
-                       FirstFeature, Handle8bitCounter);
-    FirstFeature += 8 * (ModuleCounters[i].Stop - ModuleCounters[i].Start);
+  auto HandleGuard = [&](size_t Idx) {
+    if (uint8_t V = Counters[Idx])
+      Handle8bitCounter(Idx, V);
+  };
+  size_t Begin = 0;
+  if (OnlyCallback >= 0) {
+    // The guards of the callbacks, in ascending order.
+    for (int k = 0; k < UC->size; k++) {
+      int i = CallbackGuardOrder.empty() ? k : CallbackGuardOrder[k];
+      GuardRange R = CallbackGuards(i);
+      if (i == OnlyCallback || R.Begin == R.End) continue;
+      ForEachCoveredGuard({Begin, R.Begin}, HandleGuard);
+      Begin = R.End;
+    }
   }
+  ForEachCoveredGuard({Begin, N}, HandleGuard);
+  FirstFeature += N * 8;
 
-  ForEachNonZeroByte(ExtraCountersBegin(), ExtraCountersEnd(), FirstFeature,
-                     Handle8bitCounter);
+  if (Passes & kExtraCountersPass)
+    ForEachNonZeroByte(ExtraCountersBegin(), ExtraCountersEnd(), FirstFeature,
+                       Handle8bitCounter);
 
-  if (UseValueProfile)
-    ValueProfileMap.ForEach([&](size_t Idx) {
-      HandleFeature(N * 8 + Idx);
-    });
+  if (Passes & kValueProfilePass) {
+    auto HandleValue = [&](size_t Idx) { HandleFeature(N * 8 + Idx); };
+    if (OnlyCallback >= 0 && ValueProfileMap.NumMaps() > 1)
+      ValueProfileMap.ForEachInMap(OnlyCallback, HandleValue);
+    else
+      ValueProfileMap.ForEach(HandleValue);
+  }
 }
 
 extern TracePC TPC;
@@ -12,15 +12,18 @@
 #include "FuzzerUtil.h"
 #include "FuzzerIO.h"
 #include "FuzzerInternal.h"
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <cstring>
 #include <errno.h>
+#include <map>
 #include <signal.h>
 #include <sstream>
 #include <stdio.h>
 #include <sys/types.h>
 #include <thread>
+#include <tuple>
 
 namespace fuzzer {
 
@@ -205,6 +208,70 @@ unsigned NumberOfCpuCores() {
   return N;
 }
 
+std::vector<unsigned> ParseCpuList(const std::string &S) {
+  std::vector<unsigned> Res;
+  std::istringstream SS(S);
+  std::string Range;
+  while (std::getline(SS, Range, ',')) {
+    unsigned First, Last;
+    int N = sscanf(Range.c_str(), "%u-%u", &First, &Last);
+    if (N <= 0) continue;
+    if (N == 1) Last = First;
+    for (unsigned Cpu = First; Cpu <= Last; Cpu++)
+      Res.push_back(Cpu);
+  }
+  return Res;
+}
+
+std::vector<CpuInfo> OrderCpusForPlacement(std::vector<CpuInfo> Cpus) {
+  std::sort(Cpus.begin(), Cpus.end(), [](const CpuInfo &A, const CpuInfo &B) {
+    return A.Cpu < B.Cpu;
+  });
+  // Key every CPU by (which hardware thread of its core it is, how many CPUs
+  // of the same kind come before it on its node, node).
+  std::map<unsigned, unsigned> ThreadsOfCore;
+  std::map<std::pair<unsigned, unsigned>, unsigned> SeenOnNode;
+  std::vector<std::tuple<unsigned, unsigned, unsigned, size_t>> Keys;
+  for (size_t i = 0; i < Cpus.size(); i++) {
+    const CpuInfo &C = Cpus[i];
+    unsigned Thread = ThreadsOfCore[C.Core]++;
+    unsigned Pos = SeenOnNode[{Thread, C.Node}]++;
+    Keys.push_back(std::make_tuple(Thread, Pos, C.Node, i));
+  }
+  std::sort(Keys.begin(), Keys.end());
+  std::vector<CpuInfo> Res;
+  for (auto &K : Keys)
+    Res.push_back(Cpus[std::get<3>(K)]);
+  return Res;
+}
+
+std::vector<std::vector<CpuInfo>>
+SplitCpusAmongWorkers(const std::vector<CpuInfo> &Cpus, unsigned NumWorkers) {
+  std::vector<std::vector<CpuInfo>> Res(NumWorkers);
+  if (Cpus.empty()) return Res;
+  for (unsigned W = 0; W < NumWorkers; W++)
+    Res[W].push_back(Cpus[W % Cpus.size()]);
+  // The leftover CPUs go in turn to the workers of their node.
+  std::map<unsigned, unsigned> NextOnNode;
+  for (size_t i = NumWorkers; i < Cpus.size(); i++) {
+    unsigned Node = Cpus[i].Node;
+    std::vector<unsigned> OnNode;
+    for (unsigned W = 0; W < NumWorkers; W++)
+      if (Res[W][0].Node == Node)
+        OnNode.push_back(W);
+    if (OnNode.empty()) continue;
+    Res[OnNode[NextOnNode[Node]++ % OnNode.size()]].push_back(Cpus[i]);
+  }
+  return Res;
+}
+
+unsigned NumaNodeOfCpu(unsigned Cpu) {
+  for (auto &C : GetCpuTopology())
+    if (C.Cpu == Cpu)
+      return C.Node;
+  return 0;
+}
+
 bool ExecuteCommandAndReadOutput(const std::string &Command, std::string *Out) {
   FILE *Pipe = OpenProcessPipe(Command.c_str(), "r");
   if (!Pipe) return false;
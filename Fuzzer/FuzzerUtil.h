@@ -46,14 +46,93 @@ bool ExecuteCommandAndReadOutput(const std::string &Command, std::string *Out);
 // Platform specific functions.
 void SetSignalHandler(const FuzzingOptions& Options);
 
+// Calls CB(Data, Size) such that AbandonCallback(), called from a signal
+// handler on the same thread while CB runs, returns from it at once with
+// *Abandoned set. One callback at a time, from the fuzzing thread. On
+// Windows CB always runs to its end.
+int RunAbandonableCallback(UserCallback CB, const uint8_t *Data, size_t Size,
+                           bool *Abandoned);
+// Does not return if a callback can be abandoned; returns false otherwise.
+bool AbandonCallback();
+
 void SleepSeconds(int Seconds);
 
 unsigned long GetPid();
 
+// Whether the process Pid still runs. Best effort: true where it can't tell.
+bool IsProcessAlive(unsigned long Pid);
+
 size_t GetPeakRSSMb();
 
 int ExecuteCommand(const std::string &Command);
 
+// Binds the calling thread to the given CPU, or set of CPUs. Best effort: a
+// no-op on platforms without thread affinity support.
+void SetThreadAffinity(unsigned Cpu);
+void SetThreadAffinity(const std::vector<unsigned> &Cpus);
+// The CPUs the calling thread is bound to, empty if it may run on every CPU.
+std::vector<unsigned> GetThreadAffinity();
+
+// A CPU, the core it is a hardware thread of and its NUMA node.
+struct CpuInfo {
+  unsigned Cpu, Core, Node;
+};
+// The online CPUs. Where the topology is unknown, every CPU is a core of its
+// own on node 0.
+std::vector<CpuInfo> GetCpuTopology();
+
+// Identifies the code of the loaded object (executable or shared library)
+// that contains Addr: its build id, or else the contents of its file. Empty
+// where that is not known.
+std::string ObjectFileId(const void *Addr);
+// The load address of that object, which Addr minus it does not depend on.
+// False where that is not known.
+bool ObjectFileBase(const void *Addr, uintptr_t *Base);
+// The order in which to bind workers to Cpus so that they get distinct
+// cores: the first hardware thread of every core before the second ones,
+// with the NUMA nodes taking turns.
+std::vector<CpuInfo> OrderCpusForPlacement(std::vector<CpuInfo> Cpus);
+// Splits Cpus, in placement order, into one set per worker: worker W gets
+// Cpus[W] and a share of the CPUs left over on the same NUMA node. With
+// fewer CPUs than workers, workers share single CPUs.
+std::vector<std::vector<CpuInfo>>
+SplitCpusAmongWorkers(const std::vector<CpuInfo> &Cpus, unsigned NumWorkers);
+// The NUMA node of Cpu, 0 if unknown.
+unsigned NumaNodeOfCpu(unsigned Cpu);
+// Parses a kernel CPU list such as "0-3,8,10-11".
+std::vector<unsigned> ParseCpuList(const std::string &S);
+
+// Keeps the timeout alarm away from the calling (non-fuzzing) thread.
+void BlockAlarmSignalForCurrentThread();
+
+// Maps Size bytes, rounded up to whole pages, that are immediately followed
+// by an inaccessible guard page. Returns nullptr on failure.
+uint8_t *MapWithGuardPage(size_t Size);
+void UnmapWithGuardPage(uint8_t *Ptr, size_t Size);
+// Makes the whole pages of [Ptr, Ptr + Size) read-only, or writable again.
+bool ProtectPages(void *Ptr, size_t Size, bool ReadOnly);
+// Calls Callback, which must not return, when a write faults in
+// [Begin, Begin + Size); other faults go to the handler that was installed
+// before. Later calls only move the range. Posix only.
+void SetWriteFaultHandler(const void *Begin, size_t Size, void (*Callback)());
+// Maps Size zeroed bytes, backed by large pages where the system allows.
+// Pages are only committed when written. Returns nullptr on failure.
+void *MapZeroedPages(size_t Size);
+void UnmapPages(void *Ptr, size_t Size);
+size_t GetPageSize();
+// The size of the pages MapHugePages() asks for.
+static const size_t kHugePageSize = 1 << 21;
+// Maps Size zeroed bytes, rounded up to kHugePageSize, on explicit huge pages
+// where the system has some reserved, or else aligned to kHugePageSize and
+// advised for transparent huge pages. Unlike MapZeroedPages() all pages are
+// committed right away, while huge pages are still easy to get. Returns
+// nullptr on failure.
+void *MapHugePages(size_t Size);
+void UnmapHugePages(void *Ptr, size_t Size);
+// How many bytes of the mapping [Ptr, Ptr + Size) the kernel backs with huge
+// pages, explicit or transparent. 0 where that is not known.
+size_t HugePageBytes(const void *Ptr, size_t Size);
+
 FILE *OpenProcessPipe(const char *Command, const char *Mode);
 
 const void *SearchMemory(const void *haystack, size_t haystacklen,
@@ -77,6 +156,9 @@ inline std::pair<std::string, std::string> SplitBefore(std::string X,
 
 std::string DisassembleCmd(const std::string &FileName);
 
+// Disassembles with file:line lines and demangled names, like objdump -d -l -C.
+std::string DisassembleWithLinesCmd(const std::string &FileName);
+
 std::string SearchRegexCmd(const std::string &Regex);
 
 size_t SimpleFastHash(const uint8_t *Data, size_t Size);
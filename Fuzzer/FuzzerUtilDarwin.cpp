@@ -12,6 +12,7 @@
 #if LIBFUZZER_APPLE
 
 #include "FuzzerIO.h"
+#include "FuzzerUtil.h"
 #include <mutex>
 #include <signal.h>
 #include <spawn.h>
@@ -156,6 +157,24 @@ int ExecuteCommand(const std::string &Command) {
   return ProcessStatus;
 }
 
+// Darwin has no API to pin a thread to a particular CPU.
+void SetThreadAffinity(unsigned Cpu) {}
+void SetThreadAffinity(const std::vector<unsigned> &Cpus) {}
+
+std::vector<unsigned> GetThreadAffinity() { return {}; }
+
+std::vector<CpuInfo> GetCpuTopology() {
+  std::vector<CpuInfo> Res;
+  for (unsigned Cpu = 0; Cpu < NumberOfCpuCores(); Cpu++)
+    Res.push_back({Cpu, Cpu, 0});
+  return Res;
+}
+
+std::string ObjectFileId(const void *Addr) { return ""; }
+bool ObjectFileBase(const void *Addr, uintptr_t *Base) { return false; }
+
+size_t HugePageBytes(const void *Ptr, size_t Size) { return 0; }
+
 } // namespace fuzzer
 
 #endif // LIBFUZZER_APPLE
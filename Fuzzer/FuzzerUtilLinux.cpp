@@ -11,7 +11,18 @@
 #include "FuzzerDefs.h"
 #if LIBFUZZER_LINUX
 
+#include "FuzzerIO.h"
+#include "FuzzerSHA1.h"
+#include "FuzzerUtil.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <elf.h>
+#include <fstream>
+#include <link.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <unordered_map>
 
 namespace fuzzer {
 
@@ -19,6 +30,152 @@ int ExecuteCommand(const std::string &Command) {
   return system(Command.c_str());
 }
 
+void SetThreadAffinity(unsigned Cpu) {
+  SetThreadAffinity(std::vector<unsigned>({Cpu}));
+}
+
+void SetThreadAffinity(const std::vector<unsigned> &Cpus) {
+  cpu_set_t Set;
+  CPU_ZERO(&Set);
+  for (unsigned Cpu : Cpus)
+    CPU_SET(Cpu % CPU_SETSIZE, &Set);
+  sched_setaffinity(0, sizeof(Set), &Set);  // 0 is the calling thread.
+}
+
+static std::string ReadSysFile(const std::string &Path) {
+  std::ifstream In(Path);
+  std::string Line;
+  std::getline(In, Line);
+  return Line;
+}
+
+std::vector<unsigned> GetThreadAffinity() {
+  std::vector<unsigned> Res;
+  cpu_set_t Set;
+  if (sched_getaffinity(0, sizeof(Set), &Set))
+    return Res;
+  // A thread that may run on every online CPU is not bound.
+  if (static_cast<size_t>(CPU_COUNT(&Set)) >=
+      ParseCpuList(ReadSysFile("/sys/devices/system/cpu/online")).size())
+    return Res;
+  for (int Cpu = 0; Cpu < CPU_SETSIZE; Cpu++)
+    if (CPU_ISSET(Cpu, &Set))
+      Res.push_back(Cpu);
+  return Res;
+}
+
+std::vector<CpuInfo> GetCpuTopology() {
+  std::unordered_map<unsigned, unsigned> NodeOfCpu;
+  for (unsigned Node :
+       ParseCpuList(ReadSysFile("/sys/devices/system/node/online")))
+    for (unsigned Cpu : ParseCpuList(ReadSysFile(
+             "/sys/devices/system/node/node" + std::to_string(Node) +
+             "/cpulist")))
+      NodeOfCpu[Cpu] = Node;
+  std::vector<unsigned> Online =
+      ParseCpuList(ReadSysFile("/sys/devices/system/cpu/online"));
+  if (Online.empty())
+    for (unsigned Cpu = 0; Cpu < NumberOfCpuCores(); Cpu++)
+      Online.push_back(Cpu);
+  std::vector<CpuInfo> Res;
+  for (unsigned Cpu : Online) {
+    // A core is known by the lowest of its hardware threads.
+    std::vector<unsigned> Siblings = ParseCpuList(
+        ReadSysFile("/sys/devices/system/cpu/cpu" + std::to_string(Cpu) +
+                    "/topology/thread_siblings_list"));
+    unsigned Core = Siblings.empty() ? Cpu : Siblings[0];
+    Res.push_back({Cpu, Core, NodeOfCpu.count(Cpu) ? NodeOfCpu[Cpu] : 0});
+  }
+  return Res;
+}
+
+namespace {
+struct ObjectSearch {
+  uintptr_t Addr;
+  bool Found;
+  std::string Path;
+  std::string BuildId;
+  uintptr_t Base;
+};
+
+// The NT_GNU_BUILD_ID note among the PT_NOTE segments of Info, if any.
+std::string FindBuildId(const struct dl_phdr_info *Info) {
+  for (int i = 0; i < Info->dlpi_phnum; i++) {
+    const ElfW(Phdr) &Ph = Info->dlpi_phdr[i];
+    if (Ph.p_type != PT_NOTE) continue;
+    const char *P = reinterpret_cast<const char *>(Info->dlpi_addr + Ph.p_vaddr);
+    const char *End = P + Ph.p_memsz;
+    while (End - P >= static_cast<ptrdiff_t>(sizeof(ElfW(Nhdr)))) {
+      auto *Note = reinterpret_cast<const ElfW(Nhdr) *>(P);
+      const char *Name = P + sizeof(*Note);
+      const char *Desc = Name + ((Note->n_namesz + 3) & ~3U);
+      if (Desc + Note->n_descsz > End) break;
+      if (Note->n_type == NT_GNU_BUILD_ID && Note->n_namesz == 4 &&
+          !memcmp(Name, "GNU", 4))
+        return std::string(Desc, Note->n_descsz);
+      P = Desc + ((Note->n_descsz + 3) & ~3U);
+    }
+  }
+  return "";
+}
+
+int FindObject(struct dl_phdr_info *Info, size_t, void *Arg) {
+  auto *S = static_cast<ObjectSearch *>(Arg);
+  for (int i = 0; i < Info->dlpi_phnum; i++) {
+    const ElfW(Phdr) &Ph = Info->dlpi_phdr[i];
+    uintptr_t Begin = Info->dlpi_addr + Ph.p_vaddr;
+    if (Ph.p_type != PT_LOAD || S->Addr < Begin ||
+        S->Addr >= Begin + Ph.p_memsz)
+      continue;
+    S->Found = true;
+    S->Path = *Info->dlpi_name ? Info->dlpi_name : "/proc/self/exe";
+    S->BuildId = FindBuildId(Info);
+    S->Base = Info->dlpi_addr;
+    return 1;
+  }
+  return 0;
+}
+}  // namespace
+
+std::string ObjectFileId(const void *Addr) {
+  ObjectSearch S = {reinterpret_cast<uintptr_t>(Addr), false, "", "", 0};
+  dl_iterate_phdr(FindObject, &S);
+  if (!S.Found) return "";
+  if (!S.BuildId.empty()) return "build-id:" + S.BuildId;
+  Unit U = FileToVector(S.Path, 0, /*ExitOnError=*/false);
+  return U.empty() ? "" : "file:" + Hash(U);
+}
+
+bool ObjectFileBase(const void *Addr, uintptr_t *Base) {
+  ObjectSearch S = {reinterpret_cast<uintptr_t>(Addr), false, "", "", 0};
+  dl_iterate_phdr(FindObject, &S);
+  *Base = S.Base;
+  return S.Found;
+}
+
+size_t HugePageBytes(const void *Ptr, size_t Size) {
+  uintptr_t Begin = reinterpret_cast<uintptr_t>(Ptr), End = Begin + Size;
+  std::ifstream In("/proc/self/smaps");
+  std::string Line;
+  bool InRange = false;
+  size_t Kb = 0;
+  while (std::getline(In, Line)) {
+    unsigned long Lo, Hi;
+    size_t N;
+    // Each mapping starts with "lo-hi perms ..." and is followed by its
+    // "Name:   N kB" fields.
+    if (sscanf(Line.c_str(), "%lx-%lx ", &Lo, &Hi) == 2) {
+      InRange = Lo < End && Hi > Begin;
+      continue;
+    }
+    if (InRange &&
+        (sscanf(Line.c_str(), "AnonHugePages: %zu kB", &N) == 1 ||
+         sscanf(Line.c_str(), "Private_Hugetlb: %zu kB", &N) == 1))
+      Kb += N;
+  }
+  return std::min(Kb << 10, Size);
+}
+
 } // namespace fuzzer
 
 #endif // LIBFUZZER_LINUX
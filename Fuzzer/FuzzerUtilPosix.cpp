@@ -17,9 +17,11 @@
 #include <cstring>
 #include <errno.h>
 #include <iomanip>
+#include <setjmp.h>
 #include <signal.h>
 #include <sstream>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
@@ -81,8 +83,12 @@ void SetTimer(int Seconds) {
 }
 
 void SetSignalHandler(const FuzzingOptions& Options) {
-  if (Options.UnitTimeoutSec > 0)
-    SetTimer(Options.UnitTimeoutSec / 2 + 1);
+  int AlarmSec = Options.UnitTimeoutSec > 0 ? Options.UnitTimeoutSec / 2 + 1 : 0;
+  if (Options.DiffCallbackTimeoutSec > 0 &&
+      (!AlarmSec || Options.DiffCallbackTimeoutSec / 2 + 1 < AlarmSec))
+    AlarmSec = Options.DiffCallbackTimeoutSec / 2 + 1;
+  if (AlarmSec)
+    SetTimer(AlarmSec);
   if (Options.HandleInt)
     SetSigaction(SIGINT, InterruptHandler);
   if (Options.HandleTerm)
@@ -101,12 +107,165 @@ void SetSignalHandler(const FuzzingOptions& Options) {
     SetSigaction(SIGXFSZ, FileSizeExceedHandler);
 }
 
+static sigjmp_buf CallbackEscape;
+static volatile sig_atomic_t CanAbandonCallback = 0;
+
+int RunAbandonableCallback(UserCallback CB, const uint8_t *Data, size_t Size,
+                           bool *Abandoned) {
+  *Abandoned = false;
+  if (sigsetjmp(CallbackEscape, /*savemask=*/1)) {
+    CanAbandonCallback = 0;
+    *Abandoned = true;
+    return 0;
+  }
+  CanAbandonCallback = 1;
+  int Res = CB(Data, Size);
+  CanAbandonCallback = 0;
+  return Res;
+}
+
+bool AbandonCallback() {
+  if (!CanAbandonCallback)
+    return false;
+  siglongjmp(CallbackEscape, 1);
+}
+
+void BlockAlarmSignalForCurrentThread() {
+  sigset_t Set;
+  sigemptyset(&Set);
+  sigaddset(&Set, SIGALRM);
+  pthread_sigmask(SIG_BLOCK, &Set, nullptr);
+}
+
+size_t GetPageSize() {
+  static size_t PageSize = sysconf(_SC_PAGESIZE);
+  return PageSize;
+}
+
+uint8_t *MapWithGuardPage(size_t Size) {
+  size_t PageSize = GetPageSize();
+  Size = (Size + PageSize - 1) & ~(PageSize - 1);
+  void *Ptr = mmap(nullptr, Size + PageSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (Ptr == MAP_FAILED)
+    return nullptr;
+  uint8_t *Mem = static_cast<uint8_t *>(Ptr);
+  if (mprotect(Mem + Size, PageSize, PROT_NONE)) {
+    munmap(Ptr, Size + PageSize);
+    return nullptr;
+  }
+  return Mem;
+}
+
+void UnmapWithGuardPage(uint8_t *Ptr, size_t Size) {
+  size_t PageSize = GetPageSize();
+  Size = (Size + PageSize - 1) & ~(PageSize - 1);
+  munmap(Ptr, Size + PageSize);
+}
+
+bool ProtectPages(void *Ptr, size_t Size, bool ReadOnly) {
+  size_t PageSize = GetPageSize();
+  Size = (Size + PageSize - 1) & ~(PageSize - 1);
+  return !mprotect(Ptr, Size, ReadOnly ? PROT_READ : PROT_READ | PROT_WRITE);
+}
+
+static const uint8_t *volatile WriteFaultBegin;
+static const uint8_t *volatile WriteFaultEnd;
+static void (*volatile WriteFaultCallback)();
+static struct sigaction PreviousSegvAction;
+
+static void WriteFaultHandler(int Sig, siginfo_t *Info, void *Context) {
+  auto *Addr = static_cast<const uint8_t *>(Info->si_addr);
+  if (Addr >= WriteFaultBegin && Addr < WriteFaultEnd)
+    WriteFaultCallback();
+  auto &Prev = PreviousSegvAction;
+  if (Prev.sa_flags & SA_SIGINFO) {
+    if (Prev.sa_sigaction)
+      return Prev.sa_sigaction(Sig, Info, Context);
+  } else if (Prev.sa_handler != SIG_DFL && Prev.sa_handler != SIG_IGN &&
+             Prev.sa_handler != SIG_ERR) {
+    return Prev.sa_handler(Sig);
+  }
+  // The fault happens again on return, with the default action.
+  signal(SIGSEGV, SIG_DFL);
+}
+
+void SetWriteFaultHandler(const void *Begin, size_t Size, void (*Callback)()) {
+  WriteFaultBegin = static_cast<const uint8_t *>(Begin);
+  WriteFaultEnd = WriteFaultBegin + Size;
+  WriteFaultCallback = Callback;
+  static bool Installed = false;
+  if (Installed) return;
+  Installed = true;
+  struct sigaction Action = {};
+  Action.sa_sigaction = WriteFaultHandler;
+  // Sanitizers run their SEGV handlers on an alternate stack.
+  Action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  if (sigaction(SIGSEGV, &Action, &PreviousSegvAction)) {
+    Printf("libFuzzer: sigaction failed with %d\n", errno);
+    exit(1);
+  }
+}
+
+void *MapZeroedPages(size_t Size) {
+  void *Ptr = mmap(nullptr, Size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (Ptr == MAP_FAILED)
+    return nullptr;
+#ifdef MADV_HUGEPAGE
+  madvise(Ptr, Size, MADV_HUGEPAGE);
+#endif
+  return Ptr;
+}
+
+void UnmapPages(void *Ptr, size_t Size) { munmap(Ptr, Size); }
+
+void *MapHugePages(size_t Size) {
+  Size = (Size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+#ifdef MAP_HUGETLB
+  // Explicit huge pages are reserved by mmap() itself, so this fails rather
+  // than faulting later when the pool is too small.
+  void *Ptr = mmap(nullptr, Size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (Ptr != MAP_FAILED)
+    return Ptr;
+#endif
+  // Over-map by one huge page and trim both ends, so that the mapping starts
+  // on a huge page boundary and every kHugePageSize of it can be one page.
+  void *Raw = mmap(nullptr, Size + kHugePageSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (Raw == MAP_FAILED)
+    return nullptr;
+  uintptr_t Begin = reinterpret_cast<uintptr_t>(Raw);
+  uintptr_t Aligned = (Begin + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  if (Aligned != Begin)
+    munmap(Raw, Aligned - Begin);
+  if (size_t Tail = Begin + kHugePageSize - Aligned)
+    munmap(reinterpret_cast<void *>(Aligned + Size), Tail);
+  auto *Mem = reinterpret_cast<volatile uint8_t *>(Aligned);
+#ifdef MADV_HUGEPAGE
+  madvise(const_cast<uint8_t *>(Mem), Size, MADV_HUGEPAGE);
+#endif
+  // The first write of each huge page range faults in the whole huge page.
+  for (size_t Offset = 0; Offset < Size; Offset += GetPageSize())
+    Mem[Offset] = 0;
+  return const_cast<uint8_t *>(Mem);
+}
+
+void UnmapHugePages(void *Ptr, size_t Size) {
+  munmap(Ptr, (Size + kHugePageSize - 1) & ~(kHugePageSize - 1));
+}
+
 void SleepSeconds(int Seconds) {
   sleep(Seconds); // Use C API to avoid coverage from instrumented libc++.
 }
 
 unsigned long GetPid() { return (unsigned long)getpid(); }
 
+bool IsProcessAlive(unsigned long Pid) {
+  return kill(static_cast<pid_t>(Pid), 0) == 0 || errno == EPERM;
+}
+
 size_t GetPeakRSSMb() {
   struct rusage usage;
   if (getrusage(RUSAGE_SELF, &usage))
@@ -135,6 +294,10 @@ std::string DisassembleCmd(const std::string &FileName) {
   return "objdump -d " + FileName;
 }
 
+std::string DisassembleWithLinesCmd(const std::string &FileName) {
+  return "objdump -d -l -C --no-show-raw-insn " + FileName;
+}
+
 std::string SearchRegexCmd(const std::string &Regex) {
   return "grep '" + Regex + "'";
 }
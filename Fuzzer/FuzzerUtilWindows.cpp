@@ -12,6 +12,7 @@
 #if LIBFUZZER_WINDOWS
 #include "FuzzerIO.h"
 #include "FuzzerInternal.h"
+#include "FuzzerUtil.h"
 #include <cassert>
 #include <chrono>
 #include <cstring>
@@ -115,8 +116,12 @@ static void CrashHandler(int) { Fuzzer::StaticCrashSignalCallback(); }
 void SetSignalHandler(const FuzzingOptions& Options) {
   HandlerOpt = &Options;
 
-  if (Options.UnitTimeoutSec > 0)
-    Timer.SetTimer(Options.UnitTimeoutSec / 2 + 1);
+  int AlarmSec = Options.UnitTimeoutSec > 0 ? Options.UnitTimeoutSec / 2 + 1 : 0;
+  if (Options.DiffCallbackTimeoutSec > 0 &&
+      (!AlarmSec || Options.DiffCallbackTimeoutSec / 2 + 1 < AlarmSec))
+    AlarmSec = Options.DiffCallbackTimeoutSec / 2 + 1;
+  if (AlarmSec)
+    Timer.SetTimer(AlarmSec);
 
   if (Options.HandleInt || Options.HandleTerm)
     if (!SetConsoleCtrlHandler(CtrlHandler, TRUE)) {
@@ -137,10 +142,28 @@ void SetSignalHandler(const FuzzingOptions& Options) {
     }
 }
 
+// The alarm runs on a timer-queue thread, which cannot unwind the fuzzing
+// thread.
+int RunAbandonableCallback(UserCallback CB, const uint8_t *Data, size_t Size,
+                           bool *Abandoned) {
+  *Abandoned = false;
+  return CB(Data, Size);
+}
+
+bool AbandonCallback() { return false; }
+
 void SleepSeconds(int Seconds) { Sleep(Seconds * 1000); }
 
 unsigned long GetPid() { return GetCurrentProcessId(); }
 
+bool IsProcessAlive(unsigned long Pid) {
+  HANDLE Process = OpenProcess(SYNCHRONIZE, FALSE, Pid);
+  if (!Process) return GetLastError() == ERROR_ACCESS_DENIED;
+  bool Alive = WaitForSingleObject(Process, 0) == WAIT_TIMEOUT;
+  CloseHandle(Process);
+  return Alive;
+}
+
 size_t GetPeakRSSMb() {
   PROCESS_MEMORY_COUNTERS info;
   if (!GetProcessMemoryInfo(GetCurrentProcess(), &info, sizeof(info)))
@@ -156,6 +179,81 @@ int ExecuteCommand(const std::string &Command) {
   return system(Command.c_str());
 }
 
+void SetThreadAffinity(unsigned Cpu) {
+  SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (Cpu % 64));
+}
+
+void SetThreadAffinity(const std::vector<unsigned> &Cpus) {
+  DWORD_PTR Mask = 0;
+  for (unsigned Cpu : Cpus)
+    Mask |= (DWORD_PTR)1 << (Cpu % 64);
+  if (Mask)
+    SetThreadAffinityMask(GetCurrentThread(), Mask);
+}
+
+std::vector<unsigned> GetThreadAffinity() { return {}; }
+
+std::vector<CpuInfo> GetCpuTopology() {
+  std::vector<CpuInfo> Res;
+  for (unsigned Cpu = 0; Cpu < NumberOfCpuCores(); Cpu++)
+    Res.push_back({Cpu, Cpu, 0});
+  return Res;
+}
+
+std::string ObjectFileId(const void *Addr) { return ""; }
+bool ObjectFileBase(const void *Addr, uintptr_t *Base) { return false; }
+
+// The alarm is delivered by a timer-queue thread on Windows.
+void BlockAlarmSignalForCurrentThread() {}
+
+size_t GetPageSize() {
+  SYSTEM_INFO Info;
+  GetSystemInfo(&Info);
+  return Info.dwPageSize;
+}
+
+uint8_t *MapWithGuardPage(size_t Size) {
+  size_t PageSize = GetPageSize();
+  Size = (Size + PageSize - 1) & ~(PageSize - 1);
+  uint8_t *Mem = static_cast<uint8_t *>(VirtualAlloc(
+      nullptr, Size + PageSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+  if (!Mem)
+    return nullptr;
+  DWORD OldProtect;
+  if (!VirtualProtect(Mem + Size, PageSize, PAGE_NOACCESS, &OldProtect)) {
+    VirtualFree(Mem, 0, MEM_RELEASE);
+    return nullptr;
+  }
+  return Mem;
+}
+
+void UnmapWithGuardPage(uint8_t *Ptr, size_t Size) {
+  VirtualFree(Ptr, 0, MEM_RELEASE);
+}
+
+bool ProtectPages(void *Ptr, size_t Size, bool ReadOnly) {
+  DWORD OldProtect;
+  return VirtualProtect(Ptr, Size, ReadOnly ? PAGE_READONLY : PAGE_READWRITE,
+                        &OldProtect);
+}
+
+// Writes to a read-only input are reported as any other access violation.
+void SetWriteFaultHandler(const void *Begin, size_t Size, void (*Callback)()) {
+}
+
+void *MapZeroedPages(size_t Size) {
+  return VirtualAlloc(nullptr, Size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void UnmapPages(void *Ptr, size_t Size) { VirtualFree(Ptr, 0, MEM_RELEASE); }
+
+// Large pages need SeLockMemoryPrivilege, which fuzzing processes rarely have.
+void *MapHugePages(size_t Size) { return MapZeroedPages(Size); }
+
+void UnmapHugePages(void *Ptr, size_t Size) { UnmapPages(Ptr, Size); }
+
+size_t HugePageBytes(const void *Ptr, size_t Size) { return 0; }
+
 const void *SearchMemory(const void *Data, size_t DataLen, const void *Patt,
                          size_t PattLen) {
   // TODO: make this implementation more efficient.
@@ -184,6 +282,13 @@ std::string DisassembleCmd(const std::string &FileName) {
   exit(1);
 }
 
+std::string DisassembleWithLinesCmd(const std::string &FileName) {
+  if (ExecuteCommand("objdump --version > nul") == 0)
+    return "objdump -d -l -C --no-show-raw-insn " + FileName;
+  Printf("libFuzzer: couldn't find tool to disassemble (objdump)\n");
+  exit(1);
+}
+
 std::string SearchRegexCmd(const std::string &Regex) {
   return "findstr /r \"" + Regex + "\"";
 }
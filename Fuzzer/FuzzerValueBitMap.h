@@ -13,40 +13,108 @@
 #define LLVM_FUZZER_VALUE_BIT_MAP_H
 
 #include "FuzzerDefs.h"
+#include "FuzzerUtil.h"
+
+#include <algorithm>
 
 namespace fuzzer {
 
-// A bit map containing kMapSizeInWords bits.
+// NumMaps() bit maps of MapSizeInBits() bits each, back to back in one
+// page-aligned allocation. Every value goes to the map chosen by the caller,
+// so that separate sources of values (e.g. differential callbacks) do not
+// collide with each other.
+// The storage is only allocated by Allocate(); until then values are dropped.
+// The words that became non-zero since the last Reset() are listed, so that
+// resetting a large, sparsely populated map stays cheap.
 struct ValueBitMap {
-  static const size_t kMapSizeInBits = 1 << 16;
-  static const size_t kMapPrimeMod = 65371;  // Largest Prime < kMapSizeInBits;
+  static const size_t kDefaultMapSizeLog = 16;
+  static const size_t kMinMapSizeLog = 9;
+  static const size_t kMaxMapSizeLog = 28;
   static const size_t kBitsInWord = (sizeof(uintptr_t) * 8);
-  static const size_t kMapSizeInWords = kMapSizeInBits / kBitsInWord;
  public:
 
+  // Replaces the maps with NumMaps empty maps of 1 << MapSizeLog bits.
+  bool Allocate(size_t MapSizeLog, size_t NumMaps) {
+    assert(MapSizeLog >= kMinMapSizeLog && MapSizeLog <= kMaxMapSizeLog);
+    assert(NumMaps > 0);
+    size_t NewSizeInWords = (NumMaps << MapSizeLog) / kBitsInWord;
+    auto *NewMap = static_cast<uintptr_t *>(
+        MapZeroedPages(NewSizeInWords * sizeof(uintptr_t)));
+    auto *NewTouched = static_cast<uint32_t *>(
+        MapZeroedPages(NewSizeInWords * sizeof(uint32_t)));
+    if (!NewMap || !NewTouched) {
+      if (NewMap) UnmapPages(NewMap, NewSizeInWords * sizeof(uintptr_t));
+      if (NewTouched) UnmapPages(NewTouched, NewSizeInWords * sizeof(uint32_t));
+      return false;
+    }
+    if (Map) {
+      UnmapPages(Map, SizeInWords * sizeof(uintptr_t));
+      UnmapPages(TouchedWords, SizeInWords * sizeof(uint32_t));
+    }
+    Map = NewMap;
+    TouchedWords = NewTouched;
+    NumTouchedWords = 0;
+    SizeInWords = NewSizeInWords;
+    this->MapSizeLog = MapSizeLog;
+    Mask = (1ULL << MapSizeLog) - 1;
+    PrimeMod = LargestPrimeBelow(MapSizeInBits());
+    NumBits = 0;
+    return true;
+  }
+
+  size_t MapSizeInBits() const { return Mask + 1; }
+  size_t NumMaps() const { return SizeInWords * kBitsInWord >> MapSizeLog; }
+  size_t SizeInBits() const { return SizeInWords * kBitsInWord; }
+
   // Clears all bits.
-  void Reset() { memset(Map, 0, sizeof(Map)); }
+  void Reset() {
+    if (!Map) return;
+    if (MergedInto || NumTouchedWords * kDenseResetFraction >= SizeInWords)
+      memset(Map, 0, SizeInWords * sizeof(uintptr_t));
+    else
+      for (size_t i = 0; i < NumTouchedWords; i++)
+        Map[TouchedWords[i]] = 0;
+    NumTouchedWords = 0;
+    MergedInto = false;
+  }
+
+  // Computes a hash function of Value and sets the corresponding bit of map
+  // MapIdx. Returns true if the bit was changed from 0 to 1.
+  ATTRIBUTE_NO_SANITIZE_ALL
+  inline bool AddValue(uintptr_t Value, size_t MapIdx = 0) {
+    if (!Map) return false;
+    return SetBit((MapIdx << MapSizeLog) | (Value & Mask));
+  }
+
+  // Reset() clears the whole map once 1/kDenseResetFraction of its words
+  // may be non-zero.
+  static const size_t kDenseResetFraction = 8;
+
+  ATTRIBUTE_NO_SANITIZE_ALL
+  inline bool AddValueModPrime(uintptr_t Value, size_t MapIdx = 0) {
+    if (!Map) return false;
+    return AddValue(Value % PrimeMod, MapIdx);
+  }
 
-  // Computes a hash function of Value and sets the corresponding bit.
-  // Returns true if the bit was changed from 0 to 1.
+  // Sets bit Idx of the concatenated maps, as numbered by ForEach().
   ATTRIBUTE_NO_SANITIZE_ALL
-  inline bool AddValue(uintptr_t Value) {
-    uintptr_t Idx = Value % kMapSizeInBits;
+  inline bool SetBit(uintptr_t Idx) {
+    assert(Idx < SizeInBits());
     uintptr_t WordIdx = Idx / kBitsInWord;
     uintptr_t BitIdx = Idx % kBitsInWord;
     uintptr_t Old = Map[WordIdx];
     uintptr_t New = Old | (1UL << BitIdx);
+    if (New == Old) return false;
     Map[WordIdx] = New;
-    return New != Old;
-  }
-
-  ATTRIBUTE_NO_SANITIZE_ALL
-  inline bool AddValueModPrime(uintptr_t Value) {
-    return AddValue(Value % kMapPrimeMod);
+    // Maps may be filled by several threads (-diff_parallel), one map each.
+    if (!Old)
+      TouchedWords[__atomic_fetch_add(&NumTouchedWords, 1, __ATOMIC_RELAXED)] =
+          WordIdx;
+    return true;
   }
 
   inline bool Get(uintptr_t Idx) {
-    assert(Idx < kMapSizeInBits);
+    assert(Idx < SizeInBits());
     uintptr_t WordIdx = Idx / kBitsInWord;
     uintptr_t BitIdx = Idx % kBitsInWord;
     return Map[WordIdx] & (1UL << BitIdx);
@@ -56,37 +124,83 @@ struct ValueBitMap {
 
   // Merges 'Other' into 'this', clears 'Other', updates NumBits,
   // returns true if new bits were added.
+  // The loop has no branches so that it is vectorized, popcount included
+  // on targets that have a vector popcount.
   ATTRIBUTE_TARGET_POPCNT
   bool MergeFrom(ValueBitMap &Other) {
+    assert(SizeInWords == Other.SizeInWords);
     uintptr_t Res = 0;
     size_t OldNumBits = NumBits;
-    for (size_t i = 0; i < kMapSizeInWords; i++) {
-      auto O = Other.Map[i];
-      auto M = Map[i];
-      if (O) {
-        Map[i] = (M |= O);
-        Other.Map[i] = 0;
-      }
-      if (M)
-        Res += __builtin_popcountll(M);
+    uintptr_t *__restrict M = Map;
+    uintptr_t *__restrict O = Other.Map;
+    for (size_t i = 0; i < SizeInWords; i++) {
+      uintptr_t V = M[i] | O[i];
+      M[i] = V;
+      O[i] = 0;
+      Res += __builtin_popcountll(V);
     }
     NumBits = Res;
+    Other.NumTouchedWords = 0;
+    MergedInto = true;  // The merged words are not in TouchedWords.
     return OldNumBits < NumBits;
   }
 
   template <class Callback>
   ATTRIBUTE_NO_SANITIZE_ALL
   void ForEach(Callback CB) const {
-    for (size_t i = 0; i < kMapSizeInWords; i++)
+    ForEachInWords(0, SizeInWords, CB);
+  }
+
+  // Like ForEach(), for the bits of map MapIdx only.
+  template <class Callback>
+  ATTRIBUTE_NO_SANITIZE_ALL
+  void ForEachInMap(size_t MapIdx, Callback CB) const {
+    size_t WordsPerMap = MapSizeInBits() / kBitsInWord;
+    ForEachInWords(MapIdx * WordsPerMap, (MapIdx + 1) * WordsPerMap, CB);
+  }
+
+ private:
+  template <class Callback>
+  ATTRIBUTE_NO_SANITIZE_ALL
+  void ForEachInWords(size_t Begin, size_t End, Callback CB) const {
+    auto VisitWord = [&](size_t i) {
       if (uintptr_t M = Map[i])
         for (size_t j = 0; j < sizeof(M) * 8; j++)
           if (M & ((uintptr_t)1 << j))
             CB(i * sizeof(M) * 8 + j);
+    };
+    if (MergedInto || NumTouchedWords * kDenseResetFraction >= SizeInWords) {
+      for (size_t i = Begin; i < End; i++)
+        VisitWord(i);
+      return;
+    }
+    // Visit the touched words only, in the same order as the full scan.
+    std::sort(TouchedWords, TouchedWords + NumTouchedWords);
+    for (size_t i = 0; i < NumTouchedWords; i++)
+      if (TouchedWords[i] >= Begin && TouchedWords[i] < End)
+        VisitWord(TouchedWords[i]);
   }
 
- private:
+  static size_t LargestPrimeBelow(size_t N) {
+    // The prime used before the size became configurable.
+    if (N == (1 << kDefaultMapSizeLog)) return 65371;
+    for (size_t P = N - 1;; P--) {
+      bool IsPrime = true;
+      for (size_t D = 2; D * D <= P && IsPrime; D++)
+        IsPrime = P % D;
+      if (IsPrime) return P;
+    }
+  }
+
+  uintptr_t *Map = nullptr;
+  uint32_t *TouchedWords = nullptr;
+  size_t NumTouchedWords = 0;
+  bool MergedInto = false;
+  size_t SizeInWords = 0;
+  size_t MapSizeLog = 0;
+  uintptr_t Mask = 0;
+  size_t PrimeMod = 1;
   size_t NumBits = 0;
-  uintptr_t Map[kMapSizeInWords] __attribute__((aligned(512)));
 };
 
 }  // namespace fuzzer
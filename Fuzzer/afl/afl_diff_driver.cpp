@@ -0,0 +1,255 @@
+//===- afl_diff_driver.cpp - differential glue between AFL and libFuzzer --===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//===----------------------------------------------------------------------===//
+
+/* The differential counterpart of afl_driver.cpp: it fuzzes targets that
+ export their libraries as LLVMFuzzerCustomCallbacks with AFL's persistent
+ mode, running every callback on every input without a fork per input.
+
+Usage:
+################################################################################
+# Build the target (e.g. handshake/afl_target.cpp with
+# -DCONFIG_AFL_PERSISTENT) and its libraries with afl-clang-fast, then link
+# it with this file.
+afl-clang-fast++ -DCONFIG_AFL_PERSISTENT -c afl_target.cpp
+afl-clang-fast++ afl_diff_driver.cpp afl_target.o -ldl -o afl_diff
+rm -rf IN OUT; mkdir OUT; cp -r seeds IN
+$AFL_HOME/afl-fuzz -i IN -o OUT ./afl_diff
+################################################################################
+Environment Variables:
+AFL_DRIVER_STDERR_DUPLICATE_FILENAME: as in afl_driver.cpp.
+
+AFL_DIFF_SHM_ID: the id of a System V shared memory segment (see shmget(2))
+that the driver publishes the outcome of every input to, for a differential
+afl-fuzz to read once the input is done. The segment holds a DiffSideChannel
+(below) whose Values are the return code of every callback followed by its
+bitcount: the number of AFL map entries that the callback touched first
+during the input. The LLVMFuzzerBitcounts() of diff_afl.h is not used: it is
+filled from libFuzzer's counters, which an AFL build does not have.
+Seq goes up by one after every input.
+*/
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/shm.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// libFuzzer interface is thin, so we don't include any libFuzzer headers.
+typedef int (*UserCallback)(const uint8_t *Data, size_t Size);
+struct UserCallbacks {
+  UserCallback *callbacks;
+  int size;
+};
+
+extern "C" {
+UserCallbacks *LLVMFuzzerCustomCallbacks();
+__attribute__((weak)) int LLVMFuzzerInitialize(int *argc, char ***argv);
+// The edge map of AFL's instrumentation, see afl-llvm-rt.o.c.
+__attribute__((weak)) extern uint8_t *__afl_area_ptr;
+}
+
+// Notify AFL about persistent mode.
+static volatile char AFL_PERSISTENT[] = "##SIG_AFL_PERSISTENT##";
+extern "C" int __afl_persistent_loop(unsigned int);
+static volatile char suppress_warning2 = AFL_PERSISTENT[0];
+
+// Notify AFL about deferred forkserver.
+static volatile char AFL_DEFER_FORKSVR[] = "##SIG_AFL_DEFER_FORKSRV##";
+extern "C" void  __afl_manual_init();
+static volatile char suppress_warning1 = AFL_DEFER_FORKSVR[0];
+
+// Input buffer.
+static const size_t kMaxAflInputSize = 1 << 20;
+static uint8_t AflInputBuf[kMaxAflInputSize];
+
+// MAP_SIZE of AFL's config.h.
+static const size_t kAflMapSize = 1 << 16;
+
+static const uint32_t kDiffSideChannelMagic = 0x44494646;  // "DIFF"
+
+// Layout of the AFL_DIFF_SHM_ID segment.
+struct DiffSideChannel {
+  uint32_t Magic;    // kDiffSideChannelMagic once the driver is up.
+  uint32_t NumLibs;
+  uint32_t Seq;
+  uint32_t Reserved;
+  int32_t Values[1];  // NumLibs return codes, then NumLibs bitcounts.
+};
+
+static DiffSideChannel *side_channel = NULL;
+
+// Attaches the AFL_DIFF_SHM_ID segment, if there is one, and checks that it
+// has room for NumLibs callbacks.
+static void maybe_attach_side_channel(int NumLibs) {
+  char *shm_id = getenv("AFL_DIFF_SHM_ID");
+  if (!shm_id)
+    return;
+  int id = atoi(shm_id);
+  struct shmid_ds ds;
+  size_t needed = offsetof(DiffSideChannel, Values) +
+                  2 * NumLibs * sizeof(int32_t);
+  if (shmctl(id, IPC_STAT, &ds) || ds.shm_segsz < needed) {
+    fprintf(stderr, "AFL_DIFF_SHM_ID=%s is not a segment of %zd bytes\n",
+            shm_id, needed);
+    abort();
+  }
+  void *p = shmat(id, NULL, 0);
+  if (p == (void *)-1) {
+    perror("shmat");
+    abort();
+  }
+  side_channel = static_cast<DiffSideChannel *>(p);
+  side_channel->NumLibs = NumLibs;
+  side_channel->Seq = 0;
+  __atomic_store_n(&side_channel->Magic, kDiffSideChannelMagic,
+                   __ATOMIC_RELEASE);
+}
+
+// If the user asks us to duplicate stderr, then do it.
+static void maybe_duplicate_stderr() {
+  char* stderr_duplicate_filename =
+      getenv("AFL_DRIVER_STDERR_DUPLICATE_FILENAME");
+
+  if (!stderr_duplicate_filename)
+    return;
+
+  FILE* stderr_duplicate_stream =
+      freopen(stderr_duplicate_filename, "a+", stderr);
+
+  if (!stderr_duplicate_stream) {
+    fprintf(
+        stderr,
+        "Failed to duplicate stderr to AFL_DRIVER_STDERR_DUPLICATE_FILENAME");
+    abort();
+  }
+}
+
+// Define LLVMFuzzerMutate to avoid link failures for targets that use it
+// with libFuzzer's LLVMFuzzerCustomMutator.
+extern "C" size_t LLVMFuzzerMutate(uint8_t *Data, size_t Size, size_t MaxSize) {
+  assert(false && "LLVMFuzzerMutate should not be called from afl_diff_driver");
+  return 0;
+}
+
+static size_t count_map_entries() {
+  if (!&__afl_area_ptr || !__afl_area_ptr)
+    return 0;
+  size_t n = 0;
+  for (size_t i = 0; i < kAflMapSize; i++)
+    n += __afl_area_ptr[i] != 0;
+  return n;
+}
+
+// Runs every callback on its own copy of Data, so that asan finds overflows
+// and callbacks can't see each other's writes, and stores the return codes
+// and bitcounts in RetVals and Bitcounts.
+static void run_callbacks(const UserCallbacks *UC, const uint8_t *Data,
+                          size_t Size, std::vector<int> *RetVals,
+                          std::vector<int> *Bitcounts) {
+  bool count_map = side_channel != NULL;
+  size_t entries = count_map ? count_map_entries() : 0;
+  for (int i = 0; i < UC->size; i++) {
+    uint8_t *copy = new uint8_t[Size];
+    memcpy(copy, Data, Size);
+    (*RetVals)[i] = UC->callbacks[i](copy, Size);
+    delete[] copy;
+    if (count_map) {
+      size_t now = count_map_entries();
+      (*Bitcounts)[i] = static_cast<int>(now - entries);
+      entries = now;
+    }
+  }
+}
+
+static void publish(const std::vector<int> &RetVals,
+                    const std::vector<int> &Bitcounts) {
+  if (!side_channel)
+    return;
+  size_t n = RetVals.size();
+  for (size_t i = 0; i < n; i++) {
+    side_channel->Values[i] = RetVals[i];
+    side_channel->Values[n + i] = Bitcounts[i];
+  }
+  __atomic_store_n(&side_channel->Seq, side_channel->Seq + 1,
+                   __ATOMIC_RELEASE);
+}
+
+// Execute any files provided as parameters and print the return code of
+// every callback.
+int ExecuteFilesOnyByOne(const UserCallbacks *UC, int argc, char **argv) {
+  std::vector<int> RetVals(UC->size), Bitcounts(UC->size);
+  for (int i = 1; i < argc; i++) {
+    std::ifstream in(argv[i]);
+    in.seekg(0, in.end);
+    size_t length = in.tellg();
+    in.seekg (0, in.beg);
+    std::cout << "Reading " << length << " bytes from " << argv[i] << std::endl;
+    std::vector<char> bytes(length);
+    in.read(bytes.data(), bytes.size());
+    assert(in);
+    run_callbacks(UC, reinterpret_cast<const uint8_t *>(bytes.data()),
+                  bytes.size(), &RetVals, &Bitcounts);
+    publish(RetVals, Bitcounts);
+    std::cout << "Return codes:";
+    for (int r : RetVals)
+      std::cout << " " << r;
+    std::cout << std::endl;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  fprintf(stderr,
+      "======================= INFO =========================\n"
+      "This binary is built for differential AFL-fuzz.\n"
+      "To run the callbacks on individual input(s) execute this:\n"
+      "  %s INPUT_FILE1 [INPUT_FILE2 ... ]\n"
+      "To fuzz with afl-fuzz execute this:\n"
+      "  afl-fuzz [afl-flags] %s [-N]\n"
+      "afl-fuzz will run N iterations before "
+      "re-spawning the process (default: 1000)\n"
+      "======================================================\n",
+          argv[0], argv[0]);
+  if (LLVMFuzzerInitialize)
+    LLVMFuzzerInitialize(&argc, &argv);
+  UserCallbacks *UC = LLVMFuzzerCustomCallbacks();
+  if (!UC || UC->size <= 0) {
+    fprintf(stderr, "LLVMFuzzerCustomCallbacks() returned no callbacks\n");
+    return 1;
+  }
+
+  maybe_duplicate_stderr();
+  maybe_attach_side_channel(UC->size);
+
+  __afl_manual_init();
+
+  int N = 1000;
+  if (argc == 2 && argv[1][0] == '-')
+      N = atoi(argv[1] + 1);
+  else if (argc > 1)
+    return ExecuteFilesOnyByOne(UC, argc, argv);
+
+  assert(N > 0);
+  std::vector<int> RetVals(UC->size), Bitcounts(UC->size);
+  int num_runs = 0;
+  while (__afl_persistent_loop(N)) {
+    ssize_t n_read = read(0, AflInputBuf, kMaxAflInputSize);
+    if (n_read > 0) {
+      num_runs++;
+      run_callbacks(UC, AflInputBuf, n_read, &RetVals, &Bitcounts);
+      publish(RetVals, Bitcounts);
+    }
+  }
+  fprintf(stderr, "%s: successfully executed %d input(s)\n", argv[0], num_runs);
+}
@@ -1,19 +1,60 @@
 #!/bin/bash
+# Builds libFuzzer.a in the current directory.
+#
+#   build.sh          optimised build (-O2, or -O$OPT_LEVEL)
+#   build.sh debug    unoptimised build for debugging libFuzzer itself
+#
+# Only for the optimised build:
+#   LTO=1             compile to bitcode for link-time optimisation; the
+#                     target has to be linked with -flto as well
+#   PGO_GEN=DIR       instrument for profiling; link the target with
+#                     -fprofile-generate and its runs write profiles to DIR
+#   PGO_USE=PROFILE   optimise with a merged profile (the .profdata file for
+#                     clang, the profile directory for gcc)
 LIBFUZZER_SRC_DIR=$(dirname $0)
 CXX="${CXX:-clang}"
-ROOT_DIR="/home/pany/tls-diff-testing/tls-diff-testing"
+MODE="${1:-release}"
 
+case $MODE in
+  release)
+    FLAGS="-g -O${OPT_LEVEL:-2} -fno-omit-frame-pointer"
+    if [ "$LTO" == "1" ]; then
+      FLAGS="$FLAGS -flto"
+      if [[ $CXX == *clang* ]]; then
+        AR="${AR:-llvm-ar}"
+      else
+        AR="${AR:-gcc-ar}"
+      fi
+    fi
+    if [ -n "$PGO_GEN" ] && [ -n "$PGO_USE" ]; then
+      echo "PGO_GEN and PGO_USE can't be used together" && exit 1
+    fi
+    [ -n "$PGO_GEN" ] && FLAGS="$FLAGS -fprofile-generate=$PGO_GEN"
+    [ -n "$PGO_USE" ] && FLAGS="$FLAGS -fprofile-use=$PGO_USE"
+    ;;
+  debug)
+    FLAGS="-g -O0 -fno-omit-frame-pointer"
+    ;;
+  *)
+    echo "usage: $0 [release|debug]" && exit 1
+    ;;
+esac
+AR="${AR:-ar}"
+
+echo "$CXX $FLAGS -std=c++11 $EXTRA_CXXFLAGS"
+PIDS=""
 for f in $LIBFUZZER_SRC_DIR/*.cpp; do
-  if [ $f == "./FuzzerLoop.cpp" ]
-  then
-    echo "$CXX -I$ROOT_DIR/bitman/inc -I$ROOT_DIR/cryptoman/inc -I$ROOT_DIR/middleman/inc -I$ROOT_DIR/../ -g -O2 -fno-omit-frame-pointer -std=c++11 $f -c &"
-    $CXX -I$ROOT_DIR/bitman/inc -I$ROOT_DIR/cryptoman/inc -I$ROOT_DIR/middleman/inc -I$ROOT_DIR/../ -g -O0 -fno-omit-frame-pointer -std=c++11 $f -c &
-  else
-    $CXX -g -O0 -fno-omit-frame-pointer -std=c++11 $f -c &
-  fi
+  $CXX $FLAGS -std=c++11 $EXTRA_CXXFLAGS $f -c &
+  PIDS="$PIDS $!"
+done
+FAILED=0
+for p in $PIDS; do
+  wait $p || FAILED=1
 done
-wait
+if [ $FAILED == 1 ]; then
+  rm -f Fuzzer*.o
+  exit 1
+fi
 rm -f libFuzzer.a
-ar ru libFuzzer.a Fuzzer*.o
+$AR ru libFuzzer.a Fuzzer*.o
 rm -f Fuzzer*.o
-
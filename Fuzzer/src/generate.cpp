@@ -41,7 +41,6 @@ using namespace std;
 /*
  * ___________________________________________________________________________
  */
-/*
 int main(int argc , char *argv[]) {
 
     // Maximum number of operator applications
@@ -50,6 +49,12 @@ int main(int argc , char *argv[]) {
     // Operator filter 
     vector<bool> opEnable;
 
+    // Number of worker processes, 0 for the serial generator
+    size_t nWorkers = 0;
+
+    // Seed of the first input's decisions with -j
+    unsigned int seed = 0;
+
     int iArg = 1;
 
     while (iArg < argc) {
@@ -63,14 +68,30 @@ int main(int argc , char *argv[]) {
                 opEnable.push_back(arg[ic] == '1');
             }
             iArg++;
+        } else if (arg.find("-j") == 0) {
+            nWorkers = atoi(arg.substr(2).c_str());
+            if (nWorkers == 0) {
+                nWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+            }
+            iArg++;
+        } else if (arg.find("-s") == 0) {
+            seed = strtoul(arg.substr(2).c_str(), NULL, 0);
+            iArg++;
         } else {
             break;
         }
     }
 
+    if (nWorkers > 0 && (argc - iArg) == 2) {
+        string packedCorpus(argv[iArg++]);
+        size_t N = atoi(argv[iArg++]);
+        return generate_corpus(packedCorpus, N, nMaxOp, opEnable, nWorkers, seed);
+    }
+
     if ((argc - iArg) != 3) {
         cout << "ERROR: Wrong number of arguments" << endl;
         cout << "./generate [OPTIONS] <RANDOM-INPUT-FILE> <OUTPUT-FILE> <N>" << endl;
+        cout << "./generate -j<WORKERS> [-s<SEED>] [OPTIONS] <PACKED-CORPUS> <N>" << endl;
         return 1;
     }
 
@@ -82,7 +103,6 @@ int main(int argc , char *argv[]) {
 
     return test_servers(randomInputFile, outputFile, N, nMaxOp, opEnable);
 }
-*/
 
 /*
  * ___________________________________________________________________________
@@ -355,23 +375,35 @@ size_t applyOperators(DecisionReader& decisionReader, DataUnit& operand, string&
 
 
 
+/*
+ * Number of random bytes the operators may consume per input of
+ * generate_corpus(), as in the tls-diff mutator of handshake/diff.cpp.
+ */
+static const size_t kDecisionStreamSize = 10 * 1024;
+
+/*
+ * The ClientHello every generated input is a mutation of.
+ */
+static const char* const kClientHelloTemplate =
+		"160301012c01000128030340c70e243001b96d8c63687738696432d3e6f949"
+		"107aabad8450cdffd6a266e4000092c030c02cc028c024c014c00a00a3009f"
+		"006b006a0039003800880087c032c02ec02ac026c00fc005009d003d003500"
+		"84c02fc02bc027c023c013c00900a2009e0067004000330032009a00990045"
+		"0044c031c02dc029c025c00ec004009c003c002f00960041c011c007c00cc0"
+		"0200050004c012c00800160013c00dc003000a001500120009001400110008"
+		"0006000300ff0100006d000b000403000102000a00340032000e000d001900"
+		"0b000c00180009000a00160017000800060007001400150004000500120013"
+		"000100020003000f0010001100230000000d0020001e060106020603050105"
+		"020503040104020403030103020303020102020203000f000101";
+
+
 int test_servers(string inputRandomFile, string outputFile, size_t N, size_t nMaxOp, const vector<bool>& opEnable) {
 
     cout << "Generating " << N << " inputs." << endl;
 
 	/* load the ClientHello template */
 	VectorBuffer outBuf;
-	outBuf.appendFromString(
-			"160301012c01000128030340c70e243001b96d8c63687738696432d3e6f949"
-			"107aabad8450cdffd6a266e4000092c030c02cc028c024c014c00a00a3009f"
-			"006b006a0039003800880087c032c02ec02ac026c00fc005009d003d003500"
-			"84c02fc02bc027c023c013c00900a2009e0067004000330032009a00990045"
-			"0044c031c02dc029c025c00ec004009c003c002f00960041c011c007c00cc0"
-			"0200050004c012c00800160013c00dc003000a001500120009001400110008"
-			"0006000300ff0100006d000b000403000102000a00340032000e000d001900"
-			"0b000c00180009000a00160017000800060007001400150004000500120013"
-			"000100020003000f0010001100230000000d0020001e060106020603050105"
-			"020503040104020403030103020303020102020203000f000101");
+	outBuf.appendFromString(kClientHelloTemplate);
 
 	/* dissect and print original ClientHello */
 	TVector_MainType printRec;
@@ -463,28 +495,234 @@ int test_servers(string inputRandomFile, string outputFile, size_t N, size_t nMa
 	return 0;
 }
 
+/*
+ * Digests of the inputs generated by all workers of generate_corpus(), in
+ * memory shared by the forked workers. The table is lock-free so that a
+ * worker killed at any point cannot wedge the rest.
+ */
+static const size_t kNumSharedDigests = 1 << 24;
+
+/*
+ * The workers give up after this many attempts per input asked for, in case
+ * the operators cannot produce that many distinct inputs.
+ */
+static const size_t kMaxAttemptsPerInput = 100;
+
+struct SharedGeneratorState {
+	std::atomic<uint64_t> nAttempts;
+	std::atomic<uint64_t> nGenerated;
+	std::atomic<uint64_t> nDuplicates;
+	std::atomic<uint64_t> digests[kNumSharedDigests];
+};
+
+/*
+ * Returns true if no worker has inserted digest before. If the probes run
+ * out, the input is taken as new.
+ */
+static bool insertSharedDigest(SharedGeneratorState* state, uint64_t digest) {
+
+	if (digest == 0) {
+		/* zero marks an empty slot */
+		digest = 1;
+	}
+	const size_t kMaxProbes = 64;
+	for (size_t i = 0; i < kMaxProbes; i++) {
+		std::atomic<uint64_t>& slot =
+				state->digests[(digest + i) % kNumSharedDigests];
+		uint64_t old = slot.load(std::memory_order_relaxed);
+		if (old == digest) {
+			return false;
+		}
+		if (old != 0) {
+			continue;
+		}
+		if (slot.compare_exchange_strong(old, digest)) {
+			return true;
+		}
+		if (old == digest) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * One worker of generate_corpus(): mutates the template for input IDs
+ * iWorker, iWorker + nWorkers, ... with decisions drawn from a PRNG seeded
+ * with seed + ID, until the workers together have generated N inputs or
+ * made kMaxAttemptsPerInput * N attempts.
+ */
+static int generate_worker(SharedGeneratorState* state, const string& packedCorpus,
+		size_t N, size_t nMaxOp, const vector<bool>& opEnable,
+		size_t iWorker, size_t nWorkers, unsigned int seed) {
+
+	/* every worker opens the corpus itself: the lock that serializes
+	 * appends would be shared by file descriptors inherited over fork() */
+	fuzzer::PackedCorpus corpus;
+	if (packedCorpus != "-" && !corpus.Open(packedCorpus)) {
+		return 1;
+	}
+
+	VectorBuffer templBuf;
+	templBuf.appendFromString(kClientHelloTemplate);
+	TVector_MainType templRec;
+	templRec.dissector().dissectFromBuffer(templBuf);
+
+	const uint64_t maxAttempts = (uint64_t)N * kMaxAttemptsPerInput;
+	for (size_t n = iWorker; state->nGenerated.load() < N; n += nWorkers) {
+
+		if (state->nAttempts.fetch_add(1) >= maxAttempts) {
+			break;
+		}
+
+		/* operators work on a copy, the template stays untouched */
+		std::unique_ptr<DataUnit> outRec(templRec.clone());
+
+		if (n > 0) {
+			std::mt19937 prng(seed + n);
+			uint8_t bytes[kDecisionStreamSize];
+			for (size_t i = 0; i < kDecisionStreamSize; i += 4) {
+				uint32_t word = prng();
+				memcpy(bytes + i, &word, 4);
+			}
+			VectorBuffer ctrlBuf;
+			ctrlBuf.appendBytes(bytes, kDecisionStreamSize);
+			BufferStreamReader ctrlStream(ctrlBuf);
+			DecisionReader selector(ctrlStream);
+
+			String summary;
+			if (applyOperators(selector, *outRec, summary, nMaxOp, opEnable) == 0) {
+				continue;
+			}
+		}
+
+		VectorBuffer outBuf;
+		outRec->copyTo(outBuf);
+
+		/* calculate message hash to skip cases that have already been used */
+		VectorBuffer hash;
+		SHA256 sha256;
+		sha256.digest(outBuf, hash);
+		uint64_t digest;
+		memcpy(&digest, hash.getDataPointer(), sizeof(digest));
+		if (!insertSharedDigest(state, digest)) {
+			state->nDuplicates++;
+			continue;
+		}
+		if (state->nGenerated.fetch_add(1) >= N) {
+			break;
+		}
+
+		if (corpus.IsOpen() && !corpus.Append(outBuf.getDataPointer(),
+				outBuf.getLength().byteCeil())) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Generates N distinct inputs with nWorkers forked worker processes into
+ * the packed corpus at packedCorpus (packedCorpus.idx and packedCorpus.blob,
+ * see FuzzerPackedCorpus.h), which a campaign can start from with
+ * -packed_corpus. Inputs already in the corpus are not counted. With
+ * packedCorpus "-" nothing is written, which measures the mutator alone.
+ */
+int generate_corpus(string packedCorpus, size_t N, size_t nMaxOp,
+		const vector<bool>& opEnable, size_t nWorkers, unsigned int seed) {
+
+    cout << "Generating " << N << " inputs with " << nWorkers << " workers." << endl;
+
+	void* shared = mmap(NULL, sizeof(SharedGeneratorState), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		cout << "ERROR: cannot map the digest table" << endl;
+		return 1;
+	}
+	/* a fresh mapping is zero-filled, which is an empty table */
+	SharedGeneratorState* state = (SharedGeneratorState*)shared;
+
+	fuzzer::PackedCorpus corpus;
+	if (packedCorpus != "-") {
+		if (!corpus.Open(packedCorpus)) {
+			return 1;
+		}
+		/* inputs that are in the corpus already are duplicates */
+		for (size_t i = 0; i < corpus.size(); i++) {
+			VectorBuffer inBuf;
+			inBuf.appendBytes(corpus.UnitData(i), corpus.UnitSize(i));
+			VectorBuffer hash;
+			SHA256 sha256;
+			sha256.digest(inBuf, hash);
+			uint64_t digest;
+			memcpy(&digest, hash.getDataPointer(), sizeof(digest));
+			insertSharedDigest(state, digest);
+		}
+	}
+	size_t nBefore = corpus.IsOpen() ? corpus.size() : 0;
+	corpus.Close();
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	vector<pid_t> pids;
+	for (size_t iWorker = 0; iWorker < nWorkers; iWorker++) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			_exit(generate_worker(state, packedCorpus, N, nMaxOp, opEnable,
+					iWorker, nWorkers, seed));
+		}
+		if (pid < 0) {
+			cout << "ERROR: cannot fork worker " << iWorker << endl;
+			break;
+		}
+		pids.push_back(pid);
+	}
+
+	int result = pids.empty() ? 1 : 0;
+	for (size_t i = 0; i < pids.size(); i++) {
+		int status;
+		if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) ||
+				WEXITSTATUS(status) != 0) {
+			cout << "ERROR: worker " << i << " failed" << endl;
+			result = 1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (end.tv_sec - start.tv_sec) +
+			(end.tv_nsec - start.tv_nsec) / 1e9;
+	size_t nGenerated = std::min<size_t>(state->nGenerated.load(), N);
+
+    cout << "Generated " << nGenerated << " inputs in " << seconds << " s ("
+         << (seconds > 0 ? nGenerated / seconds : 0) << " inputs/s)" << endl;
+
+    cout << "Number of rejected duplicates: " << state->nDuplicates.load() << endl;
+
+	if (result == 0 && nGenerated < N) {
+		cout << "WARNING: gave up after "
+		     << (uint64_t)N * kMaxAttemptsPerInput
+		     << " attempts, the operators found only " << nGenerated
+		     << " distinct inputs" << endl;
+	}
+
+	if (packedCorpus != "-" && corpus.Open(packedCorpus)) {
+		cout << "Packed corpus size: " << nBefore << " -> " << corpus.size() << endl;
+	}
+
+	munmap(shared, sizeof(SharedGeneratorState));
+	return result;
+}
+
 int mutate(string inputRandomFile,uint8_t* CurrentUnitData,size_t size) {
 	vector<bool> opEnable;
  
 	for (size_t ic = 0; ic < 8; ic++) {
 		opEnable.push_back(true);
 	}	
-	String tmp;
-        for(size_t i = 0;i < size; i++)
-	{
-		char buf[3];
-		sprintf(buf,"%x",CurrentUnitData[i]);
-		tmp.append(buf);
-	}
-
-	/* load the ClientHello template */
+	/* load the ClientHello */
 	VectorBuffer outBuf;
-	outBuf.appendFromString(tmp);
-
-	/* dissect and print original ClientHello */
-	TVector_MainType printRec;
-	printRec.dissector().dissectFromBuffer(outBuf);
-	printRec.print();
+	outBuf.appendBytes(CurrentUnitData, size);
 
 	/* fuzzing infrastructure */
 	FileStreamReader ctrlStream(inputRandomFile);
@@ -496,8 +734,10 @@ int mutate(string inputRandomFile,uint8_t* CurrentUnitData,size_t size) {
         size_t nDuplicates = 0;
 
 
+	/* dissect and print original ClientHello */
 	TVector_MainType outRec;
 	outRec.dissector().dissectFromBuffer(outBuf);
+	outRec.print();
 
         size_t nOp = 0;
 	String summary;
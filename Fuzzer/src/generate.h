@@ -19,6 +19,12 @@
 #include <cmath>
 #include "errno.h"
 #include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 #include "DataUnit.h"
 #include "EnumerationField.h"
@@ -39,9 +45,16 @@
 #include "../../tls-definitions.h"
 #include "SHA256.h"
 #include "TCPBatchClientSocket.h"
+#include "../FuzzerPackedCorpus.h"
 /* TODO: Add description */
 int test_servers(string inputRandomFile, string outputFile, size_t N, size_t nMaxOp, const vector<bool>& opEnable);
 
+/*
+ * Generates N distinct mutations of the ClientHello template on nWorkers
+ * cores into a packed corpus for -packed_corpus ("-" for none).
+ */
+int generate_corpus(string packedCorpus, size_t N, size_t nMaxOp, const vector<bool>& opEnable, size_t nWorkers, unsigned int seed);
+
 int mutate(string inputRandomFile,uint8_t* CurrentUnitData,size_t size);
 
 /* TODO: Add description */
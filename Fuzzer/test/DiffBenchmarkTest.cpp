@@ -0,0 +1,33 @@
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+
+// Eight differential callbacks for -diff_benchmark, in the style of
+// differential_fuzzing_tutorial/diff_fuzz_me.cc: callback I accepts the
+// inputs that start with the first I + 1 bytes of "FUZZING!".
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+typedef int (*UserCallback)(const uint8_t *Data, size_t Size);
+struct UserCallbacks {
+  UserCallback *callbacks;
+  int size;
+};
+
+static const char kMagic[] = "FUZZING!";
+
+template <size_t I>
+static int Accepts(const uint8_t *Data, size_t Size) {
+  return Size > I && !memcmp(Data, kMagic, I + 1);
+}
+
+static UserCallback Callbacks[] = {Accepts<0>, Accepts<1>, Accepts<2>,
+                                   Accepts<3>, Accepts<4>, Accepts<5>,
+                                   Accepts<6>, Accepts<7>};
+static UserCallbacks Container = {Callbacks, 8};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  return Accepts<0>(Data, Size);
+}
+
+extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() { return &Container; }
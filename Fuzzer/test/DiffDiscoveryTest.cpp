@@ -0,0 +1,53 @@
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+
+// Four implementations of a TLS-like record parser for
+// -diff_discovery_benchmark, each with an asymmetry planted at a different
+// depth: a record is a type byte (0x16 or 0x17), a version byte (at most 3),
+// a length byte and that many payload bytes.
+#include <cstddef>
+#include <cstdint>
+
+typedef int (*UserCallback)(const uint8_t *Data, size_t Size);
+struct UserCallbacks {
+  UserCallback *callbacks;
+  int size;
+};
+
+static int Parse(const uint8_t *Data, size_t Size, int MaxVersion,
+                 bool LenientAppData, size_t MaxHandshakeLen) {
+  if (Size < 3) return 0;
+  uint8_t Type = Data[0], Version = Data[1], Len = Data[2];
+  if (Type != 0x16 && Type != 0x17) return 0;
+  if (Version > MaxVersion) return 0;
+  if (Type == 0x16 && Len > MaxHandshakeLen) return 0;
+  if (Type == 0x17 && LenientAppData) return 1;
+  return Len == Size - 3;
+}
+
+// The reference.
+static int Strict(const uint8_t *Data, size_t Size) {
+  return Parse(Data, Size, 3, false, 255);
+}
+// Accepts one version too many.
+static int NewerVersion(const uint8_t *Data, size_t Size) {
+  return Parse(Data, Size, 4, false, 255);
+}
+// Does not check the length of application data.
+static int LenientAppData(const uint8_t *Data, size_t Size) {
+  return Parse(Data, Size, 3, true, 255);
+}
+// Has a buffer of 16 bytes for handshake messages.
+static int SmallBuffer(const uint8_t *Data, size_t Size) {
+  return Parse(Data, Size, 3, false, 16);
+}
+
+static UserCallback Callbacks[] = {Strict, NewerVersion, LenientAppData,
+                                   SmallBuffer};
+static UserCallbacks Container = {Callbacks, 4};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  return Strict(Data, Size);
+}
+
+extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() { return &Container; }
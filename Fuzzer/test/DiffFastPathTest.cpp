@@ -0,0 +1,36 @@
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+
+// Two differential callbacks for -diff_fast_path, and the same two again as
+// the "uninstrumented" builds that LLVMFuzzerCustomFastCallbacks returns.
+// They disagree on the inputs that start with "FAST".
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+typedef int (*UserCallback)(const uint8_t *Data, size_t Size);
+struct UserCallbacks {
+  UserCallback *callbacks;
+  int size;
+};
+
+static int Accepts(const uint8_t *Data, size_t Size) { return 0; }
+
+static int RejectsFast(const uint8_t *Data, size_t Size) {
+  return Size >= 4 && !memcmp(Data, "FAST", 4) ? 21 : 0;
+}
+
+static UserCallback Callbacks[] = {Accepts, RejectsFast};
+static UserCallbacks Container = {Callbacks, 2};
+static UserCallback FastCallbacks[] = {Accepts, RejectsFast};
+static UserCallbacks FastContainer = {FastCallbacks, 2};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  return Accepts(Data, Size);
+}
+
+extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() { return &Container; }
+
+extern "C" UserCallbacks *LLVMFuzzerCustomFastCallbacks() {
+  return &FastContainer;
+}
@@ -0,0 +1,33 @@
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+
+// Two differential callbacks for -diff_confirm. The second one rejects the
+// inputs that start with 'R', and every third input that starts with 'F',
+// the way a library with state left over from earlier calls disagrees now
+// and then; the first one accepts everything.
+#include <cstddef>
+#include <cstdint>
+
+typedef int (*UserCallback)(const uint8_t *Data, size_t Size);
+struct UserCallbacks {
+  UserCallback *callbacks;
+  int size;
+};
+
+static int Accepts(const uint8_t *Data, size_t Size) { return 0; }
+
+static int RejectsSome(const uint8_t *Data, size_t Size) {
+  static unsigned NumFlakyCalls;
+  if (Size && Data[0] == 'R') return 5;
+  if (Size && Data[0] == 'F' && NumFlakyCalls++ % 3 == 0) return 7;
+  return 0;
+}
+
+static UserCallback Callbacks[] = {Accepts, RejectsSome};
+static UserCallbacks Container = {Callbacks, 2};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  return Accepts(Data, Size);
+}
+
+extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() { return &Container; }
@@ -0,0 +1,39 @@
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+
+// Two differential callbacks for -diff_callback_timeout and
+// -diff_crash_as_diff: both accept every input, but the second one never
+// returns on inputs that start with "HANG" and crashes on "CRASH".
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+typedef int (*UserCallback)(const uint8_t *Data, size_t Size);
+struct UserCallbacks {
+  UserCallback *callbacks;
+  int size;
+};
+
+static int Accepts(const uint8_t *Data, size_t Size) { return 0; }
+
+static volatile bool Forever = true;
+
+static volatile int *Nowhere = nullptr;
+
+static int Misbehaves(const uint8_t *Data, size_t Size) {
+  if (Size >= 4 && !memcmp(Data, "HANG", 4))
+    while (Forever) {
+    }
+  if (Size >= 5 && !memcmp(Data, "CRASH", 5))
+    *Nowhere = 1;
+  return 0;
+}
+
+static UserCallback Callbacks[] = {Accepts, Misbehaves};
+static UserCallbacks Container = {Callbacks, 2};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  return Accepts(Data, Size);
+}
+
+extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() { return &Container; }
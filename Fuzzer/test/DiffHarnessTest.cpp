@@ -0,0 +1,29 @@
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+
+// Two differential callbacks defined with LLVM_FUZZER_DIFF_HARNESS. Both
+// accept the inputs that start with "HI", Strict only if nothing follows,
+// and Strict reports success as 1, which its kResultMap maps to Lenient's 0.
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "FuzzerDiffHarness.h"
+
+struct Lenient {
+  static int Run(const uint8_t *Data, size_t Size) {
+    return Size >= 2 && !memcmp(Data, "HI", 2) ? 0 : -1;
+  }
+};
+
+struct Strict {
+  static int Run(const uint8_t *Data, size_t Size) {
+    while (Size && (Data[Size - 1] == '\n' || Data[Size - 1] == '\r'))
+      Size--;
+    return Size == 2 && !memcmp(Data, "HI", 2) ? 1 : -1;
+  }
+  static constexpr fuzzer::DiffResultMapping kResultMap[] = {{1, 0}};
+};
+constexpr fuzzer::DiffResultMapping Strict::kResultMap[];
+
+LLVM_FUZZER_DIFF_HARNESS(Lenient, Strict)
@@ -0,0 +1,39 @@
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+
+// Two differential callbacks for -diff_input_to_state. The second one
+// rejects the inputs that start with two big-endian magic numbers, the way
+// a TLS parser checks a record header; the first one accepts everything.
+#include <cstddef>
+#include <cstdint>
+
+typedef int (*UserCallback)(const uint8_t *Data, size_t Size);
+struct UserCallbacks {
+  UserCallback *callbacks;
+  int size;
+};
+
+static volatile int Sink;
+
+static uint32_t ReadBE32(const uint8_t *P) {
+  return uint32_t(P[0]) << 24 | uint32_t(P[1]) << 16 | uint32_t(P[2]) << 8 |
+         P[3];
+}
+
+static int Accepts(const uint8_t *Data, size_t Size) { return 0; }
+
+static int RejectsMagic(const uint8_t *Data, size_t Size) {
+  if (Size < 8 || ReadBE32(Data) != 0x16030301) return 0;
+  Sink = 1;
+  if (ReadBE32(Data + 4) != 0xC0DEF00D) return 0;
+  return 21;
+}
+
+static UserCallback Callbacks[] = {Accepts, RejectsMagic};
+static UserCallbacks Container = {Callbacks, 2};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  return Accepts(Data, Size);
+}
+
+extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() { return &Container; }
@@ -0,0 +1,41 @@
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+
+// Two differential callbacks for the per-callback leak detection of diff
+// mode: the first one allocates and frees a block on every input, the second
+// one leaks a block on the inputs that start with 'H'.
+#include <cstddef>
+#include <cstdint>
+
+typedef int (*UserCallback)(const uint8_t *Data, size_t Size);
+struct UserCallbacks {
+  UserCallback *callbacks;
+  int size;
+};
+
+static volatile void *Sink;
+
+static int Allocates(const uint8_t *Data, size_t Size) {
+  int *P = new int;
+  Sink = P;
+  delete P;
+  Sink = nullptr;
+  return 0;
+}
+
+static int Leaks(const uint8_t *Data, size_t Size) {
+  if (Size > 0 && *Data == 'H') {
+    Sink = new int;
+    Sink = nullptr;
+  }
+  return 0;
+}
+
+static UserCallback Callbacks[] = {Allocates, Leaks};
+static UserCallbacks Container = {Callbacks, 2};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  return Allocates(Data, Size);
+}
+
+extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() { return &Container; }
@@ -0,0 +1,41 @@
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+
+// Three differential callbacks for -diff_memory_limit_mb. The second one
+// keeps 64 Kb of every input in a cache that only LLVMFuzzerCustomReload()
+// empties, like a session cache that never evicts.
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+typedef int (*UserCallback)(const uint8_t *Data, size_t Size);
+struct UserCallbacks {
+  UserCallback *callbacks;
+  int size;
+};
+
+static std::vector<void *> *Cache = new std::vector<void *>;
+
+static int Accepts(const uint8_t *Data, size_t Size) { return 0; }
+
+static int Caches(const uint8_t *Data, size_t Size) {
+  Cache->push_back(calloc(1, 1 << 16));
+  return 0;
+}
+
+static UserCallback Callbacks[] = {Accepts, Caches, Accepts};
+static UserCallbacks Container = {Callbacks, 3};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  return Accepts(Data, Size);
+}
+
+extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() { return &Container; }
+
+extern "C" int LLVMFuzzerCustomReload(int Callback) {
+  for (void *P : *Cache)
+    free(P);
+  Cache->clear();
+  return 0;
+}
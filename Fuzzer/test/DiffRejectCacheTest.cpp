@@ -0,0 +1,42 @@
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+
+// Two differential callbacks for -diff_reject_cache and -diff_early_exit:
+// both reject every input that does not start with 'T' with the same alert,
+// and LLVMFuzzerCustomInputPrefix reports the first byte of such inputs as
+// the prefix that decides it.
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+typedef int (*UserCallback)(const uint8_t *Data, size_t Size);
+struct UserCallbacks {
+  UserCallback *callbacks;
+  int size;
+};
+
+static const int kAlert = 21;
+
+static int Accepts(const uint8_t *Data, size_t Size) {
+  return Size && Data[0] == 'T' ? 0 : kAlert;
+}
+
+static int AcceptsUnlessBang(const uint8_t *Data, size_t Size) {
+  if (!Size || Data[0] != 'T')
+    return kAlert;
+  return memchr(Data, '!', Size) ? 1 : 0;
+}
+
+static UserCallback Callbacks[] = {Accepts, AcceptsUnlessBang};
+static UserCallbacks Container = {Callbacks, 2};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  return Accepts(Data, Size);
+}
+
+extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() { return &Container; }
+
+extern "C" size_t LLVMFuzzerCustomInputPrefix(const uint8_t *Data,
+                                              size_t Size) {
+  return Size && Data[0] != 'T' ? 1 : 0;
+}
@@ -0,0 +1,37 @@
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+
+// Two differential callbacks for -diff_control. The second one rejects the
+// inputs that start with 'D' until LLVMFuzzerCustomReload() "loads" its
+// patched build, which accepts everything like the first one.
+#include <cstddef>
+#include <cstdint>
+
+typedef int (*UserCallback)(const uint8_t *Data, size_t Size);
+struct UserCallbacks {
+  UserCallback *callbacks;
+  int size;
+};
+
+static bool Patched;
+
+static int Accepts(const uint8_t *Data, size_t Size) { return 0; }
+
+static int RejectsD(const uint8_t *Data, size_t Size) {
+  return !Patched && Size && Data[0] == 'D' ? 3 : 0;
+}
+
+static UserCallback Callbacks[] = {Accepts, RejectsD};
+static UserCallbacks Container = {Callbacks, 2};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  return Accepts(Data, Size);
+}
+
+extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() { return &Container; }
+
+extern "C" int LLVMFuzzerCustomReload(int Callback) {
+  if (Callback == 1)
+    Patched = true;
+  return 0;
+}
@@ -0,0 +1,282 @@
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+
+// Microbenchmarks of the data structures on the hot path of the fuzzer, for
+// regression tracking. Prints one JSON document:
+//   {"benchmarks": [{"name": ..., "ops": ..., "ns_per_op": ...}, ...]}
+// Usage: LLVMFuzzer-Microbenchmarks [-ms=N] [-filter=SUBSTRING] [OUTPUT]
+
+// Avoid ODR violations, see FuzzerUnittest.cpp.
+#define _LIBCPP_HAS_NO_ASAN
+
+#include "FuzzerCorpus.h"
+#include "FuzzerDictionary.h"
+#include "FuzzerRandom.h"
+#include "FuzzerSHA1.h"
+#include "FuzzerTracePC.h"
+#include "FuzzerValueBitMap.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace fuzzer;
+using namespace std::chrono;
+
+// For now, have LLVMFuzzerTestOneInput just to make it link.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  abort();
+}
+
+namespace {
+
+struct Result {
+  std::string Name;
+  size_t Ops;
+  double NsPerOp;
+};
+
+std::vector<Result> Results;
+int Millis = 200;
+const char *Filter = "";
+
+// Keeps the compiler from dropping the work being timed.
+volatile uint64_t Sink;
+
+// Ops run between two reads of the clock.
+const size_t kOpsPerClockRead = 16;
+
+bool Selected(const std::string &Name) {
+  return strstr(Name.c_str(), Filter) != nullptr;
+}
+
+// Runs Op(i) for i = 0, 1, ... for about Millis milliseconds, after one
+// warm-up call, like the -diff_benchmark measurements.
+template <class Callback> void Benchmark(const std::string &Name, Callback Op) {
+  if (!Selected(Name)) return;
+  Op(0);
+  auto Budget = milliseconds(Millis);
+  auto Start = steady_clock::now();
+  steady_clock::duration Elapsed;
+  size_t Ops = 0;
+  do {
+    for (size_t i = 0; i < kOpsPerClockRead; i++)
+      Op(Ops + i);
+    Ops += kOpsPerClockRead;
+    Elapsed = steady_clock::now() - Start;
+  } while (Elapsed < Budget);
+  Results.push_back(
+      {Name, Ops, duration<double, std::nano>(Elapsed).count() / Ops});
+  fprintf(stderr, "%-40s %12.1f ns/op\n", Name.c_str(), Results.back().NsPerOp);
+}
+
+// Times a one-shot operation that cannot be repeated in place, such as
+// filling a corpus: Op() runs once and counts as NumOps ops. It runs, untimed,
+// even if Name is filtered out.
+template <class Callback>
+void BenchmarkOnce(const std::string &Name, size_t NumOps, Callback Op) {
+  if (!Selected(Name)) {
+    Op();
+    return;
+  }
+  auto Start = steady_clock::now();
+  Op();
+  double Ns = duration<double, std::nano>(steady_clock::now() - Start).count();
+  Results.push_back({Name, NumOps, Ns / NumOps});
+  fprintf(stderr, "%-40s %12.1f ns/op\n", Name.c_str(), Results.back().NsPerOp);
+}
+
+Unit RandomUnit(Random &Rand, size_t MaxSize) {
+  Unit U(1 + Rand(MaxSize));
+  for (auto &B : U)
+    B = static_cast<uint8_t>(Rand(256));
+  return U;
+}
+
+void BenchmarkCorpus(size_t NumUnits) {
+  std::string Suffix = "/" + std::to_string(NumUnits);
+  if (!Selected("InputCorpus::AddToCorpus" + Suffix) &&
+      !Selected("InputCorpus::ChooseUnitToMutate" + Suffix))
+    return;
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  Random Rand(0);
+  std::vector<Unit> Units;
+  Units.reserve(NumUnits);
+  for (size_t i = 0; i < NumUnits; i++)
+    Units.push_back(RandomUnit(Rand, 64));
+  std::vector<uint32_t> FeatureSet = {1, 2, 3, 4, 5, 6, 7, 8};
+  BenchmarkOnce("InputCorpus::AddToCorpus" + Suffix, NumUnits, [&] {
+    for (auto &U : Units)
+      C->AddToCorpus(U, 1 + Rand(8), false, FeatureSet);
+  });
+  if (C->empty()) return;
+  Benchmark("InputCorpus::ChooseUnitToMutate" + Suffix,
+            [&](size_t) { Sink = C->ChooseUnitToMutate(Rand).Size; });
+}
+
+// Like Benchmark(), but every op runs with cold caches, as it does after the
+// target ran: Evict() comes before each op and is not timed.
+template <class Callback, class EvictCallback>
+void BenchmarkCold(const std::string &Name, EvictCallback Evict, Callback Op) {
+  if (!Selected(Name)) return;
+  auto Budget = milliseconds(Millis);
+  steady_clock::duration Elapsed(0), Total(0);
+  size_t Ops = 0;
+  do {
+    auto Start = steady_clock::now();
+    Evict();
+    auto OpStart = steady_clock::now();
+    Op(Ops++);
+    auto End = steady_clock::now();
+    Elapsed += End - OpStart;
+    Total += End - Start;
+  } while (Total < Budget);
+  Results.push_back(
+      {Name, Ops, duration<double, std::nano>(Elapsed).count() / Ops});
+  fprintf(stderr, "%-40s %12.1f ns/op\n", Name.c_str(), Results.back().NsPerOp);
+}
+
+void BenchmarkAddFeatures() {
+  if (!Selected("InputCorpus::AddFeature")) return;
+  // The features of one run, in the increasing order of CollectFeatures(),
+  // spread over the whole feature table; all are known already.
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  Random Rand(0);
+  std::vector<uint32_t> Features(4096);
+  for (auto &F : Features)
+    F = static_cast<uint32_t>(Rand(1 << 21));
+  std::sort(Features.begin(), Features.end());
+  for (uint32_t F : Features)
+    C->AddFeature(F, 1, false);
+  // Larger than the caches, like the memory a target touches.
+  std::vector<uint8_t> Junk(64 << 20);
+  auto Evict = [&] { memset(Junk.data(), Sink & 0xff, Junk.size()); };
+  BenchmarkCold("InputCorpus::AddFeature/4096", Evict, [&](size_t) {
+    for (uint32_t F : Features)
+      C->AddFeature(F, 2, false);
+  });
+  BenchmarkCold("InputCorpus::AddFeatures/4096", Evict, [&](size_t) {
+    C->AddFeatures(Features.data(), Features.size(), 2, false,
+                   [&](uint32_t F, bool) { Sink = F; });
+  });
+}
+
+void BenchmarkDictionary() {
+  Random Rand(0);
+  std::unique_ptr<Dictionary> D(new Dictionary);
+  std::vector<Word> Words;
+  for (size_t i = 0; i < 10000; i++) {
+    Unit U = RandomUnit(Rand, 16);
+    Words.push_back(Word(U.data(), static_cast<uint8_t>(U.size())));
+    if (i % 2)
+      D->push_back(DictionaryEntry(Words.back()));
+  }
+  Benchmark("Dictionary::ContainsWord", [&](size_t i) {
+    Sink = D->ContainsWord(Words[i % Words.size()]);
+  });
+}
+
+void BenchmarkValueBitMap() {
+  ValueBitMap A, B;
+  if (!A.Allocate(ValueBitMap::kDefaultMapSizeLog, 1) ||
+      !B.Allocate(ValueBitMap::kDefaultMapSizeLog, 1))
+    return;
+  Random Rand(0);
+  Benchmark("ValueBitMap::MergeFrom", [&](size_t) {
+    for (size_t i = 0; i < 64; i++)
+      B.AddValue(Rand(B.SizeInBits()));
+    Sink = A.MergeFrom(B);
+  });
+}
+
+void BenchmarkSHA1() {
+  Random Rand(0);
+  for (size_t Size : {64, 4096}) {
+    Unit U(Size);
+    for (auto &B : U)
+      B = static_cast<uint8_t>(Rand(256));
+    Benchmark("ComputeSHA1/" + std::to_string(Size), [&](size_t) {
+      uint8_t Sha1[kSHA1NumBytes];
+      ComputeSHA1(U.data(), U.size(), Sha1);
+      Sink = Sha1[0];
+    });
+  }
+}
+
+void BenchmarkForEachNonZeroByte() {
+  // An 8-bit counter region of 64 KB with 1% of its counters set.
+  std::vector<uint8_t> Counters(1 << 16);
+  Random Rand(0);
+  for (size_t i = 0; i < Counters.size() / 100; i++)
+    Counters[Rand(Counters.size())] = static_cast<uint8_t>(1 + Rand(255));
+  Benchmark("ForEachNonZeroByte/64K", [&](size_t) {
+    size_t Sum = 0;
+    ForEachNonZeroByte(Counters.data(), Counters.data() + Counters.size(), 0,
+                       [&](size_t Idx, uint8_t V) { Sum += Idx + V; });
+    Sink = Sum;
+  });
+}
+
+void BenchmarkNewOutputDiffChange() {
+  Random Rand(0);
+  for (size_t N : {2, 4, 8, 16}) {
+    // Verdict vectors in which the callbacks mostly agree.
+    std::vector<std::vector<int>> Vectors(256, std::vector<int>(N));
+    for (auto &V : Vectors)
+      for (auto &X : V)
+        X = Rand(8) ? 0 : static_cast<int>(Rand(3));
+    TPC.OutputDiffVec.resize(N);
+    Benchmark("TracePC::NewOutputDiff_change/" + std::to_string(N) +
+                  "-callbacks",
+              [&](size_t i) {
+                auto &V = Vectors[i % Vectors.size()];
+                std::copy(V.begin(), V.end(), TPC.OutputDiffVec.begin());
+                Sink = TPC.NewOutputDiff_change();
+              });
+  }
+}
+
+void PrintJson(FILE *Out) {
+  fprintf(Out, "{\"benchmarks\": [");
+  for (size_t i = 0; i < Results.size(); i++)
+    fprintf(Out, "%s\n  {\"name\": \"%s\", \"ops\": %zd, \"ns_per_op\": %.2f}",
+            i ? "," : "", Results[i].Name.c_str(), Results[i].Ops,
+            Results[i].NsPerOp);
+  fprintf(Out, "\n]}\n");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const char *OutputPath = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "-ms=", 4))
+      Millis = atoi(argv[i] + 4);
+    else if (!strncmp(argv[i], "-filter=", 8))
+      Filter = argv[i] + 8;
+    else
+      OutputPath = argv[i];
+  }
+  for (size_t N : {10000, 100000, 1000000})
+    BenchmarkCorpus(N);
+  BenchmarkAddFeatures();
+  BenchmarkDictionary();
+  BenchmarkValueBitMap();
+  BenchmarkSHA1();
+  BenchmarkForEachNonZeroByte();
+  BenchmarkNewOutputDiffChange();
+
+  FILE *Out = OutputPath ? fopen(OutputPath, "w") : stdout;
+  if (!Out) {
+    fprintf(stderr, "ERROR: can't write %s\n", OutputPath);
+    return 1;
+  }
+  PrintJson(Out);
+  if (Out != stdout)
+    fclose(Out);
+  return 0;
+}
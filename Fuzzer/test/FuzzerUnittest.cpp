@@ -5,17 +5,38 @@
 // with ASan) involving C++ standard library types when using libcxx.
 #define _LIBCPP_HAS_NO_ASAN
 
+#include "FuzzerCompress.h"
 #include "FuzzerCorpus.h"
 #include "FuzzerDictionary.h"
+#include "FuzzerDiffCluster.h"
+#include "FuzzerDiffPack.h"
+#include "FuzzerEdgeStore.h"
+#include "FuzzerDigestSet.h"
+#include "FuzzerHistogram.h"
+#include "FuzzerHwTrace.h"
 #include "FuzzerInternal.h"
 #include "FuzzerMerge.h"
+#include "FuzzerMetrics.h"
 #include "FuzzerMutate.h"
+#include "FuzzerMutatePipeline.h"
+#include "FuzzerOracle.h"
+#include "FuzzerPackedCorpus.h"
+#include "FuzzerPcap.h"
 #include "FuzzerRandom.h"
+#include "FuzzerRoaring.h"
+#include "FuzzerSampler.h"
+#include "FuzzerSignatureSet.h"
+#include "FuzzerSync.h"
+#include "FuzzerTrace.h"
 #include "FuzzerTracePC.h"
+#include "FuzzerUtil.h"
 #include "gtest/gtest.h"
 #include <memory>
+#include <netinet/in.h>
 #include <set>
 #include <sstream>
+#include <sys/socket.h>
+#include <unistd.h>
 
 using namespace fuzzer;
 
@@ -25,6 +46,14 @@ extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
   abort();
 }
 
+extern "C" void __sanitizer_cov_trace_pc_guard(uint32_t *Guard);
+extern "C" void __sanitizer_cov_trace_pc_guard_init(uint32_t *Start,
+                                                    uint32_t *Stop);
+extern "C" void __sanitizer_cov_8bit_counters_init(uint8_t *Start,
+                                                   uint8_t *Stop);
+extern "C" void __sanitizer_cov_pcs_init(const uintptr_t *Start,
+                                         const uintptr_t *Stop);
+
 TEST(Fuzzer, CrossOver) {
   std::unique_ptr<ExternalFunctions> t(new ExternalFunctions());
   fuzzer::EF = t.get();
@@ -92,6 +121,26 @@ TEST(Fuzzer, Hash) {
   EXPECT_EQ("81fe8bfe87576c3ecb22426f8e57847382917acf", fuzzer::Hash(U));
 }
 
+// Lengths around the block size, where the padding spills into a second
+// block, and inputs of several blocks.
+TEST(Fuzzer, HashBlockBoundaries) {
+  std::vector<std::pair<size_t, const char *>> Expected = {
+      {0, "da39a3ee5e6b4b0d3255bfef95601890afd80709"},
+      {3, "75550941124b46eb4161d17ac200c05c4fc03ce7"},
+      {55, "aecd1643c9903b9bae8cb94f53c50f8a4e18605b"},
+      {56, "f5d65c621c02cc8e785159feff8088e3072da1bc"},
+      {64, "1e17ae1fc093e5daca033553c97a5192ca164486"},
+      {119, "b4a4e69060d0b1e7e8ebbf7041a4211c63438b57"},
+      {1000, "38f3aa587f4aa04965a359f9151092759b3a4c2a"},
+  };
+  for (auto &E : Expected) {
+    fuzzer::Unit U(E.first);
+    for (size_t i = 0; i < U.size(); i++)
+      U[i] = static_cast<uint8_t>(i * 7);
+    EXPECT_EQ(E.second, fuzzer::Hash(U));
+  }
+}
+
 typedef size_t (MutationDispatcher::*Mutator)(uint8_t *Data, size_t Size,
                                               size_t MaxSize);
 
@@ -142,6 +191,132 @@ void TestEraseBytes(Mutator M, int NumIter) {
   EXPECT_EQ(FoundMask, (1 << 14) - 1);
 }
 
+TEST(Fuzzer, Hash128) {
+  uint8_t A[] = {'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i'};
+  Digest128 H = Hash128(A, sizeof(A));
+  EXPECT_EQ(H, Hash128(A, sizeof(A)));
+  EXPECT_NE(H, Hash128(A, sizeof(A) - 1));
+  A[8] = 'j';
+  EXPECT_NE(H, Hash128(A, sizeof(A)));
+  // A trailing zero byte is not the same as no byte at all.
+  uint8_t Z[] = {1, 2, 3, 4, 5, 6, 7, 8, 0};
+  EXPECT_NE(Hash128(Z, 8), Hash128(Z, 9));
+
+  // Streaming whole words gives the same digest as hashing the buffer.
+  Hasher128 S;
+  uint64_t W1, W2;
+  memcpy(&W1, "01234567", 8);
+  memcpy(&W2, "89abcdef", 8);
+  S.Update(W1);
+  S.Update(W2);
+  EXPECT_EQ(S.Final(),
+            Hash128(reinterpret_cast<const uint8_t *>("0123456789abcdef"), 16));
+}
+
+TEST(DigestSet, Exact) {
+  DigestSet S;
+  EXPECT_TRUE(S.Insert(Digest128{0, 0}));
+  EXPECT_FALSE(S.Insert(Digest128{0, 0}));
+  EXPECT_FALSE(S.Contains(Digest128{0, 1}));
+  for (uint64_t i = 1; i <= 10000; i++)
+    EXPECT_TRUE(S.Insert(Digest128{i * 1024, i}));
+  EXPECT_EQ(S.size(), 10001U);
+  for (uint64_t i = 1; i <= 10000; i++) {
+    EXPECT_TRUE(S.Contains(Digest128{i * 1024, i}));
+    EXPECT_FALSE(S.Insert(Digest128{i * 1024, i}));
+  }
+  EXPECT_TRUE(S.Contains(Digest128{0, 0}));
+  EXPECT_TRUE(S.Insert(uint64_t(42)));
+  EXPECT_TRUE(S.Contains(uint64_t(42)));
+}
+
+TEST(DigestSet, Erase) {
+  DigestSet S;
+  // Digests that collide on their home slot, then a few others.
+  for (uint64_t i = 0; i < 8; i++)
+    EXPECT_TRUE(S.Insert(Digest128{i << 20, i + 1}));
+  for (uint64_t i = 1; i < 100; i++)
+    EXPECT_TRUE(S.Insert(Digest128{i, 0}));
+  EXPECT_TRUE(S.Erase(Digest128{2 << 20, 3}));
+  EXPECT_FALSE(S.Erase(Digest128{2 << 20, 3}));
+  EXPECT_TRUE(S.Erase(Digest128{5, 0}));
+  EXPECT_FALSE(S.Contains(Digest128{2 << 20, 3}));
+  for (uint64_t i = 0; i < 8; i++)
+    EXPECT_EQ(S.Contains(Digest128{i << 20, i + 1}), i != 2);
+  for (uint64_t i = 1; i < 100; i++)
+    EXPECT_EQ(S.Contains(Digest128{i, 0}), i != 5);
+  EXPECT_EQ(S.size(), 105U);
+  EXPECT_TRUE(S.Insert(Digest128{0, 0}));
+  EXPECT_TRUE(S.Erase(Digest128{0, 0}));
+  EXPECT_FALSE(S.Contains(Digest128{0, 0}));
+}
+
+TEST(DigestSet, MaxSize) {
+  DigestSet S;
+  S.SetMaxSize(100);
+  for (uint64_t i = 0; i < 100; i++)
+    EXPECT_TRUE(S.Insert(i));
+  EXPECT_EQ(S.size(), 100U);
+  EXPECT_TRUE(S.Insert(uint64_t(100)));
+  EXPECT_EQ(S.size(), 1U);
+  EXPECT_FALSE(S.Contains(uint64_t(0)));
+}
+
+TEST(DigestSet, Approximate) {
+  DigestSet S;
+  S.SetApproximate(20);
+  EXPECT_TRUE(S.IsApproximate());
+  const size_t N = 1000;
+  for (uint64_t i = 0; i < N; i++)
+    S.Insert(Hash128(reinterpret_cast<uint8_t *>(&i), sizeof(i)));
+  // No false negatives.
+  for (uint64_t i = 0; i < N; i++)
+    EXPECT_TRUE(S.Contains(Hash128(reinterpret_cast<uint8_t *>(&i), sizeof(i))));
+  size_t FalsePositives = 0;
+  for (uint64_t i = N; i < 2 * N; i++)
+    FalsePositives +=
+        S.Contains(Hash128(reinterpret_cast<uint8_t *>(&i), sizeof(i)));
+  EXPECT_LT(FalsePositives, N / 100);
+  S.clear();
+  EXPECT_FALSE(S.Contains(uint64_t(0)));
+}
+
+TEST(DigestSet, SaveLoad) {
+  DigestSet S, Bloom;
+  Bloom.SetApproximate(12);
+  for (uint64_t i = 0; i < 100; i++) {
+    S.Insert(Digest128{i, i * 3});
+    Bloom.Insert(Digest128{i, i * 3});
+  }
+  std::vector<uint8_t> Saved;
+  S.Save(&Saved);
+  Bloom.Save(&Saved);
+  const uint8_t *P = Saved.data(), *End = P + Saved.size();
+  DigestSet T, TBloom;
+  TBloom.SetApproximate(12);
+  EXPECT_TRUE(T.Load(&P, End));
+  EXPECT_TRUE(TBloom.Load(&P, End));
+  EXPECT_EQ(P, End);
+  EXPECT_EQ(T.size(), 100U);
+  for (uint64_t i = 0; i < 100; i++) {
+    EXPECT_TRUE(T.Contains(Digest128{i, i * 3}));
+    EXPECT_TRUE(TBloom.Contains(Digest128{i, i * 3}));
+  }
+  EXPECT_FALSE(T.Contains(Digest128{100, 300}));
+  // Nor can a set be loaded in another mode or from a truncated save.
+  P = Saved.data();
+  EXPECT_FALSE(T.Load(&P, P + 100));
+  // A set saved in another mode is skipped, so the next one still loads.
+  DigestSet UBloom;
+  UBloom.SetApproximate(12);
+  P = Saved.data();
+  EXPECT_FALSE(UBloom.Load(&P, End));
+  EXPECT_EQ(UBloom.size(), 0U);
+  EXPECT_TRUE(UBloom.Load(&P, End));
+  EXPECT_EQ(P, End);
+  EXPECT_TRUE(UBloom.Contains(Digest128{7, 21}));
+}
+
 TEST(FuzzerMutate, EraseBytes1) {
   TestEraseBytes(&MutationDispatcher::Mutate_EraseBytes, 200);
 }
@@ -223,7 +398,7 @@ void TestInsertRepeatedBytes(Mutator M, int NumIter) {
 }
 
 TEST(FuzzerMutate, InsertRepeatedBytes1) {
-  TestInsertRepeatedBytes(&MutationDispatcher::Mutate_InsertRepeatedBytes, 10000);
+  TestInsertRepeatedBytes(&MutationDispatcher::Mutate_InsertRepeatedBytes, 30000);
 }
 TEST(FuzzerMutate, InsertRepeatedBytes2) {
   TestInsertRepeatedBytes(&MutationDispatcher::Mutate, 300000);
@@ -450,6 +625,25 @@ TEST(FuzzerMutate, AddWordFromDictionaryWithHint2) {
   TestAddWordFromDictionaryWithHint(&MutationDispatcher::Mutate, 1 << 10);
 }
 
+TEST(FuzzerMutate, AddPriorityWordToPersistentAutoDictionary) {
+  std::unique_ptr<ExternalFunctions> t(new ExternalFunctions());
+  fuzzer::EF = t.get();
+  Random Rand(0);
+  MutationDispatcher MD(Rand, {});
+  uint8_t W[] = {0x16, 0x03, 0x03, 0x00, 0x2f};
+  MD.AddPriorityWordToPersistentAutoDictionary(Word(W, sizeof(W)));
+  MD.AddPriorityWordToPersistentAutoDictionary(Word(W, sizeof(W)));
+  size_t NumFound = 0;
+  for (int i = 0; i < 100; i++) {
+    uint8_t T[16] = {};
+    size_t NewSize =
+        MD.Mutate_AddWordFromPersistentAutoDictionary(T, 8, sizeof(T));
+    NumFound += NewSize &&
+                std::search(T, T + NewSize, W, W + sizeof(W)) != T + NewSize;
+  }
+  EXPECT_EQ(NumFound, 100U);
+}
+
 void TestChangeASCIIInteger(Mutator M, int NumIter) {
   std::unique_ptr<ExternalFunctions> t(new ExternalFunctions());
   fuzzer::EF = t.get();
@@ -522,6 +716,103 @@ TEST(FuzzerMutate, ChangeBinaryInteger2) {
   TestChangeBinaryInteger(&MutationDispatcher::Mutate, 1 << 15);
 }
 
+TEST(FuzzerMutate, MutatorStats) {
+  std::unique_ptr<ExternalFunctions> t(new ExternalFunctions());
+  fuzzer::EF = t.get();
+  Random Rand(0);
+  FuzzingOptions Options;
+  Options.MutatorStats = true;
+  Options.MutateAdaptive = true;
+  MutationDispatcher MD(Rand, Options);
+  EXPECT_TRUE(MD.TracksMutants());
+  auto &Stats = MD.GetMutatorStats();
+  size_t ChangeBit =
+      std::find_if(Stats.begin(), Stats.end(),
+                   [](const MutationDispatcher::MutatorStats &S) {
+                     return !strcmp(S.Name, "ChangeBit");
+                   }) -
+      Stats.begin();
+  ASSERT_LT(ChangeBit, Stats.size());
+  double Uniform = MD.MutatorWeight(ChangeBit);
+  // Only the mutants made by ChangeBit find something.
+  for (int i = 0; i < 1 << 15; i++) {
+    uint8_t T[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    MD.StartMutationSequence();
+    MD.Mutate(T, 4, sizeof(T));
+    if (i % 16 == 0)
+      MD.RecordDuplicateMutant();
+    auto O = MD.TakeMutantOrigin();
+    EXPECT_EQ(__builtin_popcount(O.Mutators), 1);
+    MutationDispatcher::MutantOutcome Outcome;
+    Outcome.Seconds = 1e-6;
+    Outcome.NewUnit = O.Mutators == 1U << ChangeBit;
+    Outcome.NewFeatures = Outcome.NewUnit;
+    MD.RecordMutantOutcome(O, Outcome);
+  }
+  size_t Uses = 0, Mutants = 0, Duplicates = 0;
+  for (auto &S : Stats) {
+    Uses += S.Uses;
+    Mutants += S.Mutants;
+    Duplicates += S.Duplicates;
+  }
+  EXPECT_GE(Uses, Mutants);
+  EXPECT_EQ(Mutants, 1U << 15);
+  EXPECT_EQ(Duplicates, 1U << 11);
+  EXPECT_EQ(Stats[ChangeBit].NewFeatures, Stats[ChangeBit].Mutants);
+  EXPECT_GT(MD.MutatorWeight(ChangeBit), 2 * Uniform);
+  double Sum = 0;
+  for (size_t i = 0; i < Stats.size(); i++)
+    Sum += MD.MutatorWeight(i);
+  EXPECT_NEAR(Sum, 1, 1e-9);
+}
+
+static size_t FlipFirstByte(uint8_t *Data, size_t Size, size_t MaxSize,
+                            unsigned int Seed) {
+  if (Size) Data[0] ^= 1;
+  return Size;
+}
+
+TEST(FuzzerMutate, HybridOdds) {
+  std::unique_ptr<ExternalFunctions> t(new ExternalFunctions());
+  fuzzer::EF = t.get();
+  Random Rand(0);
+  FuzzingOptions Options;
+  Options.MutateHybrid = true;
+  // Without a custom mutator there is nothing to mix.
+  EXPECT_FALSE(MutationDispatcher(Rand, Options).IsHybrid());
+  EF->LLVMFuzzerCustomMutator = FlipFirstByte;
+  MutationDispatcher MD(Rand, Options);
+  ASSERT_TRUE(MD.IsHybrid());
+  EXPECT_EQ(MD.CustomMutatorOdds(), 0.5);
+  // Runs N mutants, of which those of group Finder find something, and
+  // returns how many were made by the custom mutator.
+  auto Run = [&](size_t N, MutationDispatcher::MutatorGroup Finder) {
+    size_t NumCustom = 0;
+    for (size_t i = 0; i < N; i++) {
+      uint8_t T[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+      MD.StartMutationSequence();
+      MD.Mutate(T, 4, sizeof(T));
+      auto O = MD.TakeMutantOrigin();
+      NumCustom += O.Group == MutationDispatcher::MG_Custom;
+      MutationDispatcher::MutantOutcome Outcome;
+      Outcome.Seconds = 1e-3;
+      Outcome.NewUnit = O.Group == Finder;
+      MD.RecordMutantOutcome(O, Outcome);
+    }
+    return NumCustom;
+  };
+  // The odds follow the group that finds, within [0.05, 0.95].
+  Run(1 << 14, MutationDispatcher::MG_Custom);
+  EXPECT_DOUBLE_EQ(MD.CustomMutatorOdds(), 0.95);
+  // Old finds fade, so the odds turn when the other group starts finding.
+  Run(1 << 16, MutationDispatcher::MG_Default);
+  EXPECT_DOUBLE_EQ(MD.CustomMutatorOdds(), 0.05);
+  // Mutate picks the custom mutator with those odds.
+  size_t NumCustom = Run(1 << 14, MutationDispatcher::MG_Default);
+  EXPECT_NEAR(NumCustom / double(1 << 14), 0.05, 0.01);
+  EF->LLVMFuzzerCustomMutator = nullptr;
+}
+
 
 TEST(FuzzerDictionary, ParseOneDictionaryEntry) {
   Unit U;
@@ -571,6 +862,64 @@ TEST(FuzzerDictionary, ParseDictionaryFile) {
             std::vector<Unit>({Unit({'a', 'a'}), Unit({'a', 'b', 'c'})}));
 }
 
+TEST(FuzzerDictionary, IndexOf) {
+  Dictionary D;
+  EXPECT_FALSE(D.ContainsWord(Word((const uint8_t *)"ab", 2)));
+  D.push_back(Word((const uint8_t *)"ab", 2));
+  D.push_back(Word((const uint8_t *)"abc", 3));
+  D.push_back(Word((const uint8_t *)"ab", 2));
+  EXPECT_EQ(D.size(), 3U);
+  EXPECT_TRUE(D.ContainsWord(Word((const uint8_t *)"abc", 3)));
+  EXPECT_FALSE(D.ContainsWord(Word((const uint8_t *)"a", 1)));
+  EXPECT_EQ(D.IndexOf(Word((const uint8_t *)"ab", 2)), 0U);
+  EXPECT_EQ(D.IndexOf(Word((const uint8_t *)"abc", 3)), 1U);
+  EXPECT_EQ(D.IndexOf(Word((const uint8_t *)"b", 1)), D.size());
+
+  // Entries stay in place while the dictionary grows past its old limit.
+  const DictionaryEntry *First = &D[0];
+  uint8_t B[4];
+  for (uint32_t i = 0; i < (1 << 15); i++) {
+    memcpy(B, &i, sizeof(i));
+    D.push_back(Word(B, sizeof(B)));
+  }
+  EXPECT_EQ(D.size(), 3U + (1 << 15));
+  EXPECT_EQ(First, &D[0]);
+  uint32_t Last = (1 << 15) - 1;
+  memcpy(B, &Last, sizeof(Last));
+  EXPECT_EQ(D.IndexOf(Word(B, sizeof(B))), D.size() - 1);
+  D.clear();
+  EXPECT_FALSE(D.ContainsWord(Word(B, sizeof(B))));
+}
+
+TEST(DiffClusters, Insert) {
+  MinHash A, B, C;
+  for (uint64_t i = 0; i < 1000; i++) {
+    A.Add(i);
+    B.Add(i < 950 ? i : i + 1000);  // Shares 950 of 1050 tokens with A.
+    C.Add(i + 5000);
+  }
+  EXPECT_EQ(A.Similarity(A), 1.);
+  EXPECT_GT(A.Similarity(B), 0.7);
+  EXPECT_LT(A.Similarity(C), 0.1);
+
+  DiffClusters DC;
+  DC.SetSimilarity(0.7);
+  bool IsNew;
+  EXPECT_EQ(DC.Insert(1, A, &IsNew), 0U);
+  EXPECT_TRUE(IsNew);
+  EXPECT_EQ(DC.Insert(1, B, &IsNew), 0U);
+  EXPECT_FALSE(IsNew);
+  EXPECT_EQ(DC.Insert(1, C, &IsNew), 1U);
+  EXPECT_TRUE(IsNew);
+  // The same coverage under other verdicts is another cluster.
+  EXPECT_EQ(DC.Insert(2, A, &IsNew), 2U);
+  EXPECT_TRUE(IsNew);
+  EXPECT_EQ(DC.Insert(1, A, &IsNew), 0U);
+  EXPECT_FALSE(IsNew);
+  EXPECT_EQ(DC.size(), 3U);
+  EXPECT_EQ(DC.NumDiffs(), 5U);
+}
+
 TEST(FuzzerUtil, Base64) {
   EXPECT_EQ("", Base64({}));
   EXPECT_EQ("YQ==", Base64({'a'}));
@@ -584,6 +933,73 @@ TEST(FuzzerUtil, Base64) {
   EXPECT_EQ("YWJjeHl6", Base64({'a', 'b', 'c', 'x', 'y', 'z'}));
 }
 
+TEST(FuzzerUtil, ParseCpuList) {
+  EXPECT_EQ(ParseCpuList(""), std::vector<unsigned>());
+  EXPECT_EQ(ParseCpuList("0"), std::vector<unsigned>({0}));
+  EXPECT_EQ(ParseCpuList("0-3,8,10-11"),
+            std::vector<unsigned>({0, 1, 2, 3, 8, 10, 11}));
+}
+
+TEST(FuzzerUtil, OrderCpusForPlacement) {
+  // Two nodes of two cores of two threads each, numbered the way Linux does.
+  std::vector<CpuInfo> Cpus = {{0, 0, 0}, {1, 1, 0}, {2, 2, 1}, {3, 3, 1},
+                               {4, 0, 0}, {5, 1, 0}, {6, 2, 1}, {7, 3, 1}};
+  std::vector<unsigned> Order;
+  for (auto &C : OrderCpusForPlacement(Cpus))
+    Order.push_back(C.Cpu);
+  EXPECT_EQ(Order, std::vector<unsigned>({0, 2, 1, 3, 4, 6, 5, 7}));
+  // Without a known topology the CPUs stay in order.
+  std::vector<CpuInfo> Flat = {{2, 2, 0}, {0, 0, 0}, {1, 1, 0}};
+  Order.clear();
+  for (auto &C : OrderCpusForPlacement(Flat))
+    Order.push_back(C.Cpu);
+  EXPECT_EQ(Order, std::vector<unsigned>({0, 1, 2}));
+}
+
+TEST(FuzzerUtil, SplitCpusAmongWorkers) {
+  // Two nodes of two cores of two threads each, in placement order.
+  std::vector<CpuInfo> Cpus = {{0, 0, 0}, {2, 2, 1}, {1, 1, 0}, {3, 3, 1},
+                               {4, 0, 0}, {6, 2, 1}, {5, 1, 0}, {7, 3, 1}};
+  auto Sets = SplitCpusAmongWorkers(Cpus, 3);
+  std::vector<std::vector<unsigned>> Got;
+  for (auto &Set : Sets) {
+    Got.push_back({});
+    for (auto &C : Set)
+      Got.back().push_back(C.Cpu);
+  }
+  // Workers 0 and 2 share the leftovers of node 0, worker 1 gets node 1's.
+  EXPECT_EQ(Got, std::vector<std::vector<unsigned>>(
+                     {{0, 4}, {2, 3, 6, 7}, {1, 5}}));
+  // No CPU is in two sets.
+  std::set<unsigned> Seen;
+  for (auto &Set : Got)
+    for (unsigned Cpu : Set)
+      EXPECT_TRUE(Seen.insert(Cpu).second);
+  // More workers than CPUs: they share single CPUs.
+  Sets = SplitCpusAmongWorkers({{0, 0, 0}, {1, 1, 0}}, 3);
+  ASSERT_EQ(Sets.size(), 3U);
+  EXPECT_EQ(Sets[2].size(), 1U);
+  EXPECT_EQ(Sets[2][0].Cpu, 0U);
+}
+
+static int ObjectFileIdProbe;
+
+TEST(FuzzerUtil, ObjectFileId) {
+  // This test and its data are in the same object, a heap block in none.
+  const void *Code = reinterpret_cast<const void *>(&Base64);
+  std::string Id = ObjectFileId(Code);
+  if (Id.empty()) return;  // Not known on this platform.
+  EXPECT_EQ(Id, ObjectFileId(&ObjectFileIdProbe));
+  std::unique_ptr<int> Heap(new int);
+  EXPECT_EQ(ObjectFileId(Heap.get()), "");
+  uintptr_t Base = 0, DataBase = 0;
+  EXPECT_TRUE(ObjectFileBase(Code, &Base));
+  EXPECT_TRUE(ObjectFileBase(&ObjectFileIdProbe, &DataBase));
+  EXPECT_EQ(Base, DataBase);
+  EXPECT_LE(Base, reinterpret_cast<uintptr_t>(Code));
+  EXPECT_FALSE(ObjectFileBase(Heap.get(), &Base));
+}
+
 TEST(Corpus, Distribution) {
   Random Rand(0);
   std::unique_ptr<InputCorpus> C(new InputCorpus(""));
@@ -602,6 +1018,504 @@ TEST(Corpus, Distribution) {
   }
 }
 
+TEST(Corpus, Aggregates) {
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  EXPECT_EQ(C->MaxInputSize(), 0U);
+  C->AddToCorpus(Unit(3, 'a'), 1, false, {1});
+  C->AddToCorpus(Unit(7, 'b'), 1, false, {2});
+  C->AddToCorpus(Unit(7, 'c'), 1, false, {3});
+  C->AddToCorpus(Unit(5, 'd'), 1, false, {4});
+  EXPECT_EQ(C->SizeInBytes(), 22U);
+  EXPECT_EQ(C->NumActiveUnits(), 4U);
+  EXPECT_EQ(C->MaxInputSize(), 7U);
+  C->DeleteInput(1);
+  EXPECT_EQ(C->MaxInputSize(), 7U);
+  C->DeleteInput(2);
+  C->DeleteInput(2);
+  EXPECT_EQ(C->SizeInBytes(), 8U);
+  EXPECT_EQ(C->NumActiveUnits(), 2U);
+  EXPECT_EQ(C->MaxInputSize(), 5U);
+}
+
+TEST(Corpus, HasUnit) {
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  Unit U = {'a', 'b', 'c'};
+  uint8_t Sha1[kSHA1NumBytes];
+  ComputeSHA1(U.data(), U.size(), Sha1);
+  EXPECT_FALSE(C->HasUnit(U));
+  C->AddToCorpus(U, 1, false, {1}, Sha1);
+  EXPECT_TRUE(C->HasUnit(U));
+  EXPECT_TRUE(C->HasUnit(Sha1));
+  EXPECT_TRUE(C->HasUnit(Hash(U)));
+  EXPECT_FALSE(C->HasUnit(Unit({'a', 'b'})));
+  EXPECT_FALSE(C->HasUnit(std::string("abc")));
+}
+
+TEST(Corpus, Arena) {
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  size_t N = 200;
+  for (size_t i = 0; i < N; i++)
+    C->AddToCorpus(Unit(1000, static_cast<uint8_t>(i)), 1, false,
+                   {static_cast<uint32_t>(i)});
+  // Deleting most units compacts the arena; the others must survive that.
+  for (size_t i = 0; i < N; i++)
+    if (i % 4)
+      C->DeleteInput(i);
+  EXPECT_EQ(C->SizeInBytes(), 50000U);
+  for (size_t i = 0; i < N; i++) {
+    UnitRef U = (*C)[i];
+    if (i % 4) {
+      EXPECT_TRUE(U.empty());
+      continue;
+    }
+    EXPECT_EQ(U.size(), 1000U);
+    EXPECT_EQ(Unit(U.begin(), U.end()), Unit(1000, static_cast<uint8_t>(i)));
+  }
+}
+
+TEST(Corpus, DiffEnergy) {
+  Random Rand(0);
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  C->SetDiffEnergy(100);
+  for (size_t i = 0; i < 10; i++)
+    C->AddToCorpus(Unit{static_cast<uint8_t>(i)}, 1, false, {});
+  // Units 0..7 share one verdict pattern, unit 8 has a rare one.
+  for (size_t i = 0; i < 8; i++)
+    C->SetDiffInfo(i, 1, 1);
+  C->SetDiffInfo(8, 2, 2);
+  EXPECT_EQ(C->NumDiffClasses(), 2U);
+  EXPECT_EQ(C->DiffClassSize(C->ChooseUnitToMutate(Rand)) > 0, true);
+  std::vector<size_t> Hist(10);
+  for (size_t i = 0; i < 10000; i++)
+    Hist[C->ChooseUnitIdxToMutate(Rand)]++;
+  EXPECT_EQ(Hist[9], 0U);
+  EXPECT_GT(Hist[8], 4000U);
+  EXPECT_LT(Hist[0], 1000U);
+}
+
+TEST(Corpus, TargetDistance) {
+  Random Rand(0);
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  // Unit 0 weighs 1, unit 1 weighs 2 on its own.
+  for (size_t i = 0; i < 2; i++)
+    C->AddToCorpus(Unit{static_cast<uint8_t>(i)}, 1, false, {});
+  C->SetTargetDistance(0, 0);  // Now 16 times as much.
+  C->SetTargetDistance(1, 100);  // Too far to count for less.
+  std::vector<size_t> Hist(2);
+  for (size_t i = 0; i < 9000; i++)
+    Hist[C->ChooseUnitIdxToMutate(Rand)]++;
+  EXPECT_GT(Hist[0], 7500U);
+  EXPECT_GT(Hist[1], 500U);
+}
+
+TEST(Corpus, CostWeights) {
+  Random Rand(0);
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  // Unit i weighs i + 1 on its own.
+  for (size_t i = 0; i < 3; i++)
+    C->AddToCorpus(Unit{static_cast<uint8_t>(i)}, 1, false, {});
+  C->SetExecTime(0, 1000);
+  C->SetExecTime(1, 4000);
+  C->SetExecTime(2, 1000000);
+  // No median yet: the factors are all 1, that is 16 / 16.
+  EXPECT_EQ(C->Input(0).CostWeight, 16U);
+  C->UpdateCostWeights();
+  EXPECT_EQ(C->MedianExecTime(), 4000U);
+  EXPECT_EQ(C->Input(0).CostWeight, 64U);
+  EXPECT_EQ(C->Input(1).CostWeight, 16U);
+  // 250 times the median, but the factor stops at 1/16.
+  EXPECT_EQ(C->Input(2).CostWeight, 1U);
+  // Now the units weigh 4, 2 and 1, the least weight a unit can have.
+  std::vector<size_t> Hist(3);
+  for (size_t i = 0; i < 7000; i++)
+    Hist[C->ChooseUnitIdxToMutate(Rand)]++;
+  EXPECT_GT(Hist[0], 3600U);
+  EXPECT_GT(Hist[1], 1600U);
+  EXPECT_LT(Hist[2], 1300U);
+}
+
+TEST(Corpus, RareEdgeBoost) {
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  C->EnableFeatureHits();
+  // Feature 1 of the first library is hit once, feature 2 of the second
+  // library 64 times.
+  C->AddFeature(1, 1, false);
+  for (size_t i = 0; i < 64; i++)
+    C->AddFeature(2, 1, false);
+  EXPECT_EQ(C->FeatureHitCount(1), 1U);
+  EXPECT_EQ(C->FeatureHitCount(2), 64U);
+  C->AddToCorpus(Unit{0}, 1, false, {});
+  C->AddToCorpus(Unit{1}, 1, false, {});
+  C->SetRarestFeatures(0, {1, 2});
+  C->SetRarestFeatures(1, {2, ~0U});
+  // 2^5 <= 65 / 2 < 2^6.
+  EXPECT_EQ(C->Input(0).RareEdgeBoost, 6U);
+  EXPECT_EQ(C->Input(1).RareEdgeBoost, 1U);
+  for (size_t i = 0; i < 64; i++)
+    C->AddFeature(1, 1, false);
+  C->UpdateRareEdgeBoosts();
+  EXPECT_EQ(C->Input(0).RareEdgeBoost, 1U);
+}
+
+TEST(Corpus, AddFeatures) {
+  std::unique_ptr<InputCorpus> A(new InputCorpus(""));
+  std::unique_ptr<InputCorpus> B(new InputCorpus(""));
+  A->EnableFeatureHits();
+  B->EnableFeatureHits();
+  Random Rand(0);
+  std::vector<uint32_t> Features(100);
+  for (auto &F : Features)
+    F = static_cast<uint32_t>(Rand(1 << 22));
+  Features.push_back(Features[0]);
+  // The first input adds every feature, the second one replaces it, the
+  // third one changes nothing.
+  for (uint8_t Size : {4, 2, 3}) {
+    size_t NumNew = 0, NumUpdated = 0;
+    for (uint32_t F : Features)
+      A->AddFeature(F, Size, true);
+    B->AddFeatures(Features.data(), Features.size(), Size, true,
+                   [&](uint32_t F, bool IsNew) {
+                     NumUpdated++;
+                     NumNew += IsNew;
+                   });
+    EXPECT_EQ(A->NumFeatures(), B->NumFeatures());
+    EXPECT_EQ(A->NumFeatureUpdates(), B->NumFeatureUpdates());
+    EXPECT_EQ(NumNew, Size == 4 ? B->NumFeatures() : 0U);
+    EXPECT_EQ(NumUpdated, Size == 3 ? 0U : B->NumFeatures());
+    if (!NumUpdated) continue;
+    A->AddToCorpus(Unit(Size, Size), NumUpdated, false, {});
+    B->AddToCorpus(Unit(Size, Size), NumUpdated, false, {});
+  }
+  EXPECT_EQ(A->NumActiveUnits(), 1U);
+  EXPECT_EQ(B->NumActiveUnits(), 1U);
+  for (uint32_t F : Features)
+    EXPECT_EQ(A->FeatureHitCount(F), B->FeatureHitCount(F));
+}
+
+TEST(Fuzzer, MapHugePages) {
+  const size_t Size = kHugePageSize + 100;
+  auto *P = static_cast<uint8_t *>(MapHugePages(Size));
+  ASSERT_NE(P, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(P) % kHugePageSize, 0U);
+  EXPECT_EQ(std::count(P, P + 2 * kHugePageSize, 0), 2 * kHugePageSize);
+  memset(P, 1, 2 * kHugePageSize);
+  EXPECT_LE(HugePageBytes(P, 2 * kHugePageSize), 2 * kHugePageSize);
+  UnmapHugePages(P, Size);
+}
+
+TEST(Corpus, HugePages) {
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  C->AddFeature(7, 3, false);
+  C->AddToCorpus(Unit(3, 'a'), 1, false, {7});
+  size_t Size = 0, HugeSize = ~0UL;
+  ASSERT_TRUE(C->UseHugePages(&Size, &HugeSize));
+  EXPECT_GT(Size, 0U);
+  EXPECT_LE(HugeSize, Size);
+  // The tables keep their contents.
+  EXPECT_FALSE(C->WouldAddFeature(7, 3, true));
+  EXPECT_TRUE(C->WouldAddFeature(7, 2, true));
+  EXPECT_TRUE(C->WouldAddFeature(8, 3, false));
+}
+
+TEST(Corpus, Budget) {
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  Random Rand(0);
+  for (uint8_t i = 0; i < 20; i++)
+    C->AddToCorpus(Unit{i}, 1, false, {});
+  // Unit 0 found nothing in many mutations, unit 1 found diffs and unit 2 is
+  // the only one of its verdict pattern.
+  C->Input(0).NumExecutedMutations = 1000;
+  C->Input(1).NumExecutedMutations = 1000;
+  C->Input(1).NumDiffMutations = 100;
+  C->Input(2).NumExecutedMutations = 1000;
+  C->SetDiffInfo(2, 42, 1);
+  C->SetBudget(16, 0);
+  EXPECT_TRUE(C->OverBudget());
+  C->EvictToBudget();
+  EXPECT_FALSE(C->OverBudget());
+  EXPECT_EQ(C->NumActiveUnits(), 15U);
+  EXPECT_EQ(C->NumEvicted(), 5U);
+  EXPECT_EQ(C->Input(0).Size, 0U);
+  EXPECT_EQ(C->Input(1).Size, 1U);
+  EXPECT_EQ(C->Input(2).Size, 1U);
+  EXPECT_TRUE(C->HasUnit(Unit{0}));
+  for (int i = 0; i < 1000; i++)
+    EXPECT_NE(C->ChooseUnitToMutate(Rand).Size, 0U);
+}
+
+TEST(Corpus, BudgetOfPatterns) {
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  // More verdict patterns than the budget has room for.
+  for (uint8_t i = 0; i < 20; i++) {
+    C->AddToCorpus(Unit{i}, 1, false, {});
+    C->SetDiffInfo(i, 100 + i, 1);
+  }
+  C->AddToCorpus(Unit{20}, 1, false, {});
+  C->AddToCorpus(Unit{21}, 1, false, {});
+  C->SetBudget(16, 0);
+  C->EvictToBudget();
+  // Only the newest unit and one of every pattern are left.
+  EXPECT_EQ(C->NumActiveUnits(), 21U);
+  EXPECT_EQ(C->Input(20).Size, 0U);
+  EXPECT_EQ(C->Input(21).Size, 1U);
+  // The next eviction waits until as much has been added as one frees.
+  EXPECT_FALSE(C->OverBudget());
+  C->AddToCorpus(Unit{22}, 1, false, {});
+  EXPECT_FALSE(C->OverBudget());
+  C->AddToCorpus(Unit{23}, 1, false, {});
+  EXPECT_TRUE(C->OverBudget());
+  C->EvictToBudget();
+  EXPECT_EQ(C->NumActiveUnits(), 21U);
+  EXPECT_EQ(C->Input(22).Size, 0U);
+  EXPECT_EQ(C->Input(23).Size, 1U);
+}
+
+TEST(Corpus, Compression) {
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  C->EnableCompression();
+  Random Rand(0);
+  std::vector<Unit> Units;
+  size_t N = InputCorpus::kMinUnitsToTrain + InputCorpus::kHotUnits + 100;
+  for (size_t i = 0; i < N; i++) {
+    // Like handshakes: a shared structure with a few random fields.
+    Unit U;
+    for (size_t j = 0; j < 8; j++) {
+      std::string S = "extension_" + std::to_string(j) + "_supported_groups";
+      U.insert(U.end(), S.begin(), S.end());
+      U.push_back(static_cast<uint8_t>(Rand(256)));
+    }
+    Units.push_back(U);
+    C->AddToCorpus(U, 1, false, {});
+  }
+  EXPECT_GT(C->DictionarySize(), 0U);
+  EXPECT_GT(C->NumPackedUnits(), 300U);
+  EXPECT_GT(C->NumPackedBytesSaved(),
+            C->NumPackedUnits() * Units[0].size() / 2);
+  for (size_t i = 0; i < N; i++) {
+    UnitRef U = (*C)[i];
+    EXPECT_EQ(Unit(U.begin(), U.end()), Units[i]);
+  }
+  // A view of a compressed unit outlives its place in the cache.
+  UnitRef Held = (*C)[1];
+  for (size_t i = 2; i < 2 + 2 * InputCorpus::kUnpackedCacheSize; i++)
+    (*C)[i];
+  EXPECT_EQ(Unit(Held.begin(), Held.end()), Units[1]);
+  // Compressed units can be replaced by smaller ones and deleted.
+  Unit Smaller(Units[0].begin(), Units[0].end() - 10);
+  C->Replace(&C->Input(0), Smaller);
+  UnitRef U0 = (*C)[0];
+  EXPECT_EQ(Unit(U0.begin(), U0.end()), Smaller);
+  for (size_t i = 1; i < N / 2; i++)
+    C->DeleteInput(i);
+  for (size_t i = N / 2; i < N; i++) {
+    UnitRef U = (*C)[i];
+    EXPECT_EQ(Unit(U.begin(), U.end()), Units[i]);
+  }
+}
+
+TEST(Compress, Dictionary) {
+  Random Rand(0);
+  std::vector<Unit> Units;
+  std::vector<std::pair<const uint8_t *, size_t>> Samples;
+  for (size_t i = 0; i < 200; i++) {
+    std::string S = "ClientHello cipher_suites=" + std::to_string(Rand(1000)) +
+                    " extensions=server_name,supported_versions," +
+                    std::to_string(Rand(1000));
+    Units.push_back(Unit(S.begin(), S.end()));
+  }
+  for (auto &U : Units)
+    Samples.push_back({U.data(), U.size()});
+  std::vector<uint8_t> Dict = TrainDictionary(Samples, 1024);
+  EXPECT_GT(Dict.size(), 0U);
+  EXPECT_LE(Dict.size(), 1024U);
+  size_t Plain = 0, WithDict = 0;
+  for (auto &U : Units) {
+    std::vector<uint8_t> P = Compress(U.data(), U.size());
+    std::vector<uint8_t> D =
+        Compress(U.data(), U.size(), Dict.data(), Dict.size());
+    Plain += P.size();
+    WithDict += D.size();
+    std::vector<uint8_t> Out;
+    EXPECT_TRUE(Decompress(D.data(), D.size(), U.size(), &Out, Dict.data(),
+                           Dict.size()));
+    EXPECT_EQ(Out, U);
+  }
+  EXPECT_LT(WithDict, Plain / 2);
+  EXPECT_TRUE(TrainDictionary({}, 1024).empty());
+}
+
+TEST(LatencyHistogram, Buckets) {
+  size_t NumBuckets = LatencyHistogram::kNumBuckets;
+  for (uint64_t V : {0ULL, 1ULL, 15ULL, 16ULL, 17ULL, 1000ULL, 123456789ULL,
+                     ~0ULL}) {
+    size_t B = LatencyHistogram::BucketOf(V);
+    EXPECT_LT(B, NumBuckets);
+    EXPECT_LE(LatencyHistogram::LowestOf(B), V);
+    if (B + 1 < NumBuckets) {
+      EXPECT_GT(LatencyHistogram::LowestOf(B + 1), V);
+    }
+  }
+}
+
+TEST(LatencyHistogram, Quantile) {
+  LatencyHistogram H;
+  EXPECT_EQ(H.Quantile(0.5), 0U);
+  for (uint64_t i = 1; i <= 1000; i++)
+    H.Record(i * 1000);
+  EXPECT_EQ(H.NumValues(), 1000U);
+  EXPECT_EQ(H.MaxNanos(), 1000000U);
+  EXPECT_EQ(H.SumNanos(), 500500000U);
+  for (double Q : {0.5, 0.9, 0.99}) {
+    double Exact = Q * 1000000;
+    EXPECT_GE(H.Quantile(Q), Exact * 0.93);
+    EXPECT_LE(H.Quantile(Q), Exact * 1.07);
+  }
+  EXPECT_EQ(H.Quantile(1), 1000000U);
+}
+
+TEST(SignatureSet, PackSignature) {
+  int A[] = {0, 1, -1, 127};
+  int B[] = {0, 1, -1, 128};
+  EXPECT_NE(PackSignature(A, 4), PackSignature(A, 3));
+  EXPECT_NE(PackSignature(A, 4), PackSignature(B, 4));
+  EXPECT_EQ(PackSignature(A, 4) >> 63, 0U);
+  EXPECT_EQ(PackSignature(B, 4) >> 63, 1U);
+  EXPECT_EQ(PackSignature(B, 4), PackSignature(B, 4));
+}
+
+TEST(SignatureSet, Insert) {
+  SignatureSet S;
+  for (uint64_t i = 0; i < 1000; i++)
+    EXPECT_TRUE(S.Insert(i * 7));
+  for (uint64_t i = 0; i < 1000; i++)
+    EXPECT_FALSE(S.Insert(i * 7));
+  EXPECT_EQ(S.size(), 1000U);
+  EXPECT_FALSE(S.Contains(1));
+}
+
+TEST(SignatureSet, Limit) {
+  SignatureSet S;
+  S.SetLimit(10);
+  for (uint64_t i = 0; i < 10; i++)
+    EXPECT_TRUE(S.Insert(i));
+  EXPECT_TRUE(S.Insert(10));
+  // 0 is seen again, so it outlives the rest of the first generation.
+  EXPECT_FALSE(S.Insert(0));
+  for (uint64_t i = 11; i < 20; i++)
+    EXPECT_TRUE(S.Insert(i));
+  EXPECT_EQ(S.size(), 11U);
+  EXPECT_TRUE(S.Contains(0));
+  EXPECT_FALSE(S.Contains(1));
+  EXPECT_TRUE(S.Insert(1));
+}
+
+TEST(SignatureSet, SaveLoad) {
+  SignatureSet S;
+  S.SetLimit(10);
+  for (uint64_t i = 0; i < 25; i++)
+    S.Insert(i);
+  std::vector<uint8_t> Saved;
+  S.Save(&Saved);
+  SignatureSet T;
+  T.SetLimit(10);
+  const uint8_t *P = Saved.data();
+  EXPECT_TRUE(T.Load(&P, Saved.data() + Saved.size()));
+  EXPECT_EQ(P, Saved.data() + Saved.size());
+  EXPECT_EQ(T.size(), S.size());
+  for (uint64_t i = 0; i < 25; i++)
+    EXPECT_EQ(T.Contains(i), S.Contains(i));
+  P = Saved.data();
+  EXPECT_FALSE(T.Load(&P, Saved.data() + 8));
+}
+
+TEST(TracePC, EdgeCountBucket) {
+  EXPECT_EQ(TracePC::EdgeCountBucket(0), 0);
+  EXPECT_EQ(TracePC::EdgeCountBucket(1), 1);
+  EXPECT_EQ(TracePC::EdgeCountBucket(2), 2);
+  EXPECT_EQ(TracePC::EdgeCountBucket(3), 2);
+  EXPECT_EQ(TracePC::EdgeCountBucket(4), 3);
+  EXPECT_EQ(TracePC::EdgeCountBucket(1023), 10);
+  EXPECT_EQ(TracePC::EdgeCountBucket(1024), 11);
+}
+
+TEST(Random, Bounded) {
+  Random Rand(0);
+  std::vector<size_t> Hist(3);
+  for (size_t i = 0; i < 30000; i++)
+    Hist[Rand(3)]++;
+  for (size_t H : Hist) {
+    EXPECT_GT(H, 9000U);
+    EXPECT_LT(H, 11000U);
+  }
+  EXPECT_EQ(Rand(0), 0U);
+  EXPECT_EQ(Rand(1), 0U);
+  for (size_t i = 0; i < 1000; i++) {
+    intptr_t V = Rand(-2, 2);
+    EXPECT_GE(V, -2);
+    EXPECT_LE(V, 2);
+  }
+}
+
+TEST(Random, Split) {
+  Random A(7), B(7);
+  Random A1 = A.Split(), B1 = B.Split();
+  // The same seed splits into the same streams.
+  for (size_t i = 0; i < 100; i++) {
+    EXPECT_EQ(A1(), B1());
+    EXPECT_EQ(A(), B());
+  }
+  Random C(7);
+  Random C1 = C.Split();
+  std::set<uint64_t> Child, Parent;
+  for (size_t i = 0; i < 100; i++) {
+    Child.insert(C1());
+    Parent.insert(C());
+  }
+  for (uint64_t V : Child)
+    EXPECT_EQ(Parent.count(V), 0U);
+  EXPECT_NE(Random(1)(), Random(2)());
+}
+
+TEST(WeightedSampler, Find) {
+  WeightedSampler S;
+  std::vector<uint64_t> W = {3, 0, 5, 1, 0, 0, 7, 2, 4};
+  for (uint64_t X : W)
+    S.PushBack(X);
+  EXPECT_EQ(S.Total(), 22U);
+  uint64_t Begin = 0;
+  for (size_t i = 0; i < W.size(); i++) {
+    for (uint64_t X = Begin; X < Begin + W[i]; X++)
+      EXPECT_EQ(S.Find(X), i);
+    Begin += W[i];
+  }
+  S.Set(2, 0);
+  S.Set(4, 6);
+  EXPECT_EQ(S.Total(), 23U);
+  EXPECT_EQ(S.Find(3), 3U);
+  EXPECT_EQ(S.Find(4), 4U);
+  EXPECT_EQ(S.Find(9), 4U);
+  EXPECT_EQ(S.Find(10), 6U);
+  EXPECT_EQ(S.Find(22), 8U);
+}
+
+TEST(WeightedSampler, Sample) {
+  Random Rand(0);
+  WeightedSampler S;
+  size_t N = 100;
+  for (size_t i = 0; i < N; i++)
+    S.PushBack(i % 2 ? i + 1 : 0);
+  std::vector<size_t> Hist(N);
+  for (size_t i = 0; i < N * 1000; i++)
+    Hist[S.Sample(Rand)]++;
+  for (size_t i = 0; i < N; i++) {
+    if (i % 2)
+      EXPECT_GT(Hist[i], 0U);
+    else
+      EXPECT_EQ(Hist[i], 0U);
+  }
+  EXPECT_GT(Hist[99], Hist[1] * 10);
+}
+
 TEST(Merge, Bad) {
   const char *kInvalidInputs[] = {
     "",
@@ -723,6 +1637,91 @@ TEST(Merge, Good) {
   EQ(NewFiles, {"B"});
 }
 
+TEST(Merge, Results) {
+  Merger M;
+  EXPECT_FALSE(M.Parse("1\n0\nA\nRESULTS 0 1\n", true));
+  EXPECT_TRUE(M.Parse("2\n0\nA\nB\n"
+                      "STARTED 0 10\nDONE 0 1 2\nRESULTS 0 0 -1 7\n"
+                      "STARTED 1 20\nDONE 1 3\n", true));
+  EXPECT_EQ(M.Files[0].Results, std::vector<int>({0, -1, 7}));
+  EXPECT_TRUE(M.Files[1].Results.empty());
+}
+
+TEST(Merge, Binary) {
+  std::string CF = "LIBFUZZER_MERGE_CONTROL 1\n2\n1\nA\nB\n";
+  Merger::AppendStarted(&CF, true, 0, 10);
+  Merger::AppendDone(&CF, true, 0, {3, 300, 70000});
+  Merger::AppendResults(&CF, true, 0, {0, -1, 7});
+  Merger::AppendStarted(&CF, true, 1, 20);
+  Merger M;
+  EXPECT_TRUE(M.Parse(CF, true));
+  EXPECT_TRUE(M.Binary);
+  EXPECT_EQ(M.NumFilesInFirstCorpus, 1U);
+  EXPECT_EQ(M.FirstNotProcessedFile, 2U);
+  EXPECT_EQ(M.LastFailure, "B");
+  EXPECT_EQ(M.Files[0].Size, 10U);
+  EQ(M.Files[0].Features, {3, 300, 70000});
+  EXPECT_EQ(M.Files[0].Results, std::vector<int>({0, -1, 7}));
+  EXPECT_EQ(M.Files[1].Size, 20U);
+
+  // A torn last record is left out.
+  size_t Complete = CF.size();
+  Merger::AppendDone(&CF, true, 1, {1, 2, 3});
+  for (size_t Cut = Complete; Cut < CF.size(); Cut++) {
+    EXPECT_TRUE(M.Parse(CF.substr(0, Cut), true));
+    EXPECT_EQ(M.ParsedSize, Complete);
+    EXPECT_EQ(M.TornSize, Cut - Complete);
+    EXPECT_EQ(M.LastFailure, "B");
+  }
+  EXPECT_TRUE(M.Parse(CF, true));
+  EXPECT_EQ(M.TornSize, 0U);
+  EXPECT_TRUE(M.LastFailure.empty());
+  EQ(M.Files[1].Features, {1, 2, 3});
+
+  // Out-of-order markers are rejected as in the text format.
+  std::string Bad = "LIBFUZZER_MERGE_CONTROL 1\n1\n1\nA\n";
+  Merger::AppendDone(&Bad, true, 0, {1});
+  EXPECT_FALSE(M.Parse(Bad, true));
+
+  // The text markers read back the same.
+  std::string Text = "2\n1\nA\nB\n";
+  Merger::AppendStarted(&Text, false, 0, 10);
+  Merger::AppendDone(&Text, false, 0, {3, 300, 70000});
+  Merger::AppendResults(&Text, false, 0, {0, -1, 7});
+  EXPECT_TRUE(M.Parse(Text, true));
+  EXPECT_FALSE(M.Binary);
+  EQ(M.Files[0].Features, {3, 300, 70000});
+  EXPECT_EQ(M.Files[0].Results, std::vector<int>({0, -1, 7}));
+}
+
+TEST(Merge, Summary) {
+  Merger M;
+  EXPECT_TRUE(M.Parse("2\n0\nA\nB C\n"
+                      "STARTED 0 10\nDONE 0 1 2 a0\nRESULTS 0 0 1\n"
+                      "STARTED 1 20\nDONE 1 3\nRESULTS 1 1 1\n", true));
+  M.Files[0].Sha1 = "aa";
+  M.Files[1].Sha1 = "bb";
+  std::stringstream SS;
+  M.PrintSummary(SS, 2, [](uint32_t F) { return F >= 0xa0 ? 1 : -1; });
+  std::vector<MergeFileInfo> Records;
+  EXPECT_EQ(Merger::ParseSummary(SS, &Records),
+            std::set<uint32_t>({1, 2, 3, 0xa0}));
+  ASSERT_EQ(Records.size(), 2U);
+  EXPECT_EQ(Records[0].Sha1, "aa");
+  EXPECT_EQ(Records[0].Size, 10U);
+  EXPECT_EQ(Records[0].Name, "A");
+  EQ(Records[0].Features, {1, 2, 0xa0});
+  EXPECT_EQ(Records[0].Results, std::vector<int>({0, 1}));
+  EXPECT_EQ(Records[1].Name, "B C");
+  EQ(Records[1].Features, {3});
+
+  // Version 1 summaries have features but no records.
+  std::stringstream V1("A size: a features:  1 2\nB size: 14 features:  3\n");
+  Records.clear();
+  EXPECT_EQ(Merger::ParseSummary(V1, &Records), std::set<uint32_t>({1, 2, 3}));
+  EXPECT_TRUE(Records.empty());
+}
+
 TEST(Merge, Merge) {
 
   Merge("3\n1\nA\nB\nC\n"
@@ -785,3 +1784,908 @@ TEST(Fuzzer, ForEachNonZeroByte) {
               {135, 5}, {137, 6}, {146, 7}};
   EXPECT_EQ(Res, Expected);
 }
+
+TEST(PackedCorpus, AppendAndReopen) {
+  std::string Path =
+      "/tmp/libFuzzerPackedCorpusTest." + std::to_string(GetPid());
+  {
+    PackedCorpus P;
+    EXPECT_TRUE(P.Open(Path));
+    EXPECT_EQ(P.size(), 0U);
+    uint8_t A[] = {1, 2, 3};
+    EXPECT_TRUE(P.Append(A, sizeof(A)));
+    EXPECT_TRUE(P.Append(A, 0));
+    EXPECT_EQ(P.size(), 0U);
+    EXPECT_EQ(P.Refresh(), 2U);
+    EXPECT_EQ(P.UnitSize(0), 3U);
+    EXPECT_EQ(P.UnitSize(1), 0U);
+    EXPECT_EQ(Unit(P.UnitData(0), P.UnitData(0) + 3), Unit({1, 2, 3}));
+  }
+  PackedCorpus P, Q;
+  EXPECT_TRUE(P.Open(Path));
+  EXPECT_TRUE(Q.Open(Path));
+  EXPECT_EQ(P.size(), 2U);
+  uint8_t B[] = {4, 5};
+  EXPECT_TRUE(Q.Append(B, sizeof(B)));
+  EXPECT_EQ(P.Refresh(), 3U);
+  EXPECT_EQ(Unit(P.UnitData(2), P.UnitData(2) + 2), Unit({4, 5}));
+  RemoveFile(Path + ".idx");
+  RemoveFile(Path + ".blob");
+}
+
+TEST(DiffPack, AppendAndFindClass) {
+  std::string Path = "/tmp/libFuzzerDiffPackTest." + std::to_string(GetPid());
+  DiffPack P;
+  EXPECT_TRUE(P.Open(Path));
+  DiffRecord A;
+  A.ClassHash = 7;
+  A.Fingerprint = {1, 2};
+  A.Results = {0, -1, 0};
+  A.Input = {1, 2, 3};
+  A.Parent = {1, 2};
+  A.MutationSequence = "MS: 1 InsertByte-";
+  DiffRecord B;
+  B.ClassHash = 9;
+  B.Results = {1, 0};
+  B.Input = {4};
+  EXPECT_TRUE(P.Append(A));
+  EXPECT_TRUE(P.Append(B));
+  EXPECT_TRUE(P.Append(A));
+  EXPECT_EQ(P.Refresh(), 3U);
+  EXPECT_EQ(P.ClassOf(1), 9U);
+  EXPECT_EQ(P.FindClass(7), std::vector<size_t>({0, 2}));
+  EXPECT_TRUE(P.FindClass(8).empty());
+  DiffRecord R;
+  EXPECT_TRUE(P.Read(2, &R));
+  EXPECT_EQ(R.ClassHash, 7U);
+  EXPECT_EQ(R.Fingerprint, A.Fingerprint);
+  EXPECT_EQ(R.Results, A.Results);
+  EXPECT_EQ(R.Input, A.Input);
+  EXPECT_EQ(R.Parent, A.Parent);
+  EXPECT_EQ(R.MutationSequence, A.MutationSequence);
+  EXPECT_TRUE(P.Read(1, &R));
+  EXPECT_TRUE(R.Parent.empty());
+  EXPECT_TRUE(R.MutationSequence.empty());
+  RemoveFile(Path + ".idx");
+  RemoveFile(Path + ".blob");
+}
+
+TEST(OutputOracle, ParseAndMap) {
+  OutputOracle O;
+  EXPECT_TRUE(O.Parse("# alerts\n"
+                      "* 40 47 50-52  # handshake failures\n"
+                      "1 0 21\n",
+                      3, 0));
+  EXPECT_TRUE(O.IsActive());
+  EXPECT_EQ(O.NumClasses(), 2U);
+  EXPECT_EQ(O.NumCodes(), 3U * 5 + 2);
+  EXPECT_EQ(O.Map(0, 47), 40);
+  EXPECT_EQ(O.Map(2, 51), 40);
+  EXPECT_EQ(O.Map(0, 48), 48);
+  EXPECT_EQ(O.Map(1, 21), 0);
+  EXPECT_EQ(O.Map(0, 21), 21);
+  EXPECT_EQ(O.Map(0, -1), -1);
+  EXPECT_EQ(O.Map(0, 1000), 1000);
+  int Results[3] = {47, 21, 40};
+  EXPECT_TRUE(O.Apply(Results, 3));
+  EXPECT_EQ(Results[0], 40);
+  EXPECT_EQ(Results[1], 0);
+  EXPECT_FALSE(O.Apply(Results, 3));
+  // With -diff_verdict_bits=8 the signature bits stay.
+  EXPECT_TRUE(O.Parse("* 1 2", 2, 8));
+  EXPECT_EQ(O.Map(1, 0x1202), 0x1201);
+  EXPECT_EQ(O.Map(1, 0x1203), 0x1203);
+  EXPECT_FALSE(O.Parse("* 1 300", 2, 8));
+  EXPECT_FALSE(O.Parse("2 1 2", 2, 0));
+  EXPECT_FALSE(O.Parse("* 1 2\n0 2 3", 2, 0));
+  EXPECT_FALSE(O.Parse("* 1 x", 2, 0));
+  EXPECT_FALSE(O.Parse("* 0 100000", 2, 0));
+  EXPECT_FALSE(O.Parse("# nothing\n", 2, 0));
+  EXPECT_TRUE(O.Parse("0 -3--1 5", 1, 0));
+  EXPECT_EQ(O.Map(0, -2), -3);
+  EXPECT_EQ(O.Map(0, 5), -3);
+  EXPECT_EQ(O.Map(0, 0), 0);
+}
+
+TEST(RoaringBitmap, SetOperations) {
+  RoaringBitmap A, B;
+  for (uint32_t i = 0; i < 10000; i += 2)  // A bitmap container.
+    A.Add(i);
+  A.Add(1 << 20);
+  A.Add(7);
+  A.Add(7);
+  EXPECT_EQ(A.Cardinality(), 5002U);
+  EXPECT_TRUE(A.Contains(7));
+  EXPECT_TRUE(A.Contains(9998));
+  EXPECT_FALSE(A.Contains(9));
+  for (uint32_t i = 0; i < 100; i++)  // An array container.
+    B.Add(i);
+  B.Add(1 << 20);
+  B.Add(3 << 20);
+  RoaringBitmap And = A, Or = A, AndNot = A;
+  And.IntersectWith(B);
+  Or.UnionWith(B);
+  AndNot.Subtract(B);
+  EXPECT_EQ(And.Cardinality(), 52U);
+  EXPECT_TRUE(And.Contains(7));
+  EXPECT_TRUE(And.Contains(1 << 20));
+  EXPECT_FALSE(And.Contains(3 << 20));
+  EXPECT_EQ(Or.Cardinality(), 5002U + 49 + 1);
+  EXPECT_TRUE(Or.Contains(99));
+  EXPECT_EQ(AndNot.Cardinality(), 5002U - 52);
+  EXPECT_FALSE(AndNot.Contains(50));
+  EXPECT_TRUE(AndNot.Contains(100));
+  RoaringBitmap Back = AndNot;
+  Back.UnionWith(And);
+  EXPECT_EQ(Back, A);
+  std::vector<uint32_t> Values;
+  And.ForEach([&](uint32_t V) { Values.push_back(V); });
+  EXPECT_EQ(Values.size(), 52U);
+  EXPECT_TRUE(std::is_sorted(Values.begin(), Values.end()));
+  And.Subtract(A);
+  EXPECT_TRUE(And.empty());
+}
+
+TEST(RoaringBitmap, Serialize) {
+  RoaringBitmap A, B;
+  for (uint32_t i = 0; i < 5000; i++)
+    A.Add(i * 3);
+  A.Add(70000);
+  std::vector<uint8_t> Buf(A.SerializedSize());
+  A.Serialize(Buf.data());
+  // The portable format: cookie 12346, two containers, 5000 values in the
+  // first one.
+  EXPECT_EQ(Buf[0] | Buf[1] << 8, 12346);
+  EXPECT_EQ(Buf[4], 2);
+  EXPECT_EQ(Buf[10] | Buf[11] << 8, 4999);
+  EXPECT_TRUE(B.Deserialize(Buf.data(), Buf.size()));
+  EXPECT_EQ(A, B);
+  EXPECT_FALSE(B.Deserialize(Buf.data(), Buf.size() - 1));
+  EXPECT_TRUE(B.empty());
+  Buf[0]++;
+  EXPECT_FALSE(B.Deserialize(Buf.data(), Buf.size()));
+  RoaringBitmap Empty;
+  Buf.resize(Empty.SerializedSize());
+  Empty.Serialize(Buf.data());
+  EXPECT_TRUE(B.Deserialize(Buf.data(), Buf.size()));
+  EXPECT_TRUE(B.empty());
+}
+
+TEST(EdgeStore, AppendAndQuery) {
+  std::string Path = "/tmp/libFuzzerEdgeStoreTest." + std::to_string(GetPid());
+  EdgeStore S;
+  EXPECT_TRUE(S.Open(Path));
+  auto Record = [](uint64_t Class, std::vector<uint32_t> Edges0,
+                   std::vector<uint32_t> Edges1) {
+    EdgeSetRecord R;
+    R.ClassHash = Class;
+    R.Results = {0, 1};
+    R.Edges.resize(2);
+    for (uint32_t E : Edges0) R.Edges[0].Add(E);
+    for (uint32_t E : Edges1) R.Edges[1].Add(E);
+    return R;
+  };
+  EdgeSetRecord A = Record(7, {1, 2, 3}, {10, 11});
+  A.Fingerprint = {1, 2};
+  A.Sha1[0] = 0xab;
+  EXPECT_TRUE(S.Append(A));
+  EXPECT_TRUE(S.Append(Record(7, {2, 3, 4}, {11})));
+  EXPECT_TRUE(S.Append(Record(9, {3, 5}, {})));
+  EXPECT_EQ(S.Refresh(), 3U);
+  EXPECT_EQ(S.ClassOf(2), 9U);
+  EXPECT_EQ(S.NumCallbacks(0), 2U);
+  EdgeSetRecord R;
+  EXPECT_TRUE(S.Read(0, &R));
+  EXPECT_EQ(R.ClassHash, 7U);
+  EXPECT_EQ(R.Fingerprint, A.Fingerprint);
+  EXPECT_EQ(R.Sha1[0], 0xab);
+  EXPECT_EQ(R.Results, A.Results);
+  EXPECT_EQ(R.Edges[0], A.Edges[0]);
+  EXPECT_EQ(R.Edges[1], A.Edges[1]);
+  RoaringBitmap B;
+  EXPECT_TRUE(S.ReadEdges(1, 1, &B));
+  EXPECT_EQ(B.Cardinality(), 1U);
+  EXPECT_FALSE(S.ReadEdges(1, 2, &B));
+  auto Classes = S.QueryClasses(0);
+  ASSERT_EQ(Classes.size(), 2U);
+  EXPECT_EQ(Classes[0].ClassHash, 7U);
+  EXPECT_EQ(Classes[0].NumRecords, 2U);
+  EXPECT_EQ(Classes[0].Common.Cardinality(), 2U);  // 2 and 3.
+  EXPECT_EQ(Classes[0].Unique.Cardinality(), 3U);  // 1, 2 and 4.
+  EXPECT_EQ(Classes[1].Unique.Cardinality(), 1U);  // 5.
+  EXPECT_TRUE(Classes[1].Unique.Contains(5));
+  RemoveFile(Path + ".idx");
+  RemoveFile(Path + ".blob");
+}
+
+// An Ethernet/IPv4/TCP frame from port SrcPort to port DstPort.
+static Unit TcpFrame(uint16_t SrcPort, uint16_t DstPort, uint32_t Seq,
+                     uint8_t Flags, const Unit &Payload) {
+  size_t IpLen = 40 + Payload.size();
+  Unit F = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0x08, 0x00,
+            0x45, 0, uint8_t(IpLen >> 8), uint8_t(IpLen), 0, 0, 0, 0, 64, 6,
+            0, 0, 10, 0, 0, 1, 10, 0, 0, 2,
+            uint8_t(SrcPort >> 8), uint8_t(SrcPort), uint8_t(DstPort >> 8),
+            uint8_t(DstPort), uint8_t(Seq >> 24), uint8_t(Seq >> 16),
+            uint8_t(Seq >> 8), uint8_t(Seq), 0, 0, 0, 0, 0x50, Flags, 1, 0,
+            0, 0, 0, 0};
+  F.insert(F.end(), Payload.begin(), Payload.end());
+  return F;
+}
+
+// A pcap file of Ethernet Frames.
+static Unit PcapFile(const std::vector<Unit> &Frames) {
+  Unit File = {0xd4, 0xc3, 0xb2, 0xa1, 2, 0, 4, 0, 0, 0, 0, 0,
+               0, 0, 0, 0, 0xff, 0xff, 0, 0, 1, 0, 0, 0};
+  for (auto &F : Frames) {
+    uint8_t Len[4] = {uint8_t(F.size()), uint8_t(F.size() >> 8), 0, 0};
+    File.insert(File.end(), 8, 0);  // Timestamp.
+    File.insert(File.end(), Len, Len + 4);
+    File.insert(File.end(), Len, Len + 4);
+    File.insert(File.end(), F.begin(), F.end());
+  }
+  return File;
+}
+
+TEST(PcapSeedImporter, ReassemblesClientHellos) {
+  // A ClientHello of 10 bytes in one record, and a ServerHello.
+  Unit Hello = {0x16, 3, 1, 0, 14, 1, 0, 0, 10};
+  for (uint8_t i = 0; i < 10; i++) Hello.push_back(i);
+  Unit ServerHello = Hello;
+  ServerHello[5] = 2;
+  const uint8_t kSyn = 2, kAck = 0x10, kFin = 1;
+  std::vector<Unit> Frames = {
+      TcpFrame(1000, 443, 99, kSyn, {}),
+      // The second half comes first, then the first half twice.
+      TcpFrame(1000, 443, 107, kAck, Unit(Hello.begin() + 7, Hello.end())),
+      TcpFrame(1000, 443, 100, kAck, Unit(Hello.begin(), Hello.begin() + 7)),
+      TcpFrame(1000, 443, 100, kAck, Unit(Hello.begin(), Hello.begin() + 7)),
+      TcpFrame(443, 1000, 500, kAck, ServerHello),
+      // The same ClientHello in a stream the capture joined late.
+      TcpFrame(1001, 443, 7, kAck, Hello),
+      TcpFrame(1002, 80, 1, kAck, {'G', 'E', 'T', ' ', '/', '\n'}),
+      TcpFrame(1000, 443, 119, kFin, {}),
+  };
+  std::string Path = "/tmp/libFuzzerPcapTest." + std::to_string(GetPid());
+  WriteToFile(PcapFile(Frames), Path);
+  PcapSeedImporter Importer(1, 0);
+  UnitVector Seeds;
+  EXPECT_TRUE(Importer.ReadFile(Path, &Seeds));
+  EXPECT_EQ(Importer.NumPackets(), Frames.size());
+  ASSERT_EQ(Seeds.size(), 1U);
+  EXPECT_EQ(Seeds[0], Hello);
+  EXPECT_EQ(Importer.NumDuplicates(), 1U);
+  // Seen in an earlier file.
+  EXPECT_TRUE(Importer.ReadFile(Path, &Seeds));
+  EXPECT_EQ(Seeds.size(), 1U);
+  RemoveFile(Path);
+  EXPECT_FALSE(Importer.ReadFile(Path, &Seeds));
+}
+
+TEST(PcapSeedImporter, ForgetsDoneStreamsWhenFull) {
+  // 64K streams seeded without a FIN fill the table; one more still counts.
+  Unit Hello = {0x16, 3, 1, 0, 6, 1, 0, 0, 2, 'h', 'i'};
+  Unit OtherHello = {0x16, 3, 1, 0, 6, 1, 0, 0, 2, 'h', 'o'};
+  std::vector<Unit> Frames;
+  for (size_t Port = 0; Port < (1 << 16); Port++)
+    Frames.push_back(TcpFrame(uint16_t(Port), 443, 1, 0x10, Hello));
+  Frames.push_back(TcpFrame(1000, 444, 1, 0x10, OtherHello));
+  std::string Path = "/tmp/libFuzzerPcapTest." + std::to_string(GetPid());
+  WriteToFile(PcapFile(Frames), Path);
+  PcapSeedImporter Importer(1, 0);
+  UnitVector Seeds;
+  EXPECT_TRUE(Importer.ReadFile(Path, &Seeds));
+  RemoveFile(Path);
+  ASSERT_EQ(Seeds.size(), 2U);
+  EXPECT_EQ(Seeds[1], OtherHello);
+  EXPECT_EQ(Importer.NumDroppedStreams(), 0U);
+}
+
+TEST(PcapSeedImporter, SeedLength) {
+  Unit Hello = {0x16, 3, 1, 0, 6, 1, 0, 0, 2, 'h', 'i'};
+  Unit KeyExchange = {0x16, 3, 1, 0, 2, 16, 0};
+  Unit ChangeCipherSpec = {0x14, 3, 1, 0, 1, 1};
+  Unit Finished = {0x16, 3, 1, 0, 3, 'e', 'n', 'c'};
+  Unit AppData = {0x17, 3, 1, 0, 1, 'x'};
+  Unit Stream;
+  for (auto *R : {&Hello, &KeyExchange, &ChangeCipherSpec, &Finished, &AppData})
+    Stream.insert(Stream.end(), R->begin(), R->end());
+  size_t SecondFlightEnd = Stream.size() - AppData.size();
+  bool Complete;
+  EXPECT_EQ(PcapSeedImporter::SeedLength(Stream.data(), Stream.size(), 1,
+                                         &Complete), Hello.size());
+  EXPECT_TRUE(Complete);
+  EXPECT_EQ(PcapSeedImporter::SeedLength(Stream.data(), Stream.size(), 2,
+                                         &Complete), SecondFlightEnd);
+  EXPECT_TRUE(Complete);
+  // Up to the last whole record while the second flight is incomplete.
+  EXPECT_EQ(PcapSeedImporter::SeedLength(Stream.data(), Hello.size() + 3, 2,
+                                         &Complete), Hello.size());
+  EXPECT_FALSE(Complete);
+  EXPECT_EQ(PcapSeedImporter::SeedLength(Stream.data(), 4, 1, &Complete), 0U);
+  EXPECT_FALSE(Complete);
+  Unit Http = {'G', 'E', 'T', ' ', '/', ' ', 'H'};
+  EXPECT_EQ(PcapSeedImporter::SeedLength(Http.data(), Http.size(), 1,
+                                         &Complete), 0U);
+  EXPECT_TRUE(Complete);
+}
+
+TEST(Compress, RoundTrip) {
+  Random Rand(0);
+  std::vector<Unit> Inputs = {{}, {7}, Unit(1000, 'A')};
+  Unit Text;
+  for (size_t i = 0; i < 300; i++)
+    for (char C : std::string("ClientHello ") + std::to_string(i % 7))
+      Text.push_back(C);
+  Inputs.push_back(Text);
+  Unit Noise(70000);
+  for (auto &B : Noise)
+    B = Rand(256);
+  Inputs.push_back(Noise);
+  for (auto &U : Inputs) {
+    std::vector<uint8_t> Packed = Compress(U.data(), U.size());
+    std::vector<uint8_t> Out;
+    EXPECT_TRUE(Decompress(Packed.data(), Packed.size(), U.size(), &Out));
+    EXPECT_EQ(Out, U);
+    if (U.size() >= 1000 && U != Noise) {
+      EXPECT_LT(Packed.size(), U.size() / 4);
+    }
+    // Truncated or mislabelled data is rejected, not overrun.
+    if (Packed.size() > 1) {
+      EXPECT_FALSE(
+          Decompress(Packed.data(), Packed.size() - 1, U.size(), &Out));
+    }
+    EXPECT_FALSE(Decompress(Packed.data(), Packed.size(), U.size() + 1, &Out));
+  }
+}
+
+TEST(Sync, LogDeduplicatesAndSkipsOwnEntries) {
+  SyncBatch A;
+  A.Units = {{1, 2}, {3}};
+  A.DiffFingerprints = {{5, 6}};
+  std::vector<uint8_t> Raw = A.Encode();
+  EXPECT_EQ(Raw.size(), A.ByteSize());
+  SyncBatch Copy;
+  EXPECT_TRUE(Copy.Decode(Raw.data(), Raw.size()));
+  EXPECT_EQ(Copy.Units, A.Units);
+  EXPECT_EQ(Copy.DiffFingerprints.size(), 1U);
+  EXPECT_FALSE(Copy.Decode(Raw.data(), Raw.size() - 1));
+
+  SyncLog L;
+  EXPECT_EQ(L.Add(1, A), 3U);
+  SyncBatch B;
+  B.Units = {{3}, {4}};
+  B.DiffFingerprints = {{5, 6}, {7, 8}};
+  EXPECT_EQ(L.Add(2, B), 2U);
+  EXPECT_EQ(L.NumDuplicates(), 2U);
+
+  SyncBatch Out;
+  EXPECT_EQ(L.Collect(1, 0, 1 << 20, &Out), 5U);
+  EXPECT_EQ(Out.Units, std::vector<Unit>({{4}}));
+  EXPECT_EQ(Out.DiffFingerprints.size(), 1U);
+  EXPECT_EQ(L.Collect(3, 0, 1, &Out), 1U);
+  EXPECT_EQ(Out.Units, std::vector<Unit>({{1, 2}}));
+  EXPECT_EQ(L.Collect(2, 5, 1 << 20, &Out), 5U);
+  EXPECT_TRUE(Out.empty());
+  // A cursor from an earlier coordinator starts over.
+  EXPECT_EQ(L.Collect(2, 9, 1 << 20, &Out), 5U);
+  EXPECT_EQ(Out.Units.size(), 2U);
+}
+
+TEST(MetricsServer, ServesLastPage) {
+  MetricsServer M;
+  int Port = 0;
+  for (int i = 0; i < 50 && !Port; i++)
+    if (M.Start(20000 + (GetPid() + i * 997) % 40000))
+      Port = 20000 + (GetPid() + i * 997) % 40000;
+  ASSERT_NE(Port, 0);
+  auto Scrape = [&]() {
+    int Fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in Addr = {};
+    Addr.sin_family = AF_INET;
+    Addr.sin_port = htons(static_cast<uint16_t>(Port));
+    Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    std::string Res;
+    if (!connect(Fd, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr))) {
+      const char Request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+      EXPECT_EQ(send(Fd, Request, sizeof(Request) - 1, 0),
+                static_cast<ssize_t>(sizeof(Request) - 1));
+      char Buf[256];
+      ssize_t N;
+      while ((N = recv(Fd, Buf, sizeof(Buf), 0)) > 0)
+        Res.append(Buf, N);
+    }
+    close(Fd);
+    return Res;
+  };
+  M.Publish("a 1\n");
+  M.Publish("b 2\n");
+  std::string Res = Scrape();
+  EXPECT_EQ(Res.compare(0, 15, "HTTP/1.0 200 OK"), 0);
+  EXPECT_NE(Res.find("Content-Length: 4\r\n\r\nb 2\n"), std::string::npos);
+  EXPECT_EQ(Res.find("a 1"), std::string::npos);
+  M.Stop();
+  EXPECT_FALSE(M.IsRunning());
+  EXPECT_EQ(Scrape(), "");
+}
+
+TEST(AsyncWriter, FilesAndPack) {
+  std::string Path = "/tmp/libFuzzerAsyncWriterTest." + std::to_string(GetPid());
+  AsyncWriter W;
+  EXPECT_TRUE(W.Start(1 << 20, Path + ".pack"));
+  EXPECT_TRUE(W.Write({1, 2, 3}, Path + ".unit", /*ToPack=*/false));
+  EXPECT_TRUE(W.Write({'a', 'b'}, "dir/diff_1_0", /*ToPack=*/true));
+  W.Stop();
+  EXPECT_EQ(W.NumWritten(), 2U);
+  EXPECT_EQ(FileToVector(Path + ".unit"), Unit({1, 2, 3}));
+  EXPECT_EQ(FileToString(Path + ".pack"), "diff_1_0 2\nab");
+  RemoveFile(Path + ".unit");
+  RemoveFile(Path + ".pack");
+}
+
+TEST(AsyncWriter, QueueLimit) {
+  AsyncWriter W;
+  EXPECT_TRUE(W.Start(4, ""));
+  // The writer may or may not have taken the first unit off the queue yet,
+  // but a unit larger than the whole queue only fits into an empty one.
+  EXPECT_TRUE(W.Write(Unit(8), "/dev/null", false));
+  size_t Dropped = 0;
+  for (int i = 0; i < 100; i++)
+    Dropped += !W.Write(Unit(8), "/dev/null", false);
+  W.Stop();
+  EXPECT_EQ(W.NumDropped(), Dropped);
+  EXPECT_EQ(W.NumWritten() + W.NumDropped(), 101U);
+}
+
+TEST(AsyncWriter, Batch) {
+  std::string Path = "/tmp/libFuzzerAsyncWriterBatch." + std::to_string(GetPid());
+  AsyncWriter W;
+  // Nothing is written before the batch is full, or the writer is stopped.
+  EXPECT_TRUE(W.Start(1 << 20, Path + ".pack", 4, std::chrono::minutes(10),
+                      /*Sync=*/true));
+  for (uint8_t i = 0; i < 3; i++)
+    EXPECT_TRUE(W.Write({i}, "diff_" + std::to_string(i), /*ToPack=*/true));
+  EXPECT_EQ(W.NumWritten(), 0U);
+  W.Stop();
+  EXPECT_EQ(W.NumWritten(), 3U);
+  EXPECT_EQ(W.NumBatches(), 1U);
+  EXPECT_EQ(FileToVector(Path + ".pack").size(), 3 * 10U);
+  RemoveFile(Path + ".pack");
+}
+
+TEST(SpscRing, FullAndEmpty) {
+  SpscRing<int> R(2);
+  EXPECT_EQ(R.Front(), nullptr);
+  for (int i = 0; i < 2; i++) {
+    ASSERT_NE(R.Back(), nullptr);
+    *R.Back() = i;
+    R.Push();
+  }
+  EXPECT_EQ(R.Back(), nullptr);
+  EXPECT_EQ(*R.Front(), 0);
+  R.Pop();
+  ASSERT_NE(R.Back(), nullptr);
+  *R.Back() = 2;
+  R.Push();
+  EXPECT_EQ(*R.Front(), 1);
+  R.Pop();
+  EXPECT_EQ(*R.Front(), 2);
+  R.Pop();
+  EXPECT_EQ(R.Front(), nullptr);
+}
+
+TEST(SpscRing, KeepsOrderAcrossThreads) {
+  SpscRing<Unit> R(4);
+  const size_t N = 10000;
+  std::thread Producer([&] {
+    for (size_t i = 0; i < N; i++) {
+      Unit *U;
+      while (!(U = R.Back()))
+        std::this_thread::yield();
+      U->assign(i % 7 + 1, static_cast<uint8_t>(i));
+      R.Push();
+    }
+  });
+  for (size_t i = 0; i < N; i++) {
+    Unit *U;
+    while (!(U = R.Front()))
+      std::this_thread::yield();
+    EXPECT_EQ(*U, Unit(i % 7 + 1, static_cast<uint8_t>(i)));
+    R.Pop();
+  }
+  Producer.join();
+}
+
+TEST(StatsLog, Push) {
+  std::string Path = "/tmp/libFuzzerStatsLogTest." + std::to_string(GetPid());
+  StatsLog L;
+  EXPECT_TRUE(L.Start(Path));
+  L.Push({20, 1, 2, 3, 0});
+  L.Push({40, 5, 6, 7, 1});
+  L.Stop();
+  EXPECT_FALSE(L.IsRunning());
+  std::string Log = FileToString(Path);
+  EXPECT_EQ(Log, "20\t1\t2\t3\t0\n40\t5\t6\t7\t1\n");
+  EXPECT_EQ(L.NumDropped(), 0U);
+  RemoveFile(Path);
+}
+
+TEST(Tracer, WritesChromeTrace) {
+  std::string Path = "/tmp/libFuzzerTracerTest." + std::to_string(GetPid());
+  Tracer T;
+  EXPECT_TRUE(T.Start(Path));
+  { TraceScope<> S(T, TS_Execute, 3); }
+  T.Record(TS_Mutate, -1, 1000, 3500);
+  T.Stop();
+  EXPECT_FALSE(T.IsRunning());
+  std::string Trace = FileToString(Path);
+  if (kTraceHooks) {
+    EXPECT_EQ(Trace.front(), '[');
+    EXPECT_NE(Trace.find("\"name\":\"Execute\""), std::string::npos);
+    EXPECT_NE(Trace.find("\"callback\":3"), std::string::npos);
+    EXPECT_NE(Trace.find("\"name\":\"Mutate\""), std::string::npos);
+    EXPECT_EQ(Trace.find("\"callback\":-1"), std::string::npos);
+  }
+  RemoveFile(Path);
+}
+
+TEST(Tracer, CountsStages) {
+  Tracer T;
+  // Machines without hardware counters, such as most VMs, can't count.
+  if (!kTraceHooks)
+    GTEST_SKIP() << "built without the trace hooks";
+  if (!T.StartCounters())
+    GTEST_SKIP() << "no hardware performance counters";
+  EXPECT_TRUE(T.IsActive());
+  EXPECT_FALSE(T.IsRunning());
+  for (int i = 0; i < 3; i++) {
+    TraceScope<> S(T, TS_Execute, 1);
+  }
+  { TraceScope<> S(T, TS_Mutate); }
+  std::string Page;
+  T.FormatCounterMetrics(&Page);
+  EXPECT_NE(Page.find("libfuzzer_stage_scopes_total{stage=\"execute\","
+                      "callback=\"1\"} 3\n"),
+            std::string::npos);
+  EXPECT_NE(Page.find("libfuzzer_stage_scopes_total{stage=\"mutate\"} 1\n"),
+            std::string::npos);
+  EXPECT_NE(Page.find("stage=\"mutate\",event=\"cycles\"}"),
+            std::string::npos);
+  EXPECT_EQ(Page.find("dedup_hash"), std::string::npos);
+}
+
+TEST(Fuzzer, ForEachNonZeroByteSparse) {
+  Random Rand(0);
+  std::vector<uint8_t> Ar(10000);
+  for (int i = 0; i < 50; i++)
+    Ar[Rand(Ar.size())] = Rand(255) + 1;
+  for (size_t Begin : {0, 1, 31, 33}) {
+    std::vector<std::pair<size_t, uint8_t>> Res, Expected;
+    for (size_t i = Begin; i < Ar.size() - 5; i++)
+      if (Ar[i])
+        Expected.push_back({i, Ar[i]});
+    ForEachNonZeroByte(Ar.data() + Begin, Ar.data() + Ar.size() - 5, Begin,
+                       [&](size_t Idx, uint8_t V) { Res.push_back({Idx, V}); });
+    EXPECT_EQ(Res, Expected);
+  }
+}
+
+TEST(Fuzzer, CounterBucket) {
+  const uint8_t Firsts[] = {1, 2, 3, 4, 8, 16, 32, 128};
+  for (unsigned B = 0; B < 8; B++) {
+    EXPECT_EQ(kCounterBucket[Firsts[B]], B);
+    EXPECT_EQ(kCounterBucket[Firsts[B] - 1], B ? B - 1 : 0);
+  }
+  EXPECT_EQ(kCounterBucket[255], 7);
+}
+
+TEST(Fuzzer, ValueBitMap) {
+  ValueBitMap A, B;
+  EXPECT_FALSE(A.AddValue(5));  // Not allocated yet.
+  ASSERT_TRUE(A.Allocate(10, 3));
+  ASSERT_TRUE(B.Allocate(10, 3));
+  EXPECT_EQ(A.MapSizeInBits(), 1024U);
+  EXPECT_EQ(A.NumMaps(), 3U);
+  EXPECT_EQ(A.SizeInBits(), 3072U);
+  EXPECT_TRUE(A.AddValue(5, 0));
+  EXPECT_FALSE(A.AddValue(5, 0));
+  EXPECT_TRUE(A.AddValue(5, 2));
+  EXPECT_FALSE(A.AddValue(5 + 1024, 2));  // Wraps around within the map.
+  std::vector<size_t> Bits;
+  A.ForEachInMap(2, [&](size_t Idx) { Bits.push_back(Idx); });
+  EXPECT_EQ(Bits, std::vector<size_t>({2048 + 5}));
+  Bits.clear();
+  A.ForEach([&](size_t Idx) { Bits.push_back(Idx); });
+  EXPECT_EQ(Bits, std::vector<size_t>({5, 2048 + 5}));
+
+  B.AddValue(5, 0);
+  B.AddValue(1000, 1);
+  EXPECT_TRUE(A.MergeFrom(B));
+  EXPECT_EQ(A.GetNumBitsSinceLastMerge(), 3U);
+  EXPECT_TRUE(A.Get(1024 + 1000));
+  EXPECT_FALSE(B.Get(1024 + 1000));
+  EXPECT_FALSE(A.MergeFrom(B));
+  A.Reset();
+  Bits.clear();
+  A.ForEach([&](size_t Idx) { Bits.push_back(Idx); });
+  EXPECT_TRUE(Bits.empty());
+}
+
+static void HitGuard(uint32_t Idx) { __sanitizer_cov_trace_pc_guard(&Idx); }
+
+static size_t NumCollectedFeatures() {
+  size_t Res = 0;
+  TPC.CollectFeatures([&](size_t) { Res++; });
+  return Res;
+}
+
+TEST(TracePC, ResetMaps) {
+  TPC.ResetCoverage();
+  TPC.ResetMaps();
+  size_t Base = NumCollectedFeatures();
+  for (uint32_t Idx : {5, 700, 701, 5000})
+    HitGuard(Idx);
+  EXPECT_EQ(NumCollectedFeatures(), Base + 4);
+  TPC.ResetMaps();
+  EXPECT_EQ(NumCollectedFeatures(), Base);
+
+  // Counters hit before ResetCoverage() are cleared as well.
+  HitGuard(700);
+  TPC.ResetCoverage();
+  HitGuard(9);
+  TPC.ResetMaps();
+  HitGuard(9);
+  EXPECT_EQ(NumCollectedFeatures(), Base + 1);
+
+  // Dense maps are cleared as a whole.
+  for (uint32_t Idx = 0; Idx < TPC.GetNumPCs(); Idx += 64)
+    HitGuard(Idx);
+  TPC.ResetMaps();
+  EXPECT_EQ(NumCollectedFeatures(), Base);
+  TPC.ResetCoverage();
+}
+
+TEST(TracePC, NumCoveredGuards) {
+  TPC.ResetCoverage();
+  for (uint32_t Idx : {5, 63, 64, 130, 700})
+    HitGuard(Idx);
+  EXPECT_EQ(TPC.NumCoveredGuards({0, 1000}), 5U);
+  EXPECT_EQ(TPC.NumCoveredGuards({0, 5}), 0U);
+  EXPECT_EQ(TPC.NumCoveredGuards({5, 6}), 1U);
+  // Ranges that start, end or lie within one word of the bitmap.
+  EXPECT_EQ(TPC.NumCoveredGuards({6, 64}), 1U);
+  EXPECT_EQ(TPC.NumCoveredGuards({64, 65}), 1U);
+  EXPECT_EQ(TPC.NumCoveredGuards({63, 131}), 3U);
+  EXPECT_EQ(TPC.NumCoveredGuards({131, 700}), 0U);
+  EXPECT_EQ(TPC.NumCoveredGuards({700, 700}), 0U);
+  // The end is clipped to the guards there are.
+  EXPECT_EQ(TPC.NumCoveredGuards({700, ~(size_t)0}), 1U);
+  TPC.ResetCoverage();
+  EXPECT_EQ(TPC.NumCoveredGuards({0, 1000}), 0U);
+  TPC.ResetMaps();
+}
+
+TEST(TracePC, GrowTables) {
+  // A module with more guards than the default tables have room for.
+  static uint32_t Guards[TracePC::kDefaultNumPCs + 1000];
+  size_t N = sizeof(Guards) / sizeof(Guards[0]);
+  __sanitizer_cov_trace_pc_guard_init(Guards, Guards + N);
+  EXPECT_GE(TPC.NumPCsCapacity(), TPC.GetNumPCs());
+  std::set<uint32_t> Seen(Guards, Guards + N);
+  EXPECT_EQ(Seen.size(), N);
+  EXPECT_EQ(*Seen.begin(), Guards[0]);
+  EXPECT_EQ(*Seen.rbegin(), Guards[N - 1]);
+  EXPECT_LT(Guards[N - 1], TPC.GetNumPCs());
+
+  TPC.ResetCoverage();
+  TPC.ResetMaps();
+  size_t Base = NumCollectedFeatures();
+  __sanitizer_cov_trace_pc_guard(&Guards[N - 1]);
+  EXPECT_EQ(NumCollectedFeatures(), Base + 1);
+  TPC.ResetMaps();
+  EXPECT_EQ(NumCollectedFeatures(), Base);
+  TPC.ResetCoverage();
+}
+
+TEST(TracePC, Inline8bitCounters) {
+  static uint8_t Counters[100];
+  static uintptr_t PCTable[2 * 100];
+  for (size_t i = 0; i < 100; i++)
+    PCTable[2 * i] = 0x1000 + i;
+  __sanitizer_cov_8bit_counters_init(Counters, Counters + 100);
+  __sanitizer_cov_pcs_init(PCTable, PCTable + 200);
+
+  TPC.ResetCoverage();
+  TPC.ResetMaps();
+  size_t Base = NumCollectedFeatures();
+  size_t CoverageBase = TPC.GetTotalPCCoverage();
+  Counters[3] = 1;
+  Counters[99] = 200;
+  TPC.UpdateInline8bitCounters();
+  EXPECT_EQ(Counters[3], 0);
+  EXPECT_EQ(Counters[99], 0);
+  EXPECT_EQ(NumCollectedFeatures(), Base + 2);
+  EXPECT_EQ(TPC.GetTotalPCCoverage(), CoverageBase + 2);
+  std::set<uintptr_t> PCs;
+  for (size_t i = 0; i < TPC.GetNumPCs(); i++)
+    if (TPC.GetPC(i) >= 0x1000 && TPC.GetPC(i) < 0x1000 + 100)
+      PCs.insert(TPC.GetPC(i));
+  EXPECT_EQ(PCs, std::set<uintptr_t>({0x1003, 0x1063}));
+
+  TPC.ResetMaps();
+  EXPECT_EQ(NumCollectedFeatures(), Base);
+  TPC.ResetCoverage();
+}
+
+TEST(TracePC, FeaturePasses) {
+  // The tests have no extra counters, so only the value profile varies.
+  TPC.ResetCoverage();
+  TPC.ResetMaps();
+  TPC.SetUseValueProfile(true);
+  EXPECT_EQ(TPC.FeaturePassesInUse(), unsigned(TracePC::kValueProfilePass));
+  size_t Base = NumCollectedFeatures();
+  TPC.SetUseValueProfile(false);
+  EXPECT_EQ(TPC.FeaturePassesInUse(), 0U);
+  EXPECT_EQ(NumCollectedFeatures(), Base);
+  HitGuard(17);
+  EXPECT_EQ(NumCollectedFeatures(), Base + 1);
+  TPC.SetUseValueProfile(true);
+  EXPECT_EQ(NumCollectedFeatures(), Base + 1);
+  TPC.SetUseValueProfile(false);
+  TPC.ResetMaps();
+  TPC.ResetCoverage();
+}
+
+TEST(TracePC, ThreadCoverage) {
+  TPC.ResetCoverage();
+  TPC.ResetMaps();
+  size_t Base = NumCollectedFeatures();
+  size_t CoverageBase = TPC.GetTotalPCCoverage();
+  size_t ThreadFeatures = 0, ThreadCoverage = 0;
+  std::thread T([&] {
+    ASSERT_TRUE(TPC.UseThreadCoverage());
+    EXPECT_EQ(TPC.GetTotalPCCoverage(), 0U);
+    for (uint32_t Idx : {5, 700, 701})
+      HitGuard(Idx);
+    ThreadFeatures = NumCollectedFeatures();
+    ThreadCoverage = TPC.GetTotalPCCoverage();
+    TPC.ResetCoverage();
+    TPC.FreeThreadCoverage();
+  });
+  T.join();
+  EXPECT_EQ(ThreadFeatures, 3U);
+  EXPECT_EQ(ThreadCoverage, 3U);
+  // Nothing went to the tables of the process.
+  EXPECT_EQ(NumCollectedFeatures(), Base);
+  EXPECT_EQ(TPC.GetTotalPCCoverage(), CoverageBase);
+  HitGuard(9);
+  EXPECT_EQ(NumCollectedFeatures(), Base + 1);
+  TPC.ResetMaps();
+  TPC.ResetCoverage();
+}
+
+TEST(TracePC, OutputClasses) {
+  TPC.OutputDiffVec = {0x100, 7, 0, 7, 0x100, 3};
+  TPC.SetDiffVerdictBits(8);
+  EXPECT_TRUE(TPC.NewOutputDiff_change());
+  EXPECT_EQ(TPC.NumOutputClasses(), 4U);
+  std::vector<uint32_t> Classes = {0, 1, 2, 1, 0, 3};
+  for (size_t i = 0; i < Classes.size(); i++)
+    EXPECT_EQ(TPC.OutputClass(i), Classes[i]);
+  EXPECT_EQ(TPC.OutputRejectMask(), 0x2aU);
+  EXPECT_EQ(TPC.NumOutputRejects(), 3U);
+
+  TPC.OutputDiffVec.assign(70, 5);
+  TPC.OutputDiffVec[66] = 0;
+  TPC.SetDiffVerdictBits(0);
+  EXPECT_TRUE(TPC.NewOutputDiff_change());
+  EXPECT_EQ(TPC.NumOutputClasses(), 2U);
+  EXPECT_EQ(TPC.OutputClass(66), 1U);
+  EXPECT_EQ(TPC.OutputClass(69), 0U);
+  EXPECT_FALSE(TPC.OutputRejected(66));
+  EXPECT_TRUE(TPC.OutputRejected(67));
+  EXPECT_EQ(TPC.NumOutputRejects(), 69U);
+
+  TPC.OutputDiffVec.assign(3, 1);
+  EXPECT_FALSE(TPC.NewOutputDiff_change());
+  EXPECT_EQ(TPC.NumOutputClasses(), 1U);
+  TPC.OutputDiffVec.clear();
+}
+
+TEST(TracePC, CmpTablesMerge) {
+  std::unique_ptr<CmpTables> Main(new CmpTables), Worker(new CmpTables);
+  Main->TORC4.Insert(1, 10, 11);
+  Main->TORC4.Insert(2, 20, 21);
+  Worker->TORC4.Insert(2, 30, 31);
+  Worker->TORC4.Insert(32 + 3, 40, 41);
+  const uint8_t W[] = {'a', 'b', 'c', 'd'};
+  Worker->MMT.Add(W, sizeof(W));
+  Main->MergeFrom(*Worker);
+  EXPECT_EQ(Main->TORC4.Get(1).A, 10U);
+  EXPECT_EQ(Main->TORC4.Get(2).A, 30U);
+  EXPECT_EQ(Main->TORC4.Get(3).B, 41U);
+  EXPECT_EQ(Main->MMT.Get(0), Word(W, sizeof(W)));
+
+  // Entries are only merged once.
+  Main->TORC4.Insert(2, 50, 51);
+  Main->MergeFrom(*Worker);
+  EXPECT_EQ(Main->TORC4.Get(2).A, 50U);
+}
+
+// Run with --gtest_also_run_disabled_tests to print the cost of a reset.
+TEST(TracePC, DISABLED_ResetMapsCost) {
+  const size_t kResets = 1000;
+  for (size_t Step : {1 << 16, 1 << 12, 1 << 9, 1 << 7, 64}) {
+    TPC.ResetCoverage();
+    for (uint32_t Idx = 0; Idx < TPC.GetNumPCs(); Idx += Step)
+      HitGuard(Idx);
+    auto Start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < kResets; i++)
+      TPC.ResetMaps();
+    auto Ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - Start).count();
+    Printf("%6zd guards hit: %8.1f ns per reset\n", TPC.GetNumPCs() / Step,
+           Ns / static_cast<double>(kResets));
+  }
+  TPC.ResetCoverage();
+}
+
+// Intel PT packets of a run of a library loaded at Base.
+static std::vector<uint8_t> PtTrace(uint64_t Base, uint8_t ShortTnt) {
+  std::vector<uint8_t> T;
+  auto Add = [&](std::initializer_list<uint8_t> Bytes) {
+    T.insert(T.end(), Bytes);
+  };
+  auto AddIP = [&](uint64_t IP, size_t N) {
+    for (size_t i = 0; i < N; i++)
+      T.push_back(static_cast<uint8_t>(IP >> (8 * i)));
+  };
+  auto AddPSB = [&] {
+    for (int i = 0; i < 8; i++)
+      Add({0x02, 0x82});
+    Add({0x02, 0x23});  // PSBEND
+  };
+  AddPSB();
+  Add({0xD1});  // TIP.PGE with the full IP.
+  AddIP(Base + 0x1000, 8);
+  Add({ShortTnt, 0x00});  // A short TNT and a PAD.
+  Add({0x2D});  // TIP with the lower 2 bytes of the IP.
+  AddIP(Base + 0x2000, 2);
+  Add({0x02, 0xA3});  // Long TNT: 10 bits.
+  AddIP(1 << 10 | 0x2AA, 6);
+  Add({0x02, 0x55, 0x1A});  // Garbage: the TNT up to the PSB is lost.
+  AddPSB();
+  Add({0xD1});
+  AddIP(Base + 0x3000, 8);
+  Add({0x04});  // A short TNT of 1 bit.
+  return T;
+}
+
+TEST(HardwareTrace, DecodeIntelPT) {
+  const size_t kNumCounts = 1 << 16;
+  const uint64_t kBase1 = 0x7f1234560000ULL, kBase2 = 0x55aaaaaa0000ULL;
+  std::vector<uint8_t> C1(kNumCounts), C2(kNumCounts), C3(kNumCounts);
+  auto T1 = PtTrace(kBase1, 0x1A);
+  EXPECT_EQ(DecodeIntelPT(T1.data(), T1.size(), kBase1, C1.data(), kNumCounts),
+            15U);
+  size_t Sum = 0;
+  for (uint8_t C : C1)
+    Sum += C;
+  EXPECT_EQ(Sum, 15U);
+
+  // The counters don't depend on where the library is loaded.
+  auto T2 = PtTrace(kBase2, 0x1A);
+  EXPECT_EQ(DecodeIntelPT(T2.data(), T2.size(), kBase2, C2.data(), kNumCounts),
+            15U);
+  EXPECT_EQ(C1, C2);
+
+  // But they do on the branches taken.
+  auto T3 = PtTrace(kBase1, 0x1C);
+  EXPECT_EQ(DecodeIntelPT(T3.data(), T3.size(), kBase1, C3.data(), kNumCounts),
+            15U);
+  EXPECT_NE(C1, C3);
+
+  // A truncated trace is fine too.
+  std::fill(C3.begin(), C3.end(), 0);
+  EXPECT_EQ(DecodeIntelPT(T1.data(), 30, kBase1, C3.data(), kNumCounts), 3U);
+}
@@ -0,0 +1,176 @@
+// A synthetic differential target for load testing the diff engine without
+// the TLS libraries. It has K implementations of one toy parser; each is a
+// separate set of template instances, so each has its own guards, and any
+// number of them can disagree with the first one.
+//
+// Compile-time knobs (-DNAME=VALUE):
+//   SYNTH_IMPLEMENTATIONS  K, the number of callbacks (default 4, at most 64)
+//   SYNTH_BRANCHES         leaves per implementation (default 256, a multiple
+//                          of 16); the bits of the input after its first two
+//                          bytes pick a path to one of them through a binary
+//                          tree, so every implementation has a few guards
+//                          per leaf, of which a call runs about log2 of the
+//                          leaves
+// Run-time knobs (environment variables, read once):
+//   SYNTH_WORK             loop iterations per call, the per-exec cost (0)
+//   SYNTH_ALLOC            bytes allocated and freed per call (0)
+//   SYNTH_DIVERGENT        the implementations 1..N disagree with the first
+//                          one on inputs starting with 0xD1 and their own
+//                          index (default: all of them)
+//   SYNTH_DIVERGENCE_DEPTH the number of further bytes those inputs need,
+//                          after the two-byte tag, before the disagreement
+//                          shows (0)
+//
+// For example, 16 implementations with 4096 branches each:
+//   clang++ -g -fsanitize=address -fsanitize-coverage=trace-pc-guard
+//     -DSYNTH_IMPLEMENTATIONS=16 -DSYNTH_BRANCHES=4096 diff_synthetic.cc
+//     libFuzzer.a -o diff_synthetic
+//   SYNTH_WORK=1000 ./diff_synthetic -diff_mode=1
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef SYNTH_IMPLEMENTATIONS
+#define SYNTH_IMPLEMENTATIONS 4
+#endif
+#ifndef SYNTH_BRANCHES
+#define SYNTH_BRANCHES 256
+#endif
+
+static_assert(SYNTH_IMPLEMENTATIONS > 0 && SYNTH_IMPLEMENTATIONS <= 64,
+              "SYNTH_IMPLEMENTATIONS must be in [1, 64]");
+static_assert(SYNTH_BRANCHES > 0 && SYNTH_BRANCHES % 16 == 0,
+              "SYNTH_BRANCHES must be a positive multiple of 16");
+
+typedef int (*UserCallback)(const uint8_t *Data, size_t Size);
+struct UserCallbacks {
+  UserCallback *callbacks;
+  int size;
+};
+
+struct Config {
+  size_t Work = 0;
+  size_t Alloc = 0;
+  size_t Divergent = SYNTH_IMPLEMENTATIONS - 1;
+  size_t Depth = 0;
+};
+
+static size_t EnvOr(const char *Name, size_t Default) {
+  const char *V = getenv(Name);
+  return V ? strtoull(V, nullptr, 0) : Default;
+}
+
+static const Config &GetConfig() {
+  static Config C = [] {
+    Config C;
+    C.Work = EnvOr("SYNTH_WORK", C.Work);
+    C.Alloc = EnvOr("SYNTH_ALLOC", C.Alloc);
+    C.Divergent = EnvOr("SYNTH_DIVERGENT", C.Divergent);
+    C.Depth = EnvOr("SYNTH_DIVERGENCE_DEPTH", C.Depth);
+    return C;
+  }();
+  return C;
+}
+
+static volatile uint64_t Sink;
+
+// The last byte that leaf B of every implementation looks for; the same in
+// all of them, so that they cover alike.
+static constexpr uint8_t BranchByte(size_t B) {
+  return static_cast<uint8_t>((B * 2654435761u) >> 13);
+}
+
+static unsigned InputBit(const uint8_t *Data, size_t Size, size_t Bit) {
+  size_t Byte = 2 + Bit / 8;
+  return Byte < Size ? Data[Byte] >> (Bit % 8) & 1 : 0;
+}
+
+// The subtree of leaves [Lo, Hi) of implementation Impl, at depth Bit. The
+// leaves come in groups of 16, one template instance each, so that large
+// trees stay cheap to compile.
+template <size_t Impl, size_t Lo, size_t Hi, bool Leaves = Hi - Lo == 16>
+struct Branches {
+  __attribute__((noinline)) static bool Run(const uint8_t *Data, size_t Size,
+                                            size_t Bit) {
+    constexpr size_t Mid = Lo + (Hi - Lo) / 32 * 16;
+    if (InputBit(Data, Size, Bit))
+      return Branches<Impl, Mid, Hi>::Run(Data, Size, Bit + 1);
+    return Branches<Impl, Lo, Mid>::Run(Data, Size, Bit + 1);
+  }
+};
+
+// The store to Sink keeps the cases from being folded into a table.
+#define SYNTH_LEAF(K)                                                          \
+  case K:                                                                      \
+    Sink = K;                                                                  \
+    return Last == BranchByte(Lo + K);
+
+template <size_t Impl, size_t Lo, size_t Hi>
+struct Branches<Impl, Lo, Hi, true> {
+  __attribute__((noinline)) static bool Run(const uint8_t *Data, size_t Size,
+                                            size_t Bit) {
+    if (Size <= 2) return false;
+    uint8_t Last = Data[Size - 1];
+    unsigned Leaf = 0;
+    for (size_t i = 0; i < 4; i++)
+      Leaf |= InputBit(Data, Size, Bit + i) << i;
+    switch (Leaf) {
+      SYNTH_LEAF(0) SYNTH_LEAF(1) SYNTH_LEAF(2) SYNTH_LEAF(3)
+      SYNTH_LEAF(4) SYNTH_LEAF(5) SYNTH_LEAF(6) SYNTH_LEAF(7)
+      SYNTH_LEAF(8) SYNTH_LEAF(9) SYNTH_LEAF(10) SYNTH_LEAF(11)
+      SYNTH_LEAF(12) SYNTH_LEAF(13) SYNTH_LEAF(14) SYNTH_LEAF(15)
+    }
+    return false;
+  }
+};
+
+template <size_t Impl> static int Parse(const uint8_t *Data, size_t Size) {
+  const Config &C = GetConfig();
+  if (C.Alloc) {
+    uint8_t *P = static_cast<uint8_t *>(malloc(C.Alloc));
+    P[0] = Size ? Data[0] : 0;
+    P[C.Alloc - 1] = P[0];
+    Sink = P[C.Alloc - 1];
+    free(P);
+  }
+  uint64_t Acc = 0;
+  for (size_t i = 0; i < C.Work; i++)
+    Acc = Acc * 31 + (Size ? Data[i % Size] : i);
+  Sink = Acc;
+
+  bool Hit = Branches<Impl, 0, SYNTH_BRANCHES>::Run(Data, Size, 0);
+  // The reference accepts inputs that start with 'S' and end with a byte
+  // other than the one of their leaf.
+  int Reject = !(Size >= 2 && Data[0] == 'S' && !Hit);
+  if (Impl && Impl <= C.Divergent && Size >= 2 + C.Depth && Data[0] == 0xD1 &&
+      Data[1] == Impl) {
+    bool Deep = true;
+    for (size_t i = 0; i < C.Depth; i++)
+      Deep &= Data[2 + i] == BranchByte(Impl * 64 + i);
+    if (Deep) Reject = !Reject;
+  }
+  return Reject;
+}
+
+template <size_t... Is> struct Indices {};
+template <size_t N, size_t... Is>
+struct MakeIndices : MakeIndices<N - 1, N - 1, Is...> {};
+template <size_t... Is> struct MakeIndices<0, Is...> : Indices<Is...> {};
+
+template <size_t... Is> static UserCallback *AllCallbacks(Indices<Is...>) {
+  static UserCallback Callbacks[] = {Parse<Is>...};
+  return Callbacks;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  return Parse<0>(Data, Size);
+}
+
+extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() {
+  static UserCallbacks Container = {
+      AllCallbacks(MakeIndices<SYNTH_IMPLEMENTATIONS>()),
+      SYNTH_IMPLEMENTATIONS};
+  return &Container;
+}
@@ -113,6 +113,90 @@ struct GlobalInitializer {
 
 static GlobalInitializer g_initializer;
 
+#ifdef CONFIG_AFL_PERSISTENT
+// One callback per library for Fuzzer/afl/afl_diff_driver.cpp, which runs
+// them all on every input in AFL's persistent mode instead of forking this
+// binary for each input. They verify the chain like main() below does and
+// also leave their return codes in ret_vals for LLVMFuzzerRetVals().
+#define DIFF_CALLBACK(name) \
+static int idx_ ##name = -1; \
+static int callback_ ##name(const uint8_t *data, size_t size) { \
+  cert_chain_ ##name = (uint8_t *)data; \
+  cert_chain_sz_ ##name = size; \
+  VERIFY_ONE(name) \
+  ret_vals[idx_ ##name] = ret_ ##name; \
+  return ret_ ##name; \
+}
+
+#define ADD_CALLBACK(name) \
+  idx_ ##name = gl_callbacks.size; \
+  gl_callbacks.callbacks[gl_callbacks.size++] = callback_ ##name;
+
+#ifdef CONFIG_USE_OPENSSL
+DIFF_CALLBACK(openssl)
+#endif
+#ifdef CONFIG_USE_LIBRESSL
+DIFF_CALLBACK(libressl)
+#endif
+#ifdef CONFIG_USE_BORINGSSL
+DIFF_CALLBACK(boringssl)
+#endif
+#ifdef CONFIG_USE_WOLFSSL
+DIFF_CALLBACK(wolfssl)
+#endif
+#ifdef CONFIG_USE_GNUTLS
+DIFF_CALLBACK(gnutls)
+#endif
+#ifdef CONFIG_USE_MBEDTLS
+// mbedTLS wants the PEM chain NUL-terminated.
+static int idx_mbedtls = -1;
+static int callback_mbedtls(const uint8_t *data, size_t size) {
+  cert_chain_mbedtls = (uint8_t *) calloc(size + 1, sizeof(uint8_t));
+  if (!cert_chain_mbedtls)
+    return FAILURE_INTERNAL;
+  memcpy(cert_chain_mbedtls, data, size);
+  cert_chain_sz_mbedtls = size + 1;
+  VERIFY_ONE(mbedtls)
+  FREE_LIB_CERTS(mbedtls)
+  ret_vals[idx_mbedtls] = ret_mbedtls;
+  return ret_mbedtls;
+}
+#endif
+
+typedef int (*UserCallback)(const uint8_t *Data, size_t Size);
+struct UserCallbacks {
+  UserCallback *callbacks;
+  int size;
+};
+static UserCallback gl_callback_fns[6];
+static UserCallbacks gl_callbacks = { gl_callback_fns, 0 };
+
+// In the order of GlobalInitializer, which is that of ret_vals.
+extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() {
+  if (gl_callbacks.size)
+    return &gl_callbacks;
+#ifdef CONFIG_USE_OPENSSL
+  ADD_CALLBACK(openssl)
+#endif
+#ifdef CONFIG_USE_LIBRESSL
+  ADD_CALLBACK(libressl)
+#endif
+#ifdef CONFIG_USE_BORINGSSL
+  ADD_CALLBACK(boringssl)
+#endif
+#ifdef CONFIG_USE_WOLFSSL
+  ADD_CALLBACK(wolfssl)
+#endif
+#ifdef CONFIG_USE_MBEDTLS
+  ADD_CALLBACK(mbedtls)
+#endif
+#ifdef CONFIG_USE_GNUTLS
+  ADD_CALLBACK(gnutls)
+#endif
+  return &gl_callbacks;
+}
+#else
+
 // extern "C" int LLVMFuzzerTestOneInput(const uint8_t *cert_chain_openssl,
                                       // size_t cert_chain_sz_openssl) {
 int main(int argc, char *argv[])
@@ -186,3 +270,4 @@ int main(int argc, char *argv[])
   }
   return 0;
 }
+#endif  // CONFIG_AFL_PERSISTENT
@@ -1,16 +1,63 @@
 #include "boringssl.h"
+#include "openssl_common.h"
+#include "fast_crypto.h"
+#include "snapshot.h"
 
 
 #include <assert.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
 #include <assert.h>
 #include <stdint.h>
 #include <stddef.h>
 
 
+#ifdef CONFIG_FAST_CRYPTO
+// The size of the server key's signatures and decryptions.
+static size_t stub_key_size;
 
-SSL_CTX *Init() {
+static ssl_private_key_result_t StubSign(SSL *ssl, uint8_t *out,
+                                         size_t *out_len, size_t max_out,
+                                         uint16_t signature_algorithm,
+                                         const uint8_t *in, size_t in_len)
+{
+    if (stub_key_size > max_out)
+        return ssl_private_key_failure;
+    memset(out, 0, stub_key_size);
+    *out_len = stub_key_size;
+    return ssl_private_key_success;
+}
+
+// BoringSSL decrypts without padding and checks the padding itself.
+static ssl_private_key_result_t StubDecrypt(SSL *ssl, uint8_t *out,
+                                            size_t *out_len, size_t max_out,
+                                            const uint8_t *in, size_t in_len)
+{
+    if (in_len > max_out)
+        return ssl_private_key_failure;
+    *out_len = stub_rsa_decrypt(in, in_len, out, in_len, 1);
+    return ssl_private_key_success;
+}
+
+static ssl_private_key_result_t StubComplete(SSL *ssl, uint8_t *out,
+                                             size_t *out_len, size_t max_out)
+{
+    return ssl_private_key_failure;
+}
+
+static const SSL_PRIVATE_KEY_METHOD stub_key_method = {
+    StubSign, StubDecrypt, StubComplete
+};
+#endif
+
+struct ServerOps : OpenSSLOps {
+    static const char *Name() { return "Boringssl"; }
+    static Ctx *Init(const struct tls_credentials *creds);
+    static void ResetRandom() { RAND_reset_for_fuzzing(); }
+};
+
+SSL_CTX *ServerOps::Init(const struct tls_credentials *creds) {
     SSL_library_init();
     SSL_load_error_strings();
     ERR_load_BIO_strings();
@@ -22,58 +69,15 @@ SSL_CTX *Init() {
       -out server.pem -days 9999 -nodes -subj /CN=a/
     */
     //SSL_CTX_set_security_level(sctx, 0);
-    assert(SSL_CTX_use_certificate_file(sctx, "runtime/server.pem",
-                                        SSL_FILETYPE_PEM));
-    assert(SSL_CTX_use_PrivateKey_file(sctx, "runtime/server.key",
-                                      SSL_FILETYPE_PEM));
+    UseCredentials(sctx, creds);
+#ifdef CONFIG_FAST_CRYPTO
+    stub_key_size = EVP_PKEY_size(SSL_CTX_get0_privatekey(sctx));
+    SSL_CTX_set_private_key_method(sctx, &stub_key_method);
+#endif
     return sctx;
 }
 
-extern "C"
-LIB_EXPORT
-int do_handshake_mem(const uint8_t *Data, uint32_t Size)
-{
-    static SSL_CTX *sctx = Init();
-    uint8_t *response = new uint8_t[8];
-    int composite_ret;
-    memset(response,0,8*sizeof(uint8_t));
-    SSL *server = SSL_new(sctx);
-    BIO *sinbio = BIO_new(BIO_s_mem());
-    BIO *soutbio = BIO_new(BIO_s_mem());
-    SSL_set_bio(server, sinbio, soutbio);
-    SSL_set_accept_state(server);
-    BIO_write(sinbio, Data, Size);
-    SSL_do_handshake(server);
-    BIO_read(soutbio,response,8*sizeof(uint8_t));
-    
-    
-    if(response[0]==0x16)
-    {        
-        DBG("[Boringssl] [handshake: HS/%02x/%02x%02x]\n",response[5],response[1],response[2]);	  
-	//composite_ret = 0;
-    }
-    else if(response[0]==0x15)
-    {
-        DBG("[Boringssl] [Alert: AL/%02x/%02x%02x]\n",response[6],response[1],response[2]);
-	//composite_ret = response[6];
-    }
-    else
-    {
-	DBG("[Boringssl] [No output: %02x%02x%02x]\n",response[0],response[1],response[2]);
-        //composite_ret = 1;
-    }
-    SSL_free(server);    
-    //SSL_CTX_free(sctx);
-    composite_ret = response[0];
-
-    
-    if(composite_ret==0)
-	composite_ret = 21;
-    else if(composite_ret==22)
-	composite_ret = 0;
-    delete [] response;
-    return composite_ret;
-}
+HANDSHAKE_ENTRY_POINTS(ServerOps)
 
 extern "C"
 LIB_EXPORT
@@ -61,6 +61,374 @@ typedef int (*fp_t)(const uint8_t *, uint32_t);
 #define FAILURE_INTERNAL        0xFFFFFFFF
 
 #define FN_DO_HANDSHAKE          "do_handshake_mem"
+#define FN_VERIFY_CERT           "verify_cert_mem"
+
+/**
+ * The trusted CA certificates as PEM, read from CA_STORE_FILE once for all
+ * libraries of x509_diff.cpp. A library that exports FN_INIT_CA_STORE
+ * builds its store from them before fuzzing starts, and FN_VERIFY_CERT then
+ * only parses and verifies the chain it is given; one that does not loads
+ * its store itself on its first verification.
+ */
+#define FN_INIT_CA_STORE         "init_ca_store"
+#define CA_STORE_FILE            "runtime/ca_chain.pem"
+
+typedef int (*init_ca_fp_t)(const uint8_t *, uint32_t);
+
+/**
+ * The return value of FN_VERIFY_CERT, normalised for the libFuzzer target:
+ *  - [3:0]:    verdict: X509_VALID, X509_REJECTED, X509_CANT_PARSE or
+ *              X509_INTERNAL
+ *  - [31:4]:   signature: the depth and error code of compositize_ret_val()
+ *              for a chain that was parsed, 0 otherwise
+ * Run the fuzzer with -diff_verdict_bits=4: the error codes of two
+ * libraries never agree, only their verdicts can.
+ */
+#define X509_VALID              0
+#define X509_REJECTED           1
+#define X509_CANT_PARSE         2
+#define X509_INTERNAL           3
+
+static inline int cert_verdict(int ret)
+{
+    if ((uint32_t)ret == RET_CERT_CANT_PARSE)
+        return X509_CANT_PARSE;
+    if ((uint32_t)ret == FAILURE_INTERNAL)
+        return X509_INTERNAL;
+    switch (ret & 0xf) {
+    case RET_CERT_OK:
+        return (ret & ~0xf) | X509_VALID;
+    case RET_CERT_ERR:
+        return (ret & ~0xf) | X509_REJECTED;
+    default:
+        return (ret & ~0xf) | X509_INTERNAL;
+    }
+}
+
+/**
+ * The server's certificate and private key as DER, read from
+ * SERVER_CERT_FILE and SERVER_KEY_FILE once for all libraries. A library
+ * that exports FN_INIT_TLS is initialised with them before fuzzing starts;
+ * one that does not, or is used without the registry, reads the files
+ * itself on its first handshake.
+ */
+#define FN_INIT_TLS              "init_tls"
+#define SERVER_CERT_FILE         "runtime/server.pem"
+#define SERVER_KEY_FILE          "runtime/server.key"
+
+struct tls_credentials {
+    const uint8_t *cert;
+    uint32_t cert_size;
+    const uint8_t *key;
+    uint32_t key_size;
+};
+
+typedef int (*init_fp_t)(const struct tls_credentials *);
+
+#define TLS_RECORD_ALERT        0x15
+#define TLS_RECORD_HANDSHAKE    0x16
+#define TLS_SERVER_HELLO        0x02
+
+/**
+ * The first reply of a server to a ClientHello is reduced to a composite
+ * return value, read in place from the server's output buffer (the memory
+ * BIO of the wrappers), where the reply stays until the next handshake:
+ *  - [7:0]:    verdict: 0 for a handshake record, 21 for an alert or no
+ *              reply at all, the record type otherwise
+ *  - [31:8]:   signature: for a ServerHello the minor version [31:24] and
+ *              the selected cipher suite [23:8], for an alert its level
+ *              [23:16] and description [15:8]
+ * Run the fuzzer with -diff_verdict_bits=8 so that only the verdicts decide
+ * what a diff is while the signatures keep different diffs apart.
+ */
+static inline int response_signature(const uint8_t *response, long len)
+{
+    if (len < 1)
+        return TLS_RECORD_ALERT;
+    uint32_t verdict = response[0] == TLS_RECORD_HANDSHAKE ? 0 : response[0];
+    uint32_t signature = 0;
+    if (response[0] == TLS_RECORD_HANDSHAKE && len > 43 &&
+        response[5] == TLS_SERVER_HELLO) {
+        // Record header (5), handshake header (4), version (2), random (32),
+        // then the session id and the cipher suite.
+        long cipher = 44 + response[43];
+        signature = response[10] << 16;
+        if (len >= cipher + 2)
+            signature |= (response[cipher] << 8) | response[cipher + 1];
+    } else if (response[0] == TLS_RECORD_ALERT && len > 6) {
+        signature = (response[5] << 8) | response[6];
+    }
+    return (int)((signature << 8) | verdict);
+}
+
+
+/**
+ * The whole reply of a server, for FN_HANDSHAKE_OUTPUT: a view of the
+ * library's output buffer, valid until its next handshake, and a digest of
+ * it. A byte that differs between two replies changes the digest unless it
+ * is random in every handshake: the random and the session id of a
+ * ServerHello, and the bodies of the other handshake messages (certificate,
+ * key exchange) and of the encrypted records, of which only the types and
+ * lengths count.
+ */
+#define FN_HANDSHAKE_OUTPUT      "do_handshake_output"
+#define TLS_RECORD_CCS          0x14
+
+struct tls_output {
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t digest;
+};
+
+typedef int (*output_fp_t)(const uint8_t *, uint32_t, struct tls_output *);
+
+static inline uint32_t fnv1a(uint32_t h, const uint8_t *data, long size)
+{
+    for (long i = 0; i < size; i++)
+        h = (h ^ data[i]) * 16777619u;
+    return h;
+}
+
+static inline uint32_t output_digest(const uint8_t *response, long len)
+{
+    uint32_t h = 2166136261u;
+    int encrypted = 0;
+    long pos = 0;
+    while (pos + 5 <= len) {
+        uint8_t type = response[pos];
+        long end = pos + 5 + ((response[pos + 3] << 8) | response[pos + 4]);
+        if (end > len)
+            end = len;
+        h = fnv1a(h, response + pos, 5);
+        if (type == TLS_RECORD_HANDSHAKE && !encrypted) {
+            long msg = pos + 5;
+            while (msg + 4 <= end) {
+                long msg_end = msg + 4 + ((response[msg + 1] << 16) |
+                                          (response[msg + 2] << 8) |
+                                          response[msg + 3]);
+                if (msg_end > end)
+                    msg_end = end;
+                h = fnv1a(h, response + msg, 4);
+                // Version (2), random (32), session id, then the rest.
+                long sid = msg + 4 + 2 + 32;
+                if (response[msg] == TLS_SERVER_HELLO && sid < msg_end) {
+                    h = fnv1a(h, response + msg + 4, 2);
+                    long rest = sid + 1 + response[sid];
+                    if (rest < msg_end)
+                        h = fnv1a(h, response + rest, msg_end - rest);
+                }
+                msg = msg_end;
+            }
+        } else if (!encrypted) {
+            h = fnv1a(h, response + pos + 5, end - pos - 5);
+        }
+        if (type == TLS_RECORD_CCS)
+            encrypted = 1;
+        pos = end;
+    }
+    return fnv1a(h, response + pos, len - pos);
+}
+
+static inline void fill_output(struct tls_output *out, const uint8_t *response,
+                               long len)
+{
+    if (!out)
+        return;
+    out->data = response;
+    out->size = len > 0 ? (uint32_t)len : 0;
+    out->digest = output_digest(response, len);
+}
+
+
+/**
+ * Multi-flight inputs (CONFIG_MULTI_FLIGHT): the first TLS record of an
+ * input is the client's first flight, its ClientHello; the records after it
+ * are the second flight (ClientKeyExchange, ChangeCipherSpec, Finished).
+ * The server gets the second flight only if it answered the first with a
+ * handshake record, and the return value is then the one of its reply to
+ * the second flight, with SECOND_FLIGHT_VERDICT set in the verdict.
+ */
+#define SECOND_FLIGHT_VERDICT   0x80
+
+static inline uint32_t first_flight_size(const uint8_t *Data, uint32_t Size)
+{
+    if (Size < 5)
+        return Size;
+    uint32_t len = 5 + ((Data[3] << 8) | Data[4]);
+    return len < Size ? len : Size;
+}
+
+static inline int is_handshake_verdict(int ret)
+{
+    return (ret & 0xff) == 0;
+}
+
+
+/**
+ * The server side of a handshake, written once for all wrappers. Ops binds
+ * it to the API of one library with these static members:
+ *  - Ctx, Server, Bio: the types of its contexts, connections and BIOs
+ *  - Server *New(Ctx *), void Free(Server *), void Clear(Server *)
+ *  - Bio *NewBio(): an empty memory BIO
+ *  - void SetBio(Server *, Bio *in, Bio *out), void ResetBio(Bio *)
+ *  - void Accept(Server *), void DoHandshake(Server *)
+ *  - void Write(Bio *, const uint8_t *, uint32_t)
+ *  - long Reply(Bio *, const uint8_t **): the data of a memory BIO, in place
+ *  - const char *Name(): the library, for DBG()
+ *  - Ctx *Init(const struct tls_credentials *): a context of the library,
+ *    for the shared credentials or, without them, the files
+ *  - void ResetRandom(): before every input, with CONFIG_FAST_CRYPTO
+ * openssl_common.h has most of them for the OpenSSL API, wolfssl.cpp all of
+ * them for wolfSSL; every wrapper names its binding ServerOps and defines
+ * its entry points with HANDSHAKE_ENTRY_POINTS(ServerOps).
+ */
+
+// The context of the library, made by FN_INIT_TLS from the shared
+// credentials before fuzzing starts, or else by the first handshake.
+template <class Ops>
+static typename Ops::Ctx *ServerContext(const struct tls_credentials *creds)
+{
+    static typename Ops::Ctx *sctx = Ops::Init(creds);
+    return sctx;
+}
+
+// A server on two new memory BIOs.
+template <class Ops>
+static typename Ops::Server *NewServer(typename Ops::Ctx *sctx,
+                                       typename Ops::Bio **sinbio,
+                                       typename Ops::Bio **soutbio)
+{
+    typename Ops::Server *server = Ops::New(sctx);
+    *sinbio = Ops::NewBio();
+    *soutbio = Ops::NewBio();
+    Ops::SetBio(server, *sinbio, *soutbio);
+    return server;
+}
+
+#ifdef CONFIG_REUSE_SSL
+// The server object and its memory BIOs are created once per thread and
+// reset between inputs instead of being allocated for every handshake.
+// Every -diff_threads executor thus gets a server of its own, which lives
+// as long as the process.
+template <class Ops>
+static typename Ops::Server *AcquireServer(typename Ops::Ctx *sctx,
+                                           typename Ops::Bio **sinbio,
+                                           typename Ops::Bio **soutbio)
+{
+    static thread_local typename Ops::Server *server = NULL;
+    static thread_local typename Ops::Bio *in = NULL, *out = NULL;
+    if (!server) {
+        server = NewServer<Ops>(sctx, &in, &out);
+    } else {
+        Ops::Clear(server);
+        Ops::ResetBio(in);
+        Ops::ResetBio(out);
+    }
+    *sinbio = in;
+    *soutbio = out;
+    return server;
+}
+#else
+// Frees the server of the last handshake of this thread, whose reply may
+// still be looked at through a tls_output, and keeps this one until the
+// next.
+template <class Ops>
+static void ReleaseServer(typename Ops::Server *server)
+{
+    static thread_local typename Ops::Server *last = NULL;
+    if (last)
+        Ops::Free(last);
+    last = server;
+}
+#endif
+
+#ifdef CONFIG_MULTI_FLIGHT
+// Feeds one flight to the server and returns the signature of its reply,
+// which stays in soutbio until the next flight.
+template <class Ops>
+static int FeedFlight(typename Ops::Server *server, typename Ops::Bio *sinbio,
+                      typename Ops::Bio *soutbio, const uint8_t *Data,
+                      uint32_t Size)
+{
+    Ops::ResetBio(soutbio);
+    Ops::Write(sinbio, Data, Size);
+    Ops::DoHandshake(server);
+    const uint8_t *out;
+    long len = Ops::Reply(soutbio, &out);
+    DBG("[%s] [flight of %u bytes: %ld bytes of reply]\n", Ops::Name(), Size,
+        len);
+    return response_signature(out, len);
+}
+
+// In snapshot.h.
+template <class Ops>
+static int HandshakeFlights(typename Ops::Ctx *sctx, const uint8_t *Data,
+                            uint32_t Size, struct tls_output *out);
+#endif
+
+// Runs the handshake of one input and returns the signature of the reply.
+template <class Ops>
+static int Handshake(const uint8_t *Data, uint32_t Size,
+                     struct tls_output *output)
+{
+    static typename Ops::Ctx *sctx = ServerContext<Ops>(NULL);
+#ifdef CONFIG_FAST_CRYPTO
+    Ops::ResetRandom();
+#endif
+#ifdef CONFIG_MULTI_FLIGHT
+    return HandshakeFlights<Ops>(sctx, Data, Size, output);
+#else
+    typename Ops::Bio *sinbio, *soutbio;
+#ifdef CONFIG_REUSE_SSL
+    typename Ops::Server *server = AcquireServer<Ops>(sctx, &sinbio, &soutbio);
+#else
+    typename Ops::Server *server = NewServer<Ops>(sctx, &sinbio, &soutbio);
+#endif
+    Ops::Accept(server);
+    Ops::Write(sinbio, Data, Size);
+    Ops::DoHandshake(server);
+    const uint8_t *response;
+    long len = Ops::Reply(soutbio, &response);
+    if (len > 6 && response[0] == TLS_RECORD_HANDSHAKE)
+        DBG("[%s] [handshake: HS/%02x/%02x%02x]\n", Ops::Name(), response[5],
+            response[1], response[2]);
+    else if (len > 6 && response[0] == TLS_RECORD_ALERT)
+        DBG("[%s] [Alert: AL/%02x/%02x%02x]\n", Ops::Name(), response[6],
+            response[1], response[2]);
+    else
+        DBG("[%s] [No output: %ld bytes]\n", Ops::Name(), len);
+    int ret = response_signature(response, len);
+    fill_output(output, response, len);
+#ifndef CONFIG_REUSE_SSL
+    ReleaseServer<Ops>(server);
+#endif
+    return ret;
+#endif
+}
+
+/**
+ * Defines the FN_INIT_TLS, FN_DO_HANDSHAKE and FN_HANDSHAKE_OUTPUT entry
+ * points of a wrapper on ServerContext<Ops>() and Handshake<Ops>(); the
+ * last also returns a view of the reply and its digest.
+ */
+#define HANDSHAKE_ENTRY_POINTS(Ops) \
+    extern "C" LIB_EXPORT \
+    int init_tls(const struct tls_credentials *creds) \
+    { \
+        ServerContext<Ops>(creds); \
+        return 0; \
+    } \
+    extern "C" LIB_EXPORT \
+    int do_handshake_mem(const uint8_t *Data, uint32_t Size) \
+    { \
+        return Handshake<Ops>(Data, Size, NULL); \
+    } \
+    extern "C" LIB_EXPORT \
+    int do_handshake_output(const uint8_t *Data, uint32_t Size, \
+                            struct tls_output *output) \
+    { \
+        return Handshake<Ops>(Data, Size, output); \
+    }
 
 
 #define FREE_PTR(ptr) \
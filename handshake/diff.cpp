@@ -1,12 +1,23 @@
 #include <assert.h>
 //#include <pthread.h>
+#include <fcntl.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "common.h"
 #include "func.h"
 
 // include generic structures for diff-based fuzzing
 #include "diff.h"
+#include "tls_dict.h"
 
 
 //tls-diff 
@@ -32,7 +43,7 @@
 /* TODO: Add description */
 int test_servers(string inputRandomFile, string outputFile, size_t N, size_t nMaxOp, const vector<bool>& opEnable);
 
-int mutate(string inputRandomFile,uint8_t* CurrentUnitData,size_t size);
+int mutate(unsigned int seed,uint8_t* CurrentUnitData,size_t size,size_t maxSize);
 
 /* TODO: Add description */
 void writeToFile(const string& filename, const string& text, bool append = false);
@@ -134,62 +145,439 @@ public:
 
 /*
  * ___________________________________________________________________________
+ *
+ * For every operator, the data units of a tree it may be applied to, in the
+ * order in which DataUnitCursor::seekByIndex() visits them. All lists are
+ * built in a single walk of the tree and only rebuilt after an operator has
+ * changed the structure of the tree.
  */
-size_t applyOperators(DecisionReader& decisionReader, DataUnit& operand, string& summary, int nMaxOp, const vector<bool>& opEnable) {
+class OperatorIndex {
 
-	size_t nOp = 0;
+private:
+
+	DataUnit& root_;
+	const DataUnitFilter& globalFilter_;
+	const vector<DataUnitOperator*>& operators_;
+	const vector<DataUnitFilter*>& filters_;
+
+	vector<DataUnit*> candidates_;
+	vector<vector<DataUnit*> > eligible_;
+	bool valid_;
+
+	void build() {
+
+		/* the lists keep their storage from the previous build */
+		vector<DataUnit*>& candidates = candidates_;
+		candidates.clear();
+		DataUnitCursor cursor(root_);
+		cursor.enumerate(candidates, globalFilter_);
+
+		eligible_.resize(operators_.size());
+		for (size_t iOp = 0; iOp < eligible_.size(); iOp++) {
+			eligible_[iOp].clear();
+		}
+		for (size_t i = 0; i < candidates.size(); i++) {
+			DataUnit& dataUnit = *candidates[i];
+			for (size_t iOp = 0; iOp < operators_.size(); iOp++) {
+				if (operators_[iOp]->getApplicationFilter().apply(dataUnit) &&
+						(filters_[iOp] == 0 || filters_[iOp]->apply(dataUnit))) {
+					eligible_[iOp].push_back(&dataUnit);
+				}
+			}
+		}
+		valid_ = true;
+	}
+
+public:
+
+	OperatorIndex(DataUnit& root, const DataUnitFilter& globalFilter,
+			const vector<DataUnitOperator*>& operators,
+			const vector<DataUnitFilter*>& filters)
+		: root_(root), globalFilter_(globalFilter), operators_(operators),
+		  filters_(filters), valid_(false) {
+	}
+
+	const vector<DataUnit*>& getEligible(size_t iOp) {
+
+		if (!valid_) {
+			build();
+		}
+		return eligible_[iOp];
+	}
+
+	inline void invalidate() {
+
+		valid_ = false;
+	}
+
+};
+
+
+/*
+ * ___________________________________________________________________________
+ *
+ * Operator scheduling. Every operator is picked with a weight proportional to
+ * its smoothed success rate: the share of its applications that ended up in a
+ * mutant libFuzzer reported as interesting, where a mutant with a new output
+ * diff counts kDiffReward times as much as one with only new coverage.
+ */
+enum OperatorId {
+	OP_VOIDING, OP_DUPLICATING, OP_DELETING, OP_FUZZ_INT, OP_TRUNCATION,
+	OP_FUZZ_DATA, OP_APPENDING, OP_GENERATING, NUM_OPERATORS
+};
+
+static const char* const kOperatorNames[NUM_OPERATORS] = {
+	"VoidingOperator", "DuplicatingOperator", "DeletingOperator",
+	"FuzzIntOperator", "TruncationFuzzOperator", "FuzzDataOperator",
+	"AppendingFuzzOperator", "GeneratingFuzzOperator"
+};
+
+static const size_t kDiffReward = 4;
+static const size_t kWeightScale = 1000;
+
+struct OperatorStats {
+	size_t uses;
+	size_t newUnits;
+	size_t newDiffs;
+};
+
+static OperatorStats opStats[NUM_OPERATORS];
+
+/*
+ * The weights operators are drawn with. opStats changes with every mutant
+ * libFuzzer keeps, so selectOperator() reads a snapshot of it taken every
+ * kWeightEpoch mutations instead: within an epoch a mutation only depends on
+ * its input and seed. Replaying a mutation in another run needs the weights
+ * off (--tls_operator_weights=0), which draws the operators uniformly.
+ */
+static const size_t kWeightEpoch = 4096;
+static size_t opWeights[NUM_OPERATORS];
+static size_t mutationsInEpoch;
+static bool adaptiveWeights = true;
+
+/* operators applied by the mutation in progress */
+static vector<size_t> appliedOperators;
+
+/*
+ * One operator application of a mutation trace (--tls_mutation_trace=1),
+ * kept in binary form and only rendered into text when it is printed. node
+ * is the index of the operand among the data units the operator was
+ * eligible for. before and after are the operand's length in bytes, or
+ * for FuzzIntOperator its value.
+ */
+struct OperationRecord {
+	uint8_t op;
+	uint8_t depth;
+	uint8_t repaired;
+	uint32_t node;
+	int64_t before;
+	int64_t after;
+};
+
+static bool traceMutations = false;
+
+/*
+ * Budget of a mutation: at most maxOpsPerMutation operator applications
+ * (--tls_max_ops, -1 for no limit) and mutationTimeBudgetNs nanoseconds
+ * (--tls_mutation_budget_us, 0 for no limit). A mutation that runs out of
+ * time keeps the operators applied so far; one cut short by time depends
+ * on the machine, not only on its seed.
+ */
+static int maxOpsPerMutation = 32;
+static uint64_t mutationTimeBudgetNs = 0;
+static uint64_t mutationDeadlineNs;
+
+/*
+ * Number of mutations by the number of operators they applied: 0, 1,
+ * 2-3, 4-7, ..., and those that hit the operator limit or ran out of time.
+ */
+static const size_t kNumOpsBuckets = 8;
+static size_t opsPerMutation[kNumOpsBuckets];
+static size_t mutationsAtOpLimit;
+static size_t mutationsOutOfTime;
+static bool mutationOutOfTime;
+
+static inline uint64_t monotonicNs() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * True once the mutation in progress has used up its time.
+ */
+static inline bool isOutOfTime() {
+
+	if (mutationTimeBudgetNs == 0 || mutationOutOfTime) {
+		return mutationOutOfTime;
+	}
+	mutationOutOfTime = monotonicNs() >= mutationDeadlineNs;
+	return mutationOutOfTime;
+}
+
+/* trace of the mutation in progress */
+static vector<OperationRecord> mutationTrace;
+
+/*
+ * Grammar coverage (--tls_grammar_counters=1). Every operator application
+ * is hashed together with the path of its operand into one of the extra
+ * counters, which libFuzzer turns into features like the edge counters, so
+ * that a mutant that changed a new part of the message structure is kept.
+ * The counters of a mutant are set while the callbacks run it.
+ */
+static const size_t kNumGrammarCounters = 1 << 14;
+__attribute__((section("__libfuzzer_extra_counters"), used, aligned(8)))
+static uint8_t grammarCounters[kNumGrammarCounters];
+static bool grammarFeedback = false;
+
+/*
+ * Counters of the mutation in progress, and of the recent mutants by their
+ * bytes. With -mutate_pipeline the mutator runs on a thread of its own,
+ * ahead of the callbacks, so the mutants are handed over under a lock.
+ */
+static const size_t kMaxPendingMutants = 256;
+static vector<uint32_t> mutationFeatures;
+static std::mutex mutantFeaturesLock;
+static std::unordered_map<std::string, vector<uint32_t> > mutantFeatures;
+
+/*
+ * ___________________________________________________________________________
+ */
+void snapshotOperatorWeights() {
+
+	for (size_t id = 0; id < NUM_OPERATORS; id++) {
+		const OperatorStats& stats = opStats[id];
+		size_t reward = stats.newUnits + kDiffReward * stats.newDiffs;
+		opWeights[id] = kWeightScale * (reward + 1) / (stats.uses + 2);
+	}
+}
+
+/*
+ * ___________________________________________________________________________
+ */
+size_t getOperatorWeight(size_t id) {
+
+	return adaptiveWeights ? std::max<size_t>(1, opWeights[id]) : 1;
+}
+
+/*
+ * ___________________________________________________________________________
+ *
+ * Returns an index into ids, the enabled operators.
+ */
+size_t selectOperator(DecisionReader& decisionReader, const vector<size_t>& ids) {
+
+	size_t total = 0;
+	for (size_t i = 0; i < ids.size(); i++) {
+		total += getOperatorWeight(ids[i]);
+	}
+	size_t r = decisionReader.readUIntUniform(total);
+	for (size_t i = 0; i < ids.size(); i++) {
+		size_t weight = getOperatorWeight(ids[i]);
+		if (r < weight) {
+			return i;
+		}
+		r -= weight;
+	}
+	return ids.size() - 1;
+}
+
+
+/*
+ * ___________________________________________________________________________
+ *
+ * True if the whole tree dataUnit belongs to is at most budget long.
+ */
+bool isWithinBudget(const DataUnit& dataUnit, const BC& budget) {
+
+	if (budget.isUndef()) {
+		return true;
+	}
+	const DataUnit* root = &dataUnit;
+	while (root->hasParent()) {
+		root = root->getParent();
+	}
+	return root->getLength() <= budget;
+}
+
+
+/*
+ * ___________________________________________________________________________
+ */
+inline bool isSameLength(const BC& a, const BC& b) {
+
+	return !a.isUndef() && !b.isUndef() && a <= b && b <= a;
+}
+
+
+/*
+ * ___________________________________________________________________________
+ *
+ * The enabled operators, their filters and the repair operator, bound to
+ * the decision reader of one mutation. They are built once per mutation and
+ * shared by the recursive applications, instead of once per call of
+ * applyOperators().
+ */
+class OperatorSet {
+
+public:
 
 	VoidingOperator voidOp;
 	DuplicatingOperator duplOp;
 	DeletingOperator delOp;
-	FuzzIntOperator fuzzIntOp(decisionReader);
-	TruncationFuzzOperator truncFuzzOp(decisionReader);
-	FuzzDataOperator fuzzDataOp(decisionReader, true);
-	AppendingFuzzOperator appFuzzOp(decisionReader);
-	GeneratingFuzzOperator genFuzzOp(decisionReader);
+	FuzzIntOperator fuzzIntOp;
+	TruncationFuzzOperator truncFuzzOp;
+	FuzzDataOperator fuzzDataOp;
+	AppendingFuzzOperator appFuzzOp;
+	GeneratingFuzzOperator genFuzzOp;
+	RepairingFuzzOperator repOp;
 
 	DynamicLengthFilter dynLenFilter;
 	VectorElementFilter vecItemFilter;
-    GeneratingFuzzOpFilter genFuzzOpFilter;
+	GeneratingFuzzOpFilter genFuzzOpFilter;
+	GlobalFilter globalFilter;
 
 	vector<DataUnitOperator*> operators;
 	vector<DataUnitFilter*> filters;
+	vector<bool> growing;
+	vector<size_t> ids;
+
+	OperatorSet(DecisionReader& decisionReader, const vector<bool>& opEnable)
+		: fuzzIntOp(decisionReader), truncFuzzOp(decisionReader),
+		  fuzzDataOp(decisionReader, true), appFuzzOp(decisionReader),
+		  genFuzzOp(decisionReader), repOp(decisionReader) {
+
+		operators.reserve(NUM_OPERATORS);
+		filters.reserve(NUM_OPERATORS);
+		growing.reserve(NUM_OPERATORS);
+		ids.reserve(NUM_OPERATORS);
+
+		if (opEnable.size() <= 0 || opEnable[0]) {
+			operators.push_back(&voidOp);
+			filters.push_back(&dynLenFilter);
+			growing.push_back(false);
+			ids.push_back(OP_VOIDING);
+		}
+		if (opEnable.size() <= 1 || opEnable[1]) {
+			operators.push_back(&duplOp);
+			filters.push_back(&vecItemFilter);
+			growing.push_back(true);
+			ids.push_back(OP_DUPLICATING);
+		}
+		if (opEnable.size() <= 2 || opEnable[2]) {
+			operators.push_back(&delOp);
+			filters.push_back(&vecItemFilter);
+			growing.push_back(false);
+			ids.push_back(OP_DELETING);
+		}
+		if (opEnable.size() <= 3 || opEnable[3]) {
+			operators.push_back(&fuzzIntOp);
+			filters.push_back(0);
+			growing.push_back(false);
+			ids.push_back(OP_FUZZ_INT);
+		}
+		if (opEnable.size() <= 4 || opEnable[4]) {
+			operators.push_back(&truncFuzzOp);
+			filters.push_back(&dynLenFilter);
+			growing.push_back(false);
+			ids.push_back(OP_TRUNCATION);
+		}
+		if (opEnable.size() <= 5 || opEnable[5]) {
+			operators.push_back(&fuzzDataOp);
+			filters.push_back(0);
+			growing.push_back(true);
+			ids.push_back(OP_FUZZ_DATA);
+		}
+		if (opEnable.size() <= 6 || opEnable[6]) {
+			operators.push_back(&appFuzzOp);
+			filters.push_back(&dynLenFilter);
+			growing.push_back(true);
+			ids.push_back(OP_APPENDING);
+		}
+		if (opEnable.size() <= 7 || opEnable[7]) {
+			operators.push_back(&genFuzzOp);
+			filters.push_back(&genFuzzOpFilter);
+			growing.push_back(true);
+			ids.push_back(OP_GENERATING);
+		}
+	}
 
-    if (opEnable.size() <= 0 || opEnable[0]) {
-	    operators.push_back(&voidOp);
-	    filters.push_back(&dynLenFilter);
-    }
-    if (opEnable.size() <= 1 || opEnable[1]) {
-	    operators.push_back(&duplOp);
-	    filters.push_back(&vecItemFilter);
-    }
-    if (opEnable.size() <= 2 || opEnable[2]) {
-	    operators.push_back(&delOp);
-	    filters.push_back(&vecItemFilter);
-    }
-    if (opEnable.size() <= 3 || opEnable[3]) {
-	    operators.push_back(&fuzzIntOp);
-	    filters.push_back(0);
-    }
-    if (opEnable.size() <= 4 || opEnable[4]) {
-	    operators.push_back(&truncFuzzOp);
-	    filters.push_back(&dynLenFilter);
-    }
-    if (opEnable.size() <= 5 || opEnable[5]) {
-	    operators.push_back(&fuzzDataOp);
-	    filters.push_back(0);
-    }
-    if (opEnable.size() <= 6 || opEnable[6]) {
-	    operators.push_back(&appFuzzOp);
-	    filters.push_back(&dynLenFilter);
-    }
-    if (opEnable.size() <= 7 || opEnable[7]) {
-	    operators.push_back(&genFuzzOp);
-	    filters.push_back(&genFuzzOpFilter);
-    }
+};
 
 
-	GlobalFilter globalFilter;
+size_t applyOperators(OperatorSet& ops, DecisionReader& decisionReader,
+		DataUnit& operand, vector<OperationRecord>* trace, int nMaxOp,
+		const BC& budget, size_t depth);
+
+DataUnit* replaceDataUnit(DataUnit& target, const DataUnit& donor);
+
+/*
+ * Data units of the kinds GeneratingFuzzOperator applies to (extensions,
+ * extension lists and cipher suite lists), harvested from the ClientHellos
+ * that produced an output diff, by kind. Every kind keeps at most
+ * kMaxFragmentsPerKind of them, the oldest are replaced first, and a data
+ * unit whose bytes were harvested before is not added again. The digests
+ * of the harvested data units are kept for the whole run, so that one that
+ * was replaced does not come back either.
+ */
+static const size_t kMaxFragmentsPerKind = 256;
+
+struct FragmentKind {
+	vector<std::unique_ptr<DataUnit> > fragments;
+	size_t next;
+};
+
+static std::unordered_map<std::string, FragmentKind> fragmentPool;
+static std::unordered_set<uint64_t> fragmentDigests;
+
+/*
+ * ___________________________________________________________________________
+ *
+ * Half of the time, if the pool has a data unit of the same kind as the
+ * cursor's, puts a copy of it in the place of the cursor's and moves the
+ * cursor there. Returns false if the generator has to synthesise one.
+ */
+bool spliceFragment(DecisionReader& decisionReader, DataUnitCursor& cursor) {
+
+	auto it = fragmentPool.find(cursor.getCurrent().getName());
+	if (it == fragmentPool.end() || !decisionReader.readBoolUniform()) {
+		return false;
+	}
+	const vector<std::unique_ptr<DataUnit> >& fragments = it->second.fragments;
+	const DataUnit& donor =
+			*fragments[decisionReader.readUIntUniform(fragments.size())];
+	cursor.moveTo(replaceDataUnit(cursor.getCurrent(), donor));
+	return true;
+}
+
+/*
+ * ___________________________________________________________________________
+ *
+ * Operators that may make the tree longer are skipped while the whole tree
+ * exceeds budget (undefined: no limit). Every application is appended to
+ * trace unless it is NULL.
+ */
+size_t applyOperators(DecisionReader& decisionReader, DataUnit& operand, vector<OperationRecord>* trace, int nMaxOp, const vector<bool>& opEnable, const BC& budget = BC::undef()) {
+
+	OperatorSet ops(decisionReader, opEnable);
+	return applyOperators(ops, decisionReader, operand, trace, nMaxOp, budget, 0);
+}
+
+
+/*
+ * ___________________________________________________________________________
+ */
+size_t applyOperators(OperatorSet& ops, DecisionReader& decisionReader,
+		DataUnit& operand, vector<OperationRecord>* trace, int nMaxOp,
+		const BC& budget, size_t depth) {
+
+	size_t nOp = 0;
+
+	const vector<DataUnitOperator*>& operators = ops.operators;
+	const vector<bool>& growing = ops.growing;
+	const vector<size_t>& ids = ops.ids;
+	OperatorIndex index(operand, ops.globalFilter, operators, ops.filters);
 
 
     do {
@@ -199,19 +587,18 @@ size_t applyOperators(DecisionReader& decisionReader, DataUnit& operand, string&
             cout << "No operators" << endl;
             break;
         }
-	    size_t iOp = decisionReader.readUIntUniform(operators.size());
+	    size_t iOp = selectOperator(decisionReader, ids);
 	    DataUnitOperator* op = operators[iOp];
-	    DataUnitFilter* opFilter = filters[iOp];
+	    if (growing[iOp] && !isWithinBudget(operand, budget)) {
+	        continue;
+	    }
 
 	    /* select a data unit to operate on at random */
-	    ConjunctionDataUnitFilter filter(globalFilter,
-			    op->getApplicationFilter(), *opFilter);
-
-	    String line;
+	    const vector<DataUnit*>& eligible = index.getEligible(iOp);
 
 	    DataUnitCursor cursor(operand);
 
-	    size_t nDu = cursor.count(filter);
+	    size_t nDu = eligible.size();
         if (nDu == 0) {
             continue;
         }
@@ -219,153 +606,593 @@ size_t applyOperators(DecisionReader& decisionReader, DataUnit& operand, string&
     	bool applyRecursive = false;
 
 		size_t iDu = decisionReader.readUIntUniform(nDu);
-		cursor.seekByIndex(iDu, filter);
-
-		if (op->apply(cursor)) {
+		cursor.moveTo(eligible[iDu]);
+
+		/* operators that resize their operand in place only need a repair
+		 * if its length changed */
+		bool inPlace = ids[iOp] == OP_VOIDING || ids[iOp] == OP_TRUNCATION ||
+				ids[iOp] == OP_APPENDING;
+		BC lengthBefore = inPlace ? cursor.getCurrent().getLength() : BC::undef();
+
+		String path;
+		if (grammarFeedback) {
+			/* before the operator, which may delete the operand */
+			path = cursor.getCurrent().getPath();
+		}
 
-            /* path operator has been applied at */
-		    String path = cursor.getCurrent().getPath();
+		OperationRecord record = OperationRecord();
+		if (trace != NULL) {
+			record.op = ids[iOp];
+			record.depth = depth;
+			record.node = iDu;
+			record.before = cursor.getCurrent().getLength().byteCeil();
+		}
 
-            /* operator name */
-			PropertyNode& opLog = op->getLastOperationLog();
-			string opType = "unknown";
-			opLog.propGet<string>("operator.type", opType);
+		if ((ids[iOp] == OP_GENERATING && spliceFragment(decisionReader, cursor))
+				|| op->apply(cursor)) {
 
-		    line = String::format("%s@%s: ", opType.c_str(), path.c_str());
+			opStats[ids[iOp]].uses++;
+			appliedOperators.push_back(ids[iOp]);
+			if (grammarFeedback) {
+				uint64_t h = std::hash<std::string>()(path) ^
+						(ids[iOp] * 0x9E3779B97F4A7C15ULL);
+				mutationFeatures.push_back(h % kNumGrammarCounters);
+			}
 
 			bool repair = true;
 
-			if (opType == "VoidingOperator") {
-
-				line.append("voided");
-
-			} else if (opType == "DuplicatingOperator") {
-
-				line.append("duplicated");
+			switch (ids[iOp]) {
+			case OP_DUPLICATING:
+			case OP_GENERATING:
 				applyRecursive = true;
-
-			} else if (opType == "DeletingOperator") {
-
-				line.append("deleted");
-
-			} else if (opType == "TruncationFuzzOperator") {
-
-				line.appendFormat("truncated %s -> %s",
-						opLog.propGet<string>("operand.length").c_str(),
-						opLog.propGet<string>("operand.length.after").c_str());
-
-			} else if (opType == "FuzzDataOperator") {
-
+				break;
+			case OP_FUZZ_DATA:
+			case OP_FUZZ_INT:
 				repair = false;
-				line.appendFormat("random content -> %s",
-						opLog.propGet<string>("operand.length.after").c_str());
-
-			} else if (opType == "FuzzIntOperator") {
-
+				break;
+			}
+			if (inPlace && isSameLength(cursor.getCurrent().getLength(),
+					lengthBefore)) {
 				repair = false;
-				line.appendFormat("%s --> %s",
-						opLog.propGetDefault<string>("int.before", "##").c_str(),
-						opLog.propGet<string>("int.after").c_str());
-
-			} else if (opType == "AppendingFuzzOperator") {
-
-				line.append("AppendingFuzzOperator");
-
-			} else if (opType == "GeneratingFuzzOperator") {
-
-				line.append("GeneratingFuzzOperator");
-				applyRecursive = true;
-
-			} else if (opType == "unknown") {
-
-				line.append("unknown operator");
+			}
 
+			if (trace != NULL) {
+				if (ids[iOp] == OP_DELETING) {
+					record.after = 0;
+				} else if (ids[iOp] == OP_FUZZ_INT) {
+					PropertyNode& opLog = op->getLastOperationLog();
+					record.before = strtoll(opLog.propGetDefault<string>(
+							"int.before", "0").c_str(), NULL, 0);
+					record.after = strtoll(opLog.propGetDefault<string>(
+							"int.after", "0").c_str(), NULL, 0);
+				} else {
+					record.after = cursor.getCurrent().getLength().byteCeil();
+				}
+				record.repaired = repair;
 			}
 
 			if (repair) {
-				RepairingFuzzOperator repOp(decisionReader);
-				repOp.apply(cursor);
-				line.append(" ");
-				line.append(repOp.getLastOperationLog().propGet<string>("operator.repairtrace"));
+				ops.repOp.apply(cursor);
+			}
+
+			/* only integer fuzzing is guaranteed to leave the tree's
+			 * structure, and thus the eligible data units, unchanged */
+			if (ids[iOp] != OP_FUZZ_INT) {
+				index.invalidate();
 			}
 
 			nOp += 1;
-		    if (summary.length() > 0) {
-			    summary.append("\n");
-		    }
-		    summary.append(line);
+			if (trace != NULL) {
+				trace->push_back(record);
+			}
 
             if (decisionReader.readBoolUniform()
                     && cursor.valid()
                     && applyRecursive
-                    && ((nMaxOp < 0) || (nOp < (size_t)nMaxOp))) {
+                    && ((nMaxOp < 0) || (nOp < (size_t)nMaxOp))
+                    && !isOutOfTime()) {
 
-	            nOp += applyOperators(decisionReader, cursor.getCurrent(),
-                        summary, nMaxOp < 0 ? nMaxOp : nMaxOp - nOp, opEnable);
+	            nOp += applyOperators(ops, decisionReader, cursor.getCurrent(),
+                        trace, nMaxOp < 0 ? nMaxOp : nMaxOp - nOp, budget,
+                        depth + 1);
+	            index.invalidate();
             }
 		}
 
     } while (((nMaxOp < 0) || (nOp < (size_t)nMaxOp))
 //            && (decisionReader.readUIntUniform(256) < 200));
-            && decisionReader.readBoolUniform());
+            && decisionReader.readBoolUniform()
+            && !isOutOfTime());
 
 	return nOp;
 }
 
-int mutate(string inputRandomFile,uint8_t* CurrentUnitData,size_t size) {
+/*
+ * Number of random bytes the operators may consume per mutation; the same
+ * as the size of the random files formerly generated by generate.sh.
+ */
+static const size_t kDecisionStreamSize = 10 * 1024;
+
+/*
+ * ___________________________________________________________________________
+ */
+void fillDecisionBuffer(VectorBuffer& buffer, unsigned int seed) {
+
+	std::mt19937 prng(seed);
+	uint8_t bytes[kDecisionStreamSize];
+	for (size_t i = 0; i < kDecisionStreamSize; i += 4) {
+		uint32_t word = prng();
+		memcpy(bytes + i, &word, 4);
+	}
+	buffer.appendBytes(bytes, kDecisionStreamSize);
+}
+
+/*
+ * Dissected ClientHello trees, keyed by the exact bytes dissectFromBuffer()
+ * read them from. libFuzzer mutates the same corpus unit several times in a
+ * row, so most lookups hit. The trees that mutate(), crossOver() and
+ * shrink() produce are not cached: even with their lengths repaired, the
+ * dissector may split their bytes into other data units (a truncated unit,
+ * say, reads as the start of the next one), and a mutation must only depend
+ * on its input and seed, not on which of the two trees the cache holds.
+ */
+typedef std::unordered_map<std::string, std::unique_ptr<DataUnit> > TreeCache;
+static const size_t kMaxCachedTrees = 4096;
+static TreeCache treeCache;
+
+/*
+ * Operators applied by recent mutations, and their traces if they are
+ * recorded, keyed by the mutant they produced, until libFuzzer reports the
+ * mutant back as interesting (or never does).
+ */
+struct RecentMutation {
+	vector<size_t> operators;
+	vector<OperationRecord> trace;
+};
+static const size_t kMaxRecentMutations = 1024;
+static std::unordered_map<std::string, RecentMutation> recentMutations;
+
+/*
+ * ___________________________________________________________________________
+ *
+ * One line per operator application, indented by its recursion depth.
+ */
+string renderMutationTrace(const vector<OperationRecord>& trace) {
+
+	String text;
+	for (size_t i = 0; i < trace.size(); i++) {
+		const OperationRecord& r = trace[i];
+		text.appendRepeated("  ", r.depth + 1);
+		text.appendFormat("%s@#%u: ", kOperatorNames[r.op], r.node);
+		switch (r.op) {
+		case OP_VOIDING:
+			text.append("voided");
+			break;
+		case OP_DUPLICATING:
+			text.append("duplicated");
+			break;
+		case OP_DELETING:
+			text.append("deleted");
+			break;
+		case OP_FUZZ_INT:
+			text.appendFormat("%lld --> %lld", (long long)r.before,
+					(long long)r.after);
+			break;
+		case OP_FUZZ_DATA:
+			text.appendFormat("random content -> %lld", (long long)r.after);
+			break;
+		default:
+			text.appendFormat("%lld -> %lld bytes", (long long)r.before,
+					(long long)r.after);
+			break;
+		}
+		if (r.repaired) {
+			text.append(", repaired");
+		}
+		text.append("\n");
+	}
+	return text;
+}
+
+/*
+ * ___________________________________________________________________________
+ */
+TreeCache::iterator cacheDissectedTree(const std::string& key,
+		std::unique_ptr<DataUnit> tree) {
+
+	if (treeCache.size() >= kMaxCachedTrees) {
+		treeCache.clear();
+	}
+	auto it = treeCache.insert(std::make_pair(key, nullptr)).first;
+	it->second = std::move(tree);
+	return it;
+}
+
+/*
+ * ___________________________________________________________________________
+ */
+std::unique_ptr<DataUnit> getDissectedTree(const uint8_t* data, size_t size) {
+
+	std::string key((const char*)data, size);
+	auto it = treeCache.find(key);
+	if (it == treeCache.end()) {
+		VectorBuffer inBuf;
+		inBuf.appendBytes(data, size);
+		std::unique_ptr<DataUnit> tree(new TVector_MainType());
+		tree->dissector().dissectFromBuffer(inBuf);
+		it = cacheDissectedTree(key, std::move(tree));
+	}
+	/* operators work on a copy, the cached tree stays untouched */
+	return std::unique_ptr<DataUnit>(it->second->clone());
+}
+
+/*
+ * Number of times mutate() starts over from the original tree when the
+ * mutated one does not fit into maxSize bytes.
+ */
+static const size_t kMaxMutateAttempts = 4;
+
+/*
+ * Bytes by which the operators grew the ClientHello in the mutations that
+ * grew it, whether or not the result fit into maxSize, as a running average
+ * over about kLengthStepWindow mutations: roughly what one more extension
+ * or list entry costs. No step is smaller than an empty extension.
+ */
+static const size_t kMinLengthStep = 4;
+static const size_t kLengthStepWindow = 8;
+static size_t lengthStep = kMinLengthStep;
+
+int mutate(unsigned int seed,uint8_t* CurrentUnitData,size_t size,size_t maxSize) {
 	vector<bool> opEnable;
-	size_t nMaxOp = -1;
+	int nMaxOp = maxOpsPerMutation;
+	size_t nOp = 0;
  	/*
 	for (size_t ic = 0; ic < 8; ic++) {
 		opEnable.push_back(true);
 	}*/	
-	String tmp;
-        for(size_t i = 0;i < size; i++)
-	{
-		char buf[3];
-		sprintf(buf,"%02x",CurrentUnitData[i]);
-		tmp.append(buf);
-	}
-
-	/* load the ClientHello template */
-	VectorBuffer inBuf;
-	inBuf.appendFromString(tmp);
-	/* dissect and print original ClientHello */
-	TVector_MainType printRec;
-	printRec.dissector().dissectFromBuffer(inBuf);
-	//printRec.print();
-
-	/* fuzzing infrastructure */
-	FileStreamReader ctrlStream(inputRandomFile);
-	DecisionReader selector(ctrlStream);
+	const BC budget((ssize_t)maxSize);
+	std::unique_ptr<DataUnit> outRec;
 
+	if (mutationsInEpoch++ % kWeightEpoch == 0) {
+		snapshotOperatorWeights();
+	}
 
-	String line;
-	std::map<string, bool> hashMap;
-        size_t nDuplicates = 0;
+	mutationOutOfTime = false;
+	if (mutationTimeBudgetNs) {
+		mutationDeadlineNs = monotonicNs() + mutationTimeBudgetNs;
+	}
 
-	
-	TVector_MainType outRec;
-	outRec.dissector().dissectFromBuffer(inBuf);
-	VectorBuffer outBuf;
-        size_t nOp = 0;
-	String summary;
+	for (size_t attempt = 0; attempt < kMaxMutateAttempts; attempt++) {
 
-        nOp = applyOperators(selector, outRec, summary, nMaxOp, opEnable);
+		appliedOperators.clear();
+		mutationTrace.clear();
+		mutationFeatures.clear();
 
-        outRec.copyTo(outBuf);
+		/* load the ClientHello, preferably from the cache */
+		outRec = getDissectedTree(CurrentUnitData, size);
+
+		/* fuzzing infrastructure: decisions are drawn from a PRNG seeded
+		 * by libFuzzer, so a mutation can be reproduced from its seed */
+		VectorBuffer ctrlBuf;
+		fillDecisionBuffer(ctrlBuf, seed + attempt);
+		BufferStreamReader ctrlStream(ctrlBuf);
+		DecisionReader selector(ctrlStream);
+
+		nOp = applyOperators(selector, *outRec,
+				traceMutations ? &mutationTrace : NULL, nMaxOp, opEnable,
+				budget);
+		if (outRec->getLength() <= budget || mutationOutOfTime) {
+			break;
+		}
+	}
+
+	size_t bucket = 0;
+	while ((nOp >> bucket) && bucket + 1 < kNumOpsBuckets) {
+		bucket++;
+	}
+	opsPerMutation[bucket]++;
+	if (nMaxOp >= 0 && nOp >= (size_t)nMaxOp) {
+		mutationsAtOpLimit++;
+	}
+	if (mutationOutOfTime) {
+		mutationsOutOfTime++;
+	}
+
+	VectorBuffer outBuf;
+        outRec->copyTo(outBuf);
 	
+	/* a tree that still does not fit is cut off at maxSize */
 	const uint8_t* tmp_data = outBuf.getDataPointer();
 	BC BC_length = outBuf.getLength();
-	size_t length = BC_length.byteCeil();
-	for(int i = 0; i < length; i++)
-	{
-		CurrentUnitData[i] = tmp_data[i];
+	if (BC_length.byteCeil() > size) {
+		lengthStep = std::max(kMinLengthStep,
+				(lengthStep * (kLengthStepWindow - 1) +
+				 BC_length.byteCeil() - size) / kLengthStepWindow);
+	}
+	size_t length = std::min(BC_length.byteCeil(), maxSize);
+	memcpy(CurrentUnitData, tmp_data, length);
+	if (recentMutations.size() >= kMaxRecentMutations) {
+		recentMutations.clear();
+	}
+	RecentMutation& recent =
+			recentMutations[std::string((const char*)CurrentUnitData, length)];
+	recent.operators = appliedOperators;
+	recent.trace = mutationTrace;
+	if (grammarFeedback) {
+		std::lock_guard<std::mutex> lock(mutantFeaturesLock);
+		if (mutantFeatures.size() >= kMaxPendingMutants) {
+			mutantFeatures.clear();
+		}
+		mutantFeatures[std::string((const char*)CurrentUnitData, length)] =
+				mutationFeatures;
+	}
+	return length;
+}
+
+
+/*
+ * ___________________________________________________________________________
+ *
+ * Puts a copy of donor in the place of target, which it deletes.
+ */
+DataUnit* replaceDataUnit(DataUnit& target, const DataUnit& donor) {
+
+	DataUnit* copy = donor.clone();
+	target.replaceBy(copy);
+	return copy;
+}
+
+
+/*
+ * ___________________________________________________________________________
+ *
+ * Sets the grammar counters of the input if it is a recent mutant. libFuzzer
+ * clears them before every callback.
+ */
+void setGrammarCounters(const uint8_t* data, size_t size) {
+
+	std::lock_guard<std::mutex> lock(mutantFeaturesLock);
+	auto it = mutantFeatures.find(std::string((const char*)data, size));
+	if (it == mutantFeatures.end()) {
+		return;
+	}
+	const vector<uint32_t>& features = it->second;
+	for (size_t i = 0; i < features.size(); i++) {
+		uint8_t& counter = grammarCounters[features[i]];
+		if (counter < 255) {
+			counter++;
+		}
 	}
+}
+
+
+/*
+ * ___________________________________________________________________________
+ *
+ * Structure-aware crossover: replaces an extension, the extension list or
+ * the cipher suite list of the first ClientHello by a copy of the data unit
+ * of the same kind from the second one and repairs the lengths around it.
+ * Returns 0 if the ClientHellos have no such pair or a result that fits
+ * into maxSize bytes is not found.
+ */
+size_t crossOver(unsigned int seed, const uint8_t* data1, size_t size1,
+		const uint8_t* data2, size_t size2, uint8_t* out, size_t maxSize) {
+
+	GeneratingFuzzOpFilter filter;
+	const BC budget((ssize_t)maxSize);
+	std::unique_ptr<DataUnit> donorRec = getDissectedTree(data2, size2);
+	vector<DataUnit*> donors;
+	DataUnitCursor(*donorRec).enumerate(donors, filter);
+	if (donors.empty()) {
+		return 0;
+	}
+
+	for (size_t attempt = 0; attempt < kMaxMutateAttempts; attempt++) {
+
+		std::unique_ptr<DataUnit> outRec = getDissectedTree(data1, size1);
+		vector<DataUnit*> candidates;
+		DataUnitCursor cursor(*outRec);
+		cursor.enumerate(candidates, filter);
+
+		VectorBuffer ctrlBuf;
+		fillDecisionBuffer(ctrlBuf, seed + attempt);
+		BufferStreamReader ctrlStream(ctrlBuf);
+		DecisionReader selector(ctrlStream);
+
+		/* only swap data units of the same kind */
+		const DataUnit& donor = *donors[selector.readUIntUniform(donors.size())];
+		vector<DataUnit*> targets;
+		for (size_t i = 0; i < candidates.size(); i++) {
+			if (candidates[i]->getName() == donor.getName()) {
+				targets.push_back(candidates[i]);
+			}
+		}
+		if (targets.empty()) {
+			continue;
+		}
+
+		DataUnit& target = *targets[selector.readUIntUniform(targets.size())];
+		cursor.moveTo(replaceDataUnit(target, donor));
+		RepairingFuzzOperator repOp(selector);
+		repOp.apply(cursor);
+		if (!(outRec->getLength() <= budget)) {
+			continue;
+		}
+
+		VectorBuffer outBuf;
+		outRec->copyTo(outBuf);
+		size_t length = outBuf.getLength().byteCeil();
+		memcpy(out, outBuf.getDataPointer(), length);
+		/* not cached, see TreeCache */
+		return length;
+	}
+	return 0;
+}
+
+
+/*
+ * ___________________________________________________________________________
+ *
+ * One step of -minimize_diff: voids, deletes or truncates a single data unit
+ * of the ClientHello and repairs the lengths around it. Returns 0 if the
+ * result is not shorter.
+ */
+size_t shrink(unsigned int seed, const uint8_t* data, size_t size,
+		uint8_t* out, size_t maxSize) {
+
+	/* only the voiding, deleting and truncating operators */
+	vector<bool> opEnable(NUM_OPERATORS, false);
+	opEnable[OP_VOIDING] = true;
+	opEnable[OP_DELETING] = true;
+	opEnable[OP_TRUNCATION] = true;
+
+	std::unique_ptr<DataUnit> outRec = getDissectedTree(data, size);
+
+	VectorBuffer ctrlBuf;
+	fillDecisionBuffer(ctrlBuf, seed);
+	BufferStreamReader ctrlStream(ctrlBuf);
+	DecisionReader selector(ctrlStream);
+
+	applyOperators(selector, *outRec, NULL, 1, opEnable);
+
+	VectorBuffer outBuf;
+	outRec->copyTo(outBuf);
+	size_t length = outBuf.getLength().byteCeil();
+	if (length >= size || length > maxSize) {
+		return 0;
+	}
+	memcpy(out, outBuf.getDataPointer(), length);
+	/* not cached, see TreeCache */
 	return length;
 }
 
 
+/*
+ * With --tls_fragment_pool=<file> the fuzzer processes sharing the file
+ * (e.g. the -jobs of one run) also take the fragments the others harvested.
+ * Every record names a data unit by the ClientHello it was harvested from
+ * and its index among the data units the pool takes from that ClientHello,
+ * so that a reader gets it from the same dissection. Records are appended
+ * with a single write() each until the file reaches kMaxFragmentFileSize.
+ */
+static const off_t kMaxFragmentFileSize = 64 << 20;
+
+struct FragmentRecordHeader {
+	uint32_t size;
+	uint32_t index;
+};
+
+static int fragmentFd = -1;
+static off_t fragmentFileRead = 0;
+
+/*
+ * ___________________________________________________________________________
+ *
+ * Adds a copy of the data unit to the pool unless one of the same kind with
+ * the same bytes was added before. Returns true if it was added.
+ */
+bool addFragment(DataUnit& dataUnit) {
+
+	VectorBuffer buf;
+	dataUnit.copyTo(buf);
+	std::string key = dataUnit.getName();
+	key.push_back('\0');
+	key.append((const char*)buf.getDataPointer(), buf.getLength().byteCeil());
+	if (!fragmentDigests.insert(std::hash<std::string>()(key)).second) {
+		return false;
+	}
+	FragmentKind& kind = fragmentPool[dataUnit.getName()];
+	std::unique_ptr<DataUnit> copy(dataUnit.clone());
+	if (kind.fragments.size() < kMaxFragmentsPerKind) {
+		kind.fragments.push_back(std::move(copy));
+	} else {
+		kind.fragments[kind.next] = std::move(copy);
+		kind.next = (kind.next + 1) % kMaxFragmentsPerKind;
+	}
+	return true;
+}
+
+/*
+ * ___________________________________________________________________________
+ *
+ * Harvests the data units of a ClientHello; only the one at onlyIndex if it
+ * is not -1. New ones are appended to the shared file if share is set.
+ */
+void harvestFragments(const uint8_t* data, size_t size, long onlyIndex,
+		bool share) {
+
+	std::unique_ptr<DataUnit> tree = getDissectedTree(data, size);
+	GeneratingFuzzOpFilter filter;
+	vector<DataUnit*> candidates;
+	DataUnitCursor(*tree).enumerate(candidates, filter);
+
+	for (size_t i = 0; i < candidates.size(); i++) {
+		if (onlyIndex >= 0 && i != (size_t)onlyIndex) {
+			continue;
+		}
+		if (!addFragment(*candidates[i]) || !share || fragmentFd < 0) {
+			continue;
+		}
+		struct stat st;
+		if (fstat(fragmentFd, &st) != 0 || st.st_size >= kMaxFragmentFileSize) {
+			continue;
+		}
+		FragmentRecordHeader header = { (uint32_t)size, (uint32_t)i };
+		vector<uint8_t> record(sizeof(header) + size);
+		memcpy(record.data(), &header, sizeof(header));
+		memcpy(record.data() + sizeof(header), data, size);
+		if (write(fragmentFd, record.data(), record.size()) < 0) {
+			/* keep the pool to ourselves from now on */
+			close(fragmentFd);
+			fragmentFd = -1;
+		}
+	}
+}
+
+/*
+ * ___________________________________________________________________________
+ *
+ * Takes the complete records the file got since the last call.
+ */
+void readSharedFragments() {
+
+	struct stat st;
+	if (fragmentFd < 0 || fstat(fragmentFd, &st) != 0 ||
+			st.st_size <= fragmentFileRead) {
+		return;
+	}
+	vector<uint8_t> records(st.st_size - fragmentFileRead);
+	ssize_t n = pread(fragmentFd, records.data(), records.size(),
+			fragmentFileRead);
+	size_t pos = 0;
+	while (n > 0 && pos + sizeof(FragmentRecordHeader) <= (size_t)n) {
+		FragmentRecordHeader header;
+		memcpy(&header, records.data() + pos, sizeof(header));
+		if (pos + sizeof(header) + header.size > (size_t)n) {
+			/* still being written */
+			break;
+		}
+		harvestFragments(records.data() + pos + sizeof(header), header.size,
+				header.index, false);
+		pos += sizeof(header) + header.size;
+	}
+	fragmentFileRead += pos;
+}
+
+/*
+ * ___________________________________________________________________________
+ */
+bool openFragmentPool(const char* path) {
+
+	fragmentFd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (fragmentFd < 0) {
+		return false;
+	}
+	readSharedFragments();
+	return true;
+}
+
+
 void writeToFile(const string& filename, const string& text, bool append) {
 
 	ios_base::openmode mode = std::ofstream::out;
@@ -387,120 +1214,438 @@ void writeToFile(const string& filename, const string& text, bool append) {
 int ret_openssl = FAILURE_INTERNAL;
 #endif
 */
-#define INCLUDE(name) \
-static fp_t do_handshake_ ##name = NULL; \
-static void *h_ ##name = NULL; \
-int ret_ ##name = FAILURE_INTERNAL; \
-
-#ifdef CONFIG_USE_OPENSSL
-#include "openssl.h"
-INCLUDE(openssl)
-#endif
+#include "registry.h"
+#include "restore.h"
+
+// Decodes the base64 body of the first PEM block of path into *der
+static bool read_pem_der(const char *path, vector<uint8_t> *der) {
+  std::ifstream ifs(path);
+  string line;
+  bool in_block = false;
+  uint32_t bits = 0;
+  int nbits = 0;
+  der->clear();
+  while (std::getline(ifs, line)) {
+    if (!line.compare(0, 5, "-----")) {
+      if (in_block)
+        return !der->empty();
+      in_block = true;
+      continue;
+    }
+    if (!in_block)
+      continue;
+    for (char c : line) {
+      int v;
+      if (c >= 'A' && c <= 'Z') v = c - 'A';
+      else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+      else if (c >= '0' && c <= '9') v = c - '0' + 52;
+      else if (c == '+') v = 62;
+      else if (c == '/') v = 63;
+      else continue;
+      bits = (bits << 6) | v;
+      nbits += 6;
+      if (nbits >= 8) {
+        nbits -= 8;
+        der->push_back((bits >> nbits) & 0xff);
+      }
+    }
+  }
+  return false;
+}
 
-#ifdef CONFIG_USE_LIBRESSL
-#include "libressl.h"
-INCLUDE(libressl)
-#endif
+// The server's certificate and key as DER, kept for the libraries that are
+// reloaded later
+static vector<uint8_t> gl_cert, gl_key;
+static bool gl_have_credentials = false;
+
+// Returns 0 on success.
+static int warm_up_impl(struct tls_impl *impl) {
+  if (!gl_have_credentials || impl->live)
+    return 0;
+  if (!impl->init) {
+    fprintf(stderr, "%s: no %s, initialised on the first handshake\n",
+            impl->name, FN_INIT_TLS);
+    return 0;
+  }
+  struct tls_credentials creds = {
+    gl_cert.data(), (uint32_t)gl_cert.size(),
+    gl_key.data(), (uint32_t)gl_key.size()
+  };
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (impl->init(&creds)) {
+    fprintf(stderr, "ERROR: %s cannot be initialised\n", impl->name);
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  impl->init_ms = (end.tv_sec - start.tv_sec) * 1e3 +
+                  (end.tv_nsec - start.tv_nsec) / 1e6;
+  fprintf(stderr, "%s: initialised in %.3f ms\n", impl->name,
+          impl->init_ms);
+  return 0;
+}
 
-#ifdef CONFIG_USE_BORINGSSL
-#include "boringssl.h"
-INCLUDE(boringssl)
-#endif
+// Initialises every library that exports FN_INIT_TLS from one copy of the
+// server's certificate and key, so that none of them parses PEM files
+// during the first measured execution.
+static void warm_up_impls() {
+  if (!read_pem_der(SERVER_CERT_FILE, &gl_cert) ||
+      !read_pem_der(SERVER_KEY_FILE, &gl_key)) {
+    fprintf(stderr, "WARNING: cannot read %s and %s, the libraries load "
+            "them on their first handshake\n", SERVER_CERT_FILE,
+            SERVER_KEY_FILE);
+    return;
+  }
+  gl_have_credentials = true;
+  for (size_t i = 0; i < 2 * gl_num_impls; i++) {
+    struct tls_impl *impl = i < gl_num_impls ? &gl_impls[i]
+                                             : gl_impls[i - gl_num_impls].fast;
+    if (impl && warm_up_impl(impl))
+      exit(1);
+  }
+}
 
-#ifdef CONFIG_USE_WOLFSSL
-#include "wolfssl.h"
-INCLUDE(wolfssl)
-#endif
+// Loads everything before the first execution is measured
+static void init_impls(const char *config) {
+  if (gl_num_impls)
+    return;
+  load_impls(config, FN_DO_HANDSHAKE);
+  warm_up_impls();
+}
 
-#ifdef CONFIG_USE_MBEDTLS
-#include "mbedtls.h"
-INCLUDE(mbedtls)
-#endif
+// A build that LLVMFuzzerCustomReload() loaded again records its globals
+// anew and is initialised like at the start. Returns 0 on success.
+static int init_reloaded_impl(struct tls_impl *impl) {
+  restore_free(impl->globals);
+  impl->globals = NULL;
+  impl->num_runs = 0;
+  impl->ran = false;
+  return warm_up_impl(impl);
+}
 
-#ifdef CONFIG_USE_GNUTLS
-#include "gnutls.h"
-INCLUDE(gnutls)
-#endif
+// With --tls_output_digest=1 the signature bits of a return value are the
+// digest of the library's whole reply instead of its version and cipher
+// suite, so that replies which differ anywhere in their ServerHello are
+// told apart. Libraries without FN_HANDSHAKE_OUTPUT keep their signatures.
+static bool gl_output_digest = false;
+
+// --tls_restore_globals=1: see restore.h
+static bool gl_restore_globals = false;
+
+extern "C" int LLVMFuzzerInitialize(int *argc, char ***argv) {
+  const char *config = NULL;
+  const char *flag = "--tls_impls=";
+  const char *digest_flag = "--tls_output_digest=";
+  const char *trace_flag = "--tls_mutation_trace=";
+  const char *pool_flag = "--tls_fragment_pool=";
+  const char *grammar_flag = "--tls_grammar_counters=";
+  const char *max_ops_flag = "--tls_max_ops=";
+  const char *weights_flag = "--tls_operator_weights=";
+  const char *time_budget_flag = "--tls_mutation_budget_us=";
+  const char *live_conns_flag = "--tls_live_connections=";
+  const char *restore_flag = "--tls_restore_globals=";
+  const char *live_timeout_flag = "--tls_live_timeout_ms=";
+  for (int i = 1; i < *argc; i++) {
+    if (!strncmp((*argv)[i], flag, strlen(flag)))
+      config = (*argv)[i] + strlen(flag);
+    if (!strncmp((*argv)[i], digest_flag, strlen(digest_flag)))
+      gl_output_digest = atoi((*argv)[i] + strlen(digest_flag)) != 0;
+    if (!strncmp((*argv)[i], trace_flag, strlen(trace_flag)))
+      traceMutations = atoi((*argv)[i] + strlen(trace_flag)) != 0;
+    if (!strncmp((*argv)[i], max_ops_flag, strlen(max_ops_flag)))
+      maxOpsPerMutation = atoi((*argv)[i] + strlen(max_ops_flag));
+    if (!strncmp((*argv)[i], weights_flag, strlen(weights_flag)))
+      adaptiveWeights = atoi((*argv)[i] + strlen(weights_flag)) != 0;
+    if (!strncmp((*argv)[i], time_budget_flag, strlen(time_budget_flag)))
+      mutationTimeBudgetNs =
+          strtoull((*argv)[i] + strlen(time_budget_flag), NULL, 10) * 1000;
+    if (!strncmp((*argv)[i], grammar_flag, strlen(grammar_flag)))
+      grammarFeedback = atoi((*argv)[i] + strlen(grammar_flag)) != 0;
+    if (!strncmp((*argv)[i], live_conns_flag, strlen(live_conns_flag)))
+      live_max_connections =
+          std::max(1, atoi((*argv)[i] + strlen(live_conns_flag)));
+    if (!strncmp((*argv)[i], live_timeout_flag, strlen(live_timeout_flag)))
+      live_timeout_ms = atoi((*argv)[i] + strlen(live_timeout_flag));
+    if (!strncmp((*argv)[i], restore_flag, strlen(restore_flag)))
+      gl_restore_globals = atoi((*argv)[i] + strlen(restore_flag)) != 0;
+    if (!strncmp((*argv)[i], pool_flag, strlen(pool_flag)) &&
+        !openFragmentPool((*argv)[i] + strlen(pool_flag)))
+      fprintf(stderr, "WARNING: can't open the fragment pool %s\n",
+              (*argv)[i] + strlen(pool_flag));
+  }
+  init_impls(config);
+  return 0;
+}
 
+UserCallbacks callback_cont = { NULL, 0 };
+
+// The globals of an implementation are recorded before its second input,
+// so that what it sets up lazily on its first handshake is part of the
+// recording, and restored before each input after that.
+static void restore_globals(struct tls_impl *impl) {
+  if (impl->globals) {
+    restore_dirty(impl->globals);
+  } else if (impl->num_runs == 1) {
+    impl->globals = restore_record(impl->handle);
+    if (impl->globals)
+      fprintf(stderr, "%s: recorded %zd pages of globals\n", impl->name,
+              impl->globals->pages);
+    else
+      fprintf(stderr, "WARNING: cannot find the segments of %s, its globals "
+              "are not restored\n", impl->libpath);
+  }
+  impl->ran = false;
+}
 
-#define INIT_LIB(name, NAME) \
-  if (!do_handshake_ ##name) { \
-    do_handshake_ ##name = \
-      (fp_t)get_interface_fn(h_ ##name, LIB_ ##NAME, FN_DO_HANDSHAKE); \
-    fprintf(stderr, #name " %p\n", do_handshake_ ##name); \
-    if (!do_handshake_ ##name) \
-      DBG("ERROR resolving function from: %s\n", LIB_ ##NAME); \
-  } \
-  assert(do_handshake_ ##name != NULL);
+// The soft-dirty bits are cleared for the whole process, so the globals of
+// all implementations are restored at once, and the bits cleared once,
+// when the first callback of the next input runs: the first one to run
+// again since the last restore. The callbacks must therefore not run at the
+// same time (-diff_parallel, -diff_threads).
+static void restore_all_globals(struct tls_impl *impl) {
+  if (!impl->ran)
+    return;
+  for (size_t i = 0; i < 2 * gl_num_impls; i++) {
+    struct tls_impl *other = i < gl_num_impls ? &gl_impls[i]
+                                              : gl_impls[i - gl_num_impls].fast;
+    if (other && !other->live && other->num_runs)
+      restore_globals(other);
+  }
+  restore_clear();
+}
 
-#define DO_HANDSHAKE_ONE(name) \
-  ret_ ##name = do_handshake_ ##name(Data, Size);
+static int run_impl(size_t i, struct tls_impl *impl, const uint8_t *Data,
+                    size_t Size) {
+  if (grammarFeedback && impl == &gl_impls[i])
+    setGrammarCounters(Data, Size);
+  if (impl->live) {
+    struct live_job job = {impl->live, Data, Size, 0};
+    live_run(&job, 1);
+    return job.result;
+  }
+  if (gl_restore_globals) {
+    restore_all_globals(impl);
+    impl->ran = true;
+  }
+  impl->num_runs++;
+  if (!gl_output_digest || !impl->handshake_output)
+    return impl->do_handshake(Data, Size);
+  int ret = impl->handshake_output(Data, Size, &impl->output);
+  uint32_t digest = impl->output.digest;
+  return (int)((((digest ^ (digest >> 24)) & 0xffffff) << 8) | (ret & 0xff));
+}
 
-struct GlobalInitializer {
-  GlobalInitializer() {
+static UserCallbacks fast_callback_cont = { NULL, 0 };
 
-#ifdef CONFIG_USE_OPENSSL
-    INIT_LIB(openssl, OPENSSL)
-#endif
-#ifdef CONFIG_USE_LIBRESSL
-    INIT_LIB(libressl, LIBRESSL)
-#endif
-#ifdef CONFIG_USE_LIBRESSL
-    INIT_LIB(boringssl, BORINGSSL)
-#endif
-#ifdef CONFIG_USE_WOLFSSL
-    INIT_LIB(wolfssl, WOLFSSL)
-#endif
-    // initialize all diff-based structures
-    // diff_init();
+typedef void (*BatchInputDone)(size_t Idx);
+typedef void (*UserBatchCallback)(const uint8_t *const *Data,
+                                  const size_t *Sizes, size_t N, int *Results,
+                                  BatchInputDone InputDone);
+struct UserBatchCallbacks {
+  UserBatchCallback *callbacks;
+  int size;
+} batch_callback_cont = { NULL, 0 };
+
+// With -diff_batch=N the first batch callback of a live server sends all N
+// inputs to all live servers at once; the others take their results from
+// gl_live_jobs, laid out input by input, as long as they get the same batch.
+// Each thread keeps its own batch, so callbacks run by -diff_threads
+// executors send it again rather than race on one.
+static thread_local vector<vector<uint8_t>> gl_live_batch;
+static thread_local vector<struct live_job> gl_live_jobs;
+
+static bool is_live_batch(const uint8_t *const *Data, const size_t *Sizes,
+                          size_t N) {
+  if (gl_live_batch.size() != N)
+    return false;
+  for (size_t j = 0; j < N; j++)
+    if (gl_live_batch[j].size() != Sizes[j] ||
+        memcmp(gl_live_batch[j].data(), Data[j], Sizes[j]))
+      return false;
+  return true;
+}
+
+static void run_live_batch(const uint8_t *const *Data, const size_t *Sizes,
+                           size_t N) {
+  gl_live_batch.resize(N);
+  gl_live_jobs.resize(N * gl_num_live);
+  for (size_t j = 0; j < N; j++) {
+    gl_live_batch[j].assign(Data[j], Data[j] + Sizes[j]);
+    for (size_t k = 0; k < gl_num_live; k++) {
+      struct live_job &job = gl_live_jobs[j * gl_num_live + k];
+      job.server = &gl_live_servers[k];
+      job.data = gl_live_batch[j].data();
+      job.size = Sizes[j];
+    }
   }
+  live_run(gl_live_jobs.data(), gl_live_jobs.size());
+}
+
+template <size_t I>
+static void call_impl_batch(const uint8_t *const *Data, const size_t *Sizes,
+                            size_t N, int *Results, BatchInputDone InputDone) {
+  struct tls_impl *impl = &gl_impls[I];
+  if (!impl->live) {
+    for (size_t j = 0; j < N; j++) {
+      Results[j] = call_impl<I>(Data[j], Sizes[j]);
+      InputDone(j);
+    }
+    return;
+  }
+  if (!is_live_batch(Data, Sizes, N))
+    run_live_batch(Data, Sizes, N);
+  size_t k = impl->live - gl_live_servers;
+  for (size_t j = 0; j < N; j++) {
+    Results[j] = gl_live_jobs[j * gl_num_live + k].result;
+    InputDone(j);
+  }
+}
 
-    ~GlobalInitializer() { }
+static UserBatchCallback gl_batch_callbacks[MAX_IMPLS] = {
+  call_impl_batch<0>,  call_impl_batch<1>,  call_impl_batch<2>,
+  call_impl_batch<3>,  call_impl_batch<4>,  call_impl_batch<5>,
+  call_impl_batch<6>,  call_impl_batch<7>,  call_impl_batch<8>,
+  call_impl_batch<9>,  call_impl_batch<10>, call_impl_batch<11>,
+  call_impl_batch<12>, call_impl_batch<13>, call_impl_batch<14>,
+  call_impl_batch<15>,
 };
 
-static GlobalInitializer g_initializer;
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  return call_impl<0>(Data, Size);
+}
 
-typedef int (*UserCallback)(const uint8_t *Data, size_t Size);
-struct UserCallbacks {
-  UserCallback *callbacks;
-  int size;
-} callback_cont = { NULL, 0 };
+extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() {
+  init_impls(NULL);
+  callback_cont.callbacks = gl_callbacks;
+  callback_cont.size = gl_num_impls;
+  return &callback_cont;
+}
 
-extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
-  
-  DO_HANDSHAKE_ONE(openssl)
-  return ret_openssl;
+extern "C" UserBatchCallbacks *LLVMFuzzerCustomBatchCallbacks() {
+  init_impls(NULL);
+  batch_callback_cont.callbacks = gl_batch_callbacks;
+  batch_callback_cont.size = gl_num_impls;
+  return &batch_callback_cont;
+}
 
+// NULL unless some implementation has a fast build
+extern "C" UserCallbacks *LLVMFuzzerCustomFastCallbacks() {
+  init_impls(NULL);
+  for (size_t i = 0; i < gl_num_impls; i++) {
+    if (!gl_impls[i].fast)
+      continue;
+    fast_callback_cont.callbacks = gl_fast_callbacks;
+    fast_callback_cont.size = gl_num_impls;
+    return &fast_callback_cont;
+  }
+  return NULL;
 }
 
-extern "C" int Callback2(const uint8_t *Data, size_t Size) {
+// The enumerated field values of tls_dict.h as libFuzzer dictionary words
+struct UserDictionaryWord {
+  const uint8_t *data;
+  size_t size;
+};
+struct UserDictionary {
+  const UserDictionaryWord *words;
+  size_t size;
+};
 
-  DO_HANDSHAKE_ONE(libressl)
-  return ret_libressl;
+static const size_t kNumTlsDictWords =
+    sizeof(kTlsDictU16) / sizeof(kTlsDictU16[0]) + sizeof(kTlsDictU8);
+static UserDictionaryWord gl_dict_words[kNumTlsDictWords];
+static UserDictionary dict_cont = { gl_dict_words, 0 };
+
+extern "C" UserDictionary *LLVMFuzzerCustomDictionary() {
+  if (dict_cont.size)
+    return &dict_cont;
+  for (const auto &w : kTlsDictU16)
+    gl_dict_words[dict_cont.size++] = { w, sizeof(w) };
+  for (const auto &w : kTlsDictU8)
+    gl_dict_words[dict_cont.size++] = { &w, 1 };
+  return &dict_cont;
 }
 
-extern "C" int Callback3(const uint8_t *Data, size_t Size) {
+extern "C" size_t LLVMFuzzerCustomMutator(uint8_t *Data, size_t Size,
+                                          size_t MaxSize, unsigned int Seed) {
+  return mutate(Seed,Data,Size,MaxSize);
+}
 
-  DO_HANDSHAKE_ONE(boringssl)
-  return ret_boringssl;
+extern "C" size_t LLVMFuzzerCustomCrossOver(const uint8_t *Data1, size_t Size1,
+                                            const uint8_t *Data2, size_t Size2,
+                                            uint8_t *Out, size_t MaxOutSize,
+                                            unsigned int Seed) {
+  return crossOver(Seed, Data1, Size1, Data2, Size2, Out, MaxOutSize);
 }
 
-extern "C" int Callback4(const uint8_t *Data, size_t Size) {
+extern "C" size_t LLVMFuzzerCustomShrink(const uint8_t *Data, size_t Size,
+                                         uint8_t *Out, size_t MaxOutSize,
+                                         unsigned int Seed) {
+  return shrink(Seed, Data, Size, Out, MaxOutSize);
+}
 
-  DO_HANDSHAKE_ONE(wolfssl)
-  return ret_wolfssl;
+// The record type and version of a ClientHello that is not a TLS handshake
+// record: the libraries reject it alike before they look any further, so
+// with -diff_reject_cache=N libFuzzer only runs one in N later inputs that
+// start the same way. Handshake records get no prefix.
+extern "C" size_t LLVMFuzzerCustomInputPrefix(const uint8_t *Data,
+                                              size_t Size) {
+  if (Size < 3)
+    return Size;
+  if (Data[0] != TLS_RECORD_HANDSHAKE || Data[1] != 3)
+    return 3;
+  return 0;
 }
 
-UserCallback gl_callbacks[4] = { LLVMFuzzerTestOneInput, Callback2, Callback3, Callback4 };
-extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() {
-  callback_cont.callbacks = gl_callbacks;
-  callback_cont.size = 4;
-  return &callback_cont;
+extern "C" size_t LLVMFuzzerCustomLengthStep(size_t MaxLen) {
+  return MaxLen + lengthStep;
 }
 
-extern "C" size_t LLVMFuzzerCustomMutator(uint8_t *Data, size_t Size,
-                                          size_t MaxSize, unsigned int Seed) {
-  char message[100];
-  sprintf(message,"./random/random%d.bin",rand()%1000+1);
-  return mutate(message,Data,Size);
+extern "C" void LLVMFuzzerCustomMutatorFeedback(const uint8_t *Data,
+                                                size_t Size,
+                                                int HadOutputDiff) {
+  readSharedFragments();
+  if (HadOutputDiff)
+    harvestFragments(Data, Size, -1, true);
+  auto it = recentMutations.find(std::string((const char*)Data, Size));
+  if (it == recentMutations.end())
+    return;
+  if (!it->second.trace.empty())
+    fprintf(stderr, "MUTATION TRACE (%s):\n%s",
+            HadOutputDiff ? "new diff" : "new unit",
+            renderMutationTrace(it->second.trace).c_str());
+  vector<size_t>& ids = it->second.operators;
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  for (size_t i = 0; i < ids.size(); i++) {
+    opStats[ids[i]].newUnits++;
+    if (HadOutputDiff)
+      opStats[ids[i]].newDiffs++;
+  }
+  recentMutations.erase(it);
+}
+
+extern "C" void LLVMFuzzerCustomMutatorPrintStats() {
+  for (size_t i = 0; i < gl_num_impls; i++)
+    if (gl_impls[i].globals)
+      fprintf(stderr, "stat::restored_pages:          %s: %zd of %zd in %zd "
+              "inputs\n", gl_impls[i].name, gl_impls[i].globals->restored,
+              gl_impls[i].globals->pages, gl_impls[i].num_runs);
+  for (size_t i = 0; i < NUM_OPERATORS; i++)
+    fprintf(stderr, "stat::%-24s uses: %zd new_units: %zd new_diffs: %zd\n",
+            kOperatorNames[i], opStats[i].uses, opStats[i].newUnits,
+            opStats[i].newDiffs);
+  fprintf(stderr, "stat::ops_per_mutation:        0: %zd", opsPerMutation[0]);
+  for (size_t i = 1; i < kNumOpsBuckets; i++) {
+    if (i + 1 == kNumOpsBuckets)
+      fprintf(stderr, " %zd+: %zd", (size_t)1 << (i - 1), opsPerMutation[i]);
+    else if (i == 1)
+      fprintf(stderr, " 1: %zd", opsPerMutation[i]);
+    else
+      fprintf(stderr, " %zd-%zd: %zd", (size_t)1 << (i - 1),
+              ((size_t)1 << i) - 1, opsPerMutation[i]);
+  }
+  fprintf(stderr, "\n");
+  fprintf(stderr, "stat::mutations_at_op_limit:   %zd\n", mutationsAtOpLimit);
+  fprintf(stderr, "stat::mutations_out_of_time:   %zd\n", mutationsOutOfTime);
 }
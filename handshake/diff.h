@@ -2,6 +2,7 @@
 #define __DIFF_H__
 
 #include <dlfcn.h>
+#include <time.h>
 
 #if defined(__has_include)
 #if __has_include(<sanitizer / coverage_interface.h>)
@@ -21,26 +22,98 @@
 #endif
 
 
+// One implementation under test: a shared library and the entry point that
+// is resolved from it.
+struct tls_impl {
+  const char *name;
+  const char *libpath;
+  const char *symbol;  // entry point, normally FN_DO_HANDSHAKE
+  void *handle;       // dlopen() handle, kept for the whole run
+  bool isolated;      // loaded into a link map namespace of its own
+  fp_t do_handshake;  // resolved entry point
+  init_fp_t init;     // FN_INIT_TLS, or NULL if the library has none
+  output_fp_t handshake_output;  // FN_HANDSHAKE_OUTPUT, or NULL
+  struct tls_output output;      // its last reply
+  double load_ms;     // time spent in dlopen() and dlsym()
+  double init_ms;     // time spent in init
+  struct tls_impl *fast;  // uninstrumented build of it, or NULL
+  struct live_server *live;  // the server of a "tcp:" line, or NULL
+  struct restore_image *globals;  // with --tls_restore_globals=1, or NULL
+  size_t num_runs;    // inputs it ran
+  bool ran;           // since the globals were last restored
+};
+
 // Use dynamic loading of independent libraries to accommodate libraries that
-// use the same API names.
-void *get_interface_fn(void *handle, const char *libpath, const char *fname) {
-  void *generic_fp;
+// use the same API names. Every library is loaded once, with all of its
+// symbols bound up front (RTLD_NOW) so that lazy binding does not stall the
+// first executions, and kept local (RTLD_LOCAL) so that the identically named
+// symbols of the other libraries do not get mixed up.
+// An isolated library is loaded with dlmopen(LM_ID_NEWLM) instead, together
+// with its own copy of every library it depends on, so that two versions of
+// the same library (and of its libssl and libcrypto) can be tested in one
+// process. It sees none of the symbols of the fuzzer either, so it must be
+// built without sanitizers and coverage instrumentation.
+// Returns 0 on success.
+static int load_impl(struct tls_impl *impl, const char *fname) {
+  struct timespec start, end;
   char *error;
 
-  handle = dlopen(libpath, RTLD_LAZY);
-  if (!handle) {
+  if (impl->do_handshake)
+    return 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+#ifdef LM_ID_NEWLM
+  if (impl->isolated)
+    impl->handle = dlmopen(LM_ID_NEWLM, impl->libpath, RTLD_NOW | RTLD_LOCAL);
+  else
+#else
+  if (impl->isolated) {
+    DBG("cannot isolate library: no dlmopen()\n");
+    return -1;
+  }
+#endif
+    impl->handle = dlopen(impl->libpath, RTLD_NOW | RTLD_LOCAL);
+  if (!impl->handle) {
     DBG("cannot load library: %s\n", dlerror());
-    return NULL;
+    return -1;
   }
 
-  generic_fp = dlsym(handle, fname);
+  dlerror();
+  impl->do_handshake = (fp_t)dlsym(impl->handle, fname);
   if ((error = dlerror()) != NULL)  {
     DBG("cannot resolve function: %s\n", error);
-    return NULL;
+    impl->do_handshake = NULL;
+    return -1;
   }
+  impl->init = (init_fp_t)dlsym(impl->handle, FN_INIT_TLS);
+  impl->handshake_output =
+      (output_fp_t)dlsym(impl->handle, FN_HANDSHAKE_OUTPUT);
+  dlerror();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  impl->load_ms = (end.tv_sec - start.tv_sec) * 1e3 +
+                  (end.tv_nsec - start.tv_nsec) / 1e6;
 
-  return generic_fp;
+  return 0;
 }
 
+// Unloads the library of impl, for load_impl() to load it again. Returns 0
+// if it is gone; a library that the loader keeps (RTLD_NODELETE, or unique
+// C++ symbols) would come back as the same old code.
+static int unload_impl(struct tls_impl *impl) {
+  if (!impl->handle)
+    return 0;
+  dlclose(impl->handle);
+  impl->handle = NULL;
+  impl->do_handshake = NULL;
+  impl->init = NULL;
+  impl->handshake_output = NULL;
+  if (impl->isolated)
+    return 0;
+  void *still_loaded = dlopen(impl->libpath, RTLD_NOW | RTLD_NOLOAD);
+  if (!still_loaded)
+    return 0;
+  dlclose(still_loaded);
+  return -1;
+}
 
 #endif // __DIFF_H__
@@ -2,6 +2,9 @@
 #define __DIFF_H__
 
 #include <dlfcn.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #if defined(__has_include)
 #if __has_include(<sanitizer / coverage_interface.h>)
@@ -38,12 +41,10 @@ __attribute__((weak)) uintptr_t
 }*/
 
 #define FREE_GLOBALS \
-  FREE_PTR(ret_vals) \
-  FREE_PTR(cov_diff) \
   FREE_PTR(cov_buff_idx) \
-  FREE_PTR(vcont_int.vals) \
-  FREE_PTR(vcont_u64.vals) \
-  FREE_PTR(bitset)
+  FREE_PTR(bitset_cur) \
+  FREE_PTR(bitset_old) \
+  diff_free_arena();
 
 #define EXERCISE(name) \
   VERIFY_ONE(name); \
@@ -79,6 +80,18 @@ int *ecnt;
 
 uint32_t num_bitcounters;
 
+// ret_vals, bitcounts, ecnt and the bitsets of all libs live in one
+// mapping: the three arrays, then the bitset_cur rows of all libs, then
+// their bitset_old rows. Every part starts on a cache line and the rows are
+// bitset_stride bytes apart, so the counter i of all libs is at
+// row + lib * bitset_stride and a pass over two rows reads adjacent memory.
+// Built with -DCONFIG_HUGE_PAGES, the mapping asks for transparent huge
+// pages.
+static const size_t kCacheLine = 64;
+uint8_t *diff_arena = NULL;
+size_t diff_arena_size = 0;
+size_t bitset_stride = 0;
+
 // TODO(atang): Refactor these int types to unsigned versions.
 struct ValContainerInt {
   int *vals;
@@ -123,32 +136,49 @@ extern "C" ValContainerU64 *LLVMFuzzerCovBuffers() {
   return &vcont_u64;
 }
 
+static size_t round_up(size_t n, size_t to) {
+  return (n + to - 1) / to * to;
+}
+
 void diff_init() {
   num_bitcounters = __sanitizer_get_number_of_counters();
 
-  ret_vals = (int *) calloc(total_libs, sizeof(int));
+  size_t ints = round_up(total_libs * sizeof(int), kCacheLine);
+  bitset_stride = round_up(num_bitcounters, kCacheLine);
+  size_t rows = round_up(total_libs * bitset_stride, kCacheLine);
+  diff_arena_size = 3 * ints + 2 * rows;
+  if (!diff_arena_size)
+    diff_arena_size = kCacheLine;
+  void *arena = mmap(NULL, diff_arena_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(arena != MAP_FAILED && "error mapping the diff arena");
+  diff_arena = (uint8_t *)arena;
+#if defined(CONFIG_HUGE_PAGES) && defined(MADV_HUGEPAGE)
+  madvise(diff_arena, diff_arena_size, MADV_HUGEPAGE);
+#endif
+
+  ret_vals = (int *)diff_arena;
+  bitcounts = (int *)(diff_arena + ints);
+  ecnt = (int *)(diff_arena + 2 * ints);
   cov_buff_idx = (uint64_t *) calloc(total_libs + 1, sizeof(uint64_t));
-  bitcounts = (int *) calloc(total_libs, sizeof(int));
-  ecnt = (int *) calloc(total_libs, sizeof(int));
 
   bitset_cur = (uint8_t **) calloc(total_libs, sizeof(uint8_t *));
   assert(bitset_cur != NULL && "error allocating bitset_cur*");
-  for (int i = 0; i < total_libs; i++) {
-    bitset_cur[i] = (uint8_t *) calloc(num_bitcounters, sizeof(uint8_t));
-    assert(bitset_cur[i] != NULL && "error allocating bitset_cur");
-  }
-
   bitset_old = (uint8_t **) calloc(total_libs, sizeof(uint8_t *));
   assert(bitset_old != NULL && "error allocating bitset_old*");
   for (int i = 0; i < total_libs; i++) {
-    bitset_old[i] = (uint8_t *) calloc(num_bitcounters, sizeof(uint8_t));
-    assert(bitset_old[i] != NULL && "error allocating bitset_old");
+    bitset_cur[i] = diff_arena + 3 * ints + i * bitset_stride;
+    bitset_old[i] = diff_arena + 3 * ints + rows + i * bitset_stride;
   }
 
-  assert(ret_vals != NULL && "error allocating ret_vals");
   assert(cov_buff_idx != NULL && "error allocating cov_buff_idx");
-  assert(bitcounts != NULL && "error allocating bitcounts");
-  assert(ecnt != NULL && "error allocating ecnt");
+}
+
+void diff_free_arena() {
+  if (diff_arena)
+    munmap(diff_arena, diff_arena_size);
+  diff_arena = NULL;
+  ret_vals = bitcounts = ecnt = NULL;
 }
 
 // Use dynamic loading of independent libraries to accommodate libraries that
@@ -172,11 +202,13 @@ void *get_interface_fn(void *handle, const char *libpath, const char *fname) {
   return generic_fp;
 }
 
-int update_bitcount(uint8_t *bitset, uint8_t *bitset_prev, int *ecnt) {
+// update_bitcount() on the counters [begin, end), adding to *ecnt.
+int update_bitcount_scalar(uint8_t *bitset, uint8_t *bitset_prev, int *ecnt,
+                           uint32_t begin, uint32_t end) {
   uint32_t num_new_bits = 0;
   int raw_edge_count = 0;
 
-  for (uint32_t i = 0; i < num_bitcounters; i++) {
+  for (uint32_t i = begin; i < end; i++) {
     if (!bitset[i])
       continue;
 
@@ -204,9 +236,75 @@ int update_bitcount(uint8_t *bitset, uint8_t *bitset_prev, int *ecnt) {
     else if (bitset[i] & 0x80) raw_edge_count += 255; // 128+
   }
 
-  *ecnt = raw_edge_count;
+  *ecnt += raw_edge_count;
 
   return num_new_bits;
 }
 
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__ >= 5)
+#define DIFF_AFL_HAS_AVX2 1
+#include <immintrin.h>
+
+// update_bitcount() on 32 counters at a time. The raw edge count of a
+// counter depends on its lowest set bit, so it is looked up by the low
+// nibble if that is non-zero and by the high nibble otherwise.
+__attribute__((target("avx2")))
+int update_bitcount_avx2(uint8_t *bitset, uint8_t *bitset_prev, int *ecnt) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  // Count of the lowest set bit of a nibble, 0 for an empty nibble.
+  const __m256i lut_lo = _mm256_setr_epi8(
+      0, 1, 2, 1, 3, 1, 2, 1, 7, 1, 2, 1, 3, 1, 2, 1,
+      0, 1, 2, 1, 3, 1, 2, 1, 7, 1, 2, 1, 3, 1, 2, 1);
+  const __m256i lut_hi = _mm256_setr_epi8(
+      0, 15, 31, 15, 127, 15, 31, 15, (char)255, 15, 31, 15, 127, 15, 31, 15,
+      0, 15, 31, 15, 127, 15, 31, 15, (char)255, 15, 31, 15, 127, 15, 31, 15);
+  uint32_t num_new_bits = 0;
+  uint64_t raw_edge_count = 0;
+  uint32_t end = num_bitcounters & ~31u;
+
+  for (uint32_t i = 0; i < end; i += 32) {
+    __m256i cur = _mm256_loadu_si256((const __m256i *)(bitset + i));
+    if (_mm256_testz_si256(cur, cur))
+      continue;
+    __m256i prev = _mm256_loadu_si256((const __m256i *)(bitset_prev + i));
+    __m256i fresh = _mm256_andnot_si256(prev, cur);
+    uint32_t old_mask = (uint32_t)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(fresh, zero));
+    num_new_bits += __builtin_popcount(~old_mask);
+    _mm256_storeu_si256((__m256i *)(bitset_prev + i),
+                        _mm256_or_si256(prev, cur));
+
+    __m256i lo = _mm256_and_si256(cur, nibble);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(cur, 4), nibble);
+    __m256i cnt = _mm256_blendv_epi8(_mm256_shuffle_epi8(lut_lo, lo),
+                                     _mm256_shuffle_epi8(lut_hi, hi),
+                                     _mm256_cmpeq_epi8(lo, zero));
+    __m256i sums = _mm256_sad_epu8(cnt, zero);
+    raw_edge_count += _mm256_extract_epi64(sums, 0) +
+                      _mm256_extract_epi64(sums, 1) +
+                      _mm256_extract_epi64(sums, 2) +
+                      _mm256_extract_epi64(sums, 3);
+  }
+
+  *ecnt = (int)raw_edge_count;
+  return num_new_bits +
+         update_bitcount_scalar(bitset, bitset_prev, ecnt, end,
+                                num_bitcounters);
+}
+#endif
+
+// Merges the counters of the last execution into bitset_prev, returns the
+// number of counters that gained a bucket and stores the raw edge count in
+// *ecnt.
+int update_bitcount(uint8_t *bitset, uint8_t *bitset_prev, int *ecnt) {
+#ifdef DIFF_AFL_HAS_AVX2
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2)
+    return update_bitcount_avx2(bitset, bitset_prev, ecnt);
+#endif
+  *ecnt = 0;
+  return update_bitcount_scalar(bitset, bitset_prev, ecnt, 0, num_bitcounters);
+}
+
 #endif // __DIFF_H__
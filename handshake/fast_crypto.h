@@ -0,0 +1,69 @@
+#ifndef __FAST_CRYPTO_H__
+#define __FAST_CRYPTO_H__
+
+#include "common.h"
+
+/**
+ * Deterministic, cheap crypto (CONFIG_FAST_CRYPTO).
+ *
+ * Every handshake draws its randomness from a generator that is reset
+ * before each input, so the same input always gets the same server random,
+ * session id and ephemeral keys, and what the libraries reply to it is all
+ * they decided. The server key's private operations are stubs where the
+ * library lets us replace them: a "decryption" returns the last
+ * FAST_CRYPTO_PREMASTER bytes of the ciphertext as the premaster secret, so
+ * the fuzzer controls it, and a signature is all zeros. None of this is
+ * secure; it only keeps the time of an execution on parsing and the state
+ * machine instead of big-number arithmetic.
+ */
+#define FAST_CRYPTO_SEED        0x6E657A6861ULL
+#define FAST_CRYPTO_PREMASTER   48
+
+static uint64_t gl_fast_rand = FAST_CRYPTO_SEED;
+
+static inline void fast_rand_reset()
+{
+    gl_fast_rand = FAST_CRYPTO_SEED;
+}
+
+// SplitMix64.
+static inline void fast_rand_bytes(uint8_t *out, size_t size)
+{
+    while (size) {
+        uint64_t z = (gl_fast_rand += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        size_t n = size < sizeof(z) ? size : sizeof(z);
+        memcpy(out, &z, n);
+        out += n;
+        size -= n;
+    }
+}
+
+/**
+ * The stub decryption of in. With raw set, as for a decryption without
+ * padding, the result is a whole block of key_size bytes with the PKCS #1
+ * type 2 padding around the premaster secret; otherwise it is the premaster
+ * secret alone. Returns the size of the result.
+ */
+static inline size_t stub_rsa_decrypt(const uint8_t *in, size_t in_size,
+                                      uint8_t *out, size_t key_size, int raw)
+{
+    uint8_t premaster[FAST_CRYPTO_PREMASTER] = {0};
+    size_t n = in_size < sizeof(premaster) ? in_size : sizeof(premaster);
+    memcpy(premaster + sizeof(premaster) - n, in + in_size - n, n);
+    if (!raw || key_size < sizeof(premaster) + 11) {
+        memcpy(out, premaster, sizeof(premaster));
+        return sizeof(premaster);
+    }
+    size_t pad = key_size - sizeof(premaster) - 3;
+    out[0] = 0x00;
+    out[1] = 0x02;
+    memset(out + 2, 0xff, pad);
+    out[2 + pad] = 0x00;
+    memcpy(out + 3 + pad, premaster, sizeof(premaster));
+    return key_size;
+}
+
+#endif  //__FAST_CRYPTO_H__
@@ -1,4 +1,7 @@
 #include "libressl.h"
+#include "openssl_common.h"
+#include "fast_crypto.h"
+#include "snapshot.h"
 
 #include <assert.h>
 #include <openssl/ssl.h>
@@ -7,7 +10,14 @@
 #include <stdint.h>
 #include <stddef.h>
 
-SSL_CTX *Init() {
+struct ServerOps : OpenSSLOps {
+    static const char *Name() { return "libressl"; }
+    static Ctx *Init(const struct tls_credentials *creds);
+    // LibreSSL's randomness is arc4random(), which can't be reset.
+    static void ResetRandom() {}
+};
+
+SSL_CTX *ServerOps::Init(const struct tls_credentials *creds) {
     SSL_library_init();
     SSL_load_error_strings();
     ERR_load_BIO_strings();
@@ -16,64 +26,16 @@ SSL_CTX *Init() {
     assert (sctx = SSL_CTX_new(TLSv1_method()));
     //SSL_CTX_set_security_level(sctx, 0);
     //assert(SSL_CTX_use_certificate_file(sctx, "runtime/server.pem",SSL_FILETYPE_PEM));
-    if (0 == SSL_CTX_use_certificate_file(sctx, "runtime/server.pem",SSL_FILETYPE_PEM))
-    {
-        printf("Cannot use Certificate File:%s", ERR_error_string( ERR_get_error(), NULL ));
-        exit(1);
-    }
-
-    assert(SSL_CTX_use_PrivateKey_file(sctx, "runtime/server.key",
-                                      SSL_FILETYPE_PEM));
+    UseCredentials(sctx, creds);
+#ifdef CONFIG_FAST_CRYPTO
+    // LibreSSL draws its randomness from arc4random(), which cannot be
+    // replaced, so only the server key's private operations are stubs.
+    StubPrivateKey(sctx, Name());
+#endif
     return sctx;
 }
 
-extern "C"
-LIB_EXPORT
-int do_handshake_mem(const uint8_t *Data, uint32_t Size)
-{
-    static SSL_CTX *sctx = Init();
-    uint8_t *response = new uint8_t[8];
-    int composite_ret;
-    memset(response,0,8*sizeof(uint8_t));
-    SSL *server = SSL_new(sctx);
-    BIO *sinbio = BIO_new(BIO_s_mem());
-    BIO *soutbio = BIO_new(BIO_s_mem());
-    
-    SSL_set_bio(server, sinbio, soutbio);
-    SSL_set_accept_state(server);
-    //SSL_accept(server);
-    BIO_write(sinbio, Data, Size);
-    int r = SSL_do_handshake(server);
-
-    BIO_read(soutbio,response,8*sizeof(uint8_t));
-    
-    if(response[0]==0x16)
-    {        
-        DBG("[libressl] [handshake: HS/%02x/%02x%02x]\n",response[5],response[1],response[2]);	        
-	//composite_ret = 0;
-    }
-    else if(response[0]==0x15)
-    {
-        DBG("[libressl] [Alert: AL/%02x/%02x%02x]\n",response[6],response[1],response[2]);
-	//composite_ret = response[6];
-    }
-    else
-    {
-	DBG("[libressl] [No output: %02x%02x%02x]\n",response[0],response[1],response[2]);
-	//composite_ret = 1;
-    }
-    SSL_free(server);    
-    //SSL_CTX_free(sctx);
-    composite_ret = response[0];
-
-    
-    if(composite_ret==0)
-	composite_ret = 21;
-    else if(composite_ret==22)
-	composite_ret = 0;
-    delete [] response;
-    return composite_ret;
-}
+HANDSHAKE_ENTRY_POINTS(ServerOps)
 
 extern "C"
 LIB_EXPORT
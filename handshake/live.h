@@ -0,0 +1,259 @@
+#ifndef __LIVE_H__
+#define __LIVE_H__
+
+#include "common.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+
+/**
+ * Live servers: implementations that only exist as a TLS server listening on
+ * a TCP port, for which the registry has a "tcp:host:port" line instead of a
+ * library.
+ *
+ * An input goes to a live server over a connection of its own, as the
+ * client's first flight. The reply is read until its first record is
+ * complete, LIVE_REPLY_BYTES have arrived, the server closes the connection
+ * or live_timeout_ms pass, and then reduced to a return value with
+ * response_signature() like the first reply of a library. A server that
+ * cannot be reached returns FAILURE_INTERNAL.
+ *
+ * live_run() drives a whole set of (server, input) jobs from one epoll loop,
+ * with up to live_max_connections connections open at once across all the
+ * servers, so that the round trips of the servers and the inputs overlap. It
+ * starts the jobs in the order they are given and finishes them in the order
+ * the replies come in. Connections are reset instead of closed, which leaves
+ * no sockets in TIME_WAIT behind.
+ *
+ * Every thread has an epoll set and connections of its own, so the executor
+ * threads of -diff_threads can call live_run() at the same time, each with
+ * up to live_max_connections connections.
+ */
+#define LIVE_REPLY_BYTES        128
+#define LIVE_MAX_EVENTS         64
+
+struct live_server {
+    const char *address;            // host:port, [host]:port for IPv6
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    std::atomic<int> warned;        // that it could not be reached
+};
+
+struct live_job {
+    struct live_server *server;
+    const uint8_t *data;
+    size_t size;
+    int result;
+};
+
+static int live_max_connections = 64;
+static int live_timeout_ms = 1000;
+
+// Returns 0 on success.
+static int live_resolve(struct live_server *server, const char *address)
+{
+    const char *colon = strrchr(address, ':');
+    if (!colon || !colon[1])
+        return -1;
+    const char *host = address;
+    size_t host_len = colon - address;
+    if (host_len >= 2 && host[0] == '[' && host[host_len - 1] == ']') {
+        host++;
+        host_len -= 2;
+    }
+    char name[256];
+    if (host_len >= sizeof(name))
+        return -1;
+    memcpy(name, host, host_len);
+    name[host_len] = '\0';
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(name, colon + 1, &hints, &res))
+        return -1;
+    memcpy(&server->addr, res->ai_addr, res->ai_addrlen);
+    server->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    server->address = address;
+    server->warned = 0;
+    return 0;
+}
+
+static inline long live_now_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+struct live_conn {
+    int fd;                         // -1 if the slot is free
+    struct live_job *job;
+    int connected;
+    int reading;                    // all of the input was sent
+    size_t sent;
+    uint8_t reply[LIVE_REPLY_BYTES];
+    long got;
+    long deadline;
+};
+
+static inline int live_reply_done(const struct live_conn *c)
+{
+    if (c->got >= LIVE_REPLY_BYTES)
+        return 1;
+    return c->got >= 5 && c->got >= 5 + ((c->reply[3] << 8) | c->reply[4]);
+}
+
+static void live_finish(int epfd, struct live_conn *c, int reachable)
+{
+    struct live_job *job = c->job;
+    if (reachable) {
+        job->result = response_signature(c->reply, c->got);
+    } else {
+        job->result = (int)FAILURE_INTERNAL;
+        if (!job->server->warned.exchange(1))
+            fprintf(stderr, "WARNING: cannot reach the server at %s\n",
+                    job->server->address);
+    }
+    struct linger reset = {1, 0};
+    setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+}
+
+// Returns 0 if the connection is under way, or finishes the job.
+static int live_start(int epfd, struct live_conn *c, struct live_job *job)
+{
+    struct live_server *server = job->server;
+    c->job = job;
+    c->connected = 0;
+    c->reading = 0;
+    c->sent = 0;
+    c->got = 0;
+    c->deadline = live_now_ms() + live_timeout_ms;
+    c->fd = socket(server->addr.ss_family,
+                   SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) {
+        job->result = (int)FAILURE_INTERNAL;
+        return -1;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLOUT;
+    ev.data.ptr = c;
+    if ((connect(c->fd, (struct sockaddr *)&server->addr, server->addr_len) &&
+         errno != EINPROGRESS) ||
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev)) {
+        live_finish(epfd, c, 0);
+        return -1;
+    }
+    return 0;
+}
+
+static void live_event(int epfd, struct live_conn *c)
+{
+    struct live_job *job = c->job;
+    if (!c->connected) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+            live_finish(epfd, c, 0);
+            return;
+        }
+        c->connected = 1;
+    }
+    if (!c->reading) {
+        ssize_t n = send(c->fd, job->data + c->sent, job->size - c->sent,
+                         MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN) {
+            live_finish(epfd, c, 1);
+            return;
+        }
+        if (n > 0)
+            c->sent += n;
+        if (c->sent < job->size)
+            return;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->reading = 1;
+        return;
+    }
+    ssize_t n = recv(c->fd, c->reply + c->got, LIVE_REPLY_BYTES - c->got, 0);
+    if (n < 0 && errno == EAGAIN)
+        return;
+    if (n > 0)
+        c->got += n;
+    // A reset or the end of the stream ends the reply as it is.
+    if (n <= 0 || live_reply_done(c))
+        live_finish(epfd, c, 1);
+}
+
+// Runs every job and stores its return value in its result.
+static void live_run(struct live_job *jobs, size_t num_jobs)
+{
+    static thread_local int epfd = -1;
+    static thread_local struct live_conn *conns = NULL;
+    static thread_local int num_conns = 0;
+    if (epfd < 0)
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (num_conns < live_max_connections) {
+        conns = (struct live_conn *)realloc(
+            conns, live_max_connections * sizeof(*conns));
+        for (int i = num_conns; i < live_max_connections; i++)
+            conns[i].fd = -1;
+        num_conns = live_max_connections;
+    }
+
+    size_t next = 0;
+    int num_open = 0;
+    struct epoll_event events[LIVE_MAX_EVENTS];
+    while (next < num_jobs || num_open) {
+        for (int i = 0; i < num_conns && next < num_jobs; i++) {
+            if (conns[i].fd >= 0)
+                continue;
+            if (live_start(epfd, &conns[i], &jobs[next++]) == 0)
+                num_open++;
+        }
+        if (!num_open)
+            continue;
+        long now = live_now_ms(), deadline = now + live_timeout_ms;
+        for (int i = 0; i < num_conns; i++)
+            if (conns[i].fd >= 0 && conns[i].deadline < deadline)
+                deadline = conns[i].deadline;
+        int n = epoll_wait(epfd, events, LIVE_MAX_EVENTS,
+                           deadline > now ? (int)(deadline - now) : 0);
+        for (int i = 0; i < n; i++) {
+            struct live_conn *c = (struct live_conn *)events[i].data.ptr;
+            live_event(epfd, c);
+            if (c->fd < 0)
+                num_open--;
+        }
+        now = live_now_ms();
+        for (int i = 0; i < num_conns; i++) {
+            if (conns[i].fd < 0 || conns[i].deadline > now)
+                continue;
+            // Whatever arrived in time is the reply.
+            live_finish(epfd, &conns[i], conns[i].connected);
+            num_open--;
+        }
+    }
+}
+
+#endif  //__LIVE_H__
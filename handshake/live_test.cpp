@@ -0,0 +1,90 @@
+/**
+ * Checks live_run() against a server on the loopback interface that answers
+ * every connection with a handshake_failure alert, from several threads at
+ * once as under -diff_threads, and against a port nobody listens on.
+ */
+#include "live.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#define LIVE_TEST_THREADS   4
+#define LIVE_TEST_JOBS      32
+
+static const uint8_t alert[] = {0x15, 0x03, 0x03, 0x00, 0x02, 0x02, 0x28};
+static const uint8_t hello[] = {0x16, 0x03, 0x01, 0x00, 0x01, 0x01};
+
+// A listening socket on 127.0.0.1, and its port.
+static int listen_loopback(int *port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(fd, 128) || getsockname(fd, (struct sockaddr *)&addr, &len)) {
+        perror("listen_loopback");
+        exit(1);
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static void serve(int fd, int num_conns)
+{
+    for (int i = 0; i < num_conns; i++) {
+        int c = accept(fd, NULL, NULL);
+        if (c < 0)
+            break;
+        uint8_t buf[64];
+        if (read(c, buf, sizeof(buf)) > 0)
+            (void)!write(c, alert, sizeof(alert));
+        close(c);
+    }
+}
+
+static int run_jobs(struct live_server *server)
+{
+    struct live_job jobs[LIVE_TEST_JOBS];
+    for (int i = 0; i < LIVE_TEST_JOBS; i++)
+        jobs[i] = {server, hello, sizeof(hello), 0};
+    live_run(jobs, LIVE_TEST_JOBS);
+    int failures = 0;
+    for (int i = 0; i < LIVE_TEST_JOBS; i++)
+        failures += jobs[i].result != response_signature(alert, sizeof(alert));
+    return failures;
+}
+
+int main()
+{
+    live_max_connections = 4;
+    int port;
+    int fd = listen_loopback(&port);
+    std::string address = "127.0.0.1:" + std::to_string(port);
+    static struct live_server server;
+    if (live_resolve(&server, address.c_str())) {
+        printf("ERROR: cannot resolve %s\n", address.c_str());
+        return 1;
+    }
+    std::thread server_thread(serve, fd, LIVE_TEST_THREADS * LIVE_TEST_JOBS);
+    std::vector<std::thread> threads;
+    std::atomic<int> failures(0);
+    for (int i = 0; i < LIVE_TEST_THREADS; i++)
+        threads.push_back(std::thread([&] { failures += run_jobs(&server); }));
+    for (auto &t : threads)
+        t.join();
+    server_thread.join();
+    close(fd);
+
+    // Nothing listens on the port any more.
+    struct live_job job = {&server, hello, sizeof(hello), 0};
+    live_run(&job, 1);
+    if (job.result != (int)FAILURE_INTERNAL)
+        failures++;
+
+    printf("live: %d failure(s)\n", failures.load());
+    return failures != 0;
+}
@@ -1,14 +1,78 @@
 #include "openssl.h"
+#include "openssl_common.h"
+#include "fast_crypto.h"
+#include "snapshot.h"
 
 #include <assert.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
 #include <assert.h>
 #include <stdint.h>
 #include <stddef.h>
 
 
-SSL_CTX *Init() {
+#ifdef CONFIG_SNAPSHOT
+static void *SnapshotMalloc(size_t size, const char *file, int line)
+{
+    return arena_malloc(size);
+}
+
+static void *SnapshotRealloc(void *ptr, size_t size, const char *file, int line)
+{
+    return arena_realloc(ptr, size);
+}
+
+static void SnapshotFree(void *ptr, const char *file, int line)
+{
+    arena_free(ptr);
+}
+
+// Private key operations cache Montgomery contexts and blinding in the key,
+// which outlives every snapshot: make one before the first.
+static void WarmUpKey(SSL_CTX *sctx)
+{
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(SSL_CTX_get0_privatekey(sctx), NULL);
+    unsigned char md[32] = {0}, sig[1024];
+    size_t siglen = sizeof(sig);
+    if (ctx && EVP_PKEY_sign_init(ctx) > 0)
+        EVP_PKEY_sign(ctx, sig, &siglen, md, sizeof(md));
+    EVP_PKEY_CTX_free(ctx);
+    ERR_clear_error();
+}
+#endif
+
+#ifdef CONFIG_FAST_CRYPTO
+static int FastRandBytes(unsigned char *buf, int num)
+{
+    fast_rand_bytes(buf, num);
+    return 1;
+}
+
+static int FastRandStatus()
+{
+    return 1;
+}
+
+static RAND_METHOD fast_rand_method = {
+    NULL, FastRandBytes, NULL, NULL, FastRandBytes, FastRandStatus
+};
+#endif
+
+struct ServerOps : OpenSSLOps {
+    static const char *Name() { return "Openssl"; }
+    static Ctx *Init(const struct tls_credentials *creds);
+    static void ResetRandom() { fast_rand_reset(); }
+};
+
+SSL_CTX *ServerOps::Init(const struct tls_credentials *creds) {
+#ifdef CONFIG_SNAPSHOT
+    // OpenSSL only takes other allocators before it allocates anything.
+    if (!CRYPTO_set_mem_functions(SnapshotMalloc, SnapshotRealloc,
+                                  SnapshotFree) || !snapshot_init())
+        fprintf(stderr, "openssl: no snapshots, replaying every flight\n");
+#endif
     SSL_library_init();
     SSL_load_error_strings();
     ERR_load_BIO_strings();
@@ -20,61 +84,19 @@ SSL_CTX *Init() {
       -out server.pem -days 9999 -nodes -subj /CN=a/
     */
     SSL_CTX_set_security_level(sctx, 0);
-    if (0 == SSL_CTX_use_certificate_file(sctx, "runtime/server.pem",SSL_FILETYPE_PEM))
-    {
-        printf("Cannot use Certificate File:%s", ERR_error_string( ERR_get_error(), NULL ));
-        exit(1);
-    }
-    assert(SSL_CTX_use_PrivateKey_file(sctx, "runtime/server.key",
-                                      SSL_FILETYPE_PEM));
+    UseCredentials(sctx, creds);
+#ifdef CONFIG_FAST_CRYPTO
+    RAND_set_rand_method(&fast_rand_method);
+    StubPrivateKey(sctx, Name());
+#endif
+#ifdef CONFIG_SNAPSHOT
+    SSL_CTX_set_session_cache_mode(sctx, SSL_SESS_CACHE_OFF);
+    WarmUpKey(sctx);
+#endif
     return sctx;
 }
 
-extern "C"
-LIB_EXPORT
-int do_handshake_mem(const uint8_t *Data, uint32_t Size)
-{
-    static SSL_CTX *sctx = Init();
-    uint8_t *response = new uint8_t[8];
-    int composite_ret;
-    memset(response,0,8*sizeof(uint8_t));
-    SSL *server = SSL_new(sctx);
-    BIO *sinbio = BIO_new(BIO_s_mem());
-    BIO *soutbio = BIO_new(BIO_s_mem());
-    SSL_set_bio(server, sinbio, soutbio);
-    SSL_set_accept_state(server);
-    BIO_write(sinbio, Data, Size);
-    SSL_do_handshake(server);
-    BIO_read(soutbio,response,8*sizeof(uint8_t));
-    
-    
-    if(response[0]==0x16)
-    {        
-        DBG("[Openssl] [handshake: HS/%02x/%02x%02x]\n",response[5],response[1],response[2]);	    
-	//composite_ret = 0;    
-    }
-    else if(response[0]==0x15)
-    {
-        DBG("[Openssl] [Alert: AL/%02x/%02x%02x]\n",response[6],response[1],response[2]);
-	//composite_ret = response[6];
-    }
-    else
-    {
-	DBG("[Openssl] [No output: %02x%02x%02x]\n",response[0],response[1],response[2]);
-	//composite_ret = 1;
-    } 
-    SSL_free(server);    
-    //SSL_CTX_free(sctx);
-    composite_ret = response[0];
-
-    
-    if(composite_ret==0)
-	composite_ret = 21;
-    else if(composite_ret==22)
-	composite_ret = 0;
-    delete [] response;
-    return composite_ret;
-}
+HANDSHAKE_ENTRY_POINTS(ServerOps)
 
 extern "C"
 LIB_EXPORT
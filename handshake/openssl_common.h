@@ -0,0 +1,108 @@
+#ifndef __OPENSSL_COMMON_H__
+#define __OPENSSL_COMMON_H__
+
+#include "common.h"
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+/**
+ * What the wrappers of OpenSSL, LibreSSL and BoringSSL share: the binding
+ * of the server in common.h to their API, to which each adds its Name().
+ */
+struct OpenSSLOps {
+    typedef SSL_CTX Ctx;
+    typedef SSL Server;
+    typedef BIO Bio;
+
+    static Server *New(Ctx *sctx) { return SSL_new(sctx); }
+    static void Free(Server *server) { SSL_free(server); }
+    static void Clear(Server *server) { SSL_clear(server); }
+    static Bio *NewBio() { return BIO_new(BIO_s_mem()); }
+    static void SetBio(Server *server, Bio *in, Bio *out)
+    {
+        SSL_set_bio(server, in, out);
+    }
+    static void ResetBio(Bio *bio) { BIO_reset(bio); }
+    static void Accept(Server *server) { SSL_set_accept_state(server); }
+    static void DoHandshake(Server *server) { SSL_do_handshake(server); }
+    static void Write(Bio *bio, const uint8_t *data, uint32_t size)
+    {
+        BIO_write(bio, data, size);
+    }
+    static long Reply(Bio *bio, const uint8_t **data)
+    {
+        char *p = NULL;
+        long len = BIO_get_mem_data(bio, &p);
+        *data = (const uint8_t *)p;
+        return len;
+    }
+};
+
+// Has sctx use the shared credentials or, without them, the files.
+static void UseCredentials(SSL_CTX *sctx, const struct tls_credentials *creds)
+{
+    int ok;
+    if (creds) {
+        const uint8_t *p = creds->key;
+        EVP_PKEY *pkey = d2i_AutoPrivateKey(NULL, &p, creds->key_size);
+        ok = SSL_CTX_use_certificate_ASN1(sctx, creds->cert_size,
+                                          creds->cert) &&
+             pkey && SSL_CTX_use_PrivateKey(sctx, pkey);
+        EVP_PKEY_free(pkey);
+    } else {
+        ok = SSL_CTX_use_certificate_file(sctx, SERVER_CERT_FILE,
+                                          SSL_FILETYPE_PEM) &&
+             SSL_CTX_use_PrivateKey_file(sctx, SERVER_KEY_FILE,
+                                         SSL_FILETYPE_PEM);
+    }
+    if (!ok) {
+        printf("Cannot use the %s credentials:%s",
+               creds ? "shared" : "server's",
+               ERR_error_string(ERR_get_error(), NULL));
+        exit(1);
+    }
+}
+
+#if defined(CONFIG_FAST_CRYPTO) && !defined(OPENSSL_IS_BORINGSSL)
+#include "fast_crypto.h"
+
+#include <openssl/rsa.h>
+
+static int StubPrivDec(int flen, const unsigned char *from, unsigned char *to,
+                       RSA *rsa, int padding)
+{
+    return stub_rsa_decrypt(from, flen, to, RSA_size(rsa),
+                            padding == RSA_NO_PADDING);
+}
+
+static int StubPrivEnc(int flen, const unsigned char *from, unsigned char *to,
+                       RSA *rsa, int padding)
+{
+    memset(to, 0, RSA_size(rsa));
+    return RSA_size(rsa);
+}
+
+// Replaces the server key by one with the same public key whose private
+// operations are stubs. A key with a method of its own does not go to the
+// providers of OpenSSL 3, so the stubs are called there too. BoringSSL has
+// no RSA methods and takes a private key method instead.
+static void StubPrivateKey(SSL_CTX *sctx, const char *name)
+{
+    RSA *rsa = EVP_PKEY_get1_RSA(SSL_CTX_get0_privatekey(sctx));
+    if (!rsa) {
+        fprintf(stderr, "%s: the server key is not RSA, keeping it\n", name);
+        return;
+    }
+    RSA_METHOD *meth = RSA_meth_dup(RSA_get_default_method());
+    RSA_meth_set_priv_dec(meth, StubPrivDec);
+    RSA_meth_set_priv_enc(meth, StubPrivEnc);
+    RSA_set_method(rsa, meth);
+    EVP_PKEY *pkey = EVP_PKEY_new();
+    EVP_PKEY_assign_RSA(pkey, rsa);
+    assert(SSL_CTX_use_PrivateKey(sctx, pkey));
+    EVP_PKEY_free(pkey);
+}
+#endif
+
+#endif  //__OPENSSL_COMMON_H__
@@ -0,0 +1,300 @@
+#ifndef __REGISTRY_H__
+#define __REGISTRY_H__
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "common.h"
+#include "diff.h"
+#include "live.h"
+
+#ifdef CONFIG_USE_OPENSSL
+#include "openssl.h"
+#endif
+
+#ifdef CONFIG_USE_LIBRESSL
+#include "libressl.h"
+#endif
+
+#ifdef CONFIG_USE_BORINGSSL
+#include "boringssl.h"
+#endif
+
+#ifdef CONFIG_USE_WOLFSSL
+#include "wolfssl.h"
+#endif
+
+#ifdef CONFIG_USE_MBEDTLS
+#include "mbedtls.h"
+#endif
+
+#ifdef CONFIG_USE_GNUTLS
+#include "gnutls.h"
+#endif
+
+// Registry of the implementations under test, in callback order. It is
+// filled from the file given with --tls_impls=<file> (or the TLS_IMPLS
+// environment variable), one "name libpath [symbol] [fast=libpath] [isolate]"
+// line per implementation, or else from the libraries selected at build
+// time. The symbol is the entry point of the target, FN_DO_HANDSHAKE for
+// diff.cpp and FN_VERIFY_CERT for x509_diff.cpp, unless a line names another
+// one. A "tcp:host:port" library is a live server (see live.h). The fast=
+// library is a build of the same implementation without coverage
+// instrumentation, for libFuzzer's -diff_fast_path. An isolated
+// implementation, and its fast build, get link map namespaces of their own
+// (see load_impl()).
+#define MAX_IMPLS 16
+static struct tls_impl gl_impls[MAX_IMPLS];
+static struct tls_impl gl_fast_impls[MAX_IMPLS];
+static size_t gl_num_impls = 0;
+static struct live_server gl_live_servers[MAX_IMPLS];
+static size_t gl_num_live = 0;
+
+static void add_impl(const char *name, const char *libpath,
+                     const char *symbol, const char *fast_libpath = NULL,
+                     bool isolated = false) {
+  if (gl_num_impls == MAX_IMPLS) {
+    fprintf(stderr, "ERROR: more than %d implementations\n", MAX_IMPLS);
+    exit(1);
+  }
+  struct tls_impl *fast = &gl_fast_impls[gl_num_impls];
+  struct tls_impl *impl = &gl_impls[gl_num_impls++];
+  memset(impl, 0, sizeof(*impl));
+  impl->name = strdup(name);
+  impl->libpath = strdup(libpath);
+  impl->symbol = strdup(symbol);
+  impl->isolated = isolated;
+  if (!strncmp(libpath, "tcp:", 4)) {
+    impl->live = &gl_live_servers[gl_num_live++];
+    if (live_resolve(impl->live, impl->libpath + 4)) {
+      fprintf(stderr, "ERROR: cannot resolve the server %s of %s\n",
+              impl->libpath + 4, name);
+      exit(1);
+    }
+    return;
+  }
+  if (fast_libpath) {
+    memset(fast, 0, sizeof(*fast));
+    fast->name = impl->name;
+    fast->libpath = strdup(fast_libpath);
+    fast->symbol = impl->symbol;
+    fast->isolated = isolated;
+    impl->fast = fast;
+  }
+}
+
+#define ADD_BUILTIN_IMPL(name, NAME) \
+  add_impl(#name, LIB_ ##NAME, symbol);
+
+static void add_builtin_impls(const char *symbol) {
+#ifdef CONFIG_USE_OPENSSL
+  ADD_BUILTIN_IMPL(openssl, OPENSSL)
+#endif
+#ifdef CONFIG_USE_LIBRESSL
+  ADD_BUILTIN_IMPL(libressl, LIBRESSL)
+#endif
+#ifdef CONFIG_USE_BORINGSSL
+  ADD_BUILTIN_IMPL(boringssl, BORINGSSL)
+#endif
+#ifdef CONFIG_USE_WOLFSSL
+  ADD_BUILTIN_IMPL(wolfssl, WOLFSSL)
+#endif
+#ifdef CONFIG_USE_MBEDTLS
+  ADD_BUILTIN_IMPL(mbedtls, MBEDTLS)
+#endif
+#ifdef CONFIG_USE_GNUTLS
+  ADD_BUILTIN_IMPL(gnutls, GNUTLS)
+#endif
+}
+
+static void add_config_impls(const char *config, const char *symbol) {
+  std::ifstream ifs(config);
+  if (!ifs.is_open()) {
+    fprintf(stderr, "ERROR: cannot read %s\n", config);
+    exit(1);
+  }
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream iss(line);
+    std::string name, libpath, entry = symbol, word, fast;
+    bool isolated = false;
+    if (!(iss >> name) || name[0] == '#')
+      continue;
+    if (!(iss >> libpath)) {
+      fprintf(stderr, "ERROR: %s: no library for %s\n", config, name.c_str());
+      exit(1);
+    }
+    while (iss >> word) {
+      if (!word.compare(0, 5, "fast="))
+        fast = word.substr(5);
+      else if (word == "isolate")
+        isolated = true;
+      else
+        entry = word;
+    }
+    if (!libpath.compare(0, 4, "tcp:") &&
+        (!fast.empty() || isolated || entry != symbol)) {
+      fprintf(stderr, "ERROR: %s: %s is a live server, which takes no fast=, "
+              "isolate or symbol\n", config, name.c_str());
+      exit(1);
+    }
+    add_impl(name.c_str(), libpath.c_str(), entry.c_str(),
+             fast.empty() ? NULL : fast.c_str(), isolated);
+  }
+}
+
+// Tells why an isolated library may not load
+static void explain_isolated(const struct tls_impl *impl) {
+  if (impl->isolated)
+    fprintf(stderr, "%s is isolated: it cannot use the sanitizers or the "
+            "coverage callbacks of the fuzzer, and glibc has at most 15 "
+            "namespaces for isolated libraries\n", impl->libpath);
+}
+
+// Drops implementation i, a builtin one, which has no fast build and no
+// live server, from the registry.
+static void drop_impl(size_t i) {
+  unload_impl(&gl_impls[i]);
+  memmove(&gl_impls[i], &gl_impls[i + 1],
+          (gl_num_impls - i - 1) * sizeof(gl_impls[0]));
+  gl_num_impls--;
+}
+
+// Fills the registry from config, or from TLS_IMPLS, or with the builtin
+// libraries, and loads every implementation and its fast build. Exits if
+// one named in a config cannot be loaded. A builtin library that does not
+// export symbol, e.g. FN_VERIFY_CERT, is skipped with a warning; exits if
+// none is left.
+static void load_impls(const char *config, const char *symbol) {
+  if (gl_num_impls)
+    return;
+  if (!config)
+    config = getenv("TLS_IMPLS");
+  if (config)
+    add_config_impls(config, symbol);
+  else
+    add_builtin_impls(symbol);
+  for (size_t i = 0; i < gl_num_impls; i++) {
+    struct tls_impl *impl = &gl_impls[i];
+    if (impl->live) {
+      fprintf(stderr, "%s: live server at %s\n", impl->name,
+              impl->live->address);
+      continue;
+    }
+    if (load_impl(impl, impl->symbol)) {
+      if (!config) {
+        fprintf(stderr, "WARNING: %s does not export %s, skipping it\n",
+                impl->libpath, impl->symbol);
+        drop_impl(i--);
+        continue;
+      }
+      fprintf(stderr, "ERROR resolving %s from: %s\n", impl->symbol,
+              impl->libpath);
+      explain_isolated(impl);
+      exit(1);
+    }
+    fprintf(stderr, "%s: loaded %s%s in %.3f ms\n", impl->name,
+            impl->libpath, impl->isolated ? " into a new namespace" : "",
+            impl->load_ms);
+    if (!impl->fast)
+      continue;
+    if (load_impl(impl->fast, impl->symbol)) {
+      fprintf(stderr, "ERROR resolving %s from: %s\n", impl->symbol,
+              impl->fast->libpath);
+      explain_isolated(impl->fast);
+      exit(1);
+    }
+    fprintf(stderr, "%s: loaded the fast build %s in %.3f ms\n", impl->name,
+            impl->fast->libpath, impl->fast->load_ms);
+  }
+  if (!gl_num_impls) {
+    fprintf(stderr, "ERROR: no library exports %s\n", symbol);
+    exit(1);
+  }
+}
+
+// Returns the loaded implementation called name, or NULL
+static inline struct tls_impl *find_impl(const char *name) {
+  for (size_t i = 0; i < gl_num_impls; i++)
+    if (!strcmp(gl_impls[i].name, name))
+      return &gl_impls[i];
+  return NULL;
+}
+
+// Every target of the registry defines run_impl(), which runs an input
+// through impl, the instrumented or the fast build of implementation i, and
+// init_reloaded_impl(), which prepares a build that LLVMFuzzerCustomReload()
+// loaded again. The latter returns 0 on success.
+static int run_impl(size_t i, struct tls_impl *impl, const uint8_t *Data,
+                    size_t Size);
+static int init_reloaded_impl(struct tls_impl *impl);
+
+typedef int (*UserCallback)(const uint8_t *Data, size_t Size);
+struct UserCallbacks {
+  UserCallback *callbacks;
+  int size;
+};
+
+// Every callback needs its own function: one instance per registry slot
+template <size_t I>
+static int call_impl(const uint8_t *Data, size_t Size) {
+  return run_impl(I, &gl_impls[I], Data, Size);
+}
+
+// The fast build, or the instrumented one of an implementation without one
+template <size_t I>
+static int call_fast_impl(const uint8_t *Data, size_t Size) {
+  struct tls_impl *impl = &gl_impls[I];
+  return run_impl(I, impl->fast ? impl->fast : impl, Data, Size);
+}
+
+static UserCallback gl_callbacks[MAX_IMPLS] = {
+  call_impl<0>,  call_impl<1>,  call_impl<2>,  call_impl<3>,
+  call_impl<4>,  call_impl<5>,  call_impl<6>,  call_impl<7>,
+  call_impl<8>,  call_impl<9>,  call_impl<10>, call_impl<11>,
+  call_impl<12>, call_impl<13>, call_impl<14>, call_impl<15>,
+};
+
+static UserCallback gl_fast_callbacks[MAX_IMPLS] = {
+  call_fast_impl<0>,  call_fast_impl<1>,  call_fast_impl<2>,
+  call_fast_impl<3>,  call_fast_impl<4>,  call_fast_impl<5>,
+  call_fast_impl<6>,  call_fast_impl<7>,  call_fast_impl<8>,
+  call_fast_impl<9>,  call_fast_impl<10>, call_fast_impl<11>,
+  call_fast_impl<12>, call_fast_impl<13>, call_fast_impl<14>,
+  call_fast_impl<15>,
+};
+
+// libFuzzer's -diff_control=PATH "reload IDX": loads the library of
+// implementation IDX, and its fast build, again from the same path, e.g.
+// after it was patched and rebuilt. Returns 0 on success.
+extern "C" int LLVMFuzzerCustomReload(int callback) {
+  if (callback < 0 || (size_t)callback >= gl_num_impls)
+    return -1;
+  struct tls_impl *impl = &gl_impls[callback];
+  if (impl->live)
+    return 0;
+  struct tls_impl *builds[] = {impl, impl->fast};
+  for (struct tls_impl *build : builds) {
+    if (!build)
+      continue;
+    if (unload_impl(build)) {
+      fprintf(stderr, "ERROR: %s stays loaded, cannot reload it\n",
+              build->libpath);
+      return -1;
+    }
+    if (load_impl(build, build->symbol)) {
+      fprintf(stderr, "ERROR resolving %s from: %s\n", build->symbol,
+              build->libpath);
+      explain_isolated(build);
+      return -1;
+    }
+    fprintf(stderr, "%s: reloaded %s in %.3f ms\n", build->name,
+            build->libpath, build->load_ms);
+    if (init_reloaded_impl(build))
+      return -1;
+  }
+  return 0;
+}
+
+#endif // __REGISTRY_H__
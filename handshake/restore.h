@@ -0,0 +1,295 @@
+#ifndef __RESTORE_H__
+#define __RESTORE_H__
+
+#include "common.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <unistd.h>
+
+/**
+ * Restoring the global state of a library (--tls_restore_globals=1).
+ *
+ * restore_record() copies the writable segments of a loaded library, its
+ * .data and .bss, as found with dl_iterate_phdr(). restore_dirty() later
+ * copies back only the pages that were written since the last call to
+ * restore_clear(). The kernel marks every page that is written after
+ * /proc/self/clear_refs was given "4" as soft-dirty in /proc/self/pagemap.
+ * A kernel without soft-dirty bits makes restore_dirty() compare every
+ * page with its copy instead.
+ *
+ * Two parts of the segments are left alone. The RELRO part is read-only
+ * once the library is loaded. The __sancov sections hold the coverage
+ * counters, which belong to the fuzzer. Whole pages are skipped, so the
+ * globals that share a page with them are not restored either.
+ *
+ * Only the segments come back. An object on the heap that a global points
+ * to keeps what the input did to it. One that was freed and replaced
+ * during an input is left dangling by the restored pointer, which ASan
+ * reports as a use after free. What an input allocates and the restored
+ * globals no longer point to leaks.
+ */
+#define RESTORE_MAX_RANGES      16
+#define PAGEMAP_SOFT_DIRTY      (1ULL << 55)
+
+struct restore_range {
+    uint8_t *addr;              // page aligned
+    size_t size;                // a multiple of the page size
+    uint8_t *copy;
+};
+
+struct restore_image {
+    struct restore_range ranges[RESTORE_MAX_RANGES];
+    int num_ranges;
+    size_t pages;               // recorded
+    size_t restored;            // pages copied back so far
+    uint64_t *flags;            // the pagemap entries of the largest range
+};
+
+static int restore_clear_refs_fd = -1;
+static int restore_pagemap_fd = -1;
+static int restore_soft_dirty = 0;      // the kernel keeps soft-dirty bits
+
+static inline size_t restore_page_size()
+{
+    static size_t page = 0;
+    if (!page)
+        page = sysconf(_SC_PAGESIZE);
+    return page;
+}
+
+// Clears the soft-dirty bits of all pages of the process.
+static inline void restore_clear()
+{
+    if (restore_clear_refs_fd >= 0 &&
+        pwrite(restore_clear_refs_fd, "4", 1, 0) != 1)
+        restore_soft_dirty = 0;
+}
+
+static inline int restore_page_is_dirty(const void *addr)
+{
+    uint64_t entry = 0;
+    off_t off = (uintptr_t)addr / restore_page_size() * sizeof(entry);
+    if (pread(restore_pagemap_fd, &entry, sizeof(entry), off) !=
+        sizeof(entry))
+        return 0;
+    return (entry & PAGEMAP_SOFT_DIRTY) != 0;
+}
+
+// Opens the proc files once and checks that a written page shows up as
+// soft-dirty.
+static void restore_open()
+{
+    static int opened = 0;
+    if (opened)
+        return;
+    opened = 1;
+    restore_clear_refs_fd =
+        open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    restore_pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (restore_clear_refs_fd < 0 || restore_pagemap_fd < 0)
+        return;
+    static volatile uint8_t probe[1 << 16];
+    volatile uint8_t *page = (volatile uint8_t *)(
+        ((uintptr_t)probe + restore_page_size() - 1) &
+        ~(restore_page_size() - 1));
+    page[0] = 1;
+    restore_soft_dirty = 1;
+    restore_clear();
+    int clean = restore_soft_dirty && !restore_page_is_dirty((void *)page);
+    page[0] = 2;
+    if (clean && restore_page_is_dirty((void *)page))
+        return;
+    restore_soft_dirty = 0;
+    fprintf(stderr, "WARNING: no soft-dirty bits, every recorded page is "
+            "compared after each input\n");
+}
+
+struct restore_search {
+    uintptr_t base;             // l_addr of the library
+    const char *path;
+    uintptr_t begin[RESTORE_MAX_RANGES], end[RESTORE_MAX_RANGES];
+    int num_writable;
+    uintptr_t skip_begin[RESTORE_MAX_RANGES], skip_end[RESTORE_MAX_RANGES];
+    int num_skipped;
+    int found;
+};
+
+static inline uintptr_t restore_page_down(uintptr_t addr)
+{
+    return addr & ~(restore_page_size() - 1);
+}
+
+static inline uintptr_t restore_page_up(uintptr_t addr)
+{
+    return restore_page_down(addr + restore_page_size() - 1);
+}
+
+static void restore_skip(struct restore_search *s, uintptr_t begin,
+                         uintptr_t end)
+{
+    if (s->num_skipped == RESTORE_MAX_RANGES || begin >= end)
+        return;
+    s->skip_begin[s->num_skipped] = restore_page_down(begin);
+    s->skip_end[s->num_skipped++] = restore_page_up(end);
+}
+
+// The writable __sancov sections of the library file.
+static void restore_skip_sancov(struct restore_search *s)
+{
+    int fd = open(s->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    ElfW(Ehdr) eh;
+    ElfW(Shdr) *shdrs = NULL;
+    char *names = NULL;
+    if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh) ||
+        memcmp(eh.e_ident, ELFMAG, SELFMAG) || eh.e_shstrndx >= eh.e_shnum)
+        goto out;
+    shdrs = (ElfW(Shdr) *)calloc(eh.e_shnum, sizeof(*shdrs));
+    if (pread(fd, shdrs, eh.e_shnum * sizeof(*shdrs), eh.e_shoff) !=
+        (ssize_t)(eh.e_shnum * sizeof(*shdrs)))
+        goto out;
+    names = (char *)calloc(shdrs[eh.e_shstrndx].sh_size + 1, 1);
+    if (pread(fd, names, shdrs[eh.e_shstrndx].sh_size,
+              shdrs[eh.e_shstrndx].sh_offset) < 0)
+        goto out;
+    for (int i = 0; i < eh.e_shnum; i++) {
+        const ElfW(Shdr) &sh = shdrs[i];
+        if (sh.sh_name < shdrs[eh.e_shstrndx].sh_size &&
+            (sh.sh_flags & SHF_WRITE) &&
+            !strncmp(names + sh.sh_name, "__sancov_", 9))
+            restore_skip(s, s->base + sh.sh_addr,
+                         s->base + sh.sh_addr + sh.sh_size);
+    }
+out:
+    free(names);
+    free(shdrs);
+    close(fd);
+}
+
+static void restore_add_segments(struct restore_search *s,
+                                 const ElfW(Phdr) *phdr, int phnum)
+{
+    for (int i = 0; i < phnum; i++) {
+        const ElfW(Phdr) &ph = phdr[i];
+        uintptr_t begin = s->base + ph.p_vaddr;
+        if (ph.p_type == PT_GNU_RELRO)
+            restore_skip(s, begin, begin + ph.p_memsz);
+        if (ph.p_type != PT_LOAD || !(ph.p_flags & PF_W) ||
+            s->num_writable == RESTORE_MAX_RANGES)
+            continue;
+        s->begin[s->num_writable] = restore_page_down(begin);
+        s->end[s->num_writable++] = restore_page_up(begin + ph.p_memsz);
+    }
+    s->found = 1;
+}
+
+static int restore_find_segments(struct dl_phdr_info *info, size_t, void *arg)
+{
+    struct restore_search *s = (struct restore_search *)arg;
+    if (info->dlpi_addr != s->base || strcmp(info->dlpi_name, s->path))
+        return 0;
+    restore_add_segments(s, info->dlpi_phdr, info->dlpi_phnum);
+    return 1;
+}
+
+static void restore_add(struct restore_image *img, uintptr_t begin,
+                        uintptr_t end)
+{
+    if (begin >= end || img->num_ranges == RESTORE_MAX_RANGES)
+        return;
+    struct restore_range *r = &img->ranges[img->num_ranges++];
+    r->addr = (uint8_t *)begin;
+    r->size = end - begin;
+    r->copy = (uint8_t *)malloc(r->size);
+    memcpy(r->copy, r->addr, r->size);
+    img->pages += r->size / restore_page_size();
+}
+
+// Records the writable segments of the library loaded with handle. Returns
+// NULL if it cannot find them.
+static struct restore_image *restore_record(void *handle)
+{
+    struct link_map *map;
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &map))
+        return NULL;
+    restore_open();
+    struct restore_search s;
+    memset(&s, 0, sizeof(s));
+    s.base = map->l_addr;
+    s.path = map->l_name;
+    dl_iterate_phdr(restore_find_segments, &s);
+    // dl_iterate_phdr() only sees the namespace of its caller, not those of
+    // isolated libraries, whose first segment maps their ELF header.
+    const ElfW(Ehdr) *eh = (const ElfW(Ehdr) *)map->l_addr;
+    if (!s.found && eh && !memcmp(eh->e_ident, ELFMAG, SELFMAG))
+        restore_add_segments(
+            &s, (const ElfW(Phdr) *)(map->l_addr + eh->e_phoff), eh->e_phnum);
+    if (!s.found)
+        return NULL;
+    restore_skip_sancov(&s);
+
+    struct restore_image *img =
+        (struct restore_image *)calloc(1, sizeof(*img));
+    size_t page = restore_page_size(), max_pages = 0;
+    for (int i = 0; i < s.num_writable; i++) {
+        // The runs of pages of the segment that are not skipped.
+        uintptr_t begin = s.begin[i];
+        for (uintptr_t addr = s.begin[i]; addr <= s.end[i]; addr += page) {
+            int skipped = addr == s.end[i];
+            for (int j = 0; j < s.num_skipped && !skipped; j++)
+                skipped = addr >= s.skip_begin[j] && addr < s.skip_end[j];
+            if (!skipped)
+                continue;
+            if (addr - begin > max_pages * page)
+                max_pages = (addr - begin) / page;
+            restore_add(img, begin, addr);
+            begin = addr + page;
+        }
+    }
+    img->flags = (uint64_t *)calloc(max_pages ? max_pages : 1,
+                                    sizeof(uint64_t));
+    return img;
+}
+
+static void restore_free(struct restore_image *img)
+{
+    if (!img)
+        return;
+    for (int i = 0; i < img->num_ranges; i++)
+        free(img->ranges[i].copy);
+    free(img->flags);
+    free(img);
+}
+
+// Copies back the pages written since the last restore_clear() and returns
+// how many.
+static size_t restore_dirty(struct restore_image *img)
+{
+    size_t page = restore_page_size(), restored = 0;
+    for (int i = 0; i < img->num_ranges; i++) {
+        struct restore_range *r = &img->ranges[i];
+        size_t pages = r->size / page;
+        if (restore_soft_dirty) {
+            off_t off = (uintptr_t)r->addr / page * sizeof(uint64_t);
+            ssize_t len = pages * sizeof(uint64_t);
+            if (pread(restore_pagemap_fd, img->flags, len, off) != len)
+                memset(img->flags, 0xff, len);
+        }
+        for (size_t p = 0; p < pages; p++) {
+            uint8_t *addr = r->addr + p * page;
+            const uint8_t *copy = r->copy + p * page;
+            if (restore_soft_dirty ? !(img->flags[p] & PAGEMAP_SOFT_DIRTY)
+                                   : !memcmp(addr, copy, page))
+                continue;
+            memcpy(addr, copy, page);
+            restored++;
+        }
+    }
+    img->restored += restored;
+    return restored;
+}
+
+#endif  //__RESTORE_H__
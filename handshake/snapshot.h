@@ -0,0 +1,234 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "common.h"
+#include "fast_crypto.h"
+
+#ifdef CONFIG_SNAPSHOT
+#include <sys/mman.h>
+
+/**
+ * Snapshots of a server's handshake state (CONFIG_SNAPSHOT).
+ *
+ * While a snapshot is being built or replayed, the library allocates from an
+ * arena: a mapping at a fixed address, carved out front to back and never
+ * reused. The state after the first flight of a multi-flight input (see
+ * common.h) lives there, SSL object and memory BIOs included, so a copy of
+ * the arena's used part is a snapshot of it. Later inputs with the
+ * same first flight copy the snapshot back and only feed the rest; an input
+ * with another first flight starts the arena over.
+ *
+ * Memory the library allocated before the first snapshot (its context and
+ * global tables) stays on the heap. Lazily allocated global state must be
+ * created before then too, or it would point into the arena once that is
+ * rolled back: the wrappers turn off the session cache, use their private
+ * key once and run inputs without a snapshot until one has reached the
+ * second flight. Allocations from the arena bypass the heap checks of ASan.
+ *
+ * A library that does not let the wrapper replace its allocators never
+ * calls snapshot_init() and replays every flight.
+ */
+#define SNAPSHOT_ARENA_SIZE     (64 << 20)
+#define SNAPSHOT_MAX_PREFIX     (1 << 16)
+#define SNAPSHOT_ALIGN          16
+
+struct snapshot_arena {
+    uint8_t *base;
+    size_t used;
+    int active;         // allocations go to the arena
+    int overflowed;     // it ran out since the snapshot was started
+    uint8_t *saved;     // base[0, saved_used) when the snapshot was taken
+    size_t saved_used, saved_cap;
+    uint8_t prefix[SNAPSHOT_MAX_PREFIX];
+    uint32_t prefix_size;  // 0 if there is no snapshot
+};
+
+static struct snapshot_arena gl_arena;
+
+static inline int in_arena(const void *ptr)
+{
+    return gl_arena.base && (const uint8_t *)ptr >= gl_arena.base &&
+           (const uint8_t *)ptr < gl_arena.base + SNAPSHOT_ARENA_SIZE;
+}
+
+// Every block starts with its size, so that realloc() knows what to copy.
+static inline void *arena_malloc(size_t size)
+{
+    if (!gl_arena.active)
+        return malloc(size);
+    size_t need = (size + 2 * SNAPSHOT_ALIGN - 1) & ~(size_t)(SNAPSHOT_ALIGN - 1);
+    if (gl_arena.used + need > SNAPSHOT_ARENA_SIZE) {
+        gl_arena.overflowed = 1;
+        return malloc(size);
+    }
+    uint8_t *block = gl_arena.base + gl_arena.used;
+    gl_arena.used += need;
+    *(size_t *)block = size;
+    return block + SNAPSHOT_ALIGN;
+}
+
+static inline void arena_free(void *ptr)
+{
+    if (!in_arena(ptr))
+        free(ptr);
+}
+
+static inline void *arena_realloc(void *ptr, size_t size)
+{
+    if (!in_arena(ptr))
+        return ptr || !gl_arena.active ? realloc(ptr, size) : arena_malloc(size);
+    size_t old = *(size_t *)((uint8_t *)ptr - SNAPSHOT_ALIGN);
+    void *res = arena_malloc(size);
+    if (res)
+        memcpy(res, ptr, old < size ? old : size);
+    return res;
+}
+
+// Returns 0 if the arena cannot be mapped.
+static inline int snapshot_init()
+{
+    void *base = mmap(NULL, SNAPSHOT_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+        return 0;
+    gl_arena.base = (uint8_t *)base;
+    return 1;
+}
+
+static inline int snapshot_enabled()
+{
+    return gl_arena.base != NULL;
+}
+
+static inline int snapshot_matches(const uint8_t *prefix, uint32_t size)
+{
+    return gl_arena.prefix_size && gl_arena.prefix_size == size &&
+           !memcmp(gl_arena.prefix, prefix, size);
+}
+
+// Drops the snapshot; what the library allocates now is part of the next.
+static inline void snapshot_begin()
+{
+    gl_arena.used = 0;
+    gl_arena.prefix_size = 0;
+    gl_arena.overflowed = 0;
+    gl_arena.active = 1;
+}
+
+// Saves the arena as the state after prefix. Without room for it, or after
+// the arena overflowed to the heap, there is no snapshot.
+static inline void snapshot_take(const uint8_t *prefix, uint32_t size)
+{
+    if (gl_arena.overflowed || size > SNAPSHOT_MAX_PREFIX)
+        return;
+    if (gl_arena.used > gl_arena.saved_cap) {
+        free(gl_arena.saved);
+        gl_arena.saved = (uint8_t *)malloc(gl_arena.used);
+        gl_arena.saved_cap = gl_arena.saved ? gl_arena.used : 0;
+        if (!gl_arena.saved)
+            return;
+    }
+    memcpy(gl_arena.saved, gl_arena.base, gl_arena.used);
+    gl_arena.saved_used = gl_arena.used;
+    memcpy(gl_arena.prefix, prefix, size);
+    gl_arena.prefix_size = size;
+}
+
+// Puts the arena back to the snapshot; what the last input allocated after
+// it is gone.
+static inline void snapshot_restore()
+{
+    memcpy(gl_arena.base, gl_arena.saved, gl_arena.saved_used);
+    gl_arena.used = gl_arena.saved_used;
+    gl_arena.active = 1;
+}
+
+// Allocations go to the heap again until the next input.
+static inline void snapshot_end()
+{
+    gl_arena.active = 0;
+}
+
+#else
+static inline int snapshot_enabled() { return 0; }
+static inline int snapshot_matches(const uint8_t *, uint32_t) { return 0; }
+static inline void snapshot_begin() {}
+static inline void snapshot_take(const uint8_t *, uint32_t) {}
+static inline void snapshot_restore() {}
+static inline void snapshot_end() {}
+#endif  // CONFIG_SNAPSHOT
+
+#ifdef CONFIG_MULTI_FLIGHT
+/**
+ * Feeds the flights of a multi-flight input (see common.h) to a server of
+ * Ops and returns the signature of its last reply. An input with the first
+ * flight of the snapshot starts from the snapshot and feeds only the rest;
+ * without snapshots every input replays its first flight.
+ */
+template <class Ops>
+static int HandshakeFlights(typename Ops::Ctx *sctx, const uint8_t *Data,
+                            uint32_t Size, struct tls_output *out)
+{
+    // The server after the first flight of the last snapshot, its reply and
+    // the state of the CONFIG_FAST_CRYPTO generator.
+    static typename Ops::Server *snap_server;
+    static typename Ops::Bio *snap_sinbio, *snap_soutbio;
+    static int snap_ret;
+    static uint64_t snap_rand;
+    // Inputs run from the heap until one has reached the second flight, so
+    // that what the library creates lazily on the way exists before the
+    // first snapshot.
+    static int warmed_up = 0;
+    uint32_t first = first_flight_size(Data, Size);
+    int snap = snapshot_enabled() && warmed_up;
+    typename Ops::Server *server;
+    typename Ops::Bio *sinbio, *soutbio;
+    int ret;
+    if (snap && snapshot_matches(Data, first)) {
+        snapshot_restore();
+        server = snap_server;
+        sinbio = snap_sinbio;
+        soutbio = snap_soutbio;
+        ret = snap_ret;
+        gl_fast_rand = snap_rand;
+    } else {
+        if (snap)
+            snapshot_begin();
+#ifdef CONFIG_REUSE_SSL
+        if (!snap)
+            server = AcquireServer<Ops>(sctx, &sinbio, &soutbio);
+        else
+#endif
+            server = NewServer<Ops>(sctx, &sinbio, &soutbio);
+        Ops::Accept(server);
+        ret = FeedFlight<Ops>(server, sinbio, soutbio, Data, first);
+        if (snap) {
+            snap_server = server;
+            snap_sinbio = sinbio;
+            snap_soutbio = soutbio;
+            snap_ret = ret;
+            snap_rand = gl_fast_rand;
+            snapshot_take(Data, first);
+        }
+    }
+    if (is_handshake_verdict(ret) && first < Size) {
+        ret = FeedFlight<Ops>(server, sinbio, soutbio, Data + first,
+                              Size - first) | SECOND_FLIGHT_VERDICT;
+        warmed_up = 1;
+    }
+    const uint8_t *reply;
+    long len = Ops::Reply(soutbio, &reply);
+    fill_output(out, reply, len);
+    if (snap) {
+        // The server stays in the arena, which the next input rolls back.
+        snapshot_end();
+        return ret;
+    }
+#ifndef CONFIG_REUSE_SSL
+    ReleaseServer<Ops>(server);
+#endif
+    return ret;
+}
+#endif  // CONFIG_MULTI_FLIGHT
+
+#endif  //__SNAPSHOT_H__
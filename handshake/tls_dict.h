@@ -0,0 +1,100 @@
+#ifndef __TLS_DICT_H__
+#define __TLS_DICT_H__
+
+#include <stdint.h>
+
+// Values of the enumerated ClientHello fields of tls-definitions.h, as they
+// appear on the wire, for the dictionary the byte mutators draw from (see
+// LLVMFuzzerCustomDictionary in diff.cpp). The values are those of the IANA
+// TLS registries that the definitions are based on. Every value is listed
+// once, under the first field it belongs to, so that none gets more weight.
+
+#define TLS_U16(v) { (uint8_t)((v) >> 8), (uint8_t)(v) }
+
+// Two-byte fields: protocol versions, cipher suites, extension types,
+// named groups and signature schemes.
+static constexpr uint8_t kTlsDictU16[][2] = {
+  // ProtocolVersion
+  TLS_U16(0x0300), TLS_U16(0x0301), TLS_U16(0x0302), TLS_U16(0x0303),
+  TLS_U16(0x0304), TLS_U16(0xfeff), TLS_U16(0xfefd),
+
+  // CipherSuite
+  TLS_U16(0x0000),  // TLS_NULL_WITH_NULL_NULL, server_name
+  TLS_U16(0x0004),  // TLS_RSA_WITH_RC4_128_MD5
+  TLS_U16(0x0005),  // TLS_RSA_WITH_RC4_128_SHA, status_request
+  TLS_U16(0x000a),  // TLS_RSA_WITH_3DES_EDE_CBC_SHA, supported_groups
+  TLS_U16(0x002f),  // TLS_RSA_WITH_AES_128_CBC_SHA
+  TLS_U16(0x0033),  // TLS_DHE_RSA_WITH_AES_128_CBC_SHA, key_share
+  TLS_U16(0x0035),  // TLS_RSA_WITH_AES_256_CBC_SHA
+  TLS_U16(0x0039),  // TLS_DHE_RSA_WITH_AES_256_CBC_SHA
+  TLS_U16(0x003c),  // TLS_RSA_WITH_AES_128_CBC_SHA256
+  TLS_U16(0x003d),  // TLS_RSA_WITH_AES_256_CBC_SHA256
+  TLS_U16(0x0067),  // TLS_DHE_RSA_WITH_AES_128_CBC_SHA256
+  TLS_U16(0x006b),  // TLS_DHE_RSA_WITH_AES_256_CBC_SHA256
+  TLS_U16(0x009c),  // TLS_RSA_WITH_AES_128_GCM_SHA256
+  TLS_U16(0x009d),  // TLS_RSA_WITH_AES_256_GCM_SHA384
+  TLS_U16(0x009e),  // TLS_DHE_RSA_WITH_AES_128_GCM_SHA256
+  TLS_U16(0x009f),  // TLS_DHE_RSA_WITH_AES_256_GCM_SHA384
+  TLS_U16(0x00ff),  // TLS_EMPTY_RENEGOTIATION_INFO_SCSV
+  TLS_U16(0x1301),  // TLS_AES_128_GCM_SHA256
+  TLS_U16(0x1302),  // TLS_AES_256_GCM_SHA384
+  TLS_U16(0x1303),  // TLS_CHACHA20_POLY1305_SHA256
+  TLS_U16(0x5600),  // TLS_FALLBACK_SCSV
+  TLS_U16(0xc009),  // TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA
+  TLS_U16(0xc00a),  // TLS_ECDHE_ECDSA_WITH_AES_256_CBC_SHA
+  TLS_U16(0xc013),  // TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA
+  TLS_U16(0xc014),  // TLS_ECDHE_RSA_WITH_AES_256_CBC_SHA
+  TLS_U16(0xc023),  // TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA256
+  TLS_U16(0xc027),  // TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA256
+  TLS_U16(0xc02b),  // TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256
+  TLS_U16(0xc02c),  // TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384
+  TLS_U16(0xc02f),  // TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256
+  TLS_U16(0xc030),  // TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384
+  TLS_U16(0xcca8),  // TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256
+  TLS_U16(0xcca9),  // TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256
+
+  // ExtensionType
+  TLS_U16(1),      // max_fragment_length
+  TLS_U16(11),     // ec_point_formats
+  TLS_U16(13),     // signature_algorithms
+  TLS_U16(15),     // heartbeat
+  TLS_U16(16),     // application_layer_protocol_negotiation
+  TLS_U16(18),     // signed_certificate_timestamp
+  TLS_U16(21),     // padding
+  TLS_U16(22),     // encrypt_then_mac
+  TLS_U16(23),     // extended_master_secret, secp256r1
+  TLS_U16(35),     // session_ticket
+  TLS_U16(41),     // pre_shared_key
+  TLS_U16(42),     // early_data
+  TLS_U16(43),     // supported_versions
+  TLS_U16(44),     // cookie
+  TLS_U16(45),     // psk_key_exchange_modes
+  TLS_U16(0xff01), // renegotiation_info
+
+  // NamedGroup
+  TLS_U16(0x0018), TLS_U16(0x0019), TLS_U16(0x001d),
+  TLS_U16(0x001e), TLS_U16(0x0100),
+
+  // SignatureScheme
+  TLS_U16(0x0401), TLS_U16(0x0501), TLS_U16(0x0601), TLS_U16(0x0403),
+  TLS_U16(0x0503), TLS_U16(0x0603), TLS_U16(0x0804), TLS_U16(0x0805),
+  TLS_U16(0x0806), TLS_U16(0x0807), TLS_U16(0x0201), TLS_U16(0x0203),
+};
+
+// One-byte fields: content and handshake types, compression methods and
+// alert levels and descriptions.
+static constexpr uint8_t kTlsDictU8[] = {
+  // ContentType; 20 is also the finished HandshakeType
+  20, 21, 22, 23, 24,
+  // HandshakeType; 1 is also the DEFLATE CompressionMethod and the warning
+  // AlertLevel, 2 the fatal one
+  1, 2, 4, 8, 11, 12, 13, 14, 15, 16,
+  // CompressionMethod
+  0,
+  // AlertDescription
+  10, 40, 42, 47, 50, 51, 70, 71, 80, 86, 90, 109, 110, 112, 120,
+};
+
+#undef TLS_U16
+
+#endif
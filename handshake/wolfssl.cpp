@@ -1,4 +1,6 @@
 #include "wolfssl.h"
+#include "fast_crypto.h"
+#include "snapshot.h"
 
 #include <assert.h>
 #include <wolfssl/options.h>
@@ -9,7 +11,71 @@
 #include <stdint.h>
 #include <stddef.h>
 
-WOLFSSL_CTX *Init() {
+#ifdef CONFIG_FAST_CRYPTO
+// wolfSSL's randomness, for a wolfSSL configured with
+// CFLAGS=-DCUSTOM_RAND_GENERATE_BLOCK=fuzz_rand_block.
+extern "C"
+LIB_EXPORT
+int fuzz_rand_block(unsigned char *out, unsigned int size)
+{
+    fast_rand_bytes(out, size);
+    return 0;
+}
+
+// For a wolfSSL configured with --enable-pkcallbacks. The premaster
+// secret is decrypted in place; signatures stay real.
+static int StubRsaDec(WOLFSSL *ssl, byte *in, word32 inSz, byte **out,
+                      const byte *keyDer, word32 keySz, void *ctx)
+{
+    if (inSz < FAST_CRYPTO_PREMASTER)
+        return -1;
+    *out = in + inSz - FAST_CRYPTO_PREMASTER;
+    return FAST_CRYPTO_PREMASTER;
+}
+#endif
+
+// The binding of the server in common.h to wolfSSL.
+struct ServerOps {
+    typedef WOLFSSL_CTX Ctx;
+    typedef WOLFSSL Server;
+    typedef WOLFSSL_BIO Bio;
+
+    static Server *New(Ctx *sctx) { return wolfSSL_new(sctx); }
+    static void Free(Server *server) { wolfSSL_free(server); }
+    static void Clear(Server *server) { wolfSSL_clear(server); }
+    static Bio *NewBio() { return wolfSSL_BIO_new(wolfSSL_BIO_s_mem()); }
+    static void SetBio(Server *server, Bio *in, Bio *out)
+    {
+        wolfSSL_set_bio(server, in, out);
+    }
+    static void ResetBio(Bio *bio) { wolfSSL_BIO_reset(bio); }
+    static void Accept(Server *server) { wolfSSL_set_accept_state(server); }
+    static void DoHandshake(Server *server)
+    {
+        wolfSSL_SSL_do_handshake(server);
+    }
+    static void Write(Bio *bio, const uint8_t *data, uint32_t size)
+    {
+        wolfSSL_BIO_write(bio, data, size);
+    }
+    static long Reply(Bio *bio, const uint8_t **data)
+    {
+        char *p = NULL;
+        long len = wolfSSL_BIO_get_mem_data(bio, &p);
+        *data = (const uint8_t *)p;
+        return len;
+    }
+    static const char *Name() { return "wolfssl"; }
+    static Ctx *Init(const struct tls_credentials *creds);
+    static void ResetRandom() { fast_rand_reset(); }
+};
+
+WOLFSSL_CTX *ServerOps::Init(const struct tls_credentials *creds) {
+#ifdef CONFIG_SNAPSHOT
+    if (wolfSSL_SetAllocators(arena_malloc, arena_free, arena_realloc) ||
+        !snapshot_init())
+        fprintf(stderr, "wolfssl: no snapshots, replaying every flight\n");
+#endif
     wolfSSL_Init(); 
     //wolfSSL_library_init ();
     WOLFSSL_CTX *sctx;
@@ -17,7 +83,13 @@ WOLFSSL_CTX *Init() {
     wolfSSL_CTX_set_verify(sctx, SSL_VERIFY_NONE,0);
     //assert(SSL_CTX_use_certificate_file(sctx, "runtime/server.pem",SSL_FILETYPE_PEM));
     
-    int ret = wolfSSL_CTX_use_certificate_file(sctx, "./runtime/server.pem",SSL_FILETYPE_PEM);
+    int ret;
+    if (creds)
+        ret = wolfSSL_CTX_use_certificate_buffer(sctx, creds->cert,
+                                                 creds->cert_size,
+                                                 WOLFSSL_FILETYPE_ASN1);
+    else
+        ret = wolfSSL_CTX_use_certificate_file(sctx, SERVER_CERT_FILE,SSL_FILETYPE_PEM);
     if (WOLFSSL_SUCCESS != ret)
     {
 	char buffer[80];
@@ -25,6 +97,8 @@ WOLFSSL_CTX *Init() {
         printf("Cannot use Certificate File:%d", ret);
         exit(1);
     }
+    // wolfSSL refuses RSA keys under 1024 bits, so it does not use the
+    // shared SERVER_KEY_FILE.
     ret = wolfSSL_CTX_use_PrivateKey_file(sctx, "./runtime/rsa_private_key.pem",WOLFSSL_FILETYPE_PEM);
     if(ret !=WOLFSSL_SUCCESS)
     {
@@ -33,57 +107,17 @@ WOLFSSL_CTX *Init() {
 	printf("Cannot use Certificate File:%s",buffer);
         exit(1);
     }
+#if defined(CONFIG_FAST_CRYPTO) && defined(HAVE_PK_CALLBACKS)
+    wolfSSL_CTX_SetRsaDecCb(sctx, StubRsaDec);
+#endif
+#ifdef CONFIG_SNAPSHOT
+    wolfSSL_CTX_set_session_cache_mode(sctx, WOLFSSL_SESS_CACHE_OFF);
+#endif
     return sctx;
 }
 
-extern "C"
-LIB_EXPORT
-int do_handshake_mem(const uint8_t *Data, uint32_t Size)
-{
-    static WOLFSSL_CTX *sctx = Init();
-    uint8_t *response = new uint8_t[8];
-    int composite_ret;
-    memset(response,0,8*sizeof(uint8_t));
-    WOLFSSL *server = wolfSSL_new(sctx);
-    WOLFSSL_BIO *sinbio;
-    sinbio = wolfSSL_BIO_new(wolfSSL_BIO_s_mem());
-    WOLFSSL_BIO *soutbio = wolfSSL_BIO_new(wolfSSL_BIO_s_mem());
-    
-    wolfSSL_set_bio(server, sinbio, soutbio);
-    wolfSSL_set_accept_state(server);
-    //SSL_accept(server);
-    wolfSSL_BIO_write(sinbio, Data, Size);
-    int r = wolfSSL_SSL_do_handshake(server);
-
-    wolfSSL_BIO_read(soutbio,response,8*sizeof(uint8_t));
-    
-    if(response[0]==0x16)
-    {        
-        DBG("[wolfssl] [handshake: HS/%02x/%02x%02x]\n",response[5],response[1],response[2]);	        
-	//composite_ret = 0;
-    }
-    else if(response[0]==0x15)
-    {
-        DBG("[wolfssl] [Alert: AL/%02x/%02x%02x]\n",response[6],response[1],response[2]);
-	//composite_ret = response[6];
-    }
-    else
-    {
-	DBG("[wolfssl] [No output: %02x%02x%02x]\n",response[0],response[1],response[2]);
-	//composite_ret = 1;
-    }
-    wolfSSL_free(server);    
-    //SSL_CTX_free(sctx);
-    composite_ret = response[0];
-
-    
-    if(composite_ret==0)
-	composite_ret = 21;
-    else if(composite_ret==22)
-	composite_ret = 0;
-    delete [] response;
-    return composite_ret;
-}
+// The binding of the server in common.h to wolfSSL.
+HANDSHAKE_ENTRY_POINTS(ServerOps)
 
 extern "C"
 LIB_EXPORT
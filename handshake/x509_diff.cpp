@@ -0,0 +1,147 @@
+#include <assert.h>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+#include "common.h"
+#include "func.h"
+
+// include generic structures for diff-based fuzzing
+#include "diff.h"
+#include "registry.h"
+
+// libFuzzer's diff mode over certificate chains: the implementations of the
+// registry, loaded with FN_VERIFY_CERT as their entry point, verify every
+// mutated chain straight from the input buffer against the CA store that
+// each of them built once in LLVMFuzzerInitialize(). The chains are PEM, as
+// for afl_target.cpp; the return values are those of cert_verdict().
+
+// The CA certificates, from --x509_ca=<file>
+static const char *gl_ca_file = CA_STORE_FILE;
+
+// The CA file, kept for the libraries that are reloaded later
+static std::vector<uint8_t> gl_ca;
+
+// Returns 0 on success.
+static int init_ca_store(struct tls_impl *impl) {
+  if (gl_ca.empty())
+    return 0;
+  init_ca_fp_t init_ca = (init_ca_fp_t)dlsym(impl->handle, FN_INIT_CA_STORE);
+  if (!init_ca) {
+    fprintf(stderr, "%s: no %s, loads its CA store on the first "
+            "verification\n", impl->name, FN_INIT_CA_STORE);
+    return 0;
+  }
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (init_ca(gl_ca.data(), (uint32_t)gl_ca.size())) {
+    fprintf(stderr, "ERROR: %s cannot load the CA store %s\n", impl->name,
+            gl_ca_file);
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  impl->init_ms = (end.tv_sec - start.tv_sec) * 1e3 +
+                  (end.tv_nsec - start.tv_nsec) / 1e6;
+  fprintf(stderr, "%s: loaded the CA store in %.3f ms\n", impl->name,
+          impl->init_ms);
+  return 0;
+}
+
+// Builds the CA store of every library that exports FN_INIT_CA_STORE, from
+// one copy of the CA file, so that no verification re-reads it
+static void init_ca_stores() {
+  uint8_t *ca = NULL;
+  size_t ca_size = read_file(gl_ca_file, &ca);
+  if (!ca_size) {
+    fprintf(stderr, "WARNING: cannot read %s, the libraries load their CA "
+            "store on their first verification\n", gl_ca_file);
+    return;
+  }
+  gl_ca.assign(ca, ca + ca_size);
+  free(ca);
+  for (size_t i = 0; i < 2 * gl_num_impls; i++) {
+    struct tls_impl *impl = i < gl_num_impls ? &gl_impls[i]
+                                             : gl_impls[i - gl_num_impls].fast;
+    if (impl && init_ca_store(impl))
+      exit(1);
+  }
+}
+
+// mbedTLS parses a PEM chain only with its terminating NUL, which it counts
+// in the size. Its chains are copied into gl_chain, which keeps its capacity
+// from one input to the next; one per thread for -diff_threads.
+static bool gl_nul_terminated[MAX_IMPLS];
+static thread_local std::vector<uint8_t> gl_chain;
+
+static void init_impls(const char *config) {
+  if (gl_num_impls)
+    return;
+  load_impls(config, FN_VERIFY_CERT);
+  for (size_t i = 0; i < gl_num_impls; i++) {
+    if (gl_impls[i].live) {
+      fprintf(stderr, "ERROR: %s: live servers cannot verify chains\n",
+              gl_impls[i].name);
+      exit(1);
+    }
+    gl_nul_terminated[i] = !strcmp(gl_impls[i].name, "mbedtls");
+  }
+  init_ca_stores();
+}
+
+extern "C" int LLVMFuzzerInitialize(int *argc, char ***argv) {
+  const char *config = NULL;
+  const char *flag = "--tls_impls=";
+  const char *ca_flag = "--x509_ca=";
+  for (int i = 1; i < *argc; i++) {
+    if (!strncmp((*argv)[i], flag, strlen(flag)))
+      config = (*argv)[i] + strlen(flag);
+    if (!strncmp((*argv)[i], ca_flag, strlen(ca_flag)))
+      gl_ca_file = (*argv)[i] + strlen(ca_flag);
+  }
+  init_impls(config);
+  return 0;
+}
+
+// A build that LLVMFuzzerCustomReload() loaded again builds its CA store
+// anew. Returns 0 on success.
+static int init_reloaded_impl(struct tls_impl *impl) {
+  return init_ca_store(impl);
+}
+
+UserCallbacks callback_cont = { NULL, 0 };
+
+// impl->do_handshake is the resolved FN_VERIFY_CERT
+static int run_impl(size_t i, struct tls_impl *impl, const uint8_t *Data,
+                    size_t Size) {
+  if (!gl_nul_terminated[i])
+    return cert_verdict(impl->do_handshake(Data, Size));
+  gl_chain.assign(Data, Data + Size);
+  gl_chain.push_back('\0');
+  return cert_verdict(impl->do_handshake(gl_chain.data(), gl_chain.size()));
+}
+
+static UserCallbacks fast_callback_cont = { NULL, 0 };
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+  return call_impl<0>(Data, Size);
+}
+
+extern "C" UserCallbacks *LLVMFuzzerCustomCallbacks() {
+  init_impls(NULL);
+  callback_cont.callbacks = gl_callbacks;
+  callback_cont.size = gl_num_impls;
+  return &callback_cont;
+}
+
+// NULL unless some implementation has a fast build
+extern "C" UserCallbacks *LLVMFuzzerCustomFastCallbacks() {
+  init_impls(NULL);
+  for (size_t i = 0; i < gl_num_impls; i++) {
+    if (!gl_impls[i].fast)
+      continue;
+    fast_callback_cont.callbacks = gl_fast_callbacks;
+    fast_callback_cont.size = gl_num_impls;
+    return &fast_callback_cont;
+  }
+  return NULL;
+}